@@ -19,14 +19,25 @@
 #ifndef COKE_BENCH_COMMON_H
 #define COKE_BENCH_COMMON_H
 
+#include <atomic>
 #include <chrono>
 #include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
 #include <iostream>
 #include <iomanip>
+#include <new>
+#include <numeric>
+#include <string>
 #include <vector>
 
 #include "coke/tools/option_parser.h"
 #include "coke/basic_awaiter.h"
+#include "coke/global.h"
+#include "coke/latency_histogram.h"
+#include "coke/task.h"
 #include "workflow/WFTaskFactory.h"
 
 class RepeaterAwaiter : public coke::BasicAwaiter<void> {
@@ -126,4 +137,241 @@ int parse_args(coke::OptionParser &args,
     return 1;
 }
 
+// The shared harness of benchmarks. A benchmark is a trial coroutine that is
+// run `warmup` times without measuring, and then repeated `times` times or
+// until `max_secs` seconds are used. The results are printed as a table, and
+// are also written to `json` if it is given, so that they can be compared
+// across versions.
+
+struct BenchOptions {
+    int warmup      = 1;
+    int times       = 1;
+    int max_secs    = 5;
+    std::string json;
+};
+
+inline BenchOptions bench_options;
+
+// Latency of single operations in nanoseconds, see BenchOpTimer
+inline coke::LatencyHistogram bench_op_latency;
+
+// Allocations of the process, only counted when BENCH_COUNT_ALLOCATIONS is
+// defined before this file is included.
+alignas(64) inline std::atomic<long long> bench_alloc_calls;
+
+#ifdef BENCH_COUNT_ALLOCATIONS
+void *operator new(std::size_t n) {
+    bench_alloc_calls.fetch_add(1, std::memory_order_relaxed);
+
+    if (void *p = std::malloc(n ? n : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete(void *p, std::size_t) noexcept { std::free(p); }
+#endif
+
+/**
+ * @brief Record the time from construction to destruction into
+ *        bench_op_latency, the benchmarks which know their operations create
+ *        one for each operation.
+*/
+class BenchOpTimer {
+public:
+    BenchOpTimer() : start(std::chrono::steady_clock::now()) { }
+
+    ~BenchOpTimer() {
+        auto cost = std::chrono::steady_clock::now() - start;
+        auto nsec = std::chrono::duration_cast<std::chrono::nanoseconds>(cost);
+        bench_op_latency.record((uint64_t)nsec.count());
+    }
+
+private:
+    std::chrono::steady_clock::time_point start;
+};
+
+struct BenchResult {
+    std::string name;
+    int trials{0};
+    long long ops{0};
+    long long total_ms{0};
+    double mean_ms{0};
+    double stddev_ms{0};
+    double ops_per_sec{0};
+
+    // Negative if allocations are not counted
+    double allocs_per_op{-1};
+
+    // In nanoseconds, all zero if no operation is timed
+    uint64_t timed_ops{0};
+    uint64_t p50{0};
+    uint64_t p99{0};
+    uint64_t p999{0};
+    uint64_t max{0};
+};
+
+inline std::vector<BenchResult> bench_results;
+
+/**
+ * @brief Add --warmup, --times, --max-secs(-m) and --json to `args`.
+*/
+inline void add_bench_options(coke::OptionParser &args) {
+    args.add_integer(bench_options.max_secs, 'm', "max-secs")
+        .set_default(5)
+        .set_description("Max seconds for each benchmark");
+    args.add_integer(bench_options.times, coke::NULL_SHORT_NAME, "times")
+        .set_default(1)
+        .set_description("The number of times each benchmark run");
+    args.add_integer(bench_options.warmup, coke::NULL_SHORT_NAME, "warmup")
+        .set_default(1)
+        .set_description("The number of times each benchmark run before "
+                         "measuring");
+    args.add_string(bench_options.json, coke::NULL_SHORT_NAME, "json")
+        .set_description("Write the results to this file in json");
+}
+
+/**
+ * @brief Run a benchmark named `name`. `ops` returns the number of operations
+ *        done by the last trial, and `allocs` counts the allocations if it is
+ *        not nullptr, such as &bench_alloc_calls.
+*/
+inline coke::Task<BenchResult>
+run_benchmark(const char *name, std::function<coke::Task<>()> trial,
+              std::function<long long()> ops,
+              std::atomic<long long> *allocs = nullptr) {
+    BenchResult r;
+    std::vector<long long> costs;
+    long long start;
+
+    r.name = name;
+
+    for (int i = 0; i < bench_options.warmup; i++)
+        co_await trial();
+
+    bench_op_latency.reset();
+    if (allocs)
+        allocs->store(0);
+
+    for (int i = 0; i < bench_options.times; i++) {
+        start = current_usec();
+        co_await trial();
+        costs.push_back(current_usec() - start);
+
+        r.trials++;
+        r.ops += ops();
+        r.total_ms += costs.back();
+
+        if (r.total_ms >= bench_options.max_secs * 1000000LL)
+            break;
+    }
+
+    double mean, stddev;
+    data_distribution(costs, mean, stddev);
+
+    r.mean_ms = mean / 1000;
+    r.stddev_ms = stddev / 1000;
+    r.ops_per_sec = 1.0e6 * r.ops / ((double)r.total_ms + 1e-9);
+    r.total_ms /= 1000;
+
+    if (allocs && r.ops > 0)
+        r.allocs_per_op = (double)allocs->load() / (double)r.ops;
+
+    coke::HistogramSnapshot snap = bench_op_latency.snapshot();
+    if (snap.count > 0) {
+        r.timed_ops = snap.count;
+        r.p50 = snap.percentile(0.5);
+        r.p99 = snap.percentile(0.99);
+        r.p999 = snap.percentile(0.999);
+        r.max = snap.max;
+    }
+
+    bench_results.push_back(r);
+    co_return r;
+}
+
+// The width of the columns printed by bench_header and bench_line, the first
+// one can be changed to fit the names.
+inline std::vector<int> bench_width{18, 8, 6, 8, 6, 10, 8, 8, 8, 10};
+
+inline void bench_header(std::ostream &os) {
+    table_line(os, bench_width, "name", "cost", "times", "mean(ms)",
+               "stddev", "per sec", "p50(ns)", "p99", "p999", "alloc/op");
+    delimiter(os, bench_width, '-');
+}
+
+inline void bench_line(std::ostream &os, const BenchResult &r) {
+    auto opt = [](uint64_t v) {
+        return v ? std::to_string(v) : std::string("-");
+    };
+
+    std::string allocs("-");
+    if (r.allocs_per_op >= 0) {
+        char buf[32];
+        snprintf(buf, sizeof(buf), "%.2f", r.allocs_per_op);
+        allocs.assign(buf);
+    }
+
+    table_line(os, bench_width, r.name, r.total_ms, r.trials, r.mean_ms,
+               r.stddev_ms, (long)r.ops_per_sec, opt(r.p50), opt(r.p99),
+               opt(r.p999), allocs);
+}
+
+/**
+ * @brief Write all the results to bench_options.json if it is given,
+ *        return false if the file cannot be written.
+*/
+inline bool write_bench_json(const char *benchmark) {
+    if (bench_options.json.empty())
+        return true;
+
+    std::ofstream ofs(bench_options.json);
+    if (!ofs)
+        return false;
+
+    auto quote = [](const std::string &str) {
+        std::string q("\"");
+        for (char c : str) {
+            if (c == '"' || c == '\\')
+                q.push_back('\\');
+            q.push_back(c);
+        }
+        q.push_back('"');
+        return q;
+    };
+
+    ofs << "{\"benchmark\": " << quote(benchmark)
+        << ", \"version\": " << quote(coke::COKE_VERSION_STR)
+        << ", \"results\": [";
+
+    for (std::size_t i = 0; i < bench_results.size(); i++) {
+        const BenchResult &r = bench_results[i];
+
+        ofs << (i ? ",\n  " : "\n  ")
+            << "{\"name\": " << quote(r.name)
+            << ", \"trials\": " << r.trials
+            << ", \"ops\": " << r.ops
+            << ", \"total_ms\": " << r.total_ms
+            << ", \"mean_ms\": " << r.mean_ms
+            << ", \"stddev_ms\": " << r.stddev_ms
+            << ", \"ops_per_sec\": " << r.ops_per_sec;
+
+        if (r.allocs_per_op >= 0)
+            ofs << ", \"allocs_per_op\": " << r.allocs_per_op;
+
+        if (r.timed_ops > 0) {
+            ofs << ", \"latency_ns\": {\"count\": " << r.timed_ops
+                << ", \"p50\": " << r.p50
+                << ", \"p99\": " << r.p99
+                << ", \"p999\": " << r.p999
+                << ", \"max\": " << r.max << "}";
+        }
+
+        ofs << "}";
+    }
+
+    ofs << "\n]}\n";
+    return (bool)ofs;
+}
+
 #endif // COKE_BENCH_COMMON_H
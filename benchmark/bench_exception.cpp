@@ -25,16 +25,14 @@
 
 #include "bench_common.h"
 #include "coke/coke.h"
+#include "coke/expected.h"
 
 alignas(64) std::atomic<long long> current;
-std::vector<int> width{14, 8, 6, 8, 6, 10};
 
 int total{100000};
 int concurrency = 1024;
-int max_secs_per_test = 5;
 int poller_threads = 6;
 int handler_threads = 20;
-int times = 1;
 bool yes = false;
 
 // Not sure if it's thread safe but it runs fine so far.
@@ -70,6 +68,31 @@ coke::Task<> do_test(int dpt, std::mt19937_64 mt, int p) {
     }
 }
 
+// The same as recursive_yield, but the error is returned by coke::Expected
+coke::Task<coke::Expected<void, int>>
+recursive_expected(int depth, std::mt19937_64 &mt, int p) {
+    if (depth <= 1) {
+        co_await coke::yield();
+        if (dist(mt) < p)
+            co_return coke::Unexpected(-1);
+
+        co_return coke::Expected<void, int>{};
+    }
+    else {
+        COKE_CO_TRY(r, co_await recursive_expected(depth-1, mt, p));
+        co_return r;
+    }
+}
+
+coke::Task<> do_test_expected(int dpt, std::mt19937_64 mt, int p) {
+    long long i;
+
+    while (next(i)) {
+        coke::Expected<void, int> r = co_await recursive_expected(dpt, mt, p);
+        (void)r;
+    }
+}
+
 // benchmark
 
 coke::Task<> bench_normal_yield() {
@@ -105,62 +128,53 @@ coke::Task<> bench_d1_p10() { co_await do_test(1, std::mt19937_64{}, 10); }
 coke::Task<> bench_d1_p20() { co_await do_test(1, std::mt19937_64{}, 20); }
 coke::Task<> bench_d1_p50() { co_await do_test(1, std::mt19937_64{}, 50); }
 
+coke::Task<> bench_expected_d1_p100() {
+    co_await do_test_expected(1, std::mt19937_64{}, 100);
+}
+
+coke::Task<> bench_expected_d5_p100() {
+    co_await do_test_expected(5, std::mt19937_64{}, 100);
+}
+
+coke::Task<> bench_expected_d1_p20() {
+    co_await do_test_expected(1, std::mt19937_64{}, 20);
+}
+
 coke::Task<> warm_up() { co_await coke::yield(); }
 
 using bench_func_t = coke::Task<>(*)();
 coke::Task<> do_benchmark(const char *name, bench_func_t func) {
-    int run_times = 0;
-    long long start, total_cost = 0;
-    std::vector<long long> costs;
-    double mean, stddev, tps;
-
-    for (int i = 0; i < times; i++) {
+    auto trial = [func]() -> coke::Task<> {
         std::vector<coke::Task<>> tasks;
         current = 0;
 
         for (int j = 0; j < concurrency; j++)
             tasks.emplace_back(func());
 
-        start = current_msec();
         co_await coke::async_wait(std::move(tasks));
-        costs.push_back(current_msec() - start);
-        total_cost += costs.back();
+    };
 
-        run_times++;
-
-        if (total_cost >= max_secs_per_test * 1000)
-            break;
-    }
-
-    data_distribution(costs, mean, stddev);
-    tps = 1.0e3 * current / (mean + 1e-9);
-
-    table_line(std::cout, width, name, total_cost, run_times,
-               mean, stddev, (long)tps);
+    BenchResult r = co_await run_benchmark(name, trial,
+        []() { return current.load(); });
+    bench_line(std::cout, r);
 }
 
-
 int main(int argc, char *argv[]) {
     coke::OptionParser args;
 
     args.add_integer(concurrency, 'c', "concurrency")
         .set_default(1024)
         .set_description("The number of concurrent during benchmark");
-    args.add_integer(max_secs_per_test, 'm', "max-secs")
-        .set_default(5)
-        .set_description("Max seconds for each benchmark");
     args.add_integer(total, 't', "total")
         .set_default(100000)
         .set_description("Total tasks in each benchmark");
-    args.add_integer(times, coke::NULL_SHORT_NAME, "times")
-        .set_default(1)
-        .set_description("The number of times each benchmark run");
     args.add_integer(poller_threads, coke::NULL_SHORT_NAME, "poller")
         .set_default(6)
         .set_description("Number of poller threads");
     args.add_integer(handler_threads, coke::NULL_SHORT_NAME, "handler")
         .set_default(20)
         .set_description("Number of handler threads");
+    add_bench_options(args);
     args.add_flag(yes, 'y', "yes").set_description("Skip asking before start");
     args.set_help_flag('h', "help");
 
@@ -178,32 +192,35 @@ int main(int argc, char *argv[]) {
 
     coke::sync_wait(warm_up());
 
-    table_line(std::cout, width,
-               "name", "cost", "times",
-               "mean(ms)", "stddev", "per sec");
-    delimiter(std::cout, width, '-');
+    bench_width[0] = 20;
+    bench_header(std::cout);
 
 #define DO_BENCHMARK(func) coke::sync_wait(do_benchmark(#func, bench_ ## func))
     DO_BENCHMARK(normal_yield);
     DO_BENCHMARK(yield_catch);
-    delimiter(std::cout, width);
+    delimiter(std::cout, bench_width);
 
     DO_BENCHMARK(d1_p0);
     DO_BENCHMARK(d2_p0);
     DO_BENCHMARK(d5_p0);
-    delimiter(std::cout, width);
+    delimiter(std::cout, bench_width);
 
     DO_BENCHMARK(d1_p100);
     DO_BENCHMARK(d2_p100);
     DO_BENCHMARK(d5_p100);
-    delimiter(std::cout, width);
+    delimiter(std::cout, bench_width);
 
     DO_BENCHMARK(d1_p1);
     DO_BENCHMARK(d1_p5);
     DO_BENCHMARK(d1_p10);
     DO_BENCHMARK(d1_p20);
     DO_BENCHMARK(d1_p50);
+    delimiter(std::cout, bench_width);
+
+    DO_BENCHMARK(expected_d1_p100);
+    DO_BENCHMARK(expected_d5_p100);
+    DO_BENCHMARK(expected_d1_p20);
 #undef DO_BENCHMARK
 
-    return 0;
+    return write_bench_json("bench_exception") ? 0 : 1;
 }
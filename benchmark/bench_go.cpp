@@ -16,26 +16,27 @@
  * Authors: kedixa (https://github.com/kedixa)
 */
 
+#include <array>
 #include <atomic>
 #include <string>
 #include <vector>
 
+#define BENCH_COUNT_ALLOCATIONS
 #include "bench_common.h"
 #include "coke/coke.h"
 #include "workflow/WFTaskFactory.h"
 
 alignas(64) std::atomic<long long> current;
 alignas(64) std::atomic<long long> global_total;
+alignas(64) std::atomic<long long> dropped;
 
 constexpr int pool_size = 10;
 std::string name_pool[pool_size];
-std::vector<int> width{16, 8, 6, 8, 6, 10};
 
 long long total{100000};
 int concurrency = 32;
-int max_secs_per_test = 5;
 int compute_threads = -1;
-int times = 1;
+int deadline_usec = 100;
 bool yes = false;
 
 bool next(long long &cur) {
@@ -73,15 +74,73 @@ coke::Task<> bench_go_name(int max) {
 
     while (next(i)) {
         const std::string &name = name_pool[i%max];
+        BenchOpTimer t;
         co_await coke::go(name, do_calculate);
     }
 }
 
+// The capture is too large for the small buffer of std::function
+coke::Task<> bench_go_capture_name(int max) {
+    std::array<long long, 8> arr{};
+    long long i;
+
+    while (next(i)) {
+        const std::string &name = name_pool[i%max];
+        arr[i%8] = i;
+
+        BenchOpTimer t;
+        co_await coke::go(name, [arr]() {
+            global_total += arr[0];
+            do_calculate();
+        });
+    }
+}
+
+coke::Task<> bench_go_batch_name(int max) {
+    constexpr std::size_t batch = 64;
+    std::vector<void (*)()> funcs;
+    long long i;
+
+    funcs.reserve(batch);
+
+    while (next(i)) {
+        funcs.push_back(do_calculate);
+
+        if (funcs.size() == batch || current.load() >= total) {
+            const std::string &name = name_pool[i%max];
+            co_await coke::go_batch(name, std::move(funcs));
+
+            funcs.clear();
+            funcs.reserve(batch);
+        }
+    }
+
+    if (!funcs.empty())
+        co_await coke::go_batch(name_pool[0], std::move(funcs));
+}
+
+// Under overload most jobs wait longer than the deadline, they are dropped
+// instead of being calculated, compare with go_one_name for the same load.
+coke::Task<> bench_go_until_name(int max) {
+    long long i;
+
+    while (next(i)) {
+        const std::string &name = name_pool[i%max];
+        auto deadline = std::chrono::steady_clock::now()
+                      + std::chrono::microseconds(deadline_usec);
+        auto ret = co_await coke::go_until(deadline, name, do_calculate);
+
+        if (ret.state != coke::TOP_SUCCESS)
+            dropped.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
 coke::Task<> bench_switch_name(int max) {
     long long i;
 
     while (next(i)) {
         const std::string &name = name_pool[i%max];
+        BenchOpTimer t;
         co_await coke::switch_go_thread(name);
         do_calculate();
     }
@@ -99,6 +158,18 @@ coke::Task<> bench_go_five_name() { return bench_go_name(5); }
 
 coke::Task<> bench_go_ten_name() { return bench_go_name(10); }
 
+coke::Task<> bench_go_capture_one_name() { return bench_go_capture_name(1); }
+
+coke::Task<> bench_go_capture_ten_name() { return bench_go_capture_name(10); }
+
+coke::Task<> bench_go_batch_one_name() { return bench_go_batch_name(1); }
+
+coke::Task<> bench_go_batch_ten_name() { return bench_go_batch_name(10); }
+
+coke::Task<> bench_go_until_one_name() { return bench_go_until_name(1); }
+
+coke::Task<> bench_go_until_ten_name() { return bench_go_until_name(10); }
+
 coke::Task<> bench_switch_one_name() { return bench_switch_name(1); }
 
 coke::Task<> bench_switch_five_name() { return bench_switch_name(5); }
@@ -109,12 +180,7 @@ coke::Task<> warm_up() { co_await coke::switch_go_thread(); }
 
 using bench_func_t = coke::Task<>(*)();
 coke::Task<> do_benchmark(const char *name, bench_func_t func) {
-    int run_times = 0;
-    long long start, total_cost = 0;
-    std::vector<long long> costs;
-    double mean, stddev, tps;
-
-    for (int i = 0; i < times; i++) {
+    auto trial = [func]() -> coke::Task<> {
         std::vector<coke::Task<>> tasks;
 
         current = 0;
@@ -123,22 +189,12 @@ coke::Task<> do_benchmark(const char *name, bench_func_t func) {
         for (int j = 0; j < concurrency; j++)
             tasks.emplace_back(func());
 
-        start = current_msec();
         co_await coke::async_wait(std::move(tasks));
-        costs.push_back(current_msec() - start);
-        total_cost += costs.back();
-
-        run_times++;
-
-        if (total_cost >= max_secs_per_test * 1000)
-            break;
-    }
-
-    data_distribution(costs, mean, stddev);
-    tps = 1.0e3 * current / (mean + 1e-9);
+    };
 
-    table_line(std::cout, width, name, total_cost, run_times,
-               mean, stddev, (long)tps);
+    BenchResult r = co_await run_benchmark(name, trial,
+        []() { return current.load(); }, &bench_alloc_calls);
+    bench_line(std::cout, r);
 }
 
 int main(int argc, char *argv[]) {
@@ -147,18 +203,16 @@ int main(int argc, char *argv[]) {
     args.add_integer(concurrency, 'c', "concurrency")
         .set_default(4096)
         .set_description("The number of concurrent during benchmark");
-    args.add_integer(max_secs_per_test, 'm', "max-secs")
-        .set_default(5)
-        .set_description("Max seconds for each benchmark");
     args.add_integer(total, 't', "total")
         .set_default(100000)
         .set_description("Total tasks in each benchmark");
-    args.add_integer(times, coke::NULL_SHORT_NAME, "times")
-        .set_default(1)
-        .set_description("The number of times each benchmark run");
+    args.add_integer(deadline_usec, coke::NULL_SHORT_NAME, "deadline")
+        .set_default(100)
+        .set_description("Deadline in microseconds of go_until benchmarks");
     args.add_integer(compute_threads, coke::NULL_SHORT_NAME, "compute")
         .set_default(-1)
         .set_description("Number of compute threads");
+    add_bench_options(args);
     args.add_flag(yes, 'y', "yes").set_description("Skip asking before start");
     args.set_help_flag('h', "help");
 
@@ -178,26 +232,36 @@ int main(int argc, char *argv[]) {
     for (int i = 0; i < pool_size; i++)
         name_pool[i] = std::to_string(i);
 
-    table_line(std::cout, width,
-               "name", "cost", "times",
-               "mean(ms)", "stddev", "per sec");
-    delimiter(std::cout, width, '-');
+    bench_width[0] = 20;
+    bench_header(std::cout);
 
 #define DO_BENCHMARK(func) coke::sync_wait(do_benchmark(#func, bench_ ## func))
     DO_BENCHMARK(wf_go_one_name);
     DO_BENCHMARK(wf_go_five_name);
     DO_BENCHMARK(wf_go_ten_name);
-    delimiter(std::cout, width);
+    delimiter(std::cout, bench_width);
 
     DO_BENCHMARK(go_one_name);
     DO_BENCHMARK(go_five_name);
     DO_BENCHMARK(go_ten_name);
-    delimiter(std::cout, width);
+    DO_BENCHMARK(go_capture_one_name);
+    DO_BENCHMARK(go_capture_ten_name);
+    delimiter(std::cout, bench_width);
+
+    DO_BENCHMARK(go_batch_one_name);
+    DO_BENCHMARK(go_batch_ten_name);
+    delimiter(std::cout, bench_width);
+
+    dropped = 0;
+    DO_BENCHMARK(go_until_one_name);
+    DO_BENCHMARK(go_until_ten_name);
+    std::cout << "dropped by deadline: " << dropped.load() << std::endl;
+    delimiter(std::cout, bench_width);
 
     DO_BENCHMARK(switch_one_name);
     DO_BENCHMARK(switch_five_name);
     DO_BENCHMARK(switch_ten_name);
 #undef DO_BENCHMARK
 
-    return 0;
+    return write_bench_json("bench_go") ? 0 : 1;
 }
@@ -17,6 +17,7 @@
 */
 
 #include <iostream>
+#include <memory>
 #include <vector>
 #include <utility>
 
@@ -25,17 +26,14 @@
 #include "coke/dag.h"
 #include "workflow/WFTaskFactory.h"
 
-std::vector<int> width{16, 8, 6, 8, 6, 10};
 
 int poller_threads = 6;
 int handler_threads = 20;
 
 int num_nodes = 128;
-int times = 1;
 int total = 500;
 int group_size = 10;
 int task_per_node = 3;
-int max_secs_per_test = 5;
 bool yes = false;
 
 template<typename RootCreater, typename NodeCreater>
@@ -198,6 +196,119 @@ auto coke_create_flower(RootFunc &&root_func, NodeFunc &&node_func) {
     return builder.build();
 }
 
+/**
+ * LegacyGraph keeps the layout used by DagGraph before the adjacency lists are
+ * compiled into contiguous arrays, that is separately allocated nodes and a
+ * vector of successors per node. It also creates a new context for each run
+ * and detaches a coroutine for each node. It is only used to compare the
+ * scheduling overhead with DagGraph.
+*/
+class LegacyGraph {
+    using node_func_t = coke::dag_node_func_t<void>;
+
+    struct Node {
+        Node(node_func_t func) : func(std::move(func)) { }
+
+        node_func_t func;
+    };
+
+public:
+    LegacyGraph() { node(nullptr); }
+
+    coke::dag_index_t node(node_func_t func) {
+        coke::dag_index_t id = nodes.size();
+        nodes.emplace_back(new Node(std::move(func)));
+        outs.push_back({});
+        weak_outs.push_back({});
+        return id;
+    }
+
+    void connect(coke::dag_index_t l, coke::dag_index_t r) {
+        outs[l].push_back(r);
+    }
+
+    bool build() {
+        return coke::detail::dag_check(outs, weak_outs, counters, weak_flags);
+    }
+
+    coke::Task<> run() {
+        coke::detail::DagContext<void> ctx(nodes.size());
+        for (std::size_t i = 0; i < nodes.size(); i++)
+            ctx[i].init(counters[i], weak_flags[i]);
+
+        invoke(ctx, 0).detach();
+        co_await ctx.wait();
+    }
+
+private:
+    coke::Task<> invoke(coke::detail::DagContext<void> &ctx,
+                        coke::dag_index_t id) {
+        auto &func = nodes[id]->func;
+        if (func)
+            co_await ctx.invoke(func);
+
+        for (auto next : outs[id])
+            if (ctx[next].count(false))
+                invoke(ctx, next).detach();
+
+        ctx.count_down();
+    }
+
+private:
+    std::vector<coke::dag_index_t> counters;
+    std::vector<bool> weak_flags;
+
+    std::vector<std::unique_ptr<Node>> nodes;
+    std::vector<std::vector<coke::dag_index_t>> outs;
+    std::vector<std::vector<coke::dag_index_t>> weak_outs;
+};
+
+template<typename RootFunc, typename NodeFunc>
+auto legacy_create_chain(RootFunc &&root_func, NodeFunc &&node_func) {
+    auto g = std::make_unique<LegacyGraph>();
+    coke::dag_index_t a = g->node(root_func), b;
+    g->connect(0, a);
+
+    for (int i = 1; i < num_nodes; i++) {
+        b = g->node(node_func);
+        g->connect(a, b);
+        a = b;
+    }
+
+    g->build();
+    return g;
+}
+
+template<typename RootFunc, typename NodeFunc>
+auto legacy_create_net(RootFunc &&root_func, NodeFunc &&node_func) {
+    auto g = std::make_unique<LegacyGraph>();
+    std::vector<coke::dag_index_t> nodes;
+    int last_start = 0, last_stop = 1;
+    int cur_start, cur_stop;
+
+    nodes.reserve(num_nodes);
+    nodes.push_back(g->node(root_func));
+    g->connect(0, nodes[0]);
+
+    int i = 1;
+    while (i < num_nodes) {
+        cur_start = i;
+        cur_stop = std::min(cur_start + group_size, num_nodes);
+        for (; i < cur_stop; i++) {
+            nodes.push_back(g->node(node_func));
+
+            for (int j = last_start; j < last_stop; j++)
+                g->connect(nodes[j], nodes[i]);
+        }
+
+        last_start = cur_start;
+        last_stop = cur_stop;
+    }
+
+    g->build();
+    return g;
+}
+
 auto wf_timer_creater(WFGraphTask *g) {
     auto &x = g->create_graph_node(WFTaskFactory::create_go_task("", []{}));
     return &x;
@@ -218,6 +329,8 @@ auto wf_creater(WFGraphTask *g) {
     return &x;
 }
 
+coke::Task<> coke_empty_func() { co_return; }
+
 coke::Task<> coke_yield_func() { co_await coke::switch_go_thread(""); }
 
 coke::Task<> coke_func() {
@@ -310,40 +423,44 @@ coke::Task<> bench_coke_flower() {
         co_await g->run();
 }
 
-coke::Task<> warm_up() { co_await coke::yield(); }
+// Nodes do nothing, so the cost is dominated by the scheduling of the graph
 
-using bench_func_t = coke::Task<>(*)();
-coke::Task<> do_benchmark(const char *name, bench_func_t func) {
-    int run_times = 0;
-    long long start, total_cost = 0;
-    std::vector<long long> costs;
-    double mean, stddev, tps;
+coke::Task<> bench_legacy_empty_chain() {
+    auto g = legacy_create_chain(coke_yield_func, coke_empty_func);
+    for (int i = 0; i < total; i++)
+        co_await g->run();
+}
 
-    for (int i = 0; i < times; i++) {
-        start = current_msec();
-        co_await func();
-        costs.push_back(current_msec() - start);
-        total_cost += costs.back();
+coke::Task<> bench_coke_empty_chain() {
+    auto g = coke_create_chain(coke_yield_func, coke_empty_func);
+    for (int i = 0; i < total; i++)
+        co_await g->run();
+}
 
-        run_times++;
+coke::Task<> bench_legacy_empty_net() {
+    auto g = legacy_create_net(coke_yield_func, coke_empty_func);
+    for (int i = 0; i < total; i++)
+        co_await g->run();
+}
 
-        if (total_cost >= max_secs_per_test * 1000)
-            break;
-    }
+coke::Task<> bench_coke_empty_net() {
+    auto g = coke_create_net(coke_yield_func, coke_empty_func);
+    for (int i = 0; i < total; i++)
+        co_await g->run();
+}
 
-    data_distribution(costs, mean, stddev);
-    tps = 1.0e3 * total / (mean + 1e-9);
+coke::Task<> warm_up() { co_await coke::yield(); }
 
-    table_line(std::cout, width, name, total_cost, run_times,
-               mean, stddev, (long)tps);
+using bench_func_t = coke::Task<>(*)();
+coke::Task<> do_benchmark(const char *name, bench_func_t func) {
+    BenchResult r = co_await run_benchmark(name, func,
+        []() { return (long long)total; });
+    bench_line(std::cout, r);
 }
 
 int main(int argc, char *argv[]) {
     coke::OptionParser args;
 
-    args.add_integer(max_secs_per_test, 'm', "max-secs")
-        .set_default(5)
-        .set_description("Max seconds for each benchmark");
     args.add_integer(total, 't', "total")
         .set_default(500)
         .set_description("Total tasks in each benchmark");
@@ -356,15 +473,13 @@ int main(int argc, char *argv[]) {
     args.add_integer(task_per_node, 'p', "task-per-node")
         .set_default(3)
         .set_description("Number of tasks in each node");
-    args.add_integer(times, coke::NULL_SHORT_NAME, "times")
-        .set_default(1)
-        .set_description("The number of times each benchmark run");
     args.add_integer(poller_threads, coke::NULL_SHORT_NAME, "poller")
         .set_default(6)
         .set_description("Number of poller threads");
     args.add_integer(handler_threads, coke::NULL_SHORT_NAME, "handler")
         .set_default(20)
         .set_description("Number of handler threads");
+    add_bench_options(args);
     args.add_flag(yes, 'y', "yes").set_description("Skip asking before start");
     args.set_help_flag('h', "help");
 
@@ -382,31 +497,36 @@ int main(int argc, char *argv[]) {
 
     coke::sync_wait(warm_up());
 
-    table_line(std::cout, width,
-               "name", "cost", "times",
-               "mean(ms)", "stddev", "per sec");
-    delimiter(std::cout, width, '-');
+    bench_header(std::cout);
 
 #define DO_BENCHMARK(func) coke::sync_wait(do_benchmark(#func, bench_ ## func))
     DO_BENCHMARK(wf_chain);
     DO_BENCHMARK(coke_chain_once);
     DO_BENCHMARK(coke_chain);
-    delimiter(std::cout, width);
+    delimiter(std::cout, bench_width);
 
     DO_BENCHMARK(wf_tree);
     DO_BENCHMARK(coke_tree_once);
     DO_BENCHMARK(coke_tree);
-    delimiter(std::cout, width);
+    delimiter(std::cout, bench_width);
 
     DO_BENCHMARK(wf_net);
     DO_BENCHMARK(coke_net_once);
     DO_BENCHMARK(coke_net);
-    delimiter(std::cout, width);
+    delimiter(std::cout, bench_width);
 
     DO_BENCHMARK(wf_flower);
     DO_BENCHMARK(coke_flower_once);
     DO_BENCHMARK(coke_flower);
+    delimiter(std::cout, bench_width);
+
+    DO_BENCHMARK(legacy_empty_chain);
+    DO_BENCHMARK(coke_empty_chain);
+    delimiter(std::cout, bench_width);
+
+    DO_BENCHMARK(legacy_empty_net);
+    DO_BENCHMARK(coke_empty_net);
 #undef DO_BENCHMARK
 
-    return 0;
+    return write_bench_json("bench_graph") ? 0 : 1;
 }
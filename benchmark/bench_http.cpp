@@ -0,0 +1,220 @@
+/**
+ * Copyright 2024 Coke Project (https://github.com/kedixa/coke)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Authors: kedixa (https://github.com/kedixa)
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#define BENCH_COUNT_ALLOCATIONS
+#include "bench_common.h"
+#include "coke/coke.h"
+#include "coke/http/http_client.h"
+#include "coke/http/http_server.h"
+
+alignas(64) std::atomic<long long> current;
+alignas(64) std::atomic<long long> errors;
+
+long long total{100000};
+int max_concurrency = 256;
+int fanout = 8;
+int port = 8800;
+int poller_threads = 4;
+int handler_threads = 20;
+int compute_threads = -1;
+bool yes = false;
+
+std::vector<int> payload_sizes{64, 4096, 65536};
+std::string payload;
+
+bool next(long long &cur) {
+    cur = current.fetch_add(1, std::memory_order_relaxed);
+    if (cur < total)
+        return true;
+
+    current.fetch_sub(1, std::memory_order_relaxed);
+    return false;
+}
+
+// Reply `size` bytes for request uri "/size"
+coke::Task<> http_processor(coke::HttpServerContext ctx) {
+    coke::HttpRequest &req = ctx.get_req();
+    coke::HttpResponse &resp = ctx.get_resp();
+    std::size_t size = std::strtoul(req.get_request_uri() + 1, nullptr, 10);
+
+    resp.set_status_code("200");
+    resp.append_output_body_nocopy(payload.data(),
+                                   std::min(size, payload.size()));
+
+    co_await ctx.reply();
+}
+
+coke::Task<> bench_request(coke::HttpClient &cli,
+                           const coke::HttpClient::Endpoint &ep) {
+    long long i;
+
+    while (next(i)) {
+        BenchOpTimer t;
+        coke::HttpResult res = co_await cli.request(ep);
+
+        if (res.state != coke::STATE_SUCCESS)
+            errors.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+// Each operation sends `fanout` requests at the same time and waits for all
+coke::Task<> bench_fanout(coke::HttpClient &cli,
+                          const coke::HttpClient::Endpoint &ep) {
+    long long i;
+
+    while (next(i)) {
+        std::vector<coke::HttpAwaiter> awaiters;
+        awaiters.reserve(fanout);
+
+        for (int j = 0; j < fanout; j++)
+            awaiters.emplace_back(cli.request(ep));
+
+        BenchOpTimer t;
+        std::vector<coke::HttpResult> results;
+        results = co_await coke::async_wait(std::move(awaiters));
+
+        for (const coke::HttpResult &res : results) {
+            if (res.state != coke::STATE_SUCCESS)
+                errors.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+}
+
+using bench_func_t = coke::Task<>(*)(coke::HttpClient &,
+                                     const coke::HttpClient::Endpoint &);
+
+coke::Task<> do_benchmark(const char *name, bench_func_t func, int conc,
+                          bool keep_alive, int size) {
+    coke::HttpClientParams params;
+    params.keep_alive_timeout = keep_alive ? 60 * 1000 : 0;
+
+    coke::HttpClient cli(params);
+    std::string url = "http://127.0.0.1:" + std::to_string(port)
+                    + "/" + std::to_string(size);
+    coke::HttpClient::Endpoint ep = cli.prepare(url);
+
+    std::string full_name(name);
+    full_name.append(keep_alive ? "_ka" : "_close")
+             .append("_c").append(std::to_string(conc))
+             .append("_p").append(std::to_string(size));
+
+    auto trial = [&, func, conc]() -> coke::Task<> {
+        std::vector<coke::Task<>> tasks;
+        current = 0;
+
+        for (int j = 0; j < conc; j++)
+            tasks.emplace_back(func(cli, ep));
+
+        co_await coke::async_wait(std::move(tasks));
+    };
+
+    errors = 0;
+    BenchResult r = co_await run_benchmark(full_name.c_str(), trial,
+        []() { return current.load(); }, &bench_alloc_calls);
+    bench_line(std::cout, r);
+
+    if (errors.load() != 0)
+        std::cout << full_name << " errors: " << errors.load() << std::endl;
+}
+
+int main(int argc, char *argv[]) {
+    coke::OptionParser args;
+
+    args.add_integer(max_concurrency, 'c', "max-concurrency")
+        .set_default(256)
+        .set_description("Run with 1, 4, 16, ... up to max-concurrency "
+                         "clients");
+    args.add_integer(total, 't', "total")
+        .set_default(100000)
+        .set_description("Total requests in each benchmark");
+    args.add_integer(fanout, 'f', "fanout")
+        .set_default(8)
+        .set_description("Requests sent at the same time by fanout");
+    args.add_integer(port, 'p', "port")
+        .set_default(8800)
+        .set_description("Port of the loopback server");
+    args.add_integer(poller_threads, coke::NULL_SHORT_NAME, "poller")
+        .set_default(4)
+        .set_description("Number of poller threads");
+    args.add_integer(handler_threads, coke::NULL_SHORT_NAME, "handler")
+        .set_default(20)
+        .set_description("Number of handler threads");
+    args.add_integer(compute_threads, coke::NULL_SHORT_NAME, "compute")
+        .set_default(-1)
+        .set_description("Number of compute threads");
+    add_bench_options(args);
+    args.add_flag(yes, 'y', "yes").set_description("Skip asking before start");
+    args.set_help_flag('h', "help");
+
+    int ret = parse_args(args, argc, argv, &yes);
+    if (ret <= 0)
+        return ret;
+
+    coke::GlobalSettings gs;
+    gs.poller_threads = poller_threads;
+    gs.handler_threads = handler_threads;
+    gs.compute_threads = compute_threads;
+    // The clients of the benchmark make many connections to one host
+    gs.endpoint_params.max_connections = 4096;
+    coke::library_init(gs);
+
+    payload.assign(payload_sizes.back(), 'x');
+
+    coke::HttpServer server(http_processor);
+    if (server.start(port) != 0) {
+        std::cerr << "HttpServer start failed " << strerror(errno) << std::endl;
+        return 1;
+    }
+
+    std::cout.precision(2);
+    std::cout.setf(std::ios_base::fixed, std::ios_base::floatfield);
+
+    bench_width[0] = 28;
+    bench_header(std::cout);
+
+    for (bool keep_alive : {true, false}) {
+        for (int c = 1; c <= max_concurrency; c *= 4) {
+            coke::sync_wait(do_benchmark("request", bench_request,
+                                         c, keep_alive, payload_sizes[0]));
+        }
+        delimiter(std::cout, bench_width);
+    }
+
+    for (int size : payload_sizes) {
+        coke::sync_wait(do_benchmark("request", bench_request,
+                                     max_concurrency, true, size));
+    }
+    delimiter(std::cout, bench_width);
+
+    for (int c = 1; c <= max_concurrency; c *= 4) {
+        coke::sync_wait(do_benchmark("fanout", bench_fanout,
+                                     c, true, payload_sizes[0]));
+    }
+
+    server.stop();
+
+    return write_bench_json("bench_http") ? 0 : 1;
+}
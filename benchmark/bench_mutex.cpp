@@ -0,0 +1,464 @@
+/**
+ * Copyright 2024 Coke Project (https://github.com/kedixa/coke)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Authors: kedixa (https://github.com/kedixa)
+*/
+
+#include <atomic>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "bench_common.h"
+#include "coke/coke.h"
+
+alignas(64) std::atomic<long long> current;
+
+long long total{1000000};
+long long rounds{10000};
+int max_threads = 16;
+int spin_count = 200;
+int section_size = 32;
+int read_percent = 90;
+int compute_threads = 16;
+int handler_threads = 20;
+bool yes = false;
+
+// Protected by the lock under test
+long long shared_data = 0;
+
+bool next(long long &cur) {
+    cur = current.fetch_add(1, std::memory_order_relaxed);
+    if (cur < total)
+        return true;
+
+    current.fetch_sub(1, std::memory_order_relaxed);
+    return false;
+}
+
+// A short critical section, about a few hundred nanoseconds
+void critical_section() {
+    volatile long long x = shared_data;
+    for (int i = 0; i < section_size; i++)
+        x = x + i;
+
+    shared_data = x;
+}
+
+// Baseline, std::mutex blocks the compute thread instead of the coroutine
+coke::Task<> bench_std_mutex(std::mutex &mtx) {
+    long long i;
+
+    // Each worker runs on its own compute thread as far as possible
+    co_await coke::switch_go_thread();
+
+    while (next(i)) {
+        BenchOpTimer t;
+        std::lock_guard<std::mutex> lg(mtx);
+        critical_section();
+    }
+}
+
+coke::Task<> bench_mutex(coke::Mutex &mtx) {
+    long long i;
+
+    co_await coke::switch_go_thread();
+
+    while (next(i)) {
+        BenchOpTimer t;
+        co_await mtx.lock();
+        critical_section();
+        mtx.unlock();
+    }
+}
+
+coke::Task<> bench_shared_mutex(coke::SharedMutex &mtx) {
+    long long i;
+
+    co_await coke::switch_go_thread();
+
+    while (next(i)) {
+        BenchOpTimer t;
+        co_await mtx.lock();
+        critical_section();
+        mtx.unlock();
+    }
+}
+
+coke::Task<> bench_shared_mutex_read(coke::SharedMutex &mtx) {
+    long long i;
+
+    co_await coke::switch_go_thread();
+
+    while (next(i)) {
+        BenchOpTimer t;
+
+        // The writers are spread evenly, `read_percent` of the operations
+        // are readers
+        if (i % 100 >= read_percent) {
+            co_await mtx.lock();
+            critical_section();
+            mtx.unlock();
+        }
+        else {
+            co_await mtx.lock_shared();
+            critical_section();
+            mtx.unlock_shared();
+        }
+    }
+}
+
+coke::Task<> bench_semaphore(coke::Semaphore &sem) {
+    long long i;
+
+    co_await coke::switch_go_thread();
+
+    while (next(i)) {
+        BenchOpTimer t;
+        co_await sem.acquire();
+        critical_section();
+        sem.release();
+    }
+}
+
+// A bounded buffer guarded by std::mutex and two coke::Condition
+struct BoundedBuffer {
+    static constexpr long long CAPACITY = 64;
+
+    std::mutex mtx;
+    coke::Condition not_empty;
+    coke::Condition not_full;
+    long long size{0};
+    long long consumed{0};
+};
+
+coke::Task<> bench_condition_producer(BoundedBuffer &buf) {
+    long long i;
+
+    co_await coke::switch_go_thread();
+
+    while (next(i)) {
+        BenchOpTimer t;
+        std::unique_lock<std::mutex> lk(buf.mtx);
+
+        while (buf.size >= BoundedBuffer::CAPACITY)
+            co_await buf.not_full.wait(lk);
+
+        buf.size++;
+        critical_section();
+        buf.not_empty.notify_one();
+    }
+}
+
+coke::Task<> bench_condition_consumer(BoundedBuffer &buf) {
+    co_await coke::switch_go_thread();
+
+    std::unique_lock<std::mutex> lk(buf.mtx);
+
+    while (true) {
+        while (buf.size == 0 && buf.consumed < total)
+            co_await buf.not_empty.wait(lk);
+
+        if (buf.size == 0)
+            break;
+
+        buf.size--;
+        buf.consumed++;
+        buf.not_full.notify_one();
+
+        // Wake up the other consumers to exit
+        if (buf.consumed == total)
+            buf.not_empty.notify_all();
+    }
+}
+
+// Each round all the workers arrive at a new latch and wait for each other
+coke::Task<> bench_latch(std::vector<std::unique_ptr<coke::Latch>> &latches) {
+    co_await coke::switch_go_thread();
+
+    for (auto &lt : latches) {
+        BenchOpTimer t;
+        co_await lt->arrive_and_wait();
+        current.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+coke::Task<> wait_group_done(coke::WaitGroup &wg) {
+    co_await coke::switch_go_thread();
+    current.fetch_add(1, std::memory_order_relaxed);
+    wg.done();
+}
+
+coke::Task<> stop_token_waiter(coke::StopToken &token) {
+    coke::StopToken::FinishGuard guard(&token);
+
+    co_await token.wait_stop();
+    current.fetch_add(1, std::memory_order_relaxed);
+}
+
+coke::Task<> stop_token_stopper(coke::StopToken &token) {
+    coke::StopToken::FinishGuard guard(&token);
+
+    co_await coke::switch_go_thread();
+    token.request_stop();
+}
+
+coke::Task<> bench_std_mutex_all(int n) {
+    std::mutex mtx;
+    std::vector<coke::Task<>> tasks;
+
+    for (int j = 0; j < n; j++)
+        tasks.emplace_back(bench_std_mutex(mtx));
+
+    co_await coke::async_wait(std::move(tasks));
+}
+
+coke::Task<> bench_mutex_all(int n) {
+    coke::Mutex mtx;
+    std::vector<coke::Task<>> tasks;
+
+    for (int j = 0; j < n; j++)
+        tasks.emplace_back(bench_mutex(mtx));
+
+    co_await coke::async_wait(std::move(tasks));
+}
+
+// The ownership is passed to the first waiter directly when contended, which
+// trades some throughput for a lower tail latency
+coke::Task<> bench_mutex_handoff_all(int n) {
+    coke::Mutex mtx(true);
+    std::vector<coke::Task<>> tasks;
+
+    for (int j = 0; j < n; j++)
+        tasks.emplace_back(bench_mutex(mtx));
+
+    co_await coke::async_wait(std::move(tasks));
+}
+
+coke::Task<> bench_shared_mutex_all(int n) {
+    coke::SharedMutex mtx;
+    std::vector<coke::Task<>> tasks;
+
+    for (int j = 0; j < n; j++)
+        tasks.emplace_back(bench_shared_mutex(mtx));
+
+    co_await coke::async_wait(std::move(tasks));
+}
+
+coke::Task<> bench_shared_mutex_read_all(int n) {
+    coke::SharedMutex mtx;
+    std::vector<coke::Task<>> tasks;
+
+    for (int j = 0; j < n; j++)
+        tasks.emplace_back(bench_shared_mutex_read(mtx));
+
+    co_await coke::async_wait(std::move(tasks));
+}
+
+coke::Task<> bench_semaphore_all(int n) {
+    coke::Semaphore sem(1);
+    std::vector<coke::Task<>> tasks;
+
+    for (int j = 0; j < n; j++)
+        tasks.emplace_back(bench_semaphore(sem));
+
+    co_await coke::async_wait(std::move(tasks));
+}
+
+// n producers and n consumers
+coke::Task<> bench_condition_all(int n) {
+    BoundedBuffer buf;
+    std::vector<coke::Task<>> tasks;
+
+    for (int j = 0; j < n; j++) {
+        tasks.emplace_back(bench_condition_producer(buf));
+        tasks.emplace_back(bench_condition_consumer(buf));
+    }
+
+    co_await coke::async_wait(std::move(tasks));
+}
+
+coke::Task<> bench_latch_all(int n) {
+    std::vector<std::unique_ptr<coke::Latch>> latches;
+    std::vector<coke::Task<>> tasks;
+
+    latches.reserve(rounds);
+    for (long long r = 0; r < rounds; r++)
+        latches.emplace_back(std::make_unique<coke::Latch>(n));
+
+    for (int j = 0; j < n; j++)
+        tasks.emplace_back(bench_latch(latches));
+
+    co_await coke::async_wait(std::move(tasks));
+}
+
+// Each round starts n workers and waits for all of them to be done
+coke::Task<> bench_wait_group_all(int n) {
+    coke::WaitGroup wg;
+
+    for (long long r = 0; r < rounds; r++) {
+        BenchOpTimer t;
+
+        wg.add(n);
+        for (int j = 0; j < n; j++)
+            coke::detach(wait_group_done(wg));
+
+        co_await wg.wait();
+    }
+}
+
+// Each round n waiters wait for one stop request
+coke::Task<> bench_stop_token_all(int n) {
+    for (long long r = 0; r < rounds; r++) {
+        BenchOpTimer t;
+        coke::StopToken token(n + 1);
+        std::vector<coke::Task<>> tasks;
+
+        for (int j = 0; j < n; j++)
+            tasks.emplace_back(stop_token_waiter(token));
+        tasks.emplace_back(stop_token_stopper(token));
+
+        co_await coke::async_wait(std::move(tasks));
+    }
+}
+
+coke::Task<> warm_up() { co_await coke::switch_go_thread(); }
+
+using bench_func_t = coke::Task<>(*)(int);
+coke::Task<> do_benchmark(const char *name, bench_func_t func,
+                          int n, int spin) {
+    std::string full_name(name);
+
+    if (spin >= 0)
+        full_name.append(spin > 0 ? "_spin" : "_park");
+    full_name.append("_c").append(std::to_string(n));
+
+    coke::set_lock_spin_count(spin > 0 ? spin : 0);
+
+    auto trial = [func, n]() -> coke::Task<> {
+        current = 0;
+        co_await func(n);
+    };
+
+    BenchResult r = co_await run_benchmark(full_name.c_str(), trial,
+        []() { return current.load(); });
+    bench_line(std::cout, r);
+}
+
+int main(int argc, char *argv[]) {
+    coke::OptionParser args;
+
+    args.add_integer(max_threads, 'c', "max-threads")
+        .set_default(16)
+        .set_description("Run with 1, 2, 4, ... up to max-threads workers");
+    args.add_integer(spin_count, 's', "spin")
+        .set_default(200)
+        .set_description("Spin count of the adaptive mode");
+    args.add_integer(section_size, coke::NULL_SHORT_NAME, "section")
+        .set_default(32)
+        .set_description("Loop count in the critical section");
+    args.add_integer(read_percent, 'r', "read-percent")
+        .set_default(90)
+        .set_description("Percent of readers in shared_mutex_read");
+    args.add_integer(total, 't', "total")
+        .set_default(1000000)
+        .set_description("Total lock operations in each benchmark");
+    args.add_integer(rounds, coke::NULL_SHORT_NAME, "rounds")
+        .set_default(10000)
+        .set_description("Rounds of latch, wait_group and stop_token");
+    args.add_integer(compute_threads, coke::NULL_SHORT_NAME, "compute")
+        .set_default(16)
+        .set_description("Number of compute threads");
+    args.add_integer(handler_threads, coke::NULL_SHORT_NAME, "handler")
+        .set_default(20)
+        .set_description("Number of handler threads");
+    add_bench_options(args);
+    args.add_flag(yes, 'y', "yes").set_description("Skip asking before start");
+    args.set_help_flag('h', "help");
+
+    int ret = parse_args(args, argc, argv, &yes);
+    if (ret <= 0)
+        return ret;
+
+    coke::GlobalSettings gs;
+    gs.compute_threads = compute_threads;
+    gs.handler_threads = handler_threads;
+    coke::library_init(gs);
+
+    std::cout.precision(2);
+    std::cout.setf(std::ios_base::fixed, std::ios_base::floatfield);
+
+    coke::sync_wait(warm_up());
+
+    bench_width[0] = 28;
+    bench_header(std::cout);
+
+    // Lock like benchmarks run in both park and spin mode
+#define DO_BENCHMARK(func, n) \
+    do { \
+        coke::sync_wait(do_benchmark(#func, bench_ ## func ## _all, n, 0)); \
+        coke::sync_wait(do_benchmark(#func, bench_ ## func ## _all, n, \
+                                     spin_count)); \
+    } while (0)
+
+#define DO_BENCHMARK_ONCE(func, n) \
+    coke::sync_wait(do_benchmark(#func, bench_ ## func ## _all, n, -1))
+
+    for (int n = 1; n <= max_threads; n *= 2)
+        DO_BENCHMARK_ONCE(std_mutex, n);
+    delimiter(std::cout, bench_width);
+
+    for (int n = 1; n <= max_threads; n *= 2)
+        DO_BENCHMARK(mutex, n);
+    delimiter(std::cout, bench_width);
+
+    for (int n = 1; n <= max_threads; n *= 2)
+        DO_BENCHMARK(mutex_handoff, n);
+    delimiter(std::cout, bench_width);
+
+    for (int n = 1; n <= max_threads; n *= 2)
+        DO_BENCHMARK(shared_mutex, n);
+    delimiter(std::cout, bench_width);
+
+    for (int n = 1; n <= max_threads; n *= 2)
+        DO_BENCHMARK(shared_mutex_read, n);
+    delimiter(std::cout, bench_width);
+
+    for (int n = 1; n <= max_threads; n *= 2)
+        DO_BENCHMARK(semaphore, n);
+    delimiter(std::cout, bench_width);
+
+    for (int n = 1; n <= max_threads; n *= 2)
+        DO_BENCHMARK_ONCE(condition, n);
+    delimiter(std::cout, bench_width);
+
+    for (int n = 1; n <= max_threads; n *= 2)
+        DO_BENCHMARK_ONCE(latch, n);
+    delimiter(std::cout, bench_width);
+
+    for (int n = 1; n <= max_threads; n *= 2)
+        DO_BENCHMARK_ONCE(wait_group, n);
+    delimiter(std::cout, bench_width);
+
+    for (int n = 1; n <= max_threads; n *= 2)
+        DO_BENCHMARK_ONCE(stop_token, n);
+
+#undef DO_BENCHMARK_ONCE
+#undef DO_BENCHMARK
+
+    return write_bench_json("bench_mutex") ? 0 : 1;
+}
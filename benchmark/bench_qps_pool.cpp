@@ -0,0 +1,182 @@
+/**
+ * Copyright 2024 Coke Project (https://github.com/kedixa/coke)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Authors: kedixa (https://github.com/kedixa)
+*/
+
+#include <atomic>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "bench_common.h"
+#include "coke/coke.h"
+#include "coke/qps_pool.h"
+
+alignas(64) std::atomic<long long> current;
+alignas(64) std::atomic<long long> acquired;
+std::vector<int> width{16, 8, 8, 6, 8, 6, 10, 10};
+
+long long total{1000000};
+long long qps = 500000;
+int max_threads = 16;
+int max_secs_per_test = 5;
+int compute_threads = 16;
+int times = 1;
+bool yes = false;
+
+bool next(long long &cur) {
+    cur = current.fetch_add(1, std::memory_order_relaxed);
+    if (cur < total)
+        return true;
+
+    current.fetch_sub(1, std::memory_order_relaxed);
+    return false;
+}
+
+// Acquire without waiting, measures the cost of get_if itself
+coke::Task<> bench_try_get(coke::QpsPool &pool) {
+    long long i;
+
+    // Each worker runs on its own compute thread as far as possible
+    co_await coke::switch_go_thread();
+
+    while (next(i)) {
+        int ret = co_await pool.get_if(1, coke::NanoSec(0));
+        if (ret == coke::SLEEP_SUCCESS)
+            acquired.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+// Acquire and wait, the throughput should be limited to `qps`
+coke::Task<> bench_get(coke::QpsPool &pool) {
+    long long i;
+
+    co_await coke::switch_go_thread();
+
+    while (next(i)) {
+        co_await pool.get();
+        acquired.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+coke::Task<> bench_try_get_all(int n) {
+    coke::QpsPool pool(qps);
+    std::vector<coke::Task<>> tasks;
+
+    for (int j = 0; j < n; j++)
+        tasks.emplace_back(bench_try_get(pool));
+
+    co_await coke::async_wait(std::move(tasks));
+}
+
+coke::Task<> bench_get_all(int n) {
+    coke::QpsPool pool(qps);
+    std::vector<coke::Task<>> tasks;
+
+    for (int j = 0; j < n; j++)
+        tasks.emplace_back(bench_get(pool));
+
+    co_await coke::async_wait(std::move(tasks));
+}
+
+coke::Task<> warm_up() { co_await coke::switch_go_thread(); }
+
+using bench_func_t = coke::Task<>(*)(int);
+coke::Task<> do_benchmark(const char *name, bench_func_t func, int n) {
+    int run_times = 0;
+    long long start, total_cost = 0, total_acquired = 0;
+    std::vector<long long> costs;
+    double mean, stddev, tps, aps;
+
+    for (int i = 0; i < times; i++) {
+        current = 0;
+        acquired = 0;
+
+        start = current_msec();
+        co_await func(n);
+        costs.push_back(current_msec() - start);
+        total_cost += costs.back();
+        total_acquired += acquired;
+
+        run_times++;
+
+        if (total_cost >= max_secs_per_test * 1000)
+            break;
+    }
+
+    data_distribution(costs, mean, stddev);
+    tps = 1.0e3 * current / (mean + 1e-9);
+    aps = 1.0e3 * total_acquired / (total_cost + 1e-9);
+
+    table_line(std::cout, width, name, n, total_cost, run_times,
+               mean, stddev, (long)tps, (long)aps);
+}
+
+int main(int argc, char *argv[]) {
+    coke::OptionParser args;
+
+    args.add_integer(max_threads, 'c', "max-threads")
+        .set_default(16)
+        .set_description("Run with 1, 2, 4, ... up to max-threads workers");
+    args.add_integer(qps, 'q', "qps")
+        .set_default(500000)
+        .set_description("Query per second of the QpsPool");
+    args.add_integer(max_secs_per_test, 'm', "max-secs")
+        .set_default(5)
+        .set_description("Max seconds for each benchmark");
+    args.add_integer(total, 't', "total")
+        .set_default(1000000)
+        .set_description("Total acquire operations in each benchmark");
+    args.add_integer(times, coke::NULL_SHORT_NAME, "times")
+        .set_default(1)
+        .set_description("The number of times each benchmark run");
+    args.add_integer(compute_threads, coke::NULL_SHORT_NAME, "compute")
+        .set_default(16)
+        .set_description("Number of compute threads");
+    args.add_flag(yes, 'y', "yes").set_description("Skip asking before start");
+    args.set_help_flag('h', "help");
+
+    int ret = parse_args(args, argc, argv, &yes);
+    if (ret <= 0)
+        return ret;
+
+    coke::GlobalSettings gs;
+    gs.compute_threads = compute_threads;
+    coke::library_init(gs);
+
+    std::cout.precision(2);
+    std::cout.setf(std::ios_base::fixed, std::ios_base::floatfield);
+
+    coke::sync_wait(warm_up());
+
+    table_line(std::cout, width,
+               "name", "threads", "cost", "times",
+               "mean(ms)", "stddev", "per sec", "acquired");
+    delimiter(std::cout, width, '-');
+
+#define DO_BENCHMARK(func, n) \
+    coke::sync_wait(do_benchmark(#func, bench_ ## func ## _all, n))
+
+    for (int n = 1; n <= max_threads; n *= 2)
+        DO_BENCHMARK(try_get, n);
+    delimiter(std::cout, width);
+
+    for (int n = 1; n <= max_threads; n *= 2)
+        DO_BENCHMARK(get, n);
+#undef DO_BENCHMARK
+
+    return 0;
+}
@@ -1,25 +1,78 @@
+#include <algorithm>
+#include <atomic>
+#include <deque>
 #include <iostream>
+#include <memory>
 #include <vector>
 #include <utility>
 
 #include "bench_common.h"
 #include "coke/coke.h"
+#include "coke/dary_heap.h"
+#include "coke/deque.h"
 #include "coke/queue.h"
-
-std::vector<int> width{16, 8, 6, 8, 6, 10};
+#include "coke/ring_buffer.h"
+#include "coke/ring_queue.h"
+#include "coke/sharded_queue.h"
+#include "coke/spsc_queue.h"
 
 int poller_threads = 6;
 int handler_threads = 20;
 
-int times = 1;
 int total = 1000000;
 int batch_size = 10;
 int que_size = 1000;
-int max_secs_per_test = 5;
 int concurrency = 10;
 bool yes = false;
 
 std::atomic<int> counter;
+std::atomic<long long> alloc_calls;
+
+// Count the allocations of the containers, to compare the allocator churn.
+// RingQueue and SpscQueue allocate their slots once by new, and ShardedQueue
+// uses the default allocator, not counted.
+template<typename T>
+struct CountingAllocator : std::allocator<T> {
+    using value_type = T;
+
+    template<typename U>
+    struct rebind { using other = CountingAllocator<U>; };
+
+    CountingAllocator() = default;
+
+    template<typename U>
+    CountingAllocator(const CountingAllocator<U> &) noexcept { }
+
+    T *allocate(std::size_t n) {
+        alloc_calls.fetch_add(1, std::memory_order_relaxed);
+        return std::allocator<T>::allocate(n);
+    }
+
+    void deallocate(T *p, std::size_t n) noexcept {
+        std::allocator<T>::deallocate(p, n);
+    }
+
+    template<typename U>
+    bool operator==(const CountingAllocator<U> &) const noexcept {
+        return true;
+    }
+};
+
+using Alloc = CountingAllocator<int>;
+using DequeC = std::deque<int, Alloc>;
+using VectorC = std::vector<int, Alloc>;
+using RingC = coke::RingBuffer<int, Alloc>;
+
+using Queue = coke::Queue<int, DequeC>;
+using RingBufQueue = coke::Queue<int, RingC>;
+using PriorityQueue = coke::PriorityQueue<int, VectorC>;
+using Priority4Queue =
+    coke::PriorityQueue<int, coke::DaryHeapVector<int, 4, Alloc>>;
+using Priority8Queue =
+    coke::PriorityQueue<int, coke::DaryHeapVector<int, 8, Alloc>>;
+using Stack = coke::Stack<int, DequeC>;
+using Deque = coke::Deque<int, Alloc>;
+using RingBufDeque = coke::Deque<int, Alloc, RingC>;
 
 bool acquire_count(int n) {
     constexpr auto relaxed = std::memory_order_relaxed;
@@ -28,63 +81,129 @@ bool acquire_count(int n) {
     return false;
 }
 
-coke::Task<> que_try_push(coke::Queue<int> &que) {
+// Deque has no push/pop, use its back/front as a queue.
+
+template<typename Q>
+bool try_push_one(Q &que, int v) { return que.try_push(v); }
+
+template<typename A, typename C>
+bool try_push_one(coke::Deque<int, A, C> &que, int v) {
+    return que.try_push_back(v);
+}
+
+template<typename Q>
+coke::Task<int> push_one(Q &que, int v) { return que.push(v); }
+
+template<typename A, typename C>
+coke::Task<int> push_one(coke::Deque<int, A, C> &que, int v) {
+    return que.push_back(v);
+}
+
+template<typename Q>
+bool try_pop_one(Q &que, int &v) { return que.try_pop(v); }
+
+template<typename A, typename C>
+bool try_pop_one(coke::Deque<int, A, C> &que, int &v) {
+    return que.try_pop_front(v);
+}
+
+template<typename Q>
+coke::Task<int> pop_one(Q &que, int &v) { return que.pop(v); }
+
+template<typename A, typename C>
+coke::Task<int> pop_one(coke::Deque<int, A, C> &que, int &v) {
+    return que.pop_front(v);
+}
+
+template<typename Q, typename Iter>
+Iter try_push_some(Q &que, Iter first, Iter last) {
+    if constexpr (requires { que.try_push_range(first, last); })
+        return que.try_push_range(first, last);
+    else if constexpr (requires { que.try_push_back_range(first, last); })
+        return que.try_push_back_range(first, last);
+    else {
+        while (first != last && que.try_push(*first))
+            ++first;
+        return first;
+    }
+}
+
+template<typename Q, typename Iter>
+Iter try_pop_some(Q &que, Iter first, Iter last) {
+    if constexpr (requires { que.try_pop_range(first, last); })
+        return que.try_pop_range(first, last);
+    else if constexpr (requires { que.try_pop_front_range(first, last); })
+        return que.try_pop_front_range(first, last);
+    else {
+        while (first != last && que.try_pop(*first))
+            ++first;
+        return first;
+    }
+}
+
+template<typename Q>
+coke::Task<> que_try_push(Q &que) {
     co_await coke::yield();
 
     while (acquire_count(1)) {
-        if (!que.full() && que.try_push(0))
+        if (!que.full() && try_push_one(que, 0))
             continue;
 
-        co_await que.push(0);
+        co_await push_one(que, 0);
     }
 }
 
-coke::Task<> que_push(coke::Queue<int> &que) {
+template<typename Q>
+coke::Task<> que_push(Q &que) {
     co_await coke::yield();
 
     while (acquire_count(1)) {
-        co_await que.push(0);
+        co_await push_one(que, 0);
     }
 }
 
-coke::Task<> que_push_range(coke::Queue<int> &que) {
+template<typename Q>
+coke::Task<> que_push_range(Q &que) {
     co_await coke::yield();
     std::vector<int> v(batch_size, 0);
 
     while (acquire_count(batch_size)) {
         auto first = v.begin(), last = v.end();
         if (!que.full())
-            first = que.try_push_range(first, last);
+            first = try_push_some(que, first, last);
 
         while (first != last) {
-            co_await que.push(*first);
+            co_await push_one(que, *first);
             ++first;
         }
     }
 }
 
-coke::Task<> que_try_pop(coke::Queue<int> &que) {
+template<typename Q>
+coke::Task<> que_try_pop(Q &que) {
     co_await coke::yield();
 
     int value;
     while (!que.closed()) {
-        if (!que.empty() && que.try_pop(value))
+        if (!que.empty() && try_pop_one(que, value))
             continue;
 
-        co_await que.pop(value);
+        co_await pop_one(que, value);
     }
 }
 
-coke::Task<> que_pop(coke::Queue<int> &que) {
+template<typename Q>
+coke::Task<> que_pop(Q &que) {
     co_await coke::yield();
 
     int value;
     while (!que.closed()) {
-        co_await que.pop(value);
+        co_await pop_one(que, value);
     }
 }
 
-coke::Task<> que_pop_range(coke::Queue<int> &que) {
+template<typename Q>
+coke::Task<> que_pop_range(Q &que) {
     co_await coke::yield();
 
     std::vector<int> v(batch_size, 0);
@@ -94,22 +213,26 @@ coke::Task<> que_pop_range(coke::Queue<int> &que) {
         auto first = v.begin(), last = v.end();
 
         if (!que.empty())
-            first = que.try_pop_range(first, last);
+            first = try_pop_some(que, first, last);
 
         if (first == v.begin())
-            co_await que.pop(value);
+            co_await pop_one(que, value);
     }
 }
 
 coke::Task<> warm_up() { co_await coke::yield(); }
 
-using push_func_t = coke::Task<>(*)(coke::Queue<int> &);
-using pop_func_t = coke::Task<>(*)(coke::Queue<int> &);
+template<typename Q>
+using push_func_t = coke::Task<>(*)(Q &);
 
-coke::Task<> benchmark_que(push_func_t push, pop_func_t pop) {
+template<typename Q>
+using pop_func_t = coke::Task<>(*)(Q &);
+
+template<typename Q>
+coke::Task<> benchmark_que(push_func_t<Q> push, pop_func_t<Q> pop) {
     std::vector<coke::Task<>> push_tasks;
     std::vector<coke::Future<void>> pop_futs;
-    coke::Queue<int> que((std::size_t)que_size);
+    Q que((std::size_t)que_size);
 
     push_tasks.reserve(concurrency);
     pop_futs.reserve(concurrency);
@@ -130,44 +253,69 @@ coke::Task<> benchmark_que(push_func_t push, pop_func_t pop) {
     }
 }
 
+template<typename Q>
 coke::Task<> bench_try_push_pop() {
-    return benchmark_que(que_try_push, que_try_pop);
+    return benchmark_que<Q>(que_try_push<Q>, que_try_pop<Q>);
 }
 
+template<typename Q>
 coke::Task<> bench_push_pop() {
-    return benchmark_que(que_push, que_pop);
+    return benchmark_que<Q>(que_push<Q>, que_pop<Q>);
 }
 
+template<typename Q>
 coke::Task<> bench_push_pop_range() {
-    return benchmark_que(que_push_range, que_pop_range);
+    return benchmark_que<Q>(que_push_range<Q>, que_pop_range<Q>);
 }
 
-using bench_func_t = coke::Task<> (*)();
-coke::Task<> do_benchmark(const char *name, bench_func_t func) {
-    int run_times = 0;
-    long long start, total_cost = 0;
-    std::vector<long long> costs;
-    double mean, stddev, tps;
+// One producer and one consumer, which is the only case SpscQueue supports.
+template<typename Q>
+coke::Task<> bench_spsc() {
+    Q que((std::size_t)que_size);
+    auto fut = coke::create_future(que_try_pop<Q>(que));
 
-    for (int i = 0; i < times; i++) {
-        counter = 0;
+    co_await que_try_push<Q>(que);
+    que.close();
 
-        start = current_msec();
-        co_await func();
-        costs.push_back(current_msec() - start);
-        total_cost += costs.back();
+    co_await fut.wait();
+    fut.get();
+}
+
+// Fill the queue with `total` random elements by range and then drain it, the
+// pops are dominated by the cache misses of the heap when total is large.
+template<typename Q>
+coke::Task<> bench_fill_drain() {
+    Q que((std::size_t)total);
+    std::vector<int> v(batch_size);
+    uint32_t x = 1;
+    int value;
 
-        run_times++;
+    co_await coke::yield();
 
-        if (total_cost >= max_secs_per_test * 1000)
-            break;
+    for (int i = 0; i < total; i += batch_size) {
+        for (int &y : v) {
+            x = x * 1664525u + 1013904223u;
+            y = (int)(x >> 1);
+        }
+
+        int n = std::min(batch_size, total - i);
+        que.try_push_range(v.begin(), v.begin() + n);
     }
 
-    data_distribution(costs, mean, stddev);
-    tps = 1.0e3 * total / (mean + 1e-9);
+    while (que.try_pop(value))
+        ;
+}
 
-    table_line(std::cout, width, name, total_cost, run_times,
-               mean, stddev, (long)tps);
+using bench_func_t = coke::Task<> (*)();
+coke::Task<> do_benchmark(const char *name, bench_func_t func) {
+    auto trial = [func]() -> coke::Task<> {
+        counter = 0;
+        co_await func();
+    };
+
+    BenchResult r = co_await run_benchmark(name, trial,
+        []() { return (long long)total; }, &alloc_calls);
+    bench_line(std::cout, r);
 }
 
 int main(int argc, char *argv[]) {
@@ -176,15 +324,9 @@ int main(int argc, char *argv[]) {
     args.add_integer(concurrency, 'c', "concurrency")
         .set_default(1024)
         .set_description("The number of concurrent during benchmark");
-    args.add_integer(max_secs_per_test, 'm', "max-secs")
-        .set_default(5)
-        .set_description("Max seconds for each benchmark");
     args.add_integer(total, 't', "total")
         .set_default(100000)
         .set_description("Total tasks in each benchmark");
-    args.add_integer(times, coke::NULL_SHORT_NAME, "times")
-        .set_default(1)
-        .set_description("The number of times each benchmark run");
     args.add_integer(que_size, 'q', "que-size")
         .set_default(1000)
         .set_description("Max elements in queue");
@@ -197,6 +339,7 @@ int main(int argc, char *argv[]) {
     args.add_integer(handler_threads, coke::NULL_SHORT_NAME, "handler")
         .set_default(20)
         .set_description("Number of handler threads");
+    add_bench_options(args);
     args.add_flag(yes, 'y', "yes").set_description("Skip asking before start");
     args.set_help_flag('h', "help");
 
@@ -214,16 +357,38 @@ int main(int argc, char *argv[]) {
 
     coke::sync_wait(warm_up());
 
-    table_line(std::cout, width,
-               "name", "cost", "times",
-               "mean(ms)", "stddev", "per sec");
-    delimiter(std::cout, width, '-');
-
-#define DO_BENCHMARK(func) coke::sync_wait(do_benchmark(#func, bench_ ## func))
-    DO_BENCHMARK(try_push_pop);
-    DO_BENCHMARK(push_pop);
-    DO_BENCHMARK(push_pop_range);
+    bench_width[0] = 28;
+    bench_header(std::cout);
+
+#define DO_BENCHMARK(name, func, Q) \
+    coke::sync_wait(do_benchmark(#name "_" #func, bench_ ## func<Q>))
+#define DO_ALL_BENCHMARK(func) \
+    DO_BENCHMARK(queue, func, Queue); \
+    DO_BENCHMARK(queue_ringbuf, func, RingBufQueue); \
+    DO_BENCHMARK(ring, func, coke::RingQueue<int>); \
+    DO_BENCHMARK(sharded, func, coke::ShardedQueue<int>); \
+    DO_BENCHMARK(priority, func, PriorityQueue); \
+    DO_BENCHMARK(priority_4ary, func, Priority4Queue); \
+    DO_BENCHMARK(priority_8ary, func, Priority8Queue); \
+    DO_BENCHMARK(stack, func, Stack); \
+    DO_BENCHMARK(deque, func, Deque); \
+    DO_BENCHMARK(deque_ringbuf, func, RingBufDeque); \
+    delimiter(std::cout, bench_width)
+
+    DO_ALL_BENCHMARK(try_push_pop);
+    DO_ALL_BENCHMARK(push_pop);
+    DO_ALL_BENCHMARK(push_pop_range);
+
+    DO_BENCHMARK(queue, spsc, Queue);
+    DO_BENCHMARK(ring, spsc, coke::RingQueue<int>);
+    DO_BENCHMARK(spsc, spsc, coke::SpscQueue<int>);
+    delimiter(std::cout, bench_width);
+
+    DO_BENCHMARK(priority, fill_drain, PriorityQueue);
+    DO_BENCHMARK(priority_4ary, fill_drain, Priority4Queue);
+    DO_BENCHMARK(priority_8ary, fill_drain, Priority8Queue);
+#undef DO_ALL_BENCHMARK
 #undef DO_BENCHMARK
 
-    return 0;
+    return write_bench_json("bench_queue") ? 0 : 1;
 }
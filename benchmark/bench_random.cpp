@@ -0,0 +1,173 @@
+/**
+ * Copyright 2024 Coke Project (https://github.com/kedixa/coke)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Authors: kedixa (https://github.com/kedixa)
+*/
+
+#include <atomic>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "bench_common.h"
+#include "coke/coke.h"
+#include "coke/detail/random.h"
+
+std::vector<int> width{16, 8, 8, 6, 8, 6, 12};
+
+long long total{10000000};
+int max_threads = 16;
+int max_secs_per_test = 5;
+int compute_threads = 16;
+int times = 1;
+bool yes = false;
+
+// Keep the results alive so that the generators are not optimized out
+std::atomic<uint64_t> sink;
+
+struct RandU64 {
+    uint64_t operator()() { return coke::rand_u64(); }
+};
+
+struct RandRange {
+    uint64_t operator()() { return coke::rand_range(1000003); }
+};
+
+struct LocalMt {
+    uint64_t operator()() {
+        thread_local std::mt19937_64 mt(coke::detail::rand_seed());
+        return mt();
+    }
+};
+
+// A global generator protected by a mutex
+struct LockedMt {
+    uint64_t operator()() {
+        static std::mutex mtx;
+        static std::mt19937_64 mt(coke::detail::rand_seed());
+
+        std::lock_guard<std::mutex> lg(mtx);
+        return mt();
+    }
+};
+
+template<typename Gen>
+coke::Task<> bench_gen(long long n) {
+    Gen gen;
+    uint64_t x = 0;
+
+    // Each worker runs on its own compute thread as far as possible
+    co_await coke::switch_go_thread();
+
+    for (long long i = 0; i < n; i++)
+        x ^= gen();
+
+    sink.fetch_xor(x, std::memory_order_relaxed);
+}
+
+template<typename Gen>
+coke::Task<> bench_all(int n) {
+    std::vector<coke::Task<>> tasks;
+
+    for (int j = 0; j < n; j++)
+        tasks.emplace_back(bench_gen<Gen>(total / n));
+
+    co_await coke::async_wait(std::move(tasks));
+}
+
+coke::Task<> warm_up() { co_await coke::switch_go_thread(); }
+
+using bench_func_t = coke::Task<>(*)(int);
+coke::Task<> do_benchmark(const char *name, bench_func_t func, int n) {
+    int run_times = 0;
+    long long start, total_cost = 0;
+    std::vector<long long> costs;
+    double mean, stddev, ops;
+
+    for (int i = 0; i < times; i++) {
+        start = current_usec();
+        co_await func(n);
+        costs.push_back(current_usec() - start);
+        total_cost += costs.back();
+
+        run_times++;
+
+        if (total_cost >= max_secs_per_test * 1000000LL)
+            break;
+    }
+
+    data_distribution(costs, mean, stddev);
+    ops = 1.0e6 * (double)(total / n * n) / (mean + 1e-9);
+
+    table_line(std::cout, width, name, n, total_cost / 1000, run_times,
+               mean / 1000, stddev / 1000, (long)ops);
+}
+
+int main(int argc, char *argv[]) {
+    coke::OptionParser args;
+
+    args.add_integer(max_threads, 'c', "max-threads")
+        .set_default(16)
+        .set_description("Run with 1, 2, 4, ... up to max-threads workers");
+    args.add_integer(max_secs_per_test, 'm', "max-secs")
+        .set_default(5)
+        .set_description("Max seconds for each benchmark");
+    args.add_integer(total, 't', "total")
+        .set_default(10000000)
+        .set_description("Total random numbers in each benchmark");
+    args.add_integer(times, coke::NULL_SHORT_NAME, "times")
+        .set_default(1)
+        .set_description("The number of times each benchmark run");
+    args.add_integer(compute_threads, coke::NULL_SHORT_NAME, "compute")
+        .set_default(16)
+        .set_description("Number of compute threads");
+    args.add_flag(yes, 'y', "yes").set_description("Skip asking before start");
+    args.set_help_flag('h', "help");
+
+    int ret = parse_args(args, argc, argv, &yes);
+    if (ret <= 0)
+        return ret;
+
+    coke::GlobalSettings gs;
+    gs.compute_threads = compute_threads;
+    coke::library_init(gs);
+
+    std::cout.precision(2);
+    std::cout.setf(std::ios_base::fixed, std::ios_base::floatfield);
+
+    coke::sync_wait(warm_up());
+
+    table_line(std::cout, width,
+               "name", "threads", "cost", "times",
+               "mean(ms)", "stddev", "per sec");
+    delimiter(std::cout, width, '-');
+
+#define DO_BENCHMARK(name, gen) \
+    do { \
+        for (int n = 1; n <= max_threads; n *= 2) \
+            coke::sync_wait(do_benchmark(name, bench_all<gen>, n)); \
+        delimiter(std::cout, width); \
+    } while (0)
+
+    DO_BENCHMARK("rand_u64", RandU64);
+    DO_BENCHMARK("rand_range", RandRange);
+    DO_BENCHMARK("local_mt19937", LocalMt);
+    DO_BENCHMARK("locked_mt19937", LockedMt);
+#undef DO_BENCHMARK
+
+    return 0;
+}
@@ -0,0 +1,258 @@
+/**
+ * Copyright 2024 Coke Project (https://github.com/kedixa/coke)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Authors: kedixa (https://github.com/kedixa)
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#define BENCH_COUNT_ALLOCATIONS
+#include "bench_common.h"
+#include "coke/coke.h"
+#include "coke/redis/redis_client.h"
+#include "coke/redis/redis_server.h"
+
+alignas(64) std::atomic<long long> current;
+alignas(64) std::atomic<long long> errors;
+
+long long total{100000};
+int max_concurrency = 256;
+int port = 8801;
+int poller_threads = 4;
+int handler_threads = 20;
+int compute_threads = -1;
+bool yes = false;
+
+std::vector<int> value_sizes{16, 1024, 16384};
+std::vector<int> pipeline_depths{1, 8, 64};
+std::string value;
+std::string key("bench_key");
+
+// Take `n` commands from total, `current` counts commands not operations
+bool next(long long n) {
+    long long cur = current.fetch_add(n, std::memory_order_relaxed);
+    if (cur + n <= total)
+        return true;
+
+    current.fetch_sub(n, std::memory_order_relaxed);
+    return false;
+}
+
+// Reply `size` bytes for "GET size"
+coke::Task<> get_handler(coke::RedisServerContext &ctx,
+                         std::vector<std::string> &params) {
+    coke::RedisValue v;
+
+    if (params.size() == 1) {
+        std::size_t size = std::strtoul(params[0].c_str(), nullptr, 10);
+        v.set_string(value.data(), std::min(size, value.size()));
+    }
+    else
+        v.set_error("ERR wrong number of arguments for 'get' command");
+
+    ctx.get_resp().set_result(v);
+    co_return;
+}
+
+coke::Task<> set_handler(coke::RedisServerContext &ctx,
+                         std::vector<std::string> &) {
+    coke::RedisValue v;
+    v.set_status("OK");
+    ctx.get_resp().set_result(v);
+    co_return;
+}
+
+coke::Task<> bench_get(coke::RedisClient &cli, const std::string &arg, int) {
+    std::vector<std::string> params{arg};
+    std::string cmd("GET");
+
+    while (next(1)) {
+        BenchOpTimer t;
+        coke::RedisResult res = co_await cli.request(cmd, params);
+
+        if (res.state != coke::STATE_SUCCESS)
+            errors.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+coke::Task<> bench_set(coke::RedisClient &cli, const std::string &arg, int) {
+    std::vector<std::string> params{key, value.substr(0, std::stoul(arg))};
+    std::string cmd("SET");
+
+    while (next(1)) {
+        BenchOpTimer t;
+        coke::RedisResult res = co_await cli.request(cmd, params);
+
+        if (res.state != coke::STATE_SUCCESS)
+            errors.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+// Each operation is a pipeline of `depth` commands, the latency is of the
+// whole pipeline but the ops are counted by commands
+coke::Task<> bench_pipeline(coke::RedisClient &cli, const std::string &arg,
+                            int depth) {
+    coke::RedisPipeline pipe;
+    std::string cmd("GET");
+
+    for (int i = 0; i < depth; i++)
+        pipe.add(cmd, {arg});
+
+    while (next(depth)) {
+        BenchOpTimer t;
+        coke::RedisPipelineResult res = co_await cli.pipeline(pipe);
+
+        if (res.state != coke::STATE_SUCCESS)
+            errors.fetch_add(depth, std::memory_order_relaxed);
+    }
+}
+
+coke::Task<> bench_batch(coke::RedisClient &cli, const std::string &arg, int) {
+    std::vector<std::string> params{arg};
+    std::string cmd("GET");
+
+    while (next(1)) {
+        BenchOpTimer t;
+        coke::RedisBatchResult res = co_await cli.batch_request(cmd, params);
+
+        if (res.state != coke::STATE_SUCCESS)
+            errors.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+using bench_func_t = coke::Task<>(*)(coke::RedisClient &,
+                                     const std::string &, int);
+
+coke::Task<> do_benchmark(const char *name, bench_func_t func, int conc,
+                          int size, int depth = 1) {
+    coke::RedisClientParams params;
+    params.host = "127.0.0.1";
+    params.port = port;
+
+    coke::RedisClient cli(params);
+    std::string arg = std::to_string(size);
+
+    std::string full_name(name);
+    full_name.append("_c").append(std::to_string(conc))
+             .append("_v").append(arg);
+    if (depth > 1)
+        full_name.append("_d").append(std::to_string(depth));
+
+    auto trial = [&, func, conc, depth]() -> coke::Task<> {
+        std::vector<coke::Task<>> tasks;
+        current = 0;
+
+        for (int j = 0; j < conc; j++)
+            tasks.emplace_back(func(cli, arg, depth));
+
+        co_await coke::async_wait(std::move(tasks));
+    };
+
+    errors = 0;
+    BenchResult r = co_await run_benchmark(full_name.c_str(), trial,
+        []() { return current.load(); }, &bench_alloc_calls);
+    bench_line(std::cout, r);
+
+    if (errors.load() != 0)
+        std::cout << full_name << " errors: " << errors.load() << std::endl;
+}
+
+int main(int argc, char *argv[]) {
+    coke::OptionParser args;
+
+    args.add_integer(max_concurrency, 'c', "max-concurrency")
+        .set_default(256)
+        .set_description("Run with 1, 4, 16, ... up to max-concurrency "
+                         "clients");
+    args.add_integer(total, 't', "total")
+        .set_default(100000)
+        .set_description("Total commands in each benchmark");
+    args.add_integer(port, 'p', "port")
+        .set_default(8801)
+        .set_description("Port of the loopback server");
+    args.add_integer(poller_threads, coke::NULL_SHORT_NAME, "poller")
+        .set_default(4)
+        .set_description("Number of poller threads");
+    args.add_integer(handler_threads, coke::NULL_SHORT_NAME, "handler")
+        .set_default(20)
+        .set_description("Number of handler threads");
+    args.add_integer(compute_threads, coke::NULL_SHORT_NAME, "compute")
+        .set_default(-1)
+        .set_description("Number of compute threads");
+    add_bench_options(args);
+    args.add_flag(yes, 'y', "yes").set_description("Skip asking before start");
+    args.set_help_flag('h', "help");
+
+    int ret = parse_args(args, argc, argv, &yes);
+    if (ret <= 0)
+        return ret;
+
+    coke::GlobalSettings gs;
+    gs.poller_threads = poller_threads;
+    gs.handler_threads = handler_threads;
+    gs.compute_threads = compute_threads;
+    // The clients of the benchmark make many connections to one host
+    gs.endpoint_params.max_connections = 4096;
+    coke::library_init(gs);
+
+    value.assign(value_sizes.back(), 'x');
+
+    coke::RedisServer server;
+    server.add_command("get", get_handler);
+    server.add_command("set", set_handler);
+
+    if (server.start(port) != 0) {
+        std::cerr << "RedisServer start failed " << strerror(errno)
+                  << std::endl;
+        return 1;
+    }
+
+    std::cout.precision(2);
+    std::cout.setf(std::ios_base::fixed, std::ios_base::floatfield);
+
+    bench_width[0] = 24;
+    bench_header(std::cout);
+
+    for (int c = 1; c <= max_concurrency; c *= 4)
+        coke::sync_wait(do_benchmark("get", bench_get, c, value_sizes[0]));
+    delimiter(std::cout, bench_width);
+
+    for (int size : value_sizes) {
+        coke::sync_wait(do_benchmark("get", bench_get, max_concurrency, size));
+        coke::sync_wait(do_benchmark("set", bench_set, max_concurrency, size));
+    }
+    delimiter(std::cout, bench_width);
+
+    for (int depth : pipeline_depths) {
+        for (int c : {1, 16}) {
+            coke::sync_wait(do_benchmark("pipeline", bench_pipeline, c,
+                                         value_sizes[0], depth));
+        }
+    }
+    delimiter(std::cout, bench_width);
+
+    for (int c = 1; c <= max_concurrency; c *= 4)
+        coke::sync_wait(do_benchmark("batch", bench_batch, c, value_sizes[0]));
+
+    server.stop();
+
+    return write_bench_json("bench_redis") ? 0 : 1;
+}
@@ -0,0 +1,155 @@
+/**
+ * Copyright 2024 Coke Project (https://github.com/kedixa/coke)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Authors: kedixa (https://github.com/kedixa)
+*/
+
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+#include "bench_common.h"
+#include "coke/coke.h"
+
+std::vector<int> width{14, 8, 10, 10, 10, 10};
+
+int concurrency = 200000;
+int times = 3;
+int poller_threads = 6;
+int handler_threads = 20;
+bool yes = false;
+
+long long resident_bytes() {
+    long long pages = 0, rss = 0;
+    std::ifstream ifs("/proc/self/statm");
+
+    if (!(ifs >> pages >> rss))
+        return 0;
+
+    return rss * (long long)sysconf(_SC_PAGESIZE);
+}
+
+// benchmark
+
+coke::Task<> bench_void() { co_return; }
+
+coke::Task<int> bench_int() { co_return 1; }
+
+coke::Task<std::string> bench_string() { co_return std::string(); }
+
+coke::Task<> bench_locals() {
+    int a[8] = {0};
+    co_await coke::yield();
+    a[0]++;
+}
+
+coke::Task<> bench_context() {
+    coke::Task<> task = bench_void();
+    task.set_context(std::make_shared<int>(0));
+    return task;
+}
+
+template<typename T>
+void do_benchmark(const char *name, coke::Task<T> (*func)()) {
+    std::vector<std::vector<coke::Task<T>>> holder;
+    std::vector<long long> mems, costs;
+    double mem_mean, mem_stddev, cost_mean, cost_stddev;
+
+    for (int i = 0; i < times; i++) {
+        std::vector<coke::Task<T>> tasks;
+        tasks.reserve(concurrency);
+
+        long long rss = resident_bytes();
+        long long start = current_usec();
+
+        // Frames are allocated when coroutines are created, and suspended at
+        // initial_suspend, so the resident memory growth is all about frames.
+        for (int j = 0; j < concurrency; j++)
+            tasks.emplace_back(func());
+
+        costs.push_back(current_usec() - start);
+        mems.push_back(resident_bytes() - rss);
+
+        // Keep frames alive until all rounds finished, otherwise the memory
+        // released by previous round will be reused.
+        holder.push_back(std::move(tasks));
+    }
+
+    for (auto &tasks : holder)
+        coke::sync_wait(std::move(tasks));
+
+    data_distribution(mems, mem_mean, mem_stddev);
+    data_distribution(costs, cost_mean, cost_stddev);
+
+    table_line(std::cout, width, name, concurrency,
+               (long)(mem_mean / 1024), mem_mean / concurrency,
+               cost_mean / 1000, 1.0e3 * cost_mean / concurrency);
+}
+
+int main(int argc, char *argv[]) {
+    coke::OptionParser args;
+
+    args.add_integer(concurrency, 'c', "concurrency")
+        .set_default(200000)
+        .set_description("The number of coroutines alive at the same time");
+    args.add_integer(times, coke::NULL_SHORT_NAME, "times")
+        .set_default(3)
+        .set_description("The number of times each benchmark run");
+    args.add_integer(poller_threads, coke::NULL_SHORT_NAME, "poller")
+        .set_default(6)
+        .set_description("Number of poller threads");
+    args.add_integer(handler_threads, coke::NULL_SHORT_NAME, "handler")
+        .set_default(20)
+        .set_description("Number of handler threads");
+    args.add_flag(yes, 'y', "yes").set_description("Skip asking before start");
+    args.set_help_flag('h', "help");
+
+    int ret = parse_args(args, argc, argv, &yes);
+    if (ret <= 0)
+        return ret;
+
+    coke::GlobalSettings gs;
+    gs.poller_threads = poller_threads;
+    gs.handler_threads = handler_threads;
+    coke::library_init(gs);
+
+    std::cout.precision(2);
+    std::cout.setf(std::ios_base::fixed, std::ios_base::floatfield);
+
+    std::cout << "sizeof(CoPromise<void>): "
+              << sizeof(coke::Task<void>::promise_type) << std::endl
+              << "sizeof(CoPromise<int>): "
+              << sizeof(coke::Task<int>::promise_type) << std::endl
+              << "sizeof(CoPromise<std::string>): "
+              << sizeof(coke::Task<std::string>::promise_type) << std::endl
+              << std::endl;
+
+    table_line(std::cout, width,
+               "name", "frames", "rss(KB)", "per frame",
+               "cost(ms)", "ns/frame");
+    delimiter(std::cout, width, '-');
+
+#define DO_BENCHMARK(func) do_benchmark(#func, bench_ ## func)
+    DO_BENCHMARK(void);
+    DO_BENCHMARK(int);
+    DO_BENCHMARK(string);
+    DO_BENCHMARK(locals);
+    DO_BENCHMARK(context);
+#undef DO_BENCHMARK
+
+    return 0;
+}
@@ -33,12 +33,9 @@ alignas(64) std::atomic<long long> current;
 constexpr int pool_size = 10;
 std::string name_pool[pool_size];
 uint64_t id_pool[pool_size];
-std::vector<int> width{18, 8, 6, 8, 6, 10};
 
 long long total{100000};
 int concurrency = 4096;
-int times = 1;
-int max_secs_per_test = 5;
 int handler_threads = 20;
 int poller_threads = 6;
 int compute_threads = -1;
@@ -89,18 +86,39 @@ coke::Task<> bench_default_timer() {
     long long i;
 
     while (next(i)) {
+        BenchOpTimer t;
         co_await coke::sleep(microseconds(dist(mt)));
     }
 }
 
+coke::Task<> bench_coarse_timer() {
+    std::mt19937_64 mt(current_msec());
+    long long i;
+
+    while (next(i)) {
+        BenchOpTimer t;
+        co_await coke::sleep_coarse(microseconds(dist(mt)));
+    }
+}
+
 coke::Task<> bench_yield() {
     long long i;
 
     while (next(i)) {
+        BenchOpTimer t;
         co_await coke::yield();
     }
 }
 
+coke::Task<> bench_exec_yield() {
+    long long i;
+
+    while (next(i)) {
+        BenchOpTimer t;
+        co_await coke::exec_yield();
+    }
+}
+
 coke::Task<> bench_timer_in_task() {
     std::mt19937_64 mt(current_msec());
     long long i;
@@ -228,6 +246,53 @@ coke::Task<> bench_timer_by_addr() {
     }
 }
 
+coke::Task<> bench_cancel_by_addr() {
+    std::mt19937_64 mt(current_msec());
+    uint64_t id;
+    long long i;
+
+    while (next(i)) {
+        id = coke::get_unique_id() * 8;
+        void *addr = (void *)(uintptr_t)id;
+        auto awaiter = coke::sleep(addr, microseconds(dist(mt)));
+        coke::cancel_sleep_by_addr(addr);
+        co_await std::move(awaiter);
+    }
+}
+
+coke::Task<> bench_detach_by_addr() {
+    std::mt19937_64 mt(current_msec());
+    uint64_t id;
+    long long i;
+
+    co_await coke::switch_go_thread();
+
+    while (next(i)) {
+        id = coke::get_unique_id() * 8;
+        void *addr = (void *)(uintptr_t)id;
+        auto awaiter = coke::sleep(addr, microseconds(dist(mt)));
+        detach(std::move(awaiter)).detach();
+        coke::cancel_sleep_by_addr(addr);
+    }
+}
+
+// The cancel lands around the expiry, racing with the timer's callback
+coke::Task<> bench_race_by_addr() {
+    std::mt19937_64 mt(current_msec());
+    uint64_t id;
+    long long i;
+
+    while (next(i)) {
+        id = coke::get_unique_id() * 8;
+        void *addr = (void *)(uintptr_t)id;
+        auto awaiter = coke::sleep(addr, microseconds(dist(mt)));
+        detach(std::move(awaiter)).detach();
+
+        co_await coke::sleep(microseconds(dist(mt)));
+        coke::cancel_sleep_by_addr(addr);
+    }
+}
+
 coke::Task<> bench_cancel_by_id() {
     std::mt19937_64 mt(current_msec());
     uint64_t id;
@@ -345,34 +410,19 @@ coke::Task<> warm_up() {
 
 using bench_func_t = coke::Task<>(*)();
 coke::Task<> do_benchmark(const char *name, bench_func_t func) {
-    int run_times = 0;
-    long long start, total_cost = 0;
-    std::vector<long long> costs;
-    double mean, stddev, tps;
-
-    for (int i = 0; i < times; i++) {
+    auto trial = [func]() -> coke::Task<> {
         std::vector<coke::Task<>> tasks;
         current = 0;
 
         for (int j = 0; j < concurrency; j++)
             tasks.emplace_back(func());
 
-        start = current_msec();
         co_await coke::async_wait(std::move(tasks));
-        costs.push_back(current_msec() - start);
-        total_cost += costs.back();
-
-        run_times++;
-
-        if (total_cost >= max_secs_per_test * 1000)
-            break;
-    }
-
-    data_distribution(costs, mean, stddev);
-    tps = 1.0e3 * current / (mean + 1e-9);
+    };
 
-    table_line(std::cout, width, name, total_cost, run_times,
-               mean, stddev, (long)tps);
+    BenchResult r = co_await run_benchmark(name, trial,
+        []() { return current.load(); });
+    bench_line(std::cout, r);
 }
 
 int main(int argc, char *argv[]) {
@@ -381,15 +431,9 @@ int main(int argc, char *argv[]) {
     args.add_integer(concurrency, 'c', "concurrency")
         .set_default(1024)
         .set_description("The number of concurrent during benchmark");
-    args.add_integer(max_secs_per_test, 'm', "max-secs")
-        .set_default(5)
-        .set_description("Max seconds for each benchmark");
     args.add_integer(total, 't', "total")
         .set_default(100000)
         .set_description("Total tasks in each benchmark");
-    args.add_integer(times, coke::NULL_SHORT_NAME, "times")
-        .set_default(1)
-        .set_description("The number of times each benchmark run");
     args.add_integer(poller_threads, coke::NULL_SHORT_NAME, "poller")
         .set_default(6)
         .set_description("Number of poller threads");
@@ -399,6 +443,7 @@ int main(int argc, char *argv[]) {
     args.add_integer(compute_threads, coke::NULL_SHORT_NAME, "compute")
         .set_default(-1)
         .set_description("Number of compute threads");
+    add_bench_options(args);
     args.add_flag(yes, 'y', "yes").set_description("Skip asking before start");
     args.set_help_flag('h', "help");
 
@@ -423,17 +468,16 @@ int main(int argc, char *argv[]) {
         id_pool[i] = coke::get_unique_id();
     }
 
-    table_line(std::cout, width,
-               "name", "cost", "times",
-               "mean(ms)", "stddev", "per sec");
-    delimiter(std::cout, width, '-');
+    bench_header(std::cout);
 
 #define DO_BENCHMARK(func) coke::sync_wait(do_benchmark(#func, bench_ ## func))
     DO_BENCHMARK(wf_repeat);
     DO_BENCHMARK(default_timer);
+    DO_BENCHMARK(coarse_timer);
     DO_BENCHMARK(yield);
+    DO_BENCHMARK(exec_yield);
     DO_BENCHMARK(timer_in_task);
-    delimiter(std::cout, width);
+    delimiter(std::cout, bench_width);
 
     DO_BENCHMARK(timer_by_name);
     DO_BENCHMARK(cancel_by_name);
@@ -445,10 +489,13 @@ int main(int argc, char *argv[]) {
 
     if (concurrency > 1)
         DO_BENCHMARK(name_one_by_one);
-    delimiter(std::cout, width);
+    delimiter(std::cout, bench_width);
 
     DO_BENCHMARK(timer_by_id);
     DO_BENCHMARK(timer_by_addr);
+    DO_BENCHMARK(cancel_by_addr);
+    DO_BENCHMARK(detach_by_addr);
+    DO_BENCHMARK(race_by_addr);
     DO_BENCHMARK(cancel_by_id);
     DO_BENCHMARK(detach_by_id);
     // disable this test case, it always make workflow deadlock
@@ -463,5 +510,5 @@ int main(int argc, char *argv[]) {
         DO_BENCHMARK(id_one_by_one);
 #undef DO_BENCHMARK
 
-    return 0;
+    return write_bench_json("bench_timer") ? 0 : 1;
 }
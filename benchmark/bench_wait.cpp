@@ -0,0 +1,328 @@
+/**
+ * Copyright 2024 Coke Project (https://github.com/kedixa/coke)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Authors: kedixa (https://github.com/kedixa)
+*/
+
+#include <array>
+#include <atomic>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "bench_common.h"
+#include "coke/coke.h"
+
+alignas(64) std::atomic<long long> current;
+std::vector<int> width{16, 8, 6, 8, 6, 10};
+
+long long total{100000};
+int concurrency = 64;
+int fan_out = 8;
+int fan_in = 10000;
+int max_secs_per_test = 5;
+int poller_threads = 6;
+int handler_threads = 20;
+int times = 1;
+bool yes = false;
+
+/**
+ * Large payload type whose move is as expensive as copy, like a response
+ * struct with inline buffers.
+*/
+struct Payload {
+    std::array<char, 4096> data;
+};
+
+bool next(long long &cur) {
+    cur = current.fetch_add(1, std::memory_order_relaxed);
+    if (cur < total)
+        return true;
+
+    current.fetch_sub(1, std::memory_order_relaxed);
+    return false;
+}
+
+coke::Task<Payload> make_payload(long long i) {
+    Payload p;
+    p.data[0] = (char)i;
+    co_return p;
+}
+
+coke::Task<Payload> nested_payload(long long i) {
+    co_return co_await make_payload(i);
+}
+
+// Wait a vector of tasks by moving each result through the promise and the
+// awaiter, which is the way before the result slot is introduced.
+coke::Task<> move_wait_helper(coke::Task<Payload> task, Payload &out,
+                              coke::Latch &lt) {
+    out = co_await std::move(task);
+    lt.count_down();
+}
+
+coke::Task<std::vector<Payload>>
+move_wait(std::vector<coke::Task<Payload>> tasks) {
+    std::size_t n = tasks.size();
+    std::vector<Payload> v(n);
+    coke::Latch lt(n);
+
+    for (std::size_t i = 0; i < n; i++)
+        coke::detach(move_wait_helper(std::move(tasks[i]), v[i], lt));
+
+    co_await lt.wait();
+    co_return v;
+}
+
+// benchmark
+
+coke::Task<> bench_async_wait() {
+    long long i;
+
+    while (next(i)) {
+        std::vector<coke::Task<Payload>> tasks;
+        for (int j = 0; j < fan_out; j++)
+            tasks.emplace_back(make_payload(i));
+
+        co_await coke::async_wait(std::move(tasks));
+    }
+}
+
+coke::Task<> bench_move_wait() {
+    long long i;
+
+    while (next(i)) {
+        std::vector<coke::Task<Payload>> tasks;
+        for (int j = 0; j < fan_out; j++)
+            tasks.emplace_back(make_payload(i));
+
+        co_await move_wait(std::move(tasks));
+    }
+}
+
+coke::Task<> bench_nested_async() {
+    long long i;
+
+    while (next(i)) {
+        std::vector<coke::Task<Payload>> tasks;
+        for (int j = 0; j < fan_out; j++)
+            tasks.emplace_back(nested_payload(i));
+
+        co_await coke::async_wait(std::move(tasks));
+    }
+}
+
+coke::Task<> bench_nested_move() {
+    long long i;
+
+    while (next(i)) {
+        std::vector<coke::Task<Payload>> tasks;
+        for (int j = 0; j < fan_out; j++)
+            tasks.emplace_back(nested_payload(i));
+
+        co_await move_wait(std::move(tasks));
+    }
+}
+
+coke::Task<> bench_when_all() {
+    long long i;
+
+    while (next(i)) {
+        std::vector<coke::Task<Payload>> tasks;
+        for (int j = 0; j < fan_out; j++)
+            tasks.emplace_back(make_payload(i));
+
+        co_await coke::when_all(std::move(tasks));
+    }
+}
+
+coke::Task<> bench_nested_when_all() {
+    long long i;
+
+    while (next(i)) {
+        std::vector<coke::Task<Payload>> tasks;
+        for (int j = 0; j < fan_out; j++)
+            tasks.emplace_back(nested_payload(i));
+
+        co_await coke::when_all(std::move(tasks));
+    }
+}
+
+coke::Task<int> small_task(long long i) { co_return (int)i; }
+
+// Children that finish synchronously, which measures the join overhead only.
+coke::Task<> bench_small_async() {
+    long long i;
+
+    while (next(i)) {
+        std::vector<coke::Task<int>> tasks;
+        for (int j = 0; j < fan_out; j++)
+            tasks.emplace_back(small_task(i));
+
+        co_await coke::async_wait(std::move(tasks));
+    }
+}
+
+coke::Task<> bench_small_when_all() {
+    long long i;
+
+    while (next(i)) {
+        std::vector<coke::Task<int>> tasks;
+        for (int j = 0; j < fan_out; j++)
+            tasks.emplace_back(small_task(i));
+
+        co_await coke::when_all(std::move(tasks));
+    }
+}
+
+coke::Task<> yield_task() { co_await coke::yield(); }
+
+// One coroutine waits for `fan_in` tasks that complete on many threads at
+// about the same time, which measures the cost of counting down the latch.
+coke::Task<> bench_fan_in() {
+    long long i;
+
+    while (next(i)) {
+        std::vector<coke::Task<>> tasks;
+        tasks.reserve(fan_in);
+
+        tasks.emplace_back(yield_task());
+        for (int j = 1; j < fan_in && next(i); j++)
+            tasks.emplace_back(yield_task());
+
+        co_await coke::async_wait(std::move(tasks));
+    }
+}
+
+coke::Task<> bench_fan_in_when_all() {
+    long long i;
+
+    while (next(i)) {
+        std::vector<coke::Task<>> tasks;
+        tasks.reserve(fan_in);
+
+        tasks.emplace_back(yield_task());
+        for (int j = 1; j < fan_in && next(i); j++)
+            tasks.emplace_back(yield_task());
+
+        co_await coke::when_all(std::move(tasks));
+    }
+}
+
+coke::Task<> warm_up() { co_await coke::yield(); }
+
+using bench_func_t = coke::Task<>(*)();
+coke::Task<> do_benchmark(const char *name, bench_func_t func,
+                          int n = -1) {
+    int run_times = 0;
+    long long start, total_cost = 0;
+    std::vector<long long> costs;
+    double mean, stddev, tps;
+
+    for (int i = 0; i < times; i++) {
+        std::vector<coke::Task<>> tasks;
+        current = 0;
+
+        for (int j = 0; j < (n < 0 ? concurrency : n); j++)
+            tasks.emplace_back(func());
+
+        start = current_msec();
+        co_await coke::async_wait(std::move(tasks));
+        costs.push_back(current_msec() - start);
+        total_cost += costs.back();
+
+        run_times++;
+
+        if (total_cost >= max_secs_per_test * 1000)
+            break;
+    }
+
+    data_distribution(costs, mean, stddev);
+    tps = 1.0e3 * current / (mean + 1e-9);
+
+    table_line(std::cout, width, name, total_cost, run_times,
+               mean, stddev, (long)tps);
+}
+
+int main(int argc, char *argv[]) {
+    coke::OptionParser args;
+
+    args.add_integer(concurrency, 'c', "concurrency")
+        .set_default(64)
+        .set_description("The number of concurrent during benchmark");
+    args.add_integer(fan_out, 'f', "fan-out")
+        .set_default(8)
+        .set_description("The number of tasks waited together");
+    args.add_integer(fan_in, coke::NULL_SHORT_NAME, "fan-in")
+        .set_default(10000)
+        .set_description("The number of tasks waited together in fan_in");
+    args.add_integer(max_secs_per_test, 'm', "max-secs")
+        .set_default(5)
+        .set_description("Max seconds for each benchmark");
+    args.add_integer(total, 't', "total")
+        .set_default(100000)
+        .set_description("Total tasks in each benchmark");
+    args.add_integer(times, coke::NULL_SHORT_NAME, "times")
+        .set_default(1)
+        .set_description("The number of times each benchmark run");
+    args.add_integer(poller_threads, coke::NULL_SHORT_NAME, "poller")
+        .set_default(6)
+        .set_description("Number of poller threads");
+    args.add_integer(handler_threads, coke::NULL_SHORT_NAME, "handler")
+        .set_default(20)
+        .set_description("Number of handler threads");
+    args.add_flag(yes, 'y', "yes").set_description("Skip asking before start");
+    args.set_help_flag('h', "help");
+
+    int ret = parse_args(args, argc, argv, &yes);
+    if (ret <= 0)
+        return ret;
+
+    coke::GlobalSettings gs;
+    gs.poller_threads = poller_threads;
+    gs.handler_threads = handler_threads;
+    coke::library_init(gs);
+
+    std::cout.precision(2);
+    std::cout.setf(std::ios_base::fixed, std::ios_base::floatfield);
+
+    coke::sync_wait(warm_up());
+
+    table_line(std::cout, width,
+               "name", "cost", "times",
+               "mean(ms)", "stddev", "per sec");
+    delimiter(std::cout, width, '-');
+
+#define DO_BENCHMARK(func) coke::sync_wait(do_benchmark(#func, bench_ ## func))
+    DO_BENCHMARK(async_wait);
+    DO_BENCHMARK(move_wait);
+    DO_BENCHMARK(when_all);
+    delimiter(std::cout, width);
+
+    DO_BENCHMARK(nested_async);
+    DO_BENCHMARK(nested_move);
+    DO_BENCHMARK(nested_when_all);
+    delimiter(std::cout, width);
+
+    DO_BENCHMARK(small_async);
+    DO_BENCHMARK(small_when_all);
+    delimiter(std::cout, width);
+
+    coke::sync_wait(do_benchmark("fan_in", bench_fan_in, 1));
+    coke::sync_wait(do_benchmark("fan_in_when_all", bench_fan_in_when_all, 1));
+#undef DO_BENCHMARK
+
+    return 0;
+}
@@ -14,6 +14,8 @@ coke::HttpClientParams cli_params {
     .keep_alive_timeout = 60 * 1000,
     .redirect_max       = 0,
     .proxy              = "",
+    .host_params        = {},
+    .collect_host_stats = false,
 };
 
 coke::HttpClient cli(cli_params);
@@ -0,0 +1,158 @@
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <deque>
+#include <iostream>
+#include <optional>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "coke/go.h"
+#include "coke/wait.h"
+#include "coke/work_steal_deque.h"
+#include "coke/tools/option_parser.h"
+
+/**
+ * This example shows how to balance a compute-heavy fan-out with
+ * coke::WorkStealDeque, instead of a central queue.
+ *
+ * Each worker runs in a coke::go thread and owns a deque. A job splits itself
+ * in half repeatedly, pushes one half into the owner's deque and continues
+ * with the other. The cost of each element grows quickly with its index, so
+ * the jobs at the end are much heavier, and idle workers steal the oldest,
+ * usually biggest, jobs from others.
+ */
+
+struct Job {
+    std::size_t first;
+    std::size_t last;
+};
+
+class Scheduler {
+public:
+    Scheduler(int nworkers, std::size_t grain)
+        : grain(grain), deques(nworkers), storage(nworkers), pending(0)
+    { }
+
+    coke::Task<double> run(std::size_t n) {
+        std::vector<coke::GoAwaiter<void>> workers;
+
+        sum = 0;
+        steals = 0;
+        pending = 1;
+        for (auto &st : storage)
+            st.clear();
+
+        storage[0].push_back(Job{0, n});
+        deques[0].push(&storage[0].back());
+
+        for (int i = 0; i < (int)deques.size(); i++) {
+            std::string name = "work_steal." + std::to_string(i);
+            workers.emplace_back(coke::go(name, [this, i]() { work(i); }));
+        }
+
+        co_await coke::async_wait(std::move(workers));
+        co_return sum.load();
+    }
+
+    long get_steals() const { return steals.load(); }
+
+private:
+    void work(int id) {
+        std::mt19937 mt((unsigned)id);
+        auto &own = deques[id];
+
+        while (pending.load(std::memory_order_acquire) != 0) {
+            std::optional<Job *> job = own.pop();
+
+            if (!job) {
+                int victim = (int)(mt() % deques.size());
+                if (victim != id)
+                    job = deques[victim].steal();
+
+                if (!job) {
+                    std::this_thread::yield();
+                    continue;
+                }
+
+                steals.fetch_add(1, std::memory_order_relaxed);
+            }
+
+            execute(**job, id);
+        }
+    }
+
+    void execute(Job job, int id) {
+        while (job.last - job.first > grain) {
+            std::size_t mid = job.first + (job.last - job.first) / 2;
+
+            // The elements of std::deque never move, only the owner adds
+            // jobs to its storage and the thieves only read them.
+            storage[id].push_back(Job{mid, job.last});
+            pending.fetch_add(1, std::memory_order_relaxed);
+            deques[id].push(&storage[id].back());
+            job.last = mid;
+        }
+
+        double s = 0;
+        for (std::size_t i = job.first; i < job.last; i++)
+            s += heavy(i);
+
+        sum.fetch_add(s, std::memory_order_relaxed);
+        pending.fetch_sub(1, std::memory_order_release);
+    }
+
+    static double heavy(std::size_t i) {
+        double x = 0;
+        for (std::size_t k = 0; k < i / 64 + 1; k++)
+            x += std::sin((double)(i + k));
+        return x;
+    }
+
+private:
+    std::size_t grain;
+    std::vector<coke::WorkStealDeque<Job *>> deques;
+    std::vector<std::deque<Job>> storage;
+
+    std::atomic<long> pending;
+    std::atomic<long> steals;
+    std::atomic<double> sum;
+};
+
+int main(int argc, char *argv[]) {
+    std::size_t n = 100000;
+    std::size_t grain = 256;
+    int workers = 4;
+
+    coke::OptionParser args;
+    args.add_integer(n, 'n', "num").set_default(100000)
+        .set_description("Number of elements to compute");
+    args.add_integer(grain, 'g', "grain").set_default(256)
+        .set_description("Max elements of the smallest job");
+    args.add_integer(workers, 'w', "workers").set_default(4)
+        .set_description("Number of workers, no more than compute threads");
+    args.set_help_flag('h', "help");
+
+    if (args.parse(argc, argv) != 0) {
+        args.usage(std::cout);
+        return 0;
+    }
+
+    coke::GlobalSettings g;
+    g.compute_threads = workers;
+    coke::library_init(g);
+
+    Scheduler sched(workers, grain);
+
+    auto start = std::chrono::steady_clock::now();
+    double sum = coke::sync_wait(sched.run(n));
+    std::chrono::duration<double> d = std::chrono::steady_clock::now() - start;
+
+    std::cout << "Sum " << sum << " cost " << d.count() << "s, "
+              << sched.get_steals() << " jobs stolen" << std::endl;
+
+    return 0;
+}
@@ -0,0 +1,220 @@
+/**
+ * Copyright 2024 Coke Project (https://github.com/kedixa/coke)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Authors: kedixa (https://github.com/kedixa)
+*/
+
+#ifndef COKE_ASYNC_GENERATOR_H
+#define COKE_ASYNC_GENERATOR_H
+
+#include <coroutine>
+#include <optional>
+#include <utility>
+
+#include "coke/detail/task_impl.h"
+
+namespace coke {
+
+template<typename T>
+    requires Cokeable<T> && (!std::is_void_v<T>)
+class AsyncGenerator;
+
+namespace detail {
+
+template<typename T>
+class GeneratorPromise;
+
+template<typename T>
+struct YieldAwaiter {
+    using handle_type = std::coroutine_handle<GeneratorPromise<T>>;
+
+    bool await_ready() const noexcept { return false; }
+    void await_resume() const noexcept { }
+
+    std::coroutine_handle<> await_suspend(handle_type h) noexcept {
+        auto prev = h.promise().previous_handle();
+        if (prev)
+            return prev;
+
+        return std::noop_coroutine();
+    }
+};
+
+/**
+ * @brief Promise type of coke::AsyncGenerator<T>. It shares PromiseBase with
+ *        coke::Task, so awaitable objects can be co awaited in the same way,
+ *        and the series of the consumer is used to run the inner tasks.
+*/
+template<typename T>
+class GeneratorPromise : public PromiseBase {
+    using handle_type = std::coroutine_handle<GeneratorPromise<T>>;
+
+public:
+    auto get_return_object() noexcept {
+        return AsyncGenerator<T>(handle_type::from_promise(*this));
+    }
+
+    auto initial_suspend() const noexcept { return std::suspend_always{}; }
+
+    auto final_suspend() const noexcept { return YieldAwaiter<T>{}; }
+
+    YieldAwaiter<T> yield_value(const T &t)
+        noexcept(std::is_nothrow_copy_constructible_v<T>)
+    {
+        value.emplace(t);
+        return {};
+    }
+
+    YieldAwaiter<T> yield_value(T &&t)
+        noexcept(std::is_nothrow_move_constructible_v<T>)
+    {
+        value.emplace(std::move(t));
+        return {};
+    }
+
+    void return_void() const noexcept { }
+
+    std::optional<T> take_value() {
+        raise_exception();
+
+        std::optional<T> ret(std::move(value));
+        value.reset();
+        return ret;
+    }
+
+private:
+    std::optional<T> value;
+};
+
+template<typename T>
+struct [[nodiscard]] GeneratorAwaiter {
+    using promise_type = GeneratorPromise<T>;
+    using handle_type = std::coroutine_handle<promise_type>;
+
+    constexpr static bool __is_coke_awaitable_type = true;
+
+    GeneratorAwaiter(handle_type hdl) noexcept : hdl(hdl) { }
+
+    GeneratorAwaiter(GeneratorAwaiter &&that) noexcept
+        : hdl(std::exchange(that.hdl, nullptr))
+    { }
+
+    bool await_ready() const noexcept { return !hdl || hdl.done(); }
+
+    std::optional<T> await_resume() {
+        if (!hdl)
+            return std::nullopt;
+
+        return hdl.promise().take_value();
+    }
+
+    template<typename PromiseType>
+    auto await_suspend(std::coroutine_handle<PromiseType> h) noexcept {
+        promise_type &p = hdl.promise();
+        p.set_previous_handle(h);
+
+        // Run on the series of the consumer, see TaskAwaiter.
+        if constexpr (IsCokePromise<PromiseType>) {
+            p.set_series(h.promise().get_series());
+            p.inherit_local_context(h.promise().get_local_context());
+        }
+        else
+            p.set_series(nullptr);
+
+        return hdl;
+    }
+
+private:
+    handle_type hdl;
+};
+
+} // namespace detail
+
+/**
+ * @brief Asynchronous generator, the coroutine can co_await any coke
+ *        awaitable object, and co_yield values one by one to the consumer.
+ *
+ *  coke::AsyncGenerator<int> numbers(int n) {
+ *      for (int i = 0; i < n; i++) {
+ *          co_await coke::sleep(0.1);
+ *          co_yield i;
+ *      }
+ *  }
+ *
+ *  coke::Task<> consumer() {
+ *      auto gen = numbers(10);
+ *      while (auto v = co_await gen.next())
+ *          use(*v);
+ *  }
+ *
+ * The generator is started lazily by the first next(), and suspended after
+ * each co_yield until next() is awaited again, so there is at most one value
+ * alive at the same time.
+*/
+template<typename T>
+    requires Cokeable<T> && (!std::is_void_v<T>)
+class [[nodiscard]] AsyncGenerator {
+public:
+    using promise_type = detail::GeneratorPromise<T>;
+    using handle_type = std::coroutine_handle<promise_type>;
+
+    AsyncGenerator() noexcept { }
+
+    AsyncGenerator(AsyncGenerator &&that) noexcept
+        : hdl(std::exchange(that.hdl, nullptr))
+    { }
+
+    AsyncGenerator &operator= (AsyncGenerator &&that) noexcept {
+        if (this != &that)
+            std::swap(this->hdl, that.hdl);
+
+        return *this;
+    }
+
+    ~AsyncGenerator() { if (hdl) hdl.destroy(); }
+
+    /**
+     * @brief Resume the generator until it yields the next value or finishes.
+     *        The returned awaiter must be co awaited immediately, and next()
+     *        must not be called again before the previous one resumes.
+     * @return An awaiter whose result is std::optional<T>, std::nullopt means
+     *         the generator is finished. If the generator throws an
+     *         exception, it will be rethrown here.
+    */
+    detail::GeneratorAwaiter<T> next() noexcept {
+        return detail::GeneratorAwaiter<T>(hdl);
+    }
+
+    /**
+     * @brief Return whether the generator is finished, or not valid.
+    */
+    bool done() const noexcept { return !hdl || hdl.done(); }
+
+    /**
+     * @brief Return whether the generator is valid.
+    */
+    bool valid() const noexcept { return (bool)hdl; }
+
+private:
+    AsyncGenerator(handle_type hdl) noexcept : hdl(hdl) { }
+
+private:
+    handle_type hdl;
+    friend promise_type;
+};
+
+} // namespace coke
+
+#endif // COKE_ASYNC_GENERATOR_H
@@ -46,6 +46,10 @@ namespace coke {
  *      }
  *  };
  * @endcode
+ *
+ * If the result is already known when the awaiter is created, for example a
+ * cache hit, just call `emplace_result` and do not set a task. An awaiter
+ * without task is ready and will not be suspended when co awaited.
 */
 template<Cokeable T>
 class BasicAwaiter;
@@ -0,0 +1,489 @@
+/**
+ * Copyright 2024 Coke Project (https://github.com/kedixa/coke)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Authors: kedixa (https://github.com/kedixa)
+*/
+
+#ifndef COKE_BROADCAST_CHANNEL_H
+#define COKE_BROADCAST_CHANNEL_H
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "coke/detail/basic_concept.h"
+#include "coke/condition.h"
+
+namespace coke {
+
+/**
+ * @brief What to do with a subscriber that falls a whole ring behind.
+*/
+enum class BroadcastPolicy {
+    // Overwrite the oldest event, the subscriber skips what it missed
+    DROP,
+    // The publisher waits until the slowest subscriber catches up
+    BLOCK,
+    // Overwrite the oldest event, the subscriber is disconnected
+    DISCONNECT,
+};
+
+/**
+ * @brief BroadcastChannel delivers every published event to all of its
+ *        subscribers. The events are kept in one shared ring, and each
+ *        subscriber only keeps a cursor into it, so the memory and the work of
+ *        publishing scale with the events rather than events x subscribers.
+ *
+ * The events are shared by std::shared_ptr<const T>, receiving an event only
+ * copies the pointer. A new subscriber starts from the next published event.
+ *
+ * @tparam T Type of the event.
+*/
+template<Cokeable T>
+class BroadcastChannel {
+    struct SubState {
+        SubState *prev{nullptr};
+        SubState *next{nullptr};
+        uint64_t cursor{0};
+        uint64_t dropped{0};
+        bool disconnected{false};
+    };
+
+    using UniqueLock = std::unique_lock<std::mutex>;
+
+public:
+    using SizeType = std::size_t;
+    using ValueType = T;
+    using ValuePtr = std::shared_ptr<const T>;
+
+    class Subscriber {
+    public:
+        Subscriber() noexcept : ch(nullptr) { }
+
+        Subscriber(Subscriber &&that) noexcept
+            : ch(that.ch), st(std::move(that.st))
+        {
+            that.ch = nullptr;
+        }
+
+        Subscriber &operator= (Subscriber &&that) noexcept {
+            if (this != &that) {
+                unsubscribe();
+                ch = that.ch;
+                st = std::move(that.st);
+                that.ch = nullptr;
+            }
+
+            return *this;
+        }
+
+        ~Subscriber() { unsubscribe(); }
+
+        /**
+         * @brief Whether it is subscribing a channel.
+        */
+        bool valid() const noexcept { return ch != nullptr; }
+
+        /**
+         * @brief Leave the channel, it makes room for the publishers if the
+         *        policy is BroadcastPolicy::BLOCK.
+         *
+         * @pre No coroutine is receiving by this subscriber.
+        */
+        void unsubscribe() {
+            if (ch) {
+                ch->remove(st.get());
+                ch = nullptr;
+                st.reset();
+            }
+        }
+
+        /**
+         * @brief Whether it is disconnected because it was too slow, only
+         *        happens when the policy is BroadcastPolicy::DISCONNECT.
+        */
+        bool disconnected() const {
+            UniqueLock lk(ch->mtx);
+            return st->disconnected;
+        }
+
+        /**
+         * @brief Number of the events it missed because it was too slow, only
+         *        counted when the policy is BroadcastPolicy::DROP.
+        */
+        uint64_t dropped() const {
+            UniqueLock lk(ch->mtx);
+            ch->lag(st.get());
+            return st->dropped;
+        }
+
+        /**
+         * @brief Number of the events published but not received yet, at most
+         *        capacity of the channel.
+        */
+        SizeType pending() const {
+            UniqueLock lk(ch->mtx);
+            if (ch->lag(st.get()))
+                return 0;
+
+            return (SizeType)(ch->tail - st->cursor);
+        }
+
+        /**
+         * @brief Try to receive the next event without waiting.
+         *
+         * @param out Receive the event.
+         * @returns Whether an event is received.
+        */
+        bool try_recv(ValuePtr &out) {
+            UniqueLock lk(ch->mtx);
+            return ch->recv_locked(st.get(), out);
+        }
+
+        /**
+         * @brief Receive the next event, wait if there is none.
+         *
+         * @param out Receive the event.
+         *
+         * @returns Coroutine that should co_await immediately.
+         * @retval coke::TOP_SUCCESS If an event is received.
+         * @retval coke::TOP_CLOSED If the channel is closed and all the
+         *         events are received, or the subscriber is disconnected.
+         * @retval See coke::Queue::try_pop_for for others.
+        */
+        Task<int> recv(ValuePtr &out) {
+            return ch->recv_impl(st.get(), detail::TimedWaitHelper{}, out);
+        }
+
+        /**
+         * @brief Same as recv, but wait at most `nsec`.
+        */
+        Task<int> try_recv_for(NanoSec nsec, ValuePtr &out) {
+            return ch->recv_impl(st.get(), detail::TimedWaitHelper{nsec}, out);
+        }
+
+        /**
+         * @brief Same as recv, but wait until `deadline`.
+        */
+        Task<int> try_recv_until(SteadyTimePoint deadline, ValuePtr &out) {
+            return ch->recv_impl(st.get(), detail::TimedWaitHelper{deadline},
+                                 out);
+        }
+
+    private:
+        Subscriber(BroadcastChannel *ch, std::unique_ptr<SubState> st)
+            : ch(ch), st(std::move(st))
+        { }
+
+    private:
+        BroadcastChannel *ch;
+        std::unique_ptr<SubState> st;
+
+        friend class BroadcastChannel;
+    };
+
+public:
+    /**
+     * @brief Create a BroadcastChannel.
+     *
+     * @param capacity Number of the events kept in the ring, rounded up to a
+     *        power of 2. A subscriber falling behind more than that is handled
+     *        by `policy`.
+     * @param policy See coke::BroadcastPolicy.
+    */
+    explicit BroadcastChannel(SizeType capacity,
+                              BroadcastPolicy policy = BroadcastPolicy::DROP)
+        : policy(policy), tail(0), min_cursor(0), ch_closed(false),
+          head(nullptr),
+          sub_cnt(0), pub_wait_cnt(0), recv_wait_cnt(0)
+    {
+        SizeType cap = 1;
+        while (cap < capacity)
+            cap <<= 1;
+
+        ring.resize(cap);
+        mask = cap - 1;
+    }
+
+    BroadcastChannel(const BroadcastChannel &) = delete;
+    BroadcastChannel &operator= (const BroadcastChannel &) = delete;
+
+    /**
+     * @pre All the subscribers are destroyed or unsubscribed.
+    */
+    ~BroadcastChannel() = default;
+
+    SizeType capacity() const noexcept { return mask + 1; }
+
+    BroadcastPolicy get_policy() const noexcept { return policy; }
+
+    SizeType subscriber_count() const {
+        UniqueLock lk(mtx);
+        return sub_cnt;
+    }
+
+    bool closed() const {
+        UniqueLock lk(mtx);
+        return ch_closed;
+    }
+
+    /**
+     * @brief Create a subscriber, it receives the events published from now
+     *        on. It must be destroyed before the channel.
+    */
+    Subscriber subscribe() {
+        auto st = std::make_unique<SubState>();
+        UniqueLock lk(mtx);
+
+        st->cursor = tail;
+        st->next = head;
+        if (head)
+            head->prev = st.get();
+        head = st.get();
+        ++sub_cnt;
+
+        return Subscriber(this, std::move(st));
+    }
+
+    /**
+     * @brief Close the channel. The publishers fail with coke::TOP_CLOSED, the
+     *        subscribers can still receive the remaining events.
+    */
+    void close() {
+        UniqueLock lk(mtx);
+        ch_closed = true;
+        lk.unlock();
+
+        pub_cv.notify_all();
+        recv_cv.notify_all();
+    }
+
+    /**
+     * @brief Reopen a closed channel.
+    */
+    void reopen() {
+        UniqueLock lk(mtx);
+        ch_closed = false;
+    }
+
+    /**
+     * @brief Try to publish `value` without waiting.
+     *
+     * @returns Whether published. It fails only when closed, or when the
+     *          policy is BroadcastPolicy::BLOCK and the slowest subscriber is
+     *          a whole ring behind.
+    */
+    bool try_publish(ValuePtr value) {
+        UniqueLock lk(mtx);
+        if (ch_closed || !can_publish())
+            return false;
+
+        publish_locked(lk, std::move(value));
+        return true;
+    }
+
+    /**
+     * @brief Publish `value`, wait if the policy is BroadcastPolicy::BLOCK
+     *        and the slowest subscriber is a whole ring behind.
+     *
+     * @returns Coroutine that should co_await immediately.
+     * @retval See coke::Queue::try_push_for.
+    */
+    Task<int> publish(ValuePtr value) {
+        return publish_impl(detail::TimedWaitHelper{}, std::move(value));
+    }
+
+    /**
+     * @brief Same as publish, but wait at most `nsec`.
+    */
+    Task<int> try_publish_for(NanoSec nsec, ValuePtr value) {
+        return publish_impl(detail::TimedWaitHelper{nsec}, std::move(value));
+    }
+
+    /**
+     * @brief Same as publish, but wait until `deadline`.
+    */
+    Task<int> try_publish_until(SteadyTimePoint deadline, ValuePtr value) {
+        return publish_impl(detail::TimedWaitHelper{deadline},
+                            std::move(value));
+    }
+
+private:
+    void remove(SubState *st) {
+        UniqueLock lk(mtx);
+
+        if (st->prev)
+            st->prev->next = st->next;
+        else
+            head = st->next;
+
+        if (st->next)
+            st->next->prev = st->prev;
+
+        --sub_cnt;
+        bool wake = (pub_wait_cnt > 0);
+        lk.unlock();
+
+        if (wake)
+            pub_cv.notify_all();
+    }
+
+    bool can_publish() {
+        if (policy != BroadcastPolicy::BLOCK || tail - min_cursor <= mask)
+            return true;
+
+        // The cursors never go back, so `min_cursor` is only recomputed when
+        // the ring looks full.
+        min_cursor = tail;
+        for (SubState *st = head; st; st = st->next) {
+            if (st->cursor < min_cursor)
+                min_cursor = st->cursor;
+        }
+
+        return tail - min_cursor <= mask;
+    }
+
+    void publish_locked(UniqueLock &lk, ValuePtr value) {
+        // The overwritten event is released after unlock
+        ValuePtr old = std::move(ring[tail & mask]);
+
+        ring[tail & mask] = std::move(value);
+        ++tail;
+
+        bool wake = (recv_wait_cnt > 0);
+        lk.unlock();
+
+        if (wake)
+            recv_cv.notify_all();
+    }
+
+    /**
+     * @brief Check whether `st` falls more than a whole ring behind, it is
+     *        disconnected or skips the overwritten events.
+     *
+     * @returns Whether `st` is disconnected.
+    */
+    bool lag(SubState *st) {
+        if (st->disconnected)
+            return true;
+
+        if (tail - st->cursor <= mask + 1)
+            return false;
+
+        if (policy == BroadcastPolicy::DISCONNECT) {
+            st->disconnected = true;
+            return true;
+        }
+
+        st->dropped += tail - (mask + 1) - st->cursor;
+        st->cursor = tail - (mask + 1);
+        return false;
+    }
+
+    bool recv_locked(SubState *st, ValuePtr &out) {
+        if (lag(st) || st->cursor == tail)
+            return false;
+
+        out = ring[st->cursor & mask];
+        ++st->cursor;
+
+        if (policy == BroadcastPolicy::BLOCK && pub_wait_cnt > 0)
+            pub_cv.notify_all();
+
+        return true;
+    }
+
+    Task<int> recv_impl(SubState *st, detail::TimedWaitHelper helper,
+                        ValuePtr &out) {
+        if (coke::prevent_recursive_stack())
+            co_await coke::yield();
+
+        UniqueLock lk(mtx);
+        auto pred = [this, st]() {
+            return st->cursor != tail || ch_closed || st->disconnected;
+        };
+
+        int ret = TOP_SUCCESS;
+        if (!pred()) {
+            ++recv_wait_cnt;
+
+            if (helper.infinite())
+                ret = co_await recv_cv.wait(lk, pred);
+            else
+                ret = co_await recv_cv.wait_until(lk, helper.deadline(), pred);
+
+            --recv_wait_cnt;
+        }
+
+        if (ret == TOP_SUCCESS && !recv_locked(st, out))
+            ret = TOP_CLOSED;
+
+        co_return ret;
+    }
+
+    Task<int> publish_impl(detail::TimedWaitHelper helper, ValuePtr value) {
+        if (coke::prevent_recursive_stack())
+            co_await coke::yield();
+
+        UniqueLock lk(mtx);
+        auto pred = [this]() { return ch_closed || can_publish(); };
+
+        int ret = TOP_SUCCESS;
+        if (!pred()) {
+            ++pub_wait_cnt;
+
+            if (helper.infinite())
+                ret = co_await pub_cv.wait(lk, pred);
+            else
+                ret = co_await pub_cv.wait_until(lk, helper.deadline(), pred);
+
+            --pub_wait_cnt;
+        }
+
+        if (ret == TOP_SUCCESS) {
+            if (ch_closed)
+                ret = TOP_CLOSED;
+            else
+                publish_locked(lk, std::move(value));
+        }
+
+        co_return ret;
+    }
+
+private:
+    const BroadcastPolicy policy;
+    SizeType mask;
+    std::vector<ValuePtr> ring;
+
+    // Sequence number of the next event to publish
+    uint64_t tail;
+    // No greater than the cursor of any subscriber, used by BLOCK policy
+    uint64_t min_cursor;
+    bool ch_closed;
+
+    SubState *head;
+    SizeType sub_cnt;
+    SizeType pub_wait_cnt;
+    SizeType recv_wait_cnt;
+
+    mutable std::mutex mtx;
+    Condition pub_cv;
+    Condition recv_cv;
+};
+
+} // namespace coke
+
+#endif // COKE_BROADCAST_CHANNEL_H
@@ -0,0 +1,527 @@
+/**
+ * Copyright 2024 Coke Project (https://github.com/kedixa/coke)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Authors: kedixa (https://github.com/kedixa)
+*/
+
+#ifndef COKE_CACHE_H
+#define COKE_CACHE_H
+
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "coke/detail/constant.h"
+#include "coke/detail/shard_config.h"
+#include "coke/single_flight.h"
+#include "coke/sleep.h"
+#include "coke/task.h"
+
+namespace coke {
+
+struct CacheParams {
+    // Max total weight of the entries, each entry weighs 1 unless a weigher
+    // is given to the cache. It is split evenly among the shards.
+    std::size_t max_weight  = 10000;
+
+    // Number of shards, rounded up to a power of 2, zero means decided by
+    // hardware concurrency.
+    std::size_t shards      = 0;
+
+    // How long an entry lives after it is put, zero means never expires.
+    NanoSec ttl{0};
+
+    // When a shard is full, admit a new entry only if its key is used more
+    // frequently than the least recently used entry, which is then evicted.
+    // Otherwise the new entry is rejected, so that a burst of one-off keys
+    // does not flush the hot entries. Disable it to get a plain LRU cache.
+    bool tinylfu            = true;
+};
+
+struct CacheStats {
+    uint64_t hits{0};
+    uint64_t misses{0};
+    // Entries evicted because their shard is full
+    uint64_t evictions{0};
+    // New entries rejected by the admission policy or for being too heavy
+    uint64_t rejections{0};
+    // Entries removed because they are expired
+    uint64_t expirations{0};
+
+    std::size_t size{0};
+    std::size_t weight{0};
+};
+
+namespace detail {
+
+/**
+ * @brief CacheSketch is a count-min sketch of 4-bit counters, which estimates
+ *        how often a key is used recently. All counters are halved after
+ *        every `10 * width` increments, so that old popularity fades.
+*/
+class CacheSketch {
+    static constexpr std::size_t DEPTH = 4;
+    static constexpr uint8_t MAX_COUNT = 15;
+
+public:
+    explicit CacheSketch(std::size_t capacity)
+        : mask(std::bit_ceil(std::max(capacity, std::size_t(256))) - 1),
+          sample_size((mask + 1) * 10),
+          counters(DEPTH * (mask + 1), 0)
+    { }
+
+    void increment(uint64_t hash) noexcept {
+        bool added = false;
+
+        for (std::size_t i = 0; i < DEPTH; i++) {
+            uint8_t &c = counters[i * (mask + 1) + index_of(hash, i)];
+            if (c < MAX_COUNT) {
+                ++c;
+                added = true;
+            }
+        }
+
+        if (added && ++additions >= sample_size)
+            reset();
+    }
+
+    uint8_t frequency(uint64_t hash) const noexcept {
+        uint8_t f = MAX_COUNT;
+
+        for (std::size_t i = 0; i < DEPTH; i++)
+            f = std::min(f, counters[i * (mask + 1) + index_of(hash, i)]);
+
+        return f;
+    }
+
+private:
+    std::size_t index_of(uint64_t hash, std::size_t i) const noexcept {
+        uint64_t h1 = hash;
+        uint64_t h2 = (hash >> 32) | 1;
+        return (std::size_t)((h1 + i * h2) & mask);
+    }
+
+    void reset() noexcept {
+        for (uint8_t &c : counters)
+            c >>= 1;
+
+        additions /= 2;
+    }
+
+private:
+    std::size_t mask;
+    std::size_t sample_size;
+    std::size_t additions{0};
+    std::vector<uint8_t> counters;
+};
+
+} // namespace detail
+
+/**
+ * @brief Cache is a concurrent in-process cache split into shards, each shard
+ *        has its own lock, LRU list and TinyLFU admission sketch. The values
+ *        are kept in std::shared_ptr<const V>, a value got from the cache is
+ *        still valid after it is evicted.
+ *
+ * The expired entries are removed when they are accessed, or by
+ * remove_expired, which can be called periodically by a background coroutine
+ * if there are a lot of keys that are never accessed again.
+*/
+template<typename K, Cokeable V, typename Hash = std::hash<K>,
+         typename KeyEqual = std::equal_to<K>>
+    requires (!std::is_void_v<V>)
+class Cache {
+public:
+    using KeyType = K;
+    using ValueType = V;
+    using ValuePtr = std::shared_ptr<const V>;
+    using WeigherType = std::function<std::size_t(const K &, const V &)>;
+
+private:
+    struct Node {
+        K key;
+        ValuePtr value;
+        uint64_t hash;
+        std::size_t weight;
+        // Clock's max means never expires
+        SteadyTimePoint expire_at;
+    };
+
+    using ListType = std::list<Node>;
+    using MapType = std::unordered_map<K, typename ListType::iterator,
+                                       Hash, KeyEqual>;
+
+    struct alignas(detail::DESTRUCTIVE_ALIGN) Shard {
+        explicit Shard(std::size_t capacity) : sketch(capacity) { }
+
+        std::mutex mtx;
+        // The front is the most recently used one
+        ListType lru;
+        MapType map;
+        detail::CacheSketch sketch;
+        std::size_t weight{0};
+
+        uint64_t hits{0};
+        uint64_t misses{0};
+        uint64_t evictions{0};
+        uint64_t rejections{0};
+        uint64_t expirations{0};
+    };
+
+public:
+    /**
+     * @brief Create a Cache.
+     *
+     * @param params See coke::CacheParams.
+     * @param weigher Return the weight of an entry, nullptr means each entry
+     *        weighs 1. It is called with the shard's lock held.
+    */
+    explicit Cache(const CacheParams &params = CacheParams(),
+                   WeigherType weigher = nullptr)
+        : ttl(params.ttl), tinylfu(params.tinylfu), weigher(std::move(weigher))
+    {
+        std::size_t n = params.shards;
+        if (n == 0)
+            n = std::thread::hardware_concurrency();
+
+        n = std::bit_ceil(std::max(n, std::size_t(1)));
+        while (n > 1 && n > params.max_weight)
+            n >>= 1;
+
+        shard_mask = n - 1;
+        shard_weight = (params.max_weight + n - 1) / n;
+
+        shards.reserve(n);
+        for (std::size_t i = 0; i < n; i++)
+            shards.emplace_back(std::make_unique<Shard>(shard_weight));
+    }
+
+    /**
+     * @brief Cache is neither copyable nor movable.
+    */
+    Cache(const Cache &) = delete;
+    Cache &operator= (const Cache &) = delete;
+
+    /**
+     * @pre No get_or_load is in flight.
+    */
+    ~Cache() = default;
+
+    /**
+     * @brief Get the value of `key`, or nullptr if it is not found or expired.
+    */
+    ValuePtr get(const K &key) {
+        uint64_t h = hash_of(key);
+        Shard &s = shard_of(h);
+        std::lock_guard<std::mutex> lg(s.mtx);
+
+        s.sketch.increment(h);
+
+        auto it = s.map.find(key);
+        if (it == s.map.end()) {
+            ++s.misses;
+            return nullptr;
+        }
+
+        typename ListType::iterator node = it->second;
+        if (expired(*node, now())) {
+            ++s.expirations;
+            ++s.misses;
+            remove_node(s, node);
+            return nullptr;
+        }
+
+        s.lru.splice(s.lru.begin(), s.lru, node);
+        ++s.hits;
+        return node->value;
+    }
+
+    /**
+     * @brief Put `value` of `key` with the default ttl, replace the old one
+     *        if `key` exists.
+     *
+     * @return Return false if it is rejected by the admission policy, or if
+     *         it is heavier than a whole shard.
+    */
+    bool put(const K &key, V value) {
+        return put(key, std::move(value), ttl);
+    }
+
+    /**
+     * @brief Same as put(key, value), but the entry lives for `ttl`, zero or
+     *        negative means never expires.
+    */
+    bool put(const K &key, V value, NanoSec ttl) {
+        auto ptr = std::make_shared<const V>(std::move(value));
+        return put_ptr(key, std::move(ptr), ttl, true);
+    }
+
+    /**
+     * @brief Get the value of `key`, loaded by `func()` if it is not in the
+     *        cache. The concurrent loads of the same key are merged into one
+     *        by coke::SingleFlight, and the loaded value is put into the cache
+     *        with the default ttl.
+     *
+     * @param key The key to get.
+     * @param func A callable object that returns coke::Task<V>, it is only
+     *        called when there is no load of `key` in flight.
+     * @return See SingleFlight::call, the value is returned even if it is
+     *         rejected by the cache.
+     * @exception The exception thrown by `func` or the loader Task, it is
+     *            never cached.
+    */
+    template<typename F>
+        requires std::is_invocable_r_v<Task<V>, F>
+    Task<ValuePtr> get_or_load(K key, F func) {
+        ValuePtr ptr = get(key);
+        if (ptr)
+            co_return ptr;
+
+        ptr = co_await flight.call(key, std::move(func));
+
+        // All the waiters of the load try to put it, only the first one does.
+        if (ptr)
+            put_ptr(key, ptr, ttl, false);
+
+        co_return ptr;
+    }
+
+    /**
+     * @brief Remove `key` from the cache, return true if it is found.
+    */
+    bool erase(const K &key) {
+        uint64_t h = hash_of(key);
+        Shard &s = shard_of(h);
+        std::lock_guard<std::mutex> lg(s.mtx);
+
+        auto it = s.map.find(key);
+        if (it == s.map.end())
+            return false;
+
+        remove_node(s, it->second);
+        return true;
+    }
+
+    /**
+     * @brief Remove all the entries, the statistics are kept.
+    */
+    void clear() {
+        for (auto &s : shards) {
+            std::lock_guard<std::mutex> lg(s->mtx);
+            s->map.clear();
+            s->lru.clear();
+            s->weight = 0;
+        }
+    }
+
+    /**
+     * @brief Remove all the expired entries, return the number of them.
+    */
+    std::size_t remove_expired() {
+        auto cur_time = now();
+        std::size_t cnt = 0;
+
+        for (auto &s : shards) {
+            std::lock_guard<std::mutex> lg(s->mtx);
+            auto it = s->lru.begin();
+
+            while (it != s->lru.end()) {
+                auto cur = it++;
+                if (expired(*cur, cur_time)) {
+                    remove_node(*s, cur);
+                    ++s->expirations;
+                    ++cnt;
+                }
+            }
+        }
+
+        return cnt;
+    }
+
+    /**
+     * @brief Get the number of entries, including the expired ones that have
+     *        not been removed yet.
+    */
+    std::size_t size() const {
+        std::size_t n = 0;
+
+        for (auto &s : shards) {
+            std::lock_guard<std::mutex> lg(s->mtx);
+            n += s->map.size();
+        }
+
+        return n;
+    }
+
+    /**
+     * @brief Get the sum of the statistics of all the shards.
+    */
+    CacheStats get_stats() const {
+        CacheStats st;
+
+        for (auto &s : shards) {
+            std::lock_guard<std::mutex> lg(s->mtx);
+            st.hits += s->hits;
+            st.misses += s->misses;
+            st.evictions += s->evictions;
+            st.rejections += s->rejections;
+            st.expirations += s->expirations;
+            st.size += s->map.size();
+            st.weight += s->weight;
+        }
+
+        return st;
+    }
+
+    std::size_t shard_count() const { return shard_mask + 1; }
+
+private:
+    static SteadyTimePoint now() noexcept {
+        // Reads the coarse clock if it is enabled for the timed waits
+        return detail::TimedWaitHelper::now();
+    }
+
+    uint64_t hash_of(const K &key) const {
+        return detail::mix_hash((uint64_t)hasher(key));
+    }
+
+    Shard &shard_of(uint64_t h) const {
+        // The low bits are used by the sketch
+        return *shards[(h >> 48) & shard_mask];
+    }
+
+    static bool expired(const Node &node, SteadyTimePoint cur) {
+        return node.expire_at != SteadyTimePoint::max() && cur >= node.expire_at;
+    }
+
+    void remove_node(Shard &s, typename ListType::iterator node) {
+        s.weight -= node->weight;
+        s.map.erase(node->key);
+        s.lru.erase(node);
+    }
+
+    bool put_ptr(const K &key, ValuePtr ptr, NanoSec ttl, bool replace) {
+        uint64_t h = hash_of(key);
+        Shard &s = shard_of(h);
+        std::size_t w = weigher ? weigher(key, *ptr) : 1;
+        SteadyTimePoint expire_at = SteadyTimePoint::max();
+
+        if (ttl > NanoSec(0))
+            expire_at = now() + ttl;
+
+        std::lock_guard<std::mutex> lg(s.mtx);
+        auto it = s.map.find(key);
+
+        if (it != s.map.end()) {
+            typename ListType::iterator node = it->second;
+
+            if (!replace && !expired(*node, now()))
+                return true;
+
+            if (w > shard_weight) {
+                ++s.rejections;
+                remove_node(s, node);
+                return false;
+            }
+
+            s.weight = s.weight - node->weight + w;
+            node->value = std::move(ptr);
+            node->weight = w;
+            node->expire_at = expire_at;
+            s.lru.splice(s.lru.begin(), s.lru, node);
+            evict(s, node);
+            return true;
+        }
+
+        s.sketch.increment(h);
+
+        if (w > shard_weight || !admit(s, h, w)) {
+            ++s.rejections;
+            return false;
+        }
+
+        s.lru.push_front(Node{key, std::move(ptr), h, w, expire_at});
+        s.map.emplace(key, s.lru.begin());
+        s.weight += w;
+        evict(s, s.lru.begin());
+        return true;
+    }
+
+    /**
+     * @brief Check whether the new entry is worth evicting the victims it
+     *        needs, the expired victims are free to evict.
+    */
+    bool admit(Shard &s, uint64_t h, std::size_t w) {
+        if (!tinylfu || s.weight + w <= shard_weight)
+            return true;
+
+        auto cur = now();
+        uint8_t freq = s.sketch.frequency(h);
+        std::size_t freed = 0;
+
+        for (auto it = s.lru.rbegin(); it != s.lru.rend(); ++it) {
+            if (!expired(*it, cur) && s.sketch.frequency(it->hash) >= freq)
+                return false;
+
+            freed += it->weight;
+            if (s.weight - freed + w <= shard_weight)
+                break;
+        }
+
+        return true;
+    }
+
+    void evict(Shard &s, typename ListType::iterator keep) {
+        while (s.weight > shard_weight && !s.lru.empty()) {
+            auto victim = std::prev(s.lru.end());
+            if (victim == keep)
+                break;
+
+            if (expired(*victim, now()))
+                ++s.expirations;
+            else
+                ++s.evictions;
+
+            remove_node(s, victim);
+        }
+    }
+
+private:
+    NanoSec ttl;
+    bool tinylfu;
+    WeigherType weigher;
+    [[no_unique_address]] Hash hasher;
+
+    std::size_t shard_mask;
+    std::size_t shard_weight;
+    std::vector<std::unique_ptr<Shard>> shards;
+
+    SingleFlight<K, V, Hash, KeyEqual> flight;
+};
+
+} // namespace coke
+
+#endif // COKE_CACHE_H
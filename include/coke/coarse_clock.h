@@ -0,0 +1,100 @@
+/**
+ * Copyright 2024 Coke Project (https://github.com/kedixa/coke)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Authors: kedixa (https://github.com/kedixa)
+*/
+
+#ifndef COKE_COARSE_CLOCK_H
+#define COKE_COARSE_CLOCK_H
+
+#include <chrono>
+#include <ctime>
+
+#include "coke/detail/coarse_clock.h"
+#include "coke/sleep.h"
+#include "coke/task.h"
+
+namespace coke {
+
+/**
+ * @brief CoarseSteadyClock is a steady clock updated by a background
+ *        coroutine every interval, so that reading it costs only one relaxed
+ *        atomic load. It lags behind std::chrono::steady_clock by at most one
+ *        interval, and is the same as it when the service is not running.
+ *        Its time_point is the one of std::chrono::steady_clock, so that
+ *        they can be mixed.
+*/
+struct CoarseSteadyClock {
+    using duration = std::chrono::steady_clock::duration;
+    using rep = duration::rep;
+    using period = duration::period;
+    using time_point = std::chrono::steady_clock::time_point;
+
+    static constexpr bool is_steady = true;
+
+    static time_point now() noexcept { return detail::coarse_steady_now(); }
+};
+
+/**
+ * @brief Same as CoarseSteadyClock, but for std::chrono::system_clock. It is
+ *        not steady if the system time is changed.
+*/
+struct CoarseSystemClock {
+    using duration = std::chrono::system_clock::duration;
+    using rep = duration::rep;
+    using period = duration::period;
+    using time_point = std::chrono::system_clock::time_point;
+
+    static constexpr bool is_steady = false;
+
+    static time_point now() noexcept { return detail::coarse_system_now(); }
+
+    static std::time_t to_time_t(const time_point &t) noexcept {
+        return std::chrono::system_clock::to_time_t(t);
+    }
+};
+
+/**
+ * @brief Start the background coroutine that updates the coarse clocks every
+ *        `interval`.
+ *
+ * @return Return false if it is already running.
+*/
+bool start_coarse_clock(NanoSec interval = std::chrono::milliseconds(1));
+
+/**
+ * @brief Stop the background coroutine and wait for it to finish, the coarse
+ *        clocks fall back to the std clocks after that. It should be called
+ *        before the end of the main function if the clock is started.
+*/
+Task<> stop_coarse_clock();
+
+/**
+ * @brief Return whether the background coroutine is running.
+*/
+bool coarse_clock_running() noexcept;
+
+/**
+ * @brief Let the deadlines of sleep_until, Mutex::try_lock_for, Condition,
+ *        StopToken and the other timed waits, and the ttl of coke::Cache be
+ *        computed from CoarseSteadyClock, see
+ *        GlobalSettings::timed_wait_coarse_clock. It can be changed at any
+ *        time.
+*/
+void set_timed_wait_coarse_clock(bool enable) noexcept;
+
+} // namespace coke
+
+#endif // COKE_COARSE_CLOCK_H
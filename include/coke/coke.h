@@ -24,19 +24,30 @@
 */
 
 #include "coke/global.h"
+#include "coke/async_generator.h"
 #include "coke/basic_awaiter.h"
 #include "coke/fileio.h"
+#include "coke/file_stream.h"
+#include "coke/mapped_file.h"
 #include "coke/go.h"
+#include "coke/executor_pool.h"
+#include "coke/executor_adapter.h"
+#include "coke/parallel_for.h"
 #include "coke/latch.h"
 #include "coke/sleep.h"
+#include "coke/coarse_clock.h"
 #include "coke/qps_pool.h"
 #include "coke/wait.h"
 #include "coke/series.h"
 #include "coke/semaphore.h"
 #include "coke/task.h"
+#include "coke/task_group.h"
 #include "coke/mutex.h"
 #include "coke/shared_mutex.h"
+#include "coke/rcu_cell.h"
+#include "coke/single_flight.h"
 #include "coke/future.h"
+#include "coke/expected.h"
 #include "coke/make_task.h"
 #include "coke/condition.h"
 #include "coke/stop_token.h"
@@ -21,6 +21,7 @@
 
 #include <functional>
 #include <mutex>
+#include <unordered_map>
 
 #include "coke/task.h"
 #include "coke/sleep.h"
@@ -92,6 +93,24 @@ public:
         return wait_impl(lock, detail::TimedWaitHelper{nsec}, std::move(pred));
     }
 
+    /**
+     * @brief Same as wait_for(lock, nsec), but wait until `deadline`.
+    */
+    Task<int> wait_until(std::unique_lock<std::mutex> &lock,
+                         SteadyTimePoint deadline) {
+        return wait_impl(lock, detail::TimedWaitHelper{deadline});
+    }
+
+    /**
+     * @brief Same as wait_for(lock, nsec, pred), but wait until `deadline`.
+    */
+    Task<int> wait_until(std::unique_lock<std::mutex> &lock,
+                         SteadyTimePoint deadline,
+                         std::function<bool()> pred) {
+        return wait_impl(lock, detail::TimedWaitHelper{deadline},
+                         std::move(pred));
+    }
+
     /**
      * @brief If any coroutines are waiting on *this, calling notify_one
      *        unblocks one of them.
@@ -131,6 +150,211 @@ private:
     int wait_cnt;
 };
 
+/**
+ * @brief KeyedCondition is a group of conditions indexed by key. Waiters wait
+ *        on a key and notifiers wake up only the waiters of that key, so that
+ *        the waiters of other keys do not wake up and check again. It works
+ *        like Condition, and the state of each key is created when the first
+ *        waiter comes, and destroyed after the last waiter leaves.
+*/
+template<typename K, typename Hash = std::hash<K>,
+         typename KeyEqual = std::equal_to<K>>
+class KeyedCondition {
+public:
+    using KeyType = K;
+
+    /**
+     * @brief Create a KeyedCondition.
+    */
+    KeyedCondition() = default;
+
+    /**
+     * @brief KeyedCondition is neither copyable nor movable.
+    */
+    KeyedCondition(const KeyedCondition &) = delete;
+    KeyedCondition &operator=(const KeyedCondition &) = delete;
+
+    ~KeyedCondition() = default;
+
+    /**
+     * @brief Blocks the current coroutine until the condition of `key` is
+     *        awakened, see Condition::wait.
+    */
+    Task<int> wait(std::unique_lock<std::mutex> &lock, const K &key) {
+        return wait_impl(lock, key, detail::TimedWaitHelper{});
+    }
+
+    /**
+     * @brief Blocks the current coroutine until the condition of `key` is
+     *        awakened and pred() returns true, see Condition::wait.
+    */
+    Task<int> wait(std::unique_lock<std::mutex> &lock, const K &key,
+                   std::function<bool()> pred) {
+        return wait_impl(lock, key, detail::TimedWaitHelper{},
+                         std::move(pred));
+    }
+
+    /**
+     * @brief See Condition::wait_for(lock, nsec).
+    */
+    Task<int> wait_for(std::unique_lock<std::mutex> &lock, const K &key,
+                       NanoSec nsec) {
+        return wait_impl(lock, key, detail::TimedWaitHelper{nsec});
+    }
+
+    /**
+     * @brief See Condition::wait_for(lock, nsec, pred).
+    */
+    Task<int> wait_for(std::unique_lock<std::mutex> &lock, const K &key,
+                       NanoSec nsec, std::function<bool()> pred) {
+        return wait_impl(lock, key, detail::TimedWaitHelper{nsec},
+                         std::move(pred));
+    }
+
+    /**
+     * @brief See Condition::wait_until(lock, deadline).
+    */
+    Task<int> wait_until(std::unique_lock<std::mutex> &lock, const K &key,
+                         SteadyTimePoint deadline) {
+        return wait_impl(lock, key, detail::TimedWaitHelper{deadline});
+    }
+
+    /**
+     * @brief See Condition::wait_until(lock, deadline, pred).
+    */
+    Task<int> wait_until(std::unique_lock<std::mutex> &lock, const K &key,
+                         SteadyTimePoint deadline,
+                         std::function<bool()> pred) {
+        return wait_impl(lock, key, detail::TimedWaitHelper{deadline},
+                         std::move(pred));
+    }
+
+    /**
+     * @brief Unblocks one of the coroutines waiting on `key`.
+    */
+    void notify_one(const K &key) { notify(key, 1); }
+
+    /**
+     * @brief Unblocks n of the coroutines waiting on `key`, if less than n,
+     *        wakeup all of them.
+    */
+    void notify(const K &key, std::size_t n) {
+        std::lock_guard<std::mutex> lg(mtx);
+        auto it = slots.find(key);
+
+        if (it != slots.end())
+            cancel_sleep_by_addr(&it->second, n);
+    }
+
+    /**
+     * @brief Unblocks all the coroutines waiting on `key`.
+    */
+    void notify_all(const K &key) { notify(key, std::size_t(-1)); }
+
+    /**
+     * @brief Unblocks all the coroutines waiting on any key.
+    */
+    void notify_all() {
+        std::lock_guard<std::mutex> lg(mtx);
+
+        for (auto &[key, slot] : slots)
+            cancel_sleep_by_addr(&slot);
+    }
+
+private:
+    // The address of a slot is used to sleep on, elements of unordered_map
+    // are never moved, even when rehashing.
+    struct Slot {
+        std::size_t waiters{0};
+    };
+
+    using SlotMap = std::unordered_map<K, Slot, Hash, KeyEqual>;
+    using SlotNode = typename SlotMap::value_type;
+
+    /**
+     * @brief Register a sleep on the slot of `key`, the sleep is created
+     *        within `mtx` so that notify never misses it.
+    */
+    SleepAwaiter enter(SlotNode *&node, const K &key,
+                       detail::TimedWaitHelper helper, bool insert_head) {
+        std::lock_guard<std::mutex> lg(mtx);
+
+        if (node == nullptr) {
+            node = &*slots.try_emplace(key).first;
+            ++node->second.waiters;
+        }
+
+        return sleep(&node->second, helper, insert_head);
+    }
+
+    void leave(SlotNode *node) {
+        std::lock_guard<std::mutex> lg(mtx);
+
+        if (--node->second.waiters == 0)
+            slots.erase(node->first);
+    }
+
+    Task<int> wait_impl(std::unique_lock<std::mutex> &lock, K key,
+                        detail::TimedWaitHelper helper) {
+        SlotNode *node = nullptr;
+        int ret;
+
+        if (helper.timeout())
+            co_return TOP_TIMEOUT;
+
+        auto s = enter(node, key, helper, false);
+
+        lock.unlock();
+        ret = co_await std::move(s);
+        lock.lock();
+        leave(node);
+
+        if (ret == SLEEP_SUCCESS)
+            ret = TOP_TIMEOUT;
+        else if (ret == SLEEP_CANCELED)
+            ret = TOP_SUCCESS;
+
+        co_return ret;
+    }
+
+    Task<int> wait_impl(std::unique_lock<std::mutex> &lock, K key,
+                        detail::TimedWaitHelper helper,
+                        std::function<bool()> pred) {
+        SlotNode *node = nullptr;
+        bool insert_head = false;
+        int ret = TOP_SUCCESS;
+
+        while (!pred()) {
+            if (helper.timeout()) {
+                ret = TOP_TIMEOUT;
+                break;
+            }
+
+            auto s = enter(node, key, helper, insert_head);
+            insert_head = true;
+
+            lock.unlock();
+            ret = co_await std::move(s);
+            lock.lock();
+
+            // if there is an error, return it
+            if (ret == SLEEP_ABORTED || ret < 0)
+                break;
+
+            ret = TOP_SUCCESS;
+        }
+
+        if (node)
+            leave(node);
+
+        co_return ret;
+    }
+
+private:
+    std::mutex mtx;
+    SlotMap slots;
+};
+
 } // namespace coke
 
 #endif // COKE_CONDITION_H
@@ -19,16 +19,22 @@
 #ifndef COKE_DAG_H
 #define COKE_DAG_H
 
+#include <algorithm>
 #include <atomic>
+#include <chrono>
+#include <cstdint>
 #include <functional>
 #include <initializer_list>
 #include <iosfwd>
+#include <map>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <type_traits>
 #include <vector>
 
 #include "coke/global.h"
+#include "coke/go.h"
 #include "coke/latch.h"
 #include "coke/task.h"
 #include "coke/sleep.h"
@@ -37,6 +43,94 @@ namespace coke {
 
 using dag_index_t = uint32_t;
 
+constexpr dag_index_t DAG_INVALID_INDEX = dag_index_t(-1);
+
+/**
+ * @brief Timestamps of a node in one run of DagGraph, in nanoseconds since the
+ *        run starts, or -1 if the node has not reached that step.
+*/
+struct DagNodeTiming {
+    // When all the dependencies are satisfied
+    int64_t ready_ns{-1};
+    // When the node starts, after the thread switch of compute or io node
+    int64_t start_ns{-1};
+    int64_t end_ns{-1};
+
+    // The predecessor that makes this node ready, DAG_INVALID_INDEX for root
+    dag_index_t trigger{DAG_INVALID_INDEX};
+};
+
+/**
+ * @brief The profile of one run of DagGraph, see DagGraph::run.
+*/
+struct DagRunProfile {
+    // Indexed by node id, node 0 is the root
+    std::vector<DagNodeTiming> nodes;
+    // Nanoseconds from the start to the end of the run
+    int64_t cost_ns{0};
+};
+
+/**
+ * @brief Get the critical path of a run, that is the chain of nodes from the
+ *        root to the last finished node, in which each node is made ready by
+ *        the previous one.
+*/
+std::vector<dag_index_t> dag_critical_path(const DagRunProfile &profile);
+
+/**
+ * @brief DagProfileStats aggregates the profiles of many runs of the same
+ *        graph. The cost of each node, from start to end, is recorded in a
+ *        log scale histogram, so the percentiles are approximations with
+ *        relative error less than 1/DagProfileStats::SUB_BUCKETS.
+ *        It is thread safe.
+*/
+class DagProfileStats {
+public:
+    static constexpr std::size_t SUB_BUCKETS = 8;
+    static constexpr std::size_t NUM_BUCKETS = 64 * SUB_BUCKETS;
+
+    DagProfileStats() = default;
+    DagProfileStats(const DagProfileStats &) = delete;
+
+    /**
+     * @brief Add the profile of a run, the profiles must come from the same
+     *        DagGraph.
+    */
+    void add(const DagRunProfile &profile);
+
+    /**
+     * @brief Clear all the collected data.
+    */
+    void clear();
+
+    std::size_t run_count() const;
+
+    std::size_t node_count() const;
+
+    /**
+     * @brief Get the `p`-th percentile(0.0 <= p <= 1.0) of the cost of node
+     *        `id` in nanoseconds, or -1 if there is no data.
+    */
+    int64_t percentile(dag_index_t id, double p) const;
+
+    /**
+     * @brief Get the number of runs in which node `id` is on the critical
+     *        path.
+    */
+    std::size_t critical_count(dag_index_t id) const;
+
+private:
+    struct NodeStats {
+        uint64_t critical{0};
+        uint64_t total{0};
+        uint32_t hist[NUM_BUCKETS]{};
+    };
+
+    mutable std::mutex mtx;
+    std::size_t runs{0};
+    std::vector<NodeStats> nodes;
+};
+
 namespace detail {
 
 template<typename T>
@@ -49,15 +143,27 @@ struct dag_node_func<void> {
     using type = std::function<Task<>()>;
 };
 
+template<typename T>
+struct dag_cond_func {
+    using type = std::function<bool(T &)>;
+};
+
+template<>
+struct dag_cond_func<void> {
+    using type = std::function<bool()>;
+};
+
 
 class DagCounter {
 public:
     DagCounter() = default;
     DagCounter(const DagCounter &) = delete;
 
-    void init(dag_index_t count, bool weak) {
+    void init(dag_index_t count, bool weak, dag_index_t weak_count = 0) {
         cnt.store(count + (weak == true), std::memory_order_relaxed);
+        weak_left.store(weak_count, std::memory_order_relaxed);
         weak_flag.store(weak, std::memory_order_relaxed);
+        skip_flag.store(false, std::memory_order_relaxed);
     }
 
     bool count(bool weak) {
@@ -67,16 +173,47 @@ public:
         return cnt.fetch_sub(1, std::memory_order_acq_rel) == 1;
     }
 
+    /**
+     * @brief Count by a skipped strong predecessor, the node is skipped too.
+    */
+    bool count_skipped() {
+        skip_flag.store(true, std::memory_order_relaxed);
+        return cnt.fetch_sub(1, std::memory_order_acq_rel) == 1;
+    }
+
+    /**
+     * @brief Count by a skipped weak predecessor, the node is skipped only if
+     *        all the weak predecessors are skipped.
+    */
+    bool count_weak_skipped() {
+        if (weak_left.fetch_sub(1, std::memory_order_acq_rel) != 1)
+            return false;
+
+        if (!weak_flag.exchange(false, std::memory_order_acq_rel))
+            return false;
+
+        return count_skipped();
+    }
+
+    bool skipped() const {
+        return skip_flag.load(std::memory_order_relaxed);
+    }
+
 private:
     std::atomic<dag_index_t> cnt;
+    std::atomic<dag_index_t> weak_left;
     std::atomic<bool> weak_flag;
+    std::atomic<bool> skip_flag;
 };
 
 
 class DagContextBase {
+    using clock_t = std::chrono::steady_clock;
+
 public:
     DagContextBase(dag_index_t cnt)
-        : lt(cnt), counts(new DagCounter[cnt])
+        : cnt(cnt), lt(cnt), counts(new DagCounter[cnt]), mask(nullptr),
+          timings(nullptr)
     { }
 
     DagContextBase(const DagContextBase &) = delete;
@@ -84,38 +221,111 @@ public:
 
     auto wait() { return lt.wait(); }
 
-    void count_down() { lt.count_down(); }
+    void count_down(long n = 1) { lt.count_down(n); }
+
+    /**
+     * @brief Make the context ready for the next run, the counters are
+     *        initialized when the run starts.
+     *
+     * @pre The previous run is finished, that is wait() is resumed.
+    */
+    void reset() {
+        std::destroy_at(&lt);
+        std::construct_at(&lt, (long)cnt);
+        mask = nullptr;
+        timings = nullptr;
+    }
 
     DagCounter &operator[] (std::size_t i) { return counts[i]; }
 
+    /**
+     * @brief Only run the nodes whose mask is not zero in this run, see
+     *        DagPlan.
+    */
+    void set_mask(const uint8_t *mask) { this->mask = mask; }
+
+    bool active(dag_index_t id) const { return !mask || mask[id]; }
+
+    /**
+     * @brief Collect the timestamps of each node to `profile` in this run.
+    */
+    void set_profile(DagRunProfile &profile) {
+        profile.nodes.assign(cnt, DagNodeTiming{});
+        profile.cost_ns = 0;
+        timings = profile.nodes.data();
+        start_time = clock_t::now();
+        timings[0].ready_ns = 0;
+    }
+
+    bool profiling() const { return timings != nullptr; }
+
+    int64_t elapsed() const {
+        auto dur = clock_t::now() - start_time;
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(dur)
+            .count();
+    }
+
+    void node_ready(dag_index_t id, dag_index_t from) {
+        if (timings) {
+            timings[id].ready_ns = elapsed();
+            timings[id].trigger = from;
+        }
+    }
+
+    void node_start(dag_index_t id) {
+        if (timings)
+            timings[id].start_ns = elapsed();
+    }
+
+    void node_end(dag_index_t id) {
+        if (timings)
+            timings[id].end_ns = elapsed();
+    }
+
 protected:
+    dag_index_t cnt;
     Latch lt;
     std::unique_ptr<DagCounter[]> counts;
+    const uint8_t *mask;
+
+    DagNodeTiming *timings;
+    clock_t::time_point start_time;
 };
 
 
 template<typename T>
 class DagContext : public DagContextBase {
     using node_func_t = typename dag_node_func<T>::type;
+    using cond_func_t = typename dag_cond_func<T>::type;
 public:
-    DagContext(dag_index_t cnt, T &data) : DagContextBase(cnt), data(data)
+    DagContext(dag_index_t cnt) : DagContextBase(cnt), data(nullptr)
     { }
 
-    Task<> invoke(node_func_t &func) { return func(data); }
+    DagContext(dag_index_t cnt, T &data) : DagContextBase(cnt), data(&data)
+    { }
+
+    void set_data(T &data) { this->data = &data; }
+
+    Task<> invoke(node_func_t &func) { return func(*data); }
+
+    bool check(cond_func_t &cond) { return cond(*data); }
 
 private:
-    T &data;
+    T *data;
 };
 
 
 template<>
 class DagContext<void> : public DagContextBase {
     using node_func_t = typename dag_node_func<void>::type;
+    using cond_func_t = typename dag_cond_func<void>::type;
 public:
     DagContext(dag_index_t cnt) : DagContextBase(cnt)
     { }
 
     Task<> invoke(node_func_t &func) { return func(); }
+
+    bool check(cond_func_t &cond) { return cond(); }
 };
 
 
@@ -124,17 +334,73 @@ bool dag_check(const std::vector<std::vector<dag_index_t>> &outs,
                std::vector<dag_index_t> &counts,
                std::vector<bool> &weak_flags);
 
+/**
+ * @brief Compile the adjacency lists into one contiguous array `edges`. The
+ *        strong successors of node i are [offsets[2i], offsets[2i+1]), and
+ *        the weak successors are [offsets[2i+1], offsets[2i+2]).
+*/
+void dag_compile(const std::vector<std::vector<dag_index_t>> &outs,
+                 const std::vector<std::vector<dag_index_t>> &weak_outs,
+                 std::vector<dag_index_t> &offsets,
+                 std::vector<dag_index_t> &edges);
+
 void dag_dump(std::ostream &os,
-              const std::vector<std::vector<dag_index_t>> &outs,
-              const std::vector<std::vector<dag_index_t>> &weak_outs,
-              const std::vector<std::string> &names);
+              const std::vector<dag_index_t> &offsets,
+              const std::vector<dag_index_t> &edges,
+              const std::vector<std::string> &names,
+              const DagProfileStats *stats);
+
+/**
+ * @brief Mark the nodes which `sinks` depend on, include `sinks` and the root,
+ *        return the number of marked nodes.
+*/
+dag_index_t dag_mark_upstream(const std::vector<dag_index_t> &offsets,
+                              const std::vector<dag_index_t> &edges,
+                              const std::vector<dag_index_t> &sinks,
+                              std::vector<uint8_t> &mask);
 
 } // namespace detail
 
 
+/**
+ * @brief DagPlan is the subgraph needed to produce a set of sink nodes, see
+ *        DagGraph::get_plan.
+*/
+class DagPlan {
+public:
+    DagPlan(const DagPlan &) = delete;
+
+    /**
+     * @brief Get the number of nodes that run in this plan, include the root.
+    */
+    std::size_t active_count() const { return count; }
+
+    /**
+     * @brief Return whether node `id` runs in this plan.
+    */
+    bool active(dag_index_t id) const {
+        return id < mask.size() && mask[id];
+    }
+
+private:
+    DagPlan() : count(0) { }
+
+    dag_index_t count;
+    std::vector<uint8_t> mask;
+
+    template<typename T>
+    friend class DagGraphBase;
+};
+
+using DagPlanPtr = std::shared_ptr<const DagPlan>;
+
+
 template<typename T>
 using dag_node_func_t = typename detail::dag_node_func<T>::type;
 
+template<typename T>
+using dag_cond_func_t = typename detail::dag_cond_func<T>::type;
+
 template<typename T>
 class DagBuilder;
 
@@ -149,6 +415,7 @@ template<typename T>
 class DagGraphBase {
 public:
     using node_func_t = dag_node_func_t<T>;
+    using cond_func_t = dag_cond_func_t<T>;
 
     DagGraphBase(const DagGraphBase &) = delete;
     ~DagGraphBase() = default;
@@ -164,54 +431,214 @@ public:
      * @brief Dump the current DAG to `os` in dot language.
     */
     void dump(std::ostream &os) const {
-        detail::dag_dump(os, outs, weak_outs, names);
+        detail::dag_dump(os, offsets, edges, names, nullptr);
+    }
+
+    /**
+     * @brief Dump the current DAG to `os` in dot language, with the p50/p99
+     *        cost of each node in `stats`, nodes ever on the critical path are
+     *        highlighted.
+    */
+    void dump(std::ostream &os, const DagProfileStats &stats) const {
+        detail::dag_dump(os, offsets, edges, names, &stats);
+    }
+
+    /**
+     * @brief Set the max number of contexts kept for reuse by later runs,
+     *        each context holds a counter for every node. Zero disables the
+     *        cache.
+    */
+    void set_max_cached_contexts(std::size_t n) {
+        std::lock_guard<std::mutex> lg(pool_mtx);
+        max_cached = n;
+        if (ctx_pool.size() > n)
+            ctx_pool.resize(n);
+    }
+
+    /**
+     * @brief Get the plan that only runs the nodes which `sinks` depend on,
+     *        directly or indirectly, through strong or weak edges. The plans
+     *        are cached by the set of sinks. Invalid ids are ignored, and the
+     *        root always runs.
+     *
+     * @param sinks The ids of the nodes whose outputs are needed, see
+     *        DagNodeRef::get_id.
+    */
+    DagPlanPtr get_plan(std::vector<dag_index_t> sinks) {
+        std::sort(sinks.begin(), sinks.end());
+        sinks.erase(std::unique(sinks.begin(), sinks.end()), sinks.end());
+
+        std::lock_guard<std::mutex> lg(plan_mtx);
+        auto it = plans.find(sinks);
+        if (it != plans.end())
+            return it->second;
+
+        std::shared_ptr<DagPlan> plan(new DagPlan());
+        plan->count = detail::dag_mark_upstream(offsets, edges, sinks,
+                                                plan->mask);
+        plans.emplace(std::move(sinks), plan);
+        return plan;
     }
 
 protected:
     struct Node {
         template<typename FUNC>
-        Node(FUNC &&func)
-            : func(std::forward<FUNC>(func))
+        explicit Node(FUNC &&func)
+            : func(std::forward<FUNC>(func)), queue(nullptr),
+              count(0), weak_count(0), weak(false), io(false)
         { }
 
         node_func_t func;
+
+        // If set and returns false, the node and its downstream are skipped.
+        cond_func_t cond;
+
+        // The queue of compute node, nullptr if not a compute node.
+        ExecQueue *queue;
+
+        // Number of strong and weak predecessors.
+        dag_index_t count;
+        dag_index_t weak_count;
+        bool weak;
+
+        // Whether the node should run in handler thread.
+        bool io;
     };
 
-    using node_ptr_t = std::unique_ptr<Node>;
+    using context_t = detail::DagContext<T>;
+    using context_ptr_t = std::unique_ptr<context_t>;
 
-    DagGraphBase() : is_valid(false) { node(nullptr, "root"); }
+    static constexpr dag_index_t INVALID_INDEX = DAG_INVALID_INDEX;
+    static constexpr std::size_t DEFAULT_MAX_CACHED = 16;
 
-    void start(detail::DagContext<T> &ctx) {
+    DagGraphBase() : is_valid(false), max_cached(DEFAULT_MAX_CACHED) {
+        node(nullptr, "root");
+    }
+
+    context_ptr_t acquire_context() {
+        {
+            std::lock_guard<std::mutex> lg(pool_mtx);
+            if (!ctx_pool.empty()) {
+                context_ptr_t ctx = std::move(ctx_pool.back());
+                ctx_pool.pop_back();
+                return ctx;
+            }
+        }
+
+        return std::make_unique<context_t>((dag_index_t)nodes.size());
+    }
+
+    void release_context(context_ptr_t ctx) {
+        ctx->reset();
+
+        std::lock_guard<std::mutex> lg(pool_mtx);
+        if (ctx_pool.size() < max_cached)
+            ctx_pool.push_back(std::move(ctx));
+    }
+
+    void start(context_t &ctx) {
         std::size_t n = nodes.size();
         for (std::size_t i = 0; i < n; i++)
-            ctx[i].init(counters[i], weak_flags[i]);
+            ctx[i].init(nodes[i].count, nodes[i].weak, nodes[i].weak_count);
 
         invoke(ctx, 0).detach();
     }
 
-    Task<> invoke(detail::DagContext<T> &ctx, dag_index_t id) {
-        // TODO yield when recursive
+    void start(context_t &ctx, const DagPlan &plan) {
+        ctx.set_mask(plan.mask.data());
 
-        auto &func = nodes[id]->func;
-        if (func)
-            co_await ctx.invoke(func);
+        // The inactive nodes never run, count them down at once
+        std::size_t skip = nodes.size() - plan.count;
+        if (skip > 0)
+            ctx.count_down((long)skip);
 
-        for (auto next : outs[id])
-            if (ctx[next].count(false))
-                invoke(ctx, next).detach();
+        start(ctx);
+    }
 
-        for (auto next : weak_outs[id])
-            if (ctx[next].count(true))
-                invoke(ctx, next).detach();
+    Task<> invoke(context_t &ctx, dag_index_t id) {
+        // TODO yield when recursive
 
-        ctx.count_down();
+        while (id != INVALID_INDEX) {
+            Node &node = nodes[id];
+            bool skip = ctx[id].skipped();
+
+            if (!skip && node.cond)
+                skip = !ctx.check(node.cond);
+
+            if (!skip) {
+                // Compute nodes continued from a node on the same queue are
+                // already in the right thread, do not switch again.
+                if (node.queue) {
+                    if (detail::current_go_queue() != node.queue) {
+                        auto *executor = detail::get_compute_executor();
+                        co_await switch_go_thread(node.queue, executor);
+                    }
+                }
+                else if (node.io)
+                    co_await switch_handler_thread();
+
+                ctx.node_start(id);
+                if (node.func)
+                    co_await ctx.invoke(node.func);
+                ctx.node_end(id);
+            }
+
+            const dag_index_t *first = edges.data() + offsets[2 * id];
+            const dag_index_t *weak = edges.data() + offsets[2 * id + 1];
+            const dag_index_t *last = edges.data() + offsets[2 * id + 2];
+            dag_index_t next = INVALID_INDEX;
+
+            // One of the ready successors runs in this coroutine, so a chain
+            // of nodes does not detach a new coroutine for each node. Prefer
+            // the one on the same queue as the current node, so that it
+            // needs no thread switch; the others are dispatched at once.
+            auto take = [&](dag_index_t x) {
+                if (next == INVALID_INDEX)
+                    next = x;
+                else if (nodes[next].queue != node.queue &&
+                         nodes[x].queue == node.queue) {
+                    invoke(ctx, next).detach();
+                    next = x;
+                }
+                else
+                    invoke(ctx, x).detach();
+            };
+
+            // A skipped node still counts its successors, so that they know
+            // to be skipped as well.
+            for (; first != weak; ++first) {
+                if (!ctx.active(*first))
+                    continue;
+
+                auto &cnt = ctx[*first];
+                if (skip ? cnt.count_skipped() : cnt.count(false)) {
+                    ctx.node_ready(*first, id);
+                    take(*first);
+                }
+            }
+
+            for (; weak != last; ++weak) {
+                if (!ctx.active(*weak))
+                    continue;
+
+                auto &cnt = ctx[*weak];
+                if (skip ? cnt.count_weak_skipped() : cnt.count(true)) {
+                    ctx.node_ready(*weak, id);
+                    take(*weak);
+                }
+            }
+
+            // The latch cannot reach zero while `next` is not finished, ctx
+            // is not touched after the last count down.
+            ctx.count_down();
+            id = next;
+        }
     }
 
     template<typename FUNC>
     dag_index_t node(FUNC &&func, const std::string &name) {
         dag_index_t id = nodes.size();
-        node_ptr_t ptr(new Node(std::forward<FUNC>(func)));
-        nodes.push_back(std::move(ptr));
+        nodes.emplace_back(std::forward<FUNC>(func));
         outs.push_back({});
         weak_outs.push_back({});
         names.push_back(name);
@@ -219,18 +646,47 @@ protected:
     }
 
     void build() {
+        std::vector<dag_index_t> counters;
+        std::vector<bool> weak_flags;
+
         is_valid = detail::dag_check(outs, weak_outs, counters, weak_flags);
+        if (is_valid) {
+            for (std::size_t i = 0; i < nodes.size(); i++) {
+                nodes[i].count = counters[i];
+                nodes[i].weak = weak_flags[i];
+            }
+
+            for (const auto &vec : weak_outs)
+                for (auto to : vec)
+                    nodes[to].weak_count++;
+        }
+
+        // The adjacency lists are only used while building, the DagGraph
+        // runs on the compiled contiguous edges.
+        detail::dag_compile(outs, weak_outs, offsets, edges);
+        outs = {};
+        weak_outs = {};
+        nodes.shrink_to_fit();
     }
 
 protected:
     bool is_valid;
-    std::vector<dag_index_t> counters;
-    std::vector<bool> weak_flags;
 
-    std::vector<node_ptr_t> nodes;
+    std::vector<Node> nodes;
+    std::vector<dag_index_t> offsets;
+    std::vector<dag_index_t> edges;
+    std::vector<std::string> names;
+
+    // Only used before build
     std::vector<std::vector<dag_index_t>> outs;
     std::vector<std::vector<dag_index_t>> weak_outs;
-    std::vector<std::string> names;
+
+    std::mutex pool_mtx;
+    std::size_t max_cached;
+    std::vector<context_ptr_t> ctx_pool;
+
+    std::mutex plan_mtx;
+    std::map<std::vector<dag_index_t>, DagPlanPtr> plans;
 
     friend DagBuilder<T>;
     friend DagNodeRef<T>;
@@ -257,9 +713,49 @@ public:
      * @pre Current DagGraph is valid.
     */
     Task<> run(T &data) {
-        detail::DagContext<T> ctx(Base::nodes.size(), data);
-        Base::start(ctx);
-        co_await ctx.wait();
+        auto ctx = Base::acquire_context();
+        ctx->set_data(data);
+        Base::start(*ctx);
+        co_await ctx->wait();
+        Base::release_context(std::move(ctx));
+    }
+
+    /**
+     * @brief Run the DAG with `data`, and collect the timestamps of each node
+     *        into `profile`, see DagRunProfile.
+     *
+     * @pre Current DagGraph is valid.
+    */
+    Task<> run(T &data, DagRunProfile &profile) {
+        auto ctx = Base::acquire_context();
+        ctx->set_data(data);
+        ctx->set_profile(profile);
+        Base::start(*ctx);
+        co_await ctx->wait();
+        profile.cost_ns = ctx->elapsed();
+        Base::release_context(std::move(ctx));
+    }
+
+    /**
+     * @brief Run the DAG with `data`, but only the nodes in `plan`, see
+     *        DagGraphBase::get_plan. The plan must come from this DagGraph.
+     *
+     * @pre Current DagGraph is valid.
+    */
+    Task<> run(T &data, DagPlanPtr plan) {
+        auto ctx = Base::acquire_context();
+        ctx->set_data(data);
+        Base::start(*ctx, *plan);
+        co_await ctx->wait();
+        Base::release_context(std::move(ctx));
+    }
+
+    /**
+     * @brief Run the DAG with `data`, but only the nodes which `sinks` depend
+     *        on. Equivalent to run(data, get_plan(sinks)).
+    */
+    Task<> run(T &data, const std::vector<dag_index_t> &sinks) {
+        return run(data, Base::get_plan(sinks));
     }
 
 private:
@@ -282,9 +778,30 @@ public:
     ~DagGraph() = default;
 
     Task<> run() {
-        detail::DagContext<void> ctx(Base::nodes.size());
-        Base::start(ctx);
-        co_await ctx.wait();
+        auto ctx = Base::acquire_context();
+        Base::start(*ctx);
+        co_await ctx->wait();
+        Base::release_context(std::move(ctx));
+    }
+
+    Task<> run(DagRunProfile &profile) {
+        auto ctx = Base::acquire_context();
+        ctx->set_profile(profile);
+        Base::start(*ctx);
+        co_await ctx->wait();
+        profile.cost_ns = ctx->elapsed();
+        Base::release_context(std::move(ctx));
+    }
+
+    Task<> run(DagPlanPtr plan) {
+        auto ctx = Base::acquire_context();
+        Base::start(*ctx, *plan);
+        co_await ctx->wait();
+        Base::release_context(std::move(ctx));
+    }
+
+    Task<> run(const std::vector<dag_index_t> &sinks) {
+        return run(Base::get_plan(sinks));
     }
 
 private:
@@ -322,6 +839,12 @@ public:
         return builder->connect(*this, r);
     }
 
+    /**
+     * @brief Get the id of the node, which is still valid after the DagGraph
+     *        is built, see DagGraph::get_plan.
+    */
+    dag_index_t get_id() const { return id; }
+
     DagNodeRef weak_then(DagNodeRef r) const {
         return builder->weak_connect(*this, r);
     }
@@ -394,6 +917,76 @@ public:
         return DagNodeRef(this, id);
     }
 
+    /**
+     * @brief Create a new compute node, it runs in the compute thread pool
+     *        with queue `queue`, as if the coroutine starts with
+     *        `co_await coke::switch_go_thread(queue)`. If it is continued
+     *        from a compute node of the same queue, the thread switch is
+     *        skipped.
+     *
+     * @param func See DagBuilder::node.
+     * @param name See DagBuilder::node.
+     * @param queue The name of the go queue.
+    */
+    template<typename FUNC>
+        requires std::constructible_from<dag_node_func_t<T>, FUNC&&>
+    DagNodeRef<T> compute_node(FUNC &&func, const std::string &name = "",
+                               const std::string &queue =
+                                   std::string(GO_DEFAULT_QUEUE)) {
+        DagNodeRef<T> r = node(std::forward<FUNC>(func), name);
+        set_compute(r, queue);
+        return r;
+    }
+
+    /**
+     * @brief Create a new io node, it runs in the handler thread, as if the
+     *        coroutine starts with `co_await coke::switch_handler_thread()`.
+     *
+     * @param func See DagBuilder::node.
+     * @param name See DagBuilder::node.
+    */
+    template<typename FUNC>
+        requires std::constructible_from<dag_node_func_t<T>, FUNC&&>
+    DagNodeRef<T> io_node(FUNC &&func, const std::string &name = "") {
+        DagNodeRef<T> r = node(std::forward<FUNC>(func), name);
+        set_io(r);
+        return r;
+    }
+
+    /**
+     * @brief Mark an existing node as compute node, see compute_node.
+    */
+    void set_compute(DagNodeRef<T> r, const std::string &queue =
+                                          std::string(GO_DEFAULT_QUEUE)) const {
+        auto &node = graph->nodes[r.id];
+        node.queue = detail::get_exec_queue(queue);
+        node.io = false;
+    }
+
+    /**
+     * @brief Set the condition of node `r`, it is checked before the node
+     *        runs in each run of DagGraph. If it returns false, the node is
+     *        skipped, and so are the nodes that strongly depend on it, or whose
+     *        weak predecessors are all skipped.
+     *
+     * @param cond A callable that can be used to construct dag_cond_func_t<T>,
+     *        it should be cheap and must not throw.
+    */
+    template<typename COND>
+        requires std::constructible_from<dag_cond_func_t<T>, COND&&>
+    void set_condition(DagNodeRef<T> r, COND &&cond) const {
+        graph->nodes[r.id].cond = std::forward<COND>(cond);
+    }
+
+    /**
+     * @brief Mark an existing node as io node, see io_node.
+    */
+    void set_io(DagNodeRef<T> r) const {
+        auto &node = graph->nodes[r.id];
+        node.queue = nullptr;
+        node.io = true;
+    }
+
     /**
      * @brief Strongly connect l -> r.
     */
@@ -0,0 +1,253 @@
+/**
+ * Copyright 2024 Coke Project (https://github.com/kedixa/coke)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Authors: kedixa (https://github.com/kedixa)
+*/
+
+#ifndef COKE_DARY_HEAP_H
+#define COKE_DARY_HEAP_H
+
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace coke {
+
+/**
+ * @brief A std::vector used as the container of coke::PriorityQueue to select
+ *        a D-ary heap instead of the binary std::priority_queue. Everything
+ *        else is the same as std::vector.
+*/
+template<typename T, std::size_t D = 4, typename Alloc = std::allocator<T>>
+struct DaryHeapVector : public std::vector<T, Alloc> {
+    static constexpr std::size_t heap_arity = D;
+
+    using std::vector<T, Alloc>::vector;
+};
+
+/**
+ * @class coke::DaryHeap
+ * @brief A container adaptor like std::priority_queue, but each node of the
+ *        heap has D children. The heap is shallower than a binary heap, and
+ *        the children of a node are adjacent in memory, so pop has fewer
+ *        cache misses on large heaps at the cost of more comparisons.
+ *
+ * @tparam T,Container,Compare Same as std::priority_queue.
+ * @tparam D Number of children of each node, 4 and 8 are usually good.
+*/
+template<
+    typename T,
+    std::size_t D = 4,
+    typename Container = std::vector<T>,
+    typename Compare = std::less<typename Container::value_type>
+>
+class DaryHeap {
+    static_assert(D >= 2, "DaryHeap requires D >= 2");
+
+public:
+    using container_type = Container;
+    using value_compare = Compare;
+    using value_type = typename Container::value_type;
+    using size_type = typename Container::size_type;
+    using reference = typename Container::reference;
+    using const_reference = typename Container::const_reference;
+
+    static constexpr std::size_t arity = D;
+
+    DaryHeap() : DaryHeap(Compare()) { }
+
+    explicit DaryHeap(const Compare &comp) : c(), comp(comp) { }
+
+    template<typename Alloc>
+        requires std::uses_allocator_v<Container, Alloc>
+    explicit DaryHeap(const Alloc &alloc) : c(alloc), comp() { }
+
+    template<typename Alloc>
+        requires std::uses_allocator_v<Container, Alloc>
+    DaryHeap(const Compare &comp, const Alloc &alloc) : c(alloc), comp(comp)
+    { }
+
+    /**
+     * @brief Build the heap from `cont` in linear time.
+    */
+    DaryHeap(const Compare &comp, Container &&cont)
+        : c(std::move(cont)), comp(comp)
+    {
+        make_heap();
+    }
+
+    /**
+     * @brief Build the heap from [first, last) in linear time.
+    */
+    template<std::input_iterator Iter>
+    DaryHeap(Iter first, Iter last, const Compare &comp = Compare())
+        : c(first, last), comp(comp)
+    {
+        make_heap();
+    }
+
+    bool empty() const noexcept { return c.empty(); }
+
+    size_type size() const noexcept { return c.size(); }
+
+    const_reference top() const { return c.front(); }
+
+    void push(const value_type &value) {
+        c.push_back(value);
+        sift_up(c.size() - 1);
+    }
+
+    void push(value_type &&value) {
+        c.push_back(std::move(value));
+        sift_up(c.size() - 1);
+    }
+
+    template<typename... Args>
+    void emplace(Args&&... args) {
+        c.emplace_back(std::forward<Args>(args)...);
+        sift_up(c.size() - 1);
+    }
+
+    /**
+     * @brief Push at most `max_count` elements of [first, last). When many
+     *        elements are pushed, the whole heap is rebuilt in linear time
+     *        instead of sifting up each of them.
+     *
+     * @return Iterator for next value to push. If an exception is thrown, the
+     *         elements pushed before it remain in the heap.
+    */
+    template<std::input_iterator Iter>
+    Iter push_range(Iter first, Iter last,
+                    size_type max_count = size_type(-1)) {
+        size_type old_size = c.size();
+        size_type n = 0;
+
+        try {
+            for (; first != last && n < max_count; ++first, ++n)
+                c.emplace_back(*first);
+        }
+        catch (...) {
+            fix_heap(old_size);
+            throw;
+        }
+
+        fix_heap(old_size);
+        return first;
+    }
+
+    void pop() {
+        value_type value = std::move(c.back());
+        c.pop_back();
+
+        if (!c.empty())
+            sift_down(0, std::move(value));
+    }
+
+    void swap(DaryHeap &other) noexcept(std::is_nothrow_swappable_v<Container>
+                                        && std::is_nothrow_swappable_v<Compare>)
+    {
+        using std::swap;
+        swap(c, other.c);
+        swap(comp, other.comp);
+    }
+
+private:
+    void sift_up(size_type hole) {
+        value_type value = std::move(c[hole]);
+
+        while (hole > 0) {
+            size_type parent = (hole - 1) / D;
+            if (!comp(c[parent], value))
+                break;
+
+            c[hole] = std::move(c[parent]);
+            hole = parent;
+        }
+
+        c[hole] = std::move(value);
+    }
+
+    void sift_down(size_type hole, value_type value) {
+        size_type n = c.size();
+
+        while (true) {
+            size_type child = hole * D + 1;
+            if (child >= n)
+                break;
+
+            size_type last = (n - child > D) ? child + D : n;
+            size_type best = child;
+
+            for (++child; child < last; ++child) {
+                if (comp(c[best], c[child]))
+                    best = child;
+            }
+
+            if (!comp(value, c[best]))
+                break;
+
+            c[hole] = std::move(c[best]);
+            hole = best;
+        }
+
+        c[hole] = std::move(value);
+    }
+
+    void make_heap() {
+        size_type n = c.size();
+        if (n < 2)
+            return;
+
+        for (size_type i = (n - 2) / D + 1; i > 0; --i)
+            sift_down(i - 1, std::move(c[i - 1]));
+    }
+
+    /**
+     * @brief Restore the heap after elements are appended after `old_size`,
+     *        rebuild it if sifting up each of them costs more.
+    */
+    void fix_heap(size_type old_size) {
+        size_type n = c.size();
+        size_type depth = 0;
+
+        for (size_type x = n; x > 1; x /= D)
+            ++depth;
+
+        if ((n - old_size) * depth > n)
+            make_heap();
+        else {
+            for (size_type i = old_size; i < n; i++)
+                sift_up(i);
+        }
+    }
+
+protected:
+    Container c;
+    Compare comp;
+};
+
+} // namespace coke
+
+template<typename T, std::size_t D, typename Container, typename Compare,
+         typename Alloc>
+struct std::uses_allocator<coke::DaryHeap<T, D, Container, Compare>, Alloc>
+    : std::uses_allocator<Container, Alloc>::type
+{ };
+
+#endif // COKE_DARY_HEAP_H
@@ -0,0 +1,347 @@
+/**
+ * Copyright 2024 Coke Project (https://github.com/kedixa/coke)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Authors: kedixa (https://github.com/kedixa)
+*/
+
+#ifndef COKE_DATAFLOW_DAG_H
+#define COKE_DATAFLOW_DAG_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <optional>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <variant>
+
+#include "coke/dag.h"
+#include "coke/latch.h"
+#include "coke/task.h"
+
+namespace coke {
+
+/**
+ * @brief A node of DataflowDag, `INPUTS` are the indexes of the nodes whose
+ *        outputs are passed to `func` in order, they must be smaller than the
+ *        index of this node. Create it by coke::dataflow_node.
+*/
+template<typename F, dag_index_t... INPUTS>
+struct DataflowNode {
+    static constexpr std::size_t input_count = sizeof...(INPUTS);
+    static constexpr std::array<dag_index_t, input_count> inputs{INPUTS...};
+
+    F func;
+};
+
+/**
+ * @brief Create a DataflowNode that takes the outputs of nodes `INPUTS`.
+ *
+ * @param func A callable returning coke::Task<R>. A node without inputs is
+ *        called as `func(input)` with the input of the run, or `func()` if
+ *        the input type is void. Other nodes are called as
+ *        `func(out_0, out_1, ...)` with const references to the outputs.
+*/
+template<dag_index_t... INPUTS, typename F>
+auto dataflow_node(F &&func) {
+    return DataflowNode<std::decay_t<F>, INPUTS...>{std::forward<F>(func)};
+}
+
+namespace detail {
+
+template<typename IN, typename NODES, std::size_t I>
+struct DataflowOutput;
+
+template<typename IN, typename NODES, std::size_t I, typename IDX>
+struct DataflowTask;
+
+template<typename IN, typename NODES, std::size_t I, std::size_t... Js>
+struct DataflowTask<IN, NODES, I, std::index_sequence<Js...>> {
+    using node_t = std::tuple_element_t<I, NODES>;
+    using func_t = decltype(node_t::func);
+
+    static auto helper() {
+        if constexpr (node_t::input_count != 0) {
+            return std::type_identity<std::invoke_result_t<func_t &,
+                const typename DataflowOutput<IN, NODES,
+                                              node_t::inputs[Js]>::type &...
+            >>{};
+        }
+        else if constexpr (std::is_void_v<IN>)
+            return std::type_identity<std::invoke_result_t<func_t &>>{};
+        else {
+            return std::type_identity<
+                std::invoke_result_t<func_t &, const IN &>
+            >{};
+        }
+    }
+
+    using type = typename decltype(helper())::type;
+};
+
+template<typename IN, typename NODES, std::size_t I>
+struct DataflowOutput {
+    using node_t = std::tuple_element_t<I, NODES>;
+    using task_t = typename DataflowTask<IN, NODES, I,
+        std::make_index_sequence<node_t::input_count>>::type;
+
+    static_assert(is_task_v<task_t>,
+                  "DataflowDag node must return coke::Task<R>");
+
+    using type = TaskRetType<task_t>;
+};
+
+template<typename T>
+struct DataflowSlot {
+    using type = std::optional<T>;
+};
+
+template<>
+struct DataflowSlot<void> {
+    using type = std::monostate;
+};
+
+template<typename... NODES>
+constexpr bool dataflow_check() {
+    const std::array<std::size_t, sizeof...(NODES)> counts{
+        NODES::input_count...
+    };
+    const std::array<const dag_index_t *, sizeof...(NODES)> inputs{
+        NODES::inputs.data()...
+    };
+
+    for (std::size_t i = 0; i < counts.size(); i++) {
+        for (std::size_t j = 0; j < counts[i]; j++) {
+            if (inputs[i][j] >= i)
+                return false;
+        }
+    }
+
+    return true;
+}
+
+} // namespace detail
+
+
+/**
+ * @brief DataflowDag is a StaticDag whose nodes communicate by typed outputs
+ *        instead of a shared data. Each node produces a value, which is stored
+ *        in a slot of the run and passed to the downstream nodes by const
+ *        reference. A slot is written by exactly one node before any of its
+ *        readers start, so parallel branches need no locks.
+ *
+ * The input of a node must be a node with a smaller index, so the graph is
+ * always acyclic. The nodes without inputs receive the input of the run. A
+ * node that returns Task<void> cannot be used as an input.
+ *
+ * @tparam IN The type of input of each run, may be void.
+ * @tparam NODES The DataflowNode types.
+*/
+template<typename IN, typename... NODES>
+class DataflowDag {
+    static constexpr std::size_t N = sizeof...(NODES);
+
+    static_assert(N > 0 && N < (std::size_t)DAG_INVALID_INDEX);
+    static_assert(detail::dataflow_check<NODES...>(),
+                  "The inputs of a DataflowDag node must be smaller than "
+                  "the index of the node");
+
+    using nodes_t = std::tuple<NODES...>;
+
+    template<std::size_t I>
+    using output_t = typename detail::DataflowOutput<IN, nodes_t, I>::type;
+
+    template<std::size_t... Is>
+    static auto make_slots(std::index_sequence<Is...>)
+        -> std::tuple<typename detail::DataflowSlot<output_t<Is>>::type...>;
+
+    using slots_t = decltype(make_slots(std::make_index_sequence<N>{}));
+    using input_ptr_t = std::add_pointer_t<std::add_const_t<IN>>;
+
+    struct Context {
+        explicit Context(input_ptr_t input) : input(input), lt((long)N) {
+            for (std::size_t i = 0; i < N; i++)
+                counts[i].store(in_counts[i], std::memory_order_relaxed);
+        }
+
+        input_ptr_t input;
+        Latch lt;
+        std::array<std::atomic<dag_index_t>, N> counts;
+        slots_t slots;
+    };
+
+    using invoker_t = Task<> (*)(DataflowDag *, Context &);
+
+    static constexpr std::array<dag_index_t, N> in_counts{
+        (dag_index_t)NODES::input_count...
+    };
+
+    static constexpr std::size_t M = (NODES::input_count + ... + 0);
+
+    // Successors of node i are outs[offsets[i]] to outs[offsets[i+1]-1]
+    static constexpr std::array<dag_index_t, N + 1> offsets = [] {
+        std::array<dag_index_t, N + 1> off{};
+        auto add = [&off](const auto &inputs) {
+            for (dag_index_t from : inputs)
+                ++off[from + 1];
+        };
+
+        (add(NODES::inputs), ...);
+        for (std::size_t i = 0; i < N; i++)
+            off[i + 1] += off[i];
+        return off;
+    }();
+
+    static constexpr std::array<dag_index_t, M> outs = [] {
+        std::array<dag_index_t, M> out{};
+        std::array<dag_index_t, N + 1> pos = offsets;
+        dag_index_t to = 0;
+        auto add = [&](const auto &inputs) {
+            for (dag_index_t from : inputs)
+                out[pos[from]++] = to;
+            ++to;
+        };
+
+        (add(NODES::inputs), ...);
+        return out;
+    }();
+
+public:
+    using result_type = output_t<N - 1>;
+
+    template<typename... Ns>
+        requires (sizeof...(Ns) == N)
+    explicit DataflowDag(Ns &&...nodes) : nodes(std::forward<Ns>(nodes)...)
+    { }
+
+    DataflowDag(const DataflowDag &) = delete;
+    DataflowDag &operator= (const DataflowDag &) = delete;
+
+    static constexpr std::size_t node_count() noexcept { return N; }
+
+    /**
+     * @brief Run the graph with `input`, and return the output of the last
+     *        node after all the nodes are finished. The outputs of the other
+     *        nodes are destroyed when the run is finished.
+    */
+    template<typename U = IN>
+        requires (!std::is_void_v<U> && std::is_same_v<U, IN>)
+    Task<result_type> run(const U &input) {
+        return run_impl(std::addressof(input));
+    }
+
+    Task<result_type> run() requires std::is_void_v<IN> {
+        return run_impl(nullptr);
+    }
+
+private:
+    Task<result_type> run_impl(input_ptr_t input) {
+        Context ctx(input);
+
+        for (std::size_t i = 0; i < N; i++) {
+            if (in_counts[i] == 0)
+                invoke(ctx, (dag_index_t)i).detach();
+        }
+
+        co_await ctx.lt.wait();
+
+        if constexpr (!std::is_void_v<result_type>)
+            co_return std::move(*std::get<N - 1>(ctx.slots));
+    }
+
+    Task<> invoke(Context &ctx, dag_index_t id) {
+        static constexpr std::array<invoker_t, N> invokers =
+            make_invokers(std::make_index_sequence<N>{});
+
+        while (id != DAG_INVALID_INDEX) {
+            co_await invokers[id](this, ctx);
+
+            dag_index_t next = DAG_INVALID_INDEX;
+            for (dag_index_t i = offsets[id]; i < offsets[id + 1]; i++) {
+                dag_index_t x = outs[i];
+                if (ctx.counts[x].fetch_sub(1, std::memory_order_acq_rel) != 1)
+                    continue;
+
+                // Continue with the first ready successor in this coroutine
+                if (next == DAG_INVALID_INDEX)
+                    next = x;
+                else
+                    invoke(ctx, x).detach();
+            }
+
+            // The latch cannot reach zero while `next` is not finished, ctx
+            // is not touched after the last count down.
+            ctx.lt.count_down();
+            id = next;
+        }
+    }
+
+    template<std::size_t I, std::size_t... Js>
+    auto call_node(Context &ctx, std::index_sequence<Js...>) {
+        using node_t = std::tuple_element_t<I, nodes_t>;
+        auto &func = std::get<I>(nodes).func;
+
+        if constexpr (node_t::input_count != 0) {
+            static_assert((!std::is_void_v<output_t<node_t::inputs[Js]>> && ...),
+                          "Node returns Task<void> cannot be an input");
+            return func(*std::get<node_t::inputs[Js]>(ctx.slots)...);
+        }
+        else if constexpr (std::is_void_v<IN>)
+            return func();
+        else
+            return func(*ctx.input);
+    }
+
+    template<std::size_t I>
+    static Task<> invoke_node(DataflowDag *dag, Context &ctx) {
+        using node_t = std::tuple_element_t<I, nodes_t>;
+        using idx_t = std::make_index_sequence<node_t::input_count>;
+
+        if constexpr (std::is_void_v<output_t<I>>)
+            co_await dag->template call_node<I>(ctx, idx_t{});
+        else {
+            std::get<I>(ctx.slots).emplace(
+                co_await dag->template call_node<I>(ctx, idx_t{})
+            );
+        }
+    }
+
+    template<std::size_t... Is>
+    static constexpr std::array<invoker_t, N>
+    make_invokers(std::index_sequence<Is...>) {
+        return {&DataflowDag::invoke_node<Is>...};
+    }
+
+private:
+    nodes_t nodes;
+};
+
+/**
+ * @brief Create a DataflowDag from the nodes created by coke::dataflow_node,
+ *        the i-th argument is node i.
+ *
+ * @tparam IN Type of the input of each run, may be void.
+ * @return The DataflowDag, which is neither copyable nor movable and is
+ *         returned by guaranteed copy elision.
+*/
+template<typename IN, typename... Ns>
+auto make_dataflow_dag(Ns &&...nodes) {
+    return DataflowDag<IN, std::decay_t<Ns>...>(std::forward<Ns>(nodes)...);
+}
+
+} // namespace coke
+
+#endif // COKE_DATAFLOW_DAG_H
@@ -0,0 +1,337 @@
+/**
+ * Copyright 2024 Coke Project (https://github.com/kedixa/coke)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Authors: kedixa (https://github.com/kedixa)
+*/
+
+#ifndef COKE_DELAY_QUEUE_H
+#define COKE_DELAY_QUEUE_H
+
+#include <algorithm>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include "coke/detail/basic_concept.h"
+#include "coke/condition.h"
+#include "coke/stop_token.h"
+
+namespace coke {
+
+/**
+ * @brief DelayQueue is an unbounded queue whose elements can only be popped
+ *        after their deadlines, the one with the earliest deadline is popped
+ *        first, and elements with the same deadline are popped in the order
+ *        they are pushed.
+ *
+ * Only one popping coroutine (the leader) sleeps until the earliest deadline,
+ * the others wait without timer until the leader leaves. When an element with
+ * an earlier deadline is pushed, the leader is woken up at once to sleep for
+ * the new one.
+ *
+ * @tparam T Type of the element.
+*/
+template<Queueable T>
+class DelayQueue {
+    using UniqueLock = std::unique_lock<std::mutex>;
+
+    struct Entry {
+        SteadyTimePoint deadline;
+        uint64_t seq;
+        T value;
+    };
+
+    struct EntryGreater {
+        bool operator()(const Entry &a, const Entry &b) const noexcept {
+            if (a.deadline != b.deadline)
+                return a.deadline > b.deadline;
+            return a.seq > b.seq;
+        }
+    };
+
+    struct WakeOnStop {
+        void operator()() const noexcept {
+            { UniqueLock lk(que->mtx); }
+            que->cv.notify_all();
+        }
+
+        DelayQueue *que;
+    };
+
+public:
+    using SizeType = std::size_t;
+    using ValueType = T;
+
+    DelayQueue() : que_closed(false), next_seq(0), leader(0), next_waiter(0) { }
+
+    DelayQueue(const DelayQueue &) = delete;
+    DelayQueue &operator= (const DelayQueue &) = delete;
+
+    /**
+     * @pre No coroutine is waiting on it.
+    */
+    ~DelayQueue() = default;
+
+    bool empty() const { return size() == 0; }
+
+    SizeType size() const {
+        UniqueLock lk(mtx);
+        return heap.size();
+    }
+
+    bool closed() const {
+        UniqueLock lk(mtx);
+        return que_closed;
+    }
+
+    /**
+     * @brief Get the earliest deadline, or std::nullopt if empty.
+    */
+    std::optional<SteadyTimePoint> next_deadline() const {
+        UniqueLock lk(mtx);
+        if (heap.empty())
+            return std::nullopt;
+        return heap.front().deadline;
+    }
+
+    /**
+     * @brief Close the container. The pushes fail, the pops still get the
+     *        remaining elements at their deadlines, and then fail with
+     *        coke::TOP_CLOSED.
+    */
+    void close() {
+        UniqueLock lk(mtx);
+        que_closed = true;
+        lk.unlock();
+
+        cv.notify_all();
+    }
+
+    /**
+     * @brief Reopen a closed container.
+    */
+    void reopen() {
+        UniqueLock lk(mtx);
+        que_closed = false;
+    }
+
+    /**
+     * @brief Remove all the elements.
+    */
+    void clear() {
+        std::vector<Entry> tmp;
+        UniqueLock lk(mtx);
+        tmp.swap(heap);
+    }
+
+    /**
+     * @brief Push `u` that can be popped at `deadline`.
+     *
+     * @returns Whether pushed, false if closed and `u` is not moved.
+    */
+    template<typename U>
+        requires std::constructible_from<T, U&&>
+    bool push_at(SteadyTimePoint deadline, U &&u) {
+        UniqueLock lk(mtx);
+        if (que_closed)
+            return false;
+
+        heap.push_back(Entry{deadline, next_seq++, T(std::forward<U>(u))});
+        std::push_heap(heap.begin(), heap.end(), EntryGreater{});
+
+        // The leader sleeps for a later one, let it sleep again
+        bool wake = (heap.front().seq == next_seq - 1);
+        if (wake)
+            leader = 0;
+        lk.unlock();
+
+        if (wake)
+            cv.notify_one();
+
+        return true;
+    }
+
+    /**
+     * @brief Push `u` that can be popped after `nsec`.
+    */
+    template<typename U>
+        requires std::constructible_from<T, U&&>
+    bool push_after(NanoSec nsec, U &&u) {
+        return push_at(detail::TimedWaitHelper::now() + nsec,
+                       std::forward<U>(u));
+    }
+
+    /**
+     * @brief Try to pop the earliest element if its deadline has passed.
+     *
+     * @param u Reference that receive popped element.
+     * @returns Whether element is popped.
+    */
+    template<typename U>
+        requires std::assignable_from<U&, T&&>
+    bool try_pop(U &u) {
+        UniqueLock lk(mtx);
+        if (!due())
+            return false;
+
+        pop_locked(lk, u);
+        return true;
+    }
+
+    /**
+     * @brief Pop the earliest element, wait until its deadline passes.
+     *
+     * @param u Reference that receive popped element.
+     *
+     * @returns Coroutine that should co_await immediately.
+     * @retval coke::TOP_SUCCESS If pop successful.
+     * @retval coke::TOP_CLOSED If container is closed and empty.
+     * @retval coke::TOP_ABORTED If process exit.
+     * @retval Negative integer to indicate system error, almost never happens.
+    */
+    template<typename U>
+        requires std::assignable_from<U&, T&&>
+    Task<int> pop(U &u) {
+        return pop_impl(detail::TimedWaitHelper{}, u);
+    }
+
+    /**
+     * @brief Same as pop, but give up with coke::TOP_STOPPED when stop is
+     *        requested on `token`, which must outlive the returned coroutine.
+    */
+    template<typename U>
+        requires std::assignable_from<U&, T&&>
+    Task<int> pop(U &u, StopToken &token) {
+        return pop_impl(detail::TimedWaitHelper{}, u, &token);
+    }
+
+    /**
+     * @brief Same as pop, but give up with coke::TOP_TIMEOUT if no element is
+     *        due in `nsec`.
+    */
+    template<typename U>
+        requires std::assignable_from<U&, T&&>
+    Task<int> try_pop_for(NanoSec nsec, U &u) {
+        return pop_impl(detail::TimedWaitHelper{nsec}, u);
+    }
+
+    /**
+     * @brief Same as try_pop_for, but wait until `deadline`.
+    */
+    template<typename U>
+        requires std::assignable_from<U&, T&&>
+    Task<int> try_pop_until(SteadyTimePoint deadline, U &u) {
+        return pop_impl(detail::TimedWaitHelper{deadline}, u);
+    }
+
+private:
+    bool due() const {
+        return !heap.empty()
+            && heap.front().deadline <= detail::TimedWaitHelper::now();
+    }
+
+    template<typename U>
+    void pop_locked(UniqueLock &lk, U &u) {
+        std::pop_heap(heap.begin(), heap.end(), EntryGreater{});
+        u = std::move(heap.back().value);
+        heap.pop_back();
+
+        // Let a follower become the leader for the next element
+        bool wake = (!heap.empty() && leader == 0);
+        lk.unlock();
+
+        if (wake)
+            cv.notify_one();
+    }
+
+    template<typename U>
+    Task<int> pop_impl(detail::TimedWaitHelper helper, U &u,
+                       StopToken *token = nullptr) {
+        if (coke::prevent_recursive_stack())
+            co_await coke::yield();
+
+        std::optional<StopCallback<WakeOnStop>> cb;
+        if (token)
+            cb.emplace(*token, WakeOnStop{this});
+
+        UniqueLock lk(mtx);
+        uint64_t id = ++next_waiter;
+        int ret;
+
+        while (true) {
+            if (due()) {
+                pop_locked(lk, u);
+                co_return TOP_SUCCESS;
+            }
+
+            if (heap.empty() && que_closed)
+                ret = TOP_CLOSED;
+            else if (token && token->stop_requested())
+                ret = TOP_STOPPED;
+            else if (helper.timeout())
+                ret = TOP_TIMEOUT;
+            else {
+                bool follow = (leader != 0 || heap.empty());
+                SteadyTimePoint deadline = helper.deadline();
+
+                if (!follow) {
+                    leader = id;
+                    deadline = std::min(deadline, heap.front().deadline);
+                }
+
+                if (deadline == detail::TimedWaitHelper::max())
+                    ret = co_await cv.wait(lk);
+                else
+                    ret = co_await cv.wait_until(lk, deadline);
+
+                if (leader == id)
+                    leader = 0;
+
+                if (ret == TOP_SUCCESS || ret == TOP_TIMEOUT)
+                    continue;
+            }
+
+            break;
+        }
+
+        // Let a follower become the leader in place of this one
+        bool wake = (!heap.empty() && leader == 0);
+        lk.unlock();
+
+        if (wake)
+            cv.notify_one();
+
+        co_return ret;
+    }
+
+private:
+    bool que_closed;
+    uint64_t next_seq;
+
+    // Id of the pop that sleeps for the earliest element, zero means none
+    uint64_t leader;
+    uint64_t next_waiter;
+
+    std::vector<Entry> heap;
+
+    mutable std::mutex mtx;
+    Condition cv;
+};
+
+} // namespace coke
+
+#endif // COKE_DELAY_QUEUE_H
@@ -27,19 +27,33 @@
 #include <deque>
 
 #include "coke/detail/basic_concept.h"
+#include "coke/detail/select_base.h"
+#include "coke/queue_stats.h"
 #include "coke/condition.h"
 
 namespace coke {
 
-template<Queueable T, typename Alloc=std::allocator<T>>
+/**
+ * @class coke::Deque
+ * @brief coke::Deque is a container that can push and pop at both ends.
+ *
+ * @tparam T Type of the element.
+ * @tparam Alloc Allocator used to create the default container.
+ * @tparam Container Type of the underlying container, such as std::deque or
+ *         coke::RingBuffer, whose allocator_type must be Alloc.
+*/
+template<Queueable T, typename Alloc=std::allocator<T>,
+         typename Container=std::deque<T, Alloc>>
 class Deque {
 public:
     using SizeType = std::size_t;
-    using ContainerType = std::deque<T, Alloc>;
+    using ContainerType = Container;
     using AllocatorType = typename ContainerType::allocator_type;
     using ValueType = T;
     using QueueType = ContainerType;
 
+    static_assert(std::is_same_v<T, typename Container::value_type>);
+
 protected:
     using UniqueLock = std::unique_lock<std::mutex>;
 
@@ -52,10 +66,21 @@ protected:
     static SizeType min(SizeType a, SizeType b) { return (b < a) ? b : a; }
 
     struct CountGuard {
-        CountGuard(SizeType &m) : n(m) { ++n; }
-        ~CountGuard() { --n; }
+        CountGuard(SizeType &m, detail::BlockStat &st)
+            : n(m), st(st), start(detail::TimedWaitHelper::now())
+        {
+            ++n;
+            ++st.count;
+        }
+
+        ~CountGuard() {
+            --n;
+            st.time += detail::TimedWaitHelper::now() - start;
+        }
 
         SizeType &n;
+        detail::BlockStat &st;
+        SteadyTimePoint start;
     };
 
 public:
@@ -69,7 +94,8 @@ public:
 
     Deque(SizeType max_size, const AllocatorType &alloc)
         : que_max_size(max_size), que_cur_size(0), que_closed(false),
-          push_wait_cnt(0), pop_wait_cnt(0), que(alloc)
+          push_wait_cnt(0), pop_wait_cnt(0), high_water(0), push_count(0),
+          pop_count(0), que(alloc)
     {
         // empty queue not supported
         if (que_max_size == 0)
@@ -132,6 +158,7 @@ public:
         if (!que_closed.exchange(true, acq_rel)) {
             push_cv.notify_all();
             pop_cv.notify_all();
+            select_list.wake_all();
         }
     }
 
@@ -141,6 +168,48 @@ public:
     */
     void reopen() noexcept { que_closed.store(false, release); }
 
+    /**
+     * @brief Get the statistics since created or the last reset_stats.
+    */
+    QueueStats get_stats() const {
+        UniqueLock lk(que_mtx);
+        QueueStats st;
+
+        st.high_water = high_water;
+        st.push_count = push_count;
+        st.pop_count = pop_count;
+        st.blocked_push_count = push_block.count;
+        st.blocked_pop_count = pop_block.count;
+        st.blocked_push_time = push_block.time;
+        st.blocked_pop_time = pop_block.time;
+        return st;
+    }
+
+    /**
+     * @brief Reset the statistics, the high water mark restarts from the
+     *        current size.
+    */
+    void reset_stats() {
+        UniqueLock lk(que_mtx);
+
+        high_water = size();
+        push_count = 0;
+        pop_count = 0;
+        push_block.reset();
+        pop_block.reset();
+    }
+
+    // Inner use only, see coke::select.
+    void add_select_node(detail::SelectNode *node) {
+        UniqueLock lk(que_mtx);
+        select_list.add(node);
+    }
+
+    void remove_select_node(detail::SelectNode *node) {
+        UniqueLock lk(que_mtx);
+        select_list.remove(node);
+    }
+
     // emplace
 
     /**
@@ -201,7 +270,8 @@ public:
     template<typename... Args>
         requires std::constructible_from<T, Args&&...>
     Task<int> emplace_front(Args&&... args) {
-        return emplace_impl(pos_front, true, NanoSec(0), std::forward<Args>(args)...);
+        return emplace_impl(pos_front, detail::TimedWaitHelper{},
+                            std::forward<Args>(args)...);
     }
 
     /**
@@ -211,7 +281,8 @@ public:
     template<typename... Args>
         requires std::constructible_from<T, Args&&...>
     Task<int> emplace_back(Args&&... args) {
-        return emplace_impl(pos_back, true, NanoSec(0), std::forward<Args>(args)...);
+        return emplace_impl(pos_back, detail::TimedWaitHelper{},
+                            std::forward<Args>(args)...);
     }
 
     /**
@@ -231,7 +302,19 @@ public:
     template<typename... Args>
         requires std::constructible_from<T, Args&&...>
     Task<int> try_emplace_front_for(NanoSec nsec, Args&&... args) {
-        return emplace_impl(pos_front, false, nsec, std::forward<Args>(args)...);
+        return emplace_impl(pos_front, detail::TimedWaitHelper{nsec},
+                            std::forward<Args>(args)...);
+    }
+
+    /**
+     * @brief Same as try_emplace_front_for, but wait until `deadline`.
+    */
+    template<typename... Args>
+        requires std::constructible_from<T, Args&&...>
+    Task<int> try_emplace_front_until(SteadyTimePoint deadline,
+                                      Args&&... args) {
+        return emplace_impl(pos_front, detail::TimedWaitHelper{deadline},
+                            std::forward<Args>(args)...);
     }
 
     /**
@@ -241,7 +324,18 @@ public:
     template<typename... Args>
         requires std::constructible_from<T, Args&&...>
     Task<int> try_emplace_back_for(NanoSec nsec, Args&&... args) {
-        return emplace_impl(pos_back, false, nsec, std::forward<Args>(args)...);
+        return emplace_impl(pos_back, detail::TimedWaitHelper{nsec},
+                            std::forward<Args>(args)...);
+    }
+
+    /**
+     * @brief Same as try_emplace_back_for, but wait until `deadline`.
+    */
+    template<typename... Args>
+        requires std::constructible_from<T, Args&&...>
+    Task<int> try_emplace_back_until(SteadyTimePoint deadline, Args&&... args) {
+        return emplace_impl(pos_back, detail::TimedWaitHelper{deadline},
+                            std::forward<Args>(args)...);
     }
 
     // push
@@ -303,7 +397,8 @@ public:
     template<typename U>
         requires std::assignable_from<T&, U&&>
     Task<int> push_front(U &&u) {
-        return push_impl(pos_front, true, NanoSec(0), std::forward<U>(u));
+        return push_impl(pos_front, detail::TimedWaitHelper{},
+                         std::forward<U>(u));
     }
 
     /**
@@ -315,7 +410,8 @@ public:
     template<typename U>
         requires std::assignable_from<T&, U&&>
     Task<int> push_back(U &&u) {
-        return push_impl(pos_back, true, NanoSec(0), std::forward<U>(u));
+        return push_impl(pos_back, detail::TimedWaitHelper{},
+                         std::forward<U>(u));
     }
 
     /**
@@ -327,7 +423,18 @@ public:
     template<typename U>
         requires std::assignable_from<T&, U&&>
     Task<int> try_push_front_for(NanoSec nsec, U &&u) {
-        return push_impl(pos_front, false, nsec, std::forward<U>(u));
+        return push_impl(pos_front, detail::TimedWaitHelper{nsec},
+                         std::forward<U>(u));
+    }
+
+    /**
+     * @brief Same as try_push_front_for, but wait until `deadline`.
+    */
+    template<typename U>
+        requires std::assignable_from<T&, U&&>
+    Task<int> try_push_front_until(SteadyTimePoint deadline, U &&u) {
+        return push_impl(pos_front, detail::TimedWaitHelper{deadline},
+                         std::forward<U>(u));
     }
 
     /**
@@ -339,7 +446,18 @@ public:
     template<typename U>
         requires std::assignable_from<T&, U&&>
     Task<int> try_push_back_for(NanoSec nsec, U &&u) {
-        return push_impl(pos_back, false, nsec, std::forward<U>(u));
+        return push_impl(pos_back, detail::TimedWaitHelper{nsec},
+                         std::forward<U>(u));
+    }
+
+    /**
+     * @brief Same as try_push_back_for, but wait until `deadline`.
+    */
+    template<typename U>
+        requires std::assignable_from<T&, U&&>
+    Task<int> try_push_back_until(SteadyTimePoint deadline, U &&u) {
+        return push_impl(pos_back, detail::TimedWaitHelper{deadline},
+                         std::forward<U>(u));
     }
 
     // pop
@@ -376,7 +494,7 @@ public:
     template<typename U>
         requires std::assignable_from<U&, T&&>
     Task<int> pop_front(U &u) {
-        return pop_impl(pos_front, true, NanoSec(0), u);
+        return pop_impl(pos_front, detail::TimedWaitHelper{}, u);
     }
 
     /**
@@ -386,7 +504,7 @@ public:
     template<typename U>
         requires std::assignable_from<U&, T&&>
     Task<int> pop_back(U &u) {
-        return pop_impl(pos_back, true, NanoSec(0), u);
+        return pop_impl(pos_back, detail::TimedWaitHelper{}, u);
     }
 
     /**
@@ -406,7 +524,16 @@ public:
     template<typename U>
         requires std::assignable_from<U&, T&&>
     Task<int> try_pop_front_for(NanoSec nsec, U &u) {
-        return pop_impl(pos_front, false, nsec, u);
+        return pop_impl(pos_front, detail::TimedWaitHelper{nsec}, u);
+    }
+
+    /**
+     * @brief Same as try_pop_front_for, but wait until `deadline`.
+    */
+    template<typename U>
+        requires std::assignable_from<U&, T&&>
+    Task<int> try_pop_front_until(SteadyTimePoint deadline, U &u) {
+        return pop_impl(pos_front, detail::TimedWaitHelper{deadline}, u);
     }
 
     /**
@@ -416,7 +543,16 @@ public:
     template<typename U>
         requires std::assignable_from<U&, T&&>
     Task<int> try_pop_back_for(NanoSec nsec, U &u) {
-        return pop_impl(pos_back, false, nsec, u);
+        return pop_impl(pos_back, detail::TimedWaitHelper{nsec}, u);
+    }
+
+    /**
+     * @brief Same as try_pop_back_for, but wait until `deadline`.
+    */
+    template<typename U>
+        requires std::assignable_from<U&, T&&>
+    Task<int> try_pop_back_until(SteadyTimePoint deadline, U &u) {
+        return pop_impl(pos_back, detail::TimedWaitHelper{deadline}, u);
     }
 
     // range
@@ -573,7 +709,15 @@ private:
 
     void after_push(UniqueLock &lk, SizeType push_cnt) {
         SizeType wake_cnt = min(push_cnt, pop_wait_cnt);
-        que_cur_size.fetch_add(push_cnt, acq_rel);
+        SizeType cur = que_cur_size.fetch_add(push_cnt, acq_rel) + push_cnt;
+
+        push_count += push_cnt;
+        if (cur > high_water)
+            high_water = cur;
+
+        // Wake with the lock held, so that the nodes cannot be removed
+        if (!select_list.empty())
+            select_list.wake_all();
 
         lk.unlock();
 
@@ -584,6 +728,7 @@ private:
     void after_pop(UniqueLock &lk, SizeType pop_cnt) {
         SizeType wake_cnt = min(pop_cnt, push_wait_cnt);
         que_cur_size.fetch_sub(pop_cnt, acq_rel);
+        pop_count += pop_cnt;
 
         lk.unlock();
 
@@ -625,7 +770,8 @@ private:
     }
 
     template<typename... Args>
-    Task<int> emplace_impl(bool pos, bool inf, NanoSec nsec, Args&&... args) {
+    Task<int> emplace_impl(bool pos, detail::TimedWaitHelper helper,
+                           Args&&... args) {
         if (coke::prevent_recursive_stack())
             co_await coke::yield();
 
@@ -635,17 +781,16 @@ private:
         if (closed())
             ret = TOP_CLOSED;
         else if (full()) {
-            CountGuard cg(push_wait_cnt);
+            CountGuard cg(push_wait_cnt, push_block);
 
-            if (inf) {
+            if (helper.infinite()) {
                 ret = co_await push_cv.wait(lk, [this]() {
                     return push_pred();
                 });
             }
             else {
-                ret = co_await push_cv.wait_for(lk, nsec, [this]() {
-                    return push_pred();
-                });
+                ret = co_await push_cv.wait_until(lk, helper.deadline(),
+                    [this]() { return push_pred(); });
             }
         }
 
@@ -698,7 +843,7 @@ private:
     }
 
     template<typename U>
-    Task<int> push_impl(bool pos, bool inf, NanoSec nsec, U &&u) {
+    Task<int> push_impl(bool pos, detail::TimedWaitHelper helper, U &&u) {
         if (coke::prevent_recursive_stack())
             co_await coke::yield();
 
@@ -708,17 +853,16 @@ private:
         if (closed())
             ret = TOP_CLOSED;
         else if (full()) {
-            CountGuard cg(push_wait_cnt);
+            CountGuard cg(push_wait_cnt, push_block);
 
-            if (inf) {
+            if (helper.infinite()) {
                 ret = co_await push_cv.wait(lk, [this]() {
                     return push_pred();
                 });
             }
             else {
-                ret = co_await push_cv.wait_for(lk, nsec, [this]() {
-                    return push_pred();
-                });
+                ret = co_await push_cv.wait_until(lk, helper.deadline(),
+                    [this]() { return push_pred(); });
             }
         }
 
@@ -760,7 +904,7 @@ private:
     }
 
     template<typename U>
-    Task<int> pop_impl(bool pos, bool inf, NanoSec nsec, U &u) {
+    Task<int> pop_impl(bool pos, detail::TimedWaitHelper helper, U &u) {
         if (coke::prevent_recursive_stack())
             co_await coke::yield();
 
@@ -772,17 +916,16 @@ private:
         else if (closed())
             ret = TOP_CLOSED;
         else {
-            CountGuard cg(pop_wait_cnt);
+            CountGuard cg(pop_wait_cnt, pop_block);
 
-            if (inf) {
+            if (helper.infinite()) {
                 ret = co_await pop_cv.wait(lk, [this]() {
                     return pop_pred();
                 });
             }
             else {
-                ret = co_await pop_cv.wait_for(lk, nsec, [this]() {
-                    return pop_pred();
-                });
+                ret = co_await pop_cv.wait_until(lk, helper.deadline(),
+                    [this]() { return pop_pred(); });
             }
         }
 
@@ -816,6 +959,14 @@ private:
 
     SizeType push_wait_cnt;
     SizeType pop_wait_cnt;
+    detail::SelectList select_list;
+
+    // Statistics, see get_stats
+    SizeType high_water;
+    uint64_t push_count;
+    uint64_t pop_count;
+    detail::BlockStat push_block;
+    detail::BlockStat pop_block;
     QueueType que;
 };
 
@@ -23,6 +23,7 @@
 #include <utility>
 
 #include "coke/detail/basic_concept.h"
+#include "coke/trace.h"
 #include "workflow/SubTask.h"
 
 namespace coke {
@@ -71,9 +72,17 @@ public:
     /**
      * @brief Return whether this awaiter is already ready.
      *
-     * If the awaiter not maintains a task, it will not be suspend.
+     * If the awaiter not maintains a task, it will not be suspend. To avoid
+     * unbounded recursion when many ready awaiters are co awaited in a row,
+     * `prevent_recursive_stack` is checked here, and once in a while a yield
+     * task is attached so that the coroutine switches thread.
     */
-    bool await_ready() { return subtask == nullptr; }
+    bool await_ready() {
+        if (subtask)
+            return false;
+
+        return !attach_yield_if_needed();
+    }
 
     /**
      * @brief Suspend current coroutine h and start the task(maintained by this
@@ -84,6 +93,7 @@ public:
     template<typename PromiseType>
     void await_suspend(std::coroutine_handle<PromiseType> h) {
         this->hdl = h;
+        COKE_TRACE_SUSPEND(this);
 
         if constexpr (IsCokePromise<PromiseType>) {
             // The Awaiter is awaited in CoPromise
@@ -115,11 +125,18 @@ public:
      * @pre this->subtask is done.
     */
     virtual void done() {
+        COKE_TRACE_RESUME(this);
         subtask = nullptr;
         hdl.resume();
     }
 
 protected:
+    /**
+     * @brief Called by `await_ready` when there is no task, returns true and
+     *        attaches a yield task if the thread should be switched.
+    */
+    bool attach_yield_if_needed();
+
     /**
      * @brief The `suspend` will be called in `await_suspend`, child classes
      *        can override this function to do something else.
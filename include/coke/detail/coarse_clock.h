@@ -0,0 +1,65 @@
+/**
+ * Copyright 2024 Coke Project (https://github.com/kedixa/coke)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Authors: kedixa (https://github.com/kedixa)
+*/
+
+#ifndef COKE_DETAIL_COARSE_CLOCK_H
+#define COKE_DETAIL_COARSE_CLOCK_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+namespace coke::detail {
+
+/**
+ * Time since the epochs of steady_clock and system_clock in nanoseconds,
+ * updated by the coarse clock service, zero when it is not running.
+*/
+extern std::atomic<int64_t> coarse_steady_ns;
+extern std::atomic<int64_t> coarse_system_ns;
+
+/**
+ * Whether TimedWaitHelper reads the coarse steady clock, see
+ * GlobalSettings::timed_wait_coarse_clock.
+*/
+extern std::atomic<bool> coarse_timed_wait;
+
+inline std::chrono::steady_clock::time_point coarse_steady_now() noexcept {
+    using Clock = std::chrono::steady_clock;
+    int64_t ns = coarse_steady_ns.load(std::memory_order_relaxed);
+
+    if (ns == 0)
+        return Clock::now();
+
+    auto d = std::chrono::nanoseconds(ns);
+    return Clock::time_point(std::chrono::duration_cast<Clock::duration>(d));
+}
+
+inline std::chrono::system_clock::time_point coarse_system_now() noexcept {
+    using Clock = std::chrono::system_clock;
+    int64_t ns = coarse_system_ns.load(std::memory_order_relaxed);
+
+    if (ns == 0)
+        return Clock::now();
+
+    auto d = std::chrono::nanoseconds(ns);
+    return Clock::time_point(std::chrono::duration_cast<Clock::duration>(d));
+}
+
+} // namespace coke::detail
+
+#endif // COKE_DETAIL_COARSE_CLOCK_H
@@ -30,17 +30,49 @@ static constexpr std::size_t DESTRUCTIVE_ALIGN =
 static constexpr std::size_t DESTRUCTIVE_ALIGN = 64;
 #endif
 
+// Default number of shards of cancelable timer maps and the mutex table, used
+// when GlobalSettings does not specify one. Zero means decided by hardware
+// concurrency. The number is always rounded up to a power of 2.
 #ifdef COKE_CANCELABLE_MAP_SIZE
 static constexpr std::size_t CANCELABLE_MAP_SIZE = COKE_CANCELABLE_MAP_SIZE;
 #else
-static constexpr std::size_t CANCELABLE_MAP_SIZE = 16;
+static constexpr std::size_t CANCELABLE_MAP_SIZE = 0;
 #endif
 
-// Use prime numbers to avoid the effect of ptr is often aligned to a power of 2
 #ifdef COKE_MUTEX_TABLE_SIZE
 static constexpr std::size_t MUTEX_TABLE_SIZE = COKE_MUTEX_TABLE_SIZE;
 #else
-static constexpr std::size_t MUTEX_TABLE_SIZE = 61;
+static constexpr std::size_t MUTEX_TABLE_SIZE = 0;
+#endif
+
+// Coroutine frames larger than this are not cached by the frame pool
+#ifdef COKE_FRAME_POOL_MAX_SIZE
+static constexpr std::size_t FRAME_POOL_MAX_SIZE = COKE_FRAME_POOL_MAX_SIZE;
+#else
+static constexpr std::size_t FRAME_POOL_MAX_SIZE = 1024;
+#endif
+
+// Max number of cached frames of each size class in each thread
+#ifdef COKE_FRAME_POOL_CACHE_COUNT
+static constexpr std::size_t FRAME_POOL_CACHE_COUNT = COKE_FRAME_POOL_CACHE_COUNT;
+#else
+static constexpr std::size_t FRAME_POOL_CACHE_COUNT = 256;
+#endif
+
+// Max number of cached SeriesWork objects in each thread for the pooled
+// series creater
+#ifdef COKE_SERIES_POOL_CACHE_COUNT
+static constexpr std::size_t SERIES_POOL_CACHE_COUNT = COKE_SERIES_POOL_CACHE_COUNT;
+#else
+static constexpr std::size_t SERIES_POOL_CACHE_COUNT = 256;
+#endif
+
+// Number of events in the trace ring buffer of each thread, must be a power
+// of 2, only used when COKE_ENABLE_TRACE is defined
+#ifdef COKE_TRACE_BUFFER_SIZE
+static constexpr std::size_t TRACE_BUFFER_SIZE = COKE_TRACE_BUFFER_SIZE;
+#else
+static constexpr std::size_t TRACE_BUFFER_SIZE = 8192;
 #endif
 
 } // namespace coke::detail
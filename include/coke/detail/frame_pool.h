@@ -0,0 +1,65 @@
+/**
+ * Copyright 2024 Coke Project (https://github.com/kedixa/coke)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Authors: kedixa (https://github.com/kedixa)
+*/
+
+#ifndef COKE_DETAIL_FRAME_POOL_H
+#define COKE_DETAIL_FRAME_POOL_H
+
+#include <cstddef>
+
+namespace coke {
+
+/**
+ * @brief Statistics of the coroutine frame pool of the calling thread.
+ *
+ * `hits` is the number of frames taken from the thread local free lists,
+ * `misses` is the number of frames allocated by global operator new, because
+ * the free list is empty or the frame is larger than FRAME_POOL_MAX_SIZE.
+*/
+struct FramePoolStats {
+    std::size_t hits{0};
+    std::size_t misses{0};
+};
+
+/**
+ * @brief Get the frame pool statistics of the calling thread.
+ *
+ * If the frame pool is disabled by COKE_NO_FRAME_POOL, both counters are
+ * always zero.
+*/
+FramePoolStats get_frame_pool_stats() noexcept;
+
+namespace detail {
+
+/**
+ * @brief Allocate `size` bytes for a coroutine frame from the thread local
+ *        size-class free lists, fall back to global operator new.
+*/
+void *frame_pool_alloc(std::size_t size);
+
+/**
+ * @brief Return the frame allocated by frame_pool_alloc(size) to the free
+ *        lists of the calling thread, which may be different from the
+ *        thread that allocated it.
+*/
+void frame_pool_free(void *ptr, std::size_t size) noexcept;
+
+} // namespace detail
+
+} // namespace coke
+
+#endif // COKE_DETAIL_FRAME_POOL_H
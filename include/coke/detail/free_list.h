@@ -0,0 +1,119 @@
+/**
+ * Copyright 2024 Coke Project (https://github.com/kedixa/coke)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Authors: kedixa (https://github.com/kedixa)
+*/
+
+#ifndef COKE_DETAIL_FREE_LIST_H
+#define COKE_DETAIL_FREE_LIST_H
+
+#include <cstddef>
+#include <new>
+
+namespace coke::detail {
+
+/**
+ * @brief A bounded intrusive list of free memory blocks, the blocks are
+ *        allocated by global operator new and released to it when the list
+ *        is full or destroyed. It is not thread safe, see ThreadLocalCache.
+*/
+class FreeList {
+public:
+    FreeList() noexcept = default;
+    FreeList(const FreeList &) = delete;
+    FreeList &operator= (const FreeList &) = delete;
+
+    ~FreeList() {
+        while (head) {
+            Node *node = head;
+            head = node->next;
+            ::operator delete((void *)node);
+        }
+
+        count = 0;
+    }
+
+    /**
+     * @brief Take a block, or nullptr if the list is empty.
+    */
+    void *pop() noexcept {
+        Node *node = head;
+
+        if (node) {
+            head = node->next;
+            --count;
+        }
+
+        return (void *)node;
+    }
+
+    /**
+     * @brief Keep the block `ptr` if there are less than `max` blocks,
+     *        return false if it is not kept.
+    */
+    bool push(void *ptr, std::size_t max) noexcept {
+        if (count >= max)
+            return false;
+
+        Node *node = (Node *)ptr;
+        node->next = head;
+        head = node;
+        ++count;
+        return true;
+    }
+
+private:
+    struct Node {
+        Node *next;
+    };
+
+    Node *head{nullptr};
+    std::size_t count{0};
+};
+
+/**
+ * @brief The thread local instance of `Cache`, which derives from this class.
+ *        After the instance is destroyed, for example blocks are released
+ *        during thread exit, `get` returns nullptr and the caller falls back
+ *        to global operator new and delete.
+*/
+template<typename Cache>
+class ThreadLocalCache {
+public:
+    static Cache *get() noexcept {
+        if (state == DEAD)
+            return nullptr;
+
+        static thread_local Cache cache;
+        return &cache;
+    }
+
+protected:
+    ThreadLocalCache() noexcept { state = ALIVE; }
+    ~ThreadLocalCache() { state = DEAD; }
+
+private:
+    enum State : unsigned char {
+        INIT = 0,
+        ALIVE,
+        DEAD,
+    };
+
+    static inline thread_local State state = INIT;
+};
+
+} // namespace coke::detail
+
+#endif // COKE_DETAIL_FREE_LIST_H
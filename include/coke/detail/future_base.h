@@ -20,6 +20,8 @@
 #define COKE_DETAIL_FUTURE_BASE_H
 
 #include <atomic>
+#include <cstddef>
+#include <new>
 #include <optional>
 #include <memory>
 #include <mutex>
@@ -48,6 +50,70 @@ class Promise;
 
 namespace detail {
 
+struct FutureStateBase;
+
+/**
+ * @brief FutureContinuation holds the callable registered by Future::then or
+ *        Future::map. A callable not larger than INLINE_SIZE is constructed
+ *        in place, so registering the usual lambdas does not allocate. It is
+ *        invoked at most once, with the state it is stored in.
+*/
+class FutureContinuation {
+    static constexpr std::size_t INLINE_SIZE = 48;
+
+    using InvokeFunc = void (*)(void *, FutureStateBase *);
+    using DestroyFunc = void (*)(void *, bool);
+
+public:
+    FutureContinuation() noexcept = default;
+    ~FutureContinuation() { reset(); }
+
+    FutureContinuation(const FutureContinuation &) = delete;
+    FutureContinuation &operator= (const FutureContinuation &) = delete;
+
+    template<typename F>
+    void emplace(F &&f) {
+        using Func = std::decay_t<F>;
+        constexpr bool is_inline = sizeof(Func) <= INLINE_SIZE &&
+            alignof(Func) <= alignof(std::max_align_t);
+
+        reset();
+
+        if constexpr (is_inline)
+            ptr = new (buf) Func(std::forward<F>(f));
+        else
+            ptr = new Func(std::forward<F>(f));
+
+        invoke = [](void *p, FutureStateBase *state) {
+            (*static_cast<Func *>(p))(state);
+        };
+
+        destroy = [](void *p, bool in_place) {
+            if (in_place)
+                static_cast<Func *>(p)->~Func();
+            else
+                delete static_cast<Func *>(p);
+        };
+    }
+
+    explicit operator bool() const noexcept { return ptr != nullptr; }
+
+    void operator()(FutureStateBase *state) { invoke(ptr, state); }
+
+    void reset() noexcept {
+        if (ptr) {
+            destroy(ptr, ptr == (void *)buf);
+            ptr = nullptr;
+        }
+    }
+
+private:
+    void *ptr{nullptr};
+    InvokeFunc invoke{nullptr};
+    DestroyFunc destroy{nullptr};
+    alignas(std::max_align_t) unsigned char buf[INLINE_SIZE];
+};
+
 struct FutureStateBase {
     constexpr static auto acquire = std::memory_order_acquire;
     constexpr static auto release = std::memory_order_release;
@@ -74,7 +140,7 @@ public:
 
     std::exception_ptr get_exception() { return eptr; }
 
-    void raise_exception() {
+    void raise_exception() const {
         if (eptr)
             std::rethrow_exception(eptr);
     }
@@ -87,6 +153,23 @@ public:
         return wait_impl(TimedWaitHelper{nsec});
     }
 
+    Task<int> wait_until(SteadyTimePoint deadline) {
+        return wait_impl(TimedWaitHelper{deadline});
+    }
+
+    /**
+     * @brief Create an awaiter which is woken up when the state is set, it is
+     *        ready immediately if the state is already set.
+    */
+    SleepAwaiter create_waiter(TimedWaitHelper helper) {
+        std::lock_guard<std::mutex> lg(mtx);
+
+        if (get_state() != FUTURE_STATE_NOTSET)
+            return SleepAwaiter();
+
+        return sleep(get_addr(), helper);
+    }
+
     void set_callback(std::function<void(int)> &&cb) {
         std::lock_guard<std::mutex> lg(mtx);
 
@@ -102,6 +185,25 @@ public:
         callback = nullptr;
     }
 
+    /**
+     * @brief Set the continuation, which is invoked once without the lock
+     *        after the state is set, or immediately if it is already set.
+     *        Different from the callback, it can not be removed.
+    */
+    template<typename F>
+    void set_continuation(F &&func) {
+        {
+            std::lock_guard<std::mutex> lg(mtx);
+
+            if (get_state() == FUTURE_STATE_NOTSET) {
+                continuation.emplace(std::forward<F>(func));
+                return;
+            }
+        }
+
+        func(this);
+    }
+
     void set_canceled() {
         canceled.store(true, release);
     }
@@ -125,15 +227,27 @@ protected:
     }
 
     void wakeup() {
-        std::lock_guard<std::mutex> lg(mtx);
+        bool has_continuation;
+
+        {
+            std::lock_guard<std::mutex> lg(mtx);
 
-        if (callback) {
-            int st = get_state();
-            callback(st);
-            callback = nullptr;
+            if (callback) {
+                int st = get_state();
+                callback(st);
+                callback = nullptr;
+            }
+
+            cancel_sleep_by_addr(get_addr());
+            has_continuation = (bool)continuation;
         }
 
-        cancel_sleep_by_addr(get_addr());
+        // The state is already set, no one touches the continuation except
+        // here, and the promise keeps this state alive until it returns.
+        if (has_continuation) {
+            continuation(this);
+            continuation.reset();
+        }
     }
 
     Task<int> wait_impl(TimedWaitHelper helper) {
@@ -177,6 +291,7 @@ protected:
 
     std::mutex mtx;
     std::function<void(int)> callback;
+    FutureContinuation continuation;
     std::exception_ptr eptr;
 };
 
@@ -202,6 +317,11 @@ public:
         return opt.value();
     }
 
+    const T &get() const {
+        raise_exception();
+        return opt.value();
+    }
+
 private:
     std::optional<T> opt;
 };
@@ -215,7 +335,7 @@ public:
         }, FUTURE_STATE_READY);
     }
 
-    void get() { raise_exception(); }
+    void get() const { raise_exception(); }
 };
 
 
@@ -256,6 +376,10 @@ public:
         return lt.wait_for(nsec);
     }
 
+    auto wait_until(SteadyTimePoint deadline) {
+        return lt.wait_until(deadline);
+    }
+
 private:
     Latch lt;
     std::atomic<std::size_t> x;
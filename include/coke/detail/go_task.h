@@ -19,17 +19,50 @@
 #ifndef COKE_DETAIL_GO_TASK_H
 #define COKE_DETAIL_GO_TASK_H
 
-#include <functional>
+#include <cstdint>
 #include <optional>
 #include <string>
+#include <type_traits>
+#include <utility>
 
 #include "workflow/ExecRequest.h"
 #include "coke/detail/awaiter_base.h"
+#include "coke/global.h"
+#include "coke/stop_token.h"
 
 namespace coke::detail {
 
 ExecQueue *get_exec_queue(const std::string &name);
 Executor *get_compute_executor();
+std::size_t get_compute_threads() noexcept;
+ExecQueue *get_yield_exec_queue();
+
+/**
+ * @brief Return the queue of the last go task finished in the calling thread,
+ *        or nullptr if the calling thread never runs a go task. It is only a
+ *        hint for avoiding unnecessary thread switches.
+*/
+ExecQueue *current_go_queue() noexcept;
+
+class GoTaskBase;
+
+/**
+ * @brief The limit and statistics of an ExecQueue, only exists for the queues
+ *        configured by coke::set_go_queue_params, see src/go.cpp.
+*/
+class GoQueueState;
+
+GoQueueState *find_go_queue_state(ExecQueue *queue) noexcept;
+
+/**
+ * @brief Return true if `task` can be dispatched now, otherwise it is parked
+ *        and will be dispatched when a running task of the queue finishes.
+*/
+bool go_queue_acquire(GoQueueState *qstate, GoTaskBase *task);
+
+void go_queue_started(GoQueueState *qstate, GoTaskBase *task) noexcept;
+
+void go_queue_release(GoQueueState *qstate);
 
 class GoTaskBase : public ExecRequest {
 public:
@@ -39,6 +72,12 @@ public:
         this->state = -1; // WFT_STATE_UNDEFINED
         this->error = 0;
         this->awaiter = nullptr;
+        this->qstate = find_go_queue_state(queue);
+        this->submit_nano = 0;
+        this->next_parked = nullptr;
+        this->drop_enabled = false;
+        this->drop_state = TOP_SUCCESS;
+        this->drop_token = nullptr;
     }
 
     virtual ~GoTaskBase() = default;
@@ -49,58 +88,130 @@ public:
     AwaiterBase *get_awaiter() const noexcept { return awaiter; }
     void set_awaiter(AwaiterBase *awaiter) noexcept { this->awaiter = awaiter; }
 
+    virtual void dispatch() override {
+        if (qstate && !go_queue_acquire(qstate, this))
+            return;
+
+        ExecRequest::dispatch();
+    }
+
+    // Dispatch a parked task, inner use only
+    void dispatch_parked() { ExecRequest::dispatch(); }
+
+    /**
+     * @brief Drop the task instead of running it, if it is still in the queue
+     *        after `deadline`, or `token` is requested to stop before it runs.
+    */
+    void set_drop_policy(TimedWaitHelper::TimePoint deadline,
+                         StopToken *token) noexcept {
+        this->drop_deadline = deadline;
+        this->drop_token = token;
+        this->drop_enabled = true;
+    }
+
+    /**
+     * @brief Returns coke::TOP_SUCCESS if the function is called, or
+     *        coke::TOP_TIMEOUT, coke::TOP_STOPPED if it is dropped.
+    */
+    int get_drop_state() const noexcept { return drop_state; }
+
+protected:
+    /**
+     * @brief Called in the compute thread before running the function,
+     *        returns true if the function should be skipped.
+    */
+    bool before_execute() noexcept {
+        if (qstate)
+            go_queue_started(qstate, this);
+
+        if (!drop_enabled)
+            return false;
+
+        if (drop_token && drop_token->stop_requested())
+            drop_state = TOP_STOPPED;
+        else if (drop_deadline != TimedWaitHelper::max() &&
+                 TimedWaitHelper::now() >= drop_deadline)
+            drop_state = TOP_TIMEOUT;
+
+        return drop_state != TOP_SUCCESS;
+    }
+
 private:
     virtual SubTask *done() override;
 
 protected:
     AwaiterBase *awaiter;
+
+    GoQueueState *qstate;
+
+    bool drop_enabled;
+    int drop_state;
+    StopToken *drop_token;
+    TimedWaitHelper::TimePoint drop_deadline;
+
+public:
+    // Inner use only, the data used by GoQueueState
+    int64_t submit_nano;
+    GoTaskBase *next_parked;
 };
 
+/**
+ * @brief GoTaskResult keeps the result of the function inline, so GoAwaiter<T>
+ *        can get it without knowing the type of the function.
+*/
 template<typename T>
-class GoTask : public GoTaskBase {
+class GoTaskResult : public GoTaskBase {
 public:
-    GoTask(ExecQueue *queue, Executor *executor,
-           std::function<T()> &&func)
-        : GoTaskBase(queue, executor), func(std::move(func))
+    GoTaskResult(ExecQueue *queue, Executor *executor)
+        : GoTaskBase(queue, executor)
     { }
 
-    void set_function(std::function<T()> func) {
-        this->func = std::move(func);
-    }
-
     T &get_result() { return result.value(); }
 
-private:
-    virtual void execute() override {
-        if (func)
-            result.emplace(func());
-    }
-
-private:
-    std::function<T()> func;
+protected:
     std::optional<T> result;
 };
 
 template<>
-class GoTask<void> : public GoTaskBase {
+class GoTaskResult<void> : public GoTaskBase {
 public:
-    GoTask(ExecQueue *queue, Executor *executor,
-           std::function<void()> &&func)
-        : GoTaskBase(queue, executor), func(std::move(func))
+    GoTaskResult(ExecQueue *queue, Executor *executor)
+        : GoTaskBase(queue, executor)
     { }
+};
 
-    void set_function(std::function<void()> func) {
-        this->func = std::move(func);
-    }
+/**
+ * @brief Function used by switch_go_thread, which does nothing.
+*/
+struct GoNoop {
+    void operator()() const noexcept { }
+};
+
+/**
+ * @brief GoTask stores the function object `FUNC` inline, so that the task,
+ *        the function and the result are in one allocation.
+*/
+template<typename T, typename FUNC>
+class GoTask : public GoTaskResult<T> {
+public:
+    template<typename F>
+    GoTask(ExecQueue *queue, Executor *executor, F &&f)
+        : GoTaskResult<T>(queue, executor), func(std::forward<F>(f))
+    { }
 
 private:
     virtual void execute() override {
-        if (func)
+        if (this->before_execute())
+            return;
+
+        if constexpr (std::is_void_v<T>)
             func();
+        else
+            this->result.emplace(func());
     }
 
 private:
-    std::function<void()> func;
+    FUNC func;
 };
 
 } // namespace coke::detail
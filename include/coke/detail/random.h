@@ -20,22 +20,106 @@
 #define COKE_DETAIL_RANDOM_H
 
 #include <cstdint>
-#include <random>
 
 namespace coke {
 
 namespace detail {
 
+/**
+ * @brief Get a seed for random generators, different calls get different
+ *        seeds even in the same nanosecond. It is lock free.
+*/
 uint64_t rand_seed();
 
+inline uint64_t splitmix64(uint64_t &x) noexcept {
+    uint64_t z = (x += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+/**
+ * @brief xoshiro256** generator, which has 32 bytes of state and is much
+ *        faster than std::mt19937_64. It is not thread safe.
+*/
+class Xoshiro256 {
+public:
+    using result_type = uint64_t;
+
+    explicit Xoshiro256(uint64_t seed) noexcept {
+        for (uint64_t &x : s)
+            x = splitmix64(seed);
+    }
+
+    static constexpr result_type min() noexcept { return 0; }
+    static constexpr result_type max() noexcept { return UINT64_MAX; }
+
+    result_type operator()() noexcept {
+        uint64_t result = rotl(s[1] * 5, 7) * 9;
+        uint64_t t = s[1] << 17;
+
+        s[2] ^= s[0];
+        s[3] ^= s[1];
+        s[1] ^= s[2];
+        s[0] ^= s[3];
+        s[2] ^= t;
+        s[3] = rotl(s[3], 45);
+
+        return result;
+    }
+
+private:
+    static uint64_t rotl(uint64_t x, int k) noexcept {
+        return (x << k) | (x >> (64 - k));
+    }
+
+private:
+    uint64_t s[4];
+};
+
+/**
+ * @brief Random integer in [0, n) from the 64 bit generator `gen`, by the
+ *        multiply and shift of Lemire, it is unbiased and avoids the
+ *        division in most cases. Return 0 if n is 0.
+*/
+template<typename Gen>
+uint64_t rand_range(Gen &gen, uint64_t n) {
+    unsigned __int128 m = (unsigned __int128)gen() * n;
+    uint64_t low = (uint64_t)m;
+
+    if (low < n) {
+        uint64_t threshold = (0 - n) % n;
+
+        while (low < threshold) {
+            m = (unsigned __int128)gen() * n;
+            low = (uint64_t)m;
+        }
+    }
+
+    return (uint64_t)(m >> 64);
+}
+
+inline Xoshiro256 &local_generator() {
+    thread_local Xoshiro256 gen(rand_seed());
+    return gen;
+}
+
 } // namespace detail
 
 /**
- * @brief Thread safe 64 bit random integer generator.
+ * @brief Thread safe 64 bit random integer generator, each thread has its
+ *        own generator so it takes no lock.
  */
 inline uint64_t rand_u64() {
-    thread_local std::mt19937_64 mt64(detail::rand_seed());
-    return mt64();
+    return detail::local_generator()();
+}
+
+/**
+ * @brief Thread safe random integer in [0, n), return 0 if n is 0. It is
+ *        unbiased and avoids the division of `rand_u64() % n` in most cases.
+*/
+inline uint64_t rand_range(uint64_t n) {
+    return detail::rand_range(detail::local_generator(), n);
 }
 
 } // namespace coke
@@ -0,0 +1,86 @@
+/**
+ * Copyright 2024 Coke Project (https://github.com/kedixa/coke)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Authors: kedixa (https://github.com/kedixa)
+*/
+
+#ifndef COKE_DETAIL_SELECT_BASE_H
+#define COKE_DETAIL_SELECT_BASE_H
+
+#include "coke/sleep.h"
+
+namespace coke::detail {
+
+/**
+ * @brief A node that links a coroutine waiting in coke::select to a queue,
+ *        the coroutine sleeps on the address `waiter`.
+*/
+struct SelectNode {
+    SelectNode *prev{nullptr};
+    SelectNode *next{nullptr};
+    const void *waiter{nullptr};
+};
+
+/**
+ * @brief The list of SelectNode of a queue, all the operations should be
+ *        called with the queue's lock held.
+*/
+class SelectList {
+public:
+    SelectList() = default;
+
+    SelectList(const SelectList &) = delete;
+    SelectList &operator= (const SelectList &) = delete;
+
+    bool empty() const noexcept { return head == nullptr; }
+
+    void add(SelectNode *node) noexcept {
+        node->prev = nullptr;
+        node->next = head;
+
+        if (head)
+            head->prev = node;
+        head = node;
+    }
+
+    void remove(SelectNode *node) noexcept {
+        if (node->prev)
+            node->prev->next = node->next;
+        else
+            head = node->next;
+
+        if (node->next)
+            node->next->prev = node->prev;
+
+        node->prev = node->next = nullptr;
+    }
+
+    /**
+     * @brief Wake up all the selecting coroutines. They race for the elements
+     *        and the losers go back to sleep, waking only some of them may
+     *        lose a wakeup when the chosen one is satisfied by another queue.
+    */
+    void wake_all() const {
+        for (SelectNode *node = head; node; node = node->next)
+            cancel_sleep_by_addr(node->waiter);
+    }
+
+private:
+    SelectNode *head{nullptr};
+};
+
+} // namespace coke::detail
+
+#endif // COKE_DETAIL_SELECT_BASE_H
@@ -20,16 +20,36 @@
 #define COKE_DETAIL_SERIES_TASK_H
 
 #include "coke/detail/awaiter_base.h"
+#include "coke/detail/frame_pool.h"
 #include "coke/task.h"
 #include "workflow/Workflow.h"
 
 namespace coke::detail {
 
+/**
+ * @brief The first task of the series created by coke::detach_on_new_series,
+ *        it starts the coroutine on the series and deletes itself.
+*/
 template<Cokeable T>
 class DetachTask final : public SubTask {
 public:
     DetachTask(Task<T> &&task) : task(std::move(task)) { }
 
+#ifndef COKE_NO_FRAME_POOL
+    /**
+     * DetachTask is created for each coroutine detached on new series, take
+     * it from the thread local free lists of the coroutine frames, so that
+     * detaching does not call global operator new in the steady state.
+    */
+    static void *operator new(std::size_t size) {
+        return frame_pool_alloc(size);
+    }
+
+    static void operator delete(void *ptr, std::size_t size) noexcept {
+        frame_pool_free(ptr, size);
+    }
+#endif
+
 protected:
     virtual void dispatch() override {
         this->subtask_done();
@@ -0,0 +1,76 @@
+/**
+ * Copyright 2024 Coke Project (https://github.com/kedixa/coke)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Authors: kedixa (https://github.com/kedixa)
+*/
+
+#ifndef COKE_DETAIL_SHARD_CONFIG_H
+#define COKE_DETAIL_SHARD_CONFIG_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace coke::detail {
+
+/**
+ * @brief Set the number of shards requested by GlobalSettings, zero means
+ *        decided by hardware concurrency. It only takes effect if called
+ *        before the first use of the sharded tables.
+*/
+void set_shard_config(std::size_t timer_map_shards,
+                      std::size_t mutex_table_shards) noexcept;
+
+/**
+ * @brief Get the number of shards of each cancelable timer map, it is a power
+ *        of 2 and fixed after the first call.
+*/
+std::size_t get_timer_map_shards() noexcept;
+
+/**
+ * @brief Get the number of shards of the mutex table, it is a power of 2 and
+ *        fixed after the first call.
+*/
+std::size_t get_mutex_table_shards() noexcept;
+
+/**
+ * @brief Get a small index of the current thread, the threads are numbered
+ *        from zero in the order they first call it. Used to choose the local
+ *        shard of a container.
+*/
+inline std::size_t get_thread_index() noexcept {
+    static std::atomic<std::size_t> next_index{0};
+    thread_local std::size_t index =
+        next_index.fetch_add(1, std::memory_order_relaxed);
+
+    return index;
+}
+
+/**
+ * @brief The finalizer of MurmurHash3, spreads the entropy of uid and address
+ *        to all bits, so that both low bits and high bits can be used as index.
+*/
+inline uint64_t mix_hash(uint64_t x) noexcept {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb3f99ae22e53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+} // namespace coke::detail
+
+#endif // COKE_DETAIL_SHARD_CONFIG_H
@@ -22,16 +22,36 @@
 #include <chrono>
 
 #include "coke/detail/awaiter_base.h"
+#include "coke/detail/coarse_clock.h"
 
 namespace coke::detail {
 
 using NanoSec = std::chrono::nanoseconds;
 
+/**
+ * @brief Get the global timer slack, see GlobalSettings::timer_slack.
+*/
+NanoSec get_timer_slack() noexcept;
+
+void set_timer_slack(NanoSec slack) noexcept;
+
+/**
+ * @brief Whether the current thread is known to be a handler thread, which
+ *        is marked when a yield is resumed on it.
+*/
+bool in_handler_thread() noexcept;
+
 class SleepBase : public AwaiterBase {
 public:
     SleepBase(SleepBase &&that) noexcept;
     SleepBase &operator= (SleepBase &&that) noexcept;
-    ~SleepBase() = default;
+
+    /**
+     * @brief If the timer is not dispatched, it is released by the timer
+     *        itself instead of being deleted by AwaiterBase, because it may
+     *        be in use by a canceler at the same time.
+    */
+    ~SleepBase();
 
     int await_resume() noexcept;
 
@@ -50,20 +70,67 @@ public:
     using TimePoint = ClockType::time_point;
 
     constexpr static TimePoint max() noexcept { return TimePoint::max(); }
-    static TimePoint now() noexcept { return ClockType::now(); }
+    static TimePoint now() noexcept {
+        if (coarse_timed_wait.load(std::memory_order_relaxed))
+            return coarse_steady_now();
+
+        return ClockType::now();
+    }
 
     TimedWaitHelper() noexcept : abs_time(max()) { }
 
     TimedWaitHelper(NanoSec nano) noexcept
-        : abs_time(now() + nano)
+        : abs_time(round_up(now() + nano, get_timer_slack()))
+    { }
+
+    TimedWaitHelper(NanoSec nano, NanoSec slack) noexcept
+        : abs_time(round_up(now() + nano, slack))
     { }
 
+    /**
+     * @brief Wait until the absolute time point `deadline`, so that one
+     *        deadline can be passed through many waits without drifting.
+    */
+    explicit TimedWaitHelper(TimePoint deadline) noexcept
+        : abs_time(round_up(deadline, get_timer_slack()))
+    { }
+
+    /**
+     * @brief Round time point `t` up to a multiple of `slack`, so that timers
+     *        with close deadlines expire at the same time and share wakeups
+     *        of the poller. The result is never earlier than `t`.
+    */
+    static TimePoint round_up(TimePoint t, NanoSec slack) noexcept {
+        if (slack.count() <= 0 || t == max())
+            return t;
+
+        auto cnt = t.time_since_epoch().count();
+        auto rem = cnt % slack.count();
+        if (rem == 0 || cnt > max().time_since_epoch().count() - slack.count())
+            return t;
+
+        return t + NanoSec(slack.count() - rem);
+    }
+
+    /**
+     * @brief Apply `slack` to a relative duration `nano`.
+    */
+    static NanoSec round_up(NanoSec nano, NanoSec slack) noexcept {
+        if (slack.count() <= 0 || nano.count() <= 0)
+            return nano;
+
+        TimePoint cur = now();
+        return round_up(cur + nano, slack) - cur;
+    }
+
     bool infinite() const noexcept { return abs_time == max(); }
 
     NanoSec time_left() const noexcept { return abs_time - now(); }
 
     bool timeout() const noexcept { return abs_time <= now(); }
 
+    TimePoint deadline() const noexcept { return abs_time; }
+
 private:
     TimePoint abs_time;
 };
@@ -0,0 +1,72 @@
+/**
+ * Copyright 2024 Coke Project (https://github.com/kedixa/coke)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Authors: kedixa (https://github.com/kedixa)
+*/
+
+#ifndef COKE_DETAIL_SPIN_WAIT_H
+#define COKE_DETAIL_SPIN_WAIT_H
+
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+
+namespace coke::detail {
+
+/**
+ * @brief Get the number of rounds to spin before parking on a contended lock,
+ *        zero means park immediately, see GlobalSettings::lock_spin_count.
+*/
+std::size_t get_lock_spin_count() noexcept;
+
+/**
+ * @brief Tell the cpu that the current thread is in a spin loop.
+*/
+inline void cpu_relax() noexcept {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+    asm volatile("yield" ::: "memory");
+#else
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+#endif
+}
+
+/**
+ * @brief Spin at most get_lock_spin_count() rounds, each round pauses and
+ *        then calls `try_func` with `mtx` held if it is not busy, until
+ *        `try_func` returns true. The `mtx` is never blocked on, so that the
+ *        one who is going to release the resource is not delayed.
+ *
+ * @return Whether `try_func` returns true.
+*/
+template<typename F>
+bool spin_try_lock(std::mutex &mtx, F &&try_func) {
+    std::size_t n = get_lock_spin_count();
+
+    for (std::size_t i = 0; i < n; i++) {
+        cpu_relax();
+
+        std::unique_lock<std::mutex> lk(mtx, std::try_to_lock);
+        if (lk.owns_lock() && try_func())
+            return true;
+    }
+
+    return false;
+}
+
+} // namespace coke::detail
+
+#endif // COKE_DETAIL_SPIN_WAIT_H
@@ -26,6 +26,7 @@
 #include <utility>
 
 #include "coke/detail/basic_concept.h"
+#include "coke/detail/frame_pool.h"
 
 // Not used, but make sure exception_config.h is included by coke/task.h
 #include "coke/detail/exception_config.h"
@@ -45,13 +46,54 @@ public:
     PromiseBase(const PromiseBase &) = delete;
     PromiseBase(PromiseBase &&) = delete;
 
-    virtual ~PromiseBase() noexcept {
+    /**
+     * Promise is always destroyed through the concrete CoPromise<T> by the
+     * coroutine frame, so the destructor does not need to be virtual.
+    */
+    ~PromiseBase() noexcept {
+        delete context;
+
         // Do not allow unhandled exceptions to escape.
         if (eptr)
             std::rethrow_exception(eptr);
     }
 
-    void set_context(std::shared_ptr<void> ctx) noexcept { context = ctx; }
+#ifndef COKE_NO_FRAME_POOL
+    /**
+     * Coroutine frames of coke::Task are allocated from thread local free
+     * lists, define COKE_NO_FRAME_POOL to use global operator new/delete.
+    */
+    static void *operator new(std::size_t size) {
+        return frame_pool_alloc(size);
+    }
+
+    static void operator delete(void *ptr, std::size_t size) noexcept {
+        frame_pool_free(ptr, size);
+    }
+#endif
+
+    /**
+     * Context is rarely used, store it out of line to keep the frame small.
+    */
+    void set_context(std::shared_ptr<void> ctx) {
+        if (context)
+            *context = std::move(ctx);
+        else
+            context = new std::shared_ptr<void>(std::move(ctx));
+    }
+
+    /**
+     * Local context is a raw pointer inherited by the child coroutines when
+     * they are co awaited, see coke::current_local_context. It is not owned
+     * by the promise.
+    */
+    void set_local_context(void *ctx) noexcept { this->local = ctx; }
+    void *get_local_context() const noexcept { return this->local; }
+
+    void inherit_local_context(void *ctx) noexcept {
+        if (!this->local)
+            this->local = ctx;
+    }
 
     void_handle previous_handle() const noexcept { return prev; }
     void set_previous_handle(void_handle prev) noexcept { this->prev = prev; }
@@ -86,9 +128,10 @@ protected:
     std::exception_ptr eptr{nullptr};
 
 private:
-    std::shared_ptr<void> context;
+    std::shared_ptr<void> *context{nullptr};
     void_handle prev;
     void *series{nullptr};
+    void *local{nullptr};
     bool detached{false};
 };
 
@@ -121,6 +164,10 @@ private:
 };
 
 
+template<Cokeable T>
+struct [[nodiscard]] TaskSlotAwaiter;
+
+
 template<Cokeable T>
 struct [[nodiscard]] TaskAwaiter {
     using promise_type = CoPromise<T>;
@@ -143,9 +190,12 @@ struct [[nodiscard]] TaskAwaiter {
         CoPromise<T> &p = hdl.promise();
         p.set_previous_handle(h);
 
-        // If this is awaited in coke::Task, share the same series
-        if constexpr (IsCokePromise<PromiseType>)
+        // If this is awaited in coke::Task, share the same series and inherit
+        // the local context
+        if constexpr (IsCokePromise<PromiseType>) {
             p.set_series(h.promise().get_series());
+            p.inherit_local_context(h.promise().get_local_context());
+        }
 
         return hdl;
     }
@@ -155,6 +205,83 @@ private:
 };
 
 
+/**
+ * @brief Same as TaskAwaiter, but the result is assigned to the slot provided
+ *        by caller when co_return, and await_resume returns nothing. This
+ *        saves the moves through the optional in promise.
+*/
+template<Cokeable T>
+struct [[nodiscard]] TaskSlotAwaiter {
+    using promise_type = CoPromise<T>;
+    using handle_type = std::coroutine_handle<promise_type>;
+    constexpr static bool __is_coke_awaitable_type = true;
+
+    TaskSlotAwaiter(handle_type hdl, T *slot) noexcept : hdl(hdl) {
+        hdl.promise().set_result_slot(slot);
+    }
+
+    TaskSlotAwaiter(TaskSlotAwaiter &&that) noexcept
+        : hdl(std::exchange(that.hdl, nullptr))
+    { }
+
+    bool await_ready() const noexcept { return false; }
+
+    void await_resume() { hdl.promise().raise_exception(); }
+
+    template<typename PromiseType>
+    auto await_suspend(std::coroutine_handle<PromiseType> h) noexcept {
+        CoPromise<T> &p = hdl.promise();
+        p.set_previous_handle(h);
+
+        if constexpr (IsCokePromise<PromiseType>) {
+            p.set_series(h.promise().get_series());
+            p.inherit_local_context(h.promise().get_local_context());
+        }
+
+        return hdl;
+    }
+
+private:
+    handle_type hdl;
+};
+
+
+/**
+ * @brief Get, and optionally replace, the local context of the awaiting
+ *        coroutine without suspending it. Use coke::current_local_context
+ *        and coke::set_local_context instead.
+*/
+template<typename T>
+struct [[nodiscard]] LocalContextAwaiter {
+    constexpr static bool __is_coke_awaitable_type = true;
+
+    LocalContextAwaiter() noexcept : replace(false), ctx(nullptr) { }
+
+    explicit LocalContextAwaiter(void *ctx) noexcept
+        : replace(true), ctx(ctx)
+    { }
+
+    bool await_ready() const noexcept { return false; }
+
+    template<typename PromiseType>
+        requires IsCokePromise<PromiseType>
+    bool await_suspend(std::coroutine_handle<PromiseType> h) noexcept {
+        prev = h.promise().get_local_context();
+        if (replace)
+            h.promise().set_local_context(ctx);
+
+        return false;
+    }
+
+    T *await_resume() const noexcept { return static_cast<T *>(prev); }
+
+private:
+    bool replace;
+    void *ctx;
+    void *prev{nullptr};
+};
+
+
 // clang deduce failed if use Cokeable
 
 template<typename T=void>
@@ -182,6 +309,17 @@ public:
     */
     TaskAwaiter<T> operator co_await() noexcept { return TaskAwaiter<T>{hdl}; }
 
+    /**
+     * @brief Inner only, co_await coke::Task and assign the result to `*slot`
+     *        directly when the coroutine co_returns.
+     *        If this function is called, the returned awaiter must be awaited.
+    */
+    template<typename U = T>
+        requires (!std::is_void_v<U> && std::is_move_assignable_v<U>)
+    TaskSlotAwaiter<U> await_into(U *slot) noexcept {
+        return TaskSlotAwaiter<U>{hdl, slot};
+    }
+
     [[deprecated("Use coke::detach() instead")]]
     void start() { detach(); }
 
@@ -224,8 +362,25 @@ public:
      * 
      * There may be a better way, welcome to discuss.
     */
-    void set_context(std::shared_ptr<void> ctx) noexcept {
-        hdl.promise().set_context(ctx);
+    void set_context(std::shared_ptr<void> ctx) {
+        hdl.promise().set_context(std::move(ctx));
+    }
+
+    /**
+     * @brief Set the local context of this coke::Task before it is started,
+     *        it will not inherit the local context of the awaiting coroutine.
+     *        See coke::current_local_context.
+    */
+    void set_local_context(void *ctx) noexcept {
+        hdl.promise().set_local_context(ctx);
+    }
+
+    /**
+     * @brief Inner only, set the local context of this coke::Task before it
+     *        is started, if it has not been set.
+    */
+    void inherit_local_context(void *ctx) noexcept {
+        hdl.promise().inherit_local_context(ctx);
     }
 
 private:
@@ -253,14 +408,36 @@ public:
     }
 
     void return_value(const T &t)
-        noexcept(std::is_nothrow_copy_constructible_v<T>)
+        noexcept(std::is_nothrow_copy_constructible_v<T> &&
+                 std::is_nothrow_copy_assignable_v<T>)
     {
+        if constexpr (std::is_copy_assignable_v<T>) {
+            if (slot) {
+                *slot = t;
+                return;
+            }
+        }
+        else if constexpr (std::is_move_assignable_v<T>) {
+            if (slot) {
+                *slot = T(t);
+                return;
+            }
+        }
+
         result.emplace(t);
     }
 
     void return_value(T &&t)
-        noexcept(std::is_nothrow_move_constructible_v<T>)
+        noexcept(std::is_nothrow_move_constructible_v<T> &&
+                 std::is_nothrow_move_assignable_v<T>)
     {
+        if constexpr (std::is_move_assignable_v<T>) {
+            if (slot) {
+                *slot = std::move(t);
+                return;
+            }
+        }
+
         result.emplace(std::move(t));
     }
 
@@ -269,8 +446,14 @@ public:
         return result.value();
     }
 
+    /**
+     * @brief Inner only, see TaskSlotAwaiter.
+    */
+    void set_result_slot(T *slot) noexcept { this->slot = slot; }
+
 private:
     std::optional<T> result;
+    T *slot{nullptr};
 };
 
 
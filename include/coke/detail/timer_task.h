@@ -20,6 +20,7 @@
 #define COKE_DETAIL_TIMER_TASK_H
 
 #include <atomic>
+#include <cstdint>
 
 #include "coke/detail/sleep_base.h"
 
@@ -28,6 +29,8 @@
 
 namespace coke::detail {
 
+class TimingWheel;
+
 class TimerTask : public SleepRequest {
 public:
     using NanoSec = std::chrono::nanoseconds;
@@ -46,7 +49,36 @@ public:
 
     int get_result() noexcept;
 
+    /**
+     * @brief Put this timer on the coarse-grained timing wheel instead of the
+     *        poller, must be called before the timer is dispatched.
+    */
+    void set_coarse(bool coarse) noexcept { this->coarse = coarse; }
+
+    /**
+     * @brief Release the timer which is never dispatched, for example when
+     *        the awaiter is destroyed without being co awaited.
+    */
+    virtual void discard() { delete this; }
+
 protected:
+    virtual void dispatch() override {
+        if (this->sleep_timer() < 0)
+            this->handle(SS_STATE_ERROR, errno);
+    }
+
+    /**
+     * @brief Start the timer on the timing wheel or on the poller, returns
+     *        the same as CommScheduler::sleep.
+    */
+    int sleep_timer();
+
+    /**
+     * @brief Cancel the started timer, returns the same as
+     *        CommScheduler::unsleep.
+    */
+    int cancel_timer();
+
     virtual SubTask *done() override {
         SeriesWork *series = series_of(this);
 
@@ -75,6 +107,16 @@ protected:
 protected:
     AwaiterBase *awaiter;
     NanoSec nsec;
+
+private:
+    // Intrusive node of the timing wheel, protected by the wheel's lock
+    TimerTask *wheel_prev{nullptr};
+    TimerTask *wheel_next{nullptr};
+    TimerTask **wheel_slot{nullptr};
+    uint64_t wheel_expire{0};
+    bool coarse{false};
+
+    friend class TimingWheel;
 };
 
 class YieldTask : public TimerTask {
@@ -127,7 +169,7 @@ private:
     std::atomic<int> ref;
 };
 
-TimerTask *create_timer(NanoSec nsec);
+TimerTask *create_timer(NanoSec nsec, bool coarse = false);
 
 TimerTask *create_timer(uint64_t id, NanoSec nsec, bool insert_head);
 
@@ -139,6 +181,18 @@ TimerTask *create_infinite_timer(const void *addr, bool insert_head);
 
 TimerTask *create_yield_timer();
 
+/**
+ * @brief Set the timing wheel parameters from GlobalSettings, see
+ *        GlobalSettings::timer_wheel_threshold.
+*/
+void set_timer_wheel_config(int threshold_ms, int tick_ms) noexcept;
+
+/**
+ * @brief Whether a timer of `nsec` should be put on the timing wheel by
+ *        default.
+*/
+bool use_timing_wheel(NanoSec nsec) noexcept;
+
 } // namespace coke::detail
 
 #endif // COKE_DETAIL_TIMER_TASK_H
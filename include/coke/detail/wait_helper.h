@@ -19,13 +19,43 @@
 #ifndef COKE_DETAIL_WAIT_HELPER_H
 #define COKE_DETAIL_WAIT_HELPER_H
 
+#include <algorithm>
+#include <atomic>
+#include <coroutine>
 #include <cstddef>
+#include <exception>
+#include <iterator>
+#include <mutex>
+#include <ranges>
 #include <type_traits>
 #include <vector>
 #include <memory>
 
+#include "coke/detail/awaiter_base.h"
+#include "coke/detail/frame_pool.h"
 #include "coke/task.h"
 #include "coke/latch.h"
+#include "coke/stop_token.h"
+#include "workflow/Workflow.h"
+
+namespace coke {
+
+/**
+ * @brief Result of coke::when_any, `index` is the position of the first
+ *        completed task, and `value` is its return value.
+*/
+template<typename T>
+struct WhenAnyResult {
+    std::size_t index;
+    T value;
+};
+
+template<>
+struct WhenAnyResult<void> {
+    std::size_t index;
+};
+
+} // namespace coke
 
 namespace coke::detail {
 
@@ -39,6 +69,8 @@ struct ValueHelper {
         return std::move(value);
     }
 
+    T *slot() { return &value; }
+
 private:
     T value;
 };
@@ -64,6 +96,8 @@ struct MValueHelper {
         return std::move(value);
     }
 
+    T *slot(std::size_t i) { return &value[i]; }
+
 private:
     std::vector<T> value;
 };
@@ -88,6 +122,8 @@ struct MValueHelper<bool> {
         return std::vector<bool>(value.get(), value.get() + n);
     }
 
+    bool *slot(std::size_t i) { return &value[i]; }
+
 private:
     std::unique_ptr<bool []> value;
     std::size_t n;
@@ -102,12 +138,24 @@ struct MValueHelper<void> {
     void get_value() { }
 };
 
+// The result is assigned to the slot of helper directly when the task
+// co_returns, instead of moving through the promise and the awaiter.
+
+/**
+ * @brief Detach `task` with the local context of the waiting coroutine, so
+ *        that the tasks started by async_wait and others inherit it.
+*/
+inline void detach_with_local(Task<> &&task, void *local) {
+    task.set_local_context(local);
+    task.detach();
+}
+
 template<Cokeable T, typename L>
 Task<> coke_wait_helper(Task<T> task, ValueHelper<T> &v, L &lt) {
     if constexpr (std::is_same_v<T, void>)
         co_await std::move(task);
     else
-        v.set_value(co_await std::move(task));
+        co_await task.await_into(v.slot());
 
     lt.count_down();
 }
@@ -118,7 +166,7 @@ Task<> coke_wait_helper(Task<T> task, MValueHelper<T> &v, std::size_t i, L &lt)
     if constexpr (std::is_same_v<T, void>)
         co_await std::move(task);
     else
-        v.set_value(i, co_await std::move(task));
+        co_await task.await_into(v.slot(i));
 
     lt.count_down();
 }
@@ -130,14 +178,359 @@ auto async_wait_helper(std::vector<Task<T>> tasks)
     std::size_t n = tasks.size();
     Latch lt(n);
     MValueHelper<T> v(n);
+    void *local = co_await LocalContextAwaiter<void>();
 
     for (std::size_t i = 0; i < n; i++)
-        coke_wait_helper(std::move(tasks[i]), v, i, lt).detach();
+        detach_with_local(coke_wait_helper(std::move(tasks[i]), v, i, lt),
+                          local);
 
     co_await lt.wait();
     co_return v.get_value();
 }
 
+template<Cokeable T, typename L>
+Task<> coke_window_helper(std::vector<Task<T>> &tasks, MValueHelper<T> &v,
+                          std::atomic<std::size_t> &next, L &lt)
+{
+    constexpr auto relaxed = std::memory_order_relaxed;
+    std::size_t n = tasks.size();
+    std::size_t i;
+
+    while ((i = next.fetch_add(1, relaxed)) < n) {
+        // Move out so that the frame is released as soon as it finishes.
+        Task<T> task = std::move(tasks[i]);
+
+        if constexpr (std::is_same_v<T, void>)
+            co_await std::move(task);
+        else
+            co_await task.await_into(v.slot(i));
+    }
+
+    lt.count_down();
+}
+
+template<Cokeable T>
+auto async_wait_n_helper(std::vector<Task<T>> tasks, std::size_t max_inflight)
+    -> Task<typename MValueHelper<T>::RetType>
+{
+    std::size_t n = tasks.size();
+    std::size_t m = std::min(n, std::max(max_inflight, std::size_t(1)));
+    std::atomic<std::size_t> next{0};
+    Latch lt(m);
+    MValueHelper<T> v(n);
+    void *local = co_await LocalContextAwaiter<void>();
+
+    // Each helper runs the tasks one by one, so that at most m are in flight.
+    for (std::size_t i = 0; i < m; i++)
+        detach_with_local(coke_window_helper(tasks, v, next, lt), local);
+
+    co_await lt.wait();
+    co_return v.get_value();
+}
+
+template<typename I, typename S, typename F, typename L>
+Task<> coke_for_each_helper(I &it, const S &last, F &func, std::mutex &mtx,
+                            L &lt)
+{
+    std::unique_lock<std::mutex> lk(mtx);
+
+    while (it != last) {
+        // func only creates the coroutine, it is cheap to hold the lock.
+        auto task = func(*it);
+        ++it;
+
+        lk.unlock();
+        co_await std::move(task);
+        lk.lock();
+    }
+
+    lk.unlock();
+    lt.count_down();
+}
+
+template<typename R, typename F>
+Task<> async_for_each_helper(R &range, F func, std::size_t concurrency) {
+    auto it = std::ranges::begin(range);
+    auto last = std::ranges::end(range);
+    std::size_t m = std::max(concurrency, std::size_t(1));
+    std::mutex mtx;
+    Latch lt(m);
+    void *local = co_await LocalContextAwaiter<void>();
+
+    for (std::size_t i = 0; i < m; i++)
+        detach_with_local(coke_for_each_helper(it, last, func, mtx, lt),
+                          local);
+
+    co_await lt.wait();
+}
+
+class WhenAllState;
+
+/**
+ * @brief The task parked in the caller's series while the children of
+ *        when_all are running. It keeps the series, for example of a server
+ *        task, alive until the join, and resumes the caller on it.
+*/
+class WhenAllParkTask final : public SubTask {
+public:
+    explicit WhenAllParkTask(WhenAllState *st) noexcept
+        : st(st), awaiter(nullptr)
+    { }
+
+    void set_awaiter(AwaiterBase *awaiter) noexcept { this->awaiter = awaiter; }
+
+    /**
+     * @brief Called by the last child, the task is dispatched before that.
+    */
+    void finish() { this->subtask_done(); }
+
+#ifndef COKE_NO_FRAME_POOL
+    static void *operator new(std::size_t size) {
+        return frame_pool_alloc(size);
+    }
+
+    static void operator delete(void *ptr, std::size_t size) noexcept {
+        frame_pool_free(ptr, size);
+    }
+#endif
+
+private:
+    virtual void dispatch() override;
+
+    virtual SubTask *done() override {
+        SeriesWork *series = series_of(this);
+        awaiter->done();
+
+        delete this;
+        return series->pop();
+    }
+
+private:
+    WhenAllState *st;
+    AwaiterBase *awaiter;
+};
+
+/**
+ * @brief Shared state of when_all. The children and the park task of the
+ *        waiting coroutine count down a single atomic counter, and the last
+ *        one finishes the park task, there is no latch or timer.
+*/
+class WhenAllState {
+public:
+    explicit WhenAllState(std::size_t n) noexcept
+        : cnt(n + 1), park(nullptr)
+    { }
+
+    class JoinAwaiter : public AwaiterBase {
+    public:
+        explicit JoinAwaiter(WhenAllState *st) : park(nullptr) {
+            // Nothing to wait if all the children finished synchronously
+            if (st->cnt.load(std::memory_order_acquire) == 1)
+                return;
+
+            park = new WhenAllParkTask(st);
+            park->set_awaiter(this);
+            st->park = park;
+            this->set_task(park);
+        }
+
+        JoinAwaiter(JoinAwaiter &&that) noexcept
+            : AwaiterBase(std::move(that)),
+              park(std::exchange(that.park, nullptr))
+        {
+            if (park)
+                park->set_awaiter(this);
+        }
+
+        void await_resume() const noexcept { }
+
+    private:
+        WhenAllParkTask *park;
+    };
+
+    /**
+     * @brief Wait for all the children, the returned awaiter must be awaited
+     *        immediately and only once.
+    */
+    JoinAwaiter join() { return JoinAwaiter(this); }
+
+    /**
+     * @brief Count down by one, return true if it is the last one.
+    */
+    bool arrive() noexcept {
+        return cnt.fetch_sub(1, std::memory_order_acq_rel) == 1;
+    }
+
+    /**
+     * @brief Called by the last child, finish the park task and the caller is
+     *        resumed on its own series.
+    */
+    void wakeup() { park->finish(); }
+
+private:
+    std::atomic<std::size_t> cnt;
+    WhenAllParkTask *park;
+};
+
+inline void WhenAllParkTask::dispatch() {
+    // The caller's series is kept here until the last child arrives
+    if (st->arrive())
+        this->subtask_done();
+}
+
+/**
+ * @brief A lightweight coroutine that awaits one child of when_all, its frame
+ *        only holds the child and a pointer to the shared state.
+*/
+class JoinTask {
+public:
+    struct promise_type {
+        struct FinalAwaiter {
+            bool await_ready() const noexcept { return false; }
+            void await_resume() const noexcept { }
+
+            std::coroutine_handle<>
+            await_suspend(std::coroutine_handle<promise_type> h) noexcept {
+                WhenAllState *st = h.promise().st;
+
+                // The frame is not used after the count down
+                h.destroy();
+
+                if (st->arrive())
+                    st->wakeup();
+
+                return std::noop_coroutine();
+            }
+        };
+
+#ifndef COKE_NO_FRAME_POOL
+        static void *operator new(std::size_t size) {
+            return frame_pool_alloc(size);
+        }
+
+        static void operator delete(void *ptr, std::size_t size) noexcept {
+            frame_pool_free(ptr, size);
+        }
+#endif
+
+        JoinTask get_return_object() noexcept {
+            using handle_type = std::coroutine_handle<promise_type>;
+            return JoinTask(handle_type::from_promise(*this));
+        }
+
+        std::suspend_always initial_suspend() const noexcept { return {}; }
+        FinalAwaiter final_suspend() const noexcept { return {}; }
+
+        void return_void() const noexcept { }
+
+        // Same as detached coke::Task, unhandled exception is fatal
+        void unhandled_exception() const noexcept { std::terminate(); }
+
+        WhenAllState *st{nullptr};
+    };
+
+    /**
+     * @brief Start the coroutine, it is destroyed by itself when finished.
+    */
+    void start(WhenAllState *st) noexcept {
+        hdl.promise().st = st;
+        hdl.resume();
+    }
+
+private:
+    explicit JoinTask(std::coroutine_handle<promise_type> hdl) noexcept
+        : hdl(hdl)
+    { }
+
+    std::coroutine_handle<promise_type> hdl;
+};
+
+template<Cokeable T>
+JoinTask coke_join_helper(Task<T> task, MValueHelper<T> &v, std::size_t i) {
+    if constexpr (std::is_same_v<T, void>)
+        co_await std::move(task);
+    else
+        co_await task.await_into(v.slot(i));
+}
+
+template<Cokeable T>
+auto when_all_helper(std::vector<Task<T>> tasks)
+    -> Task<typename MValueHelper<T>::RetType>
+{
+    std::size_t n = tasks.size();
+    WhenAllState st(n);
+    MValueHelper<T> v(n);
+    void *local = co_await LocalContextAwaiter<void>();
+
+    for (std::size_t i = 0; i < n; i++) {
+        tasks[i].inherit_local_context(local);
+        coke_join_helper(std::move(tasks[i]), v, i).start(&st);
+    }
+
+    co_await st.join();
+    co_return v.get_value();
+}
+
+template<Cokeable T>
+struct WhenAnyState {
+    WhenAnyState() : lt(1) { }
+
+    std::atomic<bool> done{false};
+    std::size_t index{0};
+    ValueHelper<T> v;
+    Latch lt;
+};
+
+template<Cokeable T>
+Task<> when_any_task(Task<T> task, std::shared_ptr<WhenAnyState<T>> state,
+                     std::size_t i)
+{
+    constexpr auto acq_rel = std::memory_order_acq_rel;
+
+    if constexpr (std::is_same_v<T, void>) {
+        co_await std::move(task);
+
+        if (!state->done.exchange(true, acq_rel)) {
+            state->index = i;
+            state->lt.count_down();
+        }
+    }
+    else {
+        T value = co_await std::move(task);
+
+        if (!state->done.exchange(true, acq_rel)) {
+            state->index = i;
+            state->v.set_value(std::move(value));
+            state->lt.count_down();
+        }
+    }
+}
+
+template<Cokeable T>
+auto when_any_helper(std::vector<Task<T>> tasks, StopToken *token)
+    -> Task<WhenAnyResult<T>>
+{
+    // The state is shared with the tasks that are still running after the
+    // first one completed, they will release it when they finish.
+    auto state = std::make_shared<WhenAnyState<T>>();
+    std::size_t n = tasks.size();
+    void *local = co_await LocalContextAwaiter<void>();
+
+    for (std::size_t i = 0; i < n; i++)
+        detach_with_local(when_any_task(std::move(tasks[i]), state, i),
+                          local);
+
+    co_await state->lt.wait();
+
+    if (token)
+        token->request_stop();
+
+    if constexpr (std::is_same_v<T, void>)
+        co_return WhenAnyResult<void>{state->index};
+    else
+        co_return WhenAnyResult<T>{state->index, state->v.get_value()};
+}
+
 template<typename T>
 concept AwaitableType = requires (T t) {
     requires std::derived_from<T, AwaiterBase>;
@@ -0,0 +1,370 @@
+/**
+ * Copyright 2024 Coke Project (https://github.com/kedixa/coke)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Authors: kedixa (https://github.com/kedixa)
+*/
+
+#ifndef COKE_EXECUTOR_ADAPTER_H
+#define COKE_EXECUTOR_ADAPTER_H
+
+#include <concepts>
+#include <coroutine>
+#include <functional>
+#include <optional>
+#include <type_traits>
+#include <utility>
+
+#include "coke/detail/awaiter_base.h"
+#include "coke/detail/frame_pool.h"
+#include "coke/task.h"
+#include "workflow/Workflow.h"
+
+namespace coke {
+
+namespace detail {
+
+/**
+ * @brief CallbackTaskResult is the part of CallbackTask which does not depend
+ *        on the type of the initiating function, it keeps the result inline.
+*/
+template<Cokeable T>
+class CallbackTaskResult : public SubTask {
+    struct Empty { };
+    using OptType = std::conditional_t<std::is_void_v<T>, Empty,
+                                       std::optional<T>>;
+
+public:
+    CallbackTaskResult() noexcept : awaiter(nullptr) { }
+
+    void set_awaiter(AwaiterBase *awaiter) noexcept { this->awaiter = awaiter; }
+
+    template<typename... ARGS>
+    void complete(ARGS&&... args) {
+        if constexpr (!std::is_void_v<T>)
+            result.emplace(std::forward<ARGS>(args)...);
+
+        this->subtask_done();
+    }
+
+    T get_result() {
+        if constexpr (!std::is_void_v<T>)
+            return std::move(result.value());
+    }
+
+#ifndef COKE_NO_FRAME_POOL
+    /**
+     * A CallbackTask is created for each co_await, take it from the thread
+     * local free lists of the coroutine frames.
+    */
+    static void *operator new(std::size_t size) {
+        return frame_pool_alloc(size);
+    }
+
+    static void operator delete(void *ptr, std::size_t size) noexcept {
+        frame_pool_free(ptr, size);
+    }
+#endif
+
+private:
+    virtual SubTask *done() override {
+        SeriesWork *series = series_of(this);
+
+        // The awaiter is resumed in the thread which completes this task
+        awaiter->done();
+
+        delete this;
+        return series->pop();
+    }
+
+private:
+    AwaiterBase *awaiter;
+    [[no_unique_address]] OptType result;
+};
+
+template<Cokeable T, typename INIT>
+class CallbackTask;
+
+} // namespace detail
+
+
+/**
+ * @brief CallbackResolver completes a CallbackAwaiter, it is passed to the
+ *        initiating function and can be copied into the callback of any async
+ *        API. It has the size of a pointer, which fits in the small buffer of
+ *        std::function.
+ *
+ * Exactly one of the copies must be called exactly once, with the arguments
+ * to construct T. The awaiting coroutine is resumed in the calling thread
+ * before the call returns.
+*/
+template<Cokeable T>
+class CallbackResolver {
+public:
+    explicit CallbackResolver(detail::CallbackTaskResult<T> *task) noexcept
+        : task(task)
+    { }
+
+    template<typename... ARGS>
+    void operator()(ARGS&&... args) const {
+        task->complete(std::forward<ARGS>(args)...);
+    }
+
+private:
+    detail::CallbackTaskResult<T> *task;
+};
+
+/**
+ * @brief The job posted to a foreign executor, calling it resumes the coke
+ *        coroutine in the executor's thread.
+*/
+using ExecutorJob = CallbackResolver<void>;
+
+/**
+ * @brief ForeignExecutor is a thread pool or event loop not managed by coke,
+ *        such as asio's io_context. It must either have a member function
+ *        `execute(ExecutorJob)`, or be invocable with an ExecutorJob, and run
+ *        the job later in one of its threads. The job can be stored in a
+ *        std::function<void()>.
+ *
+ * @code
+ *  // Adapt an asio executor
+ *  auto post = [ex = io.get_executor()] (coke::ExecutorJob job) {
+ *      asio::post(ex, job);
+ *  };
+ * @endcode
+*/
+template<typename E>
+concept ForeignExecutor = requires (E &e, ExecutorJob job) {
+    e.execute(job);
+} || std::invocable<E &, ExecutorJob>;
+
+namespace detail {
+
+template<Cokeable T, typename INIT>
+class CallbackTask final : public CallbackTaskResult<T> {
+public:
+    template<typename F>
+    explicit CallbackTask(F &&f) : init(std::forward<F>(f)) { }
+
+private:
+    virtual void dispatch() override {
+        // The callback may be called before `init` returns, and this task
+        // is deleted at that time, do not touch any member after it.
+        INIT f = std::move(init);
+        std::invoke(f, CallbackResolver<T>(this));
+    }
+
+private:
+    INIT init;
+};
+
+template<ForeignExecutor E>
+void execute_job(E &exec, ExecutorJob job) {
+    if constexpr (requires { exec.execute(job); })
+        exec.execute(job);
+    else
+        std::invoke(exec, job);
+}
+
+} // namespace detail
+
+
+/**
+ * @brief CallbackAwaiter wraps an arbitrary callback based async API into an
+ *        awaitable object. When co awaited, the initiating function `init` is
+ *        called with a CallbackResolver<T>, which should be passed to the
+ *        callback of the async API. The coroutine is suspended until the
+ *        resolver is called, and co_await returns the value given to it.
+ *
+ * There is no Workflow's task or thread involved, only a SubTask of a few
+ * pointers is created in the current series, so that the series, for
+ * example of a server task, is kept until the API is completed.
+ *
+ * @code
+ *  int ret = co_await coke::from_callback<int>([&] (auto resolve) {
+ *      client.async_get(key, [resolve] (int ret) { resolve(ret); });
+ *  });
+ * @endcode
+*/
+template<Cokeable T>
+class [[nodiscard]] CallbackAwaiter : public AwaiterBase {
+public:
+    template<typename INIT>
+        requires std::invocable<std::decay_t<INIT> &, CallbackResolver<T>>
+    explicit CallbackAwaiter(INIT &&init) {
+        using task_t = detail::CallbackTask<T, std::decay_t<INIT>>;
+
+        this->task = new task_t(std::forward<INIT>(init));
+        this->task->set_awaiter(this);
+        this->set_task(this->task);
+    }
+
+    CallbackAwaiter(CallbackAwaiter &&that) noexcept
+        : AwaiterBase(std::move(that)),
+          task(std::exchange(that.task, nullptr))
+    {
+        if (this->task)
+            this->task->set_awaiter(this);
+    }
+
+    CallbackAwaiter &operator= (CallbackAwaiter &&that) noexcept {
+        if (this != &that) {
+            this->AwaiterBase::operator=(std::move(that));
+            std::swap(this->task, that.task);
+
+            if (this->task)
+                this->task->set_awaiter(this);
+
+            if (that.task)
+                that.task->set_awaiter(&that);
+        }
+
+        return *this;
+    }
+
+    T await_resume() { return task->get_result(); }
+
+private:
+    detail::CallbackTaskResult<T> *task;
+};
+
+/**
+ * @brief Create a CallbackAwaiter<T> with initiating function `init`, see
+ *        CallbackAwaiter.
+*/
+template<Cokeable T = void, typename INIT>
+    requires std::invocable<std::decay_t<INIT> &, CallbackResolver<T>>
+CallbackAwaiter<T> from_callback(INIT &&init) {
+    return CallbackAwaiter<T>(std::forward<INIT>(init));
+}
+
+/**
+ * @brief Switch the current coroutine to a thread of the foreign executor
+ *        `exec`, the coroutine keeps its series and can co_await any coke
+ *        awaitable after it. No thread is blocked while switching.
+ *
+ * @pre `exec` lives until the returned awaiter is resumed.
+*/
+template<ForeignExecutor E>
+CallbackAwaiter<void> resume_on(E &exec) {
+    return CallbackAwaiter<void>([e = &exec] (ExecutorJob job) {
+        detail::execute_job(*e, job);
+    });
+}
+
+
+namespace detail {
+
+template<Cokeable T, ForeignExecutor E, typename CB>
+Task<> start_on_helper(E *exec, Task<T> task, CB cb) {
+    if constexpr (std::is_void_v<T>) {
+        co_await std::move(task);
+        co_await resume_on(*exec);
+        std::invoke(cb);
+    }
+    else {
+        T value = co_await std::move(task);
+        co_await resume_on(*exec);
+        std::invoke(cb, std::move(value));
+    }
+}
+
+template<Cokeable T, ForeignExecutor E>
+Task<> await_on_helper(E *exec, Task<T> task, std::coroutine_handle<> h,
+                       std::optional<T> *slot) {
+    slot->emplace(co_await std::move(task));
+    co_await resume_on(*exec);
+    h.resume();
+}
+
+template<ForeignExecutor E>
+Task<> await_on_helper(E *exec, Task<void> task, std::coroutine_handle<> h) {
+    co_await std::move(task);
+    co_await resume_on(*exec);
+    h.resume();
+}
+
+} // namespace detail
+
+
+/**
+ * @brief Start `task` without blocking the calling thread, which may be a
+ *        thread of a foreign executor, and call `cb(result)`, or `cb()` if T
+ *        is void, in a thread of `exec` when the task is finished.
+ *
+ * @pre `exec` lives until `cb` is called.
+*/
+template<Cokeable T, ForeignExecutor E, typename CB>
+    requires (std::is_void_v<T> && std::invocable<std::decay_t<CB> &>) ||
+             std::invocable<std::decay_t<CB> &, T>
+void start_on(E &exec, Task<T> &&task, CB &&cb) {
+    using cb_t = std::decay_t<CB>;
+
+    detail::start_on_helper<T, E, cb_t>(&exec, std::move(task),
+                                        std::forward<CB>(cb)).detach();
+}
+
+/**
+ * @brief AwaitOnAwaiter is used to co_await a coke::Task in the coroutines
+ *        of other frameworks, and the awaiting coroutine is resumed in a
+ *        thread of `exec` instead of a thread of coke. Use coke::await_on to
+ *        create it.
+*/
+template<Cokeable T, ForeignExecutor E>
+class [[nodiscard]] AwaitOnAwaiter {
+public:
+    AwaitOnAwaiter(E &exec, Task<T> &&task)
+        : exec(&exec), task(std::move(task))
+    { }
+
+    AwaitOnAwaiter(AwaitOnAwaiter &&) = default;
+
+    bool await_ready() const noexcept { return false; }
+
+    void await_suspend(std::coroutine_handle<> h) {
+        if constexpr (std::is_void_v<T>)
+            detail::await_on_helper(exec, std::move(task), h).detach();
+        else
+            detail::await_on_helper(exec, std::move(task), h, &slot).detach();
+    }
+
+    T await_resume() {
+        if constexpr (!std::is_void_v<T>)
+            return std::move(slot.value());
+    }
+
+private:
+    struct Empty { };
+    using OptType = std::conditional_t<std::is_void_v<T>, Empty,
+                                       std::optional<T>>;
+
+    E *exec;
+    Task<T> task;
+    [[no_unique_address]] OptType slot;
+};
+
+/**
+ * @brief Create an AwaitOnAwaiter to co_await `task` in the coroutines of
+ *        other frameworks, see AwaitOnAwaiter. In coke::Task, co_await the
+ *        task directly, and then coke::resume_on if needed.
+*/
+template<Cokeable T, ForeignExecutor E>
+AwaitOnAwaiter<T, E> await_on(E &exec, Task<T> &&task) {
+    return AwaitOnAwaiter<T, E>(exec, std::move(task));
+}
+
+} // namespace coke
+
+#endif // COKE_EXECUTOR_ADAPTER_H
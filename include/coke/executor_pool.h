@@ -0,0 +1,140 @@
+/**
+ * Copyright 2024 Coke Project (https://github.com/kedixa/coke)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Authors: kedixa (https://github.com/kedixa)
+*/
+
+#ifndef COKE_EXECUTOR_POOL_H
+#define COKE_EXECUTOR_POOL_H
+
+#include <cstddef>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "coke/go.h"
+
+namespace coke {
+
+struct ExecutorPoolParams {
+    // Number of threads in the pool, zero is treated as one
+    std::size_t threads = 1;
+
+    // Bind all the threads to these cpus, empty means no binding
+    std::vector<int> cpu_affinity;
+
+    // Nice value of the threads, see setpriority(2), zero keeps the default.
+    // Lower then the current value may need privilege.
+    int nice = 0;
+};
+
+/**
+ * @brief ExecutorPool owns a compute thread pool separated from the global one
+ *        used by coke::go, so that latency sensitive jobs and background jobs
+ *        do not compete for the same threads. The threads can be bound to
+ *        some cpus and have their own priority.
+ *
+ * The name is ExecutorPool rather than Executor, because the latter is the
+ * Workflow's thread pool, which is wrapped by this class.
+*/
+class ExecutorPool {
+public:
+    ExecutorPool() noexcept : inited(false) { }
+
+    /**
+     * @brief ExecutorPool is neither copyable nor moveable.
+    */
+    ExecutorPool(const ExecutorPool &) = delete;
+    ExecutorPool &operator=(const ExecutorPool &) = delete;
+
+    /**
+     * @brief Deinit the pool if it is inited.
+     * @pre No job is running or waiting in this pool.
+    */
+    ~ExecutorPool() { deinit(); }
+
+    /**
+     * @brief Create the threads and apply the affinity and priority to them.
+     *
+     * @return 0 on success, or a negative errno on failure, and the pool is
+     *         left uninited.
+     * @pre The pool is not inited.
+    */
+    int init(const ExecutorPoolParams &params);
+
+    /**
+     * @brief Join the threads and destroy the queues of this pool.
+     * @pre No job is running or waiting in this pool.
+    */
+    void deinit();
+
+    bool is_inited() const noexcept { return inited; }
+
+    std::size_t get_threads() const noexcept { return threads; }
+
+    /**
+     * @brief Get the Workflow's Executor of this pool.
+     * @pre The pool is inited.
+    */
+    Executor *get_executor() noexcept { return &executor; }
+
+    /**
+     * @brief Get the ExecQueue with `name` of this pool, the queues are owned
+     *        by the pool and are separated from the global ones.
+     *
+     * @return The queue, or nullptr if it cannot be created.
+    */
+    ExecQueue *get_exec_queue(const std::string &name);
+
+private:
+    bool inited;
+    std::size_t threads{0};
+    Executor executor;
+
+    std::mutex mtx;
+    std::map<std::string, std::unique_ptr<ExecQueue>, std::less<>> queues;
+};
+
+/**
+ * @brief Run `func(args...)` in `pool` with queue `name`, see coke::go.
+*/
+template<typename FUNC, typename... ARGS>
+    requires std::invocable<FUNC, ARGS...>
+auto go(ExecutorPool &pool, const std::string &name,
+        FUNC &&func, ARGS&&... args) {
+    return go(pool.get_exec_queue(name), pool.get_executor(),
+              std::forward<FUNC>(func),
+              std::forward<ARGS>(args)...);
+}
+
+/**
+ * @brief Switch to a thread in `pool` with queue `name`.
+*/
+inline auto switch_go_thread(ExecutorPool &pool, const std::string &name) {
+    return switch_go_thread(pool.get_exec_queue(name), pool.get_executor());
+}
+
+/**
+ * @brief Switch to a thread in `pool` with default name.
+*/
+inline auto switch_go_thread(ExecutorPool &pool) {
+    return switch_go_thread(pool, std::string(GO_DEFAULT_QUEUE));
+}
+
+} // namespace coke
+
+#endif // COKE_EXECUTOR_POOL_H
@@ -0,0 +1,290 @@
+/**
+ * Copyright 2024 Coke Project (https://github.com/kedixa/coke)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Authors: kedixa (https://github.com/kedixa)
+*/
+
+#ifndef COKE_EXPECTED_H
+#define COKE_EXPECTED_H
+
+#include <cassert>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include "coke/task.h"
+#include "coke/wait.h"
+
+/**
+ * coke::Expected<T, E> carries either a value or an error, like std::expected
+ * in C++23. Returning errors by value from coke::Task<Expected<T, E>> costs
+ * the same as returning a value, while throwing an exception across each
+ * coroutine level captures and rethrows an exception_ptr, see
+ * benchmark/bench_exception.cpp.
+*/
+
+namespace coke {
+
+template<typename E>
+class Unexpected {
+    static_assert(std::is_object_v<E> && !std::is_array_v<E> &&
+                  std::is_same_v<E, std::remove_cvref_t<E>>,
+                  "Unexpected requires a non cv qualified object type");
+
+public:
+    constexpr explicit Unexpected(const E &e) : err(e) { }
+    constexpr explicit Unexpected(E &&e) : err(std::move(e)) { }
+
+    constexpr E &error() & noexcept { return err; }
+    constexpr const E &error() const & noexcept { return err; }
+    constexpr E &&error() && noexcept { return std::move(err); }
+
+private:
+    E err;
+};
+
+template<typename E>
+Unexpected(E) -> Unexpected<E>;
+
+
+template<typename T, typename E = int>
+class Expected {
+    static_assert(!std::is_reference_v<T> && !std::is_reference_v<E>,
+                  "Expected does not support reference types");
+
+public:
+    using value_type = T;
+    using error_type = E;
+
+    constexpr Expected() requires std::is_default_constructible_v<T>
+        : v(std::in_place_index<0>)
+    { }
+
+    constexpr Expected(const T &t) : v(std::in_place_index<0>, t) { }
+    constexpr Expected(T &&t) : v(std::in_place_index<0>, std::move(t)) { }
+
+    template<typename G>
+        requires std::is_constructible_v<E, const G &>
+    constexpr Expected(const Unexpected<G> &u)
+        : v(std::in_place_index<1>, u.error())
+    { }
+
+    template<typename G>
+        requires std::is_constructible_v<E, G &&>
+    constexpr Expected(Unexpected<G> &&u)
+        : v(std::in_place_index<1>, std::move(u).error())
+    { }
+
+    Expected(const Expected &) = default;
+    Expected(Expected &&) = default;
+    Expected &operator= (const Expected &) = default;
+    Expected &operator= (Expected &&) = default;
+    ~Expected() = default;
+
+    constexpr bool has_value() const noexcept { return v.index() == 0; }
+    constexpr explicit operator bool() const noexcept { return has_value(); }
+
+    /**
+     * @brief Get the value, it never throws.
+     * @pre has_value() is true.
+    */
+    constexpr T &value() & noexcept {
+        assert(has_value());
+        return *std::get_if<0>(&v);
+    }
+
+    constexpr const T &value() const & noexcept {
+        assert(has_value());
+        return *std::get_if<0>(&v);
+    }
+
+    constexpr T &&value() && noexcept {
+        assert(has_value());
+        return std::move(*std::get_if<0>(&v));
+    }
+
+    /**
+     * @brief Get the error.
+     * @pre has_value() is false.
+    */
+    constexpr E &error() & noexcept {
+        assert(!has_value());
+        return *std::get_if<1>(&v);
+    }
+
+    constexpr const E &error() const & noexcept {
+        assert(!has_value());
+        return *std::get_if<1>(&v);
+    }
+
+    constexpr E &&error() && noexcept {
+        assert(!has_value());
+        return std::move(*std::get_if<1>(&v));
+    }
+
+    constexpr T &operator*() & noexcept { return value(); }
+    constexpr const T &operator*() const & noexcept { return value(); }
+    constexpr T &&operator*() && noexcept { return std::move(*this).value(); }
+
+    constexpr T *operator->() noexcept { return &value(); }
+    constexpr const T *operator->() const noexcept { return &value(); }
+
+    template<typename U>
+    constexpr T value_or(U &&u) const & {
+        return has_value() ? value() : static_cast<T>(std::forward<U>(u));
+    }
+
+    template<typename U>
+    constexpr T value_or(U &&u) && {
+        return has_value() ? std::move(*this).value()
+                           : static_cast<T>(std::forward<U>(u));
+    }
+
+private:
+    // Index 0 is the value and 1 is the error, so that T and E can be the same
+    std::variant<T, E> v;
+};
+
+
+template<typename E>
+class Expected<void, E> {
+public:
+    using value_type = void;
+    using error_type = E;
+
+    constexpr Expected() noexcept = default;
+
+    template<typename G>
+        requires std::is_constructible_v<E, const G &>
+    constexpr Expected(const Unexpected<G> &u) : err(u.error()) { }
+
+    template<typename G>
+        requires std::is_constructible_v<E, G &&>
+    constexpr Expected(Unexpected<G> &&u) : err(std::move(u).error()) { }
+
+    Expected(const Expected &) = default;
+    Expected(Expected &&) = default;
+    Expected &operator= (const Expected &) = default;
+    Expected &operator= (Expected &&) = default;
+    ~Expected() = default;
+
+    constexpr bool has_value() const noexcept { return !err.has_value(); }
+    constexpr explicit operator bool() const noexcept { return has_value(); }
+
+    constexpr void value() const noexcept { assert(has_value()); }
+
+    constexpr E &error() & noexcept {
+        assert(!has_value());
+        return *err;
+    }
+
+    constexpr const E &error() const & noexcept {
+        assert(!has_value());
+        return *err;
+    }
+
+    constexpr E &&error() && noexcept {
+        assert(!has_value());
+        return std::move(*err);
+    }
+
+private:
+    std::optional<E> err;
+};
+
+
+namespace detail {
+
+template<typename T>
+struct IsExpected : std::false_type { };
+
+template<typename T, typename E>
+struct IsExpected<Expected<T, E>> : std::true_type { };
+
+template<typename T, typename E>
+Task<Expected<std::vector<T>, E>>
+async_wait_expected_helper(std::vector<Task<Expected<T, E>>> tasks) {
+    std::vector<Expected<T, E>> rets;
+    std::vector<T> values;
+
+    rets = co_await async_wait(std::move(tasks));
+    values.reserve(rets.size());
+
+    for (Expected<T, E> &r : rets) {
+        if (!r)
+            co_return Unexpected<E>(std::move(r).error());
+
+        values.push_back(std::move(r).value());
+    }
+
+    co_return std::move(values);
+}
+
+template<typename E>
+Task<Expected<void, E>>
+async_wait_expected_helper(std::vector<Task<Expected<void, E>>> tasks) {
+    std::vector<Expected<void, E>> rets;
+
+    rets = co_await async_wait(std::move(tasks));
+
+    for (Expected<void, E> &r : rets) {
+        if (!r)
+            co_return Unexpected<E>(std::move(r).error());
+    }
+
+    co_return Expected<void, E>{};
+}
+
+} // namespace detail
+
+template<typename T>
+constexpr bool is_expected_v = detail::IsExpected<std::remove_cvref_t<T>>::value;
+
+/**
+ * @brief Async wait for a vector of coke::Task<Expected<T, E>>, all the tasks
+ *        run to completion, and the first error in the order of `tasks` is
+ *        returned if any, otherwise all the values.
+ *
+ * @return Task<Expected<std::vector<T>, E>>, or Task<Expected<void, E>> if T
+ *         is void.
+*/
+template<typename T, typename E>
+auto async_wait_expected(std::vector<Task<Expected<T, E>>> &&tasks) {
+    return detail::async_wait_expected_helper(std::move(tasks));
+}
+
+} // namespace coke
+
+/**
+ * Evaluate `expr` of type coke::Expected into a new variable `var`, and if it
+ * holds an error, co_return the error from the current coroutine, whose
+ * return type must be constructible from coke::Unexpected of the error. For
+ * example
+ *
+ *  coke::Task<coke::Expected<int>> add_one() {
+ *      COKE_CO_TRY(r, co_await load());
+ *      co_return *r + 1;
+ *  }
+*/
+#define COKE_CO_TRY(var, expr)                                      \
+    auto var = (expr);                                              \
+    static_assert(::coke::is_expected_v<decltype(var)>,             \
+                  "COKE_CO_TRY requires coke::Expected");           \
+    if (!var.has_value())                                           \
+        co_return ::coke::Unexpected(std::move(var).error())
+
+#endif // COKE_EXPECTED_H
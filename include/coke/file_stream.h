@@ -0,0 +1,299 @@
+/**
+ * Copyright 2024 Coke Project (https://github.com/kedixa/coke)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Authors: kedixa (https://github.com/kedixa)
+*/
+
+#ifndef COKE_FILE_STREAM_H
+#define COKE_FILE_STREAM_H
+
+#include <chrono>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <vector>
+
+#include "coke/fileio.h"
+#include "coke/future.h"
+#include "coke/latch.h"
+#include "coke/task.h"
+#include "coke/wait_group.h"
+
+namespace coke {
+
+struct AsyncFileReaderParams {
+    // Size of each pread
+    std::size_t buffer_size = 128 * 1024;
+
+    // Number of preads kept in flight ahead of the consumer, zero disables
+    // read-ahead and each buffer is read when it is needed.
+    std::size_t read_ahead  = 1;
+};
+
+/**
+ * @brief AsyncFileReader reads a file sequentially from `offset` with
+ *        buffering and read-ahead, the next `read_ahead` buffers are read
+ *        while the current buffer is consumed.
+ *
+ * A short read is treated as the end of file. When the reader is destroyed,
+ * the preads in flight are abandoned, and their buffers are released when
+ * they finish, so the fd must be valid until then.
+*/
+class AsyncFileReader {
+    using Buffer = std::vector<char>;
+
+    struct Pending {
+        std::shared_ptr<Buffer> buf;
+        Future<FileResult> fut;
+    };
+
+public:
+    explicit AsyncFileReader(int fd, off_t offset = 0,
+                             const AsyncFileReaderParams &params = {});
+
+    AsyncFileReader(const AsyncFileReader &) = delete;
+    AsyncFileReader &operator= (const AsyncFileReader &) = delete;
+
+    ~AsyncFileReader() = default;
+
+    /**
+     * @brief Read up to `count` bytes into `buf`, less than `count` bytes are
+     *        read only at the end of file.
+     *
+     * @return FileResult with the number of bytes read, zero means the end
+     *         of file.
+    */
+    Task<FileResult> read(void *buf, std::size_t count);
+
+    /**
+     * @brief Get the buffered data without copy, `chunk` is valid until the
+     *        next call to read or read_chunk.
+     *
+     * @return FileResult with the size of `chunk`, zero means the end of file.
+    */
+    Task<FileResult> read_chunk(std::string_view &chunk);
+
+    /**
+     * @brief The file offset of the next byte to be read.
+    */
+    off_t tell() const noexcept { return offset; }
+
+    int get_fd() const noexcept { return fd; }
+
+private:
+    Task<FileResult> fill();
+    void issue();
+    void stop_issue();
+
+private:
+    int fd;
+    off_t offset;
+    off_t read_offset;
+    AsyncFileReaderParams params;
+
+    bool stopped{false};
+    std::deque<Pending> pending;
+
+    std::shared_ptr<Buffer> cur;
+    std::size_t cur_pos{0};
+    std::size_t cur_len{0};
+
+    std::vector<std::shared_ptr<Buffer>> free_bufs;
+};
+
+struct AsyncFileWriterParams {
+    // Size of each buffer
+    std::size_t buffer_size  = 128 * 1024;
+
+    // The buffers are written out by one pwritev when `max_buffers` buffers
+    // are full.
+    std::size_t max_buffers  = 8;
+
+    // Call fdatasync after a flush when `sync_bytes` bytes are written since
+    // the last sync, or `sync_interval` has elapsed since the last sync. Zero
+    // disables them.
+    std::size_t sync_bytes   = 0;
+    std::chrono::milliseconds sync_interval{0};
+};
+
+/**
+ * @brief AsyncFileWriter writes a file sequentially from `offset`, small
+ *        writes are coalesced into buffers and written out by pwritev.
+ *
+ * The data buffered is lost if the writer is destroyed before flush. After an
+ * error, all the following operations fail with the same error.
+*/
+class AsyncFileWriter {
+    using Buffer = std::vector<char>;
+    using Clock = std::chrono::steady_clock;
+
+public:
+    explicit AsyncFileWriter(int fd, off_t offset = 0,
+                             const AsyncFileWriterParams &params = {});
+
+    AsyncFileWriter(const AsyncFileWriter &) = delete;
+    AsyncFileWriter &operator= (const AsyncFileWriter &) = delete;
+
+    ~AsyncFileWriter() = default;
+
+    /**
+     * @brief Append `count` bytes of `data`, it is written out when the
+     *        buffers are full.
+     *
+     * @return 0 on success, or a negative errno.
+    */
+    Task<int> write(const void *data, std::size_t count);
+
+    /**
+     * @brief Write out all the buffered data, and fdatasync if the periodic
+     *        sync condition is met.
+     *
+     * @return 0 on success, or a negative errno.
+    */
+    Task<int> flush();
+
+    /**
+     * @brief Write out all the buffered data and fdatasync.
+     *
+     * @return 0 on success, or a negative errno.
+    */
+    Task<int> sync();
+
+    /**
+     * @brief The file offset of the next byte to be appended.
+    */
+    off_t tell() const noexcept { return offset + (off_t)buffered; }
+
+    std::size_t buffered_size() const noexcept { return buffered; }
+
+    int get_fd() const noexcept { return fd; }
+
+private:
+    Task<int> write_out();
+    Task<int> do_sync();
+
+private:
+    int fd;
+    int error{0};
+    off_t offset;
+    AsyncFileWriterParams params;
+
+    std::size_t buffered{0};
+    std::size_t unsynced{0};
+    Clock::time_point last_sync;
+
+    std::vector<Buffer> bufs;
+    std::vector<Buffer> free_bufs;
+};
+
+struct CommitLogParams {
+    // Max number of records and bytes written by one pwritev, the records
+    // appended when the current batch is full go to the next batch.
+    std::size_t max_batch_records   = 1024;
+    std::size_t max_batch_bytes     = 1024 * 1024;
+
+    // Whether to fdatasync after each batch is written
+    bool sync                       = true;
+};
+
+/**
+ * @brief CommitLog is an append only log with group commit. The records
+ *        appended concurrently are written by one pwritev and one fdatasync,
+ *        and all the appenders of the batch resume together when it is
+ *        durable.
+ *
+ * While a batch is being written, the records appended meanwhile are
+ * collected into the next batch, so the number of syncs per second is bounded
+ * by the device, but not the number of records. The records are not copied,
+ * the appender is suspended until its record is written.
+ *
+ * After an error, all the following appends fail with the same error. Call
+ * `close` and wait for it before the CommitLog is destroyed.
+*/
+class CommitLog {
+    struct Batch {
+        Batch() : done(1) { }
+
+        std::vector<struct iovec> iov;
+        std::size_t bytes{0};
+        int result{0};
+        Latch done;
+    };
+
+public:
+    explicit CommitLog(int fd, off_t offset = 0,
+                       const CommitLogParams &params = {});
+
+    CommitLog(const CommitLog &) = delete;
+    CommitLog &operator= (const CommitLog &) = delete;
+
+    ~CommitLog() = default;
+
+    /**
+     * @brief Append `record` to the log and wait until it is written, and
+     *        synced if CommitLogParams::sync is true. The records of the
+     *        appends that have not resumed are written in the order they are
+     *        called.
+     *
+     * @return 0 on success, -EPIPE if the log is closed, or a negative errno.
+    */
+    Task<int> append(std::string_view record);
+
+    /**
+     * @brief Stop accepting new records, and wait until all the appended
+     *        records are written.
+    */
+    Task<> close();
+
+    /**
+     * @brief The file offset after the records written so far.
+    */
+    off_t tell() const {
+        std::lock_guard<std::mutex> lg(mtx);
+        return offset;
+    }
+
+    /**
+     * @brief The number of batches written, which is also the number of
+     *        fdatasync called if CommitLogParams::sync is true.
+    */
+    std::size_t get_batch_count() const {
+        std::lock_guard<std::mutex> lg(mtx);
+        return batch_count;
+    }
+
+private:
+    Task<> write_loop();
+
+private:
+    int fd;
+    CommitLogParams params;
+
+    mutable std::mutex mtx;
+    off_t offset;
+    int error{0};
+    bool closed{false};
+    bool writing{false};
+    std::size_t batch_count{0};
+    std::deque<std::shared_ptr<Batch>> batches;
+
+    WaitGroup writer;
+};
+
+} // namespace coke
+
+#endif // COKE_FILE_STREAM_H
@@ -51,6 +51,51 @@ FileAwaiter pwritev(int fd, const struct iovec *iov, int iovcnt, off_t offset);
 FileAwaiter fsync(int fd);
 FileAwaiter fdatasync(int fd);
 
+/**
+ * @brief Same as pread and pwrite, but `buf` is in the `buf_index`-th buffer
+ *        registered by `register_file_buffers`, which saves the kernel from
+ *        mapping the pages for each request. It is the same as pread and
+ *        pwrite if the io_uring backend is not in use.
+*/
+FileAwaiter pread_fixed(int fd, void *buf, std::size_t count, off_t offset,
+                        int buf_index);
+FileAwaiter pwrite_fixed(int fd, const void *buf, std::size_t count,
+                         off_t offset, int buf_index);
+
+/**
+ * @brief Register buffers to the io_uring backend for pread_fixed and
+ *        pwrite_fixed, at most one group of buffers can be registered at the
+ *        same time. It should be called when there is no file io in progress,
+ *        such as at startup.
+ *
+ * @return 0 on success, or a negative errno, -ENOTSUP if the io_uring
+ *         backend is not in use.
+*/
+int register_file_buffers(const struct iovec *iov, unsigned nr);
+
+/**
+ * @brief Unregister the buffers registered by register_file_buffers.
+ *
+ * @return See register_file_buffers.
+*/
+int unregister_file_buffers();
+
+/**
+ * @brief Get the file io backend actually in use, FIO_BACKEND_AIO or
+ *        FIO_BACKEND_IO_URING.
+*/
+int get_fio_backend();
+
+namespace detail {
+
+/**
+ * @brief Set the file io backend from GlobalSettings, see
+ *        GlobalSettings::fio_backend.
+*/
+void set_fio_backend(int backend, int uring_entries) noexcept;
+
+} // namespace detail
+
 } // namespace coke
 
 #endif // COKE_FILEIO_H
@@ -19,11 +19,54 @@
 #ifndef COKE_FUTURE_H
 #define COKE_FUTURE_H
 
+#include <concepts>
+#include <deque>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
 #include "coke/detail/future_base.h"
+#include "coke/condition.h"
 #include "coke/series.h"
 
 namespace coke {
 
+template<Cokeable Res>
+class SharedFuture;
+
+namespace detail {
+
+template<typename Res, typename F>
+struct FutureMapResult {
+    using type = std::invoke_result_t<F, Res>;
+};
+
+template<typename F>
+struct FutureMapResult<void, F> {
+    using type = std::invoke_result_t<F>;
+};
+
+/**
+ * @brief Set the result of `func()` to `promise`, or the exception it throws.
+*/
+template<Cokeable U, typename F>
+void future_set_result(Promise<U> &promise, F &&func) {
+    coke_try {
+        if constexpr (std::is_void_v<U>) {
+            func();
+            promise.set_value();
+        }
+        else {
+            promise.set_value(func());
+        }
+    }
+    coke_catch (...) {
+        promise.set_exception(std::current_exception());
+    }
+}
+
+} // namespace detail
+
 template<Cokeable Res>
 class Future {
     using State = detail::FutureState<Res>;
@@ -100,6 +143,14 @@ public:
         return state->wait_for(nsec);
     }
 
+    /**
+     * @brief Same as wait_for, but blocks until `deadline`.
+     * @pre valid() returns true.
+     */
+    Task<int> wait_until(SteadyTimePoint deadline) {
+        return state->wait_until(deadline);
+    }
+
     /**
      * @brief Notify the associated Promise to cancel the current process.
      * @pre valid() returns true.
@@ -147,6 +198,101 @@ public:
         state->remove_callback();
     }
 
+    /**
+     * @brief Move the state into a SharedFuture, which can be copied and
+     *        awaited by many coroutines.
+     * @post valid() returns false.
+    */
+    SharedFuture<Res> share() noexcept {
+        return SharedFuture<Res>(std::move(state));
+    }
+
+    /**
+     * @brief Register `func` as the continuation and return the Future of its
+     *        result. When this future is completed, `func` is called with it,
+     *        whether it is ready, broken or has an exception, and the value
+     *        returned or the exception thrown by `func` is set to the new
+     *        Future. No coroutine is created for it.
+     *
+     * `func` is called on the thread that completes this future, or
+     * immediately if it is already completed, so it should be short and
+     * never block. It is stored in the shared state without allocation if it
+     * is not larger than a few pointers.
+     *
+     * @pre valid() returns true, and then or map has not been called.
+     * @post valid() returns false.
+    */
+    template<typename F>
+        requires std::invocable<F, Future<Res>> &&
+                 Cokeable<std::invoke_result_t<F, Future<Res>>>
+    auto then(F &&func) -> Future<std::invoke_result_t<F, Future<Res>>> {
+        using U = std::invoke_result_t<F, Future<Res>>;
+
+        Promise<U> promise;
+        Future<U> fut = promise.get_future();
+        State *ptr = state.get();
+
+        // The continuation refers to this state until it is called, which is
+        // always done because the promise sets broken at last.
+        ptr->set_continuation(
+            [self = std::move(state), promise = std::move(promise),
+             func = std::forward<F>(func)] (detail::FutureStateBase *) mutable {
+                Future<Res> src(std::move(self));
+
+                detail::future_set_result(promise, [&] () -> U {
+                    return func(std::move(src));
+                });
+            }
+        );
+
+        return fut;
+    }
+
+    /**
+     * @brief Same as then, but `func` is called with the value only when this
+     *        future is ready, or without any argument if `Res` is void. The
+     *        exception is passed to the new Future, and it is broken if this
+     *        future is broken.
+     *
+     * @pre valid() returns true, and then or map has not been called.
+     * @post valid() returns false.
+    */
+    template<typename F>
+        requires Cokeable<typename detail::FutureMapResult<Res, F>::type>
+    auto map(F &&func) -> Future<typename detail::FutureMapResult<Res, F>::type> {
+        using U = typename detail::FutureMapResult<Res, F>::type;
+
+        Promise<U> promise;
+        Future<U> fut = promise.get_future();
+
+        // The promise of this future keeps the state alive when the
+        // continuation is called, it is not captured here.
+        std::shared_ptr<State> hold = std::move(state);
+        hold->set_continuation(
+            [promise = std::move(promise), func = std::forward<F>(func)]
+            (detail::FutureStateBase *base) mutable {
+                State *s = static_cast<State *>(base);
+                int st = s->get_state();
+
+                if (st == FUTURE_STATE_READY) {
+                    detail::future_set_result(promise, [&] () -> U {
+                        if constexpr (std::is_void_v<Res>)
+                            return func();
+                        else
+                            return func(std::move(s->get()));
+                    });
+                }
+                else if (st == FUTURE_STATE_EXCEPTION)
+                    promise.set_exception(s->get_exception());
+
+                // Otherwise the promise is destroyed with the continuation,
+                // and the new Future is broken.
+            }
+        );
+
+        return fut;
+    }
+
 private:
     /**
      * @brief Future can only be created by Promise.
@@ -162,6 +308,127 @@ private:
 }; // class Future
 
 
+/**
+ * @brief The awaiter of SharedFuture::wait, the result is one of the
+ *        coke::FUTURE_STATE_XXX like Future::wait_for. If the state is already
+ *        set when it is created, it is ready without any lock or allocation.
+*/
+class [[nodiscard]] SharedFutureAwaiter : public SleepAwaiter {
+public:
+    SharedFutureAwaiter(detail::FutureStateBase *state,
+                        detail::TimedWaitHelper helper)
+        : state(state)
+    {
+        if (state->get_state() == FUTURE_STATE_NOTSET)
+            SleepAwaiter::operator=(state->create_waiter(helper));
+    }
+
+    int await_resume() noexcept {
+        int ret = SleepAwaiter::await_resume();
+        int st = state->get_state();
+
+        if (st != FUTURE_STATE_NOTSET)
+            return st;
+
+        return ret == SLEEP_SUCCESS ? FUTURE_STATE_TIMEOUT : ret;
+    }
+
+private:
+    detail::FutureStateBase *state;
+};
+
+
+/**
+ * @brief SharedFuture refers to the same state as the Future it is created
+ *        from, it can be copied, and all the copies can be awaited and read
+ *        concurrently. The value is never moved out, get() returns a const
+ *        reference to it.
+*/
+template<Cokeable Res>
+class SharedFuture {
+    using State = detail::FutureState<Res>;
+
+public:
+    SharedFuture() = default;
+    SharedFuture(const SharedFuture &) = default;
+    SharedFuture(SharedFuture &&) = default;
+    SharedFuture &operator=(const SharedFuture &) = default;
+    SharedFuture &operator=(SharedFuture &&) = default;
+    ~SharedFuture() = default;
+
+    /**
+     * @brief Same as fut.share().
+    */
+    SharedFuture(Future<Res> &&fut) noexcept : SharedFuture(fut.share()) { }
+
+    bool valid() const noexcept { return (bool)state; }
+
+    /**
+     * @brief See Future::get_state.
+     * @pre valid() returns true.
+    */
+    int get_state() const noexcept { return state->get_state(); }
+
+    bool ready() const noexcept {
+        return state->get_state() == FUTURE_STATE_READY;
+    }
+
+    bool broken() const noexcept {
+        return state->get_state() == FUTURE_STATE_BROKEN;
+    }
+
+    bool has_exception() const noexcept {
+        return state->get_state() == FUTURE_STATE_EXCEPTION;
+    }
+
+    /**
+     * @brief Blocks until ready, broken or exception, see Future::wait_for.
+     *        The awaiter should be awaited immediately, and this SharedFuture
+     *        should be alive until it returns.
+     * @pre valid() returns true.
+    */
+    SharedFutureAwaiter wait() const {
+        return SharedFutureAwaiter(state.get(), detail::TimedWaitHelper{});
+    }
+
+    SharedFutureAwaiter wait_for(const NanoSec &nsec) const {
+        return SharedFutureAwaiter(state.get(), detail::TimedWaitHelper{nsec});
+    }
+
+    SharedFutureAwaiter wait_until(SteadyTimePoint deadline) const {
+        return SharedFutureAwaiter(state.get(),
+                                   detail::TimedWaitHelper{deadline});
+    }
+
+    /**
+     * @brief Get the value set by the Promise, if there is an exception set
+     *        by the Promise, it will be rethrow. It can be called any times
+     *        by any copies.
+     * @pre ready() or has_exception() returns true.
+    */
+    decltype(auto) get() const {
+        if constexpr (std::is_void_v<Res>)
+            return std::as_const(*state).get();
+        else
+            return static_cast<const Res &>(std::as_const(*state).get());
+    }
+
+    std::exception_ptr get_exception() const {
+        return state->get_exception();
+    }
+
+private:
+    SharedFuture(std::shared_ptr<State> ptr) noexcept
+        : state(std::move(ptr))
+    { }
+
+    friend Future<Res>;
+
+private:
+    std::shared_ptr<State> state;
+};
+
+
 template<Cokeable Res>
 class Promise {
     using State = detail::FutureState<Res>;
@@ -295,15 +562,15 @@ Task<void> wait_futures(std::vector<Future<T>> &futs, std::size_t n) {
 }
 
 /**
- * @brief Wait until at least `n` futures is completed, or `nsec` timeout.
+ * @brief Wait until at least `n` futures is completed, or `deadline`.
  * @pre No callback has been set for any future.
  * @return coke::Task<int> that should be co_await immediately.
  * @retval coke::TOP_SUCCESS if at least `n` futures is completed.
- * @retval coke::TOP_TIMEOUT if `nsec` timeout.
+ * @retval coke::TOP_TIMEOUT if `deadline` is reached.
 */
 template<Cokeable T>
-Task<int> wait_futures_for(std::vector<Future<T>> &futs,
-                           std::size_t n, NanoSec nsec) {
+Task<int> wait_futures_until(std::vector<Future<T>> &futs,
+                             std::size_t n, SteadyTimePoint deadline) {
     if (n == 0)
         co_return TOP_SUCCESS;
     else if (n > futs.size())
@@ -318,7 +585,7 @@ Task<int> wait_futures_for(std::vector<Future<T>> &futs,
         });
     }
 
-    ret = co_await helper.wait_for(nsec);
+    ret = co_await helper.wait_until(deadline);
 
     for (Future<T> &fut : futs) {
         fut.remove_callback();
@@ -330,6 +597,156 @@ Task<int> wait_futures_for(std::vector<Future<T>> &futs,
         co_return TOP_TIMEOUT;
 }
 
+/**
+ * @brief Wait until at least `n` futures is completed, or `nsec` timeout.
+ * @pre No callback has been set for any future.
+ * @return coke::Task<int> that should be co_await immediately.
+ * @retval coke::TOP_SUCCESS if at least `n` futures is completed.
+ * @retval coke::TOP_TIMEOUT if `nsec` timeout.
+*/
+template<Cokeable T>
+Task<int> wait_futures_for(std::vector<Future<T>> &futs,
+                           std::size_t n, NanoSec nsec) {
+    return wait_futures_until(futs, n, detail::TimedWaitHelper::now() + nsec);
+}
+
+
+/**
+ * @brief FutureSet watches a group of futures, each future's callback is set
+ *        once when it is added, and the indices of the completed futures are
+ *        queued in completion order, so getting the next completed one costs
+ *        O(1) no matter how many futures are in the set.
+ *
+ * The futures must have no callback set. `add` must not be called
+ * concurrently with itself, but `next` can be called by many coroutines.
+*/
+template<Cokeable T>
+class FutureSet {
+public:
+    FutureSet() = default;
+
+    /**
+     * @brief FutureSet is neither copyable nor movable, because the callbacks
+     *        refer to it.
+    */
+    FutureSet(const FutureSet &) = delete;
+    FutureSet &operator= (const FutureSet &) = delete;
+
+    ~FutureSet() {
+        for (Future<T> &fut : futs)
+            fut.remove_callback();
+    }
+
+    /**
+     * @brief Add `fut` to the set and return its index, which is also the
+     *        number of futures added before it.
+     * @pre fut.valid() returns true.
+    */
+    std::size_t add(Future<T> &&fut) {
+        std::size_t idx = futs.size();
+
+        {
+            std::lock_guard<std::mutex> lg(mtx);
+            total = idx + 1;
+        }
+
+        futs.push_back(std::move(fut));
+        futs.back().set_callback([this, idx](int) {
+            std::lock_guard<std::mutex> lg(mtx);
+            ready.push_back(idx);
+            cond.notify_one();
+        });
+
+        return idx;
+    }
+
+    /**
+     * @brief Wait for the next completed future and store its index into
+     *        `index`, each index is got only once.
+     *
+     * @return coke::Task<int> that should be co_await immediately.
+     * @retval coke::TOP_SUCCESS if a completed future is got.
+     * @retval coke::TOP_CLOSED if all the added futures have been got.
+     * @retval coke::TOP_ABORTED if the process is about to exit.
+    */
+    Task<int> next(std::size_t &index) {
+        return next_impl(detail::TimedWaitHelper{}, index);
+    }
+
+    /**
+     * @brief Same as next, but may return coke::TOP_TIMEOUT after `nsec`.
+    */
+    Task<int> next_for(std::size_t &index, NanoSec nsec) {
+        return next_impl(detail::TimedWaitHelper{nsec}, index);
+    }
+
+    /**
+     * @brief Same as next, but may return coke::TOP_TIMEOUT at `deadline`.
+    */
+    Task<int> next_until(std::size_t &index, SteadyTimePoint deadline) {
+        return next_impl(detail::TimedWaitHelper{deadline}, index);
+    }
+
+    /**
+     * @brief Get the future at `index`, the reference is valid until the set
+     *        is destroyed.
+    */
+    Future<T> &operator[] (std::size_t index) { return futs[index]; }
+
+    std::size_t size() const noexcept { return futs.size(); }
+
+    /**
+     * @brief The number of completed futures not got by next yet.
+    */
+    std::size_t ready_count() const {
+        std::lock_guard<std::mutex> lg(mtx);
+        return ready.size() - head;
+    }
+
+private:
+    Task<int> next_impl(detail::TimedWaitHelper helper, std::size_t &index) {
+        std::unique_lock<std::mutex> lk(mtx);
+        int ret;
+
+        while (head == ready.size()) {
+            if (got == total)
+                co_return TOP_CLOSED;
+
+            if (helper.infinite())
+                ret = co_await cond.wait(lk);
+            else
+                ret = co_await cond.wait_until(lk, helper.deadline());
+
+            if (ret != TOP_SUCCESS && head == ready.size())
+                co_return ret;
+        }
+
+        index = ready[head++];
+        got++;
+
+        // Reuse the space once all the queued indices are got
+        if (head == ready.size()) {
+            ready.clear();
+            head = 0;
+        }
+
+        co_return TOP_SUCCESS;
+    }
+
+private:
+    mutable std::mutex mtx;
+    Condition cond;
+
+    // Protected by mtx, ready[head, ...) are not got by next yet
+    std::vector<std::size_t> ready;
+    std::size_t head{0};
+    std::size_t got{0};
+    std::size_t total{0};
+
+    // Deque keeps the references valid when adding
+    std::deque<Future<T>> futs;
+};
+
 } // namespace coke
 
 #endif // COKE_FUTURE_H
@@ -68,6 +68,13 @@ constexpr int TOP_ABORTED = 2;
 // TOP_CLOSED is used when using an asynchronous container to indicate that the
 // current operation failed because the container has been closed.
 constexpr int TOP_CLOSED = 3;
+// TOP_STOPPED is used when an operation observing a coke::StopToken gives up
+// because stop is requested, such as Queue::pop(u, token).
+constexpr int TOP_STOPPED = 4;
+
+// file io backend, see GlobalSettings::fio_backend
+constexpr int FIO_BACKEND_AIO = 0;
+constexpr int FIO_BACKEND_IO_URING = 1;
 
 
 struct EndpointParams {
@@ -89,8 +96,64 @@ struct GlobalSettings {
     int handler_threads                 = 20;
     int compute_threads                 = -1;
     int fio_max_events                  = 4096;
+
+    // Backend of coke::pread, coke::pwrite etc. FIO_BACKEND_IO_URING takes
+    // effect only when coke is built with COKE_ENABLE_IO_URING, and falls
+    // back to the Workflow's AIO if io_uring is not available. The ring has
+    // `fio_uring_entries` submission entries, rounded up to a power of 2.
+    int fio_backend                     = FIO_BACKEND_AIO;
+    int fio_uring_entries               = 256;
+
     const char *resolv_conf_path        = "/etc/resolv.conf";
     const char *hosts_path              = "/etc/hosts";
+
+    // Number of shards of the timer maps used by sleep with id or address,
+    // and of the internal mutex table, rounded up to a power of 2. Zero means
+    // decided by hardware concurrency. Only takes effect when library_init
+    // is called before any coroutine is started.
+    int timer_map_shards                = 0;
+    int mutex_table_shards              = 0;
+
+    // Sleep at least `timer_wheel_threshold` milliseconds goes to a coarse
+    // grained timing wheel instead of the poller, negative disables it. The
+    // wheel's precision is `timer_wheel_tick` milliseconds.
+    int timer_wheel_threshold           = -1;
+    int timer_wheel_tick                = 10;
+
+    // Round the deadlines of sleep and timed waits up to a multiple of
+    // `timer_slack` milliseconds, so that close deadlines share wakeups.
+    // Zero disables it.
+    int timer_slack                     = 0;
+
+    // Collect the lock wait histogram of the timer maps used by sleep with id
+    // or address, see coke::get_sleep_map_stats_by_id.
+    bool timer_lock_timing              = false;
+
+    // Spin at most `lock_spin_count` rounds before parking when Mutex,
+    // SharedMutex or Semaphore is contended, which is cheaper when the
+    // critical sections are very short. Zero means park immediately.
+    int lock_spin_count                 = 0;
+
+    // Compute the deadlines of the timed waits and the ttl of coke::Cache
+    // from coke::CoarseSteadyClock, which saves a clock read per operation,
+    // but the deadlines may be one interval of the coarse clock earlier. It
+    // takes effect only when the coarse clock is started, see
+    // coke::start_coarse_clock.
+    bool timed_wait_coarse_clock        = false;
+
+    // CPU affinity of the poller, handler and compute threads, applied by
+    // library_init. Each one is a cpu list such as "0-7,16-23", nullptr or
+    // empty means not changed. A `*_numa_node` greater than or equal to zero
+    // binds the threads to the cpus of the numa node instead. The handler
+    // threads are created with the pollers' affinity if theirs is not set,
+    // so that they stay on the same node as the pollers. Binding is best
+    // effort, see coke::get_affinity_failures.
+    const char *poller_cpus             = nullptr;
+    const char *handler_cpus            = nullptr;
+    const char *compute_cpus            = nullptr;
+    int poller_numa_node                = -1;
+    int handler_numa_node               = -1;
+    int compute_numa_node               = -1;
 };
 
 
@@ -120,6 +183,31 @@ constexpr uint64_t INVALID_UNIQUE_ID = 0;
 */
 bool prevent_recursive_stack(bool clear = false);
 
+/**
+ * @brief Bind the calling thread to `cpus`, a cpu list such as "0-7,16-23".
+ * @return 0 on success, or -1 with errno set, EINVAL if `cpus` is invalid.
+*/
+int set_thread_affinity(const char *cpus);
+
+/**
+ * @brief Bind the calling thread to the cpus of numa node `node`.
+ * @return 0 on success, or -1 with errno set, such as ENOENT if there is no
+ *         such node.
+*/
+int set_thread_numa_node(int node);
+
+/**
+ * @brief Get the number of threads that library_init failed to bind to the
+ *        cpus given in GlobalSettings, they keep the inherited affinity.
+*/
+int get_affinity_failures() noexcept;
+
+/**
+ * @brief Set the number of rounds to spin before parking on a contended lock,
+ *        it can be changed at any time, see GlobalSettings::lock_spin_count.
+*/
+void set_lock_spin_count(int n) noexcept;
+
 } // namespace coke
 
 #endif // COKE_GLOBAL_H
@@ -19,9 +19,17 @@
 #ifndef COKE_GO_H
 #define COKE_GO_H
 
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <optional>
 #include <string_view>
+#include <vector>
 
 #include "coke/detail/go_task.h"
+#include "coke/sleep.h"
+#include "coke/wait.h"
 
 namespace coke {
 
@@ -30,6 +38,55 @@ namespace coke {
 */
 constexpr std::string_view GO_DEFAULT_QUEUE{"coke:go"};
 
+/**
+ * @brief ExecQueue name used by coke::exec_yield.
+*/
+constexpr std::string_view YIELD_EXEC_QUEUE{"coke:yield"};
+
+/**
+ * @brief Params of a named go queue, see coke::set_go_queue_params.
+*/
+struct GoQueueParams {
+    // Max number of tasks of the queue running at the same time, the others
+    // wait in FIFO order until a running one finishes. Zero means no limit.
+    std::size_t max_concurrency = 0;
+};
+
+/**
+ * @brief Statistics of a named go queue, only collected after the queue is
+ *        configured by coke::set_go_queue_params.
+*/
+struct GoQueueStats {
+    uint64_t submit_count{0};
+    uint64_t start_count{0};
+
+    // Number of tasks submitted but not started, including the ones waiting
+    // for the max_concurrency limit
+    std::size_t depth{0};
+    std::size_t running{0};
+
+    // The time between submitted and started
+    std::chrono::nanoseconds total_wait{0};
+    std::chrono::nanoseconds max_wait{0};
+};
+
+/**
+ * @brief Set the params of the queue with `name`, and start collecting its
+ *        statistics. It can be called at any time, the new limit applies to
+ *        the tasks created after it returns, and the parked tasks are
+ *        started if the limit is raised.
+ *
+ * All the go queues are drained by the same compute threads, one tenant
+ * flooding its own queue can only occupy `max_concurrency` of them.
+*/
+void set_go_queue_params(const std::string &name, const GoQueueParams &params);
+
+/**
+ * @brief Get the statistics of the queue with `name`.
+ * @return false if the queue is not configured by set_go_queue_params.
+*/
+bool get_go_queue_stats(const std::string &name, GoQueueStats &stats);
+
 template<typename T>
 class [[nodiscard]] GoAwaiter : public AwaiterBase {
 public:
@@ -38,13 +95,14 @@ public:
     GoAwaiter(ExecQueue *queue, Executor *executor,
               FUNC &&func, ARGS&&... args)
     {
-        std::function<T()> go(
-            [func=std::forward<FUNC>(func), ...args=std::forward<ARGS>(args)]() mutable {
-                return std::invoke(func, std::unwrap_reference_t<ARGS>(args)...);
-            }
-        );
+        // Return T to copy out the result if func returns a reference
+        auto go = [func=std::forward<FUNC>(func),
+                   ...args=std::forward<ARGS>(args)]() mutable -> T {
+            return std::invoke(func, std::unwrap_reference_t<ARGS>(args)...);
+        };
 
-        this->go_task = new detail::GoTask<T>(queue, executor, std::move(go));
+        using task_t = detail::GoTask<T, decltype(go)>;
+        this->go_task = new task_t(queue, executor, std::move(go));
         go_task->set_awaiter(this);
 
         this->set_task(go_task);
@@ -54,7 +112,9 @@ public:
     GoAwaiter(ExecQueue *queue, Executor *executor)
         requires std::is_same_v<T, void>
     {
-        this->go_task = new detail::GoTask<T>(queue, executor, nullptr);
+        using task_t = detail::GoTask<void, detail::GoNoop>;
+
+        this->go_task = new task_t(queue, executor, detail::GoNoop{});
         go_task->set_awaiter(this);
         this->set_task(go_task);
     }
@@ -87,8 +147,57 @@ public:
             return std::move(go_task->get_result());
     }
 
-private:
-    detail::GoTask<T> *go_task;
+protected:
+    detail::GoTaskResult<T> *go_task;
+};
+
+
+/**
+ * @brief Result of coke::go_until, `state` is coke::TOP_SUCCESS if the
+ *        function is called and `value` is its return value, or
+ *        coke::TOP_TIMEOUT, coke::TOP_STOPPED if the function is dropped.
+*/
+template<typename T>
+struct GoResult {
+    int state;
+    std::optional<T> value;
+};
+
+template<>
+struct GoResult<void> {
+    int state;
+};
+
+/**
+ * @brief GoUntilAwaiter is a GoAwaiter that drops the function if it is
+ *        still in the queue when the deadline passes or the token is
+ *        requested to stop. The check happens when the task reaches the
+ *        compute thread, so the awaiter is resumed at that time.
+*/
+template<typename T>
+class [[nodiscard]] GoUntilAwaiter : public GoAwaiter<T> {
+public:
+    template<typename FUNC, typename... ARGS>
+        requires std::invocable<FUNC, ARGS...>
+    GoUntilAwaiter(SteadyTimePoint deadline, StopToken *token,
+                   ExecQueue *queue, Executor *executor,
+                   FUNC &&func, ARGS&&... args)
+        : GoAwaiter<T>(queue, executor, std::forward<FUNC>(func),
+                       std::forward<ARGS>(args)...)
+    {
+        this->go_task->set_drop_policy(deadline, token);
+    }
+
+    GoResult<T> await_resume() {
+        int state = this->go_task->get_drop_state();
+
+        if constexpr (std::is_void_v<T>)
+            return GoResult<T>{state};
+        else if (state != TOP_SUCCESS)
+            return GoResult<T>{state, std::nullopt};
+        else
+            return GoResult<T>{state, std::move(this->go_task->get_result())};
+    }
 };
 
 
@@ -121,6 +230,107 @@ auto go(FUNC &&func, ARGS&&... args) {
               std::forward<ARGS>(args)...);
 }
 
+/**
+ * @brief Run `func(args...)` in the compute thread pool with queue `name` like
+ *        coke::go, but drop it if it is not started before `deadline`, so that
+ *        stale jobs do not waste cpu when the caller has already given up.
+ * @return GoUntilAwaiter, which returns coke::GoResult<T>.
+*/
+template<typename FUNC, typename... ARGS>
+    requires std::invocable<FUNC, ARGS...>
+auto go_until(SteadyTimePoint deadline, const std::string &name,
+              FUNC &&func, ARGS&&... args) {
+    using result_t = std::remove_cvref_t<std::invoke_result_t<FUNC, ARGS...>>;
+
+    return GoUntilAwaiter<result_t>(deadline, nullptr,
+                                    detail::get_exec_queue(name),
+                                    detail::get_compute_executor(),
+                                    std::forward<FUNC>(func),
+                                    std::forward<ARGS>(args)...);
+}
+
+/**
+ * @brief Same as previous go_until, but also drop the function if `token` is
+ *        requested to stop before it starts. The token must be alive until the
+ *        awaiter is resumed, use coke::SteadyTimePoint::max() for no deadline.
+*/
+template<typename FUNC, typename... ARGS>
+    requires std::invocable<FUNC, ARGS...>
+auto go_until(SteadyTimePoint deadline, StopToken &token,
+              const std::string &name, FUNC &&func, ARGS&&... args) {
+    using result_t = std::remove_cvref_t<std::invoke_result_t<FUNC, ARGS...>>;
+
+    return GoUntilAwaiter<result_t>(deadline, &token,
+                                    detail::get_exec_queue(name),
+                                    detail::get_compute_executor(),
+                                    std::forward<FUNC>(func),
+                                    std::forward<ARGS>(args)...);
+}
+
+namespace detail {
+
+template<typename T, typename FUNC>
+auto go_batch_helper(ExecQueue *queue, Executor *executor,
+                     std::vector<FUNC> funcs)
+    -> Task<typename MValueHelper<T>::RetType>
+{
+    std::size_t n = funcs.size();
+    MValueHelper<T> v(n);
+
+    auto run = [&funcs, &v](std::size_t first, std::size_t last) {
+        for (std::size_t i = first; i < last; i++) {
+            if constexpr (std::is_void_v<T>)
+                std::invoke(funcs[i]);
+            else
+                *v.slot(i) = std::invoke(funcs[i]);
+        }
+    };
+
+    // One request for each compute thread, instead of one for each job
+    std::size_t k = std::min(n, get_compute_threads());
+    std::vector<GoAwaiter<void>> awaiters;
+    awaiters.reserve(k);
+
+    for (std::size_t j = 0; j < k; j++)
+        awaiters.emplace_back(queue, executor, run, n * j / k, n * (j + 1) / k);
+
+    if (k > 0)
+        co_await async_wait(std::move(awaiters));
+
+    co_return v.get_value();
+}
+
+} // namespace detail
+
+/**
+ * @brief Run a batch of jobs in the compute thread pool, each `funcs[i]()` is
+ *        called exactly once, and the jobs are packed into at most one
+ *        request per compute thread, so a large batch only needs a few
+ *        queue operations.
+ *
+ * @param funcs Callable objects without parameters, they may be called
+ *        concurrently in different threads.
+ * @return coke::Task<std::vector<T>>, where T is the return type of the jobs,
+ *         the i-th result comes from funcs[i]. Returns coke::Task<void> if T
+ *         is void.
+*/
+template<typename FUNC>
+    requires std::invocable<FUNC&>
+auto go_batch(ExecQueue *queue, Executor *executor, std::vector<FUNC> funcs) {
+    using result_t = std::remove_cvref_t<std::invoke_result_t<FUNC&>>;
+
+    return detail::go_batch_helper<result_t>(queue, executor, std::move(funcs));
+}
+
+template<typename FUNC>
+    requires std::invocable<FUNC&>
+auto go_batch(const std::string &name, std::vector<FUNC> funcs) {
+    auto *queue = detail::get_exec_queue(name);
+    auto *executor = detail::get_compute_executor();
+
+    return go_batch(queue, executor, std::move(funcs));
+}
+
 /**
  * @brief Switch to a thread with `queue` and `executor`
 */
@@ -144,6 +354,61 @@ inline auto switch_go_thread() {
     return switch_go_thread(std::string(GO_DEFAULT_QUEUE));
 }
 
+/**
+ * @brief Switch back to a handler thread, the counterpart of switch_go_thread,
+ *        so that the following network tasks are not issued from the compute
+ *        threads. It costs the same as coke::yield, and does nothing if the
+ *        current thread is already known to be a handler thread.
+*/
+inline SleepAwaiter switch_handler_thread() {
+    if (detail::in_handler_thread())
+        return SleepAwaiter();
+
+    return yield();
+}
+
+namespace detail {
+
+template<typename T>
+Task<T> go_scoped_helper(GoAwaiter<T> awaiter) {
+    if constexpr (std::is_void_v<T>) {
+        co_await std::move(awaiter);
+        co_await switch_handler_thread();
+    }
+    else {
+        T result = co_await std::move(awaiter);
+        co_await switch_handler_thread();
+        co_return result;
+    }
+}
+
+} // namespace detail
+
+/**
+ * @brief Scoped form of switch_go_thread, run `func(args...)` in the compute
+ *        thread pool with queue `name`, and then resume the awaiting coroutine
+ *        on a handler thread, so the compute part never leaks into the code
+ *        after it.
+ * @return coke::Task<T>, where T is the return type of func.
+*/
+template<typename FUNC, typename... ARGS>
+    requires std::invocable<FUNC, ARGS...>
+auto go_scoped(const std::string &name, FUNC &&func, ARGS&&... args) {
+    return detail::go_scoped_helper(go(name, std::forward<FUNC>(func),
+                                       std::forward<ARGS>(args)...));
+}
+
+/**
+ * @brief Yield current coroutine without creating a timer. Unlike coke::yield,
+ *        the coroutine is resumed in the compute thread pool, which only needs
+ *        a queue operation instead of a round trip through the poller.
+*/
+inline auto exec_yield() {
+    auto *queue = detail::get_yield_exec_queue();
+    auto *executor = detail::get_compute_executor();
+    return switch_go_thread(queue, executor);
+}
+
 } // namespace coke
 
 #endif // COKE_GO_H
@@ -0,0 +1,143 @@
+/**
+ * Copyright 2024 Coke Project (https://github.com/kedixa/coke)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Authors: kedixa (https://github.com/kedixa)
+*/
+
+#ifndef COKE_HTTP_CACHE_H
+#define COKE_HTTP_CACHE_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "coke/http/http_client.h"
+#include "coke/single_flight.h"
+
+namespace coke {
+
+struct HttpCacheParams {
+    // The max total size of the cached responses, split evenly into
+    // `shards` LRU lists, each with its own lock.
+    std::size_t max_bytes   = 64 * 1024 * 1024;
+    std::size_t shards      = 16;
+
+    // Milliseconds a response is fresh if it has no Cache-Control max-age.
+    // Zero means it must be revalidated before used, so only responses with
+    // ETag are cached in that case.
+    int default_ttl         = 0;
+};
+
+/**
+ * @brief A response kept by HttpCache, it is shared by the callers and must
+ *        not be modified. The body is decoded if it is chunked.
+*/
+struct HttpCachedResponse {
+    int state{STATE_UNDEFINED};
+    int error{0};
+
+    std::string status_code;
+    std::vector<std::pair<std::string, std::string>> headers;
+    std::string body;
+};
+
+using HttpCacheResult = std::shared_ptr<const HttpCachedResponse>;
+
+struct HttpCacheStats {
+    // Requests served by fresh responses in cache
+    uint64_t hits{0};
+    // Requests not served by fresh responses, and the requests sent to the
+    // server for them, the others waited for the same url's request in
+    // flight.
+    uint64_t misses{0};
+    uint64_t loads{0};
+    // Stale responses that are still valid, that is 304 Not Modified
+    uint64_t revalidated{0};
+
+    uint64_t entries{0};
+    uint64_t bytes{0};
+};
+
+/**
+ * @brief In memory cache of GET responses in front of HttpClient.
+ *
+ * A successful 200 response is cached by url, unless its Cache-Control has
+ * no-store. It is fresh for max-age seconds, or no-cache means it is always
+ * stale. A stale response with ETag is revalidated by If-None-Match. The
+ * concurrent misses of the same url share one request. Vary is not
+ * supported, and the request headers are not part of the key.
+ *
+ *  coke::HttpCache cache;
+ *  coke::HttpCacheResult res = co_await cache.get(client, url);
+ *  if (res->state == coke::STATE_SUCCESS)
+ *      use(res->body);
+*/
+class HttpCache {
+    struct Shard;
+
+public:
+    explicit HttpCache(const HttpCacheParams &params = HttpCacheParams());
+
+    /**
+     * @pre No request is in flight.
+    */
+    ~HttpCache();
+
+    HttpCache(const HttpCache &) = delete;
+    HttpCache &operator= (const HttpCache &) = delete;
+
+    /**
+     * @brief GET `url` by `client`, or from cache. The client must be alive
+     *        until the returned Task is finished.
+     *
+     * @param headers Extra headers of the request.
+     * @return The response, never nullptr except when the process is about to
+     *         exit. Check its state before use.
+    */
+    Task<HttpCacheResult> get(HttpClient &client, std::string url,
+                              HttpClient::HttpHeader headers = {});
+
+    /**
+     * @brief Remove the cached response of `url`.
+    */
+    bool remove(const std::string &url);
+
+    void clear();
+
+    HttpCacheStats get_stats() const;
+
+private:
+    Task<HttpCacheResult> load(HttpClient &client, const std::string &url,
+                               const HttpClient::HttpHeader &headers);
+
+    Shard &get_shard(const std::string &url);
+
+private:
+    HttpCacheParams params;
+    std::vector<std::unique_ptr<Shard>> shards;
+    SingleFlight<std::string, HttpCacheResult> flight;
+
+    std::atomic<uint64_t> hits{0};
+    std::atomic<uint64_t> misses{0};
+    std::atomic<uint64_t> loads{0};
+    std::atomic<uint64_t> revalidated{0};
+};
+
+} // namespace coke
+
+#endif // COKE_HTTP_CACHE_H
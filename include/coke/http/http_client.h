@@ -19,13 +19,22 @@
 #ifndef COKE_HTTP_CLIENT_H
 #define COKE_HTTP_CLIENT_H
 
+#include <cerrno>
+#include <cstdint>
+#include <map>
+#include <memory>
 #include <vector>
 #include <utility>
 #include <string>
+#include <string_view>
 
+#include "coke/async_generator.h"
+#include "coke/global.h"
 #include "coke/net/network.h"
+#include "coke/task.h"
 
 #include "workflow/HttpMessage.h"
+#include "workflow/URIParser.h"
 
 namespace coke {
 
@@ -42,8 +51,83 @@ struct HttpClientParams {
 
     int redirect_max        = 0;
     std::string proxy;
+
+    // Endpoint params of each host, which override the global
+    // GlobalSettings::endpoint_params for connections to the host, such as
+    // max_connections and the timeouts. The key is the host name without
+    // port. The params are process wide, and the latest client created with
+    // params of a host wins.
+    std::map<std::string, EndpointParams> host_params;
+
+    // Collect the statistics of each host requested by this client, see
+    // coke::get_http_host_stats. The hosts in `host_params` are always
+    // collected.
+    bool collect_host_stats = false;
+
+    // Add `Accept-Encoding` of the supported codings to the requests which do
+    // not have one, the response body can be decoded by
+    // coke::http_decode_body. It takes no effect when coke is built without
+    // content encoding support, see coke/http/http_encoding.h.
+    bool accept_encoding    = false;
+
+    // The following params are used by HttpClient::hedged_request only.
+
+    // Send at most `hedge_max` backup requests when the previous one has not
+    // finished for a while, which is the `hedge_percentile` of the latencies
+    // of the recent requests of this client, or `hedge_delay` milliseconds
+    // before enough latencies are collected.
+    int hedge_max           = 1;
+    int hedge_delay         = 50;
+    double hedge_percentile = 0.95;
+
+    // Retry budget shared by all the hedged requests of this client, which is
+    // a token bucket. Each request deposits `retry_budget_ratio` tokens, at
+    // most `retry_budget_burst` tokens are saved, and each backup request or
+    // retry takes one token, so that the extra load stays in proportion to
+    // the normal load even when the backend is failing.
+    double retry_budget_ratio = 0.1;
+    int retry_budget_burst    = 10;
 };
 
+/**
+ * @brief Statistics of the requests to a host, collected by HttpClient.
+*/
+struct HttpHostStats {
+    // The max_connections in HttpClientParams::host_params, zero if the host
+    // uses the global params.
+    std::size_t max_connections{0};
+
+    // Number of requests that are created but not finished yet, and the max
+    // of it. When `active` exceeds `max_connections`, the exceeded requests
+    // are waiting for a free connection.
+    uint64_t active{0};
+    uint64_t max_active{0};
+
+    uint64_t total{0};
+    uint64_t success{0};
+    // Requests failed because of timeout when waiting for a free connection
+    uint64_t wait_timeouts{0};
+    // Requests failed because of other errors
+    uint64_t errors{0};
+};
+
+/**
+ * @brief Get the statistics of `host`, return false if there is no client
+ *        collecting statistics of it.
+*/
+bool get_http_host_stats(const std::string &host, HttpHostStats &stats);
+
+/**
+ * @brief Get the statistics of all the collected hosts.
+*/
+std::map<std::string, HttpHostStats> get_all_http_host_stats();
+
+
+namespace detail {
+
+struct HttpHedgeState;
+
+} // namespace detail
 
 class HttpClient {
 public:
@@ -52,11 +136,48 @@ public:
     using AwaiterType = HttpAwaiter;
     using HttpHeader = std::vector<std::pair<std::string, std::string>>;
 
+    static constexpr std::size_t HTTP_STREAM_RANGE_SIZE = 4 * 1024 * 1024;
+
+    /**
+     * @brief Endpoint is a url prepared by HttpClient::prepare. The url, the
+     *        proxy and the Proxy-Authorization header are parsed once, and
+     *        reused by all the requests to the endpoint.
+     *
+     * An Endpoint should only be used by the client which prepared it, and
+     * it is invalidated when that client is destroyed. It can be shared by
+     * multiple coroutines.
+    */
+    class Endpoint {
+    public:
+        Endpoint() = default;
+
+        /**
+         * @brief Return 0 if the url is parsed successfully, or the error
+         *        code, the requests to an invalid endpoint fail with it.
+        */
+        int get_error() const noexcept { return error; }
+
+        bool valid() const noexcept { return error == 0; }
+
+        const std::string &get_url() const noexcept { return url; }
+
+    private:
+        std::string url;
+        std::string request_uri;
+        std::string proxy_auth;
+        ParsedURI uri;
+        ParsedURI proxy_uri;
+        void *counter{nullptr};
+        bool https{false};
+        bool has_proxy{false};
+        int error{EINVAL};
+
+        friend class HttpClient;
+    };
+
 public:
     explicit
-    HttpClient(const HttpClientParams &params = HttpClientParams())
-        : params(params)
-    { }
+    HttpClient(const HttpClientParams &params = HttpClientParams());
 
     virtual ~HttpClient() = default;
 
@@ -68,14 +189,119 @@ public:
         return create_task(url, &req);
     }
 
+    /**
+     * @brief Send a request with `method`, `headers` and `body`. The request
+     *        takes the ownership of `body` and sends it without copy, so move
+     *        large bodies in.
+    */
     AwaiterType request(const std::string &url, const std::string &method,
                         const HttpHeader &headers, std::string body);
 
+    /**
+     * @brief Same as request, but the body is referenced without copy. The
+     *        caller must keep `body` valid until the returned awaiter is
+     *        resumed.
+    */
+    AwaiterType request_nocopy(const std::string &url,
+                               const std::string &method,
+                               const HttpHeader &headers,
+                               std::string_view body);
+
+    /**
+     * @brief Same as request_nocopy, but the body is a chain of buffers which
+     *        are sent in order, like writev. The buffers must be valid until
+     *        the returned awaiter is resumed, but the vector need not.
+    */
+    AwaiterType request_nocopy(const std::string &url,
+                               const std::string &method,
+                               const HttpHeader &headers,
+                               const std::vector<std::string_view> &body);
+
+    /**
+     * @brief Parse `url` into an Endpoint, which is used to send many
+     *        requests to the same url without parsing it again.
+    */
+    Endpoint prepare(const std::string &url) const;
+
+    /**
+     * @brief Send a request to the prepared endpoint, same as request(url).
+     *
+     * The requests to endpoints do not go through the virtual create_task,
+     * and if the host is an upstream group, the url is parsed per request to
+     * the selected replica.
+    */
+    AwaiterType request(const Endpoint &ep) {
+        return create_task(ep, nullptr, params.retry_max);
+    }
+
+    AwaiterType request(const Endpoint &ep, ReqType &&req) {
+        return create_task(ep, &req, params.retry_max);
+    }
+
+    AwaiterType request(const Endpoint &ep, const std::string &method,
+                        const HttpHeader &headers, std::string body);
+
+    /**
+     * @brief Download `url` piece by piece with Range requests of at most
+     *        `range_size` bytes, the pieces are yielded in order and the next
+     *        piece is requested only when the consumer asks for it, so that
+     *        the memory used is bounded by `range_size` no matter how large
+     *        the object is.
+     *
+     * Each yielded HttpResult holds the response of one piece, whose body
+     * can be read by coke::http_body_view or coke::HttpChunkCursor. If the
+     * server does not support Range and responds the whole object, or an
+     * error occurs, that result is yielded and the generator finishes. The
+     * HttpClient must be alive until the generator finishes.
+     *
+     *  auto gen = client.stream(url);
+     *  while (auto res = co_await gen.next()) {
+     *      if (res->state != coke::STATE_SUCCESS)
+     *          break;
+     *      consume(coke::http_body_view(res->resp));
+     *  }
+    */
+    AsyncGenerator<HttpResult> stream(std::string url, HttpHeader headers = {},
+                                      std::size_t range_size =
+                                          HTTP_STREAM_RANGE_SIZE);
+
+    /**
+     * @brief Send a request with hedging and budgeted retries, and return the
+     *        first successful result. Only idempotent requests should use it.
+     *
+     * If the request has not finished after the hedge delay, a backup request
+     * is sent, and the first successful one of them is returned, the others
+     * are abandoned and their results are discarded when they finish. If all
+     * the sent requests have failed, a new one is sent immediately, at most
+     * `retry_max` times. Each backup request and retry takes a token from the
+     * retry budget, and is not sent if the budget is exhausted. The requests
+     * are sent without the Workflow's internal retry.
+     *
+     * A request fails only when its state is not STATE_SUCCESS, the status
+     * code is not considered. If no request succeeds, the last failure is
+     * returned.
+    */
+    Task<HttpResult> hedged_request(std::string url,
+                                    std::string method = "GET",
+                                    HttpHeader headers = {},
+                                    std::string body = {});
+
 protected:
     virtual AwaiterType create_task(const std::string &url, ReqType *req) noexcept;
 
+    /**
+     * @brief Same as create_task, but the Workflow's internal retry is
+     *        `retry_max` instead of params.retry_max.
+    */
+    AwaiterType create_task(const std::string &url, ReqType *req,
+                            int retry_max) noexcept;
+
+    AwaiterType create_task(const Endpoint &ep, ReqType *req,
+                            int retry_max) noexcept;
+
 protected:
     HttpClientParams params;
+    std::shared_ptr<detail::HttpHedgeState> hedge;
 };
 
 } // namespace coke
@@ -0,0 +1,150 @@
+/**
+ * Copyright 2024 Coke Project (https://github.com/kedixa/coke)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Authors: kedixa (https://github.com/kedixa)
+*/
+
+#ifndef COKE_HTTP_ENCODING_H
+#define COKE_HTTP_ENCODING_H
+
+#include <memory>
+#include <string>
+#include <string_view>
+
+#include "coke/task.h"
+
+#include "workflow/HttpMessage.h"
+
+namespace coke {
+
+/**
+ * Content codings of HTTP, gzip and deflate are implemented by zlib, and are
+ * only available when coke is built with COKE_ENABLE_ZLIB, see
+ * http_encoding_supported. The functions return 0 on success, -ENOTSUP if
+ * the coding is not supported, or -EBADMSG if the data is corrupted.
+*/
+enum class HttpCoding {
+    IDENTITY,
+    GZIP,
+    DEFLATE,
+};
+
+/**
+ * @brief Return whether `coding` is supported by this build.
+*/
+bool http_encoding_supported(HttpCoding coding) noexcept;
+
+/**
+ * @brief Return the coding of a Content-Encoding value, or false if it is
+ *        not known. Only a single coding is supported.
+*/
+bool http_parse_coding(std::string_view value, HttpCoding &coding) noexcept;
+
+/**
+ * @brief The Accept-Encoding value with all the supported codings, empty if
+ *        none is supported.
+*/
+std::string_view http_accept_encoding() noexcept;
+
+/**
+ * @brief Compress `in` by `coding` and append it to `out`, `level` is the
+ *        zlib compression level, -1 means the default one.
+*/
+int http_compress(HttpCoding coding, std::string_view in, std::string &out,
+                  int level = -1);
+
+/**
+ * @brief Decompress `in` by `coding` and append it to `out`.
+*/
+int http_decompress(HttpCoding coding, std::string_view in, std::string &out);
+
+/**
+ * @brief HttpDecompressor decompresses a body piece by piece, so that a body
+ *        that arrives or is stored in pieces need not be joined first.
+*/
+class HttpDecompressor {
+    struct State;
+
+public:
+    HttpDecompressor() noexcept;
+    ~HttpDecompressor();
+
+    HttpDecompressor(HttpDecompressor &&) noexcept;
+    HttpDecompressor &operator= (HttpDecompressor &&) noexcept;
+
+    /**
+     * @brief Start a new stream of `coding`, the previous one is dropped.
+    */
+    int init(HttpCoding coding);
+
+    /**
+     * @brief Decompress the next piece and append the output to `out`.
+    */
+    int update(std::string_view in, std::string &out);
+
+    /**
+     * @brief Return 0 if the stream is complete, or -EBADMSG if it is
+     *        truncated.
+    */
+    int finish();
+
+private:
+    HttpCoding coding{HttpCoding::IDENTITY};
+    bool finished{true};
+    std::unique_ptr<State> state;
+};
+
+/**
+ * @brief Append the decoded body of `msg` to `out`, according to its
+ *        Transfer-Encoding and Content-Encoding. The chunks are decompressed
+ *        one by one without joining them.
+*/
+int http_decode_body(const protocol::HttpMessage &msg, std::string &out);
+
+/**
+ * @brief Same as http_decode_body, but the CPU work is done on the go
+ *        executor `queue_name`, empty means the default go queue. `msg` and
+ *        `out` must be valid until the returned Task is finished.
+*/
+Task<int> http_decode_body_go(const protocol::HttpMessage &msg,
+                              std::string &out,
+                              std::string queue_name = "");
+
+/**
+ * @brief Set `body` as the body of `resp`, compressed by the best coding
+ *        accepted by `req`'s Accept-Encoding, and set Content-Encoding and
+ *        Vary headers. Bodies smaller than `min_size` are not compressed.
+ *
+ * @return 0 on success, the body is set uncompressed if no coding is
+ *         accepted, or a negative error code which leaves `resp` untouched.
+*/
+int http_set_encoded_body(const protocol::HttpRequest &req,
+                          protocol::HttpResponse &resp, std::string_view body,
+                          std::size_t min_size = 1024, int level = -1);
+
+/**
+ * @brief Same as http_set_encoded_body, but the compression is done on the
+ *        go executor `queue_name`, empty means the default go queue. The
+ *        params must be valid until the returned Task is finished.
+*/
+Task<int> http_set_encoded_body_go(const protocol::HttpRequest &req,
+                                   protocol::HttpResponse &resp,
+                                   std::string_view body,
+                                   std::size_t min_size = 1024, int level = -1,
+                                   std::string queue_name = "");
+
+} // namespace coke
+
+#endif // COKE_HTTP_ENCODING_H
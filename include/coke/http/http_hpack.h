@@ -0,0 +1,193 @@
+/**
+ * Copyright 2024 Coke Project (https://github.com/kedixa/coke)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Authors: kedixa (https://github.com/kedixa)
+*/
+
+#ifndef COKE_HTTP_HPACK_H
+#define COKE_HTTP_HPACK_H
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace coke {
+
+/**
+ * HPACK(RFC 7541) is the header compression of HTTP/2. The functions return
+ * 0 on success, or -EBADMSG if the data is corrupted.
+*/
+
+struct HpackHeader {
+    std::string name;
+    std::string value;
+
+    // Sensitive headers such as authorization are encoded as never indexed,
+    // so that they are not put into any table along the way.
+    bool sensitive{false};
+};
+
+/**
+ * @brief Append the Huffman encoding of `in` to `out`.
+*/
+void hpack_huffman_encode(std::string_view in, std::string &out);
+
+/**
+ * @brief Return the length of the Huffman encoding of `in`.
+*/
+std::size_t hpack_huffman_length(std::string_view in) noexcept;
+
+/**
+ * @brief Decode the Huffman encoded `in` and append it to `out`.
+*/
+int hpack_huffman_decode(std::string_view in, std::string &out);
+
+namespace detail {
+
+/**
+ * @brief The dynamic table of HPACK, the newest entry is at the front.
+*/
+class HpackTable {
+public:
+    static constexpr std::size_t ENTRY_OVERHEAD = 32;
+    static constexpr std::size_t STATIC_SIZE = 61;
+
+    explicit HpackTable(std::size_t max_size) noexcept
+        : max_size(max_size), cur_size(0)
+    { }
+
+    /**
+     * @brief Get the entry of `index` in the static and dynamic table, the
+     *        index starts from 1. Return false if out of range.
+    */
+    bool get(std::size_t index, const HpackHeader *&entry) const;
+
+    /**
+     * @brief Find `name` and `value`, return the index of an entry with both
+     *        of them matched and set `name_only` to false, or the index of an
+     *        entry with the name matched and set `name_only` to true, or 0.
+    */
+    std::size_t find(std::string_view name, std::string_view value,
+                     bool &name_only) const;
+
+    void add(std::string_view name, std::string_view value);
+
+    void set_max_size(std::size_t size);
+
+    std::size_t get_max_size() const noexcept { return max_size; }
+    std::size_t get_size() const noexcept { return cur_size; }
+    std::size_t get_count() const noexcept { return entries.size(); }
+
+private:
+    void evict(std::size_t limit);
+
+private:
+    std::size_t max_size;
+    std::size_t cur_size;
+    std::deque<HpackHeader> entries;
+};
+
+} // namespace detail
+
+/**
+ * @brief HpackEncoder encodes the header lists of one direction of an HTTP/2
+ *        connection, the header blocks must be sent in order.
+*/
+class HpackEncoder {
+public:
+    /**
+     * @param max_table_size The size of the dynamic table, at most the
+     *        SETTINGS_HEADER_TABLE_SIZE of the peer.
+     * @param huffman Use Huffman encoding for the strings it makes shorter.
+    */
+    explicit HpackEncoder(std::size_t max_table_size = 4096,
+                          bool huffman = true)
+        : table(max_table_size), huffman(huffman),
+          pending_update(false), min_update(max_table_size)
+    { }
+
+    /**
+     * @brief Change the size of the dynamic table, such as when the peer
+     *        changes SETTINGS_HEADER_TABLE_SIZE. The size update is sent at
+     *        the beginning of the next header block.
+    */
+    void set_max_table_size(std::size_t size);
+
+    /**
+     * @brief Encode `headers` as a header block and append it to `out`, the
+     *        names should be in lower case as HTTP/2 requires.
+    */
+    void encode(const std::vector<HpackHeader> &headers, std::string &out);
+
+    std::size_t table_size() const noexcept { return table.get_size(); }
+
+private:
+    void encode_string(std::string_view str, std::string &out);
+
+private:
+    detail::HpackTable table;
+    bool huffman;
+    bool pending_update;
+
+    // The smallest size set since the last header block, it must be sent
+    // before the final one, see RFC 7541 section 4.2.
+    std::size_t min_update;
+};
+
+/**
+ * @brief HpackDecoder decodes the header blocks of one direction of an HTTP/2
+ *        connection, the blocks must be decoded in the order they arrive.
+*/
+class HpackDecoder {
+public:
+    /**
+     * @param max_table_size The limit of the dynamic table, that is our
+     *        SETTINGS_HEADER_TABLE_SIZE.
+     * @param max_list_size The limit of the decoded header list, counted as
+     *        SETTINGS_MAX_HEADER_LIST_SIZE, zero means no limit.
+    */
+    explicit HpackDecoder(std::size_t max_table_size = 4096,
+                          std::size_t max_list_size = 0)
+        : table(max_table_size), max_table_size(max_table_size),
+          max_list_size(max_list_size)
+    { }
+
+    /**
+     * @brief Change the limit of the dynamic table after the peer
+     *        acknowledges our new SETTINGS_HEADER_TABLE_SIZE.
+    */
+    void set_max_table_size(std::size_t size);
+
+    /**
+     * @brief Decode a complete header block and append the headers to
+     *        `headers`. After an error the decoder must not be used any more,
+     *        the connection should be closed with COMPRESSION_ERROR.
+    */
+    int decode(std::string_view block, std::vector<HpackHeader> &headers);
+
+    std::size_t table_size() const noexcept { return table.get_size(); }
+
+private:
+    detail::HpackTable table;
+    std::size_t max_table_size;
+    std::size_t max_list_size;
+};
+
+} // namespace coke
+
+#endif // COKE_HTTP_HPACK_H
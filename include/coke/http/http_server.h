@@ -19,6 +19,11 @@
 #ifndef COKE_HTTP_SERVER_H
 #define COKE_HTTP_SERVER_H
 
+#include <string>
+#include <string_view>
+
+#include "coke/mapped_file.h"
+#include "coke/metrics.h"
 #include "coke/net/basic_server.h"
 
 #include "workflow/WFHttpServer.h"
@@ -45,8 +50,124 @@ public:
     HttpServer(ProcessorType co_proc)
         : BasicServer<HttpRequest, HttpResponse>(HttpServerParams(), std::move(co_proc))
     { }
+
+protected:
+    /**
+     * @brief Reply the requests rejected by admission control with 503.
+    */
+    void do_reject(TaskType *task) override {
+        HttpResponse *resp = task->get_resp();
+
+        resp->set_http_version("HTTP/1.1");
+        resp->set_status_code("503");
+        resp->set_reason_phrase("Service Unavailable");
+        resp->set_header_pair("Retry-After", "1");
+    }
+};
+
+/**
+ * @brief HttpResponseWriter sends the response of an HttpServerContext
+ *        incrementally, so that a large body need not be held in memory.
+ *
+ * The status line and headers set in ctx.get_resp() are sent by start(), then
+ * the body is sent by write_chunk() piece by piece, and finish() ends the
+ * response and the context. It takes the place of ctx.reply(), and the body
+ * appended to ctx.get_resp() is not sent.
+ *
+ *  coke::HttpResponseWriter writer(ctx);
+ *  ctx.get_resp().set_status_code("200");
+ *  co_await writer.start();
+ *  while (has_more())
+ *      co_await writer.write_chunk(generate());
+ *  co_await writer.finish();
+ *
+ * Each operation returns 0 on success or a negative errno on failure, after a
+ * failure only finish() can be called. When the socket's send buffer is
+ * full, write_chunk() waits until it is writable again, that is, the writer
+ * is suspended instead of buffering data, and the waiting gives up after
+ * `write_timeout` milliseconds with -ETIMEDOUT.
+*/
+class HttpResponseWriter {
+public:
+    static constexpr long long CHUNKED = -1;
+
+    explicit HttpResponseWriter(HttpServerContext &ctx,
+                                int write_timeout = 10 * 1000) noexcept
+        : ctx(ctx), write_timeout(write_timeout)
+    { }
+
+    HttpResponseWriter(const HttpResponseWriter &) = delete;
+    HttpResponseWriter &operator= (const HttpResponseWriter &) = delete;
+
+    /**
+     * @brief Send the status line and headers of ctx.get_resp().
+     *
+     * @param content_length The length of the whole body, the body is sent
+     *        with Content-Length if it is known, otherwise CHUNKED means the
+     *        chunked transfer encoding is used. Do not set these two headers
+     *        in the response manually.
+    */
+    Task<int> start(long long content_length = CHUNKED);
+
+    /**
+     * @brief Send a piece of the body, `data` can be released once it returns.
+     *        Empty pieces are ignored.
+    */
+    Task<int> write_chunk(std::string_view data);
+
+    /**
+     * @brief Send [offset, offset + len) of `file` as a piece of the body.
+     *        The data is pushed to the connection directly from the mapped
+     *        pages, piece by piece, and each piece is prefetched on the go
+     *        executor before it is sent, so neither the handler thread blocks
+     *        on page faults nor the file is copied into a user space buffer.
+     *        `file` must be alive until it returns.
+     *
+     * @return 0 on success, -EINVAL if the range is out of the file, or a
+     *         negative errno.
+    */
+    Task<int> write_file(const MappedFile &file, std::size_t offset,
+                         std::size_t len);
+
+    /**
+     * @brief Finish the response and the ServerContext, must be called exactly
+     *        once whether the previous operations succeeded or not. If the
+     *        response is not started yet, it is replied by ctx.reply().
+    */
+    Task<int> finish();
+
+    /**
+     * @brief Return the number of body bytes sent by write_chunk() so far.
+    */
+    std::size_t get_body_sent() const { return body_sent; }
+
+private:
+    Task<int> push(std::string_view data);
+
+private:
+    HttpServerContext &ctx;
+    int write_timeout;
+    int error{0};
+    bool started{false};
+    bool chunked{false};
+    std::size_t body_sent{0};
 };
 
+/**
+ * @brief Reply the metrics of `registry` in Prometheus text format, so that
+ *        a processor can serve them at a path such as "/metrics".
+*/
+Task<HttpReplyResult> reply_metrics(HttpServerContext &ctx,
+                                    const MetricsRegistry &registry);
+
+/**
+ * @brief A processor that replies default_metrics_registry() to every
+ *        request, which is used by a dedicated server for the metrics.
+ *
+ *  coke::HttpServer server(coke::metrics_processor);
+*/
+Task<> metrics_processor(HttpServerContext ctx);
+
 } // namespace coke
 
 #endif // COKE_HTTP_SERVER_H
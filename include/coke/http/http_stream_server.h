@@ -0,0 +1,284 @@
+/**
+ * Copyright 2024 Coke Project (https://github.com/kedixa/coke)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Authors: kedixa (https://github.com/kedixa)
+*/
+
+#ifndef COKE_HTTP_STREAM_SERVER_H
+#define COKE_HTTP_STREAM_SERVER_H
+
+#include <cerrno>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "coke/condition.h"
+#include "coke/http/http_server.h"
+#include "coke/net/basic_server.h"
+
+namespace coke {
+
+namespace detail {
+
+/**
+ * @brief The body of a streaming request, which is filled by the poller
+ *        thread that receives it, and read by the HttpBodyReader.
+*/
+class HttpBodyState {
+public:
+    HttpBodyState(std::size_t buffer_size, bool chunked,
+                  uint64_t content_length) noexcept
+        : buffer_size(buffer_size), chunked(chunked),
+          parse_state(chunked ? CHUNK_SIZE : DATA),
+          data_left(chunked ? 0 : content_length)
+    { }
+
+    HttpBodyState(const HttpBodyState &) = delete;
+    HttpBodyState &operator= (const HttpBodyState &) = delete;
+
+    /**
+     * @brief Feed the bytes received from the connection, it is called by
+     *        the poller thread.
+     *
+     * @return The number of bytes belong to the body, which is less than
+     *         `size` only if the body ends, or -1 if the chunked encoding is
+     *         broken.
+    */
+    long long feed(const char *data, std::size_t size);
+
+    /**
+     * @brief Whether all the body is received.
+    */
+    bool finished() const noexcept { return parse_state == DONE; }
+
+    /**
+     * @brief Wake up the reader with `error` if the body is not finished.
+    */
+    void abort(int error);
+
+    /**
+     * @brief The reader will not read any more, the rest of the body is
+     *        discarded.
+    */
+    void detach();
+
+    Task<int> read_some(std::string &data, TimedWaitHelper helper);
+
+private:
+    void put(const char *data, std::size_t size, bool end);
+    long long feed_chunked(const char *data, std::size_t size);
+
+private:
+    enum {
+        CHUNK_SIZE, CHUNK_EXT, CHUNK_SIZE_LF, CHUNK_DATA, CHUNK_DATA_CR,
+        CHUNK_DATA_LF, TRAILER, TRAILER_LINE, TRAILER_LF, DATA, DONE,
+    };
+
+    std::size_t buffer_size;
+    bool chunked;
+
+    // Only accessed by the poller thread, `data_left` is the bytes left of
+    // the whole body, or of the current chunk if it is chunked
+    int parse_state;
+    uint64_t data_left;
+    int chunk_digits{0};
+
+    std::mutex mtx;
+    Condition cond;
+
+    // Protected by mtx
+    std::string buffer;
+    bool eof{false};
+    bool detached{false};
+    int error{0};
+
+};
+
+/**
+ * @brief The connection data of HttpStreamServer, it refers to the body
+ *        being received on the connection.
+*/
+struct HttpBodySlot {
+    HttpBodySlot() = default;
+    HttpBodySlot(const HttpBodySlot &) = delete;
+
+    ~HttpBodySlot() {
+        if (current)
+            current->abort(-ECONNRESET);
+    }
+
+    std::shared_ptr<HttpBodyState> current;
+};
+
+/**
+ * @brief StreamingHttpRequest completes once the headers are received, then
+ *        the body is moved to an HttpBodyState piece by piece. The following
+ *        requests on the same connection feed the rest of the body to it
+ *        before parsing themselves.
+*/
+class StreamingHttpRequest : public protocol::HttpRequest {
+public:
+    StreamingHttpRequest() = default;
+
+    ~StreamingHttpRequest() {
+        if (body)
+            body->detach();
+
+        // The connection is closed while the body is being fed by it
+        if (feeding)
+            feeding->abort(-ECONNRESET);
+    }
+
+    void set_connection(WFConnection *conn, std::size_t buffer_size) noexcept {
+        this->conn = conn;
+        this->buffer_size = buffer_size;
+    }
+
+    const std::shared_ptr<HttpBodyState> &get_body_state() const noexcept {
+        return body;
+    }
+
+protected:
+    int append(const void *buf, size_t *size) override;
+
+private:
+    int append_head(const char *buf, size_t *size);
+    HttpBodySlot *get_slot(bool create);
+
+private:
+    WFConnection *conn{nullptr};
+    std::size_t buffer_size{0};
+    std::shared_ptr<HttpBodyState> body;
+    std::shared_ptr<HttpBodyState> feeding;
+
+    // Number of bytes of "\r\n\r\n" matched at the end of the received data
+    int head_matched{0};
+    bool head_started{false};
+
+    // The connection data is not HttpBodySlot, the body is not streamed
+    bool buffered{false};
+};
+
+} // namespace detail
+
+struct HttpStreamServerParams : public HttpServerParams {
+    // Max bytes of the body received but not read by HttpBodyReader, the
+    // reader gets -ENOBUFS if it is exceeded.
+    std::size_t body_buffer_size = 4 * 1024 * 1024;
+};
+
+using StreamingHttpRequest = detail::StreamingHttpRequest;
+using HttpStreamServerContext = ServerContext<StreamingHttpRequest,
+                                             HttpResponse>;
+
+/**
+ * @brief HttpBodyReader reads the body of an HttpStreamServerContext piece
+ *        by piece, while the body is still being received.
+ *
+ *  coke::HttpBodyReader reader(ctx);
+ *  std::string data;
+ *  while (co_await reader.read_some(data) == coke::TOP_SUCCESS)
+ *      consume(data);
+*/
+class HttpBodyReader {
+public:
+    explicit HttpBodyReader(HttpStreamServerContext &ctx)
+        : req(ctx.get_req()), state(req.get_body_state())
+    { }
+
+    HttpBodyReader(const HttpBodyReader &) = delete;
+    HttpBodyReader &operator= (const HttpBodyReader &) = delete;
+
+    /**
+     * @brief Wait for the next piece of the body and store it into `data`,
+     *        the previous content of `data` is discarded, and its capacity
+     *        is reused by the following pieces.
+     *
+     * @return coke::TOP_SUCCESS if `data` is not empty, coke::TOP_CLOSED if
+     *         all the body is read, or a negative errno, such as -ECONNRESET
+     *         if the connection is closed before the body ends, -ENOBUFS if
+     *         the reader is too slow, or -EBADMSG if the body is malformed.
+    */
+    Task<int> read_some(std::string &data) {
+        return read_impl(data, detail::TimedWaitHelper{});
+    }
+
+    /**
+     * @brief Same as read_some, but return coke::TOP_TIMEOUT if nothing is
+     *        received in `nsec`.
+    */
+    Task<int> try_read_some_for(NanoSec nsec, std::string &data) {
+        return read_impl(data, detail::TimedWaitHelper(nsec));
+    }
+
+    /**
+     * @brief Return the number of body bytes read so far.
+    */
+    std::size_t get_body_read() const noexcept { return body_read; }
+
+private:
+    Task<int> read_impl(std::string &data, detail::TimedWaitHelper helper);
+
+private:
+    StreamingHttpRequest &req;
+    std::shared_ptr<detail::HttpBodyState> state;
+    std::size_t body_read{0};
+    bool parsed_body_read{false};
+};
+
+/**
+ * @brief HttpStreamServer is an HttpServer whose processor starts once the
+ *        headers of a request are received, and reads the body by
+ *        HttpBodyReader, so that the memory used by a request is bounded by
+ *        `body_buffer_size` instead of the size of the body.
+ *
+ * The body is received by the poller whether it is read or not, Workflow can
+ * not pause reading a connection, so the buffered size is limited instead.
+ * The body not read when the request is finished is discarded, and the
+ * connection can still be kept alive. Set `receive_timeout` of the params to
+ * -1 or long enough for the largest body, the connection data is used by the
+ * server itself and ctx.get_connection_data is not available.
+*/
+class HttpStreamServer
+    : public BasicServer<StreamingHttpRequest, HttpResponse> {
+    using BaseType = BasicServer<StreamingHttpRequest, HttpResponse>;
+
+public:
+    HttpStreamServer(const HttpStreamServerParams &params,
+                     ProcessorType co_proc)
+        : BaseType(params, std::move(co_proc)),
+          body_buffer_size(params.body_buffer_size)
+    { }
+
+    HttpStreamServer(ProcessorType co_proc)
+        : HttpStreamServer(HttpStreamServerParams(), std::move(co_proc))
+    { }
+
+protected:
+    CommSession *new_session(long long seq, CommConnection *conn) override;
+
+    /**
+     * @brief Reply the requests rejected by admission control with 503.
+    */
+    void do_reject(TaskType *task) override;
+
+private:
+    std::size_t body_buffer_size;
+};
+
+} // namespace coke
+
+#endif // COKE_HTTP_STREAM_SERVER_H
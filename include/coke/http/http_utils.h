@@ -19,7 +19,9 @@
 #ifndef COKE_HTTP_UTILS_H
 #define COKE_HTTP_UTILS_H
 
+#include <cstdint>
 #include <string_view>
+#include <vector>
 
 #include "workflow/HttpMessage.h"
 
@@ -44,6 +46,13 @@ struct HttpHeaderView {
 };
 
 
+/**
+ * @brief Compare two header names case-insensitively, only ASCII letters are
+ *        folded. It compares eight bytes at a time.
+*/
+bool http_name_equal(std::string_view a, std::string_view b) noexcept;
+
+
 class HttpHeaderCursor {
     struct iterator {
         iterator() {
@@ -99,6 +108,82 @@ private:
 };
 
 
+/**
+ * @brief HttpHeaderIndex indexes the headers of a message by case-folded
+ *        name, so that looking up many headers of one message does not scan
+ *        the header list each time. The index is built by one pass of
+ *        HttpHeaderCursor at the first lookup.
+ *
+ * The returned views point into `message`, the index must not be used after
+ * the headers of `message` are changed. It is not thread safe, even for the
+ * const member functions.
+*/
+class HttpHeaderIndex {
+public:
+    HttpHeaderIndex(const HttpMessage &message) : message(message) { }
+
+    HttpHeaderIndex(const HttpHeaderIndex &) = delete;
+    HttpHeaderIndex &operator= (const HttpHeaderIndex &) = delete;
+
+    /**
+     * @brief Find the value of the first header named `name`.
+     *
+     * @return True if it is found, and `value` is set.
+    */
+    bool find(std::string_view name, std::string_view &value) const;
+
+    /**
+     * @brief Return the value of the first header named `name`, or an empty
+     *        view if there is none.
+    */
+    std::string_view get(std::string_view name) const {
+        std::string_view value;
+        find(name, value);
+        return value;
+    }
+
+    bool contains(std::string_view name) const {
+        std::string_view value;
+        return find(name, value);
+    }
+
+    /**
+     * @brief Return the values of all the headers named `name`, in the order
+     *        they appear in the message.
+    */
+    std::vector<std::string_view> get_all(std::string_view name) const;
+
+    /**
+     * @brief Return the number of headers of the message.
+    */
+    std::size_t size() const {
+        build();
+        return headers.size();
+    }
+
+private:
+    void build() const {
+        if (!built)
+            build_index();
+    }
+
+    void build_index() const;
+    uint32_t find_slot(std::string_view name, uint64_t hash) const;
+
+private:
+    const HttpMessage &message;
+
+    mutable bool built{false};
+    mutable uint64_t mask{0};
+    mutable std::vector<HttpHeaderView> headers;
+    // The next header of the same name, or UINT32_MAX
+    mutable std::vector<uint32_t> next_same;
+    // Open addressing table of the first header of each name, or UINT32_MAX
+    mutable std::vector<uint32_t> slots;
+    mutable std::vector<uint64_t> hashes;
+};
+
+
 class HttpChunkCursor {
     struct iterator {
         iterator() { cur = end = nullptr; }
@@ -0,0 +1,526 @@
+/**
+ * Copyright 2024 Coke Project (https://github.com/kedixa/coke)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Authors: kedixa (https://github.com/kedixa)
+*/
+
+#ifndef COKE_HTTP_WEBSOCKET_H
+#define COKE_HTTP_WEBSOCKET_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+
+#include "coke/mutex.h"
+#include "coke/queue.h"
+#include "coke/sleep.h"
+#include "coke/http/http_server.h"
+#include "coke/net/basic_server.h"
+
+#include "workflow/HttpMessage.h"
+
+namespace coke {
+
+// Opcodes of the frames, see RFC 6455 section 5.2
+constexpr int WS_OPCODE_CONTINUATION = 0;
+constexpr int WS_OPCODE_TEXT = 1;
+constexpr int WS_OPCODE_BINARY = 2;
+constexpr int WS_OPCODE_CLOSE = 8;
+constexpr int WS_OPCODE_PING = 9;
+constexpr int WS_OPCODE_PONG = 10;
+
+// Status codes of the close frames, see RFC 6455 section 7.4
+constexpr uint16_t WS_CLOSE_NORMAL = 1000;
+constexpr uint16_t WS_CLOSE_GOING_AWAY = 1001;
+constexpr uint16_t WS_CLOSE_PROTOCOL_ERROR = 1002;
+constexpr uint16_t WS_CLOSE_NO_STATUS = 1005;
+constexpr uint16_t WS_CLOSE_ABNORMAL = 1006;
+constexpr uint16_t WS_CLOSE_POLICY_VIOLATION = 1008;
+constexpr uint16_t WS_CLOSE_TOO_BIG = 1009;
+
+// The max size of a frame header, which has 2 bytes, 8 bytes of extended
+// payload length and 4 bytes of masking key at most.
+constexpr std::size_t WS_MAX_HEADER_SIZE = 14;
+
+// The max payload size of the control frames
+constexpr std::size_t WS_MAX_CONTROL_SIZE = 125;
+
+/**
+ * @brief XOR `data` with the masking key in place, masking and unmasking are
+ *        the same operation. `offset` is the position of data[0] in the
+ *        payload, so that a payload can be masked piece by piece.
+ *
+ * The key is the 4 bytes in the frame, loaded into `key` by memcpy. It works
+ * on 32 or 16 bytes at a time with AVX2, SSE2 or NEON if the target supports
+ * them, otherwise on 8 bytes at a time.
+*/
+void websocket_mask(void *data, std::size_t len, uint32_t key,
+                    std::size_t offset = 0) noexcept;
+
+/**
+ * @brief Compute the Sec-WebSocket-Accept of the client's Sec-WebSocket-Key.
+*/
+std::string websocket_accept_key(std::string_view key);
+
+/**
+ * @brief Write the header of a frame with payload length `len` into `buf`,
+ *        which has at least WS_MAX_HEADER_SIZE bytes. If `key` is not
+ *        nullptr, the frame is masked with `*key` and the payload should be
+ *        masked by websocket_mask.
+ *
+ * @return The size of the header.
+*/
+std::size_t websocket_frame_header(char *buf, int opcode, bool fin,
+                                   uint64_t len,
+                                   const uint32_t *key = nullptr) noexcept;
+
+/**
+ * @brief Statistics of the buffer pool of WebSocketMessage, `hits` is the
+ *        number of buffers reused from the pool, `misses` is the number of
+ *        buffers allocated by operator new.
+*/
+struct WebSocketBufferStats {
+    std::size_t hits{0};
+    std::size_t misses{0};
+};
+
+WebSocketBufferStats get_websocket_buffer_stats() noexcept;
+
+namespace detail {
+
+/**
+ * @brief Allocate a buffer of at least `cap` bytes from the process wide
+ *        pool, `cap` is rounded up to the size of the buffer. Buffers larger
+ *        than the largest size class are not pooled.
+*/
+char *websocket_buffer_alloc(std::size_t &cap);
+
+void websocket_buffer_free(char *buf, std::size_t cap) noexcept;
+
+} // namespace detail
+
+/**
+ * @brief WebSocketMessage is a complete message received from the peer, the
+ *        fragments of a data message are joined. The payload is kept in a
+ *        pooled buffer, which is returned to the pool when the message is
+ *        destroyed or cleared, and view() refers to it without copy.
+*/
+class WebSocketMessage {
+public:
+    WebSocketMessage() noexcept = default;
+
+    WebSocketMessage(WebSocketMessage &&that) noexcept
+        : opcode(that.opcode),
+          buf(std::exchange(that.buf, nullptr)),
+          len(std::exchange(that.len, 0)),
+          cap(std::exchange(that.cap, 0))
+    { }
+
+    WebSocketMessage &operator= (WebSocketMessage &&that) noexcept {
+        if (this != &that) {
+            clear();
+            opcode = that.opcode;
+            buf = std::exchange(that.buf, nullptr);
+            len = std::exchange(that.len, 0);
+            cap = std::exchange(that.cap, 0);
+        }
+
+        return *this;
+    }
+
+    ~WebSocketMessage() { clear(); }
+
+    int get_opcode() const noexcept { return opcode; }
+    void set_opcode(int opcode) noexcept { this->opcode = opcode; }
+
+    bool is_text() const noexcept { return opcode == WS_OPCODE_TEXT; }
+    bool is_binary() const noexcept { return opcode == WS_OPCODE_BINARY; }
+
+    /**
+     * @brief The payload of the message, it is valid until the message is
+     *        destroyed, cleared or moved.
+    */
+    std::string_view view() const noexcept {
+        return std::string_view(buf, len);
+    }
+
+    std::size_t size() const noexcept { return len; }
+    bool empty() const noexcept { return len == 0; }
+
+    /**
+     * @brief The status code of a close message, or WS_CLOSE_NO_STATUS if it
+     *        has none.
+    */
+    uint16_t get_close_code() const noexcept;
+
+    /**
+     * @brief The reason of a close message, which follows the status code.
+    */
+    std::string_view get_close_reason() const noexcept {
+        return len > 2 ? std::string_view(buf + 2, len - 2)
+                       : std::string_view{};
+    }
+
+    /**
+     * @brief Return the buffer to the pool, the message becomes empty.
+    */
+    void clear() noexcept {
+        if (buf)
+            detail::websocket_buffer_free(buf, cap);
+
+        buf = nullptr;
+        len = cap = 0;
+    }
+
+    /**
+     * @brief Make room for `n` more bytes and return the position to write.
+     *        The bytes are counted by commit(n) after they are written.
+    */
+    char *prepare(std::size_t n);
+
+    void commit(std::size_t n) noexcept { len += n; }
+
+    void append(const char *data, std::size_t n);
+
+private:
+    int opcode{WS_OPCODE_TEXT};
+    char *buf{nullptr};
+    std::size_t len{0};
+    std::size_t cap{0};
+};
+
+/**
+ * @brief WebSocketParser parses a byte stream into WebSocketMessages. The
+ *        payload is copied into the pooled buffer of the message once, and
+ *        unmasked there. The control frames between the fragments of a data
+ *        message are delivered on their own, as RFC 6455 allows.
+*/
+class WebSocketParser {
+public:
+    /**
+     * @param max_message_size Max payload size of a message, the fragments
+     *        of a data message are counted together.
+     * @param require_mask Whether the frames must be masked, which is true
+     *        for the frames sent by clients.
+    */
+    WebSocketParser(std::size_t max_message_size, bool require_mask) noexcept
+        : max_size(max_message_size), require_mask(require_mask)
+    { }
+
+    WebSocketParser(const WebSocketParser &) = delete;
+    WebSocketParser &operator= (const WebSocketParser &) = delete;
+
+    /**
+     * @brief Parse at most `*size` bytes of `buf`, and stop after a message
+     *        is complete.
+     *
+     * @return 1 if a message is complete, and `*size` is set to the bytes
+     *         consumed, 0 if all the bytes are consumed and more are needed,
+     *         -EBADMSG if the stream breaks the protocol, or -EMSGSIZE if a
+     *         message is larger than the limit. The parser can not be used
+     *         any more after an error.
+    */
+    int append(const void *buf, std::size_t *size);
+
+    /**
+     * @brief Take the message completed by the last append.
+    */
+    void take(WebSocketMessage &msg) noexcept;
+
+private:
+    int parse_header();
+
+private:
+    std::size_t max_size;
+    bool require_mask;
+
+    char header[WS_MAX_HEADER_SIZE];
+    std::size_t header_got{0};
+    std::size_t header_need{2};
+
+    int frame_opcode{0};
+    bool frame_fin{false};
+    bool frame_masked{false};
+    uint32_t frame_key{0};
+    uint64_t payload_len{0};
+    uint64_t payload_got{0};
+
+    // Whether a fragmented data message is being received
+    bool in_fragment{false};
+    // Which message is completed, 0 means none
+    int completed{0};
+
+    WebSocketMessage data_msg;
+    WebSocketMessage control_msg;
+};
+
+struct WebSocketParams {
+    // Max payload size of a received message, the connection is closed with
+    // WS_CLOSE_TOO_BIG if it is exceeded.
+    std::size_t max_message_size = 16 * 1024 * 1024;
+
+    // Max number of messages received but not taken by receive, the
+    // connection is closed with WS_CLOSE_POLICY_VIOLATION if it is exceeded.
+    std::size_t receive_queue_size = 1024;
+
+    // Give up sending with -ETIMEDOUT if the socket's send buffer stays full
+    // for `send_timeout` milliseconds, -1 means no limit.
+    int send_timeout = 10 * 1000;
+
+    // Reply the pings by receive automatically, the pings are not returned.
+    bool auto_pong = true;
+};
+
+namespace detail {
+
+/**
+ * @brief The state of an upgraded connection, shared by the request parsing
+ *        the frames in the poller thread, and the WebSocketConnection.
+*/
+class WebSocketState {
+public:
+    explicit WebSocketState(const WebSocketParams &params)
+        : parser(params.max_message_size, true),
+          que(params.receive_queue_size == 0 ? 1 : params.receive_queue_size)
+    { }
+
+    /**
+     * @brief Parse the frames, the messages are delivered to the queue. After
+     *        an error or a close frame, the rest of the stream is ignored.
+    */
+    int append(const void *buf, std::size_t *size);
+
+    /**
+     * @brief The connection is closed, wake up the receiver.
+    */
+    void shutdown() noexcept;
+
+    /**
+     * @brief The status code to close the connection with if the stream is
+     *        broken, or zero.
+    */
+    uint16_t get_error_code() const noexcept {
+        return error_code.load(std::memory_order_acquire);
+    }
+
+    Queue<WebSocketMessage> &get_queue() noexcept { return que; }
+
+private:
+    void fail(uint16_t code) noexcept;
+
+private:
+    WebSocketParser parser;
+    Queue<WebSocketMessage> que;
+    bool stopped{false};
+    std::atomic<uint16_t> error_code{0};
+};
+
+/**
+ * @brief The request type of WebSocketServer. It is parsed as an HttpRequest
+ *        until the connection is upgraded, after that the only request of the
+ *        connection never completes, and all the frames go into the
+ *        WebSocketState of the connection.
+*/
+class WebSocketServerRequest : public protocol::HttpRequest {
+public:
+    WebSocketServerRequest() = default;
+    WebSocketServerRequest(WebSocketServerRequest &&) = default;
+    WebSocketServerRequest &operator= (WebSocketServerRequest &&) = default;
+
+    ~WebSocketServerRequest() {
+        if (state)
+            state->shutdown();
+    }
+
+    void set_connection(WFConnection *conn) noexcept { this->conn = conn; }
+
+protected:
+    int append(const void *buf, size_t *size) override;
+
+private:
+    WFConnection *conn{nullptr};
+    std::shared_ptr<WebSocketState> state;
+    bool checked{false};
+};
+
+} // namespace detail
+
+using WebSocketServerContext = ServerContext<detail::WebSocketServerRequest,
+                                             HttpResponse>;
+
+/**
+ * @brief WebSocketConnection is the server side of an upgraded connection,
+ *        it is created by WebSocketServer and passed to the processor.
+ *
+ * The frames are parsed in the poller thread as soon as they arrive, and
+ * receive takes the messages in order. The sends are serialized, a message is
+ * pushed to the socket directly without being buffered, and when the send
+ * buffer of the socket is full, send is suspended until it is writable again,
+ * which is the backpressure of a slow peer.
+ *
+ * All the sends return 0 on success or a negative errno, after a failure the
+ * connection can not send any more.
+*/
+class WebSocketConnection {
+public:
+    WebSocketConnection(WebSocketServerContext &ctx,
+                        std::shared_ptr<detail::WebSocketState> state,
+                        const WebSocketParams &params)
+        : ctx(ctx), state(std::move(state)), params(params)
+    { }
+
+    WebSocketConnection(const WebSocketConnection &) = delete;
+    WebSocketConnection &operator= (const WebSocketConnection &) = delete;
+
+    /**
+     * @brief The upgrade request, such as its uri and headers.
+    */
+    const HttpRequest &get_request() { return ctx.get_req(); }
+
+    /**
+     * @brief Receive the next message, which is a text, binary or pong
+     *        message, or a ping if auto_pong is false.
+     *
+     * @return coke::TOP_SUCCESS, or coke::TOP_CLOSED if the peer sent a close
+     *         frame or the connection is broken, see get_close_code. A close
+     *         frame is replied before it returns.
+    */
+    Task<int> receive(WebSocketMessage &msg) {
+        return receive_impl(msg, detail::TimedWaitHelper{});
+    }
+
+    /**
+     * @brief Same as receive, but return coke::TOP_TIMEOUT if no message is
+     *        received in `nsec`.
+    */
+    Task<int> try_receive_for(NanoSec nsec, WebSocketMessage &msg) {
+        return receive_impl(msg, detail::TimedWaitHelper(nsec));
+    }
+
+    Task<int> send_text(std::string_view data) {
+        return send(WS_OPCODE_TEXT, data);
+    }
+
+    Task<int> send_binary(std::string_view data) {
+        return send(WS_OPCODE_BINARY, data);
+    }
+
+    Task<int> ping(std::string_view data = {}) {
+        return send(WS_OPCODE_PING, data);
+    }
+
+    /**
+     * @brief Send a message with `opcode` in one frame, the payload of the
+     *        control frames is at most WS_MAX_CONTROL_SIZE bytes. `data` can
+     *        be released once it returns.
+    */
+    Task<int> send(int opcode, std::string_view data);
+
+    /**
+     * @brief Send a close frame, no more messages can be sent after it. The
+     *        connection is closed after the processor returns, a close frame
+     *        with WS_CLOSE_NORMAL is sent at that time if it is not sent.
+    */
+    Task<int> close(uint16_t code = WS_CLOSE_NORMAL,
+                    std::string_view reason = {});
+
+    /**
+     * @brief The status code of the close frame from the peer, or
+     *        WS_CLOSE_ABNORMAL if the connection is broken without it, or zero
+     *        if the peer has not closed.
+    */
+    uint16_t get_close_code() const noexcept { return close_code; }
+
+    bool is_close_sent() const noexcept { return close_sent; }
+
+private:
+    Task<int> receive_impl(WebSocketMessage &msg,
+                           detail::TimedWaitHelper helper);
+
+    Task<int> send_locked(int opcode, std::string_view data);
+    Task<int> push(std::string_view data);
+
+    Task<int> handshake(const std::string &accept);
+    Task<> finish();
+
+private:
+    WebSocketServerContext &ctx;
+    std::shared_ptr<detail::WebSocketState> state;
+    WebSocketParams params;
+
+    Mutex send_mtx;
+    int error{0};
+    bool close_sent{false};
+    uint16_t close_code{0};
+
+    friend class WebSocketServer;
+};
+
+/**
+ * @brief WebSocketServer accepts HTTP requests which upgrade to WebSocket, and
+ *        runs the processor on each upgraded connection, the other requests
+ *        are replied with 400 or 426. It runs on the same pollers as
+ *        HttpServer.
+ *
+ * Set `receive_timeout` of the params to -1, otherwise the connections are
+ * closed when they last longer than it. The extra listeners of
+ * start_reuse_port are not supported.
+*/
+class WebSocketServer
+    : public BasicServer<detail::WebSocketServerRequest, HttpResponse> {
+    using BaseType = BasicServer<detail::WebSocketServerRequest, HttpResponse>;
+
+public:
+    using WebSocketProcessor = std::function<Task<>(WebSocketConnection &)>;
+
+    WebSocketServer(const HttpServerParams &params,
+                    const WebSocketParams &ws_params,
+                    WebSocketProcessor ws_proc)
+        : BaseType(params, get_handler(this)),
+          ws_params(ws_params), ws_proc(std::move(ws_proc))
+    { }
+
+    WebSocketServer(WebSocketProcessor ws_proc)
+        : WebSocketServer(HttpServerParams(), WebSocketParams(),
+                          std::move(ws_proc))
+    { }
+
+protected:
+    CommSession *new_session(long long seq, CommConnection *conn) override;
+
+    void do_reject(TaskType *task) override;
+
+private:
+    static ProcessorType get_handler(WebSocketServer *server) {
+        return [server](ServerContextType ctx) {
+            return server->handle(std::move(ctx));
+        };
+    }
+
+    Task<> handle(ServerContextType ctx);
+
+private:
+    WebSocketParams ws_params;
+    WebSocketProcessor ws_proc;
+};
+
+} // namespace coke
+
+#endif // COKE_HTTP_WEBSOCKET_H
@@ -0,0 +1,141 @@
+/**
+ * Copyright 2024 Coke Project (https://github.com/kedixa/coke)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Authors: kedixa (https://github.com/kedixa)
+*/
+
+#ifndef COKE_HTTP_WEBSOCKET_CLIENT_H
+#define COKE_HTTP_WEBSOCKET_CLIENT_H
+
+#include <atomic>
+#include <string>
+
+#include "coke/http/websocket.h"
+
+#include "workflow/WFWebSocketClient.h"
+
+namespace coke {
+
+struct WebSocketClientParams {
+    // The connection is closed after idle for `idle_timeout` milliseconds,
+    // -1 means never.
+    int idle_timeout                = 10 * 1000;
+
+    // Send a ping every `ping_interval` milliseconds, -1 means never.
+    int ping_interval               = -1;
+
+    std::size_t max_message_size    = 16 * 1024 * 1024;
+
+    // Max number of messages that are received but not consumed, the new
+    // messages are dropped when the queue is full.
+    std::size_t receive_queue_size  = 1024;
+
+    bool random_masking_key         = true;
+
+    // The Sec-WebSocket-Protocol of the upgrade request, empty means not set.
+    std::string sec_protocol;
+};
+
+/**
+ * @brief WebSocketClient keeps one WebSocket connection to `url`, which is
+ *        created by Workflow's WFWebSocketClient at the first send. The
+ *        frames are masked by Workflow, and the received messages are
+ *        reassembled and delivered to `receive`.
+ *
+ *        Call `close` and wait for it before the client is destroyed.
+*/
+class WebSocketClient {
+public:
+    explicit WebSocketClient(const WebSocketClientParams &params = {});
+    ~WebSocketClient();
+
+    WebSocketClient(const WebSocketClient &) = delete;
+    WebSocketClient &operator= (const WebSocketClient &) = delete;
+
+    /**
+     * @brief Set the url, such as "ws://host:port/path" or "wss://host/path".
+     *        It must be called once before any other operations.
+     *
+     * @return 0 on success, or a negative errno.
+    */
+    int connect(const std::string &url);
+
+    Task<int> send_text(std::string_view data) {
+        return send(WS_OPCODE_TEXT, data);
+    }
+
+    Task<int> send_binary(std::string_view data) {
+        return send(WS_OPCODE_BINARY, data);
+    }
+
+    Task<int> ping(std::string_view data = {}) {
+        return send(WS_OPCODE_PING, data);
+    }
+
+    /**
+     * @brief Send a message with `opcode` in one frame.
+     *
+     * @return 0 on success, or a negative errno.
+    */
+    Task<int> send(int opcode, std::string_view data);
+
+    /**
+     * @brief Send a close frame and close the connection, the messages that
+     *        are already received can still be consumed.
+    */
+    Task<int> close();
+
+    /**
+     * @brief Receive the next text, binary or pong message.
+     *
+     * @return coke::TOP_SUCCESS, or coke::TOP_CLOSED if the connection is
+     *         closed and all the messages are received.
+    */
+    Task<int> receive(WebSocketMessage &msg) { return que.pop(msg); }
+
+    Task<int> try_receive_for(NanoSec nsec, WebSocketMessage &msg) {
+        return que.try_pop_for(nsec, msg);
+    }
+
+    /**
+     * @brief Number of messages dropped because the queue is full or they
+     *        are larger than max_message_size.
+    */
+    std::size_t get_dropped() const noexcept {
+        return dropped.load(std::memory_order_relaxed);
+    }
+
+private:
+    void on_frame(WFWebSocketTask *task);
+
+private:
+    WebSocketClientParams params;
+    std::string url;
+    bool inited{false};
+
+    Queue<WebSocketMessage> que;
+    std::atomic<std::size_t> dropped{0};
+
+    // Only accessed by the process callback, which is called in order
+    WebSocketMessage partial;
+    bool partial_dropped{false};
+
+    Mutex send_mtx;
+    WFWebSocketClient client;
+};
+
+} // namespace coke
+
+#endif // COKE_HTTP_WEBSOCKET_CLIENT_H
@@ -19,9 +19,9 @@
 #ifndef COKE_LATCH_H
 #define COKE_LATCH_H
 
+#include <atomic>
 #include <latch>
 
-#include "coke/detail/mutex_table.h"
 #include "coke/sleep.h"
 #include "coke/sync_guard.h"
 
@@ -43,7 +43,7 @@ public:
      * @param n Number to be counted and should >= 0.
     */
     explicit Latch(long n) noexcept
-        : mtx(detail::get_mutex(get_addr())), expected(n)
+        : state(n * COUNT_ONE)
     { }
 
     ~Latch() { }
@@ -58,8 +58,7 @@ public:
      * @brief Return whether the internal counter has reached zero.
     */
     bool try_wait() const {
-        std::lock_guard<std::mutex> lg(this->mtx);
-        return this->expected >= 0;
+        return load_count() <= 0;
     }
 
     /**
@@ -81,6 +80,13 @@ public:
         return wait_impl(detail::TimedWaitHelper{nsec});
     }
 
+    /**
+     * @brief Same as wait_for, but wait until `deadline`.
+     */
+    LatchAwaiter wait_until(SteadyTimePoint deadline) {
+        return wait_impl(detail::TimedWaitHelper{deadline});
+    }
+
     /**
      * @brief Count by n and wait for the Latch to be counted to zero.
      * The sum of all n's in `arrive_and_wait` and `count_down` MUST equal
@@ -103,17 +109,27 @@ public:
     void count_down(long n = 1);
 
 private:
+    // The lowest bit of `state` is set once anyone sleeps on the latch, and
+    // the others are the remaining count, so that counting down knows whether
+    // to wake up anyone by the same atomic operation, and never touches *this
+    // after that.
+    static constexpr long WAITING = 1;
+    static constexpr long COUNT_ONE = 2;
+
     const void *get_addr() const noexcept {
         return (const char *)this + 1;
     }
 
+    long load_count() const noexcept {
+        return state.load(std::memory_order_acquire) / COUNT_ONE;
+    }
+
     LatchAwaiter wait_impl(detail::TimedWaitHelper helper);
 
     LatchAwaiter create_awaiter(long n);
 
 private:
-    std::mutex &mtx;
-    long expected;
+    std::atomic<long> state;
 };
 
 class SyncLatch final {
@@ -0,0 +1,146 @@
+/**
+ * Copyright 2024 Coke Project (https://github.com/kedixa/coke)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Authors: kedixa (https://github.com/kedixa)
+*/
+
+#ifndef COKE_LATENCY_HISTOGRAM_H
+#define COKE_LATENCY_HISTOGRAM_H
+
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "coke/detail/constant.h"
+#include "coke/detail/shard_config.h"
+
+namespace coke {
+
+/**
+ * @brief A snapshot of LatencyHistogram, the values are in microseconds.
+ *        Snapshots of the same layout can be merged, such as the histograms
+ *        of several servers.
+*/
+struct HistogramSnapshot {
+    uint64_t count{0};
+    uint64_t sum{0};
+    uint64_t max{0};
+    std::vector<uint64_t> buckets;
+
+    /**
+     * @brief Get the value at percentile `p` in [0.0, 1.0], which is the
+     *        upper bound of the bucket, so the relative error is below 1/16.
+    */
+    uint64_t percentile(double p) const noexcept;
+
+    double mean() const noexcept {
+        return count ? double(sum) / double(count) : 0.0;
+    }
+
+    void merge(const HistogramSnapshot &other);
+};
+
+/**
+ * @brief LatencyHistogram records latencies into log-linear buckets like HDR
+ *        histogram, each power of two is split into 16 buckets. Recording is
+ *        lock free, each thread adds to the local shard by relaxed atomic
+ *        operations, and the shards are merged only by snapshot.
+*/
+class LatencyHistogram {
+public:
+    static constexpr std::size_t SUB_BITS = 4;
+    static constexpr std::size_t SUB_BUCKETS = std::size_t(1) << SUB_BITS;
+    // Values up to 2^MAX_BITS microseconds(about 19 hours) are distinguished
+    static constexpr std::size_t MAX_BITS = 36;
+    static constexpr std::size_t NUM_BUCKETS =
+        (MAX_BITS - SUB_BITS + 2) * SUB_BUCKETS;
+    static constexpr std::size_t NUM_SHARDS = 8;
+
+    LatencyHistogram() = default;
+
+    LatencyHistogram(const LatencyHistogram &) = delete;
+    LatencyHistogram &operator= (const LatencyHistogram &) = delete;
+
+    ~LatencyHistogram() = default;
+
+    /**
+     * @brief Record a latency of `us` microseconds.
+    */
+    void record(uint64_t us) noexcept {
+        Shard &shard = shards[detail::get_thread_index() % NUM_SHARDS];
+        std::size_t idx = bucket_index(us);
+
+        shard.buckets[idx].fetch_add(1, std::memory_order_relaxed);
+        shard.count.fetch_add(1, std::memory_order_relaxed);
+        shard.sum.fetch_add(us, std::memory_order_relaxed);
+
+        uint64_t old = shard.max.load(std::memory_order_relaxed);
+        while (old < us && !shard.max.compare_exchange_weak(old, us,
+                                std::memory_order_relaxed))
+            ;
+    }
+
+    /**
+     * @brief Merge the shards into a snapshot, records happening at the same
+     *        time may be partially included.
+    */
+    HistogramSnapshot snapshot() const;
+
+    /**
+     * @brief Clear all the records, it should not be called concurrently
+     *        with record.
+    */
+    void reset() noexcept;
+
+    static std::size_t bucket_index(uint64_t v) noexcept {
+        if (v < SUB_BUCKETS)
+            return (std::size_t)v;
+
+        std::size_t e = std::bit_width(v) - 1;
+        if (e > MAX_BITS)
+            return NUM_BUCKETS - 1;
+
+        std::size_t m = (std::size_t)(v >> (e - SUB_BITS));
+        return (e - SUB_BITS + 1) * SUB_BUCKETS + m - SUB_BUCKETS;
+    }
+
+    /**
+     * @brief The max value in the bucket `idx`.
+    */
+    static uint64_t bucket_upper(std::size_t idx) noexcept {
+        if (idx < SUB_BUCKETS)
+            return idx;
+
+        std::size_t e = idx / SUB_BUCKETS + SUB_BITS - 1;
+        uint64_t m = idx % SUB_BUCKETS + SUB_BUCKETS;
+        return ((m + 1) << (e - SUB_BITS)) - 1;
+    }
+
+private:
+    struct alignas(detail::DESTRUCTIVE_ALIGN) Shard {
+        std::atomic<uint64_t> count{0};
+        std::atomic<uint64_t> sum{0};
+        std::atomic<uint64_t> max{0};
+        std::atomic<uint64_t> buckets[NUM_BUCKETS]{};
+    };
+
+    Shard shards[NUM_SHARDS];
+};
+
+} // namespace coke
+
+#endif // COKE_LATENCY_HISTOGRAM_H
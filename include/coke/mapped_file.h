@@ -0,0 +1,148 @@
+/**
+ * Copyright 2024 Coke Project (https://github.com/kedixa/coke)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Authors: kedixa (https://github.com/kedixa)
+*/
+
+#ifndef COKE_MAPPED_FILE_H
+#define COKE_MAPPED_FILE_H
+
+#include <algorithm>
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <sys/types.h>
+
+#include "coke/task.h"
+
+namespace coke {
+
+/**
+ * @brief MappedFile maps a whole file read only for read mostly data such
+ *        as index files. Reading a page that is not resident blocks the
+ *        current thread on a page fault, use `prefetch` to bring the pages in
+ *        on the go executor before reading them in handler threads, or use
+ *        coke::pread for the cold path.
+ *
+ *  coke::MappedFile file;
+ *  if (file.open(path) == 0 && co_await file.prefetch(off, len) == 0)
+ *      consume(file.view(off, len));
+*/
+class MappedFile {
+public:
+    MappedFile() noexcept = default;
+
+    MappedFile(MappedFile &&that) noexcept
+        : addr(that.addr), length(that.length), page_size(that.page_size)
+    {
+        that.addr = nullptr;
+        that.length = 0;
+    }
+
+    MappedFile &operator= (MappedFile &&that) noexcept {
+        if (this != &that) {
+            unmap();
+
+            addr = that.addr;
+            length = that.length;
+            page_size = that.page_size;
+
+            that.addr = nullptr;
+            that.length = 0;
+        }
+
+        return *this;
+    }
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator= (const MappedFile &) = delete;
+
+    ~MappedFile() { unmap(); }
+
+    /**
+     * @brief Open and map the file at `path`, the fd is closed after mapped.
+     *
+     * @return 0 on success, or a negative errno.
+    */
+    int open(const std::string &path);
+
+    /**
+     * @brief Map the whole file of `fd`, the fd can be closed after mapped.
+     *
+     * @return 0 on success, or a negative errno.
+    */
+    int map(int fd);
+
+    /**
+     * @brief Unmap the file, the views got before are invalid.
+    */
+    void unmap() noexcept;
+
+    bool valid() const noexcept { return addr != nullptr; }
+
+    const char *data() const noexcept { return static_cast<const char *>(addr); }
+    std::size_t size() const noexcept { return length; }
+
+    /**
+     * @brief Get the view of [offset, offset + len), clamped to the file.
+    */
+    std::string_view view(std::size_t offset, std::size_t len) const noexcept {
+        if (offset >= length)
+            return std::string_view();
+
+        return std::string_view(data() + offset, std::min(len, length - offset));
+    }
+
+    /**
+     * @brief Bring the pages of [offset, offset + len) into memory on the go
+     *        executor, by madvise(MADV_WILLNEED) and reading one byte of each
+     *        page, without blocking the current thread.
+     *
+     * @return 0 on success, or a negative errno.
+    */
+    Task<int> prefetch(std::size_t offset, std::size_t len) const;
+
+    /**
+     * @brief Check whether all the pages of [offset, offset + len) are
+     *        resident by mincore, it doesn't block on page fault.
+     *
+     * @return 1 if all resident, 0 if not, or a negative errno.
+    */
+    int is_resident(std::size_t offset, std::size_t len) const;
+
+    /**
+     * @brief Call madvise on the pages of [offset, offset + len), such as
+     *        MADV_RANDOM for random access index files.
+     *
+     * @return 0 on success, or a negative errno.
+    */
+    int advise(std::size_t offset, std::size_t len, int advice) const;
+
+private:
+    bool page_range(std::size_t offset, std::size_t len,
+                    std::size_t &begin, std::size_t &end) const noexcept;
+
+    static int prefetch_pages(const char *addr, std::size_t begin,
+                              std::size_t end, std::size_t page_size);
+
+private:
+    void *addr{nullptr};
+    std::size_t length{0};
+    std::size_t page_size{0};
+};
+
+} // namespace coke
+
+#endif // COKE_MAPPED_FILE_H
@@ -0,0 +1,224 @@
+/**
+ * Copyright 2024 Coke Project (https://github.com/kedixa/coke)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Authors: kedixa (https://github.com/kedixa)
+*/
+
+#ifndef COKE_METRICS_H
+#define COKE_METRICS_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "coke/detail/constant.h"
+#include "coke/detail/shard_config.h"
+#include "coke/latency_histogram.h"
+
+namespace coke {
+
+enum class MetricType {
+    COUNTER,
+    GAUGE,
+    SUMMARY,
+};
+
+/**
+ * @brief The labels of a metric series, such as {{"method", "GET"}}. The
+ *        order is kept as given, so use the same order for the same series.
+*/
+using MetricLabels = std::vector<std::pair<std::string, std::string>>;
+
+/**
+ * @brief MetricCounter is a monotonically increasing counter. Each thread
+ *        adds to the local shard by relaxed atomic operations, and the shards
+ *        are summed only when it is read.
+*/
+class MetricCounter {
+public:
+    static constexpr std::size_t NUM_SHARDS = 8;
+
+    MetricCounter() = default;
+
+    MetricCounter(const MetricCounter &) = delete;
+    MetricCounter &operator= (const MetricCounter &) = delete;
+
+    void add(uint64_t n = 1) noexcept {
+        Shard &shard = shards[detail::get_thread_index() % NUM_SHARDS];
+        shard.value.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    uint64_t value() const noexcept {
+        uint64_t sum = 0;
+        for (const Shard &shard : shards)
+            sum += shard.value.load(std::memory_order_relaxed);
+        return sum;
+    }
+
+private:
+    struct alignas(detail::DESTRUCTIVE_ALIGN) Shard {
+        std::atomic<uint64_t> value{0};
+    };
+
+    Shard shards[NUM_SHARDS];
+};
+
+/**
+ * @brief MetricGauge is a value that can go up and down, such as the number
+ *        of running requests.
+*/
+class MetricGauge {
+public:
+    MetricGauge() = default;
+
+    MetricGauge(const MetricGauge &) = delete;
+    MetricGauge &operator= (const MetricGauge &) = delete;
+
+    void set(int64_t v) noexcept { val.store(v, std::memory_order_relaxed); }
+
+    void add(int64_t n = 1) noexcept {
+        val.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    void sub(int64_t n = 1) noexcept {
+        val.fetch_sub(n, std::memory_order_relaxed);
+    }
+
+    int64_t value() const noexcept {
+        return val.load(std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<int64_t> val{0};
+};
+
+/**
+ * @brief MetricsRegistry owns named metrics and exports them in Prometheus
+ *        text format. A metric is identified by its name and labels, getting
+ *        it again returns the same object, so look it up once and keep the
+ *        reference on hot paths. The metrics are alive until the registry is
+ *        destroyed, even if they are removed from it.
+ *
+ * Histograms are LatencyHistogram and exported as summaries with quantiles
+ * 0.5, 0.9, 0.99 and 0.999, the values are exported as recorded, so keep the
+ * unit in the name, such as "rpc_latency_microseconds".
+ *
+ * Registering a name with another type throws std::invalid_argument.
+*/
+class MetricsRegistry {
+public:
+    using ValueFunc = std::function<double()>;
+    using SnapshotFunc = std::function<HistogramSnapshot()>;
+
+    MetricsRegistry() = default;
+
+    MetricsRegistry(const MetricsRegistry &) = delete;
+    MetricsRegistry &operator= (const MetricsRegistry &) = delete;
+
+    ~MetricsRegistry() = default;
+
+    MetricCounter &counter(std::string_view name, std::string_view help,
+                           const MetricLabels &labels = {});
+
+    MetricGauge &gauge(std::string_view name, std::string_view help,
+                       const MetricLabels &labels = {});
+
+    LatencyHistogram &histogram(std::string_view name, std::string_view help,
+                                const MetricLabels &labels = {});
+
+    /**
+     * @brief Add a counter or gauge whose value is got by calling `func` on
+     *        each export, which is used to export the statistics kept by
+     *        others, such as coke::get_sleep_map_stats_by_id. Adding the same
+     *        series again replaces the function.
+     *
+     *        `func` is called with the registry's lock held, it should be
+     *        fast and must not use the registry.
+    */
+    void add_callback(std::string_view name, std::string_view help,
+                      MetricType type, const MetricLabels &labels,
+                      ValueFunc func);
+
+    /**
+     * @brief Add a summary whose snapshot is got by calling `func` on each
+     *        export, such as the histograms of ServerLatencyStats.
+    */
+    void add_callback(std::string_view name, std::string_view help,
+                      const MetricLabels &labels, SnapshotFunc func);
+
+    /**
+     * @brief Remove a series from the export. After it returns, the callback
+     *        of the series is never called again, so remove the callbacks
+     *        before the objects they refer to are destroyed.
+     *
+     * @return Whether the series is found.
+    */
+    bool remove(std::string_view name, const MetricLabels &labels = {});
+
+    /**
+     * @brief Append all the metrics to `out` in Prometheus text format, the
+     *        families are sorted by name.
+    */
+    void export_prometheus(std::string &out) const;
+
+    std::string export_prometheus() const {
+        std::string out;
+        export_prometheus(out);
+        return out;
+    }
+
+private:
+    struct Series {
+        std::string labels;
+        std::unique_ptr<MetricCounter> counter;
+        std::unique_ptr<MetricGauge> gauge;
+        std::unique_ptr<LatencyHistogram> histogram;
+        ValueFunc value_func;
+        SnapshotFunc snapshot_func;
+    };
+
+    struct Family {
+        std::string help;
+        MetricType type;
+        std::vector<std::unique_ptr<Series>> series;
+    };
+
+    Series &get_series(std::string_view name, std::string_view help,
+                       MetricType type, const MetricLabels &labels);
+
+private:
+    mutable std::mutex mtx;
+    std::map<std::string, Family, std::less<>> families;
+
+    // Keep the removed metrics alive, because their references may be held
+    std::vector<std::unique_ptr<Series>> removed;
+};
+
+/**
+ * @brief The process wide registry, which is used by default.
+*/
+MetricsRegistry &default_metrics_registry();
+
+} // namespace coke
+
+#endif // COKE_METRICS_H
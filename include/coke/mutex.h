@@ -19,17 +19,87 @@
 #ifndef COKE_MUTEX_H
 #define COKE_MUTEX_H
 
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+
+#include "coke/detail/constant.h"
 #include "coke/detail/exception_config.h"
+#include "coke/detail/shard_config.h"
+#include "coke/detail/spin_wait.h"
 #include "coke/semaphore.h"
 
 namespace coke {
 
+class Mutex;
+
+/**
+ * @brief The awaiter returned by Mutex::lock and Mutex::try_lock_for. When the
+ *        mutex is not contended, it is locked in `await_ready` by a single
+ *        atomic operation, without creating a coroutine, otherwise it waits on
+ *        a coroutine created by the mutex.
+*/
+class [[nodiscard]] MutexLockAwaiter : public AwaiterBase {
+public:
+    MutexLockAwaiter(Mutex *mtx, detail::TimedWaitHelper helper) noexcept
+        : mtx(mtx), helper(helper), ret(TOP_SUCCESS)
+    { }
+
+    MutexLockAwaiter(MutexLockAwaiter &&) = default;
+
+    bool await_ready();
+
+    template<typename PromiseType>
+    auto await_suspend(std::coroutine_handle<PromiseType> h) {
+        awaiter.emplace(task.await_into(&ret));
+        return awaiter->await_suspend(h);
+    }
+
+    int await_resume() {
+        if (awaiter)
+            awaiter->await_resume();
+
+        return ret;
+    }
+
+private:
+    Mutex *mtx;
+    detail::TimedWaitHelper helper;
+    int ret;
+
+    Task<int> task;
+    std::optional<detail::TaskSlotAwaiter<int>> awaiter;
+};
+
+
 class Mutex {
+    static constexpr uint32_t LOCKED = 1;
+    static constexpr uint32_t ONE_WAITER = 2;
+
 public:
     /**
      * @brief Create a Mutex.
     */
-    Mutex() noexcept : sem(1) { }
+    Mutex() noexcept : Mutex(false) { }
+
+    /**
+     * @brief Create a Mutex, with handoff mode if `handoff` is true.
+     *
+     * By default, `unlock` releases the mutex and wakes up a waiter, which
+     * tries to lock it again and parks again if a newcomer locks it first.
+     * In handoff mode, `unlock` passes the ownership to the first waiter
+     * directly if there is any, so that each wake up is useful and there is
+     * no retry convoy under contention, at the cost of the throughput when
+     * the mutex is held very shortly, because no one can lock it between the
+     * unlock and the waiter resumes.
+    */
+    explicit Mutex(bool handoff) noexcept
+        : state(0), handoff(handoff), head(nullptr), tail(nullptr)
+    { }
 
     /**
      * @brief Mutex is neither copyable nor movable.
@@ -46,44 +116,156 @@ public:
      *
      * @pre Current coroutine doesn't owns the mutex.
     */
-    bool try_lock() { return sem.try_acquire(); }
+    bool try_lock() noexcept {
+        uint32_t s = state.load(std::memory_order_relaxed);
+
+        while (!(s & LOCKED)) {
+            if (state.compare_exchange_weak(s, s | LOCKED,
+                                            std::memory_order_acquire,
+                                            std::memory_order_relaxed))
+                return true;
+        }
+
+        return false;
+    }
 
     /**
      * @brief Unlock the mutex.
      *
      * @pre Current coroutine must owns the mutex.
     */
-    void unlock() { return sem.release(1); }
+    void unlock() {
+        if (handoff) {
+            uint32_t s = LOCKED;
+            if (!state.compare_exchange_strong(s, 0, std::memory_order_release,
+                                               std::memory_order_relaxed))
+                unlock_handoff();
+            return;
+        }
+
+        uint32_t s = state.fetch_sub(LOCKED, std::memory_order_release);
+
+        if (s != LOCKED)
+            wake_one();
+    }
+
+    /**
+     * @brief Whether the mutex is created in handoff mode.
+    */
+    bool is_handoff() const noexcept { return handoff; }
 
     /**
      * @brief Lock the mutex, block until success.
      *
      * @pre Current coroutine doesn't owns the mutex.
-     * @return Coroutine(coke::Task<int>) that needs to be awaited immediately.
+     * @return An awaiter that needs to be awaited immediately.
      *         See try_lock_for but ignore coke::TOP_TIMEOUT.
     */
-    Task<int> lock() { return sem.acquire(); }
+    MutexLockAwaiter lock() {
+        return MutexLockAwaiter(this, detail::TimedWaitHelper{});
+    }
 
     /**
      * @brief Lock the mutex, block until success or `nsec` timeout.
      *
      * @pre Current coroutine doesn't owns the mutex.
      * @param nsec Max time to block.
-     * @return Coroutine(coke::Task<int>) that needs to be awaited immediately.
+     * @return An awaiter that needs to be awaited immediately.
      * @retval coke::TOP_SUCCESS If lock success.
      * @retval coke::TOP_TIMEOUT If `nsec` timeout.
      * @retval coke::TOP_ABORTED If process exit.
      * @retval Negative integer to indicate system error, almost never happens.
      * @see coke/global.h
     */
-    Task<int> try_lock_for(NanoSec nsec) {
-        return sem.try_acquire_for(nsec);
+    MutexLockAwaiter try_lock_for(NanoSec nsec) {
+        return MutexLockAwaiter(this, detail::TimedWaitHelper{nsec});
+    }
+
+    /**
+     * @brief Same as try_lock_for, but block until `deadline`.
+    */
+    MutexLockAwaiter try_lock_until(SteadyTimePoint deadline) {
+        return MutexLockAwaiter(this, detail::TimedWaitHelper{deadline});
+    }
+
+private:
+    /**
+     * @brief Lock without waiting if the mutex is neither locked nor waited
+     *        by others, so that the waiters are not starved.
+    */
+    bool lock_fast() noexcept {
+        uint32_t s = 0;
+        return state.compare_exchange_strong(s, LOCKED,
+                                             std::memory_order_acquire,
+                                             std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Spin a while waiting for the owner to unlock, give up as soon as
+     *        anyone is parked, see GlobalSettings::lock_spin_count.
+    */
+    bool lock_spin() noexcept {
+        std::size_t n = detail::get_lock_spin_count();
+
+        for (std::size_t i = 0; i < n; i++) {
+            detail::cpu_relax();
+
+            uint32_t s = state.load(std::memory_order_relaxed);
+            if (s & ~LOCKED)
+                return false;
+
+            if (s == 0 && lock_fast())
+                return true;
+        }
+
+        return false;
+    }
+
+    Task<int> lock_slow(detail::TimedWaitHelper helper);
+
+    /**
+     * @brief Wait in the queue until `unlock_handoff` passes the ownership to
+     *        this waiter, the mutex stays locked during the handoff.
+    */
+    Task<int> lock_handoff(detail::TimedWaitHelper helper);
+
+    void wake_one();
+
+    void unlock_handoff();
+
+    const void *get_addr() const noexcept {
+        return (const char *)this + 1;
     }
 
 private:
-    Semaphore sem;
+    struct Waiter;
+
+    // The lowest bit is LOCKED, and the others are the number of waiters
+    std::atomic<uint32_t> state;
+    bool handoff;
+
+    // Makes registering a waiter and waking it up in order
+    std::mutex mtx;
+
+    // The queue of waiters in handoff mode, which live in the frames of
+    // lock_handoff
+    Waiter *head;
+    Waiter *tail;
+
+    friend class MutexLockAwaiter;
 };
 
+inline bool MutexLockAwaiter::await_ready() {
+    if (mtx->lock_fast() || mtx->lock_spin())
+        return true;
+
+    if (mtx->handoff)
+        task = mtx->lock_handoff(helper);
+    else
+        task = mtx->lock_slow(helper);
+    return false;
+}
+
 template<typename M>
 class UniqueLock {
 public:
@@ -194,6 +376,22 @@ public:
         co_return ret;
     }
 
+    /**
+     * @brief Try to lock the mutex until `deadline`, see
+     *        Mutex::try_lock_until.
+     * @throw std::system_error if already locked.
+     */
+    Task<int> try_lock_until(SteadyTimePoint deadline) {
+        if (owns)
+            detail::throw_system_error(std::errc::resource_deadlock_would_occur);
+
+        int ret = co_await co_mtx->try_lock_until(deadline);
+        if (ret == coke::TOP_SUCCESS)
+            owns = true;
+
+        co_return ret;
+    }
+
     /**
      * @brief Unlock the associated mutex.
      * @throw std::system_error if not owns lock.
@@ -211,6 +409,164 @@ private:
     bool owns;
 };
 
+/**
+ * @brief KeyedMutex serializes the operations on the same key, while those on
+ *        different keys go on concurrently. The Mutex of each key is created
+ *        lazily in a sharded hash table, reference counted by the holder and
+ *        waiters, and destroyed when the last one releases it, so the memory
+ *        is bounded by the number of keys in use rather than all keys seen.
+ *        The number of shards is the same as the internal mutex table, see
+ *        GlobalSettings::mutex_table_shards.
+*/
+template<typename K, typename Hash = std::hash<K>,
+         typename KeyEqual = std::equal_to<K>>
+class KeyedMutex {
+    struct Entry {
+        Mutex mtx;
+        std::size_t refs{0};
+    };
+
+    struct alignas(detail::DESTRUCTIVE_ALIGN) Shard {
+        std::mutex mtx;
+        std::unordered_map<K, Entry, Hash, KeyEqual> entries;
+    };
+
+public:
+    using KeyType = K;
+
+    /**
+     * @brief Create a KeyedMutex.
+    */
+    KeyedMutex()
+        : mask(detail::get_mutex_table_shards() - 1),
+          shards(new Shard[mask + 1])
+    { }
+
+    /**
+     * @brief KeyedMutex is neither copyable nor movable.
+    */
+    KeyedMutex(const KeyedMutex &) = delete;
+    KeyedMutex &operator= (const KeyedMutex &) = delete;
+
+    /**
+     * @pre No key is locked or waited.
+    */
+    ~KeyedMutex() = default;
+
+    /**
+     * @brief Try to lock `key` without blocking.
+     *
+     * @return Return true if lock success, else false.
+     * @pre Current coroutine doesn't owns `key`.
+    */
+    bool try_lock(const K &key) {
+        Shard &shard = get_shard(key);
+        Entry *e = acquire(shard, key);
+
+        if (e->mtx.try_lock())
+            return true;
+
+        release(shard, key, e);
+        return false;
+    }
+
+    /**
+     * @brief Unlock `key`.
+     *
+     * @pre Current coroutine owns `key`.
+    */
+    void unlock(const K &key) {
+        Shard &shard = get_shard(key);
+        Entry *e;
+
+        {
+            std::lock_guard<std::mutex> lg(shard.mtx);
+            e = &shard.entries.find(key)->second;
+        }
+
+        // The entry is kept by the reference of current owner until released
+        e->mtx.unlock();
+        release(shard, key, e);
+    }
+
+    /**
+     * @brief Lock `key`, block until success.
+     *
+     * @return Coroutine(coke::Task<int>) that needs to be awaited immediately.
+     *         See try_lock_for but ignore coke::TOP_TIMEOUT.
+     * @pre Current coroutine doesn't owns `key`.
+    */
+    Task<int> lock(const K &key) {
+        return lock_impl(key, detail::TimedWaitHelper{});
+    }
+
+    /**
+     * @brief Lock `key`, block until success or `nsec` timeout, the return
+     *        values are the same as Mutex::try_lock_for.
+    */
+    Task<int> try_lock_for(const K &key, NanoSec nsec) {
+        return lock_impl(key, detail::TimedWaitHelper{nsec});
+    }
+
+    /**
+     * @brief Same as try_lock_for, but block until `deadline`.
+    */
+    Task<int> try_lock_until(const K &key, SteadyTimePoint deadline) {
+        return lock_impl(key, detail::TimedWaitHelper{deadline});
+    }
+
+    /**
+     * @brief Get the number of keys that are locked or waited now, for
+     *        debugging and monitoring.
+    */
+    std::size_t size() const {
+        std::size_t n = 0;
+
+        for (std::size_t i = 0; i <= mask; i++) {
+            std::lock_guard<std::mutex> lg(shards[i].mtx);
+            n += shards[i].entries.size();
+        }
+
+        return n;
+    }
+
+private:
+    Shard &get_shard(const K &key) const noexcept {
+        uint64_t h = detail::mix_hash((uint64_t)Hash{}(key));
+        return shards[h & mask];
+    }
+
+    Entry *acquire(Shard &shard, const K &key) {
+        std::lock_guard<std::mutex> lg(shard.mtx);
+        Entry *e = &shard.entries.try_emplace(key).first->second;
+
+        ++e->refs;
+        return e;
+    }
+
+    void release(Shard &shard, const K &key, Entry *e) {
+        std::lock_guard<std::mutex> lg(shard.mtx);
+
+        if (--e->refs == 0)
+            shard.entries.erase(key);
+    }
+
+    Task<int> lock_impl(K key, detail::TimedWaitHelper helper) {
+        Shard &shard = get_shard(key);
+        Entry *e = acquire(shard, key);
+        int ret = co_await MutexLockAwaiter(&e->mtx, helper);
+
+        if (ret != TOP_SUCCESS)
+            release(shard, key, e);
+
+        co_return ret;
+    }
+
+private:
+    const std::size_t mask;
+    std::unique_ptr<Shard[]> shards;
+};
+
 } // namespace coke
 
 #endif // COKE_MUTEX_H
@@ -19,9 +19,16 @@
 #ifndef COKE_MYSQL_CLIENT_H
 #define COKE_MYSQL_CLIENT_H
 
+#include <cstddef>
 #include <string>
+#include <string_view>
+#include <vector>
 
+#include "coke/async_generator.h"
+#include "coke/global.h"
+#include "coke/mysql/mysql_utils.h"
 #include "coke/net/network.h"
+#include "coke/task.h"
 
 #include "workflow/MySQLMessage.h"
 #include "workflow/URIParser.h"
@@ -49,12 +56,76 @@ struct MySQLClientParams {
     std::string character_set_results;
 };
 
+struct MySQLBatchParams {
+    // Max number of statements combined into one multi-statement query
+    std::size_t max_statements  = 256;
+
+    // Max length of a combined query, a statement longer than it is sent
+    // alone. It should be less than the server's max_allowed_packet.
+    std::size_t max_query_size  = 1024 * 1024;
+};
+
+/**
+ * @brief MySQLBatch collects many small statements, such as INSERT and
+ *        UPDATE, to be executed by MySQLClient::execute_batch with few round
+ *        trips. Each statement must produce exactly one result set, so CALL
+ *        of stored procedures is not supported.
+*/
+class MySQLBatch {
+public:
+    MySQLBatch() = default;
+
+    /**
+     * @brief Add a statement, the trailing semicolons are removed.
+    */
+    void add(std::string_view stmt);
+
+    std::string_view get_statement(std::size_t i) const {
+        std::size_t first = (i == 0) ? 0 : ends[i - 1];
+        return std::string_view(buf).substr(first, ends[i] - first);
+    }
+
+    std::size_t size() const { return ends.size(); }
+    bool empty() const { return ends.empty(); }
+
+    void clear() {
+        buf.clear();
+        ends.clear();
+    }
+
+private:
+    std::string buf;
+    std::vector<std::size_t> ends;
+};
+
+struct MySQLBatchResult {
+    MySQLBatchResult() = default;
+    MySQLBatchResult(MySQLBatchResult &&) = default;
+    MySQLBatchResult &operator= (MySQLBatchResult &&) = default;
+
+    // The state and error of the first failed request, or STATE_SUCCESS
+    int state{STATE_SUCCESS};
+    int error{0};
+
+    // Number of statements that have a result set, the execution stops at
+    // the first failed request or error result set.
+    std::size_t executed{0};
+
+    // views[i] is the result set of the i-th statement of the batch, it is
+    // an empty view if the statement is not executed. The views refer to
+    // resps and valid until this object is destroyed.
+    std::vector<MySQLResultSetView> views;
+    std::vector<MySQLResponse> resps;
+};
+
 class MySQLClient {
 public:
     using ReqType = MySQLRequest;
     using RespType = MySQLResponse;
     using AwaiterType = MySQLAwaiter;
 
+    static constexpr std::size_t MYSQL_STREAM_BATCH_ROWS = 4096;
+
 public:
     explicit MySQLClient(const MySQLClientParams &params)
         : MySQLClient(params, false, 0)
@@ -77,6 +148,48 @@ public:
     */
     AwaiterType request(const std::string &query);
 
+    /**
+     * @brief Read the rows of a large SELECT batch by batch, each batch is
+     *        requested with `LIMIT offset, batch_rows` appended to `query`,
+     *        and the next batch is requested only when the consumer asks for
+     *        it, so that the memory used is bounded by `batch_rows` no matter
+     *        how many rows the query returns.
+     *
+     * The `query` must be a single SELECT without LIMIT, and should have an
+     * ORDER BY on a unique key so that the batches don't overlap. Use a
+     * MySQLConnection in a transaction with consistent snapshot if the rows
+     * may be modified during streaming.
+     *
+     * Each yielded MySQLResult holds the response of one batch. If an error
+     * occurs, or a batch has less than `batch_rows` rows, that result is
+     * yielded and the generator finishes. The MySQLClient must be alive until
+     * the generator finishes.
+     *
+     *  auto gen = client.stream("SELECT * FROM t ORDER BY id");
+     *  while (auto res = co_await gen.next()) {
+     *      if (res->state != coke::STATE_SUCCESS)
+     *          break;
+     *      for (coke::MySQLResultSetView view : coke::MySQLResultSetCursor(res->resp))
+     *          consume(view);
+     *  }
+    */
+    AsyncGenerator<MySQLResult> stream(std::string query,
+                                       std::size_t batch_rows =
+                                           MYSQL_STREAM_BATCH_ROWS);
+
+    /**
+     * @brief Execute the statements of `batch` in order, consecutive
+     *        statements are combined into multi-statement queries limited by
+     *        `params`, so that it costs one round trip per query instead of
+     *        per statement.
+     *
+     * Combined queries are not atomic, use a MySQLConnection in a transaction
+     * if needed. Like the other requests, the query may be retried according
+     * to MySQLClientParams::retry_max.
+    */
+    Task<MySQLBatchResult> execute_batch(const MySQLBatch &batch,
+                                         MySQLBatchParams params = {});
+
 protected:
     MySQLClient(const MySQLClientParams &params,
                 bool unique_conn, std::size_t conn_id);
@@ -88,6 +201,11 @@ protected:
 
     std::string url;
     ParsedURI uri;
+
+    // The parts of url before and after the host and port, used to make the
+    // url of a replica when params.host is an upstream group.
+    std::string url_prefix;
+    std::string url_suffix;
 };
 
 /**
@@ -99,6 +217,9 @@ protected:
  * fails, the current connection will be closed, and the connection will be
  * re-established for the next request.
  *
+ * If params.host is an upstream group, the replica is selected once when the
+ * MySQLConnection is created, and all the requests are sent to it.
+ *
 */
 class MySQLConnection : public MySQLClient {
     static std::size_t acquire_conn_id();
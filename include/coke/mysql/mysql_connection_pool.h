@@ -0,0 +1,197 @@
+/**
+ * Copyright 2024 Coke Project (https://github.com/kedixa/coke)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Authors: kedixa (https://github.com/kedixa)
+*/
+
+#ifndef COKE_MYSQL_CONNECTION_POOL_H
+#define COKE_MYSQL_CONNECTION_POOL_H
+
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "coke/mysql/mysql_client.h"
+#include "coke/latency_histogram.h"
+#include "coke/semaphore.h"
+#include "coke/sleep.h"
+#include "coke/wait_group.h"
+
+namespace coke {
+
+struct MySQLPoolParams {
+    // Max number of connections handed out at the same time
+    std::size_t max_connections = 16;
+
+    // Max number of idle connections kept in the pool, the others are
+    // disconnected when they are returned
+    std::size_t max_idle        = 16;
+
+    // Sent when a connection is returned to reset its session state, such as
+    // an unfinished transaction. The connection is disconnected if it fails.
+    // Empty disables it.
+    std::string reset_query     = "ROLLBACK";
+};
+
+class MySQLConnectionPool;
+
+/**
+ * @brief A MySQLConnection acquired from MySQLConnectionPool, it is returned
+ *        to the pool when released or destroyed.
+*/
+class MySQLPooledConnection {
+public:
+    MySQLPooledConnection() = default;
+
+    MySQLPooledConnection(MySQLPooledConnection &&that) noexcept
+        : pool(that.pool), conn(std::move(that.conn)), broken(that.broken)
+    {
+        that.pool = nullptr;
+        that.broken = false;
+    }
+
+    MySQLPooledConnection &operator= (MySQLPooledConnection &&that) noexcept {
+        if (this != &that) {
+            release();
+
+            pool = that.pool;
+            conn = std::move(that.conn);
+            broken = that.broken;
+
+            that.pool = nullptr;
+            that.broken = false;
+        }
+
+        return *this;
+    }
+
+    ~MySQLPooledConnection() { release(); }
+
+    bool valid() const noexcept { return (bool)conn; }
+
+    MySQLConnection *get() const noexcept { return conn.get(); }
+    MySQLConnection *operator->() const noexcept { return conn.get(); }
+    MySQLConnection &operator*() const noexcept { return *conn; }
+
+    /**
+     * @brief Disconnect the connection instead of reusing it, for example
+     *        when a request fails and the session state is unknown.
+    */
+    void set_broken() noexcept { broken = true; }
+
+    /**
+     * @brief Return the connection to the pool now.
+    */
+    void release();
+
+private:
+    MySQLConnectionPool *pool{nullptr};
+    std::unique_ptr<MySQLConnection> conn;
+    bool broken{false};
+
+    friend class MySQLConnectionPool;
+};
+
+/**
+ * @brief MySQLConnectionPool keeps warm MySQLConnections for transactions, so
+ *        that a short transaction doesn't pay for the connection setup. The
+ *        connections are kept alive by Workflow for keep_alive_timeout of
+ *        MySQLClientParams after the last request.
+ *
+ *        Call `close` and wait for it before the pool is destroyed.
+*/
+class MySQLConnectionPool {
+public:
+    explicit MySQLConnectionPool(const MySQLClientParams &client_params,
+                                 const MySQLPoolParams &params = {});
+    ~MySQLConnectionPool() = default;
+
+    MySQLConnectionPool(const MySQLConnectionPool &) = delete;
+    MySQLConnectionPool &operator= (const MySQLConnectionPool &) = delete;
+
+    /**
+     * @brief Acquire a connection, the idle ones are used first.
+     *
+     * @return coke::TOP_SUCCESS, or a negative errno.
+    */
+    Task<int> acquire(MySQLPooledConnection &conn) {
+        return acquire_impl(detail::TimedWaitHelper{}, conn);
+    }
+
+    /**
+     * @brief Same as acquire, but wait at most `nsec`.
+     *
+     * @return coke::TOP_SUCCESS, coke::TOP_TIMEOUT, or a negative errno.
+    */
+    Task<int> try_acquire_for(NanoSec nsec, MySQLPooledConnection &conn) {
+        return acquire_impl(detail::TimedWaitHelper(nsec), conn);
+    }
+
+    /**
+     * @brief Wait for the connections being reset, and disconnect all the
+     *        idle connections. All the acquired connections must be returned
+     *        before close.
+    */
+    Task<> close();
+
+    std::size_t idle_count() const {
+        std::lock_guard<std::mutex> lg(mtx);
+        return idle.size();
+    }
+
+    /**
+     * @brief The histogram of the time in microseconds spent waiting for a
+     *        connection in acquire.
+    */
+    HistogramSnapshot get_wait_stats() const { return wait_hist.snapshot(); }
+
+private:
+    Task<int> acquire_impl(detail::TimedWaitHelper helper,
+                           MySQLPooledConnection &conn);
+
+    void put_back(std::unique_ptr<MySQLConnection> conn, bool broken);
+    Task<> reset_connection(std::unique_ptr<MySQLConnection> conn);
+    Task<> disconnect(std::unique_ptr<MySQLConnection> conn);
+
+private:
+    MySQLClientParams client_params;
+    MySQLPoolParams params;
+
+    Semaphore sem;
+    WaitGroup pending;
+
+    mutable std::mutex mtx;
+    bool closed{false};
+    std::vector<std::unique_ptr<MySQLConnection>> idle;
+
+    LatencyHistogram wait_hist;
+
+    friend class MySQLPooledConnection;
+};
+
+inline void MySQLPooledConnection::release() {
+    if (pool && conn)
+        pool->put_back(std::move(conn), broken);
+
+    pool = nullptr;
+    conn.reset();
+    broken = false;
+}
+
+} // namespace coke
+
+#endif // COKE_MYSQL_CONNECTION_POOL_H
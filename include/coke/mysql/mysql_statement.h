@@ -0,0 +1,135 @@
+/**
+ * Copyright 2024 Coke Project (https://github.com/kedixa/coke)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Authors: kedixa (https://github.com/kedixa)
+*/
+
+#ifndef COKE_MYSQL_STATEMENT_H
+#define COKE_MYSQL_STATEMENT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace coke {
+
+/**
+ * @brief A parameter bound to MySQLStatement, integers and floating point
+ *        numbers are formatted with std::to_chars, strings are escaped and
+ *        quoted, nullptr means NULL.
+*/
+class MySQLParam {
+public:
+    enum Type {
+        NULL_TYPE,
+        INT_TYPE,
+        UINT_TYPE,
+        DOUBLE_TYPE,
+        STRING_TYPE,
+    };
+
+    MySQLParam(std::nullptr_t) noexcept : type(NULL_TYPE), i(0) { }
+    MySQLParam(bool v) noexcept : type(INT_TYPE), i(v ? 1 : 0) { }
+    MySQLParam(int v) noexcept : type(INT_TYPE), i(v) { }
+    MySQLParam(long v) noexcept : type(INT_TYPE), i(v) { }
+    MySQLParam(long long v) noexcept : type(INT_TYPE), i(v) { }
+    MySQLParam(unsigned v) noexcept : type(UINT_TYPE), u(v) { }
+    MySQLParam(unsigned long v) noexcept : type(UINT_TYPE), u(v) { }
+    MySQLParam(unsigned long long v) noexcept : type(UINT_TYPE), u(v) { }
+    MySQLParam(float v) noexcept : type(DOUBLE_TYPE), d(v) { }
+    MySQLParam(double v) noexcept : type(DOUBLE_TYPE), d(v) { }
+    MySQLParam(std::string_view v) noexcept : type(STRING_TYPE), s(v) { }
+    MySQLParam(const char *v) noexcept : type(STRING_TYPE), s(v) { }
+    MySQLParam(const std::string &v) noexcept : type(STRING_TYPE), s(v) { }
+
+    Type get_type() const noexcept { return type; }
+
+    /**
+     * @brief Append the SQL literal of this parameter to `out`.
+     *
+     * @return 0 on success, or -EINVAL if it is nan or infinity.
+    */
+    int append_to(std::string &out) const;
+
+private:
+    Type type;
+
+    union {
+        int64_t i;
+        uint64_t u;
+        double d;
+    };
+
+    std::string_view s;
+};
+
+/**
+ * @brief Escape `str` as the content of a quoted MySQL string literal, like
+ *        mysql_real_escape_string with a ASCII compatible character set.
+*/
+void mysql_escape_string(std::string_view str, std::string &out);
+
+/**
+ * @brief MySQLStatement parses a SQL with `?` placeholders once, and binds
+ *        parameters by formatting them into the text query. The `?` in
+ *        quoted strings, identifiers and comments are not placeholders.
+ *
+ *        Workflow's MySQL tasks only send text queries(COM_QUERY) and parse
+ *        text result sets, so the binding is done on the client side.
+*/
+class MySQLStatement {
+public:
+    MySQLStatement() = default;
+    explicit MySQLStatement(std::string_view sql);
+
+    MySQLStatement(const MySQLStatement &) = default;
+    MySQLStatement(MySQLStatement &&) = default;
+    MySQLStatement &operator= (const MySQLStatement &) = default;
+    MySQLStatement &operator= (MySQLStatement &&) = default;
+    ~MySQLStatement() = default;
+
+    std::size_t param_count() const noexcept { return pieces.size() - 1; }
+
+    const std::string &get_sql() const noexcept { return sql; }
+
+    /**
+     * @brief Bind `params` to the placeholders in order and store the query
+     *        into `query`.
+     *
+     * @return 0 on success, or -EINVAL if the number of params mismatches or
+     *         a param is invalid.
+    */
+    int bind(std::string &query, std::span<const MySQLParam> params) const;
+
+    int bind(std::string &query,
+             std::initializer_list<MySQLParam> params) const {
+        return bind(query, std::span<const MySQLParam>(params.begin(),
+                                                       params.size()));
+    }
+
+private:
+    std::string sql;
+
+    // Offset and length of the SQL text around the placeholders
+    std::vector<std::pair<std::size_t, std::size_t>> pieces{{0, 0}};
+};
+
+} // namespace coke
+
+#endif // COKE_MYSQL_STATEMENT_H
@@ -20,8 +20,16 @@
 #define COKE_MYSQL_UTILS_H
 
 #include <cmath>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
 #include <string>
 #include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
 #include "coke/compatible/to_numeric.h"
@@ -35,6 +43,46 @@ using protocol::MySQLMessage;
 using protocol::MySQLRequest;
 using protocol::MySQLResponse;
 
+/**
+ * @brief Decoded value of a DATE, DATETIME or TIMESTAMP cell, the time part
+ *        is zero for DATE.
+*/
+struct MySQLDateTime {
+    int year{0};
+    int month{0};
+    int day{0};
+    int hour{0};
+    int minute{0};
+    int second{0};
+    int microsecond{0};
+
+    friend bool operator== (const MySQLDateTime &, const MySQLDateTime &) = default;
+};
+
+/**
+ * @brief Decoded value of a TIME cell, which is a duration and the hour may
+ *        be greater than 23, such as -838:59:59.
+*/
+struct MySQLTime {
+    bool negative{false};
+    int hour{0};
+    int minute{0};
+    int second{0};
+    int microsecond{0};
+
+    friend bool operator== (const MySQLTime &, const MySQLTime &) = default;
+};
+
+/**
+ * @brief Parse `YYYY-MM-DD[ hh:mm:ss[.ffffff]]` in text protocol.
+*/
+std::errc mysql_parse_datetime(std::string_view data, MySQLDateTime &value) noexcept;
+
+/**
+ * @brief Parse `[-]hhh:mm:ss[.ffffff]` in text protocol.
+*/
+std::errc mysql_parse_time(std::string_view data, MySQLTime &value) noexcept;
+
 class MySQLCellView {
 public:
     MySQLCellView() : data_type(MYSQL_TYPE_NULL) { }
@@ -59,6 +107,7 @@ public:
     bool is_date() const { return check_type(MYSQL_TYPE_DATE); }
     bool is_time() const { return check_type(MYSQL_TYPE_TIME); }
     bool is_datetime() const { return check_type(MYSQL_TYPE_DATETIME); }
+    bool is_timestamp() const { return check_type(MYSQL_TYPE_TIMESTAMP); }
 
     std::errc to_longlong(long long &value) const {
         return is_integer() ? to_numeric(value) : std::errc::invalid_argument;
@@ -86,6 +135,33 @@ public:
 
     std::string_view raw_view() const { return data; }
 
+    /**
+     * @brief Decode the cell into `value` without allocation (except for
+     *        std::string), the supported types are
+     *
+     * - std::optional<T>, which is std::nullopt for NULL cell, or T decoded.
+     * - bool and integral types, from integer cells.
+     * - float and double, from float, double and decimal cells.
+     * - std::string_view and std::string, from any cell except NULL.
+     * - MySQLDateTime from DATE, DATETIME and TIMESTAMP cells, MySQLTime from
+     *   TIME cells.
+     *
+     * @return std::errc{} on success, std::errc::invalid_argument if the cell
+     *         is NULL or of other type, or the error of std::from_chars.
+    */
+    template<typename T>
+    std::errc decode(T &value) const noexcept;
+
+    /**
+     * @brief Decode the cell as T, and return `err` on failure, for example
+     *        cell.as<int64_t>(), cell.as<std::optional<double>>().
+    */
+    template<typename T>
+    T as(T err = T()) const noexcept {
+        T t{};
+        return decode(t) == std::errc() ? t : err;
+    }
+
     void reset(int data_type, std::string_view data) {
         this->data_type = data_type;
         this->data = data;
@@ -114,6 +190,102 @@ private:
     std::string_view data;
 };
 
+namespace detail {
+
+template<typename T>
+struct IsOptional : std::false_type { };
+
+template<typename T>
+struct IsOptional<std::optional<T>> : std::true_type { };
+
+} // namespace detail
+
+template<typename T>
+std::errc MySQLCellView::decode(T &value) const noexcept {
+    if constexpr (detail::IsOptional<T>::value) {
+        if (is_null()) {
+            value.reset();
+            return std::errc();
+        }
+
+        typename T::value_type v{};
+        std::errc ec = decode(v);
+        if (ec == std::errc())
+            value.emplace(std::move(v));
+        return ec;
+    }
+    else if constexpr (std::is_same_v<T, bool>) {
+        long long v;
+        std::errc ec = to_longlong(v);
+        if (ec == std::errc())
+            value = (v != 0);
+        return ec;
+    }
+    else if constexpr (std::integral<T>) {
+        return is_integer() ? to_numeric(value) : std::errc::invalid_argument;
+    }
+    else if constexpr (std::floating_point<T>) {
+        if (is_float() || is_double() || is_decimal())
+            return to_numeric(value);
+        return std::errc::invalid_argument;
+    }
+    else if constexpr (std::is_same_v<T, std::string_view>) {
+        if (is_null())
+            return std::errc::invalid_argument;
+        value = data;
+        return std::errc();
+    }
+    else if constexpr (std::is_same_v<T, std::string>) {
+        if (is_null())
+            return std::errc::invalid_argument;
+        value.assign(data);
+        return std::errc();
+    }
+    else if constexpr (std::is_same_v<T, MySQLDateTime>) {
+        if (is_date() || is_datetime() || is_timestamp())
+            return mysql_parse_datetime(data, value);
+        return std::errc::invalid_argument;
+    }
+    else if constexpr (std::is_same_v<T, MySQLTime>) {
+        return is_time() ? mysql_parse_time(data, value)
+                         : std::errc::invalid_argument;
+    }
+    else {
+        static_assert(sizeof(T) == 0, "Unsupported type for MySQLCellView");
+    }
+}
+
+/**
+ * @brief Decode a row into the elements of `row` in one pass, `row` can be a
+ *        std::tuple, or std::tie of the members of a struct, for example
+ *
+ *  std::vector<coke::MySQLCellView> cells;
+ *  while (view.next_row(cells)) {
+ *      Item item;
+ *      if (coke::mysql_bind_row(cells, std::tie(item.id, item.name)) != std::errc())
+ *          break;
+ *  }
+ *
+ * @return std::errc{} on success, std::errc::invalid_argument if the number
+ *         of cells is not equal to the size of `row`, or the first error of
+ *         MySQLCellView::decode.
+*/
+template<typename Tuple>
+std::errc mysql_bind_row(const std::vector<MySQLCellView> &cells, Tuple &&row) {
+    using TupleType = std::remove_cvref_t<Tuple>;
+    constexpr std::size_t N = std::tuple_size_v<TupleType>;
+
+    if (cells.size() != N)
+        return std::errc::invalid_argument;
+
+    std::errc ec{};
+    [&]<std::size_t... I>(std::index_sequence<I...>) {
+        ((ec = cells[I].decode(std::get<I>(row)), ec == std::errc()) && ...);
+    }(std::make_index_sequence<N>{});
+
+    return ec;
+}
+
 class MySQLFieldView {
 public:
     MySQLFieldView() : length(0), flags(0), decimals(0), charsetnr(0), data_type(MYSQL_TYPE_NULL) { }
@@ -184,6 +356,9 @@ public:
     int get_row_count() const { return result_set->row_count; }
     bool get_fields(std::vector<MySQLFieldView> &fields) const;
 
+    // Same as get_fields, but append to `fields` without clearing it
+    bool append_fields(std::vector<MySQLFieldView> &fields) const;
+
     std::vector<MySQLFieldView> get_fields() const {
         std::vector<MySQLFieldView> fields;
         get_fields(fields);
@@ -275,6 +450,85 @@ private:
     const MySQLResponse &resp;
 };
 
+/**
+ * @brief MySQLResultTable indexes all the result sets and fields of a
+ *        response once, so that they can be accessed by index, and the
+ *        columns can be looked up by name in O(1) instead of walking the
+ *        result sets and scanning the fields every time.
+ *
+ * The table refers to the response, which must be alive and unchanged while
+ * the table is used.
+ *
+ *  coke::MySQLResultTable table(res.resp);
+ *  int col = table.find_field(0, "name");
+ *  coke::MySQLResultSetView view = table.get_result_set(0);
+ *  while (view.next_row(cells))
+ *      consume(cells[col]);
+*/
+class MySQLResultTable {
+public:
+    MySQLResultTable() = default;
+    explicit MySQLResultTable(const MySQLResponse &resp) { reset(resp); }
+
+    MySQLResultTable(const MySQLResultTable &) = default;
+    MySQLResultTable &operator= (const MySQLResultTable &) = default;
+
+    /**
+     * @brief Rebuild the table for `resp`, the memory is reused.
+    */
+    void reset(const MySQLResponse &resp);
+
+    void clear() noexcept {
+        sets.clear();
+        fields.clear();
+        hashes.clear();
+        slots.clear();
+    }
+
+    std::size_t size() const noexcept { return sets.size(); }
+    bool empty() const noexcept { return sets.empty(); }
+
+    /**
+     * @brief Get a view of the i-th result set, which is rewound to the
+     *        first row.
+    */
+    MySQLResultSetView get_result_set(std::size_t i) const {
+        return sets[i].view;
+    }
+
+    std::span<const MySQLFieldView> get_fields(std::size_t i) const {
+        const Entry &e = sets[i];
+        return std::span<const MySQLFieldView>(fields.data() + e.field_begin,
+                                               e.field_count);
+    }
+
+    /**
+     * @brief Find the column named `name` in the i-th result set, the name
+     *        is compared case insensitively as MySQL does, and the first one
+     *        is returned if there are duplicate names.
+     *
+     * @return The index of the column, or -1 if not found.
+    */
+    int find_field(std::size_t i, std::string_view name) const noexcept;
+
+private:
+    struct Entry {
+        MySQLResultSetView view;
+        std::size_t field_begin;
+        std::size_t field_count;
+        std::size_t slot_begin;
+        std::size_t slot_count;
+    };
+
+    std::vector<Entry> sets;
+    std::vector<MySQLFieldView> fields;
+    std::vector<uint64_t> hashes;
+
+    // Open addressing slots of each result set, the value is the column
+    // index plus one, zero means empty.
+    std::vector<uint32_t> slots;
+};
+
 constexpr const char *mysql_datatype_to_str(int data_type) {
     #define _COKE_MYSQL_TYPE(type) case MYSQL_TYPE_##type: return #type
     switch (data_type) {
@@ -0,0 +1,131 @@
+/**
+ * Copyright 2024 Coke Project (https://github.com/kedixa/coke)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Authors: kedixa (https://github.com/kedixa)
+*/
+
+#ifndef COKE_NET_ADMISSION_H
+#define COKE_NET_ADMISSION_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+#include "coke/semaphore.h"
+#include "coke/task.h"
+
+namespace coke {
+
+struct AdmissionParams {
+    // Max number of handlers running at the same time, zero means unlimited
+    // and disables admission control.
+    std::size_t max_inflight        = 0;
+
+    // Max number of requests waiting for a running handler to finish, the
+    // requests beyond it are rejected at once.
+    std::size_t max_queue           = 0;
+
+    // CoDel like shedding, when the time requests spent in the queue stays
+    // above `queue_target` milliseconds for `queue_interval` milliseconds,
+    // new requests are rejected instead of queued, until a request is
+    // admitted within the target again.
+    int queue_target                = 5;
+    int queue_interval              = 100;
+
+    // A queued request is rejected after waiting `queue_timeout` milliseconds.
+    int queue_timeout               = 1000;
+};
+
+struct AdmissionStats {
+    uint64_t inflight{0};
+    uint64_t queued{0};
+
+    // Requests admitted at once or after queueing
+    uint64_t admitted{0};
+    uint64_t admitted_after_queue{0};
+
+    // Requests rejected because the queue is full or shedding is active, or
+    // because they wait too long in the queue.
+    uint64_t rejected{0};
+    uint64_t queue_timeouts{0};
+
+    bool shedding{false};
+};
+
+/**
+ * @brief AdmissionController limits the number of running handlers of a
+ *        server, queues the excess requests for a short time, and sheds them
+ *        when the queue keeps growing, so that the admitted requests can
+ *        still finish in time during overload.
+*/
+class AdmissionController {
+public:
+    enum Decision {
+        ADMIT_NOW,
+        ADMIT_QUEUE,
+        ADMIT_REJECT,
+    };
+
+    explicit AdmissionController(const AdmissionParams &params);
+
+    AdmissionController(const AdmissionController &) = delete;
+    AdmissionController &operator= (const AdmissionController &) = delete;
+
+    ~AdmissionController() = default;
+
+    /**
+     * @brief Decide a new request without waiting. If ADMIT_NOW is returned
+     *        the request holds a slot, if ADMIT_QUEUE is returned wait_admit
+     *        must be awaited next.
+    */
+    Decision try_admit() noexcept;
+
+    /**
+     * @brief Wait for a slot in the queue, return true if it is admitted.
+    */
+    Task<bool> wait_admit();
+
+    /**
+     * @brief Release the slot of an admitted request.
+    */
+    void release() noexcept;
+
+    AdmissionStats get_stats() const noexcept;
+
+private:
+    void update_sojourn(int64_t sojourn_ms, int64_t now_ms) noexcept;
+
+private:
+    AdmissionParams params;
+    Semaphore sem;
+
+    std::atomic<uint64_t> inflight{0};
+    std::atomic<uint64_t> queued{0};
+    std::atomic<uint64_t> admitted{0};
+    std::atomic<uint64_t> admitted_after_queue{0};
+    std::atomic<uint64_t> rejected{0};
+    std::atomic<uint64_t> queue_timeouts{0};
+
+    // The CoDel state, `first_above` is the time when the sojourn time would
+    // have been above the target for an interval, or zero.
+    std::mutex mtx;
+    int64_t first_above{0};
+    std::atomic<bool> shedding{false};
+};
+
+} // namespace coke
+
+#endif // COKE_NET_ADMISSION_H
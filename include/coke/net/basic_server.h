@@ -19,12 +19,118 @@
 #ifndef COKE_BASIC_SERVER_H
 #define COKE_BASIC_SERVER_H
 
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <memory_resource>
+#include <utility>
+#include <vector>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "coke/latency_histogram.h"
 #include "coke/task.h"
+#include "coke/net/admission.h"
 #include "coke/net/network.h"
 #include "workflow/WFServer.h"
 
 namespace coke {
 
+namespace detail {
+
+struct ConnectionDataBase {
+    virtual ~ConnectionDataBase() = default;
+};
+
+template<typename T>
+struct ConnectionData : public ConnectionDataBase {
+    template<typename... ARGS>
+    ConnectionData(ARGS&&... args) : value(std::forward<ARGS>(args)...) { }
+
+    T value;
+};
+
+inline void delete_connection_data(void *data) {
+    delete static_cast<ConnectionDataBase *>(data);
+}
+
+inline int64_t server_now_us() noexcept {
+    using namespace std::chrono;
+    auto now = steady_clock::now().time_since_epoch();
+    return duration_cast<microseconds>(now).count();
+}
+
+struct ServerMetrics {
+    LatencyHistogram queue;
+    LatencyHistogram handler;
+    LatencyHistogram reply;
+};
+
+inline int set_reuse_port(int fd) {
+    // If it fails, the other listeners fail to bind and report the error
+    if (fd >= 0) {
+        int on = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on));
+    }
+
+    return fd;
+}
+
+/**
+ * @brief An extra listener of BasicServer, it accepts connections on the same
+ *        address with SO_REUSEPORT, and hands the requests to the server.
+*/
+template<typename REQ, typename RESP>
+class ReusePortListener : public WFServer<REQ, RESP> {
+    using BaseType = WFServer<REQ, RESP>;
+    using TaskType = WFNetworkTask<REQ, RESP>;
+
+public:
+    ReusePortListener(const WFServerParams &params,
+                      std::function<void (TaskType *)> proc,
+                      bool record_arrival)
+        : BaseType(&params, std::move(proc)), record_arrival(record_arrival)
+    { }
+
+protected:
+    int create_listen_fd() override {
+        return set_reuse_port(BaseType::create_listen_fd());
+    }
+
+    CommSession *new_session(long long seq, CommConnection *conn) override {
+        CommSession *session = BaseType::new_session(seq, conn);
+
+        if (record_arrival && session) {
+            TaskType *task = static_cast<TaskType *>(session);
+            task->user_data = (void *)(intptr_t)server_now_us();
+        }
+
+        return session;
+    }
+
+private:
+    bool record_arrival;
+};
+
+} // namespace detail
+
+/**
+ * @brief Latency histograms of a server, in microseconds.
+ *
+ * `queue` is from the request begins to arrive to the processor starts,
+ * including receiving the request and waiting for admission. `handler` is
+ * the time the processor runs, and `reply` is from ctx.reply() is called to
+ * the response is sent.
+*/
+struct ServerLatencyStats {
+    HistogramSnapshot queue;
+    HistogramSnapshot handler;
+    HistogramSnapshot reply;
+};
+
 struct NetworkReplyResult {
     int state;
     int error;
@@ -47,6 +153,30 @@ public:
 
         this->set_task(task, true);
     }
+
+    /**
+     * @brief Same as above, and record the time until the reply finishes
+     *        into `hist`.
+    */
+    template<typename REQ, typename RESP>
+    NetworkReplyAwaiter(WFNetworkTask<REQ, RESP> *task,
+                        LatencyHistogram *hist) {
+        using TaskType = WFNetworkTask<REQ, RESP>;
+        int64_t start = detail::server_now_us();
+
+        task->set_callback([info = this->get_info(), hist, start]
+                           (TaskType *task) {
+            hist->record(uint64_t(detail::server_now_us() - start));
+
+            auto *awaiter = info->get_awaiter<NetworkReplyAwaiter>();
+            awaiter->emplace_result(NetworkReplyResult{
+                task->get_state(), task->get_error()
+            });
+            awaiter->done();
+        });
+
+        this->set_task(task, true);
+    }
 };
 
 template<typename REQ, typename RESP>
@@ -57,21 +187,25 @@ class ServerContext {
     using AwaiterType = NetworkReplyAwaiter;
 
 public:
-    ServerContext(TaskType *task)
-        : replied(false), task(task)
+    ServerContext(TaskType *task, detail::ServerMetrics *metrics = nullptr)
+        : replied(false), task(task), metrics(metrics)
     { }
 
     ServerContext(ServerContext &&that)
-        : replied(that.replied), task(that.task) {
+        : replied(that.replied), task(that.task), metrics(that.metrics),
+          arena(std::move(that.arena)) {
         // that cannot be used any more
         that.replied = true;
         that.task = nullptr;
+        that.metrics = nullptr;
     }
 
     ServerContext &operator=(ServerContext &&that) {
         if (this != &that) {
             std::swap(this->task, that.task);
             std::swap(this->replied, that.replied);
+            std::swap(this->metrics, that.metrics);
+            std::swap(this->arena, that.arena);
         }
         return *this;
     }
@@ -92,12 +226,122 @@ public:
         assert(!replied);
         replied = true;
 
+        if (metrics)
+            return AwaiterType(task, &metrics->reply);
+
         return AwaiterType(task);
     }
 
+    /**
+     * @brief Finish the context without replying the response, which is
+     *        used when the response has already been pushed to the
+     *        connection by task->push, such as coke::HttpResponseWriter.
+     *        It takes the place of reply.
+    */
+    AwaiterType noreply() {
+        assert(!replied);
+        replied = true;
+
+        task->noreply();
+
+        if (metrics)
+            return AwaiterType(task, &metrics->reply);
+
+        return AwaiterType(task);
+    }
+
+    bool is_replied() const { return replied; }
+
+    /**
+     * @brief Get the user data of the connection which this request comes
+     *        from, it is created by T(args...) at the first call on the
+     *        connection, then shared by all the requests of the connection
+     *        and destroyed when the connection is closed. It can hold the
+     *        state of long-lived connections, such as the authentication.
+     *
+     * @attention Only one type of data can be saved on a connection, if it
+     *            is already created with another type, nullptr is returned.
+     *            The creation is thread safe, but the access to the data is
+     *            not synchronized, pipelined requests may use it at the same
+     *            time.
+    */
+    template<typename T, typename... ARGS>
+    T *get_connection_data(ARGS&&... args) {
+        using DataType = detail::ConnectionData<T>;
+
+        WFConnection *conn = task->get_connection();
+        void *old = conn->get_context();
+
+        if (!old) {
+            DataType *data = new DataType(std::forward<ARGS>(args)...);
+            old = conn->test_set_context(nullptr, data,
+                                         detail::delete_connection_data);
+            if (!old)
+                return &data->value;
+
+            delete data;
+        }
+
+        auto *base = static_cast<detail::ConnectionDataBase *>(old);
+        DataType *data = dynamic_cast<DataType *>(base);
+        return data ? &data->value : nullptr;
+    }
+
+    /**
+     * @brief Get the user data of the connection if it is created with type
+     *        T, or nullptr.
+    */
+    template<typename T>
+    T *find_connection_data() {
+        using DataType = detail::ConnectionData<T>;
+
+        void *ctx = task->get_connection()->get_context();
+        auto *base = static_cast<detail::ConnectionDataBase *>(ctx);
+        DataType *data = dynamic_cast<DataType *>(base);
+        return data ? &data->value : nullptr;
+    }
+
+    /**
+     * @brief Get the arena of this request, a monotonic memory resource that
+     *        is created at the first call with an initial buffer of
+     *        `initial_size` bytes, and grows as needed. The memory is never
+     *        freed one by one, but released in one shot when the context is
+     *        destroyed, that is after the processor replies and returns.
+     *
+     * It is suitable for the short lived strings and containers of the
+     * request, such as std::pmr::string and std::pmr::vector, and can be
+     * passed to the child coroutines of the request.
+     *
+     * @attention The arena is not thread safe, child coroutines running at
+     *            the same time should not allocate from it concurrently. The
+     *            memory must not be used after the context is destroyed, so
+     *            do not give it to the response by nocopy functions.
+    */
+    std::pmr::memory_resource *get_arena(std::size_t initial_size = 4096) {
+        if (!arena) {
+            arena = std::make_unique<std::pmr::monotonic_buffer_resource>(
+                std::max(initial_size, std::size_t(1))
+            );
+        }
+
+        return arena.get();
+    }
+
+    /**
+     * @brief Get an allocator that allocates from the arena of this request.
+    */
+    template<typename T = std::byte>
+    std::pmr::polymorphic_allocator<T> get_arena_allocator() {
+        return std::pmr::polymorphic_allocator<T>(get_arena());
+    }
+
+    bool has_arena() const { return arena != nullptr; }
+
 private:
     bool replied;
     TaskType *task;
+    detail::ServerMetrics *metrics;
+    std::unique_ptr<std::pmr::monotonic_buffer_resource> arena;
 };
 
 using ServerParams = WFServerParams;
@@ -125,14 +369,253 @@ public:
           co_proc(std::move(co_proc))
     { }
 
+    /**
+     * @brief Limit the running handlers and shed the excess requests, see
+     *        coke::AdmissionParams. The rejected requests are finished by
+     *        do_reject without running the processor. It must be called
+     *        before the server is started.
+    */
+    void set_admission_params(const AdmissionParams &params) {
+        if (params.max_inflight == 0)
+            admission.reset();
+        else
+            admission = std::make_unique<AdmissionController>(params);
+    }
+
+    /**
+     * @brief Get the statistics of admission control, all zero if it is not
+     *        enabled.
+    */
+    AdmissionStats get_admission_stats() const {
+        return admission ? admission->get_stats() : AdmissionStats{};
+    }
+
+    /**
+     * @brief Enable the latency histograms of this server, see
+     *        coke::ServerLatencyStats. It must be called before the server
+     *        is started, and costs a few atomic operations per request.
+    */
+    void enable_latency_stats() {
+        if (!metrics)
+            metrics = std::make_unique<detail::ServerMetrics>();
+    }
+
+    /**
+     * @brief Get the snapshot of the latency histograms, all empty if they
+     *        are not enabled.
+    */
+    ServerLatencyStats get_latency_stats() const {
+        ServerLatencyStats stats;
+
+        if (metrics) {
+            stats.queue = metrics->queue.snapshot();
+            stats.handler = metrics->handler.snapshot();
+            stats.reply = metrics->reply.snapshot();
+        }
+
+        return stats;
+    }
+
+    /**
+     * @brief Start `listeners` listening sockets on the same address with
+     *        SO_REUSEPORT, the kernel spreads the new connections over them,
+     *        and they are handled by different pollers. This server itself
+     *        is the first listener, and all the requests go to its
+     *        processor, admission control and latency histograms.
+     *
+     * If `port` is 0, the port chosen by the first listener is used by the
+     *        others. If `cert_file` and `key_file` are not nullptr, the
+     *        listeners serve TLS. Use shutdown, wait_finish and stop of this
+     *        class to stop all the listeners.
+     *
+     * @return 0 on success, or -1 with errno set, in which case none of the
+     *         listeners is running.
+    */
+    int start_reuse_port(std::size_t listeners, int family, const char *host,
+                         unsigned short port, const char *cert_file = nullptr,
+                         const char *key_file = nullptr) {
+        reuse_port = true;
+
+        if (BaseType::start(family, host, port, cert_file, key_file) < 0)
+            return -1;
+
+        if (port == 0)
+            port = get_bound_port();
+
+        for (std::size_t i = 1; i < listeners; i++) {
+            auto ptr = std::make_unique<ListenerType>(*this->get_params(),
+                                                      get_process(this),
+                                                      metrics != nullptr);
+
+            if (ptr->start(family, host, port, cert_file, key_file) < 0) {
+                int err = errno;
+                stop();
+                errno = err;
+                return -1;
+            }
+
+            extra_listeners.push_back(std::move(ptr));
+        }
+
+        return 0;
+    }
+
+    int start_reuse_port(std::size_t listeners, unsigned short port) {
+        return start_reuse_port(listeners, AF_INET, nullptr, port);
+    }
+
+    /**
+     * @brief Stop accepting on all the listeners, the in-flight requests
+     *        continue to be processed.
+    */
+    void shutdown() {
+        for (auto &listener : extra_listeners)
+            listener->shutdown();
+
+        BaseType::shutdown();
+    }
+
+    /**
+     * @brief Wait until all the listeners are shut down and their requests
+     *        are finished.
+    */
+    void wait_finish() {
+        for (auto &listener : extra_listeners)
+            listener->wait_finish();
+
+        BaseType::wait_finish();
+        extra_listeners.clear();
+    }
+
+    void stop() {
+        shutdown();
+        wait_finish();
+    }
+
+    size_t get_conn_count() const {
+        size_t n = BaseType::get_conn_count();
+
+        for (auto &listener : extra_listeners)
+            n += listener->get_conn_count();
+
+        return n;
+    }
+
 protected:
+    int create_listen_fd() override {
+        int fd = BaseType::create_listen_fd();
+        return reuse_port ? detail::set_reuse_port(fd) : fd;
+    }
+
     virtual void do_proc(TaskType *task) {
-        Task<> t = co_proc(ServerContextType(task));
+        if (!admission && !metrics) {
+            Task<> t = co_proc(ServerContextType(task));
+            t.detach_on_series(series_of(task));
+            return;
+        }
+
+        AdmissionController::Decision d = AdmissionController::ADMIT_NOW;
+        Task<> t;
+
+        if (admission)
+            d = admission->try_admit();
+
+        switch (d) {
+        case AdmissionController::ADMIT_NOW:
+            record_queue_time(task);
+            t = run_admitted(ServerContextType(task, metrics.get()));
+            break;
+        case AdmissionController::ADMIT_QUEUE:
+            t = run_queued(task);
+            break;
+        default:
+            task->user_data = nullptr;
+            do_reject(task);
+            return;
+        }
+
         t.detach_on_series(series_of(task));
     }
 
+    /**
+     * The arrival time is saved in the task's user_data until the processor
+     * starts, so it is still free for the processor.
+    */
+    CommSession *new_session(long long seq, CommConnection *conn) override {
+        CommSession *session = BaseType::new_session(seq, conn);
+
+        if (metrics && session) {
+            TaskType *task = static_cast<TaskType *>(session);
+            task->user_data = (void *)(intptr_t)detail::server_now_us();
+        }
+
+        return session;
+    }
+
+    /**
+     * @brief Finish a request rejected by admission control, the default
+     *        one drops it without reply. It is called in the handler thread
+     *        and must not block.
+    */
+    virtual void do_reject(TaskType *task) {
+        task->noreply();
+    }
+
+private:
+    unsigned short get_bound_port() const {
+        struct sockaddr_storage ss;
+        socklen_t len = sizeof(ss);
+        auto *addr = (struct sockaddr *)&ss;
+
+        if (this->get_listen_addr(addr, &len) != 0)
+            return 0;
+
+        if (addr->sa_family == AF_INET6)
+            return ntohs(((struct sockaddr_in6 *)addr)->sin6_port);
+
+        return ntohs(((struct sockaddr_in *)addr)->sin_port);
+    }
+
+    void record_queue_time(TaskType *task) {
+        if (metrics && task->user_data) {
+            int64_t arrive = (int64_t)(intptr_t)task->user_data;
+            metrics->queue.record(uint64_t(detail::server_now_us() - arrive));
+        }
+
+        task->user_data = nullptr;
+    }
+
+    Task<> run_admitted(ServerContextType ctx) {
+        int64_t start = metrics ? detail::server_now_us() : 0;
+
+        co_await co_proc(std::move(ctx));
+
+        if (metrics)
+            metrics->handler.record(uint64_t(detail::server_now_us() - start));
+
+        if (admission)
+            admission->release();
+    }
+
+    Task<> run_queued(TaskType *task) {
+        if (co_await admission->wait_admit()) {
+            record_queue_time(task);
+            co_await run_admitted(ServerContextType(task, metrics.get()));
+        }
+        else {
+            task->user_data = nullptr;
+            do_reject(task);
+        }
+    }
+
 private:
     ProcessorType co_proc;
+    std::unique_ptr<AdmissionController> admission;
+    std::unique_ptr<detail::ServerMetrics> metrics;
+
+    using ListenerType = detail::ReusePortListener<REQ, RESP>;
+    std::vector<std::unique_ptr<ListenerType>> extra_listeners;
+    bool reuse_port{false};
 };
 
 } // namespace coke
@@ -0,0 +1,192 @@
+/**
+ * Copyright 2024 Coke Project (https://github.com/kedixa/coke)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Authors: kedixa (https://github.com/kedixa)
+*/
+
+#ifndef COKE_NET_CONCURRENCY_LIMITER_H
+#define COKE_NET_CONCURRENCY_LIMITER_H
+
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+#include "coke/condition.h"
+#include "coke/global.h"
+#include "coke/net/network.h"
+#include "coke/task.h"
+
+namespace coke {
+
+enum class LimiterAlgorithm {
+    // Additive increase when the limit is nearly used, multiplicative
+    // decrease when a request is dropped or slower than `aimd_timeout`.
+    AIMD,
+
+    // Follow the gradient between the long term and the recent latency,
+    // which shrinks the limit as soon as requests queue up in the backend.
+    GRADIENT,
+};
+
+struct ConcurrencyLimiterParams {
+    LimiterAlgorithm algorithm  = LimiterAlgorithm::GRADIENT;
+
+    double initial_limit        = 20;
+    double min_limit            = 1;
+    double max_limit            = 1000;
+
+    // The limit is multiplied by `backoff_ratio` when a request is dropped,
+    // by both algorithms.
+    double backoff_ratio        = 0.9;
+
+    // AIMD only, requests slower than `aimd_timeout` milliseconds are treated
+    // as dropped.
+    int aimd_timeout            = 1000;
+
+    // GRADIENT only. The long term latency is the moving average of about
+    // `long_window` samples, the recent latency may be `rtt_tolerance` times
+    // of it before the limit shrinks. The new limit is smoothed by
+    // `smoothing`, and a queue of sqrt(limit) is allowed.
+    int long_window             = 600;
+    double rtt_tolerance        = 1.5;
+    double smoothing            = 0.2;
+
+    // Max milliseconds to wait for a slot in acquire, zero means reject at
+    // once when the limit is reached.
+    int max_wait                = 0;
+};
+
+struct ConcurrencyLimiterStats {
+    std::size_t limit{0};
+    std::size_t inflight{0};
+
+    // The long term latency in microseconds, GRADIENT only
+    int64_t long_rtt{0};
+
+    uint64_t accepted{0};
+    uint64_t rejected{0};
+    uint64_t dropped{0};
+};
+
+/**
+ * @brief ConcurrencyLimiter limits the number of requests in flight to a
+ *        backend, and adjusts the limit by the observed latency, so that the
+ *        latency is protected when the backend slows down, without manual
+ *        tuning of rates or connections.
+ *
+ * Each acquired slot must be released with the outcome of the request. It
+ * can be used standalone, or with the requests of HttpClient, RedisClient
+ * and MySQLClient by coke::limited_request.
+*/
+class ConcurrencyLimiter {
+public:
+    enum Outcome {
+        // The request finished, its latency is a valid sample
+        OUTCOME_SUCCESS,
+        // The request timed out or was rejected by the backend for overload
+        OUTCOME_DROPPED,
+        // The request failed for other reasons, the latency is ignored
+        OUTCOME_IGNORED,
+    };
+
+    explicit ConcurrencyLimiter(const ConcurrencyLimiterParams &params = {});
+
+    ConcurrencyLimiter(const ConcurrencyLimiter &) = delete;
+    ConcurrencyLimiter &operator= (const ConcurrencyLimiter &) = delete;
+
+    ~ConcurrencyLimiter() = default;
+
+    /**
+     * @brief Acquire a slot without waiting, return true on success.
+    */
+    bool try_acquire();
+
+    /**
+     * @brief Acquire a slot, wait at most ConcurrencyLimiterParams::max_wait
+     *        milliseconds if the limit is reached, return true on success.
+    */
+    Task<bool> acquire();
+
+    /**
+     * @brief Release an acquired slot, the request took `rtt` and finished
+     *        with `outcome`.
+    */
+    void release(std::chrono::nanoseconds rtt, Outcome outcome);
+
+    std::size_t get_limit() const;
+
+    ConcurrencyLimiterStats get_stats() const;
+
+private:
+    void update_aimd(int64_t rtt_us, bool dropped);
+    void update_gradient(int64_t rtt_us, bool dropped);
+
+private:
+    ConcurrencyLimiterParams params;
+
+    mutable std::mutex mtx;
+    Condition cv;
+
+    double limit;
+    std::size_t inflight{0};
+    double long_rtt{0};
+
+    uint64_t accepted{0};
+    uint64_t rejected{0};
+    uint64_t dropped{0};
+};
+
+/**
+ * @brief Send the request of `awaiter` under `limiter`, the latency and the
+ *        result are reported to the limiter. If no slot is acquired, the
+ *        request is not sent and the result is STATE_SYS_ERROR with EBUSY.
+ *        Timeouts are reported as dropped, and other errors are ignored.
+ *
+ *  coke::HttpResult res = co_await coke::limited_request(limiter,
+ *                                                        cli.request(url));
+*/
+template<typename REQ, typename RESP>
+Task<NetworkResult<REQ, RESP>>
+limited_request(ConcurrencyLimiter &limiter,
+                NetworkAwaiter<REQ, RESP> awaiter) {
+    using ResultType = NetworkResult<REQ, RESP>;
+
+    if (!co_await limiter.acquire()) {
+        ResultType res;
+        res.state = STATE_SYS_ERROR;
+        res.error = EBUSY;
+        res.task = nullptr;
+        co_return res;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    ResultType res = co_await std::move(awaiter);
+    auto rtt = std::chrono::steady_clock::now() - start;
+
+    ConcurrencyLimiter::Outcome outcome = ConcurrencyLimiter::OUTCOME_IGNORED;
+    if (res.state == STATE_SUCCESS)
+        outcome = ConcurrencyLimiter::OUTCOME_SUCCESS;
+    else if (res.state == STATE_SYS_ERROR && res.error == ETIMEDOUT)
+        outcome = ConcurrencyLimiter::OUTCOME_DROPPED;
+
+    limiter.release(rtt, outcome);
+    co_return res;
+}
+
+} // namespace coke
+
+#endif // COKE_NET_CONCURRENCY_LIMITER_H
@@ -0,0 +1,140 @@
+/**
+ * Copyright 2024 Coke Project (https://github.com/kedixa/coke)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Authors: kedixa (https://github.com/kedixa)
+*/
+
+#ifndef COKE_NET_DNS_H
+#define COKE_NET_DNS_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "coke/task.h"
+
+namespace coke {
+
+/**
+ * The DNS cache is the process wide cache of Workflow, shared by HttpClient,
+ * RedisClient, MySQLClient etc. Its entries expire after
+ * GlobalSettings::dns_ttl_default seconds, and the request that finds an
+ * expired entry waits for the re-resolution. The functions here keep the
+ * entries of hot hosts fresh, so that the requests never wait for them.
+*/
+
+// Results of dns_cache_lookup
+constexpr int DNS_CACHE_HIT = 0;
+constexpr int DNS_CACHE_STALE = 1;
+constexpr int DNS_CACHE_MISS = 2;
+
+struct DnsHost {
+    std::string host;
+    unsigned short port             = 80;
+};
+
+struct DnsPrefetchParams {
+    // Re-resolve a host `refresh_ahead` seconds before its entry expires,
+    // it is limited to half of the entry's ttl.
+    unsigned int refresh_ahead      = 10;
+
+    // The hosts looked up by dns_cache_lookup are prefetched until they are
+    // not looked up for `idle_timeout` seconds. The hosts added by
+    // dns_prefetch_add are always prefetched.
+    unsigned int idle_timeout       = 300;
+
+    // Check the hosts to refresh every `check_interval` milliseconds
+    int check_interval              = 1000;
+
+    // At most `max_concurrency` hosts are resolving at the same time
+    std::size_t max_concurrency     = 8;
+};
+
+struct DnsCacheStats {
+    // Lookups by dns_cache_lookup
+    uint64_t hits{0};
+    uint64_t stale_hits{0};
+    uint64_t misses{0};
+
+    // Resolutions by dns_resolve, including the prefetches
+    uint64_t resolves{0};
+    uint64_t resolve_failures{0};
+    uint64_t prefetches{0};
+
+    // Number of hosts being prefetched
+    uint64_t prefetch_hosts{0};
+};
+
+/**
+ * @brief Resolve `host` by getaddrinfo in the DNS threads of Workflow, and
+ *        put the result into the DNS cache, replacing the old entry.
+ *
+ * @return Coroutine(coke::Task<int>) that needs to be awaited immediately,
+ *         the result is 0 on success, or the error code of getaddrinfo, see
+ *         gai_strerror.
+*/
+Task<int> dns_resolve(const std::string &host, unsigned short port);
+
+/**
+ * @brief Resolve the `hosts` at the same time, such as at startup before the
+ *        server accepts requests, and add them to prefetching if `prefetch`.
+ *
+ * @return Coroutine(coke::Task<std::size_t>) that needs to be awaited
+ *         immediately, the result is the number of hosts resolved.
+*/
+Task<std::size_t> dns_preresolve(const std::vector<DnsHost> &hosts,
+                                 bool prefetch = true);
+
+/**
+ * @brief Look up the DNS cache without resolving.
+ *
+ * @retval coke::DNS_CACHE_HIT If the entry is fresh.
+ * @retval coke::DNS_CACHE_STALE If the entry expires, but it is still used
+ *         by the requests, and an asynchronous re-resolution is started.
+ * @retval coke::DNS_CACHE_MISS If there is no entry.
+ *
+ * The host is marked hot and prefetched if prefetching is started.
+*/
+int dns_cache_lookup(const std::string &host, unsigned short port);
+
+/**
+ * @brief Start the prefetching coroutine of the hot hosts.
+ * @return 0 on success, or -1 if it is already started.
+*/
+int dns_prefetch_start(const DnsPrefetchParams &params);
+
+/**
+ * @brief Stop the prefetching coroutine and wait for it.
+ *
+ * @return Coroutine(coke::Task<>) that needs to be awaited immediately. It
+ *         must be awaited before the process exits if prefetching is started.
+*/
+Task<> dns_prefetch_stop();
+
+/**
+ * @brief Add `host` to prefetching until it is removed.
+*/
+void dns_prefetch_add(const std::string &host, unsigned short port);
+
+/**
+ * @brief Remove `host` from prefetching, its entry is kept in the cache.
+*/
+void dns_prefetch_remove(const std::string &host, unsigned short port);
+
+DnsCacheStats get_dns_cache_stats();
+
+} // namespace coke
+
+#endif // COKE_NET_DNS_H
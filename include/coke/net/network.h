@@ -52,26 +52,48 @@ public:
     using ResultType = NetworkResult<ReqType, RespType>;
     using TaskType = WFNetworkTask<ReqType, RespType>;
 
+    using DoneHook = void (*)(TaskType *);
+
 public:
     explicit NetworkAwaiter(TaskType *task, bool move_resp = true) {
         task->set_callback([info = this->get_info(), move_resp] (TaskType *task) {
-            using AwaiterType = NetworkAwaiter<ReqType, RespType>;
-            auto *awaiter = info->template get_awaiter<AwaiterType>();
-
-            ResultType result;
-            result.state = task->get_state();
-            result.error = task->get_error();
-            result.task = task;
+            finish(info, task, move_resp);
+        });
 
-            if (move_resp)
-                result.resp = std::move(*task->get_resp());
+        this->set_task(task);
+    }
 
-            awaiter->emplace_result(std::move(result));
-            awaiter->done();
+    /**
+     * @brief Same as NetworkAwaiter(task, true), but call `hook(task)` in the
+     *        callback of task before the result is moved out, which can be
+     *        used to collect statistics.
+    */
+    NetworkAwaiter(TaskType *task, DoneHook hook) {
+        task->set_callback([info = this->get_info(), hook] (TaskType *task) {
+            hook(task);
+            finish(info, task, true);
         });
 
         this->set_task(task);
     }
+
+private:
+    static void finish(AwaiterInfo<ResultType> *info, TaskType *task,
+                       bool move_resp) {
+        using AwaiterType = NetworkAwaiter<ReqType, RespType>;
+        auto *awaiter = info->template get_awaiter<AwaiterType>();
+
+        ResultType result;
+        result.state = task->get_state();
+        result.error = task->get_error();
+        result.task = task;
+
+        if (move_resp)
+            result.resp = std::move(*task->get_resp());
+
+        awaiter->emplace_result(std::move(result));
+        awaiter->done();
+    }
 };
 
 /**
@@ -0,0 +1,276 @@
+/**
+ * Copyright 2024 Coke Project (https://github.com/kedixa/coke)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Authors: kedixa (https://github.com/kedixa)
+*/
+
+#ifndef COKE_NET_RPC_H
+#define COKE_NET_RPC_H
+
+#include <cerrno>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+
+#include "coke/global.h"
+#include "coke/net/basic_server.h"
+#include "coke/net/network.h"
+#include "coke/task.h"
+
+#include "workflow/ProtocolMessage.h"
+
+namespace coke {
+
+/**
+ * Each frame of the rpc protocol is a 20 bytes header followed by the body,
+ * all the integers are in network byte order.
+ *
+ *  | magic(4) | code(4) | id(8) | body size(4) | body(body size) |
+ *
+ * The code of a request is the method, and the code of a response is the
+ * status, RPC_STATUS_OK or a status defined by the application. The id of a
+ * response is the id of its request, so that they can be matched.
+*/
+constexpr uint32_t RPC_MAGIC = 0x434B5250;
+constexpr std::size_t RPC_HEADER_SIZE = 20;
+
+constexpr uint32_t RPC_STATUS_OK = 0;
+// The request is rejected by admission control of the server
+constexpr uint32_t RPC_STATUS_REJECTED = 1;
+
+class RpcMessage : public protocol::ProtocolMessage {
+public:
+    RpcMessage() = default;
+    RpcMessage(RpcMessage &&) = default;
+    RpcMessage &operator= (RpcMessage &&) = default;
+    virtual ~RpcMessage() = default;
+
+    uint64_t get_id() const noexcept { return id; }
+    void set_id(uint64_t id) noexcept { this->id = id; }
+
+    uint32_t get_code() const noexcept { return code; }
+    void set_code(uint32_t code) noexcept { this->code = code; }
+
+    std::string &get_body() noexcept { return body; }
+    const std::string &get_body() const noexcept { return body; }
+    void set_body(std::string body) noexcept { this->body = std::move(body); }
+
+protected:
+    int encode(struct iovec vectors[], int max) override;
+    int append(const void *buf, size_t *size) override;
+
+private:
+    uint64_t id{0};
+    uint32_t code{0};
+    std::string body;
+
+    // Parsing state of append
+    std::size_t header_received{0};
+    std::size_t body_size{0};
+    char header[RPC_HEADER_SIZE];
+};
+
+class RpcRequest : public RpcMessage {
+public:
+    uint32_t get_method() const noexcept { return get_code(); }
+    void set_method(uint32_t method) noexcept { set_code(method); }
+};
+
+class RpcResponse : public RpcMessage {
+public:
+    uint32_t get_status() const noexcept { return get_code(); }
+    void set_status(uint32_t status) noexcept { set_code(status); }
+};
+
+/**
+ * @brief RpcCodec<T> converts T to and from the body of RpcMessage, so that
+ *        the typed RpcClient::call and rpc_encode/rpc_decode work with T.
+ *        Specialize it for the message types of the application, such as
+ *        the generated types of protobuf:
+ *
+ *  template<>
+ *  struct coke::RpcCodec<EchoRequest> {
+ *      static bool encode(const EchoRequest &v, std::string &body) {
+ *          return v.SerializeToString(&body);
+ *      }
+ *      static bool decode(std::string_view body, EchoRequest &v) {
+ *          return v.ParseFromArray(body.data(), (int)body.size());
+ *      }
+ *  };
+*/
+template<typename T>
+struct RpcCodec;
+
+template<>
+struct RpcCodec<std::string> {
+    static bool encode(const std::string &v, std::string &body) {
+        body = v;
+        return true;
+    }
+
+    static bool decode(std::string_view body, std::string &v) {
+        v.assign(body);
+        return true;
+    }
+};
+
+template<typename T>
+bool rpc_encode(const T &value, RpcMessage &msg) {
+    return RpcCodec<T>::encode(value, msg.get_body());
+}
+
+template<typename T>
+bool rpc_decode(const RpcMessage &msg, T &value) {
+    return RpcCodec<T>::decode(msg.get_body(), value);
+}
+
+
+using RpcAwaiter = NetworkAwaiter<RpcRequest, RpcResponse>;
+using RpcResult = RpcAwaiter::ResultType;
+
+struct RpcClientParams {
+    std::string host;
+    unsigned short port     = 0;
+    bool use_ssl            = false;
+
+    int retry_max           = 0;
+    int send_timeout        = -1;
+    int receive_timeout     = -1;
+    int keep_alive_timeout  = 60 * 1000;
+
+    // Responses larger than it fail with EMSGSIZE
+    std::size_t response_size_limit = 64 * 1024 * 1024;
+};
+
+/**
+ * @brief RpcClient sends the requests to the server in RpcClientParams, each
+ *        request takes an idle connection of the endpoint, and the concurrent
+ *        requests use as many connections as needed, up to the endpoint's
+ *        max_connections. A response whose id differs from the request's
+ *        fails with STATE_SYS_ERROR and EBADMSG.
+*/
+class RpcClient {
+public:
+    explicit RpcClient(const RpcClientParams &params) : params(params) { }
+
+    /**
+     * @brief Call `req`, its id is assigned by the client.
+    */
+    Task<RpcResult> call(RpcRequest req);
+
+    Task<RpcResult> call(uint32_t method, std::string body) {
+        RpcRequest req;
+        req.set_method(method);
+        req.set_body(std::move(body));
+        return call(std::move(req));
+    }
+
+    /**
+     * @brief Call `method` with `req` encoded by RpcCodec<REQ>, and decode the
+     *        body of a RPC_STATUS_OK response into `resp`. Fail with
+     *        STATE_SYS_ERROR and EINVAL if `req` cannot be encoded, or
+     *        EBADMSG if the response cannot be decoded. `resp` must be alive
+     *        until the call finishes.
+    */
+    template<typename REQ, typename RESP>
+    Task<RpcResult> call(uint32_t method, const REQ &req, RESP &resp) {
+        RpcRequest msg;
+        msg.set_method(method);
+
+        if (!rpc_encode(req, msg)) {
+            co_return make_error(EINVAL);
+        }
+
+        RpcResult res = co_await call(std::move(msg));
+        if (res.state == STATE_SUCCESS &&
+            res.resp.get_status() == RPC_STATUS_OK &&
+            !rpc_decode(res.resp, resp))
+        {
+            res.state = STATE_SYS_ERROR;
+            res.error = EBADMSG;
+        }
+
+        co_return res;
+    }
+
+    const RpcClientParams &get_params() const { return params; }
+
+private:
+    static RpcResult make_error(int error) {
+        RpcResult res;
+        res.state = STATE_SYS_ERROR;
+        res.error = error;
+        res.task = nullptr;
+        return res;
+    }
+
+private:
+    RpcClientParams params;
+};
+
+
+using RpcServerContext = ServerContext<RpcRequest, RpcResponse>;
+using RpcReplyResult = NetworkReplyResult;
+
+struct RpcServerParams : public ServerParams {
+    RpcServerParams() : ServerParams(SERVER_PARAMS_DEFAULT) {
+        request_size_limit = 64 * 1024 * 1024;
+    }
+
+    ~RpcServerParams() = default;
+};
+
+/**
+ * @brief RpcServer serves the rpc protocol, the id of each response is set to
+ *        the id of its request before the processor is called, and the
+ *        processor only fills the status and body.
+*/
+class RpcServer : public BasicServer<RpcRequest, RpcResponse> {
+    using BaseType = BasicServer<RpcRequest, RpcResponse>;
+
+public:
+    RpcServer(const RpcServerParams &params, ProcessorType co_proc)
+        : BaseType(params, wrap(std::move(co_proc)))
+    { }
+
+    RpcServer(ProcessorType co_proc)
+        : BaseType(RpcServerParams(), wrap(std::move(co_proc)))
+    { }
+
+protected:
+    /**
+     * @brief Reply the requests rejected by admission control with
+     *        RPC_STATUS_REJECTED.
+    */
+    void do_reject(TaskType *task) override {
+        RpcResponse *resp = task->get_resp();
+
+        resp->set_id(task->get_req()->get_id());
+        resp->set_status(RPC_STATUS_REJECTED);
+    }
+
+private:
+    static ProcessorType wrap(ProcessorType proc) {
+        return [proc = std::move(proc)] (RpcServerContext ctx) -> Task<> {
+            ctx.get_resp().set_id(ctx.get_req().get_id());
+            return proc(std::move(ctx));
+        };
+    }
+};
+
+} // namespace coke
+
+#endif // COKE_NET_RPC_H
@@ -0,0 +1,77 @@
+/**
+ * Copyright 2024 Coke Project (https://github.com/kedixa/coke)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Authors: kedixa (https://github.com/kedixa)
+*/
+
+#ifndef COKE_NET_TLS_SESSION_H
+#define COKE_NET_TLS_SESSION_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include "coke/latency_histogram.h"
+
+namespace coke {
+
+struct TlsSessionParams {
+    // Keep at most `max_sessions` sessions, one for each server(the peer
+    // address and the SNI name), the least recently used one is dropped.
+    std::size_t max_sessions        = 1024;
+
+    // Record the time of each handshake into TlsHandshakeStats::latency,
+    // it reads the clock twice per handshake.
+    bool handshake_timing           = false;
+};
+
+struct TlsHandshakeStats {
+    // Number of client handshakes finished, and how many of them resumed a
+    // cached session instead of a full handshake.
+    uint64_t handshakes{0};
+    uint64_t resumed{0};
+
+    // Number of sessions in the cache
+    uint64_t sessions{0};
+
+    // Handshake time in microseconds, empty if handshake_timing is false
+    HistogramSnapshot latency;
+};
+
+/**
+ * @brief Enable the client side session cache on the SSL_CTX shared by the
+ *        clients of Workflow, so that reconnecting to the same server
+ *        resumes the previous session(by session id or session ticket)
+ *        instead of a full handshake. It works for HttpClient with https,
+ *        and RedisClient/MySQLClient with use_ssl.
+ *
+ * It must be called after coke::library_init and before the first TLS
+ * connection, and cannot be disabled.
+ *
+ * @return 0 on success, or -1 if it is already enabled or there is no
+ *         client SSL_CTX.
+*/
+int enable_tls_session_cache(const TlsSessionParams &params);
+
+/**
+ * @brief Drop all the cached sessions, for example after the certificates
+ *        of the servers are rotated.
+*/
+void clear_tls_session_cache();
+
+TlsHandshakeStats get_tls_handshake_stats();
+
+} // namespace coke
+
+#endif // COKE_NET_TLS_SESSION_H
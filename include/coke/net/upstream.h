@@ -0,0 +1,134 @@
+/**
+ * Copyright 2024 Coke Project (https://github.com/kedixa/coke)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Authors: kedixa (https://github.com/kedixa)
+*/
+
+#ifndef COKE_NET_UPSTREAM_H
+#define COKE_NET_UPSTREAM_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace coke {
+
+/**
+ * An upstream group is a process wide set of replicas of a backend, named by
+ * a virtual host. When the host of HttpClient's url, or the `host` in the
+ * params of RedisClient or MySQLClient is the name of a group, each request
+ * is sent to one of the replicas selected by the group's policy.
+*/
+enum class UpstreamPolicy {
+    WEIGHTED_RANDOM,
+
+    // Smooth weighted round robin
+    ROUND_ROBIN,
+
+    // Requests with the same key go to the same replica, and only a small
+    // part of them move when the replicas change. The key is the path and
+    // query of HttpClient's url, the first argument(the key of most
+    // commands) of RedisClient's request, and empty for MySQLClient. The
+    // requests with empty key are selected by round robin.
+    CONSISTENT_HASH,
+
+    // Select the replica with the least in-flight requests of this process,
+    // relative to its weight.
+    LEAST_INFLIGHT,
+};
+
+struct UpstreamParams {
+    UpstreamPolicy policy           = UpstreamPolicy::WEIGHTED_RANDOM;
+
+    // Passive health checking, a replica is ejected after `max_fails`
+    // continuous failed requests, and is selected again after
+    // `eject_timeout` milliseconds. Zero `max_fails` disables ejection. If
+    // all the replicas are ejected, they are selected as if none is.
+    unsigned int max_fails          = 5;
+    int eject_timeout               = 10 * 1000;
+};
+
+struct UpstreamServer {
+    // The replica's "host:port", or "[ipv6]:port"
+    std::string address;
+    unsigned int weight             = 1;
+};
+
+struct UpstreamServerStats {
+    std::string address;
+    unsigned int weight{0};
+    bool ejected{false};
+
+    uint64_t inflight{0};
+    uint64_t total{0};
+    uint64_t failed{0};
+};
+
+/**
+ * @brief Create an upstream group named `name`.
+ * @return 0 on success, or -1 if the group already exists.
+*/
+int upstream_create(const std::string &name, const UpstreamParams &params);
+
+/**
+ * @brief Delete the group, requests to it are no longer redirected.
+ * @return 0 on success, or -1 if there is no such group.
+*/
+int upstream_delete(const std::string &name);
+
+/**
+ * @brief Add a replica to the group.
+ * @return 0 on success, or -1 if there is no such group, the address already
+ *         exists, or the weight is zero.
+*/
+int upstream_add_server(const std::string &name, const UpstreamServer &server);
+
+/**
+ * @brief Remove a replica from the group, the in-flight requests to it are
+ *         not affected.
+ * @return 0 on success, or -1 if there is no such group or address.
+*/
+int upstream_remove_server(const std::string &name, const std::string &address);
+
+/**
+ * @brief Get the statistics of each replica of the group, return false if
+ *        there is no such group.
+*/
+bool get_upstream_stats(const std::string &name,
+                        std::vector<UpstreamServerStats> &stats);
+
+namespace detail {
+
+struct UpstreamSelection {
+    std::string address;
+    void *server{nullptr};
+};
+
+/**
+ * @brief Select a replica for a request to `name` with `key`, return false
+ *        if `name` is not an upstream group. The request must be finished
+ *        by upstream_finish(sel.server, state) once it is done.
+*/
+bool upstream_select(std::string_view name, std::string_view key,
+                     UpstreamSelection &sel);
+
+void upstream_finish(void *server, int state) noexcept;
+
+} // namespace detail
+
+} // namespace coke
+
+#endif // COKE_NET_UPSTREAM_H
@@ -0,0 +1,419 @@
+/**
+ * Copyright 2024 Coke Project (https://github.com/kedixa/coke)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Authors: kedixa (https://github.com/kedixa)
+*/
+
+#ifndef COKE_OBJECT_POOL_H
+#define COKE_OBJECT_POOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "coke/condition.h"
+#include "coke/detail/constant.h"
+#include "coke/detail/shard_config.h"
+#include "coke/task.h"
+
+namespace coke {
+
+struct ObjectPoolParams {
+    // At most `max_objects` objects are created by the pool, zero means no
+    // limit, that is acquire never waits.
+    std::size_t max_objects     = 1024;
+
+    // Number of thread local caches, rounded up to a power of 2
+    std::size_t local_caches    = 16;
+
+    // Each local cache keeps at most `local_cache_size` idle objects, the
+    // others go to the shared overflow list.
+    std::size_t local_cache_size = 16;
+};
+
+/**
+ * @brief ObjectPool keeps expensive objects for reuse, such as parsers,
+ *        compression contexts and big buffers. An object is returned to the
+ *        cache of the releasing thread, and acquired from the cache of the
+ *        acquiring thread first, then the shared overflow list, then created
+ *        by the factory, then taken from the other caches. When all the
+ *        `max_objects` objects are in use, acquire waits for a release.
+ *
+ * The objects are returned as they are, reset them before use if needed. The
+ * pool must be alive until all the handles are destroyed.
+*/
+template<typename T>
+class ObjectPool {
+public:
+    using FactoryType = std::function<std::unique_ptr<T>()>;
+
+    /**
+     * @brief Handle owns an acquired object, and returns it to the pool when
+     *        destroyed. An empty handle means no object is acquired.
+    */
+    class Handle {
+    public:
+        Handle() noexcept : pool(nullptr), obj(nullptr) { }
+
+        Handle(Handle &&that) noexcept
+            : pool(std::exchange(that.pool, nullptr)),
+              obj(std::exchange(that.obj, nullptr))
+        { }
+
+        Handle &operator= (Handle &&that) noexcept {
+            if (this != &that) {
+                reset();
+                pool = std::exchange(that.pool, nullptr);
+                obj = std::exchange(that.obj, nullptr);
+            }
+
+            return *this;
+        }
+
+        ~Handle() { reset(); }
+
+        T *get() const noexcept { return obj; }
+        T &operator*() const noexcept { return *obj; }
+        T *operator->() const noexcept { return obj; }
+
+        explicit operator bool() const noexcept { return obj != nullptr; }
+
+        /**
+         * @brief Return the object to the pool, the handle becomes empty.
+        */
+        void reset() noexcept {
+            if (obj)
+                pool->release(std::exchange(obj, nullptr));
+        }
+
+        /**
+         * @brief Destroy the object instead of returning it, such as when it
+         *        is broken, the pool can create a new one instead.
+        */
+        void discard() noexcept {
+            if (obj)
+                pool->destroy(std::exchange(obj, nullptr));
+        }
+
+    private:
+        Handle(ObjectPool *pool, T *obj) noexcept : pool(pool), obj(obj) { }
+
+        friend ObjectPool;
+
+    private:
+        ObjectPool *pool;
+        T *obj;
+    };
+
+public:
+    explicit ObjectPool(const ObjectPoolParams &params,
+                        FactoryType factory = default_factory)
+        : factory(std::move(factory)),
+          max_objects(params.max_objects),
+          cache_size(params.local_cache_size),
+          shard_mask(std::bit_ceil(std::max(params.local_caches,
+                                            std::size_t(1))) - 1),
+          caches(std::make_unique<Cache[]>(shard_mask + 1))
+    { }
+
+    ObjectPool() : ObjectPool(ObjectPoolParams{}) { }
+
+    /**
+     * @brief ObjectPool is neither copyable nor movable.
+    */
+    ObjectPool(const ObjectPool &) = delete;
+    ObjectPool &operator= (const ObjectPool &) = delete;
+
+    ~ObjectPool() {
+        for (std::size_t i = 0; i <= shard_mask; i++) {
+            for (T *obj : caches[i].objs)
+                delete obj;
+        }
+
+        for (T *obj : shared)
+            delete obj;
+    }
+
+    /**
+     * @brief Acquire an object without waiting, return an empty handle if all
+     *        the objects are in use. The factory is called if needed, and the
+     *        exception thrown by it is propagated.
+    */
+    Handle try_acquire() {
+        return Handle(this, try_get());
+    }
+
+    /**
+     * @brief Acquire an object, wait for a release if all the objects are in
+     *        use. The handle is empty only if the process is about to exit.
+    */
+    Task<Handle> acquire() {
+        return acquire_impl(detail::TimedWaitHelper{});
+    }
+
+    /**
+     * @brief Same as acquire, but return an empty handle after `nsec`.
+    */
+    Task<Handle> acquire_for(NanoSec nsec) {
+        return acquire_impl(detail::TimedWaitHelper{nsec});
+    }
+
+    /**
+     * @brief Same as acquire, but return an empty handle at `deadline`.
+    */
+    Task<Handle> acquire_until(SteadyTimePoint deadline) {
+        return acquire_impl(detail::TimedWaitHelper{deadline});
+    }
+
+    /**
+     * @brief The number of objects created and not destroyed.
+    */
+    std::size_t created() const noexcept {
+        return num_created.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief The number of idle objects in the pool, it is not exact when the
+     *        pool is used concurrently.
+    */
+    std::size_t idle() const {
+        std::size_t n = 0;
+
+        for (std::size_t i = 0; i <= shard_mask; i++) {
+            std::lock_guard<std::mutex> lg(caches[i].mtx);
+            n += caches[i].objs.size();
+        }
+
+        std::lock_guard<std::mutex> lg(shared_mtx);
+        return n + shared.size();
+    }
+
+private:
+    struct alignas(detail::DESTRUCTIVE_ALIGN) Cache {
+        mutable std::mutex mtx;
+        std::vector<T *> objs;
+    };
+
+    static std::unique_ptr<T> default_factory() {
+        return std::make_unique<T>();
+    }
+
+    Cache &local_cache() {
+        return caches[detail::get_thread_index() & shard_mask];
+    }
+
+    static T *pop_cache(Cache &c) {
+        std::lock_guard<std::mutex> lg(c.mtx);
+
+        if (c.objs.empty())
+            return nullptr;
+
+        T *obj = c.objs.back();
+        c.objs.pop_back();
+        return obj;
+    }
+
+    T *pop_shared_locked() {
+        if (shared.empty())
+            return nullptr;
+
+        T *obj = shared.back();
+        shared.pop_back();
+        return obj;
+    }
+
+    bool can_create() const noexcept {
+        return max_objects == 0 ||
+               num_created.load(std::memory_order_relaxed) < max_objects;
+    }
+
+    T *create() {
+        std::size_t n = num_created.load(std::memory_order_relaxed);
+
+        do {
+            if (max_objects != 0 && n >= max_objects)
+                return nullptr;
+        } while (!num_created.compare_exchange_weak(n, n + 1,
+                                                    std::memory_order_relaxed));
+
+        try {
+            return factory().release();
+        }
+        catch (...) {
+            num_created.fetch_sub(1, std::memory_order_relaxed);
+            throw;
+        }
+    }
+
+    T *steal() {
+        for (std::size_t i = 0; i <= shard_mask; i++) {
+            if (T *obj = pop_cache(caches[i]))
+                return obj;
+        }
+
+        return nullptr;
+    }
+
+    T *try_get() {
+        T *obj = pop_cache(local_cache());
+
+        if (!obj) {
+            std::lock_guard<std::mutex> lg(shared_mtx);
+            obj = pop_shared_locked();
+        }
+
+        if (!obj)
+            obj = create();
+
+        if (!obj)
+            obj = steal();
+
+        return obj;
+    }
+
+    Task<Handle> acquire_impl(detail::TimedWaitHelper helper) {
+        T *obj = try_get();
+        int ret = TOP_SUCCESS;
+
+        if (obj)
+            co_return Handle(this, obj);
+
+        // After `waiters` is increased, a releasing thread either sees it and
+        // moves its cache to the shared list, or the object is seen here
+        waiters.fetch_add(1, std::memory_order_seq_cst);
+
+        while (true) {
+            obj = steal();
+            if (!obj)
+                obj = create();
+
+            if (obj || ret != TOP_SUCCESS)
+                break;
+
+            std::unique_lock<std::mutex> lk(shared_mtx);
+            obj = pop_shared_locked();
+            if (obj)
+                break;
+
+            // An object was destroyed after create failed, try again
+            if (can_create())
+                continue;
+
+            if (helper.infinite())
+                ret = co_await cond.wait(lk);
+            else
+                ret = co_await cond.wait_until(lk, helper.deadline());
+
+            obj = pop_shared_locked();
+            if (obj)
+                break;
+        }
+
+        waiters.fetch_sub(1, std::memory_order_relaxed);
+        co_return Handle(obj ? this : nullptr, obj);
+    }
+
+    void release(T *obj) noexcept {
+        Cache &c = local_cache();
+        bool cached;
+
+        {
+            std::lock_guard<std::mutex> lg(c.mtx);
+            cached = try_push(c, obj);
+        }
+
+        if (!cached)
+            push_shared(obj);
+        else {
+            // Pairs with the increment of `waiters` in acquire_impl
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (waiters.load(std::memory_order_relaxed) > 0)
+                flush_cache(c);
+        }
+    }
+
+    // Push without throwing, false if the cache is full or out of memory
+    bool try_push(Cache &c, T *obj) noexcept {
+        if (c.objs.size() >= cache_size)
+            return false;
+
+        try {
+            c.objs.push_back(obj);
+            return true;
+        }
+        catch (...) {
+            return false;
+        }
+    }
+
+    void push_shared(T *obj) noexcept {
+        std::lock_guard<std::mutex> lg(shared_mtx);
+
+        try {
+            shared.push_back(obj);
+        }
+        catch (...) {
+            // No memory to keep it, then destroy it
+            delete obj;
+            num_created.fetch_sub(1, std::memory_order_relaxed);
+        }
+
+        // The waiters check the shared list under the same lock
+        if (waiters.load(std::memory_order_relaxed) > 0)
+            cond.notify_one();
+    }
+
+    // Hand over the cached objects to the waiters
+    void flush_cache(Cache &c) noexcept {
+        while (T *obj = pop_cache(c))
+            push_shared(obj);
+    }
+
+    void destroy(T *obj) noexcept {
+        delete obj;
+        num_created.fetch_sub(1, std::memory_order_seq_cst);
+
+        // A waiter can create a new one now
+        if (waiters.load(std::memory_order_seq_cst) > 0) {
+            std::lock_guard<std::mutex> lg(shared_mtx);
+            cond.notify_one();
+        }
+    }
+
+private:
+    FactoryType factory;
+    std::size_t max_objects;
+    std::size_t cache_size;
+    std::size_t shard_mask;
+
+    std::atomic<std::size_t> num_created{0};
+    std::atomic<std::size_t> waiters{0};
+
+    std::unique_ptr<Cache[]> caches;
+
+    mutable std::mutex shared_mtx;
+    Condition cond;
+    std::vector<T *> shared;
+};
+
+} // namespace coke
+
+#endif // COKE_OBJECT_POOL_H
@@ -0,0 +1,251 @@
+/**
+ * Copyright 2024 Coke Project (https://github.com/kedixa/coke)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Authors: kedixa (https://github.com/kedixa)
+*/
+
+#ifndef COKE_PARALLEL_FOR_H
+#define COKE_PARALLEL_FOR_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <optional>
+#include <ranges>
+#include <vector>
+
+#include "coke/go.h"
+#include "coke/wait.h"
+
+namespace coke {
+
+namespace detail {
+
+/**
+ * @brief ParallelChunks splits [0, n) into chunks, which are claimed one by
+ *        one by all the workers, so that a slow worker does not hold back
+ *        the others.
+*/
+class ParallelChunks {
+    // Each worker gets about this many chunks, to balance the load
+    static constexpr std::size_t CHUNKS_PER_WORKER = 4;
+
+public:
+    ParallelChunks(std::size_t n, std::size_t grain, std::size_t workers)
+        : n(n), next(0)
+    {
+        grain = std::max(grain, std::size_t(1));
+        workers = std::max(workers, std::size_t(1));
+
+        std::size_t target = workers * CHUNKS_PER_WORKER;
+        chunk = std::max(grain, (n + target - 1) / target);
+        nchunks = (n + chunk - 1) / chunk;
+    }
+
+    std::size_t size() const noexcept { return nchunks; }
+
+    /**
+     * @brief Claim the next chunk [begin, end), return its index or size()
+     *        if all the chunks are claimed.
+    */
+    std::size_t claim(std::size_t &begin, std::size_t &end) noexcept {
+        std::size_t i = next.fetch_add(1, std::memory_order_relaxed);
+        if (i >= nchunks)
+            return nchunks;
+
+        begin = i * chunk;
+        end = std::min(n, begin + chunk);
+        return i;
+    }
+
+private:
+    std::size_t n;
+    std::size_t chunk;
+    std::size_t nchunks;
+    std::atomic<std::size_t> next;
+};
+
+template<typename W>
+Task<> parallel_go_helper(ExecQueue *queue, Executor *executor, W &work) {
+    co_await go(queue, executor, std::ref(work));
+}
+
+template<typename W>
+Task<> parallel_inline_helper(W &work) {
+    work();
+    co_return;
+}
+
+/**
+ * @brief Call `func(index, begin, end)` for each chunk of [0, n). The chunks
+ *        are executed by the compute thread pool, and the awaiting coroutine
+ *        also executes chunks in its current thread instead of idling.
+*/
+template<typename F>
+Task<> parallel_chunks_helper(std::size_t n, std::size_t grain, F &func) {
+    std::size_t threads = get_compute_threads();
+    ParallelChunks chunks(n, grain, threads + 1);
+
+    if (chunks.size() <= 1) {
+        if (n > 0)
+            func(std::size_t(0), std::size_t(0), n);
+        co_return;
+    }
+
+    auto work = [&chunks, &func]() {
+        std::size_t i, begin, end;
+
+        while ((i = chunks.claim(begin, end)) < chunks.size())
+            func(i, begin, end);
+    };
+
+    // One chunk is left for the awaiting coroutine at least
+    std::size_t helpers = std::min(threads, chunks.size() - 1);
+    auto *queue = get_exec_queue(std::string(GO_DEFAULT_QUEUE));
+    auto *executor = get_compute_executor();
+
+    std::vector<Task<>> tasks;
+    tasks.reserve(helpers + 1);
+
+    for (std::size_t i = 0; i < helpers; i++)
+        tasks.emplace_back(parallel_go_helper(queue, executor, work));
+
+    // The helpers are started first, then the awaiting coroutine joins them
+    tasks.emplace_back(parallel_inline_helper(work));
+
+    co_await async_wait(std::move(tasks));
+}
+
+template<typename F>
+Task<> parallel_for_index(std::size_t first, std::size_t last,
+                          std::size_t grain, F func) {
+    std::size_t n = (last > first) ? last - first : 0;
+    auto chunk_func = [first, &func](std::size_t, std::size_t b, std::size_t e) {
+        for (std::size_t i = first + b; i < first + e; i++)
+            std::invoke(func, i);
+    };
+
+    co_await parallel_chunks_helper(n, grain, chunk_func);
+}
+
+template<typename R, typename F>
+Task<> parallel_for_range(R &range, std::size_t grain, F func) {
+    auto it = std::ranges::begin(range);
+    std::size_t n = (std::size_t)std::ranges::distance(range);
+    auto chunk_func = [it, &func](std::size_t, std::size_t b, std::size_t e) {
+        auto cur = it + b;
+        for (std::size_t i = b; i < e; i++, ++cur)
+            std::invoke(func, *cur);
+    };
+
+    co_await parallel_chunks_helper(n, grain, chunk_func);
+}
+
+template<typename T, typename R, typename Reduce, typename Trans>
+Task<T> parallel_reduce_range(R &range, std::size_t grain, T init,
+                              Reduce reduce, Trans trans) {
+    auto it = std::ranges::begin(range);
+    std::size_t n = (std::size_t)std::ranges::distance(range);
+
+    // At most one partial result per chunk, see ParallelChunks
+    std::vector<std::optional<T>> partial;
+    auto chunk_func = [&](std::size_t idx, std::size_t b, std::size_t e) {
+        auto cur = it + b;
+        T acc = std::invoke(trans, *cur);
+
+        for (++cur, ++b; b < e; ++b, ++cur)
+            acc = std::invoke(reduce, std::move(acc), std::invoke(trans, *cur));
+
+        partial[idx].emplace(std::move(acc));
+    };
+
+    std::size_t threads = get_compute_threads();
+    partial.resize(ParallelChunks(n, grain, threads + 1).size());
+    co_await parallel_chunks_helper(n, grain, chunk_func);
+
+    // Combine in the order of chunks, so the result is deterministic
+    for (auto &opt : partial) {
+        if (opt)
+            init = std::invoke(reduce, std::move(init), std::move(*opt));
+    }
+
+    co_return init;
+}
+
+} // namespace detail
+
+/**
+ * @brief Call `func(i)` for each i in [first, last) in parallel.
+ *
+ * The indices are split into chunks of at least `grain` elements, the chunks
+ * are executed by the compute thread pool, and the awaiting coroutine also
+ * executes chunks in its current thread instead of idling.
+ *
+ * @param grain The min number of elements in one chunk, 0 is treated as 1.
+ * @param func Callable object, called concurrently in many threads, and must
+ *        not throw exceptions.
+ * @return coke::Task<void>, which finishes after all the calls return.
+*/
+template<typename F>
+    requires std::invocable<F&, std::size_t>
+Task<> parallel_for(std::size_t first, std::size_t last,
+                    std::size_t grain, F &&func) {
+    return detail::parallel_for_index(first, last, grain,
+                                      std::forward<F>(func));
+}
+
+/**
+ * @brief Call `func(elem)` for each element of `range` in parallel, see the
+ *        index version above.
+ *
+ * @param range The range must be alive until the returned task finishes.
+*/
+template<std::ranges::random_access_range R, typename F>
+    requires std::ranges::sized_range<R>
+        && std::invocable<F&, std::ranges::range_reference_t<R>>
+Task<> parallel_for(R &range, std::size_t grain, F &&func) {
+    return detail::parallel_for_range(range, grain, std::forward<F>(func));
+}
+
+/**
+ * @brief Reduce the elements of `range` in parallel, the result is
+ *        reduce(...reduce(reduce(init, part0), part1)..., partN), where each
+ *        part is the reduction of trans(elem) over a chunk of the range.
+ *
+ * @param range The range must be alive until the returned task finishes.
+ * @param grain The min number of elements in one chunk, 0 is treated as 1.
+ * @param init The initial value, used once.
+ * @param reduce Associative binary operation, called concurrently in many
+ *        threads, and must not throw exceptions.
+ * @param trans Unary operation applied to each element, default identity.
+ * @return coke::Task<T>.
+*/
+template<std::ranges::random_access_range R, Cokeable T,
+         typename Reduce, typename Trans = std::identity>
+    requires std::ranges::sized_range<R>
+        && std::invocable<Trans&, std::ranges::range_reference_t<R>>
+        && std::invocable<Reduce&, T, T>
+Task<T> parallel_reduce(R &range, std::size_t grain, T init,
+                        Reduce &&reduce, Trans &&trans = Trans{}) {
+    return detail::parallel_reduce_range(range, grain, std::move(init),
+                                         std::forward<Reduce>(reduce),
+                                         std::forward<Trans>(trans));
+}
+
+} // namespace coke
+
+#endif // COKE_PARALLEL_FOR_H
@@ -19,16 +19,32 @@
 #ifndef COKE_QPS_POOL_H
 #define COKE_QPS_POOL_H
 
-#include <mutex>
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cmath>
 #include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
 
 #include "coke/sleep.h"
 
 namespace coke {
 
+/**
+ * @brief QpsPool is lock free, the time of the last license is kept in one
+ *        atomic integer and updated by compare and swap.
+*/
 class QpsPool {
     using NanoType = int64_t;
-    static constexpr NanoType SUB_MASK = 1'000L;
+
+    // The time is kept in 1/16 nanoseconds relative to the creation of the
+    // pool, so that the fraction of the interval is not lost, and it will not
+    // overflow in 18 years.
+    static constexpr int SUB_SHIFT = 4;
 
 public:
     using AwaiterType = SleepAwaiter;
@@ -63,11 +79,210 @@ public:
     AwaiterType get_if(unsigned count, NanoSec nsec);
 
 private:
-    std::mutex mtx;
-    NanoType interval_nano;
-    NanoType interval_sub;
-    NanoType last_nano;
-    NanoType last_sub;
+    NanoType current_sub() const noexcept;
+
+private:
+    NanoType base_nano;
+    std::atomic<NanoType> interval_sub;
+    std::atomic<NanoType> last_sub;
+};
+
+
+struct KeyedQpsPoolParams {
+    // Allow `query` query in `seconds` seconds for each key
+    long query          = 0;
+    long seconds        = 1;
+
+    // At most `burst` licenses can be acquired at once by a key that has been
+    // idle for long enough, zero is treated as one.
+    unsigned burst      = 1;
+
+    // Number of shards, rounded up to a power of 2
+    std::size_t shards  = 16;
+
+    // Idle keys are evicted when the number of keys in a shard reaches
+    // `max_keys / shards`. Keys that are still limited are never evicted, so
+    // the memory is bounded by the number of recently active keys.
+    std::size_t max_keys = 65536;
+};
+
+/**
+ * @brief KeyedQpsPool limits the rate of each key independently, with a burst
+ *        allowance. The state of a key is its theoretical arrival time, a key
+ *        whose time has passed behaves the same as a new key, so evicting it
+ *        loses nothing.
+ *
+ * @tparam K Type of the key.
+ * @tparam Hash Hash function of the key.
+ * @tparam Equal Equal function of the key.
+*/
+template<typename K, typename Hash = std::hash<K>,
+         typename Equal = std::equal_to<K>>
+class KeyedQpsPool {
+    using NanoType = int64_t;
+
+    // Same precision as QpsPool
+    static constexpr int SUB_SHIFT = 4;
+
+    struct alignas(64) Shard {
+        std::mutex mtx;
+        std::size_t sweep_size{0};
+        std::unordered_map<K, NanoType, Hash, Equal> keys;
+    };
+
+public:
+    using AwaiterType = SleepAwaiter;
+    using KeyType = K;
+
+public:
+    /**
+     * @brief Create KeyedQpsPool with `params`, requires `params.query` >= 0
+     *        and `params.seconds` >= 1.
+    */
+    explicit KeyedQpsPool(const KeyedQpsPoolParams &params)
+        : base_nano(current_nano()), interval_sub(0)
+    {
+        std::size_t n = std::bit_ceil(std::max(params.shards, std::size_t(1)));
+
+        shard_mask = n - 1;
+        shards.reset(new Shard[n]);
+        shard_max_keys = std::max(params.max_keys / n, std::size_t(1));
+
+        for (std::size_t i = 0; i < n; i++)
+            shards[i].sweep_size = shard_max_keys;
+
+        burst = std::max(params.burst, 1U);
+        reset_qps(params.query, params.seconds);
+    }
+
+    KeyedQpsPool(const KeyedQpsPool &) = delete;
+    KeyedQpsPool &operator= (const KeyedQpsPool &) = delete;
+
+    /**
+     * @brief Reset the limit of all keys, see QpsPool::reset_qps.
+    */
+    void reset_qps(long query, long seconds = 1) {
+        NanoType interval = 0;
+
+        if (query > 0) {
+            double d = 1e9 * seconds / query;
+            interval = NanoType(std::floor(d * (1 << SUB_SHIFT)));
+        }
+
+        interval_sub.store(interval, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Acquire `count` license of `key`.
+     * @return An awaitable object that should be co awaited immediately.
+    */
+    AwaiterType get(const K &key, unsigned count = 1) {
+        return get_if(key, count, NanoSec::max());
+    }
+
+    /**
+     * @brief Acquire `count` license of `key` if wait period <= `nsec`.
+     * @return An awaitable object that should be co awaited immediately.
+     * @retval coke::SLEEP_SUCCESS if the license if acquired.
+     * @retval coke::SLEEP_CANCELED if cannot be acquired in nsec.
+    */
+    AwaiterType get_if(const K &key, unsigned count, NanoSec nsec) {
+        NanoType interval = interval_sub.load(std::memory_order_relaxed);
+        if (interval == 0)
+            return AwaiterType();
+
+        NanoType current = (current_nano() - base_nano) << SUB_SHIFT;
+        NanoType tolerance = interval * burst;
+        Shard &shard = get_shard(key);
+        std::lock_guard<std::mutex> lg(shard.mtx);
+
+        auto it = shard.keys.find(key);
+        NanoType tat = (it == shard.keys.end()) ? current : it->second;
+        NanoType next = std::max(tat, current) + interval * count;
+
+        auto nano = NanoSec((next - tolerance - current) >> SUB_SHIFT);
+        if (nano.count() > 0 && nano >= nsec)
+            return AwaiterType(SleepAwaiter::ImmediateTag{}, SLEEP_CANCELED);
+
+        if (it != shard.keys.end())
+            it->second = next;
+        else {
+            if (shard.keys.size() >= shard.sweep_size)
+                sweep(shard, current);
+
+            shard.keys.emplace(key, next);
+        }
+
+        if (nano.count() > 0)
+            return AwaiterType(nano);
+
+        // SLEEP_SUCCESS
+        return AwaiterType();
+    }
+
+    /**
+     * @brief Remove all the idle keys, it is done automatically when a shard
+     *        is full, and can also be called periodically.
+     * @return The number of keys removed.
+    */
+    std::size_t evict_idle() {
+        NanoType current = (current_nano() - base_nano) << SUB_SHIFT;
+        std::size_t removed = 0;
+
+        for (std::size_t i = 0; i <= shard_mask; i++) {
+            std::lock_guard<std::mutex> lg(shards[i].mtx);
+            removed += sweep(shards[i], current);
+        }
+
+        return removed;
+    }
+
+    /**
+     * @brief Get the number of keys currently kept.
+    */
+    std::size_t size() const {
+        std::size_t n = 0;
+
+        for (std::size_t i = 0; i <= shard_mask; i++) {
+            std::lock_guard<std::mutex> lg(shards[i].mtx);
+            n += shards[i].keys.size();
+        }
+
+        return n;
+    }
+
+private:
+    static NanoType current_nano() noexcept {
+        auto now = std::chrono::steady_clock::now().time_since_epoch();
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(now).count();
+    }
+
+    Shard &get_shard(const K &key) const {
+        std::size_t h = Hash{}(key);
+
+        // Mix the high bits in, std::hash of integers is usually identity
+        h ^= h >> 17;
+        return shards[(h * 0x9E3779B97F4A7C15ULL >> 32) & shard_mask];
+    }
+
+    std::size_t sweep(Shard &shard, NanoType current) {
+        std::size_t removed = std::erase_if(shard.keys, [current](auto &kv) {
+            return kv.second <= current;
+        });
+
+        // Sweep again only after the shard has grown enough, so that the cost
+        // is amortized when most keys are still active.
+        shard.sweep_size = std::max(shard_max_keys, shard.keys.size() * 2);
+        return removed;
+    }
+
+private:
+    NanoType base_nano;
+    std::atomic<NanoType> interval_sub;
+    unsigned burst;
+    std::size_t shard_mask;
+    std::size_t shard_max_keys;
+    std::unique_ptr<Shard[]> shards;
 };
 
 } // namespace coke
@@ -23,10 +23,26 @@
 #include <stack>
 
 #include "coke/detail/basic_concept.h"
+#include "coke/dary_heap.h"
 #include "coke/queue_common.h"
 
 namespace coke {
 
+namespace detail {
+
+template<typename T, typename Container, typename Compare>
+struct PriorityQueueType {
+    using type = std::priority_queue<T, Container, Compare>;
+};
+
+template<typename T, typename Container, typename Compare>
+    requires requires { Container::heap_arity; }
+struct PriorityQueueType<T, Container, Compare> {
+    using type = DaryHeap<T, Container::heap_arity, Container, Compare>;
+};
+
+} // namespace detail
+
 /**
  * @class coke::Queue
  * @brief coke::Queue is a container that gives the functionality of a queue,
@@ -102,7 +118,9 @@ private:
  * coke::PriorityQueue derive from coke::QueueCommon, which implement
  * most of the public member functions.
  *
- * @tparam T,Container,Compare Directly used to create std::priority_queue.
+ * @tparam T,Container,Compare Directly used to create std::priority_queue. If
+ *         Container is coke::DaryHeapVector<T, D>, a D-ary coke::DaryHeap is
+ *         used instead, which is cache friendlier for large queues.
 */
 template<
     Queueable T,
@@ -118,7 +136,8 @@ public:
     using SizeType = typename BaseType::SizeType;
     using ContainerType = Container;
     using ValueType = typename Container::value_type;
-    using QueueType = std::priority_queue<T, Container, Compare>;
+    using QueueType = typename detail::PriorityQueueType<
+        T, Container, Compare>::type;
     using CompareType = Compare;
 
     static_assert(std::is_same_v<T, ValueType>);
@@ -181,6 +200,26 @@ private:
         que.push(std::forward<U>(u));
     }
 
+    /**
+     * @brief Push at most `m` elements of [first, last) by one bulk build of
+     *        coke::DaryHeap, `n` is increased by the number pushed.
+    */
+    template<typename Iter>
+        requires requires (QueueType &q, Iter i) { q.push_range(i, i, 0); }
+    void do_push_range(Iter &first, Iter last, SizeType m, SizeType &n) {
+        SizeType old_size = que.size();
+
+        try {
+            first = que.push_range(first, last, m);
+        }
+        catch (...) {
+            n += que.size() - old_size;
+            throw;
+        }
+
+        n += que.size() - old_size;
+    }
+
     template<typename U>
     void do_pop(U &u) {
         if constexpr (std::is_nothrow_assignable_v<U &, T &&>)
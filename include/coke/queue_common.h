@@ -22,10 +22,14 @@
 #include <atomic>
 #include <cstdint>
 #include <mutex>
+#include <optional>
 #include <type_traits>
 #include <utility>
 
 #include "coke/condition.h"
+#include "coke/detail/select_base.h"
+#include "coke/queue_stats.h"
+#include "coke/stop_token.h"
 
 namespace coke {
 
@@ -35,7 +39,9 @@ namespace coke {
  *
  * Class QueueCommon requires its subclasses to implement three template
  * functions: `void do_emplace(Args&&...)`, `void do_push(U &&)`, and
- * `void do_pop(U &)` to use the interface provided by this class.
+ * `void do_pop(U &)` to use the interface provided by this class. They may
+ * also implement `void do_push_range(Iter &first, Iter last, SizeType m,
+ * SizeType &n)` to push at most m elements at once in try_push_range.
  *
  * @tparam Q Type of subclass.
  * @tparam T Type of container's value.
@@ -56,10 +62,36 @@ protected:
     static SizeType min(SizeType a, SizeType b) { return (b < a) ? b : a; }
 
     struct CountGuard {
-        CountGuard(SizeType &m) : n(m) { ++n; }
-        ~CountGuard() { --n; }
+        CountGuard(SizeType &m, detail::BlockStat &st)
+            : n(m), st(st), start(detail::TimedWaitHelper::now())
+        {
+            ++n;
+            ++st.count;
+        }
+
+        ~CountGuard() {
+            --n;
+            st.time += detail::TimedWaitHelper::now() - start;
+        }
 
         SizeType &n;
+        detail::BlockStat &st;
+        SteadyTimePoint start;
+    };
+
+    /**
+     * @brief Wake up the waiters of `cv` when stop is requested. Lock and
+     *        unlock que_mtx first, so that the waiters who have checked
+     *        stop_requested() are already sleeping on `cv`.
+    */
+    struct WakeOnStop {
+        void operator()() const noexcept {
+            { UniqueLock lk(que->que_mtx); }
+            cv->notify_all();
+        }
+
+        QueueCommon *que;
+        Condition *cv;
     };
 
     /**
@@ -69,7 +101,8 @@ protected:
     */
     QueueCommon(SizeType max_size)
         : que_max_size(max_size), que_cur_size(0), que_closed(false),
-          push_wait_cnt(0), pop_wait_cnt(0)
+          push_wait_cnt(0), pop_wait_cnt(0), high_water(0), push_count(0),
+          pop_count(0)
     {
         // empty queue not supported
         if (que_max_size == 0)
@@ -133,6 +166,7 @@ public:
         if (!que_closed.exchange(true, acq_rel)) {
             push_cv.notify_all();
             pop_cv.notify_all();
+            select_list.wake_all();
         }
     }
 
@@ -142,6 +176,48 @@ public:
     */
     void reopen() noexcept { que_closed.store(false, release); }
 
+    /**
+     * @brief Get the statistics since created or the last reset_stats.
+    */
+    QueueStats get_stats() const {
+        UniqueLock lk(que_mtx);
+        QueueStats st;
+
+        st.high_water = high_water;
+        st.push_count = push_count;
+        st.pop_count = pop_count;
+        st.blocked_push_count = push_block.count;
+        st.blocked_pop_count = pop_block.count;
+        st.blocked_push_time = push_block.time;
+        st.blocked_pop_time = pop_block.time;
+        return st;
+    }
+
+    /**
+     * @brief Reset the statistics, the high water mark restarts from the
+     *        current size.
+    */
+    void reset_stats() {
+        UniqueLock lk(que_mtx);
+
+        high_water = size();
+        push_count = 0;
+        pop_count = 0;
+        push_block.reset();
+        pop_block.reset();
+    }
+
+    // Inner use only, see coke::select.
+    void add_select_node(detail::SelectNode *node) {
+        UniqueLock lk(que_mtx);
+        select_list.add(node);
+    }
+
+    void remove_select_node(detail::SelectNode *node) {
+        UniqueLock lk(que_mtx);
+        select_list.remove(node);
+    }
+
 // public template member functions
 public:
 
@@ -198,7 +274,8 @@ public:
     template<typename... Args>
         requires std::constructible_from<T, Args&&...>
     Task<int> emplace(Args&&... args) {
-        return emplace_impl(true, NanoSec(0), std::forward<Args>(args)...);
+        return emplace_impl(detail::TimedWaitHelper{},
+                            std::forward<Args>(args)...);
     }
 
     /**
@@ -218,7 +295,18 @@ public:
     template<typename... Args>
         requires std::constructible_from<T, Args&&...>
     Task<int> try_emplace_for(NanoSec nsec, Args&&... args) {
-        return emplace_impl(false, nsec, std::forward<Args>(args)...);
+        return emplace_impl(detail::TimedWaitHelper{nsec},
+                            std::forward<Args>(args)...);
+    }
+
+    /**
+     * @brief Same as try_emplace_for, but wait until `deadline`.
+    */
+    template<typename... Args>
+        requires std::constructible_from<T, Args&&...>
+    Task<int> try_emplace_until(SteadyTimePoint deadline, Args&&... args) {
+        return emplace_impl(detail::TimedWaitHelper{deadline},
+                            std::forward<Args>(args)...);
     }
 
     /**
@@ -277,7 +365,26 @@ public:
     template<typename U>
         requires std::assignable_from<T&, U&&>
     Task<int> push(U &&u) {
-        return push_impl(true, NanoSec(0), std::forward<U>(u));
+        return push_impl(detail::TimedWaitHelper{}, std::forward<U>(u));
+    }
+
+    /**
+     * @brief Push new element into container, or give up when stop is
+     *        requested on `token` while waiting.
+     *
+     * @param u Value that will push into container.
+     * @param token The StopToken to observe, it must outlive the returned
+     *        coroutine.
+     *
+     * @returns Coroutine coke::Task that should co_await immediately.
+     * @retval coke::TOP_STOPPED If stop is requested before able to push.
+     * @retval Others see try_emplace_for.
+    */
+    template<typename U>
+        requires std::assignable_from<T&, U&&>
+    Task<int> push(U &&u, StopToken &token) {
+        return push_impl(detail::TimedWaitHelper{}, std::forward<U>(u),
+                         &token);
     }
 
     /**
@@ -292,7 +399,16 @@ public:
     template<typename U>
         requires std::assignable_from<T&, U&&>
     Task<int> try_push_for(NanoSec nsec, U &&u) {
-        return push_impl(false, nsec, std::forward<U>(u));
+        return push_impl(detail::TimedWaitHelper{nsec}, std::forward<U>(u));
+    }
+
+    /**
+     * @brief Same as try_push_for, but wait until `deadline`.
+    */
+    template<typename U>
+        requires std::assignable_from<T&, U&&>
+    Task<int> try_push_until(SteadyTimePoint deadline, U &&u) {
+        return push_impl(detail::TimedWaitHelper{deadline}, std::forward<U>(u));
     }
 
     /**
@@ -330,7 +446,25 @@ public:
     template<typename U>
         requires std::assignable_from<U&, T&&>
     Task<int> pop(U &u) {
-        return pop_impl(true, NanoSec(0), u);
+        return pop_impl(detail::TimedWaitHelper{}, u);
+    }
+
+    /**
+     * @brief Pop element from container, or give up when stop is requested
+     *        on `token` while waiting.
+     *
+     * @param u Reference that receive popped element.
+     * @param token The StopToken to observe, it must outlive the returned
+     *        coroutine.
+     *
+     * @returns Coroutine that should co_await immediately.
+     * @retval coke::TOP_STOPPED If stop is requested before able to pop.
+     * @retval Others see try_pop_for.
+    */
+    template<typename U>
+        requires std::assignable_from<U&, T&&>
+    Task<int> pop(U &u, StopToken &token) {
+        return pop_impl(detail::TimedWaitHelper{}, u, &token);
     }
 
     /**
@@ -350,7 +484,16 @@ public:
     template<typename U>
         requires std::assignable_from<U&, T&&>
     Task<int> try_pop_for(NanoSec nsec, U &u) {
-        return pop_impl(false, nsec, u);
+        return pop_impl(detail::TimedWaitHelper{nsec}, u);
+    }
+
+    /**
+     * @brief Same as try_pop_for, but wait until `deadline`.
+    */
+    template<typename U>
+        requires std::assignable_from<U&, T&&>
+    Task<int> try_pop_until(SteadyTimePoint deadline, U &u) {
+        return pop_impl(detail::TimedWaitHelper{deadline}, u);
     }
 
     /**
@@ -382,10 +525,14 @@ public:
 
         SizeType n = 0, m = max_qsize - cur_qsize;
         try {
-            while (first != last && n < m) {
-                get().do_push(*first);
-                ++n;
-                ++first;
+            if constexpr (requires { get().do_push_range(first, last, m, n); })
+                get().do_push_range(first, last, m, n);
+            else {
+                while (first != last && n < m) {
+                    get().do_push(*first);
+                    ++n;
+                    ++first;
+                }
             }
         }
         catch (...) {
@@ -472,24 +619,95 @@ public:
         if (cur_size == 0)
             return 0;
 
-        SizeType n = 0, m = min(cur_size, max_pop);
-        try {
-            while (n < m) {
-                get().do_pop(*iter);
-                ++n;
-                ++iter;
-            }
-        }
-        catch (...) {
-            // Because no way to roll back, discard what was popped.
-            if (n)
-                after_pop(lk, n);
+        return pop_n_locked(lk, iter, min(cur_size, max_pop));
+    }
 
-            std::rethrow_exception(std::current_exception());
-        }
+    /**
+     * @brief Push all the elements in [first, last) into container. When it is
+     *        full, wait for space and push as many as possible under one lock
+     *        acquisition, and wake up the waiting poppers once for each batch.
+     *
+     * @param first,last Element range [first, last).
+     * @param pushed If not nullptr, receive the number of elements pushed.
+     *
+     * @returns Coroutine that should co_await immediately.
+     * @retval coke::TOP_SUCCESS If all the elements are pushed.
+     * @retval Others see try_emplace_for, the elements before the failure
+     *         are already pushed.
+    */
+    template<std::input_iterator Iter>
+        requires std::assignable_from<T&, typename Iter::value_type>
+    Task<int> push_range(Iter first, Iter last, SizeType *pushed = nullptr) {
+        return push_range_impl(detail::TimedWaitHelper{}, std::move(first),
+                               std::move(last), pushed);
+    }
 
-        after_pop(lk, n);
-        return n;
+    /**
+     * @brief Same as push_range, but wait at most `nsec` for the whole range.
+    */
+    template<std::input_iterator Iter>
+        requires std::assignable_from<T&, typename Iter::value_type>
+    Task<int> try_push_range_for(NanoSec nsec, Iter first, Iter last,
+                                 SizeType *pushed = nullptr) {
+        return push_range_impl(detail::TimedWaitHelper{nsec}, std::move(first),
+                               std::move(last), pushed);
+    }
+
+    /**
+     * @brief Same as push_range, but wait until `deadline`.
+    */
+    template<std::input_iterator Iter>
+        requires std::assignable_from<T&, typename Iter::value_type>
+    Task<int> try_push_range_until(SteadyTimePoint deadline, Iter first,
+                                   Iter last, SizeType *pushed = nullptr) {
+        return push_range_impl(detail::TimedWaitHelper{deadline},
+                               std::move(first), std::move(last), pushed);
+    }
+
+    /**
+     * @brief Wait until container is not empty, then pop at most max_pop
+     *        elements under one lock acquisition, and wake up the waiting
+     *        pushers once.
+     *
+     * @param iter Iterator to recieve element. E.g. std::back_insert_iterator.
+     * @param max_pop Max elements to pop.
+     * @param popped If not nullptr, receive the number of elements popped.
+     *
+     * @returns Coroutine that should co_await immediately.
+     * @retval coke::TOP_SUCCESS If at least one element is popped, or max_pop
+     *         is zero.
+     * @retval Others see try_pop_for.
+    */
+    template<typename Iter>
+        requires std::is_assignable_v<decltype(*std::declval<Iter>()), T&&>
+                 && std::output_iterator<Iter, T>
+    Task<int> pop_n(Iter iter, SizeType max_pop, SizeType *popped = nullptr) {
+        return pop_n_impl(detail::TimedWaitHelper{}, std::move(iter), max_pop,
+                          popped);
+    }
+
+    /**
+     * @brief Same as pop_n, but wait at most `nsec`.
+    */
+    template<typename Iter>
+        requires std::is_assignable_v<decltype(*std::declval<Iter>()), T&&>
+                 && std::output_iterator<Iter, T>
+    Task<int> try_pop_n_for(NanoSec nsec, Iter iter, SizeType max_pop,
+                            SizeType *popped = nullptr) {
+        return pop_n_impl(detail::TimedWaitHelper{nsec}, std::move(iter),
+                          max_pop, popped);
+    }
+
+    /**
+     * @brief Same as pop_n, but wait until `deadline`.
+    */
+    template<typename Iter>
+        requires std::is_assignable_v<decltype(*std::declval<Iter>()), T&&>
+                 && std::output_iterator<Iter, T>
+    Task<int> try_pop_n_until(SteadyTimePoint deadline, Iter iter,
+                              SizeType max_pop, SizeType *popped = nullptr) {
+        return pop_n_impl(detail::TimedWaitHelper{deadline}, std::move(iter),
+                          max_pop, popped);
     }
 
 protected:
@@ -501,7 +719,15 @@ protected:
 
     void after_push(UniqueLock &lk, SizeType push_cnt) {
         SizeType wake_cnt = min(push_cnt, pop_wait_cnt);
-        que_cur_size.fetch_add(push_cnt, acq_rel);
+        SizeType cur = que_cur_size.fetch_add(push_cnt, acq_rel) + push_cnt;
+
+        push_count += push_cnt;
+        if (cur > high_water)
+            high_water = cur;
+
+        // Wake with the lock held, so that the nodes cannot be removed
+        if (!select_list.empty())
+            select_list.wake_all();
 
         lk.unlock();
 
@@ -512,6 +738,7 @@ protected:
     void after_pop(UniqueLock &lk, SizeType pop_cnt) {
         SizeType wake_cnt = min(pop_cnt, push_wait_cnt);
         que_cur_size.fetch_sub(pop_cnt, acq_rel);
+        pop_count += pop_cnt;
 
         lk.unlock();
 
@@ -519,8 +746,138 @@ protected:
             push_cv.notify(wake_cnt);
     }
 
+    template<typename Iter>
+    SizeType pop_n_locked(UniqueLock &lk, Iter &iter, SizeType m) {
+        SizeType n = 0;
+        try {
+            while (n < m) {
+                get().do_pop(*iter);
+                ++n;
+                ++iter;
+            }
+        }
+        catch (...) {
+            // Because no way to roll back, discard what was popped.
+            if (n)
+                after_pop(lk, n);
+
+            std::rethrow_exception(std::current_exception());
+        }
+
+        after_pop(lk, n);
+        return n;
+    }
+
+    template<typename Iter>
+    Task<int> push_range_impl(detail::TimedWaitHelper helper, Iter first,
+                              Iter last, SizeType *pushed) {
+        if (coke::prevent_recursive_stack())
+            co_await coke::yield();
+
+        SizeType total = 0;
+        int ret = TOP_SUCCESS;
+
+        while (first != last && ret == TOP_SUCCESS) {
+            UniqueLock lk(que_mtx);
+
+            if (full() && !closed()) {
+                CountGuard cg(push_wait_cnt, push_block);
+
+                if (helper.infinite()) {
+                    ret = co_await push_cv.wait(lk, [this]() {
+                        return push_pred();
+                    });
+                }
+                else {
+                    ret = co_await push_cv.wait_until(lk, helper.deadline(),
+                        [this]() { return push_pred(); });
+                }
+            }
+
+            if (ret != TOP_SUCCESS)
+                break;
+
+            if (closed()) {
+                ret = TOP_CLOSED;
+                break;
+            }
+
+            SizeType n = 0, m = max_size() - min(size(), max_size());
+            try {
+                while (first != last && n < m) {
+                    get().do_push(*first);
+                    ++n;
+                    ++first;
+                }
+            }
+            catch (...) {
+                if (n)
+                    after_push(lk, n);
+
+                if (pushed)
+                    *pushed = total + n;
+
+                std::rethrow_exception(std::current_exception());
+            }
+
+            total += n;
+            after_push(lk, n);
+        }
+
+        if (pushed)
+            *pushed = total;
+
+        co_return ret;
+    }
+
+    template<typename Iter>
+    Task<int> pop_n_impl(detail::TimedWaitHelper helper, Iter iter,
+                         SizeType max_pop, SizeType *popped) {
+        if (coke::prevent_recursive_stack())
+            co_await coke::yield();
+
+        if (popped)
+            *popped = 0;
+
+        if (max_pop == 0)
+            co_return TOP_SUCCESS;
+
+        int ret;
+
+        UniqueLock lk(que_mtx);
+        if (!empty())
+            ret = TOP_SUCCESS;
+        else if (closed())
+            ret = TOP_CLOSED;
+        else {
+            CountGuard cg(pop_wait_cnt, pop_block);
+
+            if (helper.infinite()) {
+                ret = co_await pop_cv.wait(lk, [this]() {
+                    return pop_pred();
+                });
+            }
+            else {
+                ret = co_await pop_cv.wait_until(lk, helper.deadline(),
+                    [this]() { return pop_pred(); });
+            }
+        }
+
+        if (ret == TOP_SUCCESS) {
+            if (!empty()) {
+                SizeType n = pop_n_locked(lk, iter, min(size(), max_pop));
+                if (popped)
+                    *popped = n;
+            }
+            else
+                ret = TOP_CLOSED;
+        }
+
+        co_return ret;
+    }
+
     template<typename... Args>
-    Task<int> emplace_impl(bool inf, NanoSec nsec, Args&&... args) {
+    Task<int> emplace_impl(detail::TimedWaitHelper helper, Args&&... args) {
         if (coke::prevent_recursive_stack())
             co_await coke::yield();
 
@@ -530,17 +887,16 @@ protected:
         if (closed())
             ret = TOP_CLOSED;
         else if (full()) {
-            CountGuard cg(push_wait_cnt);
+            CountGuard cg(push_wait_cnt, push_block);
 
-            if (inf) {
+            if (helper.infinite()) {
                 ret = co_await push_cv.wait(lk, [this]() {
                     return push_pred();
                 });
             }
             else {
-                ret = co_await push_cv.wait_for(lk, nsec, [this]() {
-                    return push_pred();
-                });
+                ret = co_await push_cv.wait_until(lk, helper.deadline(),
+                    [this]() { return push_pred(); });
             }
         }
 
@@ -558,28 +914,37 @@ protected:
     }
 
     template<typename U>
-    Task<int> push_impl(bool inf, NanoSec nsec, U &&u) {
+    Task<int> push_impl(detail::TimedWaitHelper helper, U &&u,
+                        StopToken *token = nullptr) {
         if (coke::prevent_recursive_stack())
             co_await coke::yield();
 
         int ret = TOP_SUCCESS;
 
+        // Registered before locking, because it may be invoked at once and
+        // locks que_mtx, see WakeOnStop.
+        std::optional<StopCallback<WakeOnStop>> cb;
+        if (token)
+            cb.emplace(*token, WakeOnStop{this, &push_cv});
+
         UniqueLock lk(que_mtx);
         if (closed())
             ret = TOP_CLOSED;
+        else if (token && token->stop_requested())
+            ret = TOP_STOPPED;
         else if (full()) {
-            CountGuard cg(push_wait_cnt);
+            CountGuard cg(push_wait_cnt, push_block);
+            auto pred = [this, token]() {
+                return push_pred() || (token && token->stop_requested());
+            };
 
-            if (inf) {
-                ret = co_await push_cv.wait(lk, [this]() {
-                    return push_pred();
-                });
-            }
-            else {
-                ret = co_await push_cv.wait_for(lk, nsec, [this]() {
-                    return push_pred();
-                });
-            }
+            if (helper.infinite())
+                ret = co_await push_cv.wait(lk, pred);
+            else
+                ret = co_await push_cv.wait_until(lk, helper.deadline(), pred);
+
+            if (ret == TOP_SUCCESS && !push_pred())
+                ret = TOP_STOPPED;
         }
 
         if (ret == TOP_SUCCESS) {
@@ -596,30 +961,37 @@ protected:
     }
 
     template<typename U>
-    Task<int> pop_impl(bool inf, NanoSec nsec, U &u) {
+    Task<int> pop_impl(detail::TimedWaitHelper helper, U &u,
+                       StopToken *token = nullptr) {
         if (coke::prevent_recursive_stack())
             co_await coke::yield();
 
         int ret;
 
+        std::optional<StopCallback<WakeOnStop>> cb;
+        if (token)
+            cb.emplace(*token, WakeOnStop{this, &pop_cv});
+
         UniqueLock lk(que_mtx);
         if (!empty())
             ret = TOP_SUCCESS;
         else if (closed())
             ret = TOP_CLOSED;
+        else if (token && token->stop_requested())
+            ret = TOP_STOPPED;
         else {
-            CountGuard cg(pop_wait_cnt);
+            CountGuard cg(pop_wait_cnt, pop_block);
+            auto pred = [this, token]() {
+                return pop_pred() || (token && token->stop_requested());
+            };
 
-            if (inf) {
-                ret = co_await pop_cv.wait(lk, [this]() {
-                    return pop_pred();
-                });
-            }
-            else {
-                ret = co_await pop_cv.wait_for(lk, nsec, [this]() {
-                    return pop_pred();
-                });
-            }
+            if (helper.infinite())
+                ret = co_await pop_cv.wait(lk, pred);
+            else
+                ret = co_await pop_cv.wait_until(lk, helper.deadline(), pred);
+
+            if (ret == TOP_SUCCESS && !pop_pred())
+                ret = TOP_STOPPED;
         }
 
         if (ret == TOP_SUCCESS) {
@@ -646,6 +1018,14 @@ protected:
 
     SizeType push_wait_cnt;
     SizeType pop_wait_cnt;
+    detail::SelectList select_list;
+
+    // Statistics, see get_stats
+    SizeType high_water;
+    uint64_t push_count;
+    uint64_t pop_count;
+    detail::BlockStat push_block;
+    detail::BlockStat pop_block;
 
 private:
     Q &get() noexcept { return static_cast<Q &>(*this); }
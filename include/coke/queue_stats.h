@@ -0,0 +1,68 @@
+/**
+ * Copyright 2024 Coke Project (https://github.com/kedixa/coke)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Authors: kedixa (https://github.com/kedixa)
+*/
+
+#ifndef COKE_QUEUE_STATS_H
+#define COKE_QUEUE_STATS_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include "coke/sleep.h"
+
+namespace coke {
+
+/**
+ * @brief Statistics of coke::Queue, coke::PriorityQueue, coke::Stack and
+ *        coke::Deque, used to tune `max_size` and the backpressure.
+*/
+struct QueueStats {
+    // Max number of elements ever in the container
+    std::size_t high_water{0};
+
+    // Number of elements pushed and popped
+    uint64_t push_count{0};
+    uint64_t pop_count{0};
+
+    // Number of pushes and pops that waited, and the total time they waited
+    uint64_t blocked_push_count{0};
+    uint64_t blocked_pop_count{0};
+    NanoSec blocked_push_time{0};
+    NanoSec blocked_pop_time{0};
+};
+
+namespace detail {
+
+/**
+ * @brief Count the waits of one side of a container, the clock is only read
+ *        when it is going to wait, which is much more expensive.
+*/
+struct BlockStat {
+    void reset() noexcept {
+        count = 0;
+        time = NanoSec(0);
+    }
+
+    uint64_t count{0};
+    NanoSec time{0};
+};
+
+} // namespace detail
+
+} // namespace coke
+
+#endif // COKE_QUEUE_STATS_H
@@ -0,0 +1,252 @@
+/**
+ * Copyright 2024 Coke Project (https://github.com/kedixa/coke)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Authors: kedixa (https://github.com/kedixa)
+*/
+
+#ifndef COKE_RCU_CELL_H
+#define COKE_RCU_CELL_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+#include "coke/detail/constant.h"
+#include "coke/mutex.h"
+#include "coke/sleep.h"
+#include "coke/task.h"
+
+namespace coke {
+
+/**
+ * @brief RcuCell holds a value of T that is read far more often than updated.
+ *        Readers get a snapshot by two atomic operations, and never wait for
+ *        the updaters or each other. An update publishes the new value at
+ *        once, then waits for the readers of the old value to leave, called
+ *        a grace period, before destroying it. The grace period is waited by
+ *        sleeping on the address of the cell, just like other primitives, so
+ *        no thread is blocked.
+ *
+ * Readers are counted by the epoch when they begin. Each update flips the
+ * epoch twice and waits for the readers of the previous epoch after each
+ * flip, so that a reader who loaded an old epoch and is counted late is still
+ * waited for.
+*/
+template<typename T>
+class RcuCell {
+public:
+    using ValueType = T;
+
+    /**
+     * @brief ReadGuard keeps the snapshot valid until it is destroyed. It can
+     *        be held across co_await, but the update of the same cell must
+     *        not be awaited while holding it, which never finishes.
+    */
+    class [[nodiscard]] ReadGuard {
+    public:
+        ReadGuard() noexcept : cell(nullptr), ptr(nullptr), idx(0) { }
+
+        ReadGuard(ReadGuard &&that) noexcept
+            : cell(std::exchange(that.cell, nullptr)),
+              ptr(std::exchange(that.ptr, nullptr)), idx(that.idx)
+        { }
+
+        ReadGuard &operator= (ReadGuard &&that) noexcept {
+            if (this != &that) {
+                reset();
+                cell = std::exchange(that.cell, nullptr);
+                ptr = std::exchange(that.ptr, nullptr);
+                idx = that.idx;
+            }
+
+            return *this;
+        }
+
+        ~ReadGuard() { reset(); }
+
+        /**
+         * @brief Leave the read side critical section, the snapshot must not
+         *        be used after that.
+        */
+        void reset() noexcept {
+            if (cell) {
+                cell->read_unlock(idx);
+                cell = nullptr;
+                ptr = nullptr;
+            }
+        }
+
+        const T *get() const noexcept { return ptr; }
+        const T &operator*() const noexcept { return *ptr; }
+        const T *operator->() const noexcept { return ptr; }
+
+        explicit operator bool() const noexcept { return ptr != nullptr; }
+
+    private:
+        ReadGuard(const RcuCell *cell, const T *ptr, unsigned idx) noexcept
+            : cell(cell), ptr(ptr), idx(idx)
+        { }
+
+    private:
+        const RcuCell *cell;
+        const T *ptr;
+        unsigned idx;
+
+        friend class RcuCell;
+    };
+
+public:
+    /**
+     * @brief Create an RcuCell holds `value`, which may be nullptr.
+    */
+    explicit RcuCell(std::unique_ptr<T> value = nullptr) noexcept
+        : ptr(value.release()), epoch(0), grace_waiting(false)
+    {
+        readers[0].count = 0;
+        readers[1].count = 0;
+    }
+
+    /**
+     * @brief RcuCell is neither copyable nor movable.
+    */
+    RcuCell(const RcuCell &) = delete;
+    RcuCell &operator= (const RcuCell &) = delete;
+
+    /**
+     * @pre There is no reader or updater of this cell.
+    */
+    ~RcuCell() { delete ptr.load(std::memory_order_relaxed); }
+
+    /**
+     * @brief Get a snapshot of the current value, it is wait free.
+    */
+    ReadGuard read() const noexcept {
+        unsigned idx = epoch.load(std::memory_order_seq_cst) & 1;
+
+        readers[idx].count.fetch_add(1, std::memory_order_seq_cst);
+        return ReadGuard(this, ptr.load(std::memory_order_seq_cst), idx);
+    }
+
+    /**
+     * @brief Replace the value with `value`, and destroy the old one after
+     *        all the readers of it leave. Concurrent updates are applied one
+     *        by one.
+     *
+     * @return Coroutine(coke::Task<int>) that needs to be awaited immediately,
+     *         the new value is visible to readers once it starts.
+     * @retval coke::TOP_SUCCESS If the old value is destroyed.
+     * @retval coke::TOP_ABORTED If process exit during the grace period, the
+     *         old value is leaked rather than destroyed while it may be read.
+     * @retval Negative integer to indicate system error, almost never happens.
+     * @see coke/global.h
+    */
+    Task<int> update(std::unique_ptr<T> value) {
+        co_await update_mtx.lock();
+
+        T *old = ptr.exchange(value.release(), std::memory_order_seq_cst);
+        int ret = co_await synchronize_locked();
+
+        update_mtx.unlock();
+
+        if (ret == TOP_SUCCESS)
+            delete old;
+
+        co_return ret;
+    }
+
+    /**
+     * @brief Same as update, but construct the new value with `args`.
+    */
+    template<typename... Args>
+    Task<int> emplace(Args&&... args) {
+        return update(std::make_unique<T>(std::forward<Args>(args)...));
+    }
+
+    /**
+     * @brief Wait for a grace period, all the readers that begin before the
+     *        call have left when it finishes.
+     *
+     * @return See update.
+    */
+    Task<int> synchronize() {
+        co_await update_mtx.lock();
+        int ret = co_await synchronize_locked();
+        update_mtx.unlock();
+
+        co_return ret;
+    }
+
+private:
+    void read_unlock(unsigned idx) const {
+        auto &cnt = readers[idx].count;
+
+        if (cnt.fetch_sub(1, std::memory_order_seq_cst) == 1 &&
+            grace_waiting.load(std::memory_order_seq_cst))
+            cancel_sleep_by_addr(get_addr());
+    }
+
+    const void *get_addr() const noexcept {
+        return (const char *)this + 1;
+    }
+
+    Task<int> synchronize_locked() {
+        int ret = TOP_SUCCESS;
+
+        grace_waiting.store(true, std::memory_order_seq_cst);
+
+        for (int i = 0; i < 2 && ret == TOP_SUCCESS; i++) {
+            unsigned idx = epoch.fetch_add(1, std::memory_order_seq_cst) & 1;
+            ret = co_await wait_readers(idx);
+        }
+
+        grace_waiting.store(false, std::memory_order_relaxed);
+        co_return ret;
+    }
+
+    Task<int> wait_readers(unsigned idx) {
+        auto &cnt = readers[idx].count;
+
+        while (cnt.load(std::memory_order_seq_cst) != 0) {
+            // The last reader wakes it up, see WaitGroup::wait
+            auto slp = sleep(get_addr(), inf_dur);
+
+            if (cnt.load(std::memory_order_seq_cst) == 0)
+                cancel_sleep_by_addr(get_addr());
+
+            int ret = co_await std::move(slp);
+            if (ret == SLEEP_ABORTED || ret < 0)
+                co_return ret;
+        }
+
+        co_return TOP_SUCCESS;
+    }
+
+private:
+    struct alignas(detail::DESTRUCTIVE_ALIGN) ReaderCount {
+        mutable std::atomic<std::size_t> count;
+    };
+
+    std::atomic<T *> ptr;
+    std::atomic<unsigned> epoch;
+    std::atomic<bool> grace_waiting;
+
+    ReaderCount readers[2];
+    Mutex update_mtx;
+};
+
+} // namespace coke
+
+#endif // COKE_RCU_CELL_H
@@ -19,11 +19,18 @@
 #ifndef COKE_REDIS_CLIENT_H
 #define COKE_REDIS_CLIENT_H
 
+#include <memory>
+#include <span>
 #include <vector>
 #include <utility>
 #include <string>
+#include <string_view>
+#include <sys/uio.h>
 
 #include "coke/net/network.h"
+#include "coke/redis/redis_utils.h"
+#include "coke/global.h"
+#include "coke/task.h"
 
 #include "workflow/RedisMessage.h"
 #include "workflow/URIParser.h"
@@ -36,6 +43,91 @@ using RedisValue = protocol::RedisValue;
 using RedisAwaiter = NetworkAwaiter<RedisRequest, RedisResponse>;
 using RedisResult = RedisAwaiter::ResultType;
 
+/**
+ * @brief RedisPipeline collects commands that are sent by
+ *        RedisClient::pipeline in one write on one connection. The commands
+ *        are encoded when added, so the pipeline can be reused many times.
+*/
+class RedisPipeline {
+public:
+    RedisPipeline() = default;
+    RedisPipeline(const RedisPipeline &) = default;
+    RedisPipeline(RedisPipeline &&) = default;
+    RedisPipeline &operator= (const RedisPipeline &) = default;
+    RedisPipeline &operator= (RedisPipeline &&) = default;
+    ~RedisPipeline() = default;
+
+    RedisPipeline &add(const std::string &command,
+                       const std::vector<std::string> &params);
+
+    /**
+     * @brief Add a command whose arguments(including the command itself) are
+     *        encoded from the views directly, without making owned strings.
+    */
+    RedisPipeline &add_args(std::span<const std::string_view> args);
+    RedisPipeline &add_args(std::span<const struct iovec> args);
+
+    std::size_t size() const noexcept { return count; }
+    bool empty() const noexcept { return count == 0; }
+
+    /**
+     * @brief The encoded commands in RESP format.
+    */
+    const std::string &get_buffer() const noexcept { return buf; }
+
+    void clear() noexcept {
+        buf.clear();
+        key.clear();
+        count = 0;
+    }
+
+private:
+    std::string buf;
+    std::string key;
+    std::size_t count{0};
+
+    friend class RedisClient;
+};
+
+struct RedisPipelineResult {
+    int state{STATE_UNDEFINED};
+    int error{0};
+
+    // One value for each command of the pipeline in order, valid only when
+    // state is STATE_SUCCESS.
+    std::vector<RedisValue> values;
+};
+
+/**
+ * @brief The result of RedisClient::pipeline_view, the replies are kept in
+ *        `buffer` as received and `values` are views into it, so it can be
+ *        moved but not copied.
+*/
+struct RedisViewResult {
+    RedisViewResult() = default;
+    RedisViewResult(RedisViewResult &&) = default;
+    RedisViewResult &operator= (RedisViewResult &&) = default;
+
+    int state{STATE_UNDEFINED};
+    int error{0};
+
+    std::vector<char> buffer;
+    std::vector<RedisValueView> values;
+};
+
+struct RedisBatchResult {
+    int state{STATE_UNDEFINED};
+    int error{0};
+    RedisValue value;
+};
+
+namespace detail {
+
+struct RedisBatcher;
+struct RedisPipelineState;
+
+} // namespace detail
+
 struct RedisClientParams {
     int retry_max           = 0;
     int send_timeout        = -1;
@@ -48,8 +140,26 @@ struct RedisClientParams {
     std::string host;
     std::string username;
     std::string password;
+
+    // The concurrent requests of RedisClient::batch_request are coalesced
+    // into one pipeline of at most `batch_max` commands, a batch is sent
+    // `batch_window_us` microseconds after its first command or once it is
+    // full. Zero window means just yield to let others join.
+    std::size_t batch_max   = 64;
+    int batch_window_us     = 100;
 };
 
+namespace detail {
+
+/**
+ * @brief Make the url of a redis server from params, `prefix` and `suffix`
+ *        are the parts of url before and after the host and port.
+*/
+void make_redis_url(const RedisClientParams &params, std::string &url,
+                    std::string &prefix, std::string &suffix);
+
+} // namespace detail
+
 class RedisClient {
 public:
     using ReqType = RedisRequest;
@@ -63,13 +173,68 @@ public:
     AwaiterType request(const std::string &command,
                         const std::vector<std::string> &params) noexcept;
 
+    /**
+     * @brief Send all the commands of `pipe` in one write on one connection
+     *        and receive the replies in order. AUTH and SELECT are sent in
+     *        front of the commands when needed, their replies are not
+     *        included in the result.
+     *
+     *        If params.host is an upstream group, the first argument of the
+     *        first command is used to select the replica, so commands with
+     *        keys on different replicas should not share one pipeline.
+    */
+    Task<RedisPipelineResult> pipeline(RedisPipeline pipe);
+
+    /**
+     * @brief Same as pipeline, but the replies are not parsed into RedisValue,
+     *        see RedisValueView.
+    */
+    Task<RedisViewResult> pipeline_view(RedisPipeline pipe);
+
+    /**
+     * @brief Send one command built from `args` like RedisPipeline::add_args,
+     *        and get its reply as RedisValueView. The args are encoded before
+     *        this function returns.
+    */
+    Task<RedisViewResult> request_view(std::span<const std::string_view> args);
+
+    /**
+     * @brief Same as request, but the concurrent requests of this client are
+     *        coalesced into pipelines automatically, and the reply of each
+     *        command is delivered back to its caller. It trades a little
+     *        latency for far fewer connections when there are hundreds of
+     *        concurrent requests, see RedisClientParams::batch_max.
+     *
+     *        If params.host is an upstream group, each batch is sent to the
+     *        replica selected by its first command, see pipeline.
+    */
+    Task<RedisBatchResult> batch_request(const std::string &command,
+                                         const std::vector<std::string> &params);
+
 protected:
     virtual AwaiterType create_task(ReqType *) noexcept;
 
+    /**
+     * @brief Same as create_task, but if params.host is an upstream group,
+     *        `key` is used to select the replica, see coke::UpstreamPolicy.
+    */
+    AwaiterType create_task(ReqType *req, std::string_view key) noexcept;
+
+    Task<> send_pipeline(RedisPipeline &pipe, bool raw,
+                         detail::RedisPipelineState &st);
+
 protected:
     RedisClientParams params;
     std::string url;
     ParsedURI uri;
+
+    // The parts of url before and after the host and port, used to make the
+    // url of a replica when params.host is an upstream group.
+    std::string url_prefix;
+    std::string url_suffix;
+
+    // Shared by the copies of this client, so that they batch together.
+    std::shared_ptr<detail::RedisBatcher> batcher;
 };
 
 } // namespace coke
@@ -0,0 +1,132 @@
+/**
+ * Copyright 2024 Coke Project (https://github.com/kedixa/coke)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Authors: kedixa (https://github.com/kedixa)
+*/
+
+#ifndef COKE_REDIS_CLUSTER_CLIENT_H
+#define COKE_REDIS_CLUSTER_CLIENT_H
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "coke/redis/redis_client.h"
+#include "coke/mutex.h"
+
+namespace coke {
+
+constexpr uint16_t REDIS_CLUSTER_SLOTS = 16384;
+
+/**
+ * @brief Get the hash slot of `key` in Redis Cluster, only the part inside
+ *        the first non-empty {...} is hashed if there is one.
+*/
+uint16_t redis_key_slot(std::string_view key) noexcept;
+
+using RedisClusterResult = RedisBatchResult;
+
+struct RedisCommand {
+    std::string command;
+    std::vector<std::string> params;
+};
+
+struct RedisClusterParams {
+    int retry_max           = 0;
+    int send_timeout        = -1;
+    int receive_timeout     = -1;
+    int keep_alive_timeout  = 60 * 1000;
+
+    bool use_ssl            = false;
+    std::string username;
+    std::string password;
+
+    // Addresses of some nodes in the cluster in "host:port" format, used to
+    // get the slot map at the first time.
+    std::vector<std::string> seeds;
+
+    // Max number of MOVED, ASK and TRYAGAIN redirections followed for one
+    // command.
+    int max_redirects       = 5;
+};
+
+class RedisClusterClient {
+public:
+    explicit RedisClusterClient(const RedisClusterParams &params);
+    virtual ~RedisClusterClient() = default;
+
+    RedisClusterClient(const RedisClusterClient &) = delete;
+    RedisClusterClient &operator= (const RedisClusterClient &) = delete;
+
+    /**
+     * @brief Send the command to the node that serves the slot of its key,
+     *        the first argument is treated as the key. MOVED and ASK replies
+     *        are followed, and MOVED also refreshes the cached slot map.
+    */
+    Task<RedisClusterResult> request(const std::string &command,
+                                     const std::vector<std::string> &params);
+
+    /**
+     * @brief Split the commands by node, and send them as one pipeline to each
+     *        node in parallel. The results are in the same order as `cmds`,
+     *        commands that are redirected are sent again one by one.
+    */
+    Task<std::vector<RedisClusterResult>>
+    pipeline(const std::vector<RedisCommand> &cmds);
+
+    /**
+     * @brief Get the slot map by CLUSTER SLOTS from the known nodes and the
+     *        seeds, concurrent calls are coalesced into one.
+     *
+     * @return 0 on success, or a negative errno.
+    */
+    Task<int> refresh_slots();
+
+    /**
+     * @brief Get the address of the node that serves `slot` in the cached slot
+     *        map, or an empty string if it is unknown.
+    */
+    std::string get_slot_address(uint16_t slot) const;
+
+protected:
+    RedisClient *get_node(const std::string &address);
+    uint32_t add_node_locked(const std::string &address);
+    RedisClient *find_slot_node(uint16_t slot, uint64_t *version) const;
+    void update_slot(uint16_t slot, const std::string &address);
+
+    Task<int> refresh_slots(uint64_t version);
+
+protected:
+    RedisClusterParams params;
+
+    mutable std::shared_mutex slot_mtx;
+    uint64_t slot_version{0};
+
+    // Index of node plus one for each slot, zero means unknown.
+    std::vector<uint32_t> slots;
+    std::vector<std::unique_ptr<RedisClient>> nodes;
+    std::vector<std::string> node_addrs;
+    std::map<std::string, uint32_t, std::less<>> node_index;
+
+    Mutex refresh_mtx;
+};
+
+} // namespace coke
+
+#endif // COKE_REDIS_CLUSTER_CLIENT_H
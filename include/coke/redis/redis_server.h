@@ -19,6 +19,12 @@
 #ifndef COKE_REDIS_SERVER_H
 #define COKE_REDIS_SERVER_H
 
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+
 #include "coke/net/basic_server.h"
 
 #include "workflow/WFRedisServer.h"
@@ -37,6 +43,53 @@ struct RedisServerParams : public ServerParams {
     ~RedisServerParams() = default;
 };
 
+/**
+ * @brief The handler of a command, `params` are the arguments after the
+ *        command name. The response is replied after the handler returns if
+ *        it is not replied by the handler.
+*/
+using RedisCommandHandler = std::function<
+    Task<>(RedisServerContext &ctx, std::vector<std::string> &params)
+>;
+
+/**
+ * @brief RedisCommandTable maps the case-insensitive command names to their
+ *        handlers with a flat open addressing table, so that a command is
+ *        found without lowercasing or allocating. Add all the commands before
+ *        the table is used concurrently.
+*/
+class RedisCommandTable {
+public:
+    RedisCommandTable() = default;
+
+    /**
+     * @brief Add or replace the handler of command `name`.
+    */
+    void add(std::string_view name, RedisCommandHandler handler);
+
+    /**
+     * @brief Find the handler of command `name`, or nullptr if not found.
+    */
+    const RedisCommandHandler *find(std::string_view name) const noexcept;
+
+    std::size_t size() const noexcept { return entries.size(); }
+
+private:
+    void rebuild();
+
+private:
+    struct Entry {
+        std::string name;
+        uint64_t hash;
+        RedisCommandHandler handler;
+    };
+
+    std::vector<Entry> entries;
+
+    // Index of entry plus one, zero means empty, the size is a power of 2.
+    std::vector<uint32_t> slots;
+};
+
 class RedisServer : public BasicServer<RedisRequest, RedisResponse> {
 public:
     RedisServer(const RedisServerParams &params, ProcessorType co_proc)
@@ -47,6 +100,40 @@ public:
         : BasicServer<RedisRequest, RedisResponse>(RedisServerParams(),
                                                    std::move(co_proc))
     { }
+
+    /**
+     * @brief Create a RedisServer that dispatches the requests to the
+     *        handlers added by `add_command`.
+    */
+    explicit RedisServer(const RedisServerParams &params)
+        : BasicServer<RedisRequest, RedisResponse>(params,
+            [this](RedisServerContext ctx) { return dispatch(std::move(ctx)); })
+    { }
+
+    RedisServer() : RedisServer(RedisServerParams()) { }
+
+    /**
+     * @brief Add the handler of command `name`, only used when the server is
+     *        created without a processor. Call it before the server starts.
+    */
+    void add_command(std::string_view name, RedisCommandHandler handler) {
+        commands.add(name, std::move(handler));
+    }
+
+    /**
+     * @brief Set the handler of the commands that are not added, the default
+     *        one replies an "ERR unknown command" error.
+    */
+    void set_unknown_command(RedisCommandHandler handler) {
+        unknown_command = std::move(handler);
+    }
+
+protected:
+    Task<> dispatch(RedisServerContext ctx);
+
+protected:
+    RedisCommandTable commands;
+    RedisCommandHandler unknown_command;
 };
 
 } // namespace coke
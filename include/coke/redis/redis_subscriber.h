@@ -0,0 +1,145 @@
+/**
+ * Copyright 2024 Coke Project (https://github.com/kedixa/coke)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Authors: kedixa (https://github.com/kedixa)
+*/
+
+#ifndef COKE_REDIS_SUBSCRIBER_H
+#define COKE_REDIS_SUBSCRIBER_H
+
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "coke/redis/redis_client.h"
+#include "coke/queue.h"
+#include "coke/stop_token.h"
+
+#include "workflow/WFRedisSubscriber.h"
+
+namespace coke {
+
+struct RedisSubscriberParams {
+    int send_timeout        = -1;
+    int keep_alive_timeout  = 60 * 1000;
+
+    // Wait `reconnect_interval` milliseconds before reconnecting after the
+    // connection is closed.
+    int reconnect_interval  = 1000;
+
+    // Max number of messages that are received but not consumed, the new
+    // messages are dropped when the queue is full.
+    std::size_t queue_size  = 4096;
+};
+
+struct RedisPushMessage {
+    // "message", or "pmessage" if it matches a pattern
+    std::string type;
+    // The matched pattern, only for pmessage
+    std::string pattern;
+    std::string channel;
+    std::string payload;
+};
+
+/**
+ * @brief RedisSubscriber keeps a dedicated connection to receive the messages
+ *        of the subscribed channels and patterns, and delivers them to
+ *        `receive`. It reconnects and subscribes again when the connection is
+ *        closed, the messages published during reconnecting are lost.
+ *
+ *        Call `close` and wait for it before the subscriber is destroyed.
+*/
+class RedisSubscriber {
+public:
+    explicit RedisSubscriber(const RedisClientParams &client_params,
+                             const RedisSubscriberParams &params = {});
+    ~RedisSubscriber() = default;
+
+    RedisSubscriber(const RedisSubscriber &) = delete;
+    RedisSubscriber &operator= (const RedisSubscriber &) = delete;
+
+    /**
+     * @brief Subscribe channels, the connection is started at the first call.
+     *
+     * @return 0 on success, or a negative errno.
+    */
+    int subscribe(const std::vector<std::string> &channels);
+    int psubscribe(const std::vector<std::string> &patterns);
+
+    int unsubscribe(const std::vector<std::string> &channels);
+    int punsubscribe(const std::vector<std::string> &patterns);
+
+    /**
+     * @brief Receive the next message.
+     *
+     * @return coke::TOP_SUCCESS, or coke::TOP_CLOSED if the subscriber is
+     *         closed and all the messages are received.
+    */
+    Task<int> receive(RedisPushMessage &msg) { return que.pop(msg); }
+
+    bool try_receive(RedisPushMessage &msg) { return que.try_pop(msg); }
+
+    /**
+     * @brief Close the connection and stop reconnecting, the messages that
+     *        are already received can still be consumed.
+    */
+    Task<> close();
+
+    /**
+     * @brief Number of messages dropped because the queue is full.
+    */
+    std::size_t get_dropped() const noexcept {
+        return dropped.load(std::memory_order_relaxed);
+    }
+
+private:
+    int prepare_locked(bool &start);
+    void start(bool start);
+
+    void on_connect(WFRedisSubscribeTask *task, bool send_all);
+    void on_message(WFRedisSubscribeTask *task);
+    void on_finish(WFRedisSubscribeTask *task);
+
+    Task<> run();
+
+private:
+    RedisSubscriberParams params;
+    WFRedisSubscriber subscriber;
+    int init_error{0};
+
+    std::mutex mtx;
+    bool started{false};
+    bool closing{false};
+    bool resubscribe{false};
+    WFRedisSubscribeTask *current{nullptr};
+    std::set<std::string> channels;
+    std::set<std::string> patterns;
+
+    // The channels and patterns unsubscribed while not connected, they are
+    // unsubscribed again once connected
+    std::set<std::string> removed_channels;
+    std::set<std::string> removed_patterns;
+
+    Queue<RedisPushMessage> que;
+    std::atomic<std::size_t> dropped{0};
+    StopToken token;
+};
+
+} // namespace coke
+
+#endif // COKE_REDIS_SUBSCRIBER_H
@@ -19,7 +19,11 @@
 #ifndef COKE_REDIS_UTILS_H
 #define COKE_REDIS_UTILS_H
 
+#include <cstddef>
+#include <cstdint>
 #include <string>
+#include <string_view>
+#include <vector>
 
 #include "workflow/RedisMessage.h"
 
@@ -34,6 +38,82 @@ using RedisValue = protocol::RedisValue;
 */
 std::string redis_value_to_string(const RedisValue &value);
 
+/**
+ * @brief RedisValueView is a read-only view of a reply in RESP format, the
+ *        strings are not copied, so the buffer must outlive the view.
+*/
+class RedisValueView {
+public:
+    RedisValueView() noexcept
+        : type(REDIS_REPLY_TYPE_NIL), ptr(nullptr), len(0), num(0)
+    { }
+
+    RedisValueView(const RedisValueView &) = default;
+    RedisValueView &operator= (const RedisValueView &) = default;
+
+    int get_type() const noexcept { return type; }
+
+    bool is_nil() const noexcept { return type == REDIS_REPLY_TYPE_NIL; }
+    bool is_int() const noexcept { return type == REDIS_REPLY_TYPE_INTEGER; }
+    bool is_array() const noexcept { return type == REDIS_REPLY_TYPE_ARRAY; }
+    bool is_string() const noexcept { return type == REDIS_REPLY_TYPE_STRING; }
+    bool is_status() const noexcept { return type == REDIS_REPLY_TYPE_STATUS; }
+    bool is_error() const noexcept { return type == REDIS_REPLY_TYPE_ERROR; }
+
+    bool is_ok() const noexcept {
+        return is_status() && as_string_view() == "OK";
+    }
+
+    /**
+     * @brief The content of string, status or error, empty for other types.
+    */
+    std::string_view as_string_view() const noexcept {
+        return std::string_view(ptr, len);
+    }
+
+    std::string as_string() const { return std::string(ptr, len); }
+
+    int64_t int_value() const noexcept { return is_int() ? num : 0; }
+
+    std::size_t arr_size() const noexcept {
+        return is_array() ? static_cast<std::size_t>(num) : 0;
+    }
+
+    /**
+     * @brief Get the element at `pos` of an array, it skips the elements
+     *        before `pos`, use `arr_values` to visit all of them.
+    */
+    RedisValueView arr_at(std::size_t pos) const;
+
+    std::vector<RedisValueView> arr_values() const;
+
+    /**
+     * @brief Copy the view into an owning RedisValue.
+    */
+    RedisValue to_value() const;
+
+    /**
+     * @brief Parse one reply at the front of `buf`.
+     *
+     * @return 1 if a complete reply is parsed and `*used` is set to its size,
+     *         0 if more data is needed, or -1 if it is not in RESP format.
+    */
+    static int parse(const char *buf, std::size_t size,
+                     RedisValueView &view, std::size_t *used) noexcept;
+
+private:
+    int type;
+
+    // String content, or the encoded elements of an array
+    const char *ptr;
+    std::size_t len;
+
+    // The integer, or the number of elements of an array
+    int64_t num;
+
+    friend struct RedisViewParser;
+};
+
 } // namespace coke
 
 #endif // COKE_REDIS_UTILS_H
@@ -0,0 +1,377 @@
+/**
+ * Copyright 2024 Coke Project (https://github.com/kedixa/coke)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Authors: kedixa (https://github.com/kedixa)
+*/
+
+#ifndef COKE_RING_BUFFER_H
+#define COKE_RING_BUFFER_H
+
+#include <cstddef>
+#include <memory>
+#include <type_traits>
+#include <utility>
+
+namespace coke {
+
+/**
+ * @brief RingBuffer is a contiguous growable circular buffer that can be used
+ *        as the `Container` of coke::Queue and coke::Deque instead of
+ *        std::deque, or directly as a double-ended sequence.
+ *
+ * It allocates a power-of-2 sized array and only reallocates when it is full,
+ * so the steady state of a queue allocates nothing, while std::deque
+ * allocates and frees a chunk every time the elements cross a chunk boundary.
+ *
+ * @tparam T Type of the element.
+ * @tparam Alloc Allocator of T.
+ * @tparam AutoShrink Whether to halve the capacity when no more than a quarter
+ *         is used, so that a burst does not keep the memory forever. Without
+ *         it, the memory is only released by shrink_to_fit or destruction.
+*/
+template<typename T, typename Alloc = std::allocator<T>,
+         bool AutoShrink = false>
+class RingBuffer {
+    using AllocTraits = std::allocator_traits<Alloc>;
+    using Pointer = typename AllocTraits::pointer;
+
+    static constexpr std::size_t MIN_CAPACITY = 8;
+
+public:
+    using value_type = T;
+    using allocator_type = Alloc;
+    using size_type = std::size_t;
+    using difference_type = std::ptrdiff_t;
+    using reference = T &;
+    using const_reference = const T &;
+
+    static_assert(std::is_same_v<T, typename AllocTraits::value_type>);
+
+    RingBuffer() noexcept(noexcept(Alloc())) : RingBuffer(Alloc()) { }
+
+    explicit RingBuffer(const Alloc &alloc) noexcept
+        : alloc(alloc), buf(nullptr), cap(0), head(0), cnt(0)
+    { }
+
+    RingBuffer(const RingBuffer &that)
+        : RingBuffer(AllocTraits::select_on_container_copy_construction(
+                        that.alloc))
+    {
+        copy_from(that);
+    }
+
+    RingBuffer(RingBuffer &&that) noexcept
+        : alloc(std::move(that.alloc)), buf(that.buf), cap(that.cap),
+          head(that.head), cnt(that.cnt)
+    {
+        that.reset();
+    }
+
+    RingBuffer &operator= (const RingBuffer &that) {
+        if (this != &that) {
+            clear();
+
+            if constexpr (AllocTraits::propagate_on_container_copy_assignment
+                          ::value) {
+                if (alloc != that.alloc)
+                    release();
+                alloc = that.alloc;
+            }
+
+            copy_from(that);
+        }
+
+        return *this;
+    }
+
+    RingBuffer &operator= (RingBuffer &&that)
+        noexcept(AllocTraits::is_always_equal::value ||
+                 AllocTraits::propagate_on_container_move_assignment::value)
+    {
+        if (this == &that)
+            return *this;
+
+        clear();
+
+        constexpr bool propagate =
+            AllocTraits::propagate_on_container_move_assignment::value;
+
+        if (propagate || alloc == that.alloc) {
+            release();
+
+            if constexpr (propagate)
+                alloc = std::move(that.alloc);
+
+            buf = that.buf;
+            cap = that.cap;
+            head = that.head;
+            cnt = that.cnt;
+            that.reset();
+        }
+        else {
+            // Different allocators, the elements are moved one by one
+            reserve(that.cnt);
+            for (size_type i = 0; i < that.cnt; i++)
+                emplace_back(std::move(that[i]));
+            that.clear();
+        }
+
+        return *this;
+    }
+
+    ~RingBuffer() {
+        clear();
+        release();
+    }
+
+    allocator_type get_allocator() const noexcept { return alloc; }
+
+    bool empty() const noexcept { return cnt == 0; }
+    size_type size() const noexcept { return cnt; }
+    size_type capacity() const noexcept { return cap; }
+
+    reference operator[](size_type i) noexcept { return buf[slot(i)]; }
+    const_reference operator[](size_type i) const noexcept {
+        return buf[slot(i)];
+    }
+
+    reference front() noexcept { return buf[head]; }
+    const_reference front() const noexcept { return buf[head]; }
+
+    reference back() noexcept { return buf[slot(cnt - 1)]; }
+    const_reference back() const noexcept { return buf[slot(cnt - 1)]; }
+
+    template<typename... Args>
+    reference emplace_back(Args&&... args) {
+        if (cnt == cap)
+            grow(false, std::forward<Args>(args)...);
+        else
+            construct(slot(cnt), std::forward<Args>(args)...);
+
+        ++cnt;
+        return back();
+    }
+
+    template<typename... Args>
+    reference emplace_front(Args&&... args) {
+        if (cnt == cap)
+            grow(true, std::forward<Args>(args)...);
+        else {
+            size_type pos = (head + cap - 1) & (cap - 1);
+            construct(pos, std::forward<Args>(args)...);
+            head = pos;
+        }
+
+        ++cnt;
+        return front();
+    }
+
+    void push_back(const T &x) { emplace_back(x); }
+    void push_back(T &&x) { emplace_back(std::move(x)); }
+
+    void push_front(const T &x) { emplace_front(x); }
+    void push_front(T &&x) { emplace_front(std::move(x)); }
+
+    void pop_front() {
+        destroy(head);
+        head = (head + 1) & (cap - 1);
+        --cnt;
+        maybe_shrink();
+    }
+
+    void pop_back() {
+        destroy(slot(cnt - 1));
+        --cnt;
+        maybe_shrink();
+    }
+
+    void clear() noexcept {
+        clear_keep_count();
+
+        head = 0;
+        cnt = 0;
+    }
+
+    /**
+     * @brief Make the capacity at least `n`, rounded up to a power of 2.
+    */
+    void reserve(size_type n) {
+        if (n > cap)
+            reallocate(round_up(n));
+    }
+
+    /**
+     * @brief Reduce the capacity to the smallest power of 2 that holds all
+     *        the elements, release the memory if empty.
+    */
+    void shrink_to_fit() {
+        if (cnt == 0)
+            release();
+        else if (round_up(cnt) < cap)
+            reallocate(round_up(cnt));
+    }
+
+    void swap(RingBuffer &that) noexcept {
+        using std::swap;
+
+        if constexpr (AllocTraits::propagate_on_container_swap::value)
+            swap(alloc, that.alloc);
+
+        swap(buf, that.buf);
+        swap(cap, that.cap);
+        swap(head, that.head);
+        swap(cnt, that.cnt);
+    }
+
+    friend void swap(RingBuffer &a, RingBuffer &b) noexcept { a.swap(b); }
+
+private:
+    static size_type round_up(size_type n) noexcept {
+        size_type c = MIN_CAPACITY;
+        while (c < n)
+            c <<= 1;
+        return c;
+    }
+
+    size_type slot(size_type i) const noexcept {
+        return (head + i) & (cap - 1);
+    }
+
+    template<typename... Args>
+    void construct(size_type pos, Args&&... args) {
+        AllocTraits::construct(alloc, std::to_address(buf + pos),
+                               std::forward<Args>(args)...);
+    }
+
+    void destroy(size_type pos) noexcept {
+        AllocTraits::destroy(alloc, std::to_address(buf + pos));
+    }
+
+    void reset() noexcept {
+        buf = nullptr;
+        cap = head = cnt = 0;
+    }
+
+    void release() noexcept {
+        if (buf)
+            AllocTraits::deallocate(alloc, buf, cap);
+
+        reset();
+    }
+
+    void maybe_shrink() {
+        if constexpr (AutoShrink) {
+            if (cap > MIN_CAPACITY && cnt <= cap / 4)
+                reallocate(cap / 2);
+        }
+    }
+
+    /**
+     * @brief Move the elements into [dst + off, dst + off + cnt) of a new
+     *        array, destroy what is moved if an exception is thrown.
+    */
+    void relocate(Pointer dst, size_type off) {
+        size_type i = 0;
+
+        try {
+            for (; i < cnt; i++) {
+                AllocTraits::construct(alloc, std::to_address(dst + off + i),
+                                       std::move_if_noexcept(buf[slot(i)]));
+            }
+        }
+        catch (...) {
+            while (i > 0)
+                AllocTraits::destroy(alloc, std::to_address(dst + off + --i));
+            throw;
+        }
+    }
+
+    void replace(Pointer new_buf, size_type new_cap, size_type new_head) {
+        clear_keep_count();
+        if (buf)
+            AllocTraits::deallocate(alloc, buf, cap);
+
+        buf = new_buf;
+        cap = new_cap;
+        head = new_head;
+    }
+
+    void clear_keep_count() noexcept {
+        for (size_type i = 0; i < cnt; i++)
+            destroy(slot(i));
+    }
+
+    void reallocate(size_type new_cap) {
+        Pointer new_buf = AllocTraits::allocate(alloc, new_cap);
+
+        try {
+            relocate(new_buf, 0);
+        }
+        catch (...) {
+            AllocTraits::deallocate(alloc, new_buf, new_cap);
+            throw;
+        }
+
+        replace(new_buf, new_cap, 0);
+    }
+
+    /**
+     * @brief Double the capacity and construct the new element, which is
+     *        constructed first because `args` may refer to an old element.
+    */
+    template<typename... Args>
+    void grow(bool at_front, Args&&... args) {
+        size_type new_cap = cap ? cap * 2 : MIN_CAPACITY;
+        size_type pos = at_front ? new_cap - 1 : cnt;
+        Pointer new_buf = AllocTraits::allocate(alloc, new_cap);
+
+        try {
+            AllocTraits::construct(alloc, std::to_address(new_buf + pos),
+                                   std::forward<Args>(args)...);
+        }
+        catch (...) {
+            AllocTraits::deallocate(alloc, new_buf, new_cap);
+            throw;
+        }
+
+        try {
+            relocate(new_buf, 0);
+        }
+        catch (...) {
+            AllocTraits::destroy(alloc, std::to_address(new_buf + pos));
+            AllocTraits::deallocate(alloc, new_buf, new_cap);
+            throw;
+        }
+
+        replace(new_buf, new_cap, at_front ? pos : 0);
+    }
+
+    void copy_from(const RingBuffer &that) {
+        reserve(that.cnt);
+        for (size_type i = 0; i < that.cnt; i++)
+            emplace_back(that[i]);
+    }
+
+private:
+    [[no_unique_address]] Alloc alloc;
+    Pointer buf;
+    size_type cap;
+    size_type head;
+    size_type cnt;
+};
+
+} // namespace coke
+
+#endif // COKE_RING_BUFFER_H
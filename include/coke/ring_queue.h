@@ -0,0 +1,528 @@
+/**
+ * Copyright 2024 Coke Project (https://github.com/kedixa/coke)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Authors: kedixa (https://github.com/kedixa)
+*/
+
+#ifndef COKE_RING_QUEUE_H
+#define COKE_RING_QUEUE_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include "coke/detail/basic_concept.h"
+#include "coke/detail/constant.h"
+#include "coke/condition.h"
+
+namespace coke {
+
+/**
+ * @class coke::RingQueue
+ * @brief coke::RingQueue is a bounded FIFO queue on a preallocated ring of
+ *        slots, it has the same interface as coke::Queue.
+ *
+ * Each slot has a sequence number that tells whether it is ready to be pushed
+ * or popped for the current round, so that try_push and try_pop only claim a
+ * position by one CAS, and never lock or allocate. The coroutines that wait
+ * for a full or empty queue are parked by Condition, and the pushers and
+ * poppers only lock to wake them up when someone is waiting.
+ *
+ * The max size is rounded up to a power of 2.
+ *
+ * @tparam T Type of the elements.
+*/
+template<Queueable T>
+class RingQueue final {
+    static constexpr auto relaxed = std::memory_order_relaxed;
+    static constexpr auto acquire = std::memory_order_acquire;
+    static constexpr auto release = std::memory_order_release;
+    static constexpr auto acq_rel = std::memory_order_acq_rel;
+    static constexpr auto seq_cst = std::memory_order_seq_cst;
+
+public:
+    using SizeType = std::size_t;
+    using ValueType = T;
+
+private:
+    using UniqueLock = std::unique_lock<std::mutex>;
+    using DiffType = std::make_signed_t<SizeType>;
+
+    struct Slot {
+        T *get() noexcept { return std::launder(reinterpret_cast<T *>(buf)); }
+
+        std::atomic<SizeType> seq;
+
+        // False if the construction of the element failed, the poppers skip
+        // it and release the slot.
+        bool valid;
+        alignas(T) unsigned char buf[sizeof(T)];
+    };
+
+    struct CountGuard {
+        CountGuard(std::atomic<SizeType> &m) : n(m) { n.fetch_add(1, seq_cst); }
+        ~CountGuard() { n.fetch_sub(1, relaxed); }
+
+        std::atomic<SizeType> &n;
+    };
+
+    static SizeType round_up(SizeType n) {
+        SizeType x = 1;
+        while (x < n)
+            x <<= 1;
+        return x;
+    }
+
+public:
+    /**
+     * @brief Create coke::RingQueue with max_size.
+     *
+     * @param max_size Max elements in the container, rounded up to a power
+     *        of 2. Zero is treated as one.
+    */
+    explicit RingQueue(SizeType max_size)
+        : mask(round_up(max_size) - 1),
+          slots(new Slot[mask + 1]),
+          que_closed(false),
+          push_wait_cnt(0), pop_wait_cnt(0),
+          tail(0), head(0)
+    {
+        for (SizeType i = 0; i <= mask; i++)
+            slots[i].seq.store(i, relaxed);
+    }
+
+    /**
+     * @brief RingQueue is neither copyable nor moveable.
+    */
+    RingQueue(const RingQueue &) = delete;
+    RingQueue &operator=(const RingQueue &) = delete;
+
+    /**
+     * @pre No coroutine is waiting on the container.
+    */
+    ~RingQueue() {
+        SizeType last = tail.load(relaxed);
+
+        for (SizeType pos = head.load(relaxed); pos != last; ++pos) {
+            Slot &s = slots[pos & mask];
+            if (s.valid)
+                s.get()->~T();
+        }
+    }
+
+    /**
+     * @brief Check whether the container is empty.
+     * @note In a concurrent environment, this value may no longer be accurate
+     *       after returned.
+    */
+    bool empty() const noexcept { return size() == 0; }
+
+    /**
+     * @brief Check whether the container is full.
+     * @note In a concurrent environment, this value may no longer be accurate
+     *       after returned.
+    */
+    bool full() const noexcept { return size() >= max_size(); }
+
+    /**
+     * @brief Check whether the container is closed.
+     * @see close().
+    */
+    bool closed() const noexcept { return que_closed.load(acquire); }
+
+    /**
+     * @brief Get the element count of the container, including the positions
+     *        that are being pushed or popped.
+     * @note In a concurrent environment, this value may no longer be accurate
+     *       after returned.
+    */
+    SizeType size() const noexcept {
+        SizeType h = head.load(acquire);
+        SizeType t = tail.load(acquire);
+        DiffType d = (DiffType)(t - h);
+
+        if (d <= 0)
+            return 0;
+        return ((SizeType)d > max_size()) ? max_size() : (SizeType)d;
+    }
+
+    /**
+     * @brief Get the max size of the container, which is the `max_size` param
+     *        used to create this container rounded up to a power of 2.
+    */
+    SizeType max_size() const noexcept { return mask + 1; }
+
+    /**
+     * @brief Close the container, see coke::Queue::close.
+     * @pre The container is not closed().
+    */
+    void close() {
+        UniqueLock lk(mtx);
+
+        if (!que_closed.exchange(true, acq_rel)) {
+            push_cv.notify_all();
+            pop_cv.notify_all();
+        }
+    }
+
+    /**
+     * @brief Reopen a closed container.
+     * @pre The container is closed().
+    */
+    void reopen() noexcept { que_closed.store(false, release); }
+
+    /**
+     * @brief Try to emplace new element into container without locking.
+     *
+     * @returns Whether new element is pushed, false if full or closed, and
+     *          the args... will not be moved or copied.
+    */
+    template<typename... Args>
+        requires std::constructible_from<T, Args&&...>
+    bool try_emplace(Args&&... args) {
+        if (closed() || !do_emplace(std::forward<Args>(args)...))
+            return false;
+
+        after_push();
+        return true;
+    }
+
+    /**
+     * @brief Emplace new element into container, wait if full.
+     * @retval See try_emplace_for.
+    */
+    template<typename... Args>
+        requires std::constructible_from<T, Args&&...>
+    Task<int> emplace(Args&&... args) {
+        return emplace_impl(detail::TimedWaitHelper{},
+                            std::forward<Args>(args)...);
+    }
+
+    /**
+     * @brief Emplace new element into container before nsec timeout.
+     *
+     * @retval coke::TOP_SUCCESS If emplace successful.
+     * @retval coke::TOP_TIMEOUT If timeout before container is able to push.
+     * @retval coke::TOP_ABORTED If process exit.
+     * @retval coke::TOP_CLOSED If container is closed.
+     * @retval Negative integer to indicate system error, almost never happens.
+    */
+    template<typename... Args>
+        requires std::constructible_from<T, Args&&...>
+    Task<int> try_emplace_for(NanoSec nsec, Args&&... args) {
+        return emplace_impl(detail::TimedWaitHelper{nsec},
+                            std::forward<Args>(args)...);
+    }
+
+    /**
+     * @brief Same as try_emplace_for, but wait until `deadline`.
+    */
+    template<typename... Args>
+        requires std::constructible_from<T, Args&&...>
+    Task<int> try_emplace_until(SteadyTimePoint deadline, Args&&... args) {
+        return emplace_impl(detail::TimedWaitHelper{deadline},
+                            std::forward<Args>(args)...);
+    }
+
+    /**
+     * @brief Try to push new element into container without locking.
+     *
+     * @returns Whether new element is pushed, false if full or closed, and
+     *          the u will not be moved or copied.
+    */
+    template<typename U>
+        requires std::constructible_from<T, U&&>
+    bool try_push(U &&u) {
+        return try_emplace(std::forward<U>(u));
+    }
+
+    /**
+     * @brief Push new element into container, wait if full.
+     * @retval See try_emplace_for.
+    */
+    template<typename U>
+        requires std::constructible_from<T, U&&>
+    Task<int> push(U &&u) {
+        return emplace_impl(detail::TimedWaitHelper{}, std::forward<U>(u));
+    }
+
+    /**
+     * @brief Push new element into container before nsec timeout.
+     * @retval See try_emplace_for.
+    */
+    template<typename U>
+        requires std::constructible_from<T, U&&>
+    Task<int> try_push_for(NanoSec nsec, U &&u) {
+        return emplace_impl(detail::TimedWaitHelper{nsec}, std::forward<U>(u));
+    }
+
+    /**
+     * @brief Same as try_push_for, but wait until `deadline`.
+    */
+    template<typename U>
+        requires std::constructible_from<T, U&&>
+    Task<int> try_push_until(SteadyTimePoint deadline, U &&u) {
+        return emplace_impl(detail::TimedWaitHelper{deadline},
+                            std::forward<U>(u));
+    }
+
+    /**
+     * @brief Try to pop element from container without locking.
+     *
+     * @returns Whether element is popped, false if empty, and u is keep
+     *          unchanged.
+    */
+    template<typename U>
+        requires std::assignable_from<U&, T&&>
+    bool try_pop(U &u) {
+        if (!do_pop(u))
+            return false;
+
+        after_pop();
+        return true;
+    }
+
+    /**
+     * @brief Pop element from container, wait if empty.
+     * @retval See try_pop_for.
+    */
+    template<typename U>
+        requires std::assignable_from<U&, T&&>
+    Task<int> pop(U &u) {
+        return pop_impl(detail::TimedWaitHelper{}, u);
+    }
+
+    /**
+     * @brief Pop element from container before nsec timeout.
+     *
+     * @retval coke::TOP_SUCCESS If pop successful.
+     * @retval coke::TOP_TIMEOUT If timeout before container is able to pop.
+     * @retval coke::TOP_ABORTED If process exit.
+     * @retval coke::TOP_CLOSED If container is empty and closed.
+     * @retval Negative integer to indicate system error, almost never happens.
+    */
+    template<typename U>
+        requires std::assignable_from<U&, T&&>
+    Task<int> try_pop_for(NanoSec nsec, U &u) {
+        return pop_impl(detail::TimedWaitHelper{nsec}, u);
+    }
+
+    /**
+     * @brief Same as try_pop_for, but wait until `deadline`.
+    */
+    template<typename U>
+        requires std::assignable_from<U&, T&&>
+    Task<int> try_pop_until(SteadyTimePoint deadline, U &u) {
+        return pop_impl(detail::TimedWaitHelper{deadline}, u);
+    }
+
+private:
+    template<typename... Args>
+    bool do_emplace(Args&&... args) {
+        SizeType pos = tail.load(relaxed);
+        Slot *s;
+
+        while (true) {
+            s = &slots[pos & mask];
+            SizeType seq = s->seq.load(acquire);
+            DiffType diff = (DiffType)(seq - pos);
+
+            if (diff == 0) {
+                if (tail.compare_exchange_weak(pos, pos + 1, relaxed))
+                    break;
+            }
+            else if (diff < 0)
+                return false;
+            else
+                pos = tail.load(relaxed);
+        }
+
+        // The position is claimed, it must be released even if the
+        // construction throws.
+        struct Publish {
+            ~Publish() { s->seq.store(pos + 1, release); }
+            Slot *s;
+            SizeType pos;
+        } publish{s, pos};
+
+        s->valid = false;
+        ::new ((void *)s->buf) T(std::forward<Args>(args)...);
+        s->valid = true;
+
+        return true;
+    }
+
+    template<typename U>
+    bool do_pop(U &u) {
+        while (true) {
+            SizeType pos = head.load(relaxed);
+            Slot *s;
+
+            while (true) {
+                s = &slots[pos & mask];
+                SizeType seq = s->seq.load(acquire);
+                DiffType diff = (DiffType)(seq - (pos + 1));
+
+                if (diff == 0) {
+                    if (head.compare_exchange_weak(pos, pos + 1, relaxed))
+                        break;
+                }
+                else if (diff < 0)
+                    return false;
+                else
+                    pos = head.load(relaxed);
+            }
+
+            struct Release {
+                ~Release() {
+                    if (s->valid)
+                        s->get()->~T();
+                    s->seq.store(pos + mask + 1, release);
+                }
+
+                Slot *s;
+                SizeType pos;
+                SizeType mask;
+            } rel{s, pos, mask};
+
+            if (s->valid) {
+                u = std::move(*s->get());
+                return true;
+            }
+        }
+    }
+
+    void after_push() {
+        // Pairs with the fence of the waiting poppers, either they see the
+        // new element, or we see them waiting.
+        std::atomic_thread_fence(seq_cst);
+
+        if (pop_wait_cnt.load(relaxed) != 0) {
+            UniqueLock lk(mtx);
+            lk.unlock();
+            pop_cv.notify_one();
+        }
+    }
+
+    void after_pop() {
+        std::atomic_thread_fence(seq_cst);
+
+        if (push_wait_cnt.load(relaxed) != 0) {
+            UniqueLock lk(mtx);
+            lk.unlock();
+            push_cv.notify_one();
+        }
+    }
+
+    template<typename... Args>
+    Task<int> emplace_impl(detail::TimedWaitHelper helper, Args&&... args) {
+        if (coke::prevent_recursive_stack())
+            co_await coke::yield();
+
+        if (closed())
+            co_return TOP_CLOSED;
+
+        if (do_emplace(std::forward<Args>(args)...)) {
+            after_push();
+            co_return TOP_SUCCESS;
+        }
+
+        int ret = TOP_SUCCESS;
+        bool pushed = false;
+        auto pred = [&]() {
+            std::atomic_thread_fence(seq_cst);
+            if (closed())
+                return true;
+
+            pushed = do_emplace(std::forward<Args>(args)...);
+            return pushed;
+        };
+
+        UniqueLock lk(mtx);
+        CountGuard cg(push_wait_cnt);
+
+        if (helper.infinite())
+            ret = co_await push_cv.wait(lk, pred);
+        else
+            ret = co_await push_cv.wait_until(lk, helper.deadline(), pred);
+
+        lk.unlock();
+
+        if (pushed) {
+            after_push();
+            co_return TOP_SUCCESS;
+        }
+
+        co_return (ret == TOP_SUCCESS) ? TOP_CLOSED : ret;
+    }
+
+    template<typename U>
+    Task<int> pop_impl(detail::TimedWaitHelper helper, U &u) {
+        if (coke::prevent_recursive_stack())
+            co_await coke::yield();
+
+        if (do_pop(u)) {
+            after_pop();
+            co_return TOP_SUCCESS;
+        }
+
+        int ret = TOP_SUCCESS;
+        bool popped = false;
+        auto pred = [&]() {
+            std::atomic_thread_fence(seq_cst);
+            popped = do_pop(u);
+            return popped || closed();
+        };
+
+        UniqueLock lk(mtx);
+        CountGuard cg(pop_wait_cnt);
+
+        if (helper.infinite())
+            ret = co_await pop_cv.wait(lk, pred);
+        else
+            ret = co_await pop_cv.wait_until(lk, helper.deadline(), pred);
+
+        lk.unlock();
+
+        if (popped) {
+            after_pop();
+            co_return TOP_SUCCESS;
+        }
+
+        co_return (ret == TOP_SUCCESS) ? TOP_CLOSED : ret;
+    }
+
+private:
+    const SizeType mask;
+    std::unique_ptr<Slot[]> slots;
+    std::atomic<bool> que_closed;
+
+    std::mutex mtx;
+    Condition push_cv;
+    Condition pop_cv;
+    std::atomic<SizeType> push_wait_cnt;
+    std::atomic<SizeType> pop_wait_cnt;
+
+    alignas(detail::DESTRUCTIVE_ALIGN) std::atomic<SizeType> tail;
+    alignas(detail::DESTRUCTIVE_ALIGN) std::atomic<SizeType> head;
+};
+
+} // namespace coke
+
+#endif // COKE_RING_QUEUE_H
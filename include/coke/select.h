@@ -0,0 +1,316 @@
+/**
+ * Copyright 2024 Coke Project (https://github.com/kedixa/coke)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Authors: kedixa (https://github.com/kedixa)
+*/
+
+#ifndef COKE_SELECT_H
+#define COKE_SELECT_H
+
+#include <concepts>
+#include <cstddef>
+#include <optional>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include "coke/detail/select_base.h"
+#include "coke/sleep.h"
+#include "coke/stop_token.h"
+#include "coke/task.h"
+
+namespace coke {
+
+/**
+ * @brief SelectResult::index when no case is chosen.
+*/
+constexpr std::size_t SELECT_NPOS = std::size_t(-1);
+
+struct SelectResult {
+    /**
+     * coke::TOP_SUCCESS if an element is popped by case `index`,
+     * coke::TOP_CLOSED if the queue of case `index` is closed and empty,
+     * coke::TOP_TIMEOUT, coke::TOP_STOPPED, coke::TOP_ABORTED if no case is
+     * chosen, or negative integer to indicate system error.
+    */
+    int state;
+
+    // The index of the chosen case, or SELECT_NPOS.
+    std::size_t index;
+};
+
+/**
+ * @brief A case of coke::select, it tries to pop an element from `que` by
+ *        `func(que)`. Use coke::pop_case etc. to create it.
+*/
+template<typename Q, typename F>
+class SelectCase {
+public:
+    SelectCase(Q &que, F func) : que(&que), func(std::move(func)) { }
+
+    Q &queue() const noexcept { return *que; }
+
+    /**
+     * @brief Check whether this case can be chosen now.
+     *
+     * @param state Receive coke::TOP_SUCCESS if popped, or coke::TOP_CLOSED if
+     *        the queue is closed and empty, no new element can be pushed.
+    */
+    bool poll(int &state) {
+        if (func(*que))
+            state = TOP_SUCCESS;
+        else if (que->closed() && que->empty())
+            state = TOP_CLOSED;
+        else
+            return false;
+
+        return true;
+    }
+
+private:
+    Q *que;
+    F func;
+};
+
+namespace detail {
+
+template<typename T>
+struct IsSelectCase : std::false_type { };
+
+template<typename Q, typename F>
+struct IsSelectCase<SelectCase<Q, F>> : std::true_type { };
+
+template<typename Q>
+concept SelectableQueue = requires(Q &q, detail::SelectNode *node) {
+    q.add_select_node(node);
+    q.remove_select_node(node);
+    { q.closed() } -> std::same_as<bool>;
+    { q.empty() } -> std::same_as<bool>;
+};
+
+} // namespace detail
+
+template<typename T>
+concept SelectCaseType = detail::IsSelectCase<std::remove_cvref_t<T>>::value;
+
+/**
+ * @brief Create a case that pops from coke::Queue, coke::PriorityQueue or
+ *        coke::Stack into `u`, `u` must outlive the select.
+*/
+template<detail::SelectableQueue Q, typename U>
+    requires requires(Q &q, U &u) { { q.try_pop(u) } -> std::same_as<bool>; }
+auto pop_case(Q &que, U &u) {
+    auto func = [&u](Q &q) { return q.try_pop(u); };
+    return SelectCase<Q, decltype(func)>(que, std::move(func));
+}
+
+/**
+ * @brief Create a case that pops from the front of coke::Deque into `u`.
+*/
+template<detail::SelectableQueue Q, typename U>
+    requires requires(Q &q, U &u) {
+        { q.try_pop_front(u) } -> std::same_as<bool>;
+    }
+auto pop_front_case(Q &que, U &u) {
+    auto func = [&u](Q &q) { return q.try_pop_front(u); };
+    return SelectCase<Q, decltype(func)>(que, std::move(func));
+}
+
+/**
+ * @brief Create a case that pops from the back of coke::Deque into `u`.
+*/
+template<detail::SelectableQueue Q, typename U>
+    requires requires(Q &q, U &u) {
+        { q.try_pop_back(u) } -> std::same_as<bool>;
+    }
+auto pop_back_case(Q &que, U &u) {
+    auto func = [&u](Q &q) { return q.try_pop_back(u); };
+    return SelectCase<Q, decltype(func)>(que, std::move(func));
+}
+
+namespace detail {
+
+template<typename... Cases>
+class SelectState {
+    static constexpr std::size_t N = sizeof...(Cases);
+    using IndexSeq = std::index_sequence_for<Cases...>;
+
+public:
+    SelectState(Cases &...cases) : cases(cases...), registered(false) { }
+
+    SelectState(const SelectState &) = delete;
+    SelectState &operator= (const SelectState &) = delete;
+
+    ~SelectState() {
+        if (registered)
+            remove_nodes(IndexSeq{});
+    }
+
+    const void *addr() const noexcept { return nodes; }
+
+    /**
+     * @brief Poll the cases in order, the first ready one is chosen.
+    */
+    bool poll(SelectResult &res) { return poll(res, IndexSeq{}); }
+
+    void add_nodes() {
+        add_nodes(IndexSeq{});
+        registered = true;
+    }
+
+private:
+    template<std::size_t... I>
+    bool poll(SelectResult &res, std::index_sequence<I...>) {
+        return (poll_one<I>(res) || ...);
+    }
+
+    template<std::size_t I>
+    bool poll_one(SelectResult &res) {
+        if (!std::get<I>(cases).poll(res.state))
+            return false;
+
+        res.index = I;
+        return true;
+    }
+
+    template<std::size_t... I>
+    void add_nodes(std::index_sequence<I...>) {
+        ((nodes[I].waiter = addr(),
+          std::get<I>(cases).queue().add_select_node(&nodes[I])), ...);
+    }
+
+    template<std::size_t... I>
+    void remove_nodes(std::index_sequence<I...>) {
+        (std::get<I>(cases).queue().remove_select_node(&nodes[I]), ...);
+    }
+
+private:
+    std::tuple<Cases &...> cases;
+    SelectNode nodes[N];
+    bool registered;
+};
+
+struct SelectStopWaker {
+    void operator()() const { cancel_sleep_by_addr(addr); }
+
+    const void *addr;
+};
+
+template<typename... Cases>
+Task<SelectResult> select_impl(TimedWaitHelper helper, StopToken *token,
+                               Cases... cases) {
+    if (coke::prevent_recursive_stack())
+        co_await coke::yield();
+
+    SelectResult res{TOP_SUCCESS, SELECT_NPOS};
+    SelectState<Cases...> state(cases...);
+
+    if (state.poll(res))
+        co_return res;
+
+    // Register before the StopCallback, which may be invoked at once.
+    state.add_nodes();
+
+    std::optional<StopCallback<SelectStopWaker>> cb;
+    if (token)
+        cb.emplace(*token, SelectStopWaker{state.addr()});
+
+    while (true) {
+        // Either the pushers see the sleep, or it's seen ready here.
+        SleepAwaiter s = sleep(state.addr(), helper);
+        bool done = state.poll(res);
+
+        if (!done && token && token->stop_requested()) {
+            res.state = TOP_STOPPED;
+            done = true;
+        }
+
+        if (done)
+            cancel_sleep_by_addr(state.addr());
+
+        int ret = co_await std::move(s);
+
+        if (done)
+            break;
+
+        if (ret < 0 || ret == SLEEP_ABORTED) {
+            res.state = ret;
+            break;
+        }
+
+        if (ret == SLEEP_SUCCESS) {
+            if (!state.poll(res))
+                res.state = TOP_TIMEOUT;
+            break;
+        }
+    }
+
+    co_return res;
+}
+
+} // namespace detail
+
+/**
+ * @brief Wait until one of the cases is ready, and pop an element by it.
+ *        Only one coroutine is suspended no matter how many queues are
+ *        selected, it is woken up when any of them is pushed or closed.
+ *
+ * @param cases... Cases created by coke::pop_case etc. When many of them are
+ *        ready, the first one is chosen. The queues must outlive the select.
+ *
+ * @returns Coroutine that should co_await immediately.
+ * @retval See coke::SelectResult.
+*/
+template<SelectCaseType... Cases>
+    requires (sizeof...(Cases) > 0)
+Task<SelectResult> select(Cases... cases) {
+    return detail::select_impl(detail::TimedWaitHelper{}, nullptr,
+                               std::move(cases)...);
+}
+
+/**
+ * @brief Same as select, but give up with coke::TOP_STOPPED when stop is
+ *        requested on `token`, which must outlive the returned coroutine.
+*/
+template<SelectCaseType... Cases>
+    requires (sizeof...(Cases) > 0)
+Task<SelectResult> select(StopToken &token, Cases... cases) {
+    return detail::select_impl(detail::TimedWaitHelper{}, &token,
+                               std::move(cases)...);
+}
+
+/**
+ * @brief Same as select, but give up with coke::TOP_TIMEOUT after `nsec`.
+*/
+template<SelectCaseType... Cases>
+    requires (sizeof...(Cases) > 0)
+Task<SelectResult> try_select_for(NanoSec nsec, Cases... cases) {
+    return detail::select_impl(detail::TimedWaitHelper{nsec}, nullptr,
+                               std::move(cases)...);
+}
+
+/**
+ * @brief Same as try_select_for, but wait until `deadline`.
+*/
+template<SelectCaseType... Cases>
+    requires (sizeof...(Cases) > 0)
+Task<SelectResult> try_select_until(SteadyTimePoint deadline, Cases... cases) {
+    return detail::select_impl(detail::TimedWaitHelper{deadline}, nullptr,
+                               std::move(cases)...);
+}
+
+} // namespace coke
+
+#endif // COKE_SELECT_H
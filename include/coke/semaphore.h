@@ -35,7 +35,7 @@ public:
      * @brief Create a Semaphore, with initial count `n`.
     */
     explicit Semaphore(CountType n) noexcept
-        : count(n), waiting(0)
+        : count(n), head(nullptr), tail(nullptr)
     { }
 
     /**
@@ -47,16 +47,18 @@ public:
     ~Semaphore() = default;
 
     /**
-     * @brief Try to acquire a count.
+     * @brief Try to acquire `n` counts at once.
      *
      * @pre Current coroutine doesn't owns all the counts.
-     * @return Return true if acquire success, else false.
+     * @return Return true if acquire success, else false. It fails if there
+     *         are others waiting, even if the counts are enough, so that the
+     *         waiters are not starved.
     */
-    bool try_acquire() {
+    bool try_acquire(CountType n = 1) {
         std::lock_guard<std::mutex> lg(mtx);
 
-        if (count > 0) {
-            --count;
+        if (head == nullptr && count >= n) {
+            count -= n;
             return true;
         }
 
@@ -64,31 +66,36 @@ public:
     }
 
     /**
-     * @brief Release `cnt` counts, and wake up those who are waiting.
+     * @brief Release `cnt` counts, and wake up those who are waiting in
+     *        order, as long as the counts are enough for the first one.
     */
     void release(CountType cnt = 1) {
         std::lock_guard<std::mutex> lg(mtx);
         count += cnt;
 
-        if (waiting > 0 && cnt > 0)
-            cancel_sleep_by_addr(get_addr(), waiting > cnt ? cnt : waiting);
+        if (head)
+            grant_waiters();
     }
 
     /**
-     * @brief Acquire a count, block until success.
+     * @brief Acquire `n` counts at once, block until success.
      *
-     * @pre Current coroutine doesn't owns all the count.
+     * @pre Current coroutine doesn't owns all the count, and `n` is not
+     *      greater than the total counts, or it never succeeds.
      * @return See try_acquire_for but ignore coke::TOP_TIMEOUT.
     */
-    Task<int> acquire() {
-        return acquire_impl(detail::TimedWaitHelper{});
+    Task<int> acquire(CountType n = 1) {
+        return acquire_impl(n, detail::TimedWaitHelper{});
     }
 
     /**
-     * @brief Acquire a count, block until success or `nsec` timeout.
+     * @brief Acquire `n` counts at once, block until success or `nsec`
+     *        timeout. The waiters are served in order, a waiter never gets
+     *        counts before those who are waiting in front of it.
      *
      * @pre Current coroutine doesn't owns all the count.
      * @param nsec Max time to block.
+     * @param n The number of counts to acquire.
      * @return Coroutine(coke::Task<int>) that needs to be awaited immediately.
      * @retval coke::TOP_SUCCESS If acquire success.
      * @retval coke::TOP_TIMEOUT If wait timeout.
@@ -96,25 +103,39 @@ public:
      * @retval Negative integer to indicate system error, almost never happens.
      * @see coke/global.h
     */
-    Task<int> try_acquire_for(NanoSec nsec) {
-        return acquire_impl(detail::TimedWaitHelper(nsec));
+    Task<int> try_acquire_for(NanoSec nsec, CountType n = 1) {
+        return acquire_impl(n, detail::TimedWaitHelper(nsec));
+    }
+
+    /**
+     * @brief Same as try_acquire_for, but block until `deadline`.
+    */
+    Task<int> try_acquire_until(SteadyTimePoint deadline, CountType n = 1) {
+        return acquire_impl(n, detail::TimedWaitHelper(deadline));
     }
 
 protected:
+    struct Waiter;
+
     /**
      * The `helper` variable must not be a reference to ensure that it exists
      * until the coroutine ends.
     */
-    Task<int> acquire_impl(detail::TimedWaitHelper helper);
+    Task<int> acquire_impl(CountType n, detail::TimedWaitHelper helper);
 
-    const void *get_addr() const noexcept {
-        return (const char *)this + 1;
-    }
+    /**
+     * @brief Hand the counts to the waiters from the front of the queue,
+     *        stop at the first one that cannot be satisfied.
+    */
+    void grant_waiters();
 
 private:
     std::mutex mtx;
     CountType count;
-    CountType waiting;
+
+    // The queue of waiters, which live in the frames of acquire_impl
+    Waiter *head;
+    Waiter *tail;
 };
 
 } // namespace coke
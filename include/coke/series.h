@@ -142,6 +142,32 @@ SeriesCreater set_series_creater(SeriesCreater creater) noexcept;
 */
 SeriesCreater get_series_creater() noexcept;
 
+/**
+ * @brief A series creater that recycles the memory of finished SeriesWork
+ *        objects through thread local free lists, it can be used by
+ *        `coke::set_series_creater(coke::pooled_series_creater)`.
+ *
+ * The created series is an instance of a SeriesWork's child class, do not
+ * use it if the series is expected to be exactly SeriesWork.
+*/
+SeriesWork *pooled_series_creater(SubTask *first);
+
+/**
+ * @brief Statistics of the pooled series creater of the calling thread.
+ *
+ * `hits` is the number of series created from cached memory, `misses` is the
+ * number of series created by global operator new.
+*/
+struct SeriesPoolStats {
+    std::size_t hits{0};
+    std::size_t misses{0};
+};
+
+/**
+ * @brief Get the pooled series creater statistics of the calling thread.
+*/
+SeriesPoolStats get_series_pool_stats() noexcept;
+
 /**
  * @brief Detach the coke::Task on the running series. Each valid coke::Task
  *        can be co awaited, detached, detached on series, detached on new
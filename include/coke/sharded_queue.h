@@ -0,0 +1,481 @@
+/**
+ * Copyright 2024 Coke Project (https://github.com/kedixa/coke)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Authors: kedixa (https://github.com/kedixa)
+*/
+
+#ifndef COKE_SHARDED_QUEUE_H
+#define COKE_SHARDED_QUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+#include "coke/detail/basic_concept.h"
+#include "coke/detail/constant.h"
+#include "coke/detail/shard_config.h"
+#include "coke/condition.h"
+#include "coke/ring_buffer.h"
+
+namespace coke {
+
+/**
+ * @brief ShardedQueue is a bounded queue split into many sub-queues (shards),
+ *        each with its own lock, so that many producers and consumers on
+ *        different threads rarely contend on the same lock.
+ *
+ * Each thread pushes to and pops from its local shard first, and turns to the
+ * other shards only when the local one is full or empty, so elements are not
+ * strictly FIFO across shards, but FIFO within one shard. The close/reopen
+ * and coke::TOP_CLOSED semantics are the same as coke::Queue.
+ *
+ * @tparam T Type of the element.
+*/
+template<Queueable T>
+class ShardedQueue {
+public:
+    using SizeType = std::size_t;
+    using ValueType = T;
+
+private:
+    using UniqueLock = std::unique_lock<std::mutex>;
+
+    static constexpr auto relaxed = std::memory_order_relaxed;
+    static constexpr auto acquire = std::memory_order_acquire;
+    static constexpr auto release = std::memory_order_release;
+    static constexpr auto acq_rel = std::memory_order_acq_rel;
+    static constexpr auto seq_cst = std::memory_order_seq_cst;
+
+    struct alignas(detail::DESTRUCTIVE_ALIGN) Shard {
+        std::mutex mtx;
+        RingBuffer<T> que;
+
+        // Same as que.size(), read without lock to skip full or empty shards
+        std::atomic<SizeType> cnt{0};
+    };
+
+    struct CountGuard {
+        CountGuard(std::atomic<SizeType> &m) : n(m) { n.fetch_add(1, seq_cst); }
+        ~CountGuard() { n.fetch_sub(1, relaxed); }
+
+        std::atomic<SizeType> &n;
+    };
+
+public:
+    /**
+     * @brief Create coke::ShardedQueue.
+     *
+     * @param max_size Max elements in the container, divided evenly into the
+     *        shards and rounded up.
+     * @param shards Number of the shards, zero means the hardware concurrency.
+    */
+    explicit ShardedQueue(SizeType max_size, SizeType shards = 0)
+        : que_closed(false), push_wait_cnt(0), pop_wait_cnt(0)
+    {
+        if (shards == 0)
+            shards = std::thread::hardware_concurrency();
+        if (shards == 0)
+            shards = 1;
+
+        n_shards = shards;
+        shard_max = (max_size + shards - 1) / shards;
+        if (shard_max == 0)
+            shard_max = 1;
+
+        shard_arr = std::make_unique<Shard[]>(n_shards);
+    }
+
+    /**
+     * @brief ShardedQueue is neither copyable nor moveable.
+    */
+    ShardedQueue(const ShardedQueue &) = delete;
+    ShardedQueue &operator=(const ShardedQueue &) = delete;
+
+    /**
+     * @pre No coroutine is waiting on the container.
+    */
+    ~ShardedQueue() = default;
+
+    /**
+     * @brief Check whether the container is empty.
+     * @note In a concurrent environment, this value may no longer be accurate
+     *       after returned.
+    */
+    bool empty() const noexcept { return size() == 0; }
+
+    /**
+     * @brief Check whether all the shards are full.
+     * @note In a concurrent environment, this value may no longer be accurate
+     *       after returned.
+    */
+    bool full() const noexcept { return size() >= max_size(); }
+
+    /**
+     * @brief Check whether the container is closed.
+     * @see close().
+    */
+    bool closed() const noexcept { return que_closed.load(acquire); }
+
+    /**
+     * @brief Get the element count of all the shards.
+     * @note In a concurrent environment, this value may no longer be accurate
+     *       after returned.
+    */
+    SizeType size() const noexcept {
+        SizeType n = 0;
+        for (SizeType i = 0; i < n_shards; i++)
+            n += shard_arr[i].cnt.load(relaxed);
+        return n;
+    }
+
+    /**
+     * @brief Get the max size of the container, which is the `max_size` param
+     *        rounded up to a multiple of the number of shards.
+    */
+    SizeType max_size() const noexcept { return shard_max * n_shards; }
+
+    SizeType shard_count() const noexcept { return n_shards; }
+
+    /**
+     * @brief Close the container, see coke::Queue::close.
+     * @pre The container is not closed().
+    */
+    void close() {
+        UniqueLock lk(mtx);
+
+        if (!que_closed.exchange(true, acq_rel)) {
+            push_cv.notify_all();
+            pop_cv.notify_all();
+        }
+    }
+
+    /**
+     * @brief Reopen a closed container.
+     * @pre The container is closed().
+    */
+    void reopen() noexcept { que_closed.store(false, release); }
+
+    /**
+     * @brief Try to emplace new element into the local shard, or any other
+     *        shard that is not full.
+     *
+     * @returns Whether new element is pushed, false if full or closed, and
+     *          the args... will not be moved or copied.
+    */
+    template<typename... Args>
+        requires std::constructible_from<T, Args&&...>
+    bool try_emplace(Args&&... args) {
+        if (closed() || !do_emplace(std::forward<Args>(args)...))
+            return false;
+
+        after_push();
+        return true;
+    }
+
+    /**
+     * @brief Emplace new element into container, wait if full.
+     * @retval See try_emplace_for.
+    */
+    template<typename... Args>
+        requires std::constructible_from<T, Args&&...>
+    Task<int> emplace(Args&&... args) {
+        return emplace_impl(detail::TimedWaitHelper{},
+                            std::forward<Args>(args)...);
+    }
+
+    /**
+     * @brief Emplace new element into container before nsec timeout.
+     *
+     * @retval coke::TOP_SUCCESS If emplace successful.
+     * @retval coke::TOP_TIMEOUT If timeout before container is able to push.
+     * @retval coke::TOP_ABORTED If process exit.
+     * @retval coke::TOP_CLOSED If container is closed.
+     * @retval Negative integer to indicate system error, almost never happens.
+    */
+    template<typename... Args>
+        requires std::constructible_from<T, Args&&...>
+    Task<int> try_emplace_for(NanoSec nsec, Args&&... args) {
+        return emplace_impl(detail::TimedWaitHelper{nsec},
+                            std::forward<Args>(args)...);
+    }
+
+    /**
+     * @brief Same as try_emplace_for, but wait until `deadline`.
+    */
+    template<typename... Args>
+        requires std::constructible_from<T, Args&&...>
+    Task<int> try_emplace_until(SteadyTimePoint deadline, Args&&... args) {
+        return emplace_impl(detail::TimedWaitHelper{deadline},
+                            std::forward<Args>(args)...);
+    }
+
+    /**
+     * @brief Try to push new element into container, see try_emplace.
+    */
+    template<typename U>
+        requires std::constructible_from<T, U&&>
+    bool try_push(U &&u) {
+        return try_emplace(std::forward<U>(u));
+    }
+
+    /**
+     * @brief Push new element into container, wait if full.
+     * @retval See try_emplace_for.
+    */
+    template<typename U>
+        requires std::constructible_from<T, U&&>
+    Task<int> push(U &&u) {
+        return emplace_impl(detail::TimedWaitHelper{}, std::forward<U>(u));
+    }
+
+    /**
+     * @brief Push new element into container before nsec timeout.
+     * @retval See try_emplace_for.
+    */
+    template<typename U>
+        requires std::constructible_from<T, U&&>
+    Task<int> try_push_for(NanoSec nsec, U &&u) {
+        return emplace_impl(detail::TimedWaitHelper{nsec}, std::forward<U>(u));
+    }
+
+    /**
+     * @brief Same as try_push_for, but wait until `deadline`.
+    */
+    template<typename U>
+        requires std::constructible_from<T, U&&>
+    Task<int> try_push_until(SteadyTimePoint deadline, U &&u) {
+        return emplace_impl(detail::TimedWaitHelper{deadline},
+                            std::forward<U>(u));
+    }
+
+    /**
+     * @brief Try to pop element from the local shard, or steal from the
+     *        other shards if it is empty.
+     *
+     * @returns Whether element is popped, false if empty, and u is keep
+     *          unchanged.
+    */
+    template<typename U>
+        requires std::assignable_from<U&, T&&>
+    bool try_pop(U &u) {
+        if (!do_pop(u))
+            return false;
+
+        after_pop();
+        return true;
+    }
+
+    /**
+     * @brief Pop element from container, wait if empty.
+     * @retval See try_pop_for.
+    */
+    template<typename U>
+        requires std::assignable_from<U&, T&&>
+    Task<int> pop(U &u) {
+        return pop_impl(detail::TimedWaitHelper{}, u);
+    }
+
+    /**
+     * @brief Pop element from container before nsec timeout.
+     *
+     * @retval coke::TOP_SUCCESS If pop successful.
+     * @retval coke::TOP_TIMEOUT If timeout before container is able to pop.
+     * @retval coke::TOP_ABORTED If process exit.
+     * @retval coke::TOP_CLOSED If container is empty and closed.
+     * @retval Negative integer to indicate system error, almost never happens.
+    */
+    template<typename U>
+        requires std::assignable_from<U&, T&&>
+    Task<int> try_pop_for(NanoSec nsec, U &u) {
+        return pop_impl(detail::TimedWaitHelper{nsec}, u);
+    }
+
+    /**
+     * @brief Same as try_pop_for, but wait until `deadline`.
+    */
+    template<typename U>
+        requires std::assignable_from<U&, T&&>
+    Task<int> try_pop_until(SteadyTimePoint deadline, U &u) {
+        return pop_impl(detail::TimedWaitHelper{deadline}, u);
+    }
+
+private:
+    SizeType local_shard() const noexcept {
+        return detail::get_thread_index() % n_shards;
+    }
+
+    template<typename... Args>
+    bool do_emplace(Args&&... args) {
+        SizeType start = local_shard();
+
+        for (SizeType k = 0; k < n_shards; k++) {
+            Shard &s = shard_arr[(start + k) % n_shards];
+            if (s.cnt.load(relaxed) >= shard_max)
+                continue;
+
+            UniqueLock lk(s.mtx);
+            if (s.que.size() >= shard_max)
+                continue;
+
+            s.que.emplace_back(std::forward<Args>(args)...);
+            s.cnt.store(s.que.size(), relaxed);
+            return true;
+        }
+
+        return false;
+    }
+
+    template<typename U>
+    bool do_pop(U &u) {
+        SizeType start = local_shard();
+
+        for (SizeType k = 0; k < n_shards; k++) {
+            Shard &s = shard_arr[(start + k) % n_shards];
+            if (s.cnt.load(relaxed) == 0)
+                continue;
+
+            UniqueLock lk(s.mtx);
+            if (s.que.empty())
+                continue;
+
+            u = std::move(s.que.front());
+            s.que.pop_front();
+            s.cnt.store(s.que.size(), relaxed);
+            return true;
+        }
+
+        return false;
+    }
+
+    void after_push() {
+        // Pairs with the fence of the waiting poppers, either they see the
+        // new element, or we see them waiting.
+        std::atomic_thread_fence(seq_cst);
+
+        if (pop_wait_cnt.load(relaxed) != 0) {
+            UniqueLock lk(mtx);
+            lk.unlock();
+            pop_cv.notify_one();
+        }
+    }
+
+    void after_pop() {
+        std::atomic_thread_fence(seq_cst);
+
+        if (push_wait_cnt.load(relaxed) != 0) {
+            UniqueLock lk(mtx);
+            lk.unlock();
+            push_cv.notify_one();
+        }
+    }
+
+    template<typename... Args>
+    Task<int> emplace_impl(detail::TimedWaitHelper helper, Args&&... args) {
+        if (coke::prevent_recursive_stack())
+            co_await coke::yield();
+
+        if (closed())
+            co_return TOP_CLOSED;
+
+        if (do_emplace(std::forward<Args>(args)...)) {
+            after_push();
+            co_return TOP_SUCCESS;
+        }
+
+        int ret = TOP_SUCCESS;
+        bool pushed = false;
+        auto pred = [&]() {
+            std::atomic_thread_fence(seq_cst);
+            if (closed())
+                return true;
+
+            pushed = do_emplace(std::forward<Args>(args)...);
+            return pushed;
+        };
+
+        UniqueLock lk(mtx);
+        CountGuard cg(push_wait_cnt);
+
+        if (helper.infinite())
+            ret = co_await push_cv.wait(lk, pred);
+        else
+            ret = co_await push_cv.wait_until(lk, helper.deadline(), pred);
+
+        lk.unlock();
+
+        if (pushed) {
+            after_push();
+            co_return TOP_SUCCESS;
+        }
+
+        co_return (ret == TOP_SUCCESS) ? TOP_CLOSED : ret;
+    }
+
+    template<typename U>
+    Task<int> pop_impl(detail::TimedWaitHelper helper, U &u) {
+        if (coke::prevent_recursive_stack())
+            co_await coke::yield();
+
+        if (do_pop(u)) {
+            after_pop();
+            co_return TOP_SUCCESS;
+        }
+
+        int ret = TOP_SUCCESS;
+        bool popped = false;
+        auto pred = [&]() {
+            std::atomic_thread_fence(seq_cst);
+            popped = do_pop(u);
+            return popped || closed();
+        };
+
+        UniqueLock lk(mtx);
+        CountGuard cg(pop_wait_cnt);
+
+        if (helper.infinite())
+            ret = co_await pop_cv.wait(lk, pred);
+        else
+            ret = co_await pop_cv.wait_until(lk, helper.deadline(), pred);
+
+        lk.unlock();
+
+        if (popped) {
+            after_pop();
+            co_return TOP_SUCCESS;
+        }
+
+        co_return (ret == TOP_SUCCESS) ? TOP_CLOSED : ret;
+    }
+
+private:
+    SizeType n_shards;
+    SizeType shard_max;
+    std::unique_ptr<Shard[]> shard_arr;
+    std::atomic<bool> que_closed;
+
+    // Only used to park the waiting pushers and poppers
+    std::mutex mtx;
+    Condition push_cv;
+    Condition pop_cv;
+    std::atomic<SizeType> push_wait_cnt;
+    std::atomic<SizeType> pop_wait_cnt;
+};
+
+} // namespace coke
+
+#endif // COKE_SHARDED_QUEUE_H
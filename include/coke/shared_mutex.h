@@ -19,21 +19,67 @@
 #ifndef COKE_SHARED_MUTEX_H
 #define COKE_SHARED_MUTEX_H
 
+#include <atomic>
 #include <cstdint>
 #include <mutex>
+#include <optional>
 
 #include "coke/detail/exception_config.h"
+#include "coke/detail/spin_wait.h"
 #include "coke/task.h"
 #include "coke/sleep.h"
 
 namespace coke {
 
+class SharedMutex;
+
+/**
+ * @brief The awaiter returned by the lock functions of SharedMutex. When the
+ *        mutex can be locked at once, it is locked in `await_ready` by atomic
+ *        operations, without touching the internal std::mutex or creating a
+ *        coroutine, otherwise it waits on a coroutine created by the mutex.
+*/
+class [[nodiscard]] SharedMutexLockAwaiter : public AwaiterBase {
+public:
+    SharedMutexLockAwaiter(SharedMutex *mtx, detail::TimedWaitHelper helper,
+                           bool shared) noexcept
+        : mtx(mtx), helper(helper), shared(shared), ret(TOP_SUCCESS)
+    { }
+
+    SharedMutexLockAwaiter(SharedMutexLockAwaiter &&) = default;
+
+    bool await_ready();
+
+    template<typename PromiseType>
+    auto await_suspend(std::coroutine_handle<PromiseType> h) {
+        awaiter.emplace(task.await_into(&ret));
+        return awaiter->await_suspend(h);
+    }
+
+    int await_resume() {
+        if (awaiter)
+            awaiter->await_resume();
+
+        return ret;
+    }
+
+private:
+    SharedMutex *mtx;
+    detail::TimedWaitHelper helper;
+    bool shared;
+    int ret;
+
+    Task<int> task;
+    std::optional<detail::TaskSlotAwaiter<int>> awaiter;
+};
+
+
 class SharedMutex {
-    enum class State : uint8_t {
-        Idle        = 0,
-        Reading     = 1,
-        Writing     = 2,
-    };
+    // The lowest bits are the number of readers who own the mutex
+    static constexpr uint32_t WRITING           = 1u << 31;
+    static constexpr uint32_t WRITER_WAITING    = 1u << 30;
+    static constexpr uint32_t READER_WAITING    = 1u << 29;
+    static constexpr uint32_t READER_MASK       = READER_WAITING - 1;
 
 public:
     using CountType = uint32_t;
@@ -42,7 +88,7 @@ public:
      * @brief Create a SharedMutex.
     */
     SharedMutex() noexcept
-        : read_doing(0), read_waiting(0), write_waiting(0), state(State::Idle)
+        : state(0), read_waiting(0), write_waiting(0)
     { }
 
     /**
@@ -60,12 +106,14 @@ public:
      *      exclusive).
      * @return Return true if lock success, else false.
     */
-    bool try_lock() {
-        std::lock_guard<std::mutex> lg(mtx);
-
-        if (state == State::Idle) {
-            state = State::Writing;
-            return true;
+    bool try_lock() noexcept {
+        uint32_t s = state.load(std::memory_order_relaxed);
+
+        while (!(s & (WRITING | READER_MASK))) {
+            if (state.compare_exchange_weak(s, s | WRITING,
+                                            std::memory_order_acquire,
+                                            std::memory_order_relaxed))
+                return true;
         }
 
         return false;
@@ -78,13 +126,14 @@ public:
      *      exclusive).
      * @return Return true if lock success, else false.
     */
-    bool try_lock_shared() {
-        std::lock_guard<std::mutex> lg(mtx);
-
-        if (state == State::Idle || state == State::Reading) {
-            state = State::Reading;
-            read_doing++;
-            return true;
+    bool try_lock_shared() noexcept {
+        uint32_t s = state.load(std::memory_order_relaxed);
+
+        while (!(s & WRITING)) {
+            if (state.compare_exchange_weak(s, s + 1,
+                                            std::memory_order_acquire,
+                                            std::memory_order_relaxed))
+                return true;
         }
 
         return false;
@@ -98,13 +147,14 @@ public:
      *         exclusive ownership, else return false and current coroutine
      *         has shared ownership, just like before calling `try_upgrade`.
     */
-    bool try_upgrade() {
-        std::lock_guard<std::mutex> lg(mtx);
-
-        if (state == State::Reading && read_doing == 1) {
-            read_doing = 0;
-            state = State::Writing;
-            return true;
+    bool try_upgrade() noexcept {
+        uint32_t s = state.load(std::memory_order_relaxed);
+
+        while ((s & READER_MASK) == 1) {
+            if (state.compare_exchange_weak(s, (s - 1) | WRITING,
+                                            std::memory_order_acquire,
+                                            std::memory_order_relaxed))
+                return true;
         }
 
         return false;
@@ -116,23 +166,43 @@ public:
      * @pre Current coroutine must owns the mutex in any mode(shared or
      *      exclusive).
     */
-    void unlock();
+    void unlock() {
+        uint32_t s = state.load(std::memory_order_relaxed);
+
+        if (!(s & WRITING)) {
+            unlock_shared();
+            return;
+        }
+
+        s = state.fetch_and(~WRITING, std::memory_order_release);
+        if (s & (WRITER_WAITING | READER_WAITING))
+            wake_waiters();
+    }
 
     /**
      * @brief Unlock the mutex from shared ownership.
      *
      * @pre Current coroutine must owns the mutex in shared ownership.
      */
-    void unlock_shared() { unlock(); }
+    void unlock_shared() {
+        uint32_t s = state.fetch_sub(1, std::memory_order_release);
+
+        // Only writers wait for the readers to leave
+        if ((s & READER_MASK) == 1 && (s & WRITER_WAITING))
+            wake_waiters();
+    }
 
     /**
      * @brief Lock the mutex for exclusive ownership, block until success.
      *
      * @pre Current coroutine doesn't owns the mutex in any mode(shared or
      *      exclusive).
-     * @return See try_lock_for but ignore coke::TOP_TIMEOUT.
+     * @return An awaiter that needs to be awaited immediately.
+     *         See try_lock_for but ignore coke::TOP_TIMEOUT.
     */
-    Task<int> lock() { return lock_impl(detail::TimedWaitHelper{}); }
+    SharedMutexLockAwaiter lock() {
+        return SharedMutexLockAwaiter(this, detail::TimedWaitHelper{}, false);
+    }
 
     /**
      * @brief Lock the mutex for exclusive ownership, block until success or
@@ -141,15 +211,24 @@ public:
      * @pre Current coroutine doesn't owns the mutex in any mode(shared or
      *      exclusive).
      * @param nsec Max time to block.
-     * @return Coroutine(coke::Task<int>) that needs to be awaited immediately.
+     * @return An awaiter that needs to be awaited immediately.
      * @retval coke::TOP_SUCCESS If lock success.
      * @retval coke::TOP_TIMEOUT If `nsec` timeout.
      * @retval coke::TOP_ABORTED If process exit.
      * @retval Negative integer to indicate system error, almost never happens.
      * @see coke/global.h
     */
-    Task<int> try_lock_for(const NanoSec &nsec) {
-        return lock_impl(detail::TimedWaitHelper(nsec));
+    SharedMutexLockAwaiter try_lock_for(const NanoSec &nsec) {
+        return SharedMutexLockAwaiter(this, detail::TimedWaitHelper(nsec),
+                                      false);
+    }
+
+    /**
+     * @brief Same as try_lock_for, but block until `deadline`.
+    */
+    SharedMutexLockAwaiter try_lock_until(SteadyTimePoint deadline) {
+        return SharedMutexLockAwaiter(this, detail::TimedWaitHelper(deadline),
+                                      false);
     }
 
     /**
@@ -159,8 +238,8 @@ public:
      *      exclusive).
      * @return See try_lock_for but ignore coke::TOP_TIMEOUT.
     */
-    Task<int> lock_shared() {
-        return lock_shared_impl(detail::TimedWaitHelper{});
+    SharedMutexLockAwaiter lock_shared() {
+        return SharedMutexLockAwaiter(this, detail::TimedWaitHelper{}, true);
     }
 
     /**
@@ -173,18 +252,74 @@ public:
      * @return See try_lock_for.
      *
     */
-    Task<int> try_lock_shared_for(const NanoSec &nsec) {
-        return lock_shared_impl(detail::TimedWaitHelper(nsec));
+    SharedMutexLockAwaiter try_lock_shared_for(const NanoSec &nsec) {
+        return SharedMutexLockAwaiter(this, detail::TimedWaitHelper(nsec),
+                                      true);
+    }
+
+    /**
+     * @brief Same as try_lock_shared_for, but block until `deadline`.
+    */
+    SharedMutexLockAwaiter try_lock_shared_until(SteadyTimePoint deadline) {
+        return SharedMutexLockAwaiter(this, detail::TimedWaitHelper(deadline),
+                                      true);
     }
 
 protected:
+    /**
+     * @brief Lock for exclusive ownership without waiting if the mutex is
+     *        neither locked nor waited by others.
+    */
+    bool lock_fast() noexcept {
+        uint32_t s = 0;
+        return state.compare_exchange_strong(s, WRITING,
+                                             std::memory_order_acquire,
+                                             std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Lock for shared ownership without waiting if there is no writer
+     *        owns or waits for the mutex, so that the writers are not starved.
+    */
+    bool lock_shared_fast() noexcept {
+        uint32_t s = state.load(std::memory_order_relaxed);
+
+        while (!(s & (WRITING | WRITER_WAITING))) {
+            if (state.compare_exchange_weak(s, s + 1,
+                                            std::memory_order_acquire,
+                                            std::memory_order_relaxed))
+                return true;
+        }
+
+        return false;
+    }
+
+    /**
+     * @brief Spin a while before parking, give up as soon as anyone of the
+     *        same mode is parked, see GlobalSettings::lock_spin_count.
+    */
+    template<bool SHARED>
+    bool lock_spin() noexcept {
+        constexpr uint32_t PARKED = SHARED ? READER_WAITING : WRITER_WAITING;
+        std::size_t n = detail::get_lock_spin_count();
+
+        for (std::size_t i = 0; i < n; i++) {
+            detail::cpu_relax();
+
+            if (state.load(std::memory_order_relaxed) & PARKED)
+                return false;
+
+            if (SHARED ? lock_shared_fast() : lock_fast())
+                return true;
+        }
+
+        return false;
+    }
+
     Task<int> lock_impl(detail::TimedWaitHelper helper);
     Task<int> lock_shared_impl(detail::TimedWaitHelper helper);
 
-    bool can_lock_shared() const noexcept {
-        return (state == State::Idle || state == State::Reading)
-               && write_waiting == 0;
-    }
+    void wake_waiters();
 
     const void *rlock_addr() const noexcept {
         return (const char *)this + 1;
@@ -195,13 +330,33 @@ protected:
     }
 
 private:
+    std::atomic<uint32_t> state;
+
+    // Makes registering a waiter and waking it up in order
     std::mutex mtx;
-    CountType read_doing;
     CountType read_waiting;
     CountType write_waiting;
-    State state;
+
+    friend class SharedMutexLockAwaiter;
 };
 
+inline bool SharedMutexLockAwaiter::await_ready() {
+    if (shared) {
+        if (mtx->lock_shared_fast() || mtx->lock_spin<true>())
+            return true;
+
+        task = mtx->lock_shared_impl(helper);
+    }
+    else {
+        if (mtx->lock_fast() || mtx->lock_spin<false>())
+            return true;
+
+        task = mtx->lock_impl(helper);
+    }
+
+    return false;
+}
+
 template<typename M>
 class SharedLock {
 public:
@@ -313,6 +468,22 @@ public:
         co_return ret;
     }
 
+    /**
+     * @brief Try to lock the mutex until `deadline`, see
+     *        SharedMutex::try_lock_shared_until.
+     * @throw std::system_error if already locked.
+     */
+    Task<int> try_lock_until(SteadyTimePoint deadline) {
+        if (owns)
+            detail::throw_system_error(std::errc::resource_deadlock_would_occur);
+
+        int ret = co_await co_mtx->try_lock_shared_until(deadline);
+        if (ret == coke::TOP_SUCCESS)
+            owns = true;
+
+        co_return ret;
+    }
+
     /**
      * @brief Unlock the associated mutex.
      * @throw std::system_error if not owns lock.
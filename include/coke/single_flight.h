@@ -0,0 +1,204 @@
+/**
+ * Copyright 2024 Coke Project (https://github.com/kedixa/coke)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Authors: kedixa (https://github.com/kedixa)
+*/
+
+#ifndef COKE_SINGLE_FLIGHT_H
+#define COKE_SINGLE_FLIGHT_H
+
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+
+#include "coke/detail/exception_config.h"
+#include "coke/detail/future_base.h"
+#include "coke/sleep.h"
+#include "coke/task.h"
+
+namespace coke {
+
+/**
+ * @brief SingleFlight suppresses duplicate loads of the same key. The first
+ *        caller of a key runs the loader, and the callers that arrive before
+ *        it finishes wait for its result instead of loading again. The result
+ *        is shared by all of them through a FutureState, which is the same
+ *        state used by Future and Promise.
+ *
+ * If `ttl` is greater than zero, a successful result is kept for `ttl` after
+ * the load finishes, and the callers during that time get it immediately. An
+ * exception thrown by the loader is rethrown to all the waiting callers, and
+ * is never kept.
+*/
+template<typename K, Cokeable V, typename Hash = std::hash<K>,
+         typename KeyEqual = std::equal_to<K>>
+    requires (!std::is_void_v<V>)
+class SingleFlight {
+    using ResultType = std::shared_ptr<const V>;
+    using State = detail::FutureState<ResultType>;
+    using StatePtr = std::shared_ptr<State>;
+    using Clock = std::chrono::steady_clock;
+
+    struct Entry {
+        StatePtr state;
+        bool done{false};
+        SteadyTimePoint expire_at;
+    };
+
+public:
+    using KeyType = K;
+    using ValueType = V;
+
+    /**
+     * @brief Create a SingleFlight.
+     *
+     * @param ttl How long a loaded result is kept, zero or negative means the
+     *        result is forgotten as soon as the load finishes.
+    */
+    explicit SingleFlight(NanoSec ttl = NanoSec(0)) : ttl(ttl) { }
+
+    /**
+     * @brief SingleFlight is neither copyable nor movable.
+    */
+    SingleFlight(const SingleFlight &) = delete;
+    SingleFlight &operator= (const SingleFlight &) = delete;
+
+    /**
+     * @pre No load is in flight.
+    */
+    ~SingleFlight() = default;
+
+    /**
+     * @brief Get the result of `key`, loaded by `func()` if there is neither
+     *        a load in flight nor an unexpired result of `key`.
+     *
+     * @param key The key to load.
+     * @param func A callable object that returns coke::Task<V>, it is only
+     *        called by the first caller and is dropped by the others.
+     * @return A shared pointer to the result, which is shared by all callers
+     *         of the same load. Return nullptr only when the process is about
+     *         to exit before the load finishes.
+     * @exception The exception thrown by `func` or the loader Task.
+    */
+    template<typename F>
+        requires std::is_invocable_r_v<Task<V>, F>
+    Task<ResultType> call(K key, F func) {
+        StatePtr state;
+        bool leader = false;
+
+        {
+            std::lock_guard<std::mutex> lg(mtx);
+            auto it = entries.find(key);
+
+            if (it != entries.end() && it->second.done &&
+                Clock::now() >= it->second.expire_at)
+            {
+                entries.erase(it);
+                it = entries.end();
+            }
+
+            if (it == entries.end()) {
+                state = std::make_shared<State>();
+                entries.emplace(key, Entry{state, false, SteadyTimePoint{}});
+                leader = true;
+            }
+            else
+                state = it->second.state;
+        }
+
+        if (leader)
+            co_await load(key, state, func);
+
+        int st = state->get_state();
+        if (st == FUTURE_STATE_NOTSET)
+            st = co_await state->wait();
+
+        if (st == FUTURE_STATE_READY || st == FUTURE_STATE_EXCEPTION)
+            co_return state->get();
+
+        co_return nullptr;
+    }
+
+    /**
+     * @brief Forget the kept result or the in flight load of `key`, the next
+     *        caller will load it again. The callers already waiting for the
+     *        in flight load still get its result.
+     *
+     * @return Return true if `key` is found.
+    */
+    bool forget(const K &key) {
+        std::lock_guard<std::mutex> lg(mtx);
+        return entries.erase(key) != 0;
+    }
+
+    /**
+     * @brief Forget all the kept results and in flight loads.
+    */
+    void clear() {
+        std::lock_guard<std::mutex> lg(mtx);
+        entries.clear();
+    }
+
+    /**
+     * @brief Get the number of keys that are loading or kept, including the
+     *        expired ones that have not been removed yet.
+    */
+    std::size_t size() const {
+        std::lock_guard<std::mutex> lg(mtx);
+        return entries.size();
+    }
+
+private:
+    template<typename F>
+    Task<> load(const K &key, const StatePtr &state, F &func) {
+        bool succ = false;
+
+        coke_try {
+            V value = co_await std::invoke(func);
+            succ = state->set_value(std::make_shared<const V>(std::move(value)));
+        }
+        coke_catch (...) {
+            state->set_exception(std::current_exception());
+        }
+
+        std::lock_guard<std::mutex> lg(mtx);
+        auto it = entries.find(key);
+
+        // The entry may be forgotten, or replaced by a new load.
+        if (it == entries.end() || it->second.state != state)
+            co_return;
+
+        if (succ && ttl > NanoSec(0)) {
+            it->second.done = true;
+            it->second.expire_at = Clock::now() + ttl;
+        }
+        else
+            entries.erase(it);
+    }
+
+private:
+    NanoSec ttl;
+
+    mutable std::mutex mtx;
+    std::unordered_map<K, Entry, Hash, KeyEqual> entries;
+};
+
+} // namespace coke
+
+#endif // COKE_SINGLE_FLIGHT_H
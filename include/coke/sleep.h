@@ -20,6 +20,7 @@
 #define COKE_SLEEP_H
 
 #include <string>
+#include <vector>
 
 #include "coke/detail/sleep_base.h"
 #include "coke/basic_awaiter.h"
@@ -29,6 +30,12 @@ namespace coke {
 
 using NanoSec = detail::NanoSec;
 
+/**
+ * @brief The time point used by `*_until` functions, such as `sleep_until`
+ *        and `Mutex::try_lock_until`.
+*/
+using SteadyTimePoint = detail::TimedWaitHelper::TimePoint;
+
 /**
  * @brief InfiniteDuration is used to represent an infinite time when sleeping
  *        with id, and will only be awakened when `cancel_sleep_by_id`.
@@ -51,6 +58,7 @@ class [[nodiscard]] SleepAwaiter : public detail::SleepBase {
 public:
     struct ImmediateTag { };
     struct YieldTag { };
+    struct CoarseTag { };
 
     /**
      * @brief Create a SleepAwaiter that returns SLEEP_SUCCESS immediately,
@@ -77,6 +85,26 @@ public:
     */
     SleepAwaiter(double sec);
 
+    /**
+     * @brief Create a SleepAwaiter that will sleep `nsec` on the coarse
+     *        grained timing wheel, it may wake up one tick later than
+     *        expected but is cheaper for long timeouts.
+     *
+     * @param nsec See previous description.
+    */
+    SleepAwaiter(NanoSec nsec, CoarseTag);
+
+    /**
+     * @brief Create a SleepAwaiter that will sleep at least `nsec`, the
+     *        deadline is rounded up to a multiple of `slack`, so that many
+     *        timers with close deadlines expire at the same time.
+     *
+     * @param nsec See previous description.
+     * @param slack The max extra time to sleep, overrides
+     *        GlobalSettings::timer_slack.
+    */
+    SleepAwaiter(NanoSec nsec, NanoSec slack);
+
     /**
      * @brief Create a SleepAwaiter that will sleep `nsec` with id, this awaiter
      *        can be canceled using the same id, even it is not co awaited. All
@@ -131,6 +159,19 @@ inline SleepAwaiter sleep(double sec) {
     return SleepAwaiter(sec);
 }
 
+inline SleepAwaiter sleep(NanoSec nsec, NanoSec slack) {
+    return SleepAwaiter(nsec, slack);
+}
+
+inline SleepAwaiter sleep_coarse(NanoSec nsec) {
+    return SleepAwaiter(nsec, SleepAwaiter::CoarseTag{});
+}
+
+inline SleepAwaiter sleep_until(SteadyTimePoint deadline) {
+    detail::TimedWaitHelper helper(deadline);
+    return SleepAwaiter(helper.time_left(), NanoSec(0));
+}
+
 
 inline SleepAwaiter
 sleep(uint64_t id, NanoSec nsec, bool insert_head = false) {
@@ -181,6 +222,42 @@ sleep(const void *addr, detail::TimedWaitHelper helper,
 }
 
 
+/**
+ * @brief SleepKey interns a name to a unique id once, so that sleeping and
+ *        canceling by the key do no string hashing or allocation. Keys created
+ *        from the same name are equal. It works like sleep with id, and is
+ *        unrelated to the Workflow's sleep by name.
+*/
+class SleepKey {
+public:
+    SleepKey() noexcept : id(INVALID_UNIQUE_ID) { }
+
+    explicit SleepKey(const std::string &name);
+
+    SleepKey(const SleepKey &) noexcept = default;
+    SleepKey &operator= (const SleepKey &) noexcept = default;
+
+    uint64_t get_id() const noexcept { return id; }
+
+    bool valid() const noexcept { return id != INVALID_UNIQUE_ID; }
+
+    friend bool operator== (const SleepKey &, const SleepKey &) = default;
+
+private:
+    uint64_t id;
+};
+
+inline SleepAwaiter
+sleep(const SleepKey &key, NanoSec nsec, bool insert_head = false) {
+    return SleepAwaiter(key.get_id(), nsec, insert_head);
+}
+
+inline SleepAwaiter
+sleep(const SleepKey &key, InfiniteDuration x, bool insert_head = false) {
+    return SleepAwaiter(key.get_id(), x, insert_head);
+}
+
+
 inline SleepAwaiter yield() {
     return SleepAwaiter(SleepAwaiter::YieldTag{});
 }
@@ -191,12 +268,61 @@ inline std::size_t cancel_sleep_by_id(uint64_t id) {
     return cancel_sleep_by_id(id, std::size_t(-1));
 }
 
+inline std::size_t cancel_sleep(const SleepKey &key, std::size_t max) {
+    return cancel_sleep_by_id(key.get_id(), max);
+}
+
+inline std::size_t cancel_sleep(const SleepKey &key) {
+    return cancel_sleep_by_id(key.get_id(), std::size_t(-1));
+}
+
 std::size_t cancel_sleep_by_addr(const void *addr, std::size_t max);
 
 inline std::size_t cancel_sleep_by_addr(const void *addr) {
     return cancel_sleep_by_addr(addr, std::size_t(-1));
 }
 
+/**
+ * @brief Statistics of one shard of the timer maps used by sleep with id or
+ *        address, `contended_count` is the number of times the shard's lock
+ *        was already held by another thread.
+*/
+struct TimerMapStats {
+    static constexpr std::size_t LOCK_WAIT_BUCKETS = 8;
+
+    uint64_t lock_count{0};
+    uint64_t contended_count{0};
+
+    // Number of timers currently in the shard
+    uint64_t live_timers{0};
+    // Number of timers added, canceled, and expired(or failed) without cancel
+    uint64_t add_count{0};
+    uint64_t cancel_count{0};
+    uint64_t expire_count{0};
+
+    /**
+     * Histogram of the time spent waiting for the contended lock, bucket 0
+     * counts waits shorter than 1us, bucket i counts [4^(i-1), 4^i) us, and
+     * the last bucket counts the rest. Only collected when enabled by
+     * `set_sleep_map_lock_timing`, because it reads the clock.
+    */
+    uint64_t lock_wait_hist[LOCK_WAIT_BUCKETS]{};
+};
+
+/**
+ * @brief Enable or disable collecting TimerMapStats::lock_wait_hist, it can
+ *        be changed at any time, see GlobalSettings::timer_lock_timing.
+*/
+void set_sleep_map_lock_timing(bool enable) noexcept;
+
+/**
+ * @brief Get the statistics of each shard of the timer maps, the number of
+ *        shards can be changed by GlobalSettings::timer_map_shards.
+*/
+std::vector<TimerMapStats> get_sleep_map_stats_by_id();
+
+std::vector<TimerMapStats> get_sleep_map_stats_by_addr();
+
 inline WFSleepAwaiter sleep(const std::string &name, NanoSec nsec) {
     return WFSleepAwaiter(name, nsec);
 }
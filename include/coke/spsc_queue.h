@@ -0,0 +1,466 @@
+/**
+ * Copyright 2024 Coke Project (https://github.com/kedixa/coke)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Authors: kedixa (https://github.com/kedixa)
+*/
+
+#ifndef COKE_SPSC_QUEUE_H
+#define COKE_SPSC_QUEUE_H
+
+#include <atomic>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include "coke/detail/basic_concept.h"
+#include "coke/detail/constant.h"
+#include "coke/global.h"
+#include "coke/sleep.h"
+#include "coke/task.h"
+
+namespace coke {
+
+/**
+ * @class coke::SpscQueue
+ * @brief coke::SpscQueue is a bounded FIFO queue between exactly one producer
+ *        and one consumer, with the same awaitable interface as coke::Queue.
+ *
+ * The producer only writes the tail index and the consumer only writes the
+ * head index, they are on different cache lines and each side caches the
+ * other's index, so that a push or pop costs a couple of atomic operations
+ * and no lock. When it is full or empty, the side that waits sets its wake
+ * flag and sleeps on its own address, and the other side only wakes it up
+ * when it sees the flag.
+ *
+ * The max size is rounded up to a power of 2.
+ *
+ * @pre At any time, at most one coroutine pushes and at most one coroutine
+ *      pops.
+*/
+template<Queueable T>
+class SpscQueue final {
+    static constexpr auto relaxed = std::memory_order_relaxed;
+    static constexpr auto acquire = std::memory_order_acquire;
+    static constexpr auto release = std::memory_order_release;
+    static constexpr auto acq_rel = std::memory_order_acq_rel;
+    static constexpr auto seq_cst = std::memory_order_seq_cst;
+
+public:
+    using SizeType = std::size_t;
+    using ValueType = T;
+
+private:
+    struct Slot {
+        T *get() noexcept { return std::launder(reinterpret_cast<T *>(buf)); }
+
+        alignas(T) unsigned char buf[sizeof(T)];
+    };
+
+    static SizeType round_up(SizeType n) {
+        SizeType x = 1;
+        while (x < n)
+            x <<= 1;
+        return x;
+    }
+
+public:
+    /**
+     * @brief Create coke::SpscQueue with max_size.
+     *
+     * @param max_size Max elements in the container, rounded up to a power
+     *        of 2. Zero is treated as one.
+    */
+    explicit SpscQueue(SizeType max_size)
+        : mask(round_up(max_size) - 1), slots(new Slot[mask + 1]),
+          que_closed(false),
+          tail(0), cached_head(0), push_waiting(false),
+          head(0), cached_tail(0), pop_waiting(false)
+    { }
+
+    /**
+     * @brief SpscQueue is neither copyable nor moveable.
+    */
+    SpscQueue(const SpscQueue &) = delete;
+    SpscQueue &operator=(const SpscQueue &) = delete;
+
+    /**
+     * @pre No coroutine is waiting on the container.
+    */
+    ~SpscQueue() {
+        SizeType last = tail.load(relaxed);
+
+        for (SizeType pos = head.load(relaxed); pos != last; ++pos)
+            slots[pos & mask].get()->~T();
+    }
+
+    /**
+     * @brief Check whether the container is empty.
+    */
+    bool empty() const noexcept { return size() == 0; }
+
+    /**
+     * @brief Check whether the container is full.
+    */
+    bool full() const noexcept { return size() >= max_size(); }
+
+    /**
+     * @brief Check whether the container is closed.
+    */
+    bool closed() const noexcept { return que_closed.load(acquire); }
+
+    /**
+     * @brief Get the element count of the container.
+     * @note In a concurrent environment, this value may no longer be accurate
+     *       after returned.
+    */
+    SizeType size() const noexcept {
+        SizeType h = head.load(acquire);
+        SizeType t = tail.load(acquire);
+        return t - h;
+    }
+
+    /**
+     * @brief Get the max size of the container, which is the `max_size` param
+     *        used to create this container rounded up to a power of 2.
+    */
+    SizeType max_size() const noexcept { return mask + 1; }
+
+    /**
+     * @brief Close the container, see coke::Queue::close.
+    */
+    void close() {
+        if (!que_closed.exchange(true, acq_rel)) {
+            std::atomic_thread_fence(seq_cst);
+            wake(push_waiting, get_push_addr());
+            wake(pop_waiting, get_pop_addr());
+        }
+    }
+
+    /**
+     * @brief Reopen a closed container.
+     * @pre The container is closed().
+    */
+    void reopen() noexcept { que_closed.store(false, release); }
+
+    /**
+     * @brief Try to emplace new element into container.
+     *
+     * @returns Whether new element is pushed, false if full or closed, and
+     *          the args... will not be moved or copied.
+    */
+    template<typename... Args>
+        requires std::constructible_from<T, Args&&...>
+    bool try_emplace(Args&&... args) {
+        if (closed() || !do_emplace(std::forward<Args>(args)...))
+            return false;
+
+        after_push();
+        return true;
+    }
+
+    /**
+     * @brief Emplace new element into container, wait if full.
+     * @retval See try_emplace_for.
+    */
+    template<typename... Args>
+        requires std::constructible_from<T, Args&&...>
+    Task<int> emplace(Args&&... args) {
+        return emplace_impl(detail::TimedWaitHelper{},
+                            std::forward<Args>(args)...);
+    }
+
+    /**
+     * @brief Emplace new element into container before nsec timeout.
+     *
+     * @retval coke::TOP_SUCCESS If emplace successful.
+     * @retval coke::TOP_TIMEOUT If timeout before container is able to push.
+     * @retval coke::TOP_ABORTED If process exit.
+     * @retval coke::TOP_CLOSED If container is closed.
+     * @retval Negative integer to indicate system error, almost never happens.
+    */
+    template<typename... Args>
+        requires std::constructible_from<T, Args&&...>
+    Task<int> try_emplace_for(NanoSec nsec, Args&&... args) {
+        return emplace_impl(detail::TimedWaitHelper{nsec},
+                            std::forward<Args>(args)...);
+    }
+
+    /**
+     * @brief Same as try_emplace_for, but wait until `deadline`.
+    */
+    template<typename... Args>
+        requires std::constructible_from<T, Args&&...>
+    Task<int> try_emplace_until(SteadyTimePoint deadline, Args&&... args) {
+        return emplace_impl(detail::TimedWaitHelper{deadline},
+                            std::forward<Args>(args)...);
+    }
+
+    /**
+     * @brief Try to push new element into container.
+     *
+     * @returns Whether new element is pushed, false if full or closed, and
+     *          the u will not be moved or copied.
+    */
+    template<typename U>
+        requires std::constructible_from<T, U&&>
+    bool try_push(U &&u) {
+        return try_emplace(std::forward<U>(u));
+    }
+
+    /**
+     * @brief Push new element into container, wait if full.
+     * @retval See try_emplace_for.
+    */
+    template<typename U>
+        requires std::constructible_from<T, U&&>
+    Task<int> push(U &&u) {
+        return emplace_impl(detail::TimedWaitHelper{}, std::forward<U>(u));
+    }
+
+    /**
+     * @brief Push new element into container before nsec timeout.
+     * @retval See try_emplace_for.
+    */
+    template<typename U>
+        requires std::constructible_from<T, U&&>
+    Task<int> try_push_for(NanoSec nsec, U &&u) {
+        return emplace_impl(detail::TimedWaitHelper{nsec}, std::forward<U>(u));
+    }
+
+    /**
+     * @brief Same as try_push_for, but wait until `deadline`.
+    */
+    template<typename U>
+        requires std::constructible_from<T, U&&>
+    Task<int> try_push_until(SteadyTimePoint deadline, U &&u) {
+        return emplace_impl(detail::TimedWaitHelper{deadline},
+                            std::forward<U>(u));
+    }
+
+    /**
+     * @brief Try to pop element from container.
+     *
+     * @returns Whether element is popped, false if empty, and u is keep
+     *          unchanged.
+    */
+    template<typename U>
+        requires std::assignable_from<U&, T&&>
+    bool try_pop(U &u) {
+        if (!do_pop(u))
+            return false;
+
+        after_pop();
+        return true;
+    }
+
+    /**
+     * @brief Pop element from container, wait if empty.
+     * @retval See try_pop_for.
+    */
+    template<typename U>
+        requires std::assignable_from<U&, T&&>
+    Task<int> pop(U &u) {
+        return pop_impl(detail::TimedWaitHelper{}, u);
+    }
+
+    /**
+     * @brief Pop element from container before nsec timeout.
+     *
+     * @retval coke::TOP_SUCCESS If pop successful.
+     * @retval coke::TOP_TIMEOUT If timeout before container is able to pop.
+     * @retval coke::TOP_ABORTED If process exit.
+     * @retval coke::TOP_CLOSED If container is empty and closed.
+     * @retval Negative integer to indicate system error, almost never happens.
+    */
+    template<typename U>
+        requires std::assignable_from<U&, T&&>
+    Task<int> try_pop_for(NanoSec nsec, U &u) {
+        return pop_impl(detail::TimedWaitHelper{nsec}, u);
+    }
+
+    /**
+     * @brief Same as try_pop_for, but wait until `deadline`.
+    */
+    template<typename U>
+        requires std::assignable_from<U&, T&&>
+    Task<int> try_pop_until(SteadyTimePoint deadline, U &u) {
+        return pop_impl(detail::TimedWaitHelper{deadline}, u);
+    }
+
+private:
+    template<typename... Args>
+    bool do_emplace(Args&&... args) {
+        SizeType t = tail.load(relaxed);
+
+        if (t - cached_head > mask) {
+            cached_head = head.load(acquire);
+            if (t - cached_head > mask)
+                return false;
+        }
+
+        ::new ((void *)slots[t & mask].buf) T(std::forward<Args>(args)...);
+        tail.store(t + 1, release);
+        return true;
+    }
+
+    template<typename U>
+    bool do_pop(U &u) {
+        SizeType h = head.load(relaxed);
+
+        if (h == cached_tail) {
+            cached_tail = tail.load(acquire);
+            if (h == cached_tail)
+                return false;
+        }
+
+        // Release the slot even if the assignment throws.
+        struct Release {
+            ~Release() {
+                s->get()->~T();
+                que->head.store(h + 1, release);
+            }
+
+            SpscQueue *que;
+            Slot *s;
+            SizeType h;
+        } rel{this, &slots[h & mask], h};
+
+        u = std::move(*rel.s->get());
+        return true;
+    }
+
+    void after_push() {
+        // Pairs with the fence in wait_for, either the waiter sees the new
+        // state, or we see its flag.
+        std::atomic_thread_fence(seq_cst);
+        wake(pop_waiting, get_pop_addr());
+    }
+
+    void after_pop() {
+        std::atomic_thread_fence(seq_cst);
+        wake(push_waiting, get_push_addr());
+    }
+
+    static void wake(std::atomic<bool> &flag, const void *addr) {
+        if (flag.load(relaxed) && flag.exchange(false, acq_rel))
+            cancel_sleep_by_addr(addr, 1);
+    }
+
+    /**
+     * @brief Sleep on `addr` until woken up by the other side, `ready` is
+     *        checked after the flag is set to avoid missing the wakeup.
+    */
+    template<typename F>
+    Task<int> wait_for(std::atomic<bool> &flag, const void *addr,
+                       detail::TimedWaitHelper helper, F &&ready) {
+        SleepAwaiter s = sleep(addr, helper);
+        flag.store(true, relaxed);
+        std::atomic_thread_fence(seq_cst);
+
+        if (ready() && flag.exchange(false, acq_rel))
+            cancel_sleep_by_addr(addr, 1);
+
+        int ret = co_await std::move(s);
+        flag.store(false, relaxed);
+        co_return ret;
+    }
+
+    template<typename... Args>
+    Task<int> emplace_impl(detail::TimedWaitHelper helper, Args&&... args) {
+        if (coke::prevent_recursive_stack())
+            co_await coke::yield();
+
+        auto ready = [this]() { return closed() || !full(); };
+
+        while (true) {
+            if (closed())
+                co_return TOP_CLOSED;
+
+            if (do_emplace(std::forward<Args>(args)...)) {
+                after_push();
+                co_return TOP_SUCCESS;
+            }
+
+            if (helper.timeout())
+                co_return TOP_TIMEOUT;
+
+            int ret = co_await wait_for(push_waiting, get_push_addr(),
+                                        helper, ready);
+            if (ret < 0 || ret == SLEEP_ABORTED)
+                co_return ret;
+        }
+    }
+
+    template<typename U>
+    Task<int> pop_impl(detail::TimedWaitHelper helper, U &u) {
+        if (coke::prevent_recursive_stack())
+            co_await coke::yield();
+
+        auto ready = [this]() { return closed() || !empty(); };
+
+        while (true) {
+            if (do_pop(u)) {
+                after_pop();
+                co_return TOP_SUCCESS;
+            }
+
+            if (closed()) {
+                // Elements pushed before close are still popped.
+                if (do_pop(u)) {
+                    after_pop();
+                    co_return TOP_SUCCESS;
+                }
+
+                co_return TOP_CLOSED;
+            }
+
+            if (helper.timeout())
+                co_return TOP_TIMEOUT;
+
+            int ret = co_await wait_for(pop_waiting, get_pop_addr(),
+                                        helper, ready);
+            if (ret < 0 || ret == SLEEP_ABORTED)
+                co_return ret;
+        }
+    }
+
+    const void *get_push_addr() const noexcept {
+        return (const char *)this + 1;
+    }
+
+    const void *get_pop_addr() const noexcept {
+        return (const char *)this + 2;
+    }
+
+private:
+    const SizeType mask;
+    std::unique_ptr<Slot[]> slots;
+    std::atomic<bool> que_closed;
+
+    // Owned by the producer
+    alignas(detail::DESTRUCTIVE_ALIGN) std::atomic<SizeType> tail;
+    SizeType cached_head;
+    std::atomic<bool> push_waiting;
+
+    // Owned by the consumer
+    alignas(detail::DESTRUCTIVE_ALIGN) std::atomic<SizeType> head;
+    SizeType cached_tail;
+    std::atomic<bool> pop_waiting;
+};
+
+} // namespace coke
+
+#endif // COKE_SPSC_QUEUE_H
@@ -0,0 +1,257 @@
+/**
+ * Copyright 2024 Coke Project (https://github.com/kedixa/coke)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Authors: kedixa (https://github.com/kedixa)
+*/
+
+#ifndef COKE_STATIC_DAG_H
+#define COKE_STATIC_DAG_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include "coke/dag.h"
+#include "coke/latch.h"
+#include "coke/task.h"
+
+namespace coke {
+
+/**
+ * @brief An edge of StaticDag, node `to` runs after node `from` is finished.
+*/
+struct StaticDagEdge {
+    dag_index_t from;
+    dag_index_t to;
+};
+
+namespace detail {
+
+/**
+ * @brief Check that the edges of a graph with `N` nodes refer to existing
+ *        nodes, have no self loop or duplicate, and the graph is acyclic.
+*/
+template<std::size_t N, std::size_t M>
+constexpr bool static_dag_check(const std::array<StaticDagEdge, M> &edges) {
+    std::array<dag_index_t, N> in{};
+    std::array<dag_index_t, N> queue{};
+    std::size_t head = 0, tail = 0;
+
+    if (N == 0 || N >= (std::size_t)DAG_INVALID_INDEX)
+        return false;
+
+    for (std::size_t i = 0; i < M; i++) {
+        const StaticDagEdge &e = edges[i];
+        if (e.from >= N || e.to >= N || e.from == e.to)
+            return false;
+
+        for (std::size_t j = 0; j < i; j++) {
+            if (edges[j].from == e.from && edges[j].to == e.to)
+                return false;
+        }
+
+        ++in[e.to];
+    }
+
+    for (std::size_t i = 0; i < N; i++) {
+        if (in[i] == 0)
+            queue[tail++] = (dag_index_t)i;
+    }
+
+    while (head < tail) {
+        dag_index_t id = queue[head++];
+        for (std::size_t i = 0; i < M; i++) {
+            if (edges[i].from == id && --in[edges[i].to] == 0)
+                queue[tail++] = edges[i].to;
+        }
+    }
+
+    return tail == N;
+}
+
+} // namespace detail
+
+
+/**
+ * @brief StaticDag is a DagGraph whose nodes and edges are fixed at compile
+ *        time. The edges are a constexpr std::array<StaticDagEdge, M> and are
+ *        validated by static_assert, the node callables are stored by value
+ *        and invoked without type erasure, and the counters of a run live in
+ *        a fixed-size array of the run's coroutine frame.
+ *
+ * Node `i` is the i-th callable, nodes without predecessors start when the
+ * run starts. Each callable is invoked as `func(data)` if T is not void, or
+ * `func()` otherwise, and returns coke::Task<>. Different runs may proceed
+ * concurrently, and the StaticDag must outlive all of them.
+ *
+ * @tparam T The type of the data shared by the nodes of a run.
+ * @tparam EDGES The edges of the graph.
+ * @tparam FUNCS The types of the node callables.
+*/
+template<typename T, auto EDGES, typename... FUNCS>
+class StaticDag {
+    static constexpr std::size_t N = sizeof...(FUNCS);
+    static constexpr std::size_t M = EDGES.size();
+
+    static_assert(std::is_same_v<std::remove_cv_t<decltype(EDGES)>,
+                                 std::array<StaticDagEdge, M>>,
+                  "EDGES must be a std::array<coke::StaticDagEdge, M>");
+    static_assert(detail::static_dag_check<N>(EDGES),
+                  "Invalid static dag, there is an edge out of range, "
+                  "a self loop, a duplicate edge or a cycle");
+
+    using data_ptr_t = std::add_pointer_t<T>;
+
+    struct Context {
+        explicit Context(data_ptr_t data) : data(data), lt((long)N) {
+            for (std::size_t i = 0; i < N; i++)
+                counts[i].store(in_counts[i], std::memory_order_relaxed);
+        }
+
+        data_ptr_t data;
+        Latch lt;
+        std::array<std::atomic<dag_index_t>, N> counts;
+    };
+
+    using invoker_t = Task<> (*)(StaticDag *, Context &);
+
+    static constexpr std::array<dag_index_t, N> in_counts = [] {
+        std::array<dag_index_t, N> in{};
+        for (const StaticDagEdge &e : EDGES)
+            ++in[e.to];
+        return in;
+    }();
+
+    // Successors of node i are outs[offsets[i]] to outs[offsets[i+1]-1]
+    static constexpr std::array<dag_index_t, N + 1> offsets = [] {
+        std::array<dag_index_t, N + 1> off{};
+        for (const StaticDagEdge &e : EDGES)
+            ++off[e.from + 1];
+        for (std::size_t i = 0; i < N; i++)
+            off[i + 1] += off[i];
+        return off;
+    }();
+
+    static constexpr std::array<dag_index_t, M> outs = [] {
+        std::array<dag_index_t, M> out{};
+        std::array<dag_index_t, N + 1> pos = offsets;
+        for (const StaticDagEdge &e : EDGES)
+            out[pos[e.from]++] = e.to;
+        return out;
+    }();
+
+public:
+    template<typename... Fs>
+        requires (sizeof...(Fs) == N && sizeof...(Fs) > 0)
+    explicit StaticDag(Fs &&...fs) : funcs(std::forward<Fs>(fs)...) { }
+
+    StaticDag(const StaticDag &) = delete;
+    StaticDag &operator= (const StaticDag &) = delete;
+
+    static constexpr std::size_t node_count() noexcept { return N; }
+    static constexpr std::size_t edge_count() noexcept { return M; }
+
+    /**
+     * @brief Run the graph with `data`, the returned Task is finished after
+     *        all the nodes are finished.
+    */
+    template<typename U = T>
+        requires (!std::is_void_v<U> && std::is_same_v<U, T>)
+    Task<> run(U &data) {
+        return run_impl(std::addressof(data));
+    }
+
+    Task<> run() requires std::is_void_v<T> {
+        return run_impl(nullptr);
+    }
+
+private:
+    Task<> run_impl(data_ptr_t data) {
+        Context ctx(data);
+
+        for (std::size_t i = 0; i < N; i++) {
+            if (in_counts[i] == 0)
+                invoke(ctx, (dag_index_t)i).detach();
+        }
+
+        co_await ctx.lt.wait();
+    }
+
+    Task<> invoke(Context &ctx, dag_index_t id) {
+        static constexpr std::array<invoker_t, N> invokers =
+            make_invokers(std::make_index_sequence<N>{});
+
+        while (id != DAG_INVALID_INDEX) {
+            co_await invokers[id](this, ctx);
+
+            dag_index_t next = DAG_INVALID_INDEX;
+            for (dag_index_t i = offsets[id]; i < offsets[id + 1]; i++) {
+                dag_index_t x = outs[i];
+                if (ctx.counts[x].fetch_sub(1, std::memory_order_acq_rel) != 1)
+                    continue;
+
+                // Continue with the first ready successor in this coroutine
+                if (next == DAG_INVALID_INDEX)
+                    next = x;
+                else
+                    invoke(ctx, x).detach();
+            }
+
+            // The latch cannot reach zero while `next` is not finished, ctx
+            // is not touched after the last count down.
+            ctx.lt.count_down();
+            id = next;
+        }
+    }
+
+    template<std::size_t I>
+    static Task<> invoke_node(StaticDag *dag, Context &ctx) {
+        auto &func = std::get<I>(dag->funcs);
+
+        if constexpr (std::is_void_v<T>)
+            return func();
+        else
+            return func(*ctx.data);
+    }
+
+    template<std::size_t... Is>
+    static constexpr std::array<invoker_t, N>
+    make_invokers(std::index_sequence<Is...>) {
+        return {&StaticDag::invoke_node<Is>...};
+    }
+
+private:
+    std::tuple<FUNCS...> funcs;
+};
+
+/**
+ * @brief Create a StaticDag with the constexpr `EDGES` and the node callables.
+ *
+ * @tparam T Type of the data shared by the nodes, may be void.
+ * @tparam EDGES A constexpr std::array<coke::StaticDagEdge, M>.
+ * @return The StaticDag, which is neither copyable nor movable and is returned
+ *         by guaranteed copy elision.
+*/
+template<typename T, auto EDGES, typename... Fs>
+auto make_static_dag(Fs &&...fs) {
+    return StaticDag<T, EDGES, std::decay_t<Fs>...>(std::forward<Fs>(fs)...);
+}
+
+} // namespace coke
+
+#endif // COKE_STATIC_DAG_H
@@ -20,14 +20,44 @@
 #define COKE_STOP_TOKEN_H
 
 #include <atomic>
+#include <cstdint>
+#include <functional>
+#include <thread>
+#include <type_traits>
+#include <utility>
 
-#include "coke/detail/mutex_table.h"
 #include "coke/task.h"
 #include "coke/sleep.h"
 
 namespace coke {
 
+class StopToken;
+
+namespace detail {
+
+/**
+ * @brief The node of the callbacks registered on StopToken, see StopCallback.
+*/
+struct StopCallbackNode {
+    using RunFunc = void (*)(StopCallbackNode *) noexcept;
+
+    explicit StopCallbackNode(RunFunc run) noexcept : run(run) { }
+
+    StopCallbackNode *prev{nullptr};
+    StopCallbackNode *next{nullptr};
+    RunFunc run;
+
+    // Set by the destructor when it is called inside the callback itself.
+    bool *removed{nullptr};
+    std::atomic<bool> finished{false};
+};
+
+} // namespace detail
+
 class StopToken final {
+    static constexpr uint32_t STOP_BIT = 1;
+    static constexpr uint32_t LOCK_BIT = 2;
+
 public:
     /**
      * @brief Create a StopToken.
@@ -36,7 +66,7 @@ public:
      *        of stop token become finished.
     */
     explicit StopToken(std::size_t cnt = 1) noexcept
-        : mtx(detail::get_mutex(this)), n(cnt), should_stop(false)
+        : n(cnt), state(0), head(nullptr), running(nullptr)
     { }
 
     StopToken(const StopToken &) = delete;
@@ -49,25 +79,25 @@ public:
      * @pre The previous process has ended normally.
     */
     void reset(std::size_t cnt) noexcept {
-        n = cnt;
-        should_stop.store(false, std::memory_order_relaxed);
+        n.store(cnt, std::memory_order_relaxed);
+        state.fetch_and(~STOP_BIT, std::memory_order_relaxed);
     }
 
     /**
-     * @brief Request the coroutine working with this stop token to stop.
+     * @brief Request the coroutine working with this stop token to stop, the
+     *        registered StopCallbacks are invoked in this thread before it
+     *        returns. Only the first call takes effect.
+     *
+     * @return Whether this call is the first one that requests stop.
      * @post stop_requested() will returns true.
     */
-    void request_stop() {
-        std::lock_guard<std::mutex> lg(mtx);
-        should_stop.store(true, std::memory_order_release);
-        cancel_sleep_by_addr(get_stop_addr());
-    }
+    bool request_stop();
 
     /**
      * @brief Return whether stop is requested.
     */
     bool stop_requested() const noexcept {
-        return should_stop.load(std::memory_order_acquire);
+        return state.load(std::memory_order_acquire) & STOP_BIT;
     }
 
     /**
@@ -75,17 +105,25 @@ public:
      *        that is waiting for finish.
     */
     void set_finished() {
-        std::lock_guard<std::mutex> lg(mtx);
-        if (n > 0 && --n == 0)
-            cancel_sleep_by_addr(get_finish_addr());
+        std::size_t cnt = n.load(std::memory_order_relaxed);
+
+        while (cnt > 0) {
+            if (n.compare_exchange_weak(cnt, cnt - 1,
+                                        std::memory_order_acq_rel,
+                                        std::memory_order_relaxed))
+            {
+                if (cnt == 1)
+                    cancel_sleep_by_addr(get_finish_addr());
+                break;
+            }
+        }
     }
 
     /**
      * @brief Return whether set_finished() has been called `n` times.
     */
-    bool finished() const {
-        std::lock_guard<std::mutex> lg(mtx);
-        return n == 0;
+    bool finished() const noexcept {
+        return n.load(std::memory_order_acquire) == 0;
     }
 
     /**
@@ -103,6 +141,22 @@ public:
         return wait_finish_impl(detail::TimedWaitHelper{nsec});
     }
 
+    /**
+     * @brief Wait until finish or `deadline`.
+     * @return Whether it is finished.
+    */
+    Task<bool> wait_finish_until(SteadyTimePoint deadline) {
+        return wait_finish_impl(detail::TimedWaitHelper{deadline});
+    }
+
+    /**
+     * @brief Wait until stop requested.
+     * @return Whether stop is requested, false only when process exit.
+    */
+    Task<bool> wait_stop() {
+        return wait_stop_impl(detail::TimedWaitHelper{});
+    }
+
     /**
      * @brief Wait until stop requested or timeout.
      * @return Whether stop is requested.
@@ -111,6 +165,14 @@ public:
         return wait_stop_impl(detail::TimedWaitHelper{nsec});
     }
 
+    /**
+     * @brief Wait until stop requested or `deadline`.
+     * @return Whether stop is requested.
+    */
+    Task<bool> wait_stop_until(SteadyTimePoint deadline) {
+        return wait_stop_impl(detail::TimedWaitHelper{deadline});
+    }
+
     struct FinishGuard {
         explicit FinishGuard(StopToken *sptr = nullptr) noexcept
             : ptr(sptr)
@@ -136,6 +198,24 @@ private:
 
     Task<bool> wait_stop_impl(detail::TimedWaitHelper helper);
 
+    /**
+     * @brief Add `node` to the callback list, return false without adding it
+     *        if stop is already requested.
+    */
+    bool add_callback(detail::StopCallbackNode *node) noexcept;
+
+    /**
+     * @brief Remove `node` from the callback list, if it is running in
+     *        another thread, wait for it to finish.
+    */
+    void remove_callback(detail::StopCallbackNode *node) noexcept;
+
+    uint32_t lock_list() noexcept;
+
+    void unlock_list() noexcept {
+        state.fetch_and(~LOCK_BIT, std::memory_order_release);
+    }
+
     const void *get_stop_addr() const noexcept {
         return (const char *)this + 1;
     }
@@ -144,12 +224,66 @@ private:
         return (const char *)this + 2;
     }
 
+    template<typename F>
+    friend class StopCallback;
+
 private:
-    std::mutex &mtx;
-    std::size_t n;
-    std::atomic<bool> should_stop;
+    std::atomic<std::size_t> n;
+
+    // STOP_BIT, and LOCK_BIT which protects the callback list
+    std::atomic<uint32_t> state;
+
+    detail::StopCallbackNode *head;
+    detail::StopCallbackNode *running;
+    std::thread::id running_tid;
 };
 
+/**
+ * @brief StopCallback registers `func` on a StopToken like std::stop_callback,
+ *        it is invoked by the first request_stop(), or immediately in the
+ *        constructor if stop is already requested. The destructor removes it,
+ *        and waits for it if it is running in another thread, so `func` is
+ *        never invoked after StopCallback is destroyed.
+ *
+ * `func` should be short and must not throw, for example wake up a waiting
+ * coroutine. The StopToken must outlive the StopCallback.
+*/
+template<typename F>
+class [[nodiscard]] StopCallback final : private detail::StopCallbackNode {
+public:
+    template<typename U>
+        requires std::constructible_from<F, U&&>
+    explicit StopCallback(StopToken &token, U &&func)
+        : detail::StopCallbackNode(&StopCallback::invoke),
+          token(&token), func(std::forward<U>(func))
+    {
+        if (!token.add_callback(this)) {
+            this->token = nullptr;
+            std::invoke(this->func);
+        }
+    }
+
+    StopCallback(const StopCallback &) = delete;
+    StopCallback &operator= (const StopCallback &) = delete;
+
+    ~StopCallback() {
+        if (token)
+            token->remove_callback(this);
+    }
+
+private:
+    static void invoke(detail::StopCallbackNode *node) noexcept {
+        std::invoke(static_cast<StopCallback *>(node)->func);
+    }
+
+private:
+    StopToken *token;
+    F func;
+};
+
+template<typename F>
+StopCallback(StopToken &, F) -> StopCallback<F>;
+
 } // namespace coke
 
 #endif // COKE_STOP_TOKEN_H
@@ -19,6 +19,8 @@
 #ifndef COKE_TASK_H
 #define COKE_TASK_H
 
+#include <cstddef>
+
 #include "coke/detail/task_impl.h"
 
 namespace coke {
@@ -47,6 +49,46 @@ void detach(Task<T> &&task) {
     task.detach();
 }
 
+/**
+ * @brief Get the local context of the current coroutine, which is a raw
+ *        pointer such as a request context holding the trace id, deadline
+ *        and tenant of the request.
+ *
+ * A coke::Task co awaited by a coroutine inherits the local context of the
+ * coroutine when it is started, unless it has one already, so the context is
+ * visible to all the nested coroutines without passing it as an argument.
+ * The async_wait family and when_any propagate it to the tasks they start
+ * too, but a detached coroutine starts without local context unless it is
+ * set by Task::set_local_context. The pointer is neither owned nor reference
+ * counted, the object must be alive until all the coroutines using it end.
+ *
+ *  RequestCtx *ctx = co_await coke::current_local_context<RequestCtx>();
+ *
+ * @return A pointer to T, or nullptr if there is no local context.
+*/
+template<typename T = void>
+detail::LocalContextAwaiter<T> current_local_context() noexcept {
+    return detail::LocalContextAwaiter<T>();
+}
+
+/**
+ * @brief Set the local context of the current coroutine, the coroutines it
+ *        co awaits afterwards inherit `ctx`. The coroutines that awaited it
+ *        are not affected.
+ *
+ * @return The previous local context, so that it can be restored later.
+*/
+template<typename T>
+detail::LocalContextAwaiter<T> set_local_context(T *ctx) noexcept {
+    void *p = const_cast<void *>(static_cast<const void *>(ctx));
+    return detail::LocalContextAwaiter<T>(p);
+}
+
+inline detail::LocalContextAwaiter<void>
+set_local_context(std::nullptr_t) noexcept {
+    return detail::LocalContextAwaiter<void>(nullptr);
+}
+
 } // namespace coke
 
 #endif // COKE_TASK_H
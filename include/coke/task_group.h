@@ -0,0 +1,134 @@
+/**
+ * Copyright 2024 Coke Project (https://github.com/kedixa/coke)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Authors: kedixa (https://github.com/kedixa)
+*/
+
+#ifndef COKE_TASK_GROUP_H
+#define COKE_TASK_GROUP_H
+
+#include <exception>
+#include <mutex>
+
+#include "coke/stop_token.h"
+#include "coke/task.h"
+#include "coke/wait_group.h"
+
+namespace coke {
+
+/**
+ * @brief TaskGroup owns a set of coroutines started by spawn(), they share a
+ *        StopToken and can be joined with a single co_await join().
+ *
+ * Children are started in detached mode without creating a series in
+ * advance, the series is created only when a child first awaits a task, so
+ * that spawning is cheaper than detach_on_new_series. All the bookkeeping is
+ * stored in the TaskGroup itself, no allocation is needed except the frame of
+ * each child.
+*/
+class TaskGroup final {
+public:
+    TaskGroup() noexcept : token(0) { }
+
+    /**
+     * @brief TaskGroup is neither copyable nor movable.
+    */
+    TaskGroup(const TaskGroup &) = delete;
+    TaskGroup &operator= (const TaskGroup &) = delete;
+
+    /**
+     * @pre All the spawned children are finished, i.e. join() returned.
+    */
+    ~TaskGroup() = default;
+
+    /**
+     * @brief Start `task` as a child of this group.
+     *
+     * If the child throws an exception, stop is requested for the whole
+     * group, and the first exception will be rethrown by join().
+    */
+    template<Cokeable T>
+    void spawn(Task<T> &&task) {
+        wg.add(1);
+        child_helper(std::move(task), this).detach();
+    }
+
+    /**
+     * @brief Request all the children to stop, children should check it by
+     *        stop_requested() or get_stop_token().
+    */
+    void request_stop() { token.request_stop(); }
+
+    /**
+     * @brief Return whether stop is requested.
+    */
+    bool stop_requested() const noexcept { return token.stop_requested(); }
+
+    /**
+     * @brief Get the StopToken shared by all the children, it can be used to
+     *        wait for stop, for example `token.wait_stop_for(nsec)`.
+    */
+    StopToken &get_stop_token() noexcept { return token; }
+
+    /**
+     * @brief Wait for all the children spawned before to finish.
+     * @return coke::Task<void>, it rethrows the first exception of children.
+    */
+    Task<> join() {
+        co_await wg.wait();
+
+        std::exception_ptr e;
+        {
+            std::lock_guard<std::mutex> lg(mtx);
+            e = std::exchange(eptr, nullptr);
+        }
+
+        if (e)
+            std::rethrow_exception(e);
+    }
+
+private:
+    void set_exception(std::exception_ptr e) {
+        {
+            std::lock_guard<std::mutex> lg(mtx);
+            if (!eptr)
+                eptr = e;
+        }
+
+        token.request_stop();
+    }
+
+    template<Cokeable T>
+    static Task<> child_helper(Task<T> task, TaskGroup *group) {
+        coke_try {
+            co_await std::move(task);
+        }
+        coke_catch (...) {
+            group->set_exception(std::current_exception());
+        }
+
+        group->wg.done();
+    }
+
+private:
+    StopToken token;
+    WaitGroup wg;
+    std::mutex mtx;
+    std::exception_ptr eptr;
+};
+
+} // namespace coke
+
+#endif // COKE_TASK_GROUP_H
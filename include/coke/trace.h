@@ -0,0 +1,86 @@
+/**
+ * Copyright 2024 Coke Project (https://github.com/kedixa/coke)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Authors: kedixa (https://github.com/kedixa)
+*/
+
+#ifndef COKE_TRACE_H
+#define COKE_TRACE_H
+
+#include <cstddef>
+#include <ostream>
+
+/**
+ * Coroutine level tracing. When COKE_ENABLE_TRACE is defined, each awaiter
+ * derived from coke::AwaiterBase records a suspend event when it is awaited
+ * and a resume event when it is done, into a lock free ring buffer of the
+ * calling thread. When it is not defined, the hooks compile to nothing.
+ *
+ * The type name of awaiter is obtained by typeid, so RTTI is required when
+ * tracing is enabled.
+*/
+
+namespace coke {
+
+/**
+ * @brief Export all the recorded events to `os` in Chrome trace event format,
+ *        which can be loaded by chrome://tracing or https://ui.perfetto.dev.
+ *
+ * Each awaiter is exported as an async slice from suspend to resume. The ring
+ * buffers are written without lock, export them after the traced workload
+ * finished, otherwise some events may be inconsistent.
+*/
+void trace_export_chrome(std::ostream &os);
+
+/**
+ * @brief Discard all the recorded events.
+ * @pre No event is being recorded concurrently.
+*/
+void trace_clear();
+
+namespace detail {
+
+enum TracePhase : char {
+    TRACE_SUSPEND = 'b',
+    TRACE_RESUME = 'e',
+};
+
+/**
+ * @brief Record an event of `awaiter` into the ring buffer of current thread.
+ * @param name Type name of the awaiter, must be a static string.
+*/
+void trace_record(TracePhase phase, const void *awaiter,
+                  const char *name) noexcept;
+
+} // namespace detail
+
+} // namespace coke
+
+#ifdef COKE_ENABLE_TRACE
+#include <typeinfo>
+
+#define COKE_TRACE_SUSPEND(awaiter)                             \
+    ::coke::detail::trace_record(::coke::detail::TRACE_SUSPEND, \
+                                 (awaiter), typeid(*(awaiter)).name())
+
+#define COKE_TRACE_RESUME(awaiter)                              \
+    ::coke::detail::trace_record(::coke::detail::TRACE_RESUME,  \
+                                 (awaiter), typeid(*(awaiter)).name())
+#else
+#define COKE_TRACE_SUSPEND(awaiter) ((void)0)
+#define COKE_TRACE_RESUME(awaiter) ((void)0)
+#endif // COKE_ENABLE_TRACE
+
+#endif // COKE_TRACE_H
@@ -170,6 +170,122 @@ auto async_wait(std::vector<A> &&as) {
     return detail::async_wait_helper(std::move(tasks));
 }
 
+/**
+ * @brief Async wait for a vector of coke::Task<T> like async_wait, but the
+ *        children are awaited by lightweight coroutines which count down a
+ *        single atomic counter, and the last one to finish resumes the caller
+ *        directly instead of waking it up through a latch. It is cheaper for
+ *        fan-outs of small tasks.
+ *
+ * While waiting, a small task is parked in the caller's series, so the series
+ * is kept alive and the caller goes on with it after all the children finish.
+ * A child only creates its own series when it starts a workflow task.
+ * @return std::vector<T> if T is not void, else void.
+*/
+template<Cokeable T>
+auto when_all(std::vector<Task<T>> &&tasks) {
+    return detail::when_all_helper(std::move(tasks));
+}
+
+/**
+ * @brief Same as when_all for a vector, with a constant number of tasks.
+*/
+template<Cokeable T, Cokeable... Ts>
+    requires (std::conjunction_v<std::is_same<T, Ts>...>)
+auto when_all(Task<T> &&first, Task<Ts>&&... others)
+    -> Task<typename detail::MValueHelper<T>::RetType>
+{
+    std::vector<Task<T>> tasks;
+    tasks.reserve(sizeof...(Ts) + 1);
+    tasks.emplace_back(std::move(first));
+    (tasks.emplace_back(std::move(others)), ...);
+
+    return detail::when_all_helper(std::move(tasks));
+}
+
+/**
+ * @brief Async wait for a vector of coke::Task<T>, but at most `max_inflight`
+ *        of them are running at the same time. When one of them finishes, the
+ *        next one is started.
+ * @param tasks The tasks to be waited.
+ * @param max_inflight Max number of running tasks, 0 is treated as 1.
+ * @return std::vector<T> if T is not void, else void.
+*/
+template<Cokeable T>
+auto async_wait_n(std::vector<Task<T>> &&tasks, std::size_t max_inflight) {
+    return detail::async_wait_n_helper(std::move(tasks), max_inflight);
+}
+
+/**
+ * @brief Call `func(elem)` for each element of `range`, and async wait for the
+ *        returned coke::Task. At most `concurrency` tasks are running at the
+ *        same time, and the coroutine is created only when it can be started,
+ *        so the memory usage is bounded even for a large range.
+ * @param range The range must be alive until the returned task finishes.
+ * @param func Callable object returns coke::Task, the return value is ignored.
+ * @param concurrency Max number of running tasks, 0 is treated as 1.
+ * @return coke::Task<void>.
+*/
+template<std::ranges::input_range R, typename F>
+    requires is_task_v<std::invoke_result_t<F&, std::ranges::range_reference_t<R>>>
+auto async_for_each(R &range, F &&func, std::size_t concurrency) -> Task<> {
+    return detail::async_for_each_helper(range, std::forward<F>(func),
+                                         concurrency);
+}
+
+/**
+ * @brief Async wait until the first of `tasks` completes.
+ *
+ * The remaining tasks keep running in the background, their results are
+ * discarded. If `token` is not nullptr, token->request_stop() is called after
+ * the first task completes, so that the others can check it and bail out.
+ *
+ * @param tasks A non-empty vector of coke::Task<T>.
+ * @param token Optional stop token shared by the tasks, it must outlive all
+ *        of them, for example by waiting token->wait_finish() later.
+ * @return coke::Task<coke::WhenAnyResult<T>>.
+ * @pre tasks is not empty.
+*/
+template<Cokeable T>
+auto when_any(std::vector<Task<T>> &&tasks, StopToken *token = nullptr) {
+    return detail::when_any_helper(std::move(tasks), token);
+}
+
+/**
+ * @brief Async wait until the first of a constant number of coke::Task<T>
+ *        completes, see the vector version above.
+*/
+template<Cokeable T, Cokeable... Ts>
+    requires (std::conjunction_v<std::is_same<T, Ts>...>)
+auto when_any(Task<T> &&first, Task<Ts>&&... others)
+    -> Task<WhenAnyResult<T>>
+{
+    std::vector<Task<T>> tasks;
+    tasks.reserve(sizeof...(Ts) + 1);
+    tasks.emplace_back(std::move(first));
+    (tasks.emplace_back(std::move(others)), ...);
+
+    return detail::when_any_helper(std::move(tasks), nullptr);
+}
+
+/**
+ * @brief Same as above, and token->request_stop() is called after the first
+ *        task completes, see the vector version. The token is placed first
+ *        because it cannot follow the parameter pack.
+*/
+template<Cokeable T, Cokeable... Ts>
+    requires (std::conjunction_v<std::is_same<T, Ts>...>)
+auto when_any(StopToken *token, Task<T> &&first, Task<Ts>&&... others)
+    -> Task<WhenAnyResult<T>>
+{
+    std::vector<Task<T>> tasks;
+    tasks.reserve(sizeof...(Ts) + 1);
+    tasks.emplace_back(std::move(first));
+    (tasks.emplace_back(std::move(others)), ...);
+
+    return detail::when_any_helper(std::move(tasks), token);
+}
+
 /**
  * @brief Make task func(args...) and sync wait.
 */
@@ -38,7 +38,7 @@ public:
     /**
      * @brief Create an empty WaitGroup.
      */
-    WaitGroup() noexcept : count(0) { }
+    WaitGroup() noexcept : state(0) { }
 
     /**
      * @brief WaitGroup is neither copyable nor movable.
@@ -55,16 +55,27 @@ public:
      * The number of calls to done must match the sum of n in add.
      */
     void add(long n) noexcept {
-        count.fetch_add(n, std::memory_order_relaxed);
+        state.fetch_add(n * COUNT_ONE, std::memory_order_relaxed);
     }
 
     /**
      * @brief Notify that one count is complete.
      */
     void done() {
-        if (count.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        long s = state.load(std::memory_order_relaxed);
+        long t;
+
+        // The last one clears the WAITING bit for the next round of use
+        do {
+            t = s - COUNT_ONE;
+            if (t / COUNT_ONE == 0)
+                t = 0;
+        } while (!state.compare_exchange_weak(s, t, std::memory_order_acq_rel,
+                                              std::memory_order_relaxed));
+
+        // Touch the sleep map only when reaching zero and anyone is waiting
+        if (t == 0 && (s & WAITING))
             cancel_sleep_by_addr(get_addr());
-        }
     }
 
     /**
@@ -77,7 +88,9 @@ public:
         if (c > 0) {
             a = sleep(get_addr(), inf_dur);
 
-            if (load_count() <= 0)
+            // Either the last done sees the bit, or the count is seen here
+            c = state.fetch_or(WAITING, std::memory_order_acq_rel) / COUNT_ONE;
+            if (c <= 0)
                 cancel_sleep_by_addr(get_addr());
         }
 
@@ -85,16 +98,21 @@ public:
     }
 
 private:
+    // The lowest bit of `state` is set when anyone is waiting, and the others
+    // are the count.
+    static constexpr long WAITING = 1;
+    static constexpr long COUNT_ONE = 2;
+
     const void *get_addr() {
         return (const char *)this + 1;
     }
 
     long load_count() {
-        return count.load(std::memory_order_acquire);
+        return state.load(std::memory_order_acquire) / COUNT_ONE;
     }
 
 private:
-    std::atomic<long> count;
+    std::atomic<long> state;
 };
 
 }
@@ -0,0 +1,206 @@
+/**
+ * Copyright 2024 Coke Project (https://github.com/kedixa/coke)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Authors: kedixa (https://github.com/kedixa)
+*/
+
+#ifndef COKE_WORK_STEAL_DEQUE_H
+#define COKE_WORK_STEAL_DEQUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <type_traits>
+#include <vector>
+
+#include "coke/detail/constant.h"
+
+namespace coke {
+
+/**
+ * @brief WorkStealDeque is a Chase-Lev work stealing deque. The owner pushes
+ *        and pops at the bottom without locking, the thieves in other threads
+ *        steal from the top with one CAS, so that each worker of a scheduler
+ *        can keep its own deque and balance load without a central queue.
+ *
+ * The slots are accessed by atomic operations, so T must be trivially
+ * copyable, such as a pointer to a job. The array grows when it is full, and
+ * the old arrays are freed when the deque is destroyed, because a thief may
+ * still be reading them.
+ *
+ * Unlike the other containers, it never waits. The owner decides what to do
+ * when nothing can be popped or stolen.
+ *
+ * @pre Only one thread (the owner) calls push and pop at the same time.
+*/
+template<typename T>
+    requires std::is_trivially_copyable_v<T>
+class WorkStealDeque {
+    using IndexType = int64_t;
+
+    struct Array {
+        explicit Array(std::size_t cap)
+            : mask(cap - 1), slots(new std::atomic<T>[cap])
+        { }
+
+        std::size_t capacity() const noexcept { return mask + 1; }
+
+        T get(IndexType i) const noexcept {
+            return slots[(std::size_t)i & mask].load(std::memory_order_relaxed);
+        }
+
+        void put(IndexType i, T x) noexcept {
+            slots[(std::size_t)i & mask].store(x, std::memory_order_relaxed);
+        }
+
+        std::size_t mask;
+        std::unique_ptr<std::atomic<T>[]> slots;
+    };
+
+public:
+    /**
+     * @brief Create a WorkStealDeque.
+     *
+     * @param init_cap Initial capacity, rounded up to a power of 2.
+    */
+    explicit WorkStealDeque(std::size_t init_cap = 64)
+        : top(0), bottom(0)
+    {
+        std::size_t cap = 1;
+        while (cap < init_cap)
+            cap <<= 1;
+
+        arrays.push_back(std::make_unique<Array>(cap));
+        array.store(arrays.back().get(), std::memory_order_relaxed);
+    }
+
+    WorkStealDeque(const WorkStealDeque &) = delete;
+    WorkStealDeque &operator= (const WorkStealDeque &) = delete;
+
+    ~WorkStealDeque() = default;
+
+    /**
+     * @brief Get the number of elements, it may be inaccurate when other
+     *        threads are stealing.
+    */
+    std::size_t size() const noexcept {
+        IndexType b = bottom.load(std::memory_order_relaxed);
+        IndexType t = top.load(std::memory_order_relaxed);
+        return (b > t) ? (std::size_t)(b - t) : 0;
+    }
+
+    bool empty() const noexcept { return size() == 0; }
+
+    /**
+     * @brief Push `x` at the bottom, can only be called by the owner.
+    */
+    void push(T x) {
+        IndexType b = bottom.load(std::memory_order_relaxed);
+        IndexType t = top.load(std::memory_order_acquire);
+        Array *a = array.load(std::memory_order_relaxed);
+
+        if (b - t > (IndexType)a->capacity() - 1)
+            a = grow(a, t, b);
+
+        a->put(b, x);
+        std::atomic_thread_fence(std::memory_order_release);
+        bottom.store(b + 1, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Pop the element at the bottom, the last pushed one, can only be
+     *        called by the owner.
+     *
+     * @return The element, or std::nullopt if empty.
+    */
+    std::optional<T> pop() noexcept {
+        IndexType b = bottom.load(std::memory_order_relaxed) - 1;
+        Array *a = array.load(std::memory_order_relaxed);
+
+        bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        IndexType t = top.load(std::memory_order_relaxed);
+
+        if (t > b) {
+            bottom.store(b + 1, std::memory_order_relaxed);
+            return std::nullopt;
+        }
+
+        T x = a->get(b);
+        if (t < b)
+            return x;
+
+        // The last element, race with the thieves.
+        bool succ = top.compare_exchange_strong(t, t + 1,
+                                                std::memory_order_seq_cst,
+                                                std::memory_order_relaxed);
+        bottom.store(b + 1, std::memory_order_relaxed);
+
+        if (succ)
+            return x;
+        return std::nullopt;
+    }
+
+    /**
+     * @brief Steal the element at the top, the first pushed one, can be
+     *        called by any thread.
+     *
+     * @return The element, or std::nullopt if empty or lost the race with
+     *         others, the caller may try again or try another deque.
+    */
+    std::optional<T> steal() noexcept {
+        IndexType t = top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        IndexType b = bottom.load(std::memory_order_acquire);
+
+        if (t >= b)
+            return std::nullopt;
+
+        Array *a = array.load(std::memory_order_acquire);
+        T x = a->get(t);
+
+        if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                         std::memory_order_relaxed))
+            return std::nullopt;
+
+        return x;
+    }
+
+private:
+    Array *grow(Array *a, IndexType t, IndexType b) {
+        arrays.push_back(std::make_unique<Array>(a->capacity() * 2));
+        Array *na = arrays.back().get();
+
+        for (IndexType i = t; i < b; i++)
+            na->put(i, a->get(i));
+
+        array.store(na, std::memory_order_release);
+        return na;
+    }
+
+private:
+    alignas(detail::DESTRUCTIVE_ALIGN) std::atomic<IndexType> top;
+    alignas(detail::DESTRUCTIVE_ALIGN) std::atomic<IndexType> bottom;
+    std::atomic<Array *> array;
+
+    // All the arrays ever used, only touched by the owner.
+    std::vector<std::unique_ptr<Array>> arrays;
+};
+
+} // namespace coke
+
+#endif // COKE_WORK_STEAL_DEQUE_H
@@ -0,0 +1,113 @@
+/**
+ * Copyright 2024 Coke Project (https://github.com/kedixa/coke)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Authors: kedixa (https://github.com/kedixa)
+*/
+
+#include <chrono>
+
+#include "coke/net/admission.h"
+#include "coke/global.h"
+
+namespace coke {
+
+static int64_t steady_now_ms() {
+    using namespace std::chrono;
+    auto now = steady_clock::now().time_since_epoch();
+    return duration_cast<milliseconds>(now).count();
+}
+
+AdmissionController::AdmissionController(const AdmissionParams &params)
+    : params(params),
+      sem(static_cast<Semaphore::CountType>(params.max_inflight))
+{ }
+
+AdmissionController::Decision AdmissionController::try_admit() noexcept {
+    if (sem.try_acquire()) {
+        // Nobody is waiting, the queue is drained
+        if (shedding.load(std::memory_order_relaxed))
+            update_sojourn(0, 0);
+
+        inflight.fetch_add(1, std::memory_order_relaxed);
+        admitted.fetch_add(1, std::memory_order_relaxed);
+        return ADMIT_NOW;
+    }
+
+    if (!shedding.load(std::memory_order_relaxed)) {
+        uint64_t n = queued.fetch_add(1, std::memory_order_relaxed);
+        if (n < params.max_queue)
+            return ADMIT_QUEUE;
+
+        queued.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    rejected.fetch_add(1, std::memory_order_relaxed);
+    return ADMIT_REJECT;
+}
+
+Task<bool> AdmissionController::wait_admit() {
+    auto timeout = std::chrono::milliseconds(params.queue_timeout);
+    int64_t start = steady_now_ms();
+
+    int ret = co_await sem.try_acquire_for(timeout);
+    int64_t now = steady_now_ms();
+
+    queued.fetch_sub(1, std::memory_order_relaxed);
+    update_sojourn(now - start, now);
+
+    if (ret != TOP_SUCCESS) {
+        queue_timeouts.fetch_add(1, std::memory_order_relaxed);
+        co_return false;
+    }
+
+    inflight.fetch_add(1, std::memory_order_relaxed);
+    admitted_after_queue.fetch_add(1, std::memory_order_relaxed);
+    co_return true;
+}
+
+void AdmissionController::release() noexcept {
+    inflight.fetch_sub(1, std::memory_order_relaxed);
+    sem.release();
+}
+
+void AdmissionController::update_sojourn(int64_t sojourn_ms,
+                                         int64_t now_ms) noexcept {
+    std::lock_guard<std::mutex> lg(mtx);
+
+    if (sojourn_ms < params.queue_target) {
+        first_above = 0;
+        shedding.store(false, std::memory_order_relaxed);
+    }
+    else if (first_above == 0)
+        first_above = now_ms + params.queue_interval;
+    else if (now_ms >= first_above)
+        shedding.store(true, std::memory_order_relaxed);
+}
+
+AdmissionStats AdmissionController::get_stats() const noexcept {
+    AdmissionStats stats;
+
+    stats.inflight = inflight.load(std::memory_order_relaxed);
+    stats.queued = queued.load(std::memory_order_relaxed);
+    stats.admitted = admitted.load(std::memory_order_relaxed);
+    stats.admitted_after_queue =
+        admitted_after_queue.load(std::memory_order_relaxed);
+    stats.rejected = rejected.load(std::memory_order_relaxed);
+    stats.queue_timeouts = queue_timeouts.load(std::memory_order_relaxed);
+    stats.shedding = shedding.load(std::memory_order_relaxed);
+    return stats;
+}
+
+} // namespace coke
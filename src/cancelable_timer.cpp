@@ -17,15 +17,18 @@
 */
 
 #include <atomic>
+#include <chrono>
 #include <cstdint>
-#include <list>
+#include <memory>
 #include <mutex>
-#include <map>
 #include <new>
-#include <string_view>
+#include <vector>
 
 #include "coke/detail/constant.h"
+#include "coke/detail/exception_config.h"
+#include "coke/detail/shard_config.h"
 #include "coke/detail/timer_task.h"
+#include "coke/sleep.h"
 #include "coke/sync_guard.h"
 #include "workflow/WFTask.h" // WFT_STATE_XXX
 #include "workflow/WFGlobal.h"
@@ -34,24 +37,80 @@ namespace coke::detail {
 
 class CancelInterface;
 
+static std::atomic<bool> lock_timing_enabled{false};
+
+/**
+ * All the timers with the same uid are linked into an intrusive list, the
+ * list nodes are embedded in CancelInterface, so adding a timer into the map
+ * does not allocate memory.
+*/
+struct TimerList {
+    uint64_t uid;
+    CancelInterface *head;
+    CancelInterface *tail;
+    std::size_t size;
+};
+
+/**
+ * CancelableTimerMap is an open addressing hash table with linear probing,
+ * keyed by uid. The slots do not have stable addresses, timers only remember
+ * their uid and look up the list again when they leave the map.
+*/
 class alignas(DESTRUCTIVE_ALIGN) CancelableTimerMap {
+    struct Shards {
+        Shards() : mask(get_timer_map_shards() - 1),
+                   maps(new CancelableTimerMap[mask + 1])
+        { }
+
+        std::size_t mask;
+        std::unique_ptr<CancelableTimerMap[]> maps;
+    };
+
+    static Shards &uid_shards() {
+        static Shards s;
+        return s;
+    }
+
+    static Shards &addr_shards() {
+        static Shards s;
+        return s;
+    }
+
 public:
     static CancelableTimerMap *get_uid_instance(uint64_t uid) {
-        static CancelableTimerMap m[CANCELABLE_MAP_SIZE];
-        return m + uid % CANCELABLE_MAP_SIZE;
+        Shards &s = uid_shards();
+        return s.maps.get() + (uid & s.mask);
     }
 
     static CancelableTimerMap *get_addr_instance(std::size_t key) {
-        static CancelableTimerMap m[CANCELABLE_MAP_SIZE];
-        return m + key % CANCELABLE_MAP_SIZE;
+        Shards &s = addr_shards();
+        return s.maps.get() + (key & s.mask);
     }
 
-public:
-    using List = std::list<CancelInterface *>;
-    using ListIter = List::iterator;
-    using Map = std::map<uint64_t, List>;
-    using MapIter = Map::iterator;
+    static std::vector<TimerMapStats> get_stats(bool by_addr) {
+        Shards &s = by_addr ? addr_shards() : uid_shards();
+        std::vector<TimerMapStats> stats(s.mask + 1);
+
+        for (std::size_t i = 0; i <= s.mask; i++) {
+            constexpr auto relaxed = std::memory_order_relaxed;
+            const CancelableTimerMap &m = s.maps[i];
+            TimerMapStats &st = stats[i];
 
+            st.lock_count = m.lock_count.load(relaxed);
+            st.contended_count = m.contended_count.load(relaxed);
+            st.live_timers = m.live_timers.load(relaxed);
+            st.add_count = m.add_count.load(relaxed);
+            st.cancel_count = m.cancel_count.load(relaxed);
+            st.expire_count = m.expire_count.load(relaxed);
+
+            for (std::size_t j = 0; j < TimerMapStats::LOCK_WAIT_BUCKETS; j++)
+                st.lock_wait_hist[j] = m.lock_wait_hist[j].load(relaxed);
+        }
+
+        return stats;
+    }
+
+public:
     CancelableTimerMap() = default;
 
     // It is bad behavior if there are still unfinished timers.
@@ -59,27 +118,83 @@ public:
 
     void add_task(uint64_t uid, CancelInterface *task, bool insert_head);
     std::size_t cancel(uint64_t uid, std::size_t max);
-    void del_task_unlocked(MapIter miter, ListIter liter);
+    void del_task_unlocked(CancelInterface *task);
+
+    // Called within the lock when a timer expires before canceled
+    void count_expired() noexcept { bump(expire_count, 1); }
+
+private:
+    static void bump(std::atomic<uint64_t> &a, uint64_t n) noexcept {
+        a.store(a.load(std::memory_order_relaxed) + n,
+                std::memory_order_relaxed);
+    }
+
+    void add_lock_wait(NanoSec nsec) noexcept;
+
+    static constexpr std::size_t MIN_BITS = 4;
+
+    std::size_t home_of(uint64_t uid) const noexcept {
+        return (std::size_t)(mix_hash(uid) >> shift);
+    }
+
+    TimerList *find_list(uint64_t uid) noexcept;
+    TimerList *find_or_insert(uint64_t uid);
+    void erase_list(TimerList *lst) noexcept;
+    void rehash(std::size_t bits);
 
 private:
     std::mutex mtx;
-    Map timer_map;
+    std::vector<TimerList> slots;
+    std::size_t count{0};
+    std::size_t mask{0};
+    unsigned shift{64};
+
+    // Only modified when the lock is held, atomic for lock free reading
+    std::atomic<uint64_t> lock_count{0};
+    std::atomic<uint64_t> contended_count{0};
+    std::atomic<uint64_t> live_timers{0};
+    std::atomic<uint64_t> add_count{0};
+    std::atomic<uint64_t> cancel_count{0};
+    std::atomic<uint64_t> expire_count{0};
+    std::atomic<uint64_t> lock_wait_hist[TimerMapStats::LOCK_WAIT_BUCKETS]{};
 
     friend struct TimerMapLock;
 };
 
 
-struct TimerMapLock final : public std::lock_guard<std::mutex> {
-    TimerMapLock(CancelableTimerMap *m) : std::lock_guard<std::mutex>(m->mtx)
-    { }
+struct TimerMapLock final {
+    static constexpr auto relaxed = std::memory_order_relaxed;
+
+    TimerMapLock(CancelableTimerMap *m) : m(m) {
+        if (m->mtx.try_lock()) {
+            CancelableTimerMap::bump(m->lock_count, 1);
+            return;
+        }
+
+        if (lock_timing_enabled.load(relaxed)) {
+            auto start = std::chrono::steady_clock::now();
+            m->mtx.lock();
+            m->add_lock_wait(std::chrono::steady_clock::now() - start);
+        }
+        else
+            m->mtx.lock();
+
+        CancelableTimerMap::bump(m->lock_count, 1);
+        CancelableTimerMap::bump(m->contended_count, 1);
+    }
+
+    ~TimerMapLock() { m->mtx.unlock(); }
+
+    TimerMapLock(const TimerMapLock &) = delete;
+    TimerMapLock &operator= (const TimerMapLock &) = delete;
+
+private:
+    CancelableTimerMap *m;
 };
 
 
 class CancelInterface : public TimerTask {
 public:
-    using ListIter = CancelableTimerMap::ListIter;
-    using MapIter = CancelableTimerMap::MapIter;
-
     static constexpr auto relaxed = std::memory_order_relaxed;
     static constexpr auto acquire = std::memory_order_acquire;
     static constexpr auto release = std::memory_order_release;
@@ -87,30 +202,52 @@ public:
 
     CancelInterface(CommScheduler *scheduler, NanoSec nsec)
         : TimerTask(scheduler, nsec),
-          timer_map(nullptr), ref(2), in_map(false), cancel_done(false)
+          timer_map(nullptr), ref(2), in_map(false), cancel_state(0)
     { }
 
     virtual ~CancelInterface() {
         if (in_map.load(acquire)) {
             TimerMapLock lk(timer_map);
             if (in_map.load(acquire))
-                timer_map->del_task_unlocked(miter, liter);
+                timer_map->del_task_unlocked(this);
         }
     }
 
     /**
-     * Cancel the unfinished timer. This function must be called within the
-     * timer map lock.
+     * Detach the unfinished timer from the map before canceling it. This
+     * function must be called within the timer map lock, and the caller must
+     * call `cancel_detached` after the lock is released.
+    */
+    void detach_from_map() {
+        // Keep the timer alive until `cancel_detached` returns
+        ref.fetch_add(1, relaxed);
+        this->prepare_cancel();
+        in_map.store(false, release);
+    }
+
+    /**
+     * Cancel the timer detached by `detach_from_map`. This function must be
+     * called outside the timer map lock, and the timer may be destroyed after
+     * it returns.
     */
-    virtual int cancel_timer_in_map() = 0;
+    void cancel_detached() {
+        this->do_cancel();
+        this->dec_ref();
+    }
 
     virtual SubTask *done() override {
         SeriesWork *series = series_of(this);
 
         this->awaiter->done();
 
-        if (cancel_done.load(acquire) == false)
-            cancel_done.wait(false, acquire);
+        // Workflow releases the timer's poller node after `done` returns, it
+        // must not be in use by the pending `cancel_timer`. This is a short
+        // wait that only happens when `cancel_timer` is racing the expiry.
+        unsigned s = cancel_state.load(acquire);
+        while (!cancel_finished(s)) {
+            cancel_state.wait(s, acquire);
+            s = cancel_state.load(acquire);
+        }
 
         this->dec_ref();
 
@@ -118,13 +255,12 @@ public:
     }
 
     /**
-     * Set the location where the timer is placed. It must be called within the
+     * Set the map where the timer is placed. It must be called within the
      * timer map lock and should be called immediately after construction.
     */
-    void set_in_map(CancelableTimerMap *m, MapIter mit, ListIter lit) {
+    void set_in_map(CancelableTimerMap *m, uint64_t uid) {
         this->timer_map = m;
-        this->miter = mit;
-        this->liter = lit;
+        this->uid = uid;
         in_map.store(true, release);
     }
 
@@ -133,65 +269,110 @@ public:
             delete this;
     }
 
+    /**
+     * The timer is never dispatched, remove it from the map and drop the
+     * references of dispatch and done. A canceler who has detached it holds
+     * its own reference, and the last one deletes the timer.
+    */
+    virtual void discard() override {
+        if (in_map.load(acquire)) {
+            TimerMapLock lk(timer_map);
+            if (in_map.load(acquire)) {
+                timer_map->del_task_unlocked(this);
+                in_map.store(false, release);
+            }
+        }
+
+        if (ref.fetch_sub(2, acq_rel) == 2)
+            delete this;
+    }
+
+protected:
+    /**
+     * Bits of `cancel_state`. SLEEPING is set after dispatch has started the
+     * timer and DISPATCHED after dispatch no longer touches it. CANCELED is
+     * set when the timer is detached from the map by cancel, together with
+     * UNSLEEPING if the timer has been started and must be canceled by the
+     * canceler, who sets CANCEL_DONE after that.
+    */
+    static constexpr unsigned SLEEPING      = 0x01;
+    static constexpr unsigned DISPATCHED    = 0x02;
+    static constexpr unsigned CANCELED      = 0x04;
+    static constexpr unsigned UNSLEEPING    = 0x08;
+    static constexpr unsigned CANCEL_DONE   = 0x10;
+
+    static bool cancel_finished(unsigned s) {
+        return (s & DISPATCHED) && (!(s & UNSLEEPING) || (s & CANCEL_DONE));
+    }
+
+    void set_cancel_state(unsigned bits) {
+        cancel_state.fetch_or(bits, release);
+        cancel_state.notify_one();
+    }
+
+    // Called by `detach_from_map` within the timer map lock
+    virtual void prepare_cancel() = 0;
+
+    // Called by `cancel_detached` outside the timer map lock
+    virtual void do_cancel() = 0;
+
 protected:
-    ListIter liter;
-    MapIter miter;
+    // Intrusive list node, protected by the timer map lock
+    CancelInterface *prev{nullptr};
+    CancelInterface *next{nullptr};
+    uint64_t uid{0};
     CancelableTimerMap *timer_map;
 
     std::atomic<int> ref;
     std::atomic<bool> in_map;
-    std::atomic<bool> cancel_done;
+    std::atomic<unsigned> cancel_state;
+
+    friend class CancelableTimerMap;
 };
 
 
 class CancelableTimer final : public CancelInterface {
 public:
     CancelableTimer(CommScheduler *scheduler, NanoSec nsec)
-        : CancelInterface(scheduler, nsec),
-          switched(false), canceled(false)
+        : CancelInterface(scheduler, nsec)
     { }
 
     virtual ~CancelableTimer() = default;
 
+protected:
     /**
-     * Cancel the unfinished timer. This function must be called within the
-     * timer map lock.
-     * CancelableTimer guarantees that if `cancel_timer_in_map` is called
-     * before `handle` takes effect, the timer's state is `SLEEP_CANCELED`.
+     * CancelableTimer guarantees that if `detach_from_map` is called before
+     * `handle` takes effect, the timer's state is `SLEEP_CANCELED`.
     */
-    virtual int cancel_timer_in_map() override;
+    virtual void prepare_cancel() override;
+    virtual void do_cancel() override;
 
-protected:
     virtual void dispatch() override;
     virtual void handle(int state, int error) override;
-
-private:
-    std::atomic<bool> switched;
-    bool canceled;
 };
 
 
 class InfiniteTimer final : public CancelInterface {
 public:
     InfiniteTimer(CommScheduler *scheduler)
-        : CancelInterface(scheduler, std::chrono::seconds(1)),
-          flag(false)
+        : CancelInterface(scheduler, std::chrono::seconds(1))
     { }
 
     ~InfiniteTimer() = default;
 
 protected:
+    // SLEEPING is set by the first of dispatch and cancel, the second one
+    // starts the timer and cancels it immediately.
     virtual void dispatch() override {
-        if (flag.exchange(true, acq_rel)) {
+        if (cancel_state.fetch_or(SLEEPING, acq_rel) & SLEEPING) {
             if (this->scheduler->sleep(this) >= 0) {
                 this->cancel();
-
-                cancel_done.store(true, release);
-                cancel_done.notify_one();
+                set_cancel_state(DISPATCHED);
             }
             else {
-                cancel_done.store(true, relaxed);
-                this->handle(SS_STATE_ERROR, errno);
+                int error = errno;
+                set_cancel_state(DISPATCHED);
+                this->handle(SS_STATE_ERROR, error);
             }
 
             this->dec_ref();
@@ -207,16 +388,10 @@ protected:
         this->TimerTask::handle(state, error);
     }
 
-    virtual int cancel_timer_in_map() override {
-        // `in_map` can be modified in advance because InfiniteTimer can only be
-        // canceled and no race conditions will occur.
-        this->in_map.store(false, relaxed);
-        this->dispatch();
-        return 0;
-    }
+    // InfiniteTimer can only be canceled and no race conditions will occur.
+    virtual void prepare_cancel() override { }
 
-private:
-    std::atomic<bool> flag;
+    virtual void do_cancel() override { this->dispatch(); }
 };
 
 
@@ -225,80 +400,238 @@ void CancelableTimerMap::add_task(uint64_t uid,
                                   bool insert_head) {
     TimerMapLock lk(this);
 
-    MapIter miter = timer_map.lower_bound(uid);
-    if (miter == timer_map.end() || miter->first != uid)
-        miter = timer_map.insert(miter, {uid, List{}});
+    TimerList *lst = find_or_insert(uid);
 
-    List &lst = miter->second;
-    ListIter liter;
+    if (lst->head == nullptr) {
+        task->prev = task->next = nullptr;
+        lst->head = lst->tail = task;
+    }
+    else if (insert_head) {
+        task->prev = nullptr;
+        task->next = lst->head;
+        lst->head->prev = task;
+        lst->head = task;
+    }
+    else {
+        task->prev = lst->tail;
+        task->next = nullptr;
+        lst->tail->next = task;
+        lst->tail = task;
+    }
 
-    if (insert_head)
-        liter = lst.insert(lst.begin(), task);
-    else
-        liter = lst.insert(lst.end(), task);
+    ++lst->size;
+    task->set_in_map(this, uid);
 
-    task->set_in_map(this, miter, liter);
+    bump(live_timers, 1);
+    bump(add_count, 1);
 }
 
 
 std::size_t CancelableTimerMap::cancel(uint64_t uid, std::size_t max) {
-    TimerMapLock lk(this);
+    CancelInterface *head, *tail;
+    std::size_t cnt;
+
+    {
+        TimerMapLock lk(this);
 
-    MapIter miter = timer_map.find(uid);
-    if (miter == timer_map.end())
-        return 0;
+        TimerList *lst = find_list(uid);
+        if (lst == nullptr || max == 0)
+            return 0;
 
-    std::size_t cnt = 0;
-    List &lst = miter->second;
-    CancelInterface *timer;
+        if (max > lst->size)
+            max = lst->size;
 
-    if (max > lst.size())
-        max = lst.size();
+        // Detach the first `max` timers as a whole, they will be canceled
+        // after the lock is released.
+        head = tail = lst->head;
+        for (cnt = 1; ; cnt++) {
+            tail->detach_from_map();
+            if (cnt == max)
+                break;
+
+            tail = tail->next;
+        }
 
-    bool need_sync = max > 128;
+        lst->head = tail->next;
+        if (lst->head)
+            lst->head->prev = nullptr;
+        else
+            lst->tail = nullptr;
+
+        tail->next = nullptr;
+        lst->size -= cnt;
+
+        if (lst->head == nullptr)
+            erase_list(lst);
+
+        live_timers.store(live_timers.load(std::memory_order_relaxed) - cnt,
+                          std::memory_order_relaxed);
+        bump(cancel_count, cnt);
+    }
+
+    bool need_sync = cnt > 128;
     SyncGuard guard(need_sync);
 
-    while (cnt < max) {
-        timer = lst.front();
-        lst.pop_front();
-        ++cnt;
+    while (head) {
+        CancelInterface *timer = head;
+        head = timer->next;
 
-        timer->cancel_timer_in_map();
+        timer->cancel_detached();
         // The timer may have been destroyed at this time
     }
 
     if (need_sync)
         guard.sync_operation_end();
 
-    if (lst.empty())
-        timer_map.erase(miter);
-
     return cnt;
 }
 
 
-void CancelableTimerMap::del_task_unlocked(MapIter miter, ListIter liter) {
-    List &lst = miter->second;
-    lst.erase(liter);
+void CancelableTimerMap::del_task_unlocked(CancelInterface *task) {
+    TimerList *lst = find_list(task->uid);
+
+    if (task->prev)
+        task->prev->next = task->next;
+    else
+        lst->head = task->next;
+
+    if (task->next)
+        task->next->prev = task->prev;
+    else
+        lst->tail = task->prev;
+
+    task->prev = task->next = nullptr;
+
+    if (--lst->size == 0)
+        erase_list(lst);
+
+    live_timers.store(live_timers.load(std::memory_order_relaxed) - 1,
+                      std::memory_order_relaxed);
+}
+
+
+void CancelableTimerMap::add_lock_wait(NanoSec nsec) noexcept {
+    auto us = std::chrono::duration_cast<std::chrono::microseconds>(nsec);
+    auto cnt = us.count();
+    std::size_t pos = 0;
+
+    while (cnt > 0 && pos + 1 < TimerMapStats::LOCK_WAIT_BUCKETS) {
+        ++pos;
+        cnt >>= 2;
+    }
+
+    bump(lock_wait_hist[pos], 1);
+}
+
+
+TimerList *CancelableTimerMap::find_list(uint64_t uid) noexcept {
+    if (count == 0)
+        return nullptr;
+
+    std::size_t pos = home_of(uid);
+
+    while (slots[pos].head != nullptr) {
+        if (slots[pos].uid == uid)
+            return &slots[pos];
+
+        pos = (pos + 1) & mask;
+    }
+
+    return nullptr;
+}
+
+
+TimerList *CancelableTimerMap::find_or_insert(uint64_t uid) {
+    // Keep the load factor below 0.5 to make probe sequences short
+    if ((count + 1) * 2 > slots.size())
+        rehash(slots.empty() ? MIN_BITS : (64 - shift) + 1);
+
+    std::size_t pos = home_of(uid);
+
+    while (slots[pos].head != nullptr) {
+        if (slots[pos].uid == uid)
+            return &slots[pos];
+
+        pos = (pos + 1) & mask;
+    }
+
+    // The caller will link the first timer into it
+    ++count;
+    slots[pos].uid = uid;
+    slots[pos].size = 0;
+    return &slots[pos];
+}
+
 
-    if (lst.empty())
-        timer_map.erase(miter);
+void CancelableTimerMap::erase_list(TimerList *lst) noexcept {
+    std::size_t pos = (std::size_t)(lst - slots.data());
+    std::size_t next = pos;
+
+    // Backward shift deletion, no tombstone is needed
+    while (true) {
+        next = (next + 1) & mask;
+        if (slots[next].head == nullptr)
+            break;
+
+        std::size_t home = home_of(slots[next].uid);
+        bool keep = (pos <= next) ? (pos < home && home <= next)
+                                  : (pos < home || home <= next);
+        if (!keep) {
+            slots[pos] = slots[next];
+            pos = next;
+        }
+    }
+
+    slots[pos] = TimerList{0, nullptr, nullptr, 0};
+    --count;
+
+    // Release memory after a burst of waiters is gone
+    std::size_t bits = 64 - shift;
+    if (bits > MIN_BITS + 2 && count * 8 < slots.size()) {
+        coke_try {
+            rehash(bits - 1);
+        }
+        coke_catch (...) {
+            // Keep the larger table if memory allocation fails
+        }
+    }
+}
+
+
+void CancelableTimerMap::rehash(std::size_t bits) {
+    std::vector<TimerList> old(std::size_t(1) << bits);
+    old.swap(slots);
+
+    mask = slots.size() - 1;
+    shift = (unsigned)(64 - bits);
+
+    for (const TimerList &lst : old) {
+        if (lst.head == nullptr)
+            continue;
+
+        std::size_t pos = home_of(lst.uid);
+        while (slots[pos].head != nullptr)
+            pos = (pos + 1) & mask;
+
+        slots[pos] = lst;
+    }
 }
 
 
 void CancelableTimer::dispatch() {
-    int ret = this->scheduler->sleep(this);
+    int ret = this->sleep_timer();
 
     if (ret < 0) {
-        cancel_done.store(true, relaxed);
-        this->handle(SS_STATE_ERROR, errno);
+        int error = errno;
+        set_cancel_state(DISPATCHED);
+        this->handle(SS_STATE_ERROR, error);
     }
     else {
-        if (switched.exchange(true, acq_rel))
-            this->TimerTask::cancel();
+        // The timer is detached before started, so nobody else cancels it
+        if (cancel_state.fetch_or(SLEEPING, acq_rel) & CANCELED)
+            this->cancel_timer();
 
-        cancel_done.store(true, release);
-        cancel_done.notify_one();
+        set_cancel_state(DISPATCHED);
     }
 
     this->dec_ref();
@@ -309,12 +642,14 @@ void CancelableTimer::handle(int state, int error) {
     if (in_map.load(acquire)) {
         TimerMapLock lk(timer_map);
         if (in_map.load(acquire)) {
-            timer_map->del_task_unlocked(miter, liter);
+            timer_map->del_task_unlocked(this);
+            timer_map->count_expired();
             in_map.store(false, release);
         }
     }
 
     // when canceled before callback, it will always be canceled
+    bool canceled = (cancel_state.load(acquire) & CANCELED);
     if (state == WFT_STATE_SUCCESS && canceled) {
         state = WFT_STATE_SYS_ERROR;
         error = ECANCELED;
@@ -324,26 +659,33 @@ void CancelableTimer::handle(int state, int error) {
 }
 
 
-int CancelableTimer::cancel_timer_in_map() {
-    int ret = 0;
-    canceled = true;
+void CancelableTimer::prepare_cancel() {
+    unsigned s = cancel_state.load(relaxed);
+    unsigned t;
+
+    // sync with dispatch, whoever comes later cancels the started timer
+    do {
+        t = s | CANCELED;
+        if (s & SLEEPING)
+            t |= UNSLEEPING;
+    } while (!cancel_state.compare_exchange_weak(s, t, acq_rel, relaxed));
+}
 
-    // sync with dispatch
-    if (switched.exchange(true, acq_rel)) {
-        // this cancel is protected by `in_map`, so `cancel_done` is not needed
-        cancel_done.store(true, relaxed);
-        ret = this->TimerTask::cancel();
-    }
 
-    // sync with handle and destructor
-    in_map.store(false, release);
-    return ret;
+void CancelableTimer::do_cancel() {
+    // UNSLEEPING is only set by prepare_cancel, which is called before
+    if (cancel_state.load(relaxed) & UNSLEEPING) {
+        this->cancel_timer();
+        set_cancel_state(CANCEL_DONE);
+    }
 }
 
 
 TimerTask *create_timer(uint64_t id, NanoSec nsec, bool insert_head) {
+    nsec = TimedWaitHelper::round_up(nsec, get_timer_slack());
     auto *timer_map = CancelableTimerMap::get_uid_instance(id);
     auto *task = new CancelableTimer(WFGlobal::get_scheduler(), nsec);
+    task->set_coarse(use_timing_wheel(nsec));
     timer_map->add_task(id, task, insert_head);
     return task;
 }
@@ -356,13 +698,11 @@ TimerTask *create_infinite_timer(uint64_t id, bool insert_head) {
 }
 
 std::size_t get_hash_from_uaddr(uintptr_t uaddr) {
-    // Maybe we need a more efficient hash
-    auto p = (const unsigned char *)&uaddr;
-    std::string_view sv((const char *)p, sizeof (uaddr));
-    return std::hash<std::string_view>{}(sv);
+    return (std::size_t)mix_hash((uint64_t)uaddr);
 }
 
 TimerTask *create_timer(const void *addr, NanoSec nsec, bool insert_head) {
+    nsec = TimedWaitHelper::round_up(nsec, get_timer_slack());
     // Make sure uaddr can be passed to add_task
     static_assert(sizeof(uint64_t) >= sizeof(uintptr_t));
 
@@ -371,6 +711,7 @@ TimerTask *create_timer(const void *addr, NanoSec nsec, bool insert_head) {
 
     auto *timer_map = CancelableTimerMap::get_addr_instance(hash);
     auto *task = new CancelableTimer(WFGlobal::get_scheduler(), nsec);
+    task->set_coarse(use_timing_wheel(nsec));
     timer_map->add_task(uaddr, task, insert_head);
     return task;
 }
@@ -394,6 +735,18 @@ std::size_t cancel_sleep_by_id(uint64_t id, std::size_t max) {
     return timer_map->cancel(id, max);
 }
 
+void set_sleep_map_lock_timing(bool enable) noexcept {
+    detail::lock_timing_enabled.store(enable, std::memory_order_relaxed);
+}
+
+std::vector<TimerMapStats> get_sleep_map_stats_by_id() {
+    return detail::CancelableTimerMap::get_stats(false);
+}
+
+std::vector<TimerMapStats> get_sleep_map_stats_by_addr() {
+    return detail::CancelableTimerMap::get_stats(true);
+}
+
 std::size_t cancel_sleep_by_addr(const void *addr, std::size_t max) {
     uintptr_t uaddr = (uintptr_t)(void *)addr;
     std::size_t hash = detail::get_hash_from_uaddr(uaddr);
@@ -0,0 +1,129 @@
+/**
+ * Copyright 2024 Coke Project (https://github.com/kedixa/coke)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Authors: kedixa (https://github.com/kedixa)
+*/
+
+#include <memory>
+#include <mutex>
+
+#include "coke/coarse_clock.h"
+#include "coke/stop_token.h"
+
+namespace coke {
+
+namespace detail {
+
+std::atomic<int64_t> coarse_steady_ns{0};
+std::atomic<int64_t> coarse_system_ns{0};
+std::atomic<bool> coarse_timed_wait{false};
+
+} // namespace detail
+
+namespace {
+
+struct CoarseClockState {
+    std::mutex mtx;
+
+    // Not null while the updater is running
+    std::unique_ptr<StopToken> token;
+};
+
+CoarseClockState &get_coarse_clock_state() {
+    static CoarseClockState state;
+    return state;
+}
+
+void update_coarse_clock() noexcept {
+    using std::chrono::duration_cast;
+    using std::chrono::nanoseconds;
+    constexpr auto relaxed = std::memory_order_relaxed;
+
+    auto steady = std::chrono::steady_clock::now().time_since_epoch();
+    auto system = std::chrono::system_clock::now().time_since_epoch();
+
+    // Zero means not running, it never happens to a real clock
+    detail::coarse_steady_ns.store(duration_cast<nanoseconds>(steady).count(),
+                                   relaxed);
+    detail::coarse_system_ns.store(duration_cast<nanoseconds>(system).count(),
+                                   relaxed);
+}
+
+/**
+ * The updater sleeps by the address of the token instead of waiting on it,
+ * because StopToken's timed wait reads TimedWaitHelper's clock, which may be
+ * the coarse clock that only this coroutine updates.
+*/
+Task<> coarse_clock_updater(StopToken *token, NanoSec interval) {
+    StopToken::FinishGuard guard(token);
+
+    while (!token->stop_requested()) {
+        update_coarse_clock();
+
+        int ret = co_await sleep(token, interval);
+        if (ret < 0 || ret == SLEEP_ABORTED)
+            break;
+    }
+
+    detail::coarse_steady_ns.store(0, std::memory_order_relaxed);
+    detail::coarse_system_ns.store(0, std::memory_order_relaxed);
+}
+
+} // namespace
+
+bool start_coarse_clock(NanoSec interval) {
+    CoarseClockState &st = get_coarse_clock_state();
+    std::lock_guard<std::mutex> lg(st.mtx);
+
+    if (st.token)
+        return false;
+
+    if (interval <= NanoSec(0))
+        interval = std::chrono::milliseconds(1);
+
+    st.token = std::make_unique<StopToken>(1);
+
+    // Make the clocks valid before start returns
+    update_coarse_clock();
+    coarse_clock_updater(st.token.get(), interval).detach();
+    return true;
+}
+
+Task<> stop_coarse_clock() {
+    CoarseClockState &st = get_coarse_clock_state();
+    std::unique_ptr<StopToken> token;
+
+    {
+        std::lock_guard<std::mutex> lg(st.mtx);
+        token = std::move(st.token);
+    }
+
+    if (!token)
+        co_return;
+
+    token->request_stop();
+    cancel_sleep_by_addr(token.get());
+    co_await token->wait_finish();
+}
+
+bool coarse_clock_running() noexcept {
+    return detail::coarse_steady_ns.load(std::memory_order_relaxed) != 0;
+}
+
+void set_timed_wait_coarse_clock(bool enable) noexcept {
+    detail::coarse_timed_wait.store(enable, std::memory_order_relaxed);
+}
+
+} // namespace coke
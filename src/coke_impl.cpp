@@ -16,15 +16,30 @@
  * Authors: kedixa (https://github.com/kedixa)
 */
 
+#include <algorithm>
 #include <atomic>
+#include <bit>
+#include <cerrno>
+#include <cstdlib>
+#include <fstream>
+#include <latch>
+#include <memory>
+#include <string>
+#include <thread>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
 
 #include "coke/detail/awaiter_base.h"
 #include "coke/detail/mutex_table.h"
+#include "coke/detail/shard_config.h"
+#include "coke/detail/timer_task.h"
 #include "coke/detail/constant.h"
 #include "coke/detail/exception_config.h"
 #include "coke/coke.h"
 
 #include "workflow/Workflow.h"
+#include "workflow/WFGlobal.h"
 #include "workflow/WFTaskFactory.h"
 
 namespace coke {
@@ -46,6 +61,136 @@ static_assert(CTOR_CONNECT_TIMEOUT  == TOR_CONNECT_TIMEOUT);
 static_assert(CTOR_TRANSMIT_TIMEOUT == TOR_TRANSMIT_TIMEOUT);
 
 
+// Parse a cpu list such as "0-7,16-23" into `set`
+static bool parse_cpu_list(const char *cpus, cpu_set_t *set) {
+    const char *p = cpus;
+    char *end;
+
+    CPU_ZERO(set);
+
+    while (*p) {
+        long first = std::strtol(p, &end, 10);
+        long last = first;
+
+        if (end == p || first < 0)
+            return false;
+
+        p = end;
+        if (*p == '-') {
+            ++p;
+            last = std::strtol(p, &end, 10);
+            if (end == p || last < first)
+                return false;
+
+            p = end;
+        }
+
+        if (last >= CPU_SETSIZE)
+            return false;
+
+        for (long i = first; i <= last; i++)
+            CPU_SET((int)i, set);
+
+        while (*p == ',' || *p == ' ' || *p == '\n')
+            ++p;
+    }
+
+    return CPU_COUNT(set) > 0;
+}
+
+static int get_numa_node_cpus(int node, cpu_set_t *set) {
+    std::string path = "/sys/devices/system/node/node" + std::to_string(node)
+                     + "/cpulist";
+    std::ifstream ifs(path);
+    std::string line;
+
+    if (node < 0 || !ifs || !std::getline(ifs, line)) {
+        errno = ENOENT;
+        return -1;
+    }
+
+    if (!parse_cpu_list(line.c_str(), set)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return 0;
+}
+
+// Get the cpu set of a kind of threads, false if not set
+static bool get_affinity(const char *cpus, int node, cpu_set_t *set) {
+    if (node >= 0)
+        return get_numa_node_cpus(node, set) == 0;
+
+    return cpus && *cpus && parse_cpu_list(cpus, set);
+}
+
+static int set_affinity(const cpu_set_t *set) {
+    int ret = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), set);
+    if (ret != 0) {
+        errno = ret;
+        return -1;
+    }
+
+    return 0;
+}
+
+int set_thread_affinity(const char *cpus) {
+    cpu_set_t set;
+
+    if (!cpus || !parse_cpu_list(cpus, &set)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return set_affinity(&set);
+}
+
+int set_thread_numa_node(int node) {
+    cpu_set_t set;
+
+    if (get_numa_node_cpus(node, &set) != 0)
+        return -1;
+
+    return set_affinity(&set);
+}
+
+static std::atomic<int> affinity_failures{0};
+
+int get_affinity_failures() noexcept {
+    return affinity_failures.load(std::memory_order_relaxed);
+}
+
+/**
+ * Run one coroutine on each thread of the pool and bind the thread, every
+ * coroutine blocks its thread until all of them arrive, so that no thread
+ * runs two of them. It is only used in library_init, when the pool is idle.
+*/
+static Task<> bind_one(bool handler, const cpu_set_t *set, std::latch *lt,
+                       std::atomic<int> *failed) {
+    if (handler)
+        co_await yield();
+    else
+        co_await switch_go_thread();
+
+    if (set_affinity(set) != 0)
+        failed->fetch_add(1, std::memory_order_relaxed);
+
+    lt->arrive_and_wait();
+}
+
+// Return the number of threads failed to bind
+static int bind_pool(bool handler, const cpu_set_t *set, int threads) {
+    std::latch lt(threads + 1);
+    std::atomic<int> failed{0};
+
+    for (int i = 0; i < threads; i++)
+        bind_one(handler, set, &lt, &failed).detach();
+
+    lt.arrive_and_wait();
+    return failed.load(std::memory_order_relaxed);
+}
+
 void library_init(const GlobalSettings &s) {
     WFGlobalSettings t = GLOBAL_SETTINGS_DEFAULT;
 
@@ -72,7 +217,58 @@ void library_init(const GlobalSettings &s) {
     t.resolv_conf_path  = s.resolv_conf_path;
     t.hosts_path        = s.hosts_path;
 
+    cpu_set_t poller_set, handler_set, compute_set, old_set;
+    bool bind_poller, bind_handler, bind_compute;
+    int failed = 0;
+
+    bind_poller = get_affinity(s.poller_cpus, s.poller_numa_node, &poller_set);
+    bind_handler = get_affinity(s.handler_cpus, s.handler_numa_node,
+                                &handler_set);
+    bind_compute = get_affinity(s.compute_cpus, s.compute_numa_node,
+                                &compute_set);
+
+    // Workflow creates the pollers and handlers lazily with the scheduler,
+    // create it here while this thread has the pollers' affinity, so that
+    // they inherit it. The old affinity must be known to be restored.
+    if (bind_poller) {
+        int ret = pthread_getaffinity_np(pthread_self(), sizeof(cpu_set_t),
+                                         &old_set);
+        bind_poller = (ret == 0 && set_affinity(&poller_set) == 0);
+        if (!bind_poller)
+            failed += t.poller_threads;
+    }
+
     WORKFLOW_library_init(&t);
+
+    if (bind_poller)
+        WFGlobal::get_scheduler();
+
+    // Binding is best effort, the threads failed to bind keep the inherited
+    // affinity, and they are counted for get_affinity_failures.
+    if (bind_handler)
+        failed += bind_pool(true, &handler_set, t.handler_threads);
+
+    if (bind_compute) {
+        int n = t.compute_threads;
+        if (n <= 0)
+            n = (int)sysconf(_SC_NPROCESSORS_ONLN);
+
+        failed += bind_pool(false, &compute_set, n);
+    }
+
+    if (bind_poller)
+        set_affinity(&old_set);
+
+    affinity_failures.store(failed, std::memory_order_relaxed);
+
+    detail::set_shard_config((std::size_t)std::max(s.timer_map_shards, 0),
+                             (std::size_t)std::max(s.mutex_table_shards, 0));
+    detail::set_timer_wheel_config(s.timer_wheel_threshold, s.timer_wheel_tick);
+    detail::set_timer_slack(std::chrono::milliseconds(std::max(s.timer_slack, 0)));
+    set_sleep_map_lock_timing(s.timer_lock_timing);
+    set_lock_spin_count(s.lock_spin_count);
+    set_timed_wait_coarse_clock(s.timed_wait_coarse_clock);
+    detail::set_fio_backend(s.fio_backend, s.fio_uring_entries);
 }
 
 const char *get_error_string(int state, int error) {
@@ -130,6 +326,16 @@ void AwaiterBase::suspend(void *s, bool is_new) {
         series->push_front(subtask);
 }
 
+bool AwaiterBase::attach_yield_if_needed() {
+    if (!prevent_recursive_stack())
+        return false;
+
+    auto *yield_task = detail::create_yield_timer();
+    yield_task->set_awaiter(this);
+    set_task(yield_task);
+    return true;
+}
+
 AwaiterBase::~AwaiterBase() {
     // We assume that SubTask can be deleted
     delete subtask;
@@ -145,10 +351,46 @@ struct alignas(DESTRUCTIVE_ALIGN) AlignedMutex {
 };
 
 std::mutex &get_mutex(const void *ptr) noexcept {
-    static AlignedMutex m[MUTEX_TABLE_SIZE];
+    static const std::size_t mask = get_mutex_table_shards() - 1;
+    static std::unique_ptr<AlignedMutex[]> m(new AlignedMutex[mask + 1]);
+
+    uint64_t h = mix_hash((uint64_t)(uintptr_t)ptr);
+    return m[h & mask].mtx;
+}
+
+// detail/shard_config.h impl
+
+static std::atomic<std::size_t> timer_map_shards_conf{CANCELABLE_MAP_SIZE};
+static std::atomic<std::size_t> mutex_table_shards_conf{MUTEX_TABLE_SIZE};
+
+static std::size_t round_shards(std::size_t conf, std::size_t min) noexcept {
+    constexpr std::size_t MAX_SHARDS = 65536;
+
+    if (conf == 0)
+        conf = std::max(min, (std::size_t)std::thread::hardware_concurrency());
+
+    return std::bit_ceil(std::min(conf, MAX_SHARDS));
+}
+
+void set_shard_config(std::size_t timer_map_shards,
+                      std::size_t mutex_table_shards) noexcept {
+    // Zero keeps the compile time default
+    if (timer_map_shards)
+        timer_map_shards_conf.store(timer_map_shards, std::memory_order_relaxed);
+    if (mutex_table_shards)
+        mutex_table_shards_conf.store(mutex_table_shards, std::memory_order_relaxed);
+}
+
+std::size_t get_timer_map_shards() noexcept {
+    static const std::size_t n = round_shards(
+        timer_map_shards_conf.load(std::memory_order_relaxed), 16);
+    return n;
+}
 
-    uintptr_t h = (uintptr_t)(void *)ptr;
-    return m[h%MUTEX_TABLE_SIZE].mtx;
+std::size_t get_mutex_table_shards() noexcept {
+    static const std::size_t n = round_shards(
+        mutex_table_shards_conf.load(std::memory_order_relaxed), 64);
+    return n;
 }
 
 // detail/exception_config.h
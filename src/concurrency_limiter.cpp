@@ -0,0 +1,162 @@
+/**
+ * Copyright 2024 Coke Project (https://github.com/kedixa/coke)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Authors: kedixa (https://github.com/kedixa)
+*/
+
+#include <algorithm>
+#include <cmath>
+
+#include "coke/net/concurrency_limiter.h"
+
+namespace coke {
+
+ConcurrencyLimiter::ConcurrencyLimiter(const ConcurrencyLimiterParams &params)
+    : params(params)
+{
+    this->params.min_limit = std::max(params.min_limit, 1.0);
+    this->params.max_limit = std::max(params.max_limit,
+                                      this->params.min_limit);
+    this->params.long_window = std::max(params.long_window, 1);
+
+    limit = std::clamp(params.initial_limit, this->params.min_limit,
+                       this->params.max_limit);
+}
+
+bool ConcurrencyLimiter::try_acquire() {
+    std::lock_guard<std::mutex> lg(mtx);
+
+    if ((double)inflight < std::floor(limit)) {
+        ++inflight;
+        ++accepted;
+        return true;
+    }
+
+    ++rejected;
+    return false;
+}
+
+Task<bool> ConcurrencyLimiter::acquire() {
+    std::unique_lock<std::mutex> lk(mtx);
+    auto pred = [this]() { return (double)inflight < std::floor(limit); };
+
+    if (!pred() && params.max_wait > 0) {
+        auto timeout = std::chrono::milliseconds(params.max_wait);
+        co_await cv.wait_for(lk, timeout, pred);
+    }
+
+    if (pred()) {
+        ++inflight;
+        ++accepted;
+        co_return true;
+    }
+
+    ++rejected;
+    co_return false;
+}
+
+void ConcurrencyLimiter::release(std::chrono::nanoseconds rtt,
+                                 Outcome outcome) {
+    using std::chrono::microseconds;
+    int64_t rtt_us = std::chrono::duration_cast<microseconds>(rtt).count();
+    std::size_t wake = 0;
+
+    {
+        std::lock_guard<std::mutex> lg(mtx);
+
+        if (outcome != OUTCOME_IGNORED) {
+            bool drop = (outcome == OUTCOME_DROPPED);
+
+            if (drop)
+                ++dropped;
+
+            if (params.algorithm == LimiterAlgorithm::AIMD)
+                update_aimd(rtt_us, drop);
+            else
+                update_gradient(rtt_us, drop);
+        }
+
+        // The released request is still counted by the updates above
+        --inflight;
+
+        double slots = std::floor(limit) - (double)inflight;
+        if (slots > 0)
+            wake = (std::size_t)slots;
+    }
+
+    if (wake > 0 && params.max_wait > 0)
+        cv.notify(wake);
+}
+
+void ConcurrencyLimiter::update_aimd(int64_t rtt_us, bool drop) {
+    if (drop || rtt_us > (int64_t)params.aimd_timeout * 1000)
+        limit *= params.backoff_ratio;
+    else if ((double)inflight * 2 >= limit)
+        limit += 1.0;
+
+    limit = std::clamp(limit, params.min_limit, params.max_limit);
+}
+
+void ConcurrencyLimiter::update_gradient(int64_t rtt_us, bool drop) {
+    if (drop) {
+        limit = std::clamp(limit * params.backoff_ratio,
+                           params.min_limit, params.max_limit);
+        return;
+    }
+
+    double rtt = (double)std::max(rtt_us, int64_t(1));
+
+    if (long_rtt == 0)
+        long_rtt = rtt;
+    else {
+        double alpha = 2.0 / (params.long_window + 1);
+        long_rtt += (rtt - long_rtt) * alpha;
+    }
+
+    // The backend has recovered from a long slow period, let the long term
+    // latency follow it faster.
+    if (long_rtt / rtt > 2.0)
+        long_rtt *= 0.95;
+
+    // Do not grow the limit when it is not used up
+    double gradient = std::clamp(params.rtt_tolerance * long_rtt / rtt,
+                                 0.5, 1.0);
+    if (gradient >= 1.0 && (double)inflight * 2 < limit)
+        return;
+
+    double new_limit = limit * gradient + std::sqrt(limit);
+    limit = limit * (1 - params.smoothing) + new_limit * params.smoothing;
+    limit = std::clamp(limit, params.min_limit, params.max_limit);
+}
+
+std::size_t ConcurrencyLimiter::get_limit() const {
+    std::lock_guard<std::mutex> lg(mtx);
+    return (std::size_t)limit;
+}
+
+ConcurrencyLimiterStats ConcurrencyLimiter::get_stats() const {
+    std::lock_guard<std::mutex> lg(mtx);
+    ConcurrencyLimiterStats stats;
+
+    stats.limit = (std::size_t)limit;
+    stats.inflight = inflight;
+    stats.long_rtt = (int64_t)long_rtt;
+    stats.accepted = accepted;
+    stats.rejected = rejected;
+    stats.dropped = dropped;
+    return stats;
+}
+
+} // namespace coke
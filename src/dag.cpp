@@ -16,7 +16,11 @@
  * Authors: kedixa (https://github.com/kedixa)
 */
 
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
 #include <iomanip>
+#include <mutex>
 
 #include "coke/dag.h"
 
@@ -119,53 +123,295 @@ std::ostream &operator<< (std::ostream &os, const GetName &x) {
     return os;
 }
 
+void dag_compile(const std::vector<std::vector<dag_index_t>> &outs,
+                 const std::vector<std::vector<dag_index_t>> &weak_outs,
+                 std::vector<dag_index_t> &offsets,
+                 std::vector<dag_index_t> &edges)
+{
+    std::size_t n = outs.size();
+    std::size_t total = 0;
+
+    for (std::size_t i = 0; i < n; i++)
+        total += outs[i].size() + weak_outs[i].size();
+
+    offsets.clear();
+    offsets.reserve(n * 2 + 1);
+    edges.clear();
+    edges.reserve(total);
+
+    for (std::size_t i = 0; i < n; i++) {
+        offsets.push_back((dag_index_t)edges.size());
+        edges.insert(edges.end(), outs[i].begin(), outs[i].end());
+
+        offsets.push_back((dag_index_t)edges.size());
+        edges.insert(edges.end(), weak_outs[i].begin(), weak_outs[i].end());
+    }
+
+    offsets.push_back((dag_index_t)edges.size());
+}
+
+static void dump_edges(std::ostream &os, dag_index_t from,
+                       const dag_index_t *first, const dag_index_t *last,
+                       bool weak)
+{
+    if (first == last)
+        return;
+
+    os << "    " << GetName(from) << " -> {";
+    for (const dag_index_t *p = first; p != last; ++p) {
+        if (p != first)
+            os << ", ";
+
+        os << GetName(*p);
+    }
+
+    if (weak)
+        os << "} [style=dashed];\n";
+    else
+        os << "};\n";
+}
+
+struct GetCost {
+    int64_t nsec;
+
+    GetCost(int64_t nsec) : nsec(nsec) { }
+};
+
+std::ostream &operator<< (std::ostream &os, const GetCost &x) {
+    char buf[32];
+
+    if (x.nsec < 0)
+        os << "-";
+    else {
+        std::snprintf(buf, sizeof(buf), "%.1fus", x.nsec / 1000.0);
+        os << buf;
+    }
+    return os;
+}
+
 void dag_dump(std::ostream &os,
-              const std::vector<std::vector<dag_index_t>> &outs,
-              const std::vector<std::vector<dag_index_t>> &weak_outs,
-              const std::vector<std::string> &names)
+              const std::vector<dag_index_t> &offsets,
+              const std::vector<dag_index_t> &edges,
+              const std::vector<std::string> &names,
+              const DagProfileStats *stats)
 {
-    dag_index_t n = (dag_index_t)outs.size();
-    bool first;
+    dag_index_t n = (dag_index_t)names.size();
+    const dag_index_t *data = edges.data();
+
+    if (stats && stats->node_count() != n)
+        stats = nullptr;
 
     os << "digraph {\n";
 
     for (dag_index_t i = 0; i < n; i++) {
         os << "    " << GetName(i)
-           << " [label=" << GetLabel(i, names[i]) << "];\n";
+           << " [label=" << GetLabel(i, names[i]);
+
+        if (stats) {
+            os << ", xlabel=\"p50 " << GetCost(stats->percentile(i, 0.5))
+               << " p99 " << GetCost(stats->percentile(i, 0.99)) << "\"";
+
+            if (stats->critical_count(i) > 0)
+                os << ", color=red";
+        }
+
+        os << "];\n";
     }
 
     os << "\n";
 
     for (dag_index_t i = 0; i < n; i++) {
-        if (!outs[i].empty()) {
-            os << "    " << GetName(i) << " -> {";
+        dump_edges(os, i, data + offsets[2 * i], data + offsets[2 * i + 1],
+                   false);
+        dump_edges(os, i, data + offsets[2 * i + 1], data + offsets[2 * i + 2],
+                   true);
+    }
 
-            first = true;
-            for (auto to : outs[i]) {
-                if (!first)
-                    os << ", ";
+    os << "}\n";
+}
 
-                first = false;
-                os << GetName(to);
-            }
-            os << "};\n";
-        }
+dag_index_t dag_mark_upstream(const std::vector<dag_index_t> &offsets,
+                              const std::vector<dag_index_t> &edges,
+                              const std::vector<dag_index_t> &sinks,
+                              std::vector<uint8_t> &mask)
+{
+    dag_index_t n = (dag_index_t)(offsets.size() / 2);
+    std::vector<dag_index_t> in_offsets(n + 1, 0);
+    std::vector<dag_index_t> in_edges(edges.size());
+    std::vector<dag_index_t> v;
+    dag_index_t count = 0;
 
-        if (!weak_outs[i].empty()) {
-            os << "    " << GetName(i) << " -> {";
-            first = true;
-            for (auto to : weak_outs[i]) {
-                if (!first)
-                    os << ", ";
+    // Build the predecessors of each node, strong and weak edges are treated
+    // in the same way.
+    for (dag_index_t from = 0; from < n; from++)
+        for (dag_index_t i = offsets[2 * from]; i < offsets[2 * from + 2]; i++)
+            in_offsets[edges[i] + 1]++;
 
-                first = false;
-                os << GetName(to);
-            }
-            os << "} [style=dashed];\n";
+    for (dag_index_t i = 0; i < n; i++)
+        in_offsets[i + 1] += in_offsets[i];
+
+    std::vector<dag_index_t> pos(in_offsets.begin(), in_offsets.end() - 1);
+    for (dag_index_t from = 0; from < n; from++)
+        for (dag_index_t i = offsets[2 * from]; i < offsets[2 * from + 2]; i++)
+            in_edges[pos[edges[i]]++] = from;
+
+    mask.assign(n, 0);
+
+    auto mark = [&](dag_index_t id) {
+        if (!mask[id]) {
+            mask[id] = 1;
+            count++;
+            v.push_back(id);
         }
+    };
+
+    if (n > 0)
+        mark(0);
+
+    for (auto id : sinks)
+        if (id < n)
+            mark(id);
+
+    while (!v.empty()) {
+        dag_index_t to = v.back();
+        v.pop_back();
+
+        for (dag_index_t i = in_offsets[to]; i < in_offsets[to + 1]; i++)
+            mark(in_edges[i]);
     }
 
-    os << "}\n";
+    return count;
 }
 
 } // namespace coke::detail
+
+namespace coke {
+
+std::vector<dag_index_t> dag_critical_path(const DagRunProfile &profile) {
+    const auto &nodes = profile.nodes;
+    std::vector<dag_index_t> path;
+    dag_index_t last = DAG_INVALID_INDEX;
+    int64_t last_end = -1;
+
+    for (dag_index_t i = 0; i < (dag_index_t)nodes.size(); i++) {
+        if (nodes[i].end_ns > last_end) {
+            last_end = nodes[i].end_ns;
+            last = i;
+        }
+    }
+
+    // Each node has at most one trigger, and the trigger always ends before
+    // the node is ready, so there is no loop.
+    while (last != DAG_INVALID_INDEX && path.size() < nodes.size()) {
+        path.push_back(last);
+        last = nodes[last].trigger;
+    }
+
+    std::reverse(path.begin(), path.end());
+    return path;
+}
+
+static std::size_t cost_bucket(int64_t nsec) {
+    constexpr std::size_t SUB = DagProfileStats::SUB_BUCKETS;
+    constexpr int SUB_BITS = 3;
+    static_assert(SUB == (1 << SUB_BITS));
+
+    uint64_t v = nsec < 0 ? 0 : (uint64_t)nsec;
+    if (v < SUB)
+        return (std::size_t)v;
+
+    int e = 63 - __builtin_clzll(v);
+    std::size_t sub = (v >> (e - SUB_BITS)) & (SUB - 1);
+    return (std::size_t)(e - SUB_BITS + 1) * SUB + sub;
+}
+
+static int64_t bucket_value(std::size_t idx) {
+    constexpr std::size_t SUB = DagProfileStats::SUB_BUCKETS;
+    constexpr int SUB_BITS = 3;
+
+    if (idx < SUB)
+        return (int64_t)idx;
+
+    int e = (int)(idx / SUB) + SUB_BITS - 1;
+    uint64_t sub = idx % SUB;
+    uint64_t width = uint64_t(1) << (e - SUB_BITS);
+    uint64_t low = (SUB + sub) << (e - SUB_BITS);
+
+    // Middle of the bucket
+    return (int64_t)(low + width / 2);
+}
+
+void DagProfileStats::add(const DagRunProfile &profile) {
+    std::vector<dag_index_t> path = dag_critical_path(profile);
+    std::lock_guard<std::mutex> lg(mtx);
+
+    if (nodes.size() != profile.nodes.size()) {
+        if (!nodes.empty())
+            return;
+
+        nodes.resize(profile.nodes.size());
+    }
+
+    for (std::size_t i = 0; i < nodes.size(); i++) {
+        const DagNodeTiming &t = profile.nodes[i];
+        if (t.start_ns < 0 || t.end_ns < 0)
+            continue;
+
+        nodes[i].hist[cost_bucket(t.end_ns - t.start_ns)]++;
+        nodes[i].total++;
+    }
+
+    for (dag_index_t id : path)
+        nodes[id].critical++;
+
+    runs++;
+}
+
+void DagProfileStats::clear() {
+    std::lock_guard<std::mutex> lg(mtx);
+    nodes.clear();
+    runs = 0;
+}
+
+std::size_t DagProfileStats::run_count() const {
+    std::lock_guard<std::mutex> lg(mtx);
+    return runs;
+}
+
+std::size_t DagProfileStats::node_count() const {
+    std::lock_guard<std::mutex> lg(mtx);
+    return nodes.size();
+}
+
+int64_t DagProfileStats::percentile(dag_index_t id, double p) const {
+    std::lock_guard<std::mutex> lg(mtx);
+
+    if (id >= nodes.size() || nodes[id].total == 0)
+        return -1;
+
+    const NodeStats &st = nodes[id];
+    p = std::clamp(p, 0.0, 1.0);
+
+    uint64_t rank = (uint64_t)std::ceil(p * (double)st.total);
+    rank = std::clamp<uint64_t>(rank, 1, st.total);
+
+    uint64_t cur = 0;
+    for (std::size_t i = 0; i < NUM_BUCKETS; i++) {
+        cur += st.hist[i];
+        if (cur >= rank)
+            return bucket_value(i);
+    }
+
+    return bucket_value(NUM_BUCKETS - 1);
+}
+
+std::size_t DagProfileStats::critical_count(dag_index_t id) const {
+    std::lock_guard<std::mutex> lg(mtx);
+
+    if (id >= nodes.size())
+        return 0;
+
+    return (std::size_t)nodes[id].critical;
+}
+
+} // namespace coke
@@ -0,0 +1,347 @@
+/**
+ * Copyright 2024 Coke Project (https://github.com/kedixa/coke)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Authors: kedixa (https://github.com/kedixa)
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <utility>
+#include <netdb.h>
+#include <sys/socket.h>
+
+#include "coke/net/dns.h"
+#include "coke/go.h"
+#include "coke/stop_token.h"
+#include "coke/wait.h"
+
+#include "workflow/DnsCache.h"
+#include "workflow/WFGlobal.h"
+
+namespace coke {
+
+namespace {
+
+using HostKey = std::pair<std::string, unsigned short>;
+
+struct HostState {
+    bool pinned{false};
+    bool resolving{false};
+    int64_t last_used{0};
+
+    // When to re-resolve it, zero means at the next check
+    int64_t refresh_time{0};
+};
+
+struct DnsState {
+    std::mutex mtx;
+    std::map<HostKey, HostState> hosts;
+    std::set<HostKey> revalidating;
+    DnsPrefetchParams params;
+
+    // Not nullptr when prefetching is started
+    std::unique_ptr<StopToken> token;
+
+    std::atomic<uint64_t> hits{0};
+    std::atomic<uint64_t> stale_hits{0};
+    std::atomic<uint64_t> misses{0};
+    std::atomic<uint64_t> resolves{0};
+    std::atomic<uint64_t> resolve_failures{0};
+    std::atomic<uint64_t> prefetches{0};
+};
+
+DnsState &get_dns_state() {
+    static DnsState state;
+    return state;
+}
+
+int64_t steady_now_ms() {
+    using namespace std::chrono;
+    auto now = steady_clock::now().time_since_epoch();
+    return duration_cast<milliseconds>(now).count();
+}
+
+// The time from resolved to refresh, in milliseconds
+int64_t refresh_delay(const DnsPrefetchParams &params) {
+    const WFGlobalSettings *settings = WFGlobal::get_global_settings();
+    int64_t ttl = std::max(settings->dns_ttl_default, settings->dns_ttl_min);
+    int64_t ahead = std::min<int64_t>(params.refresh_ahead, ttl / 2);
+
+    return (ttl - ahead) * 1000;
+}
+
+int resolve_routine(const std::string &host, unsigned short port,
+                    struct addrinfo **res) {
+    struct addrinfo hints{};
+    std::string port_str = std::to_string(port);
+
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_ADDRCONFIG | AI_NUMERICSERV;
+
+    return getaddrinfo(host.c_str(), port_str.c_str(), &hints, res);
+}
+
+Task<> revalidate(std::string host, unsigned short port) {
+    DnsState &s = get_dns_state();
+
+    co_await dns_resolve(host, port);
+
+    std::lock_guard<std::mutex> lg(s.mtx);
+    s.revalidating.erase(HostKey(std::move(host), port));
+}
+
+Task<> prefetch_one(DnsHost &h) {
+    DnsState &s = get_dns_state();
+    int ret = co_await dns_resolve(h.host, h.port);
+
+    std::lock_guard<std::mutex> lg(s.mtx);
+    auto it = s.hosts.find(HostKey(h.host, h.port));
+
+    if (it != s.hosts.end()) {
+        it->second.resolving = false;
+
+        // Retry at the next check if failed, the old entry is still used
+        // by the requests until it is replaced.
+        if (ret != 0)
+            it->second.refresh_time = 0;
+    }
+}
+
+Task<> prefetch_loop(StopToken *token, DnsPrefetchParams params) {
+    StopToken::FinishGuard guard(token);
+    DnsState &s = get_dns_state();
+    auto interval = std::chrono::milliseconds(std::max(params.check_interval, 1));
+    int64_t idle_ms = int64_t(params.idle_timeout) * 1000;
+    std::vector<DnsHost> todo;
+
+    while (!co_await token->wait_stop_for(interval)) {
+        int64_t now = steady_now_ms();
+        todo.clear();
+
+        {
+            std::lock_guard<std::mutex> lg(s.mtx);
+            auto it = s.hosts.begin();
+
+            while (it != s.hosts.end()) {
+                HostState &st = it->second;
+
+                if (!st.pinned && !st.resolving && now - st.last_used > idle_ms)
+                    it = s.hosts.erase(it);
+                else {
+                    if (!st.resolving && st.refresh_time <= now) {
+                        st.resolving = true;
+                        todo.push_back(DnsHost{it->first.first,
+                                               it->first.second});
+                    }
+
+                    ++it;
+                }
+            }
+        }
+
+        if (todo.empty())
+            continue;
+
+        s.prefetches.fetch_add(todo.size(), std::memory_order_relaxed);
+
+        std::size_t n = std::min(todo.size(), params.max_concurrency);
+        co_await async_for_each(todo, prefetch_one, n);
+    }
+}
+
+void add_host(DnsState &s, const std::string &host, unsigned short port,
+              bool pinned) {
+    auto ret = s.hosts.try_emplace(HostKey(host, port));
+    HostState &st = ret.first->second;
+
+    st.last_used = steady_now_ms();
+    if (pinned)
+        st.pinned = true;
+}
+
+} // namespace
+
+
+Task<int> dns_resolve(const std::string &host, unsigned short port) {
+    DnsState &s = get_dns_state();
+    struct addrinfo *ai = nullptr;
+
+    int ret = co_await go(WFGlobal::get_dns_queue(),
+                          WFGlobal::get_dns_executor(),
+                          resolve_routine, std::cref(host), port, &ai);
+
+    s.resolves.fetch_add(1, std::memory_order_relaxed);
+
+    if (ret != 0) {
+        s.resolve_failures.fetch_add(1, std::memory_order_relaxed);
+        co_return ret;
+    }
+
+    const WFGlobalSettings *settings = WFGlobal::get_global_settings();
+    DnsCache *cache = WFGlobal::get_dns_cache();
+
+    // The cache takes the ownership of ai
+    cache->release(cache->put(host, port, ai, settings->dns_ttl_default,
+                              settings->dns_ttl_min));
+
+    std::lock_guard<std::mutex> lg(s.mtx);
+    auto it = s.hosts.find(HostKey(host, port));
+
+    if (it != s.hosts.end())
+        it->second.refresh_time = steady_now_ms() + refresh_delay(s.params);
+
+    co_return 0;
+}
+
+Task<std::size_t> dns_preresolve(const std::vector<DnsHost> &hosts,
+                                 bool prefetch) {
+    DnsState &s = get_dns_state();
+    std::atomic<std::size_t> cnt{0};
+
+    if (prefetch) {
+        std::lock_guard<std::mutex> lg(s.mtx);
+
+        for (const DnsHost &h : hosts)
+            add_host(s, h.host, h.port, true);
+    }
+
+    auto resolve = [&cnt](const DnsHost &h) -> Task<> {
+        if (co_await dns_resolve(h.host, h.port) == 0)
+            cnt.fetch_add(1, std::memory_order_relaxed);
+    };
+
+    if (!hosts.empty())
+        co_await async_for_each(hosts, resolve, hosts.size());
+
+    co_return cnt.load();
+}
+
+int dns_cache_lookup(const std::string &host, unsigned short port) {
+    DnsState &s = get_dns_state();
+    DnsCache *cache = WFGlobal::get_dns_cache();
+    const DnsCache::DnsHandle *handle;
+    int ret = DNS_CACHE_HIT;
+    bool start = false;
+
+    handle = cache->get_ttl(host, port);
+    if (!handle) {
+        handle = cache->get_confident(host, port);
+        ret = handle ? DNS_CACHE_STALE : DNS_CACHE_MISS;
+    }
+
+    if (handle)
+        cache->release(handle);
+
+    switch (ret) {
+    case DNS_CACHE_HIT:
+        s.hits.fetch_add(1, std::memory_order_relaxed);
+        break;
+    case DNS_CACHE_STALE:
+        s.stale_hits.fetch_add(1, std::memory_order_relaxed);
+        break;
+    default:
+        s.misses.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    {
+        std::lock_guard<std::mutex> lg(s.mtx);
+
+        if (s.token)
+            add_host(s, host, port, false);
+
+        // Serve the stale entry, and re-resolve it in the background once
+        if (ret == DNS_CACHE_STALE)
+            start = s.revalidating.emplace(host, port).second;
+    }
+
+    if (start)
+        revalidate(host, port).detach();
+
+    return ret;
+}
+
+int dns_prefetch_start(const DnsPrefetchParams &params) {
+    DnsState &s = get_dns_state();
+    std::lock_guard<std::mutex> lg(s.mtx);
+
+    if (s.token)
+        return -1;
+
+    s.params = params;
+    s.token = std::make_unique<StopToken>();
+    prefetch_loop(s.token.get(), params).detach();
+    return 0;
+}
+
+Task<> dns_prefetch_stop() {
+    DnsState &s = get_dns_state();
+    std::unique_ptr<StopToken> token;
+
+    {
+        std::lock_guard<std::mutex> lg(s.mtx);
+        token = std::move(s.token);
+    }
+
+    if (token) {
+        token->request_stop();
+        co_await token->wait_finish();
+    }
+}
+
+void dns_prefetch_add(const std::string &host, unsigned short port) {
+    DnsState &s = get_dns_state();
+    std::lock_guard<std::mutex> lg(s.mtx);
+
+    add_host(s, host, port, true);
+}
+
+void dns_prefetch_remove(const std::string &host, unsigned short port) {
+    DnsState &s = get_dns_state();
+    std::lock_guard<std::mutex> lg(s.mtx);
+    auto it = s.hosts.find(HostKey(host, port));
+
+    // A resolving one is removed when it is idle
+    if (it != s.hosts.end()) {
+        if (it->second.resolving)
+            it->second.pinned = false;
+        else
+            s.hosts.erase(it);
+    }
+}
+
+DnsCacheStats get_dns_cache_stats() {
+    DnsState &s = get_dns_state();
+    DnsCacheStats stats;
+
+    stats.hits = s.hits.load(std::memory_order_relaxed);
+    stats.stale_hits = s.stale_hits.load(std::memory_order_relaxed);
+    stats.misses = s.misses.load(std::memory_order_relaxed);
+    stats.resolves = s.resolves.load(std::memory_order_relaxed);
+    stats.resolve_failures = s.resolve_failures.load(std::memory_order_relaxed);
+    stats.prefetches = s.prefetches.load(std::memory_order_relaxed);
+
+    std::lock_guard<std::mutex> lg(s.mtx);
+    stats.prefetch_hosts = s.hosts.size();
+    return stats;
+}
+
+} // namespace coke
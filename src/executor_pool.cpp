@@ -0,0 +1,178 @@
+/**
+ * Copyright 2024 Coke Project (https://github.com/kedixa/coke)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Authors: kedixa (https://github.com/kedixa)
+*/
+
+#include <cerrno>
+#include <latch>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "coke/executor_pool.h"
+
+namespace coke {
+
+namespace {
+
+/**
+ * @brief SetupSession applies the affinity and priority to the thread that
+ *        runs it. All the sessions wait for each other before that, so that
+ *        each thread of the pool runs exactly one of them.
+*/
+class SetupSession : public ExecSession {
+public:
+    SetupSession(const ExecutorPoolParams &params,
+                 std::latch &start, std::latch &done)
+        : params(params), start(start), done(done), error(0)
+    { }
+
+    int get_error() const noexcept { return error; }
+
+private:
+    virtual void execute() override {
+        start.arrive_and_wait();
+
+        if (!params.cpu_affinity.empty()) {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+
+            for (int cpu : params.cpu_affinity) {
+                if (cpu >= 0 && cpu < CPU_SETSIZE)
+                    CPU_SET(cpu, &set);
+            }
+
+            int ret = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+            if (ret != 0) {
+                error = ret;
+                return;
+            }
+        }
+
+        if (params.nice != 0) {
+            // On Linux the priority of PRIO_PROCESS with a thread id only
+            // applies to that thread
+            id_t tid = (id_t)syscall(SYS_gettid);
+            if (setpriority(PRIO_PROCESS, tid, params.nice) != 0)
+                error = errno;
+        }
+    }
+
+    // The session must be alive until handle returns, count down here
+    virtual void handle(int state, int err) override {
+        if (state != ES_STATE_FINISHED && error == 0)
+            error = err ? err : ECANCELED;
+
+        done.count_down();
+    }
+
+private:
+    const ExecutorPoolParams &params;
+    std::latch &start;
+    std::latch &done;
+    int error;
+};
+
+} // namespace
+
+int ExecutorPool::init(const ExecutorPoolParams &params) {
+    std::size_t n = params.threads ? params.threads : 1;
+    std::size_t n_queues = 0;
+
+    // Use a queue for each session, so that they are not serialized
+    std::vector<ExecQueue> setup_queues(n);
+    int error = 0;
+
+    while (n_queues < n && setup_queues[n_queues].init() == 0)
+        n_queues++;
+
+    if (n_queues < n)
+        error = errno;
+    else if (executor.init(n) < 0)
+        error = errno;
+    else {
+        std::vector<std::unique_ptr<SetupSession>> sessions;
+        std::latch start(n), done(n);
+
+        sessions.reserve(n);
+
+        for (std::size_t i = 0; i < n; i++) {
+            sessions.emplace_back(new SetupSession(params, start, done));
+
+            if (executor.request(sessions[i].get(), &setup_queues[i]) < 0) {
+                // This session never runs, release the others
+                if (error == 0)
+                    error = errno ? errno : ENOMEM;
+
+                start.count_down();
+                done.count_down();
+            }
+        }
+
+        done.wait();
+
+        for (std::size_t i = 0; i < n && error == 0; i++)
+            error = sessions[i]->get_error();
+
+        if (error != 0)
+            executor.deinit();
+    }
+
+    for (std::size_t i = 0; i < n_queues; i++)
+        setup_queues[i].deinit();
+
+    if (error != 0)
+        return -error;
+
+    threads = n;
+    inited = true;
+    return 0;
+}
+
+void ExecutorPool::deinit() {
+    if (!inited)
+        return;
+
+    executor.deinit();
+
+    std::lock_guard<std::mutex> lg(mtx);
+    for (auto &[name, queue] : queues)
+        queue->deinit();
+
+    queues.clear();
+    threads = 0;
+    inited = false;
+}
+
+ExecQueue *ExecutorPool::get_exec_queue(const std::string &name) {
+    std::lock_guard<std::mutex> lg(mtx);
+
+    auto it = queues.find(name);
+    if (it != queues.end())
+        return it->second.get();
+
+    auto queue = std::make_unique<ExecQueue>();
+    if (queue->init() < 0)
+        return nullptr;
+
+    ExecQueue *ptr = queue.get();
+    queues.emplace(name, std::move(queue));
+    return ptr;
+}
+
+} // namespace coke
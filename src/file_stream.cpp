@@ -0,0 +1,401 @@
+/**
+ * Copyright 2024 Coke Project (https://github.com/kedixa/coke)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Authors: kedixa (https://github.com/kedixa)
+*/
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <sys/uio.h>
+
+#include "coke/file_stream.h"
+#include "coke/global.h"
+
+namespace coke {
+
+static Task<FileResult>
+read_buffer(int fd, std::shared_ptr<std::vector<char>> buf, off_t offset) {
+    co_return co_await coke::pread(fd, buf->data(), buf->size(), offset);
+}
+
+/**
+ * Write all the data of `iov` from `offset`, short writes are continued from
+ * where they stop. `iov` is modified. Returns the number of bytes written, or
+ * a negative errno.
+*/
+static Task<long>
+write_all(int fd, std::vector<struct iovec> &iov, off_t offset) {
+    std::size_t first = 0;
+    long total = 0;
+
+    while (first < iov.size()) {
+        FileResult res = co_await coke::pwritev(fd, iov.data() + first,
+                                                (int)(iov.size() - first),
+                                                offset + total);
+
+        if (res.state != STATE_SUCCESS || res.nbytes <= 0) {
+            int err = (res.state != STATE_SUCCESS && res.error) ? res.error : EIO;
+            co_return -err;
+        }
+
+        std::size_t n = (std::size_t)res.nbytes;
+        total += res.nbytes;
+
+        while (first < iov.size() && n >= iov[first].iov_len)
+            n -= iov[first++].iov_len;
+
+        if (n > 0) {
+            iov[first].iov_base = (char *)iov[first].iov_base + n;
+            iov[first].iov_len -= n;
+        }
+    }
+
+    co_return total;
+}
+
+AsyncFileReader::AsyncFileReader(int fd, off_t offset,
+                                 const AsyncFileReaderParams &params)
+    : fd(fd), offset(offset), read_offset(offset), params(params)
+{
+    if (this->params.buffer_size == 0)
+        this->params.buffer_size = AsyncFileReaderParams().buffer_size;
+}
+
+void AsyncFileReader::issue() {
+    std::shared_ptr<Buffer> buf;
+
+    if (!free_bufs.empty()) {
+        buf = std::move(free_bufs.back());
+        free_bufs.pop_back();
+    }
+    else
+        buf = std::make_shared<Buffer>(params.buffer_size);
+
+    Future<FileResult> fut = create_future(read_buffer(fd, buf, read_offset));
+    read_offset += (off_t)params.buffer_size;
+    pending.push_back(Pending{std::move(buf), std::move(fut)});
+}
+
+void AsyncFileReader::stop_issue() {
+    // The preads in flight are beyond the end of file or the error, abandon
+    // them and their buffers are released when they finish.
+    stopped = true;
+    pending.clear();
+}
+
+Task<FileResult> AsyncFileReader::fill() {
+    if (cur_pos < cur_len)
+        co_return FileResult{STATE_SUCCESS, 0, (long)(cur_len - cur_pos)};
+
+    if (pending.empty() && !stopped)
+        issue();
+
+    if (pending.empty())
+        co_return FileResult{STATE_SUCCESS, 0, 0};
+
+    Pending p = std::move(pending.front());
+    pending.pop_front();
+
+    // Keep the read-ahead in flight while waiting for and consuming `p`
+    while (!stopped && pending.size() < params.read_ahead)
+        issue();
+
+    // The buffer can be reused only if no pread refers to it
+    if (cur && cur.use_count() == 1)
+        free_bufs.push_back(std::move(cur));
+
+    cur.reset();
+    cur_pos = cur_len = 0;
+
+    co_await p.fut.wait();
+    FileResult res = p.fut.get();
+
+    if (res.state != STATE_SUCCESS) {
+        stop_issue();
+        co_return res;
+    }
+
+    if ((std::size_t)res.nbytes < params.buffer_size)
+        stop_issue();
+
+    cur = std::move(p.buf);
+    cur_len = (std::size_t)res.nbytes;
+    co_return res;
+}
+
+Task<FileResult> AsyncFileReader::read(void *buf, std::size_t count) {
+    char *dst = static_cast<char *>(buf);
+    std::size_t total = 0;
+
+    while (total < count) {
+        FileResult res = co_await fill();
+
+        if (res.state != STATE_SUCCESS)
+            co_return res;
+
+        if (res.nbytes == 0)
+            break;
+
+        std::size_t n = std::min(count - total, cur_len - cur_pos);
+        std::memcpy(dst + total, cur->data() + cur_pos, n);
+
+        cur_pos += n;
+        total += n;
+        offset += (off_t)n;
+    }
+
+    co_return FileResult{STATE_SUCCESS, 0, (long)total};
+}
+
+Task<FileResult> AsyncFileReader::read_chunk(std::string_view &chunk) {
+    FileResult res = co_await fill();
+
+    chunk = std::string_view();
+    if (res.state != STATE_SUCCESS || res.nbytes == 0)
+        co_return res;
+
+    chunk = std::string_view(cur->data() + cur_pos, cur_len - cur_pos);
+    offset += (off_t)chunk.size();
+    cur_pos = cur_len;
+
+    co_return FileResult{STATE_SUCCESS, 0, (long)chunk.size()};
+}
+
+AsyncFileWriter::AsyncFileWriter(int fd, off_t offset,
+                                 const AsyncFileWriterParams &params)
+    : fd(fd), offset(offset), params(params), last_sync(Clock::now())
+{
+    if (this->params.buffer_size == 0)
+        this->params.buffer_size = AsyncFileWriterParams().buffer_size;
+
+    this->params.max_buffers = std::clamp(this->params.max_buffers,
+                                          (std::size_t)1, (std::size_t)IOV_MAX);
+}
+
+Task<int> AsyncFileWriter::write(const void *data, std::size_t count) {
+    const char *src = static_cast<const char *>(data);
+
+    if (error)
+        co_return -error;
+
+    while (count > 0) {
+        if (bufs.empty() || bufs.back().size() == params.buffer_size) {
+            if (bufs.size() == params.max_buffers) {
+                int ret = co_await write_out();
+                if (ret < 0)
+                    co_return ret;
+            }
+
+            if (!free_bufs.empty()) {
+                bufs.push_back(std::move(free_bufs.back()));
+                free_bufs.pop_back();
+            }
+            else {
+                bufs.emplace_back();
+                bufs.back().reserve(params.buffer_size);
+            }
+        }
+
+        Buffer &buf = bufs.back();
+        std::size_t n = std::min(count, params.buffer_size - buf.size());
+
+        buf.insert(buf.end(), src, src + n);
+        src += n;
+        count -= n;
+        buffered += n;
+    }
+
+    co_return 0;
+}
+
+Task<int> AsyncFileWriter::write_out() {
+    std::vector<struct iovec> iov;
+
+    iov.reserve(bufs.size());
+    for (Buffer &buf : bufs)
+        iov.push_back(iovec{buf.data(), buf.size()});
+
+    long nbytes = co_await write_all(fd, iov, offset);
+    if (nbytes < 0) {
+        error = (int)-nbytes;
+        co_return -error;
+    }
+
+    offset += (off_t)nbytes;
+    buffered -= (std::size_t)nbytes;
+    unsynced += (std::size_t)nbytes;
+
+    for (Buffer &buf : bufs) {
+        buf.clear();
+        free_bufs.push_back(std::move(buf));
+    }
+
+    bufs.clear();
+    co_return 0;
+}
+
+Task<int> AsyncFileWriter::do_sync() {
+    FileResult res = co_await coke::fdatasync(fd);
+
+    if (res.state != STATE_SUCCESS) {
+        error = res.error ? res.error : EIO;
+        co_return -error;
+    }
+
+    unsynced = 0;
+    last_sync = Clock::now();
+    co_return 0;
+}
+
+Task<int> AsyncFileWriter::flush() {
+    if (error)
+        co_return -error;
+
+    if (!bufs.empty()) {
+        int ret = co_await write_out();
+        if (ret < 0)
+            co_return ret;
+    }
+
+    if (unsynced == 0)
+        co_return 0;
+
+    bool by_bytes = params.sync_bytes > 0 && unsynced >= params.sync_bytes;
+    bool by_time = params.sync_interval.count() > 0 &&
+                   Clock::now() - last_sync >= params.sync_interval;
+
+    if (by_bytes || by_time)
+        co_return co_await do_sync();
+
+    co_return 0;
+}
+
+Task<int> AsyncFileWriter::sync() {
+    if (error)
+        co_return -error;
+
+    if (!bufs.empty()) {
+        int ret = co_await write_out();
+        if (ret < 0)
+            co_return ret;
+    }
+
+    co_return co_await do_sync();
+}
+
+CommitLog::CommitLog(int fd, off_t offset, const CommitLogParams &params)
+    : fd(fd), params(params), offset(offset)
+{
+    this->params.max_batch_records = std::clamp(this->params.max_batch_records,
+                                                (std::size_t)1,
+                                                (std::size_t)IOV_MAX);
+}
+
+Task<int> CommitLog::append(std::string_view record) {
+    std::shared_ptr<Batch> batch;
+    bool start = false;
+
+    {
+        std::lock_guard<std::mutex> lg(mtx);
+
+        if (error)
+            co_return -error;
+        if (closed)
+            co_return -EPIPE;
+
+        if (batches.empty() ||
+            batches.back()->iov.size() >= params.max_batch_records ||
+            batches.back()->bytes + record.size() > params.max_batch_bytes)
+        {
+            if (batches.empty() || !batches.back()->iov.empty())
+                batches.push_back(std::make_shared<Batch>());
+        }
+
+        batch = batches.back();
+        batch->iov.push_back(iovec{(void *)record.data(), record.size()});
+        batch->bytes += record.size();
+
+        if (!writing) {
+            writing = start = true;
+            writer.add(1);
+        }
+    }
+
+    if (start)
+        write_loop().detach();
+
+    co_await batch->done.wait();
+    co_return batch->result;
+}
+
+Task<> CommitLog::write_loop() {
+    std::shared_ptr<Batch> batch;
+    off_t pos;
+    int err;
+
+    while (true) {
+        {
+            std::lock_guard<std::mutex> lg(mtx);
+
+            if (batches.empty()) {
+                writing = false;
+                break;
+            }
+
+            batch = std::move(batches.front());
+            batches.pop_front();
+            pos = offset;
+            err = error;
+        }
+
+        long nbytes = err ? -err : co_await write_all(fd, batch->iov, pos);
+
+        if (nbytes >= 0 && params.sync) {
+            FileResult res = co_await coke::fdatasync(fd);
+            if (res.state != STATE_SUCCESS)
+                nbytes = -(res.error ? res.error : EIO);
+        }
+
+        {
+            std::lock_guard<std::mutex> lg(mtx);
+
+            if (nbytes >= 0) {
+                offset += (off_t)nbytes;
+                ++batch_count;
+            }
+            else if (error == 0)
+                error = (int)-nbytes;
+        }
+
+        batch->result = nbytes < 0 ? (int)nbytes : 0;
+        batch->done.count_down();
+        batch.reset();
+    }
+
+    writer.done();
+}
+
+Task<> CommitLog::close() {
+    {
+        std::lock_guard<std::mutex> lg(mtx);
+        closed = true;
+    }
+
+    co_await writer.wait();
+}
+
+} // namespace coke
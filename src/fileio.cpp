@@ -16,10 +16,499 @@
  * Authors: kedixa (https://github.com/kedixa)
 */
 
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+
 #include "coke/fileio.h"
+#include "coke/global.h"
 
 #include "workflow/WFTaskFactory.h"
 
+#ifdef COKE_ENABLE_IO_URING
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "workflow/WFGlobal.h"
+#include "workflow/SleepRequest.h"
+#endif
+
+namespace coke::detail {
+
+static std::atomic<int> fio_backend{FIO_BACKEND_AIO};
+static std::atomic<int> fio_uring_entries{256};
+
+void set_fio_backend(int backend, int uring_entries) noexcept {
+    fio_backend.store(backend, std::memory_order_relaxed);
+    fio_uring_entries.store(uring_entries > 0 ? uring_entries : 256,
+                            std::memory_order_relaxed);
+}
+
+#ifdef COKE_ENABLE_IO_URING
+
+class UringService;
+
+/**
+ * UringTask is a file io request on io_uring. The sqe is prepared when the
+ * task is created and copied into the ring when dispatched. When the
+ * completion is reaped, the task is handed to the poller as a zero duration
+ * timer, so that it finishes in handler threads like the Workflow's tasks.
+*/
+class UringTask : public SleepRequest {
+public:
+    using callback_t = std::function<void(UringTask *)>;
+
+    UringTask(CommScheduler *scheduler, UringService *service) noexcept
+        : SleepRequest(scheduler), service(service)
+    { }
+
+    void set_callback(callback_t cb) { callback = std::move(cb); }
+
+    int get_state() const noexcept { return this->state; }
+    int get_error() const noexcept { return this->error; }
+    long get_retval() const noexcept { return retval; }
+
+public:
+    struct io_uring_sqe sqe{};
+
+    // Used by the sqe of pread and pwrite
+    struct iovec iov{};
+
+protected:
+    virtual void dispatch() override;
+
+    virtual int duration(struct timespec *value) override {
+        value->tv_sec = 0;
+        value->tv_nsec = 0;
+        return 0;
+    }
+
+    virtual void handle(int st, int err) override {
+        if (st != SS_STATE_COMPLETE) {
+            this->state = STATE_SYS_ERROR;
+            this->error = err;
+            retval = -1;
+        }
+        else if (res < 0) {
+            this->state = STATE_SYS_ERROR;
+            this->error = -res;
+            retval = -1;
+        }
+        else {
+            this->state = STATE_SUCCESS;
+            this->error = 0;
+            retval = res;
+        }
+
+        this->subtask_done();
+    }
+
+    virtual SubTask *done() override {
+        SeriesWork *series = series_of(this);
+
+        if (callback)
+            callback(this);
+
+        delete this;
+        return series->pop();
+    }
+
+private:
+    UringService *service;
+    UringTask *next{nullptr};
+    int res{0};
+    long retval{-1};
+    callback_t callback;
+
+    friend class UringService;
+};
+
+/**
+ * UringService owns an io_uring instance and a reaper thread, it is created
+ * when first used and never destroyed, because the reaper may still be
+ * running at exit.
+ *
+ * The submitters copy sqes into the ring under a lock, and only one of them
+ * calls io_uring_enter at a time for all the sqes queued so far, so that
+ * concurrent requests are submitted in batches. When the ring is full, the
+ * tasks wait in a backlog and are submitted by the reaper after completions.
+*/
+class UringService {
+public:
+    static UringService *get_instance() {
+        static UringService *service = create();
+        return service;
+    }
+
+    void submit(UringTask *task);
+
+    int register_buffers(const struct iovec *iov, unsigned nr) {
+        long ret = syscall(__NR_io_uring_register, ring_fd,
+                           IORING_REGISTER_BUFFERS, iov, nr);
+        return ret < 0 ? -errno : 0;
+    }
+
+    int unregister_buffers() {
+        long ret = syscall(__NR_io_uring_register, ring_fd,
+                           IORING_UNREGISTER_BUFFERS, nullptr, 0);
+        return ret < 0 ? -errno : 0;
+    }
+
+private:
+    UringService() = default;
+
+    static UringService *create();
+
+    int init(unsigned entries);
+    void deinit();
+
+    int enter(unsigned to_submit, unsigned min_complete, unsigned flags) {
+        return (int)syscall(__NR_io_uring_enter, ring_fd, to_submit,
+                            min_complete, flags, nullptr, 0);
+    }
+
+    bool push_sqe(UringTask *task);
+    void push_backlog();
+    void flush(std::unique_lock<std::mutex> &lk);
+    UringTask *take_unsubmitted(int err);
+    void complete(UringTask *list);
+    void reap();
+
+private:
+    int ring_fd{-1};
+
+    void *sq_ptr{nullptr};
+    void *cq_ptr{nullptr};
+    std::size_t sq_size{0};
+    std::size_t cq_size{0};
+
+    unsigned *sq_head{nullptr};
+    unsigned *sq_tail{nullptr};
+    unsigned *sq_array{nullptr};
+    unsigned sq_mask{0};
+    unsigned sq_entries{0};
+    struct io_uring_sqe *sqes{nullptr};
+
+    unsigned *cq_head{nullptr};
+    unsigned *cq_tail{nullptr};
+    unsigned cq_mask{0};
+    unsigned cq_entries{0};
+    struct io_uring_cqe *cqes{nullptr};
+
+    std::mutex mtx;
+    unsigned local_tail{0};
+    unsigned to_submit{0};
+    unsigned inflight{0};
+    bool submitting{false};
+
+    UringTask *backlog_head{nullptr};
+    UringTask *backlog_tail{nullptr};
+};
+
+UringService *UringService::create() {
+    if (fio_backend.load(std::memory_order_relaxed) != FIO_BACKEND_IO_URING)
+        return nullptr;
+
+    UringService *service = new UringService();
+    unsigned entries = (unsigned)fio_uring_entries.load(std::memory_order_relaxed);
+
+    if (service->init(entries) < 0) {
+        delete service;
+        return nullptr;
+    }
+
+    std::thread(&UringService::reap, service).detach();
+    return service;
+}
+
+int UringService::init(unsigned entries) {
+    struct io_uring_params p{};
+    int fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+    if (fd < 0)
+        return -errno;
+
+    ring_fd = fd;
+    sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+
+    bool single_mmap = (p.features & IORING_FEAT_SINGLE_MMAP);
+    if (single_mmap)
+        sq_size = cq_size = std::max(sq_size, cq_size);
+
+    sq_ptr = mmap(nullptr, sq_size, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (sq_ptr == MAP_FAILED) {
+        sq_ptr = nullptr;
+        deinit();
+        return -1;
+    }
+
+    if (single_mmap)
+        cq_ptr = sq_ptr;
+    else {
+        cq_ptr = mmap(nullptr, cq_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (cq_ptr == MAP_FAILED) {
+            cq_ptr = nullptr;
+            deinit();
+            return -1;
+        }
+    }
+
+    void *sqe_ptr = mmap(nullptr, p.sq_entries * sizeof(struct io_uring_sqe),
+                         PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                         fd, IORING_OFF_SQES);
+    if (sqe_ptr == MAP_FAILED) {
+        deinit();
+        return -1;
+    }
+
+    char *sq = static_cast<char *>(sq_ptr);
+    char *cq = static_cast<char *>(cq_ptr);
+
+    sq_head = reinterpret_cast<unsigned *>(sq + p.sq_off.head);
+    sq_tail = reinterpret_cast<unsigned *>(sq + p.sq_off.tail);
+    sq_array = reinterpret_cast<unsigned *>(sq + p.sq_off.array);
+    sq_mask = *reinterpret_cast<unsigned *>(sq + p.sq_off.ring_mask);
+    sq_entries = p.sq_entries;
+    sqes = static_cast<struct io_uring_sqe *>(sqe_ptr);
+
+    cq_head = reinterpret_cast<unsigned *>(cq + p.cq_off.head);
+    cq_tail = reinterpret_cast<unsigned *>(cq + p.cq_off.tail);
+    cq_mask = *reinterpret_cast<unsigned *>(cq + p.cq_off.ring_mask);
+    cq_entries = p.cq_entries;
+    cqes = reinterpret_cast<struct io_uring_cqe *>(cq + p.cq_off.cqes);
+
+    local_tail = *sq_tail;
+    return 0;
+}
+
+void UringService::deinit() {
+    if (cq_ptr && cq_ptr != sq_ptr)
+        munmap(cq_ptr, cq_size);
+    if (sq_ptr)
+        munmap(sq_ptr, sq_size);
+
+    close(ring_fd);
+    ring_fd = -1;
+    sq_ptr = cq_ptr = nullptr;
+}
+
+bool UringService::push_sqe(UringTask *task) {
+    // Never have more requests in flight than the completion queue can hold
+    if (inflight >= cq_entries)
+        return false;
+
+    unsigned head = __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+    if (local_tail - head >= sq_entries)
+        return false;
+
+    unsigned index = local_tail & sq_mask;
+
+    sqes[index] = task->sqe;
+    sqes[index].user_data = (uint64_t)(uintptr_t)task;
+    sq_array[index] = index;
+
+    ++local_tail;
+    __atomic_store_n(sq_tail, local_tail, __ATOMIC_RELEASE);
+
+    ++inflight;
+    ++to_submit;
+    return true;
+}
+
+void UringService::push_backlog() {
+    while (backlog_head && push_sqe(backlog_head)) {
+        UringTask *task = backlog_head;
+        backlog_head = task->next;
+        task->next = nullptr;
+    }
+
+    if (!backlog_head)
+        backlog_tail = nullptr;
+}
+
+UringTask *UringService::take_unsubmitted(int err) {
+    UringTask *list = nullptr;
+
+    // Nothing else calls io_uring_enter with sqes to submit, so the kernel
+    // does not consume them, take them back and rewind the tail.
+    while (to_submit > 0) {
+        --to_submit;
+        --local_tail;
+        --inflight;
+
+        uint64_t data = sqes[local_tail & sq_mask].user_data;
+        UringTask *task = (UringTask *)(uintptr_t)data;
+        task->res = -err;
+        task->next = list;
+        list = task;
+    }
+
+    __atomic_store_n(sq_tail, local_tail, __ATOMIC_RELEASE);
+    return list;
+}
+
+void UringService::flush(std::unique_lock<std::mutex> &lk) {
+    UringTask *failed = nullptr;
+
+    if (submitting)
+        return;
+
+    submitting = true;
+
+    while (to_submit > 0) {
+        unsigned n = to_submit;
+        to_submit = 0;
+
+        lk.unlock();
+        int ret = enter(n, 0, 0);
+        int err = errno;
+        lk.lock();
+
+        if (ret >= 0) {
+            to_submit += n - std::min((unsigned)ret, n);
+            continue;
+        }
+
+        to_submit += n;
+        if (err == EINTR)
+            continue;
+
+        if (err == EAGAIN || err == EBUSY) {
+            // Retried by the reaper after some requests complete, unless
+            // nothing is in the kernel and the reaper never wakes up
+            if (inflight > to_submit)
+                break;
+
+            lk.unlock();
+            std::this_thread::yield();
+            lk.lock();
+            continue;
+        }
+
+        failed = take_unsubmitted(err);
+        break;
+    }
+
+    submitting = false;
+
+    if (failed) {
+        lk.unlock();
+        complete(failed);
+        lk.lock();
+    }
+}
+
+void UringService::submit(UringTask *task) {
+    std::unique_lock<std::mutex> lk(mtx);
+
+    if (backlog_head || !push_sqe(task)) {
+        if (backlog_tail)
+            backlog_tail->next = task;
+        else
+            backlog_head = task;
+
+        backlog_tail = task;
+        return;
+    }
+
+    flush(lk);
+}
+
+void UringService::reap() {
+    while (true) {
+        // Errors such as EINTR are ignored, the completion queue is checked
+        // anyway.
+        enter(0, 1, IORING_ENTER_GETEVENTS);
+
+        UringTask *list = nullptr;
+        UringTask **last = &list;
+        unsigned count = 0;
+        unsigned head = *cq_head;
+        unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+
+        for (; head != tail; head++, count++) {
+            struct io_uring_cqe *cqe = &cqes[head & cq_mask];
+            UringTask *task = (UringTask *)(uintptr_t)cqe->user_data;
+
+            task->res = cqe->res;
+            *last = task;
+            last = &task->next;
+        }
+
+        __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+
+        if (count > 0) {
+            std::unique_lock<std::mutex> lk(mtx);
+            inflight -= count;
+            push_backlog();
+            flush(lk);
+        }
+
+        complete(list);
+    }
+}
+
+void UringService::complete(UringTask *list) {
+    while (list) {
+        UringTask *task = list;
+        list = task->next;
+        task->next = nullptr;
+
+        // `task` may be destroyed after sleep
+        if (task->scheduler->sleep(task) < 0)
+            task->handle(SS_STATE_ERROR, errno);
+    }
+}
+
+void UringTask::dispatch() {
+    service->submit(this);
+}
+
+static UringTask *create_uring_task(UringService *service, uint8_t opcode,
+                                    int fd, const void *addr, unsigned len,
+                                    off_t offset) {
+    UringTask *task = new UringTask(WFGlobal::get_scheduler(), service);
+    struct io_uring_sqe &sqe = task->sqe;
+
+    sqe.opcode = opcode;
+    sqe.fd = fd;
+    sqe.addr = (uint64_t)(uintptr_t)addr;
+    sqe.len = len;
+    sqe.off = (uint64_t)offset;
+    return task;
+}
+
+static UringTask *create_uring_rw_task(UringService *service, uint8_t opcode,
+                                       int fd, const void *buf,
+                                       std::size_t count, off_t offset) {
+    UringTask *task = create_uring_task(service, opcode, fd, nullptr, 1, offset);
+
+    task->iov.iov_base = const_cast<void *>(buf);
+    task->iov.iov_len = count;
+    task->sqe.addr = (uint64_t)(uintptr_t)&task->iov;
+    return task;
+}
+
+static UringService *get_uring_service() {
+    if (fio_backend.load(std::memory_order_relaxed) != FIO_BACKEND_IO_URING)
+        return nullptr;
+
+    return UringService::get_instance();
+}
+
+#endif // COKE_ENABLE_IO_URING
+
+} // namespace coke::detail
+
 namespace coke {
 
 template<typename Task>
@@ -37,33 +526,132 @@ FileAwaiter::FileAwaiter(Task *task) {
 }
 
 FileAwaiter pread(int fd, void *buf, std::size_t count, off_t offset) {
+#ifdef COKE_ENABLE_IO_URING
+    if (auto *service = detail::get_uring_service()) {
+        return FileAwaiter(detail::create_uring_rw_task(service,
+            IORING_OP_READV, fd, buf, count, offset));
+    }
+#endif
+
     auto *task = WFTaskFactory::create_pread_task(fd, buf, count, offset, nullptr);
     return FileAwaiter(task);
 }
 
 FileAwaiter pwrite(int fd, const void *buf, std::size_t count, off_t offset) {
+#ifdef COKE_ENABLE_IO_URING
+    if (auto *service = detail::get_uring_service()) {
+        return FileAwaiter(detail::create_uring_rw_task(service,
+            IORING_OP_WRITEV, fd, buf, count, offset));
+    }
+#endif
+
     auto *task = WFTaskFactory::create_pwrite_task(fd, buf, count, offset, nullptr);
     return FileAwaiter(task);
 }
 
 FileAwaiter preadv(int fd, const struct iovec *iov, int iovcnt, off_t offset) {
+#ifdef COKE_ENABLE_IO_URING
+    if (auto *service = detail::get_uring_service()) {
+        return FileAwaiter(detail::create_uring_task(service,
+            IORING_OP_READV, fd, iov, (unsigned)iovcnt, offset));
+    }
+#endif
+
     auto *task = WFTaskFactory::create_preadv_task(fd, iov, iovcnt, offset, nullptr);
     return FileAwaiter(task);
 }
 
 FileAwaiter pwritev(int fd, const struct iovec *iov, int iovcnt, off_t offset) {
+#ifdef COKE_ENABLE_IO_URING
+    if (auto *service = detail::get_uring_service()) {
+        return FileAwaiter(detail::create_uring_task(service,
+            IORING_OP_WRITEV, fd, iov, (unsigned)iovcnt, offset));
+    }
+#endif
+
     auto *task = WFTaskFactory::create_pwritev_task(fd, iov, iovcnt, offset, nullptr);
     return FileAwaiter(task);
 }
 
 FileAwaiter fsync(int fd) {
+#ifdef COKE_ENABLE_IO_URING
+    if (auto *service = detail::get_uring_service()) {
+        return FileAwaiter(detail::create_uring_task(service,
+            IORING_OP_FSYNC, fd, nullptr, 0, 0));
+    }
+#endif
+
     auto *task = WFTaskFactory::create_fsync_task(fd, nullptr);
     return FileAwaiter(task);
 }
 
 FileAwaiter fdatasync(int fd) {
+#ifdef COKE_ENABLE_IO_URING
+    if (auto *service = detail::get_uring_service()) {
+        auto *task = detail::create_uring_task(service,
+            IORING_OP_FSYNC, fd, nullptr, 0, 0);
+        task->sqe.fsync_flags = IORING_FSYNC_DATASYNC;
+        return FileAwaiter(task);
+    }
+#endif
+
     auto *task = WFTaskFactory::create_fdsync_task(fd, nullptr);
     return FileAwaiter(task);
 }
 
+FileAwaiter pread_fixed(int fd, void *buf, std::size_t count, off_t offset,
+                        int buf_index) {
+#ifdef COKE_ENABLE_IO_URING
+    if (auto *service = detail::get_uring_service()) {
+        auto *task = detail::create_uring_task(service,
+            IORING_OP_READ_FIXED, fd, buf, (unsigned)count, offset);
+        task->sqe.buf_index = (uint16_t)buf_index;
+        return FileAwaiter(task);
+    }
+#endif
+
+    return pread(fd, buf, count, offset);
+}
+
+FileAwaiter pwrite_fixed(int fd, const void *buf, std::size_t count,
+                         off_t offset, int buf_index) {
+#ifdef COKE_ENABLE_IO_URING
+    if (auto *service = detail::get_uring_service()) {
+        auto *task = detail::create_uring_task(service,
+            IORING_OP_WRITE_FIXED, fd, buf, (unsigned)count, offset);
+        task->sqe.buf_index = (uint16_t)buf_index;
+        return FileAwaiter(task);
+    }
+#endif
+
+    return pwrite(fd, buf, count, offset);
+}
+
+int register_file_buffers(const struct iovec *iov, unsigned nr) {
+#ifdef COKE_ENABLE_IO_URING
+    if (auto *service = detail::get_uring_service())
+        return service->register_buffers(iov, nr);
+#endif
+
+    return -ENOTSUP;
+}
+
+int unregister_file_buffers() {
+#ifdef COKE_ENABLE_IO_URING
+    if (auto *service = detail::get_uring_service())
+        return service->unregister_buffers();
+#endif
+
+    return -ENOTSUP;
+}
+
+int get_fio_backend() {
+#ifdef COKE_ENABLE_IO_URING
+    if (detail::get_uring_service())
+        return FIO_BACKEND_IO_URING;
+#endif
+
+    return FIO_BACKEND_AIO;
+}
+
 } // namespace coke
@@ -0,0 +1,112 @@
+/**
+ * Copyright 2024 Coke Project (https://github.com/kedixa/coke)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Authors: kedixa (https://github.com/kedixa)
+*/
+
+#include <new>
+
+#include "coke/detail/frame_pool.h"
+#include "coke/detail/free_list.h"
+#include "coke/detail/constant.h"
+
+namespace coke::detail {
+
+static constexpr std::size_t FRAME_GRANULE = 32;
+static constexpr std::size_t FRAME_CLASS_NUM =
+    (FRAME_POOL_MAX_SIZE + FRAME_GRANULE - 1) / FRAME_GRANULE;
+
+static_assert(FRAME_POOL_MAX_SIZE > 0, "FRAME_POOL_MAX_SIZE must be positive");
+
+class FrameCache : public ThreadLocalCache<FrameCache> {
+public:
+    void *alloc(std::size_t idx) noexcept {
+        void *ptr = lists[idx].pop();
+
+        if (ptr)
+            ++stats.hits;
+        else
+            ++stats.misses;
+
+        return ptr;
+    }
+
+    bool free(void *ptr, std::size_t idx) noexcept {
+        return lists[idx].push(ptr, FRAME_POOL_CACHE_COUNT);
+    }
+
+    void add_miss() noexcept { ++stats.misses; }
+
+    FramePoolStats get_stats() const noexcept { return stats; }
+
+private:
+    FreeList lists[FRAME_CLASS_NUM];
+    FramePoolStats stats;
+};
+
+static inline std::size_t frame_class(std::size_t size) noexcept {
+    return (size + FRAME_GRANULE - 1) / FRAME_GRANULE - 1;
+}
+
+void *frame_pool_alloc(std::size_t size) {
+    FrameCache *cache = FrameCache::get();
+
+    if (size == 0 || size > FRAME_POOL_MAX_SIZE) {
+        if (cache)
+            cache->add_miss();
+
+        return ::operator new(size);
+    }
+
+    std::size_t idx = frame_class(size);
+    void *ptr = nullptr;
+
+    if (cache)
+        ptr = cache->alloc(idx);
+
+    // Always allocate the whole size class, so that the frame can be reused
+    // by any other frame in the same class.
+    if (!ptr)
+        ptr = ::operator new((idx + 1) * FRAME_GRANULE);
+
+    return ptr;
+}
+
+void frame_pool_free(void *ptr, std::size_t size) noexcept {
+    if (size == 0 || size > FRAME_POOL_MAX_SIZE) {
+        ::operator delete(ptr);
+        return;
+    }
+
+    FrameCache *cache = FrameCache::get();
+
+    if (!cache || !cache->free(ptr, frame_class(size)))
+        ::operator delete(ptr);
+}
+
+} // namespace coke::detail
+
+namespace coke {
+
+FramePoolStats get_frame_pool_stats() noexcept {
+    detail::FrameCache *cache = detail::FrameCache::get();
+
+    if (cache)
+        return cache->get_stats();
+
+    return FramePoolStats{};
+}
+
+} // namespace coke
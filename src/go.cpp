@@ -16,6 +16,14 @@
  * Authors: kedixa (https://github.com/kedixa)
 */
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+
 #include "coke/go.h"
 
 #include "workflow/WFGlobal.h"
@@ -30,9 +38,171 @@ Executor *get_compute_executor() {
     return WFGlobal::get_compute_executor();
 }
 
+std::size_t get_compute_threads() noexcept {
+    // Workflow uses the number of processors for non positive value
+    int n = WFGlobal::get_global_settings()->compute_threads;
+    if (n > 0)
+        return (std::size_t)n;
+
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+ExecQueue *get_yield_exec_queue() {
+    // Looking up the queue by name needs a lock, cache it
+    static ExecQueue *queue = get_exec_queue(std::string(YIELD_EXEC_QUEUE));
+    return queue;
+}
+
+static int64_t current_nano() noexcept {
+    auto now = std::chrono::steady_clock::now().time_since_epoch();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(now).count();
+}
+
+class GoQueueState {
+public:
+    void set_params(const GoQueueParams &params) {
+        std::vector<GoTaskBase *> ready;
+
+        {
+            std::lock_guard<std::mutex> lg(mtx);
+            max_conc = params.max_concurrency;
+
+            while (parked_head && (max_conc == 0 || running < max_conc)) {
+                ready.push_back(pop_parked());
+                running++;
+            }
+        }
+
+        for (GoTaskBase *task : ready)
+            task->dispatch_parked();
+    }
+
+    bool acquire(GoTaskBase *task) {
+        task->submit_nano = current_nano();
+
+        std::lock_guard<std::mutex> lg(mtx);
+        submit_count++;
+
+        if (max_conc == 0 || running < max_conc) {
+            running++;
+            return true;
+        }
+
+        task->next_parked = nullptr;
+        if (parked_tail)
+            parked_tail->next_parked = task;
+        else
+            parked_head = task;
+        parked_tail = task;
+
+        return false;
+    }
+
+    void started(GoTaskBase *task) noexcept {
+        int64_t wait = current_nano() - task->submit_nano;
+
+        std::lock_guard<std::mutex> lg(mtx);
+        start_count++;
+        total_wait += wait;
+        max_wait = std::max(max_wait, wait);
+    }
+
+    void release() {
+        GoTaskBase *next = nullptr;
+
+        {
+            std::lock_guard<std::mutex> lg(mtx);
+
+            // The running one is handed over to the first parked task, unless
+            // the limit is lowered
+            if (parked_head && (max_conc == 0 || running <= max_conc))
+                next = pop_parked();
+            else
+                running--;
+        }
+
+        if (next)
+            next->dispatch_parked();
+    }
+
+    void get_stats(GoQueueStats &stats) {
+        std::lock_guard<std::mutex> lg(mtx);
+
+        stats.submit_count = submit_count;
+        stats.start_count = start_count;
+        stats.depth = (std::size_t)(submit_count - start_count);
+        stats.running = running;
+        stats.total_wait = std::chrono::nanoseconds(total_wait);
+        stats.max_wait = std::chrono::nanoseconds(max_wait);
+    }
+
+private:
+    GoTaskBase *pop_parked() noexcept {
+        GoTaskBase *task = parked_head;
+
+        parked_head = task->next_parked;
+        if (!parked_head)
+            parked_tail = nullptr;
+
+        task->next_parked = nullptr;
+        return task;
+    }
+
+private:
+    std::mutex mtx;
+    std::size_t max_conc{0};
+    std::size_t running{0};
+    GoTaskBase *parked_head{nullptr};
+    GoTaskBase *parked_tail{nullptr};
+
+    uint64_t submit_count{0};
+    uint64_t start_count{0};
+    int64_t total_wait{0};
+    int64_t max_wait{0};
+};
+
+// The states are never destroyed, because tasks may refer to them at any time
+static std::mutex go_queue_mtx;
+static std::map<ExecQueue *, std::unique_ptr<GoQueueState>> go_queue_states;
+static std::atomic<bool> go_queue_configured{false};
+
+GoQueueState *find_go_queue_state(ExecQueue *queue) noexcept {
+    // Fast path for the most common case that no queue is configured
+    if (!go_queue_configured.load(std::memory_order_acquire))
+        return nullptr;
+
+    std::lock_guard<std::mutex> lg(go_queue_mtx);
+    auto it = go_queue_states.find(queue);
+    return it == go_queue_states.end() ? nullptr : it->second.get();
+}
+
+bool go_queue_acquire(GoQueueState *qstate, GoTaskBase *task) {
+    return qstate->acquire(task);
+}
+
+void go_queue_started(GoQueueState *qstate, GoTaskBase *task) noexcept {
+    qstate->started(task);
+}
+
+void go_queue_release(GoQueueState *qstate) {
+    qstate->release();
+}
+
+static thread_local ExecQueue *cur_go_queue = nullptr;
+
+ExecQueue *current_go_queue() noexcept {
+    return cur_go_queue;
+}
+
 SubTask *GoTaskBase::done() {
     SeriesWork *series = series_of(this);
 
+    if (qstate)
+        go_queue_release(qstate);
+
+    // The awaiter is resumed in this thread
+    cur_go_queue = this->queue;
+
     awaiter->done();
 
     delete this;
@@ -40,3 +210,36 @@ SubTask *GoTaskBase::done() {
 }
 
 } // namespace coke::detail
+
+namespace coke {
+
+void set_go_queue_params(const std::string &name, const GoQueueParams &params) {
+    ExecQueue *queue = detail::get_exec_queue(name);
+    detail::GoQueueState *qstate;
+
+    {
+        std::lock_guard<std::mutex> lg(detail::go_queue_mtx);
+        auto &ptr = detail::go_queue_states[queue];
+
+        if (!ptr)
+            ptr = std::make_unique<detail::GoQueueState>();
+
+        qstate = ptr.get();
+        detail::go_queue_configured.store(true, std::memory_order_release);
+    }
+
+    qstate->set_params(params);
+}
+
+bool get_go_queue_stats(const std::string &name, GoQueueStats &stats) {
+    ExecQueue *queue = detail::get_exec_queue(name);
+    detail::GoQueueState *qstate = detail::find_go_queue_state(queue);
+
+    if (!qstate)
+        return false;
+
+    qstate->get_stats(stats);
+    return true;
+}
+
+} // namespace coke
@@ -0,0 +1,293 @@
+/**
+ * Copyright 2024 Coke Project (https://github.com/kedixa/coke)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Authors: kedixa (https://github.com/kedixa)
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <string_view>
+#include <unordered_map>
+
+#include "coke/http/http_cache.h"
+#include "coke/http/http_utils.h"
+
+namespace coke {
+
+using Clock = std::chrono::steady_clock;
+
+struct HttpCache::Shard {
+    struct Item {
+        std::string url;
+        HttpCacheResult resp;
+        std::string etag;
+        Clock::time_point expire_at;
+        std::size_t size;
+    };
+
+    using ItemList = std::list<Item>;
+
+    bool lookup(const std::string &url, Item &item) {
+        std::lock_guard<std::mutex> lg(mtx);
+        auto it = index.find(url);
+        if (it == index.end())
+            return false;
+
+        lru.splice(lru.begin(), lru, it->second);
+        item = *(it->second);
+        return true;
+    }
+
+    void insert(Item &&item) {
+        std::lock_guard<std::mutex> lg(mtx);
+        erase_locked(item.url);
+
+        if (item.size > capacity)
+            return;
+
+        bytes += item.size;
+        lru.push_front(std::move(item));
+        index.emplace(lru.front().url, lru.begin());
+
+        while (bytes > capacity) {
+            bytes -= lru.back().size;
+            index.erase(lru.back().url);
+            lru.pop_back();
+        }
+    }
+
+    // Extend the freshness if the cached response is still `resp`
+    void refresh(const std::string &url, const HttpCacheResult &resp,
+                 Clock::time_point expire_at) {
+        std::lock_guard<std::mutex> lg(mtx);
+        auto it = index.find(url);
+
+        if (it != index.end() && it->second->resp == resp) {
+            it->second->expire_at = expire_at;
+            lru.splice(lru.begin(), lru, it->second);
+        }
+    }
+
+    bool erase(const std::string &url) {
+        std::lock_guard<std::mutex> lg(mtx);
+        return erase_locked(url);
+    }
+
+    bool erase_locked(const std::string &url) {
+        auto it = index.find(url);
+        if (it == index.end())
+            return false;
+
+        bytes -= it->second->size;
+        lru.erase(it->second);
+        index.erase(it);
+        return true;
+    }
+
+    void clear() {
+        std::lock_guard<std::mutex> lg(mtx);
+        index.clear();
+        lru.clear();
+        bytes = 0;
+    }
+
+    std::size_t capacity{0};
+
+    mutable std::mutex mtx;
+    std::size_t bytes{0};
+    ItemList lru;
+    std::unordered_map<std::string, ItemList::iterator> index;
+};
+
+namespace {
+
+struct CacheControl {
+    bool no_store{false};
+    bool no_cache{false};
+    long long max_age{-1};
+};
+
+std::string_view trim(std::string_view s) {
+    while (!s.empty() && (s.front() == ' ' || s.front() == '\t'))
+        s.remove_prefix(1);
+    while (!s.empty() && (s.back() == ' ' || s.back() == '\t'))
+        s.remove_suffix(1);
+    return s;
+}
+
+void parse_cache_control(std::string_view value, CacheControl &cc) {
+    while (!value.empty()) {
+        std::size_t pos = value.find(',');
+        std::string_view token = trim(value.substr(0, pos));
+        value = (pos == std::string_view::npos) ? std::string_view()
+                                                : value.substr(pos + 1);
+
+        if (http_name_equal(token, "no-store"))
+            cc.no_store = true;
+        else if (http_name_equal(token, "no-cache"))
+            cc.no_cache = true;
+        else if (token.size() > 8 && http_name_equal(token.substr(0, 8), "max-age=")) {
+            std::string num(token.substr(8));
+            cc.max_age = std::strtoll(num.c_str(), nullptr, 10);
+        }
+    }
+}
+
+} // namespace
+
+HttpCache::HttpCache(const HttpCacheParams &params)
+    : params(params)
+{
+    std::size_t n = std::max(params.shards, std::size_t(1));
+
+    shards.reserve(n);
+    for (std::size_t i = 0; i < n; i++) {
+        shards.emplace_back(std::make_unique<Shard>());
+        shards.back()->capacity = params.max_bytes / n;
+    }
+}
+
+HttpCache::~HttpCache() = default;
+
+HttpCache::Shard &HttpCache::get_shard(const std::string &url) {
+    std::size_t h = std::hash<std::string>{}(url);
+    return *shards[h % shards.size()];
+}
+
+Task<HttpCacheResult>
+HttpCache::get(HttpClient &client, std::string url,
+               HttpClient::HttpHeader headers) {
+    Shard::Item item;
+
+    if (get_shard(url).lookup(url, item) && Clock::now() < item.expire_at) {
+        hits.fetch_add(1, std::memory_order_relaxed);
+        co_return item.resp;
+    }
+
+    misses.fetch_add(1, std::memory_order_relaxed);
+
+    auto ptr = co_await flight.call(url, [&]() {
+        return load(client, url, headers);
+    });
+
+    co_return ptr ? *ptr : nullptr;
+}
+
+Task<HttpCacheResult>
+HttpCache::load(HttpClient &client, const std::string &url,
+                const HttpClient::HttpHeader &headers) {
+    Shard &shard = get_shard(url);
+    Shard::Item old;
+    bool has_old = shard.lookup(url, old);
+    HttpClient::HttpHeader req_headers = headers;
+
+    if (has_old && !old.etag.empty())
+        req_headers.emplace_back("If-None-Match", old.etag);
+
+    loads.fetch_add(1, std::memory_order_relaxed);
+    HttpResult res = co_await client.request(url, "GET", req_headers,
+                                             std::string());
+
+    auto resp = std::make_shared<HttpCachedResponse>();
+    resp->state = res.state;
+    resp->error = res.error;
+
+    if (res.state != STATE_SUCCESS)
+        co_return resp;
+
+    const char *code = res.resp.get_status_code();
+    resp->status_code = code ? code : "";
+
+    CacheControl cc;
+    std::string etag;
+
+    for (const HttpHeaderView &header : HttpHeaderCursor(res.resp)) {
+        if (http_name_equal(header.name, "Cache-Control"))
+            parse_cache_control(header.value, cc);
+        else if (http_name_equal(header.name, "ETag"))
+            etag.assign(header.value);
+
+        // The body is decoded
+        if (!http_name_equal(header.name, "Transfer-Encoding"))
+            resp->headers.emplace_back(header.name, header.value);
+    }
+
+    Clock::time_point now = Clock::now();
+    Clock::time_point expire_at = now;
+
+    if (cc.no_cache)
+        expire_at = now;
+    else if (cc.max_age >= 0)
+        expire_at = now + std::chrono::seconds(cc.max_age);
+    else
+        expire_at = now + std::chrono::milliseconds(params.default_ttl);
+
+    if (has_old && resp->status_code == "304") {
+        // Not modified, the cached one is still valid
+        revalidated.fetch_add(1, std::memory_order_relaxed);
+        shard.refresh(url, old.resp, expire_at);
+        co_return old.resp;
+    }
+
+    for (std::string_view chunk : HttpChunkCursor(res.resp))
+        resp->body.append(chunk);
+
+    if (resp->status_code != "200" || cc.no_store)
+        co_return resp;
+
+    // Nothing to do with a stale response without ETag
+    if (expire_at <= now && etag.empty())
+        co_return resp;
+
+    std::size_t size = url.size() + etag.size() + resp->body.size();
+    for (const auto &[name, value] : resp->headers)
+        size += name.size() + value.size();
+
+    shard.insert(Shard::Item{url, resp, std::move(etag), expire_at, size});
+    co_return resp;
+}
+
+bool HttpCache::remove(const std::string &url) {
+    flight.forget(url);
+    return get_shard(url).erase(url);
+}
+
+void HttpCache::clear() {
+    flight.clear();
+    for (auto &shard : shards)
+        shard->clear();
+}
+
+HttpCacheStats HttpCache::get_stats() const {
+    HttpCacheStats stats;
+    stats.hits = hits.load(std::memory_order_relaxed);
+    stats.misses = misses.load(std::memory_order_relaxed);
+    stats.loads = loads.load(std::memory_order_relaxed);
+    stats.revalidated = revalidated.load(std::memory_order_relaxed);
+
+    for (const auto &shard : shards) {
+        std::lock_guard<std::mutex> lg(shard->mtx);
+        stats.entries += shard->index.size();
+        stats.bytes += shard->bytes;
+    }
+
+    return stats;
+}
+
+} // namespace coke
@@ -0,0 +1,388 @@
+/**
+ * Copyright 2024 Coke Project (https://github.com/kedixa/coke)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Authors: kedixa (https://github.com/kedixa)
+*/
+
+#include <cerrno>
+#include <cstdlib>
+
+#ifdef COKE_ENABLE_ZLIB
+#include <zlib.h>
+#endif
+
+#include "coke/go.h"
+#include "coke/http/http_encoding.h"
+#include "coke/http/http_utils.h"
+
+namespace coke {
+
+namespace {
+
+std::string_view trim(std::string_view s) {
+    while (!s.empty() && (s.front() == ' ' || s.front() == '\t'))
+        s.remove_prefix(1);
+    while (!s.empty() && (s.back() == ' ' || s.back() == '\t'))
+        s.remove_suffix(1);
+    return s;
+}
+
+std::string_view get_header(const HttpMessage &msg, std::string_view name) {
+    for (const HttpHeaderView &header : HttpHeaderCursor(msg)) {
+        if (http_name_equal(header.name, name))
+            return header.value;
+    }
+
+    return std::string_view();
+}
+
+const char *coding_name(HttpCoding coding) {
+    switch (coding) {
+    case HttpCoding::GZIP: return "gzip";
+    case HttpCoding::DEFLATE: return "deflate";
+    default: return "identity";
+    }
+}
+
+/**
+ * Choose the best supported coding in Accept-Encoding, gzip is preferred when
+ * q values are equal. The `*` wildcard is not supported.
+*/
+HttpCoding choose_coding(std::string_view accept) {
+    HttpCoding best = HttpCoding::IDENTITY;
+    double best_q = 0.0;
+
+    while (!accept.empty()) {
+        std::size_t pos = accept.find(',');
+        std::string_view item = trim(accept.substr(0, pos));
+        accept = (pos == std::string_view::npos) ? std::string_view()
+                                                 : accept.substr(pos + 1);
+
+        double q = 1.0;
+        std::size_t semi = item.find(';');
+        if (semi != std::string_view::npos) {
+            std::string_view param = trim(item.substr(semi + 1));
+            if (param.starts_with("q="))
+                q = std::strtod(std::string(param.substr(2)).c_str(), nullptr);
+            item = trim(item.substr(0, semi));
+        }
+
+        HttpCoding coding;
+        if (q <= 0.0 || !http_parse_coding(item, coding) ||
+            coding == HttpCoding::IDENTITY || !http_encoding_supported(coding))
+            continue;
+
+        if (q > best_q || (q == best_q && coding == HttpCoding::GZIP)) {
+            best = coding;
+            best_q = q;
+        }
+    }
+
+    return best;
+}
+
+} // namespace
+
+bool http_parse_coding(std::string_view value, HttpCoding &coding) noexcept {
+    value = trim(value);
+
+    if (value.empty() || http_name_equal(value, "identity"))
+        coding = HttpCoding::IDENTITY;
+    else if (http_name_equal(value, "gzip") || http_name_equal(value, "x-gzip"))
+        coding = HttpCoding::GZIP;
+    else if (http_name_equal(value, "deflate"))
+        coding = HttpCoding::DEFLATE;
+    else
+        return false;
+
+    return true;
+}
+
+#ifdef COKE_ENABLE_ZLIB
+
+struct HttpDecompressor::State {
+    z_stream strm;
+};
+
+bool http_encoding_supported(HttpCoding) noexcept { return true; }
+
+std::string_view http_accept_encoding() noexcept { return "gzip, deflate"; }
+
+int http_compress(HttpCoding coding, std::string_view in, std::string &out,
+                  int level) {
+    if (coding == HttpCoding::IDENTITY) {
+        out.append(in);
+        return 0;
+    }
+
+    z_stream strm{};
+    int bits = (coding == HttpCoding::GZIP) ? MAX_WBITS + 16 : MAX_WBITS;
+
+    if (deflateInit2(&strm, level, Z_DEFLATED, bits, 8,
+                     Z_DEFAULT_STRATEGY) != Z_OK)
+        return -ENOMEM;
+
+    std::size_t old_size = out.size();
+    std::size_t bound = deflateBound(&strm, in.size());
+    out.resize(old_size + bound);
+
+    strm.next_in = (Bytef *)in.data();
+    strm.avail_in = (uInt)in.size();
+    strm.next_out = (Bytef *)out.data() + old_size;
+    strm.avail_out = (uInt)bound;
+
+    int ret = deflate(&strm, Z_FINISH);
+    out.resize(old_size + strm.total_out);
+    deflateEnd(&strm);
+
+    if (ret != Z_STREAM_END) {
+        out.resize(old_size);
+        return -ENOMEM;
+    }
+
+    return 0;
+}
+
+HttpDecompressor::HttpDecompressor() noexcept = default;
+
+HttpDecompressor::~HttpDecompressor() {
+    if (state)
+        inflateEnd(&state->strm);
+}
+
+HttpDecompressor::HttpDecompressor(HttpDecompressor &&) noexcept = default;
+
+HttpDecompressor &
+HttpDecompressor::operator= (HttpDecompressor &&that) noexcept {
+    if (this != &that) {
+        if (state)
+            inflateEnd(&state->strm);
+
+        coding = that.coding;
+        finished = that.finished;
+        state = std::move(that.state);
+    }
+
+    return *this;
+}
+
+int HttpDecompressor::init(HttpCoding coding) {
+    if (state) {
+        inflateEnd(&state->strm);
+        state.reset();
+    }
+
+    this->coding = coding;
+    this->finished = (coding == HttpCoding::IDENTITY);
+    if (finished)
+        return 0;
+
+    state = std::make_unique<State>();
+    state->strm = z_stream{};
+
+    // Automatic detection of gzip or zlib header, the raw deflate without
+    // zlib header is detected at the first update.
+    int bits = (coding == HttpCoding::GZIP) ? MAX_WBITS + 16 : MAX_WBITS + 32;
+    if (inflateInit2(&state->strm, bits) != Z_OK) {
+        state.reset();
+        return -ENOMEM;
+    }
+
+    return 0;
+}
+
+int HttpDecompressor::update(std::string_view in, std::string &out) {
+    constexpr std::size_t BUF_SIZE = 16 * 1024;
+
+    if (coding == HttpCoding::IDENTITY) {
+        out.append(in);
+        return 0;
+    }
+
+    if (!state)
+        return -EINVAL;
+
+    z_stream &strm = state->strm;
+
+    if (strm.total_in == 0 && coding == HttpCoding::DEFLATE && in.size() >= 2) {
+        // Some servers send raw deflate data without zlib header
+        unsigned char b0 = in[0], b1 = in[1];
+        if ((b0 & 0x0F) != Z_DEFLATED || ((b0 << 8) | b1) % 31 != 0) {
+            inflateEnd(&strm);
+            strm = z_stream{};
+            if (inflateInit2(&strm, -MAX_WBITS) != Z_OK) {
+                state.reset();
+                return -ENOMEM;
+            }
+        }
+    }
+
+    strm.next_in = (Bytef *)in.data();
+    strm.avail_in = (uInt)in.size();
+
+    while (strm.avail_in > 0 && !finished) {
+        std::size_t old_size = out.size();
+        out.resize(old_size + BUF_SIZE);
+
+        strm.next_out = (Bytef *)out.data() + old_size;
+        strm.avail_out = (uInt)BUF_SIZE;
+
+        int ret = inflate(&strm, Z_NO_FLUSH);
+        out.resize(old_size + BUF_SIZE - strm.avail_out);
+
+        if (ret == Z_STREAM_END)
+            finished = true;
+        else if (ret != Z_OK && ret != Z_BUF_ERROR)
+            return -EBADMSG;
+    }
+
+    return 0;
+}
+
+int HttpDecompressor::finish() {
+    return finished ? 0 : -EBADMSG;
+}
+
+#else
+
+struct HttpDecompressor::State { };
+
+bool http_encoding_supported(HttpCoding coding) noexcept {
+    return coding == HttpCoding::IDENTITY;
+}
+
+std::string_view http_accept_encoding() noexcept { return ""; }
+
+int http_compress(HttpCoding coding, std::string_view in, std::string &out,
+                  int) {
+    if (coding != HttpCoding::IDENTITY)
+        return -ENOTSUP;
+
+    out.append(in);
+    return 0;
+}
+
+HttpDecompressor::HttpDecompressor() noexcept = default;
+HttpDecompressor::~HttpDecompressor() = default;
+HttpDecompressor::HttpDecompressor(HttpDecompressor &&) noexcept = default;
+
+HttpDecompressor &
+HttpDecompressor::operator= (HttpDecompressor &&) noexcept = default;
+
+int HttpDecompressor::init(HttpCoding coding) {
+    this->coding = coding;
+    return coding == HttpCoding::IDENTITY ? 0 : -ENOTSUP;
+}
+
+int HttpDecompressor::update(std::string_view in, std::string &out) {
+    if (coding != HttpCoding::IDENTITY)
+        return -ENOTSUP;
+
+    out.append(in);
+    return 0;
+}
+
+int HttpDecompressor::finish() {
+    return coding == HttpCoding::IDENTITY ? 0 : -ENOTSUP;
+}
+
+#endif // COKE_ENABLE_ZLIB
+
+int http_decompress(HttpCoding coding, std::string_view in, std::string &out) {
+    HttpDecompressor d;
+    int ret = d.init(coding);
+
+    if (ret == 0)
+        ret = d.update(in, out);
+    if (ret == 0)
+        ret = d.finish();
+
+    return ret;
+}
+
+int http_decode_body(const HttpMessage &msg, std::string &out) {
+    HttpCoding coding;
+    std::string_view value = get_header(msg, "Content-Encoding");
+
+    if (!http_parse_coding(value, coding))
+        return -ENOTSUP;
+
+    HttpDecompressor d;
+    std::size_t total = 0;
+    int ret = d.init(coding);
+
+    for (std::string_view chunk : HttpChunkCursor(msg)) {
+        if (ret != 0)
+            break;
+
+        total += chunk.size();
+        ret = d.update(chunk, out);
+    }
+
+    // Responses without body, such as to HEAD, may also have Content-Encoding
+    if (ret == 0 && total > 0)
+        ret = d.finish();
+
+    return ret;
+}
+
+Task<int> http_decode_body_go(const HttpMessage &msg, std::string &out,
+                              std::string queue_name) {
+    if (queue_name.empty())
+        queue_name.assign(GO_DEFAULT_QUEUE);
+
+    co_return co_await go(queue_name, [&msg, &out]() {
+        return http_decode_body(msg, out);
+    });
+}
+
+int http_set_encoded_body(const protocol::HttpRequest &req,
+                          protocol::HttpResponse &resp,
+                          std::string_view body, std::size_t min_size,
+                          int level) {
+    HttpCoding coding = HttpCoding::IDENTITY;
+
+    if (body.size() >= min_size)
+        coding = choose_coding(get_header(req, "Accept-Encoding"));
+
+    if (coding == HttpCoding::IDENTITY) {
+        resp.append_output_body(body.data(), body.size());
+        return 0;
+    }
+
+    std::string encoded;
+    int ret = http_compress(coding, body, encoded, level);
+    if (ret != 0)
+        return ret;
+
+    resp.set_header_pair("Content-Encoding", coding_name(coding));
+    resp.add_header_pair("Vary", "Accept-Encoding");
+    resp.append_output_body(encoded.data(), encoded.size());
+    return 0;
+}
+
+Task<int> http_set_encoded_body_go(const protocol::HttpRequest &req,
+                                   protocol::HttpResponse &resp,
+                                   std::string_view body, std::size_t min_size,
+                                   int level, std::string queue_name) {
+    if (queue_name.empty())
+        queue_name.assign(GO_DEFAULT_QUEUE);
+
+    co_return co_await go(queue_name, [&, min_size, level]() {
+        return http_set_encoded_body(req, resp, body, min_size, level);
+    });
+}
+
+} // namespace coke
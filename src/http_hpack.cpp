@@ -0,0 +1,522 @@
+/**
+ * Copyright 2024 Coke Project (https://github.com/kedixa/coke)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Authors: kedixa (https://github.com/kedixa)
+*/
+
+#include <array>
+#include <cerrno>
+
+#include "coke/http/http_hpack.h"
+
+namespace coke {
+
+namespace {
+
+constexpr std::size_t HUFFMAN_SYMBOLS = 257;
+constexpr std::size_t HUFFMAN_EOS = 256;
+constexpr std::size_t HUFFMAN_MAX_LEN = 30;
+
+/**
+ * The code lengths of the Huffman code in RFC 7541 Appendix B, the code is
+ * canonical, so the codes are rebuilt from the lengths.
+*/
+constexpr uint8_t HUFFMAN_LENGTHS[HUFFMAN_SYMBOLS] = {
+    13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28,
+    28, 28, 28, 28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+    6, 10, 10, 12, 13, 6, 8, 11, 10, 10, 8, 11, 8, 6, 6, 6,
+    5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 7, 8, 15, 6, 12, 10,
+    13, 6, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7, 8, 7, 8, 13, 19, 13, 14, 6,
+    15, 5, 6, 5, 6, 5, 6, 6, 6, 5, 7, 7, 6, 6, 6, 5,
+    6, 7, 6, 5, 5, 6, 7, 7, 7, 7, 7, 15, 11, 14, 13, 28,
+    20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23,
+    24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24,
+    22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23,
+    21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23,
+    26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25,
+    19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27,
+    20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23,
+    26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26,
+    30,
+};
+
+struct HuffmanTables {
+    // Code of each symbol, aligned to the low bits
+    uint32_t codes[HUFFMAN_SYMBOLS];
+
+    // Number of codes of each length, and the symbols sorted by the code
+    uint16_t counts[HUFFMAN_MAX_LEN + 1];
+    uint16_t sorted[HUFFMAN_SYMBOLS];
+};
+
+constexpr HuffmanTables make_huffman_tables() {
+    HuffmanTables t{};
+    std::size_t pos = 0;
+    uint32_t code = 0;
+
+    for (std::size_t len = 1; len <= HUFFMAN_MAX_LEN; len++) {
+        for (std::size_t sym = 0; sym < HUFFMAN_SYMBOLS; sym++) {
+            if (HUFFMAN_LENGTHS[sym] == len) {
+                t.codes[sym] = code++;
+                t.counts[len]++;
+                t.sorted[pos++] = uint16_t(sym);
+            }
+        }
+
+        code <<= 1;
+    }
+
+    return t;
+}
+
+constexpr HuffmanTables HUFFMAN = make_huffman_tables();
+
+static_assert(HUFFMAN.codes[0] == 0x1ff8);
+static_assert(HUFFMAN.codes['a'] == 0x3);
+static_assert(HUFFMAN.codes[HUFFMAN_EOS] == 0x3fffffff);
+
+const std::array<HpackHeader, detail::HpackTable::STATIC_SIZE> STATIC_TABLE{{
+    {":authority", ""},
+    {":method", "GET"},
+    {":method", "POST"},
+    {":path", "/"},
+    {":path", "/index.html"},
+    {":scheme", "http"},
+    {":scheme", "https"},
+    {":status", "200"},
+    {":status", "204"},
+    {":status", "206"},
+    {":status", "304"},
+    {":status", "400"},
+    {":status", "404"},
+    {":status", "500"},
+    {"accept-charset", ""},
+    {"accept-encoding", "gzip, deflate"},
+    {"accept-language", ""},
+    {"accept-ranges", ""},
+    {"accept", ""},
+    {"access-control-allow-origin", ""},
+    {"age", ""},
+    {"allow", ""},
+    {"authorization", ""},
+    {"cache-control", ""},
+    {"content-disposition", ""},
+    {"content-encoding", ""},
+    {"content-language", ""},
+    {"content-length", ""},
+    {"content-location", ""},
+    {"content-range", ""},
+    {"content-type", ""},
+    {"cookie", ""},
+    {"date", ""},
+    {"etag", ""},
+    {"expect", ""},
+    {"expires", ""},
+    {"from", ""},
+    {"host", ""},
+    {"if-match", ""},
+    {"if-modified-since", ""},
+    {"if-none-match", ""},
+    {"if-range", ""},
+    {"if-unmodified-since", ""},
+    {"last-modified", ""},
+    {"link", ""},
+    {"location", ""},
+    {"max-forwards", ""},
+    {"proxy-authenticate", ""},
+    {"proxy-authorization", ""},
+    {"range", ""},
+    {"referer", ""},
+    {"refresh", ""},
+    {"retry-after", ""},
+    {"server", ""},
+    {"set-cookie", ""},
+    {"strict-transport-security", ""},
+    {"transfer-encoding", ""},
+    {"user-agent", ""},
+    {"vary", ""},
+    {"via", ""},
+    {"www-authenticate", ""},
+}};
+
+void encode_integer(uint64_t value, unsigned prefix, uint8_t flags,
+                    std::string &out) {
+    uint64_t max_prefix = (1u << prefix) - 1;
+
+    if (value < max_prefix) {
+        out.push_back(char(flags | value));
+        return;
+    }
+
+    out.push_back(char(flags | max_prefix));
+    value -= max_prefix;
+
+    while (value >= 128) {
+        out.push_back(char((value & 0x7f) | 0x80));
+        value >>= 7;
+    }
+
+    out.push_back(char(value));
+}
+
+bool decode_integer(std::string_view &in, unsigned prefix, uint64_t &value) {
+    uint64_t max_prefix = (1u << prefix) - 1;
+    unsigned shift = 0;
+
+    if (in.empty())
+        return false;
+
+    value = uint8_t(in[0]) & max_prefix;
+    in.remove_prefix(1);
+
+    if (value < max_prefix)
+        return true;
+
+    while (!in.empty()) {
+        uint8_t b = uint8_t(in[0]);
+        in.remove_prefix(1);
+
+        // Reject integers that do not fit in 32 bits, nothing is that large
+        if (shift > 28)
+            return false;
+
+        value += uint64_t(b & 0x7f) << shift;
+        shift += 7;
+
+        if (!(b & 0x80))
+            return value <= UINT32_MAX;
+    }
+
+    return false;
+}
+
+bool decode_string(std::string_view &in, std::string &out) {
+    bool huffman;
+    uint64_t len;
+
+    if (in.empty())
+        return false;
+
+    huffman = uint8_t(in[0]) & 0x80;
+    if (!decode_integer(in, 7, len) || len > in.size())
+        return false;
+
+    std::string_view str = in.substr(0, len);
+    in.remove_prefix(len);
+
+    out.clear();
+    if (huffman)
+        return hpack_huffman_decode(str, out) == 0;
+
+    out.assign(str);
+    return true;
+}
+
+} // namespace
+
+
+void hpack_huffman_encode(std::string_view in, std::string &out) {
+    uint64_t bits = 0;
+    unsigned nbits = 0;
+
+    for (unsigned char c : in) {
+        bits = (bits << HUFFMAN_LENGTHS[c]) | HUFFMAN.codes[c];
+        nbits += HUFFMAN_LENGTHS[c];
+
+        while (nbits >= 8) {
+            nbits -= 8;
+            out.push_back(char(bits >> nbits));
+        }
+    }
+
+    // Pad with the most significant bits of EOS, that is all ones
+    if (nbits > 0) {
+        bits = (bits << (8 - nbits)) | ((1u << (8 - nbits)) - 1);
+        out.push_back(char(bits));
+    }
+}
+
+std::size_t hpack_huffman_length(std::string_view in) noexcept {
+    std::size_t nbits = 0;
+
+    for (unsigned char c : in)
+        nbits += HUFFMAN_LENGTHS[c];
+
+    return (nbits + 7) / 8;
+}
+
+int hpack_huffman_decode(std::string_view in, std::string &out) {
+    // Canonical decoding, `first` is the first code of length `len`, and
+    // `index` is the position of it in HUFFMAN.sorted.
+    uint32_t code = 0, first = 0;
+    std::size_t len = 0, index = 0;
+    bool all_ones = true;
+
+    for (unsigned char c : in) {
+        for (int i = 7; i >= 0; i--) {
+            uint32_t bit = (c >> i) & 1;
+
+            code = (code << 1) | bit;
+            all_ones = all_ones && bit;
+            len++;
+
+            uint32_t count = HUFFMAN.counts[len];
+            if (code - first < count) {
+                std::size_t sym = HUFFMAN.sorted[index + code - first];
+
+                // EOS must not appear in the string
+                if (sym == HUFFMAN_EOS)
+                    return -EBADMSG;
+
+                out.push_back(char(sym));
+                code = first = 0;
+                len = index = 0;
+                all_ones = true;
+            }
+            else {
+                index += count;
+                first = (first + count) << 1;
+
+                if (len == HUFFMAN_MAX_LEN)
+                    return -EBADMSG;
+            }
+        }
+    }
+
+    // The padding is shorter than 8 bits and all ones
+    if (len > 7 || !all_ones)
+        return -EBADMSG;
+
+    return 0;
+}
+
+
+namespace detail {
+
+bool HpackTable::get(std::size_t index, const HpackHeader *&entry) const {
+    if (index == 0)
+        return false;
+
+    if (index <= STATIC_SIZE) {
+        entry = &STATIC_TABLE[index - 1];
+        return true;
+    }
+
+    index -= STATIC_SIZE + 1;
+    if (index >= entries.size())
+        return false;
+
+    entry = &entries[index];
+    return true;
+}
+
+std::size_t HpackTable::find(std::string_view name, std::string_view value,
+                             bool &name_only) const {
+    std::size_t name_index = 0;
+
+    for (std::size_t i = 0; i < STATIC_SIZE; i++) {
+        if (STATIC_TABLE[i].name == name) {
+            if (STATIC_TABLE[i].value == value) {
+                name_only = false;
+                return i + 1;
+            }
+
+            if (name_index == 0)
+                name_index = i + 1;
+        }
+    }
+
+    for (std::size_t i = 0; i < entries.size(); i++) {
+        if (entries[i].name == name) {
+            if (entries[i].value == value) {
+                name_only = false;
+                return i + STATIC_SIZE + 1;
+            }
+
+            if (name_index == 0)
+                name_index = i + STATIC_SIZE + 1;
+        }
+    }
+
+    name_only = true;
+    return name_index;
+}
+
+void HpackTable::add(std::string_view name, std::string_view value) {
+    std::size_t size = name.size() + value.size() + ENTRY_OVERHEAD;
+
+    // An entry larger than the table empties it, see RFC 7541 section 4.4
+    if (size > max_size) {
+        evict(0);
+        return;
+    }
+
+    evict(max_size - size);
+    entries.push_front(HpackHeader{std::string(name), std::string(value)});
+    cur_size += size;
+}
+
+void HpackTable::set_max_size(std::size_t size) {
+    max_size = size;
+    evict(size);
+}
+
+void HpackTable::evict(std::size_t limit) {
+    while (cur_size > limit && !entries.empty()) {
+        const HpackHeader &h = entries.back();
+        cur_size -= h.name.size() + h.value.size() + ENTRY_OVERHEAD;
+        entries.pop_back();
+    }
+}
+
+} // namespace detail
+
+
+void HpackEncoder::set_max_table_size(std::size_t size) {
+    if (!pending_update || size < min_update)
+        min_update = size;
+
+    pending_update = true;
+    table.set_max_size(size);
+}
+
+void HpackEncoder::encode_string(std::string_view str, std::string &out) {
+    if (huffman) {
+        std::size_t len = hpack_huffman_length(str);
+
+        if (len < str.size()) {
+            encode_integer(len, 7, 0x80, out);
+            hpack_huffman_encode(str, out);
+            return;
+        }
+    }
+
+    encode_integer(str.size(), 7, 0, out);
+    out.append(str);
+}
+
+void HpackEncoder::encode(const std::vector<HpackHeader> &headers,
+                          std::string &out) {
+    if (pending_update) {
+        std::size_t size = table.get_max_size();
+
+        if (min_update < size)
+            encode_integer(min_update, 5, 0x20, out);
+
+        encode_integer(size, 5, 0x20, out);
+        pending_update = false;
+    }
+
+    for (const HpackHeader &h : headers) {
+        bool name_only;
+        std::size_t index = table.find(h.name, h.value, name_only);
+
+        if (index != 0 && !name_only && !h.sensitive) {
+            encode_integer(index, 7, 0x80, out);
+            continue;
+        }
+
+        if (h.sensitive)
+            encode_integer(index, 4, 0x10, out);
+        else
+            encode_integer(index, 6, 0x40, out);
+
+        if (index == 0)
+            encode_string(h.name, out);
+
+        encode_string(h.value, out);
+
+        if (!h.sensitive)
+            table.add(h.name, h.value);
+    }
+}
+
+
+void HpackDecoder::set_max_table_size(std::size_t size) {
+    max_table_size = size;
+
+    if (table.get_max_size() > size)
+        table.set_max_size(size);
+}
+
+int HpackDecoder::decode(std::string_view block,
+                         std::vector<HpackHeader> &headers) {
+    std::size_t list_size = 0;
+    bool header_seen = false;
+    std::string name, value;
+
+    while (!block.empty()) {
+        uint8_t b = uint8_t(block[0]);
+        const HpackHeader *entry = nullptr;
+        uint64_t index;
+
+        if (b & 0x80) {
+            // Indexed header field
+            if (!decode_integer(block, 7, index) || !table.get(index, entry))
+                return -EBADMSG;
+
+            name = entry->name;
+            value = entry->value;
+            headers.push_back(HpackHeader{name, value});
+        }
+        else if ((b & 0xe0) == 0x20) {
+            // Dynamic table size update, only at the beginning of a block
+            if (header_seen || !decode_integer(block, 5, index) ||
+                index > max_table_size)
+                return -EBADMSG;
+
+            table.set_max_size(index);
+            continue;
+        }
+        else {
+            // Literal, with incremental indexing, without indexing, or
+            // never indexed
+            bool indexing = (b & 0xc0) == 0x40;
+            bool sensitive = (b & 0xf0) == 0x10;
+            unsigned prefix = indexing ? 6 : 4;
+
+            if (!decode_integer(block, prefix, index))
+                return -EBADMSG;
+
+            if (index != 0) {
+                if (!table.get(index, entry))
+                    return -EBADMSG;
+
+                name = entry->name;
+            }
+            else if (!decode_string(block, name))
+                return -EBADMSG;
+
+            if (!decode_string(block, value))
+                return -EBADMSG;
+
+            if (indexing)
+                table.add(name, value);
+
+            headers.push_back(HpackHeader{name, value, sensitive});
+        }
+
+        header_seen = true;
+        list_size += name.size() + value.size() + 32;
+
+        if (max_list_size != 0 && list_size > max_list_size)
+            return -EBADMSG;
+    }
+
+    return 0;
+}
+
+} // namespace coke
@@ -16,19 +16,337 @@
  * Authors: kedixa (https://github.com/kedixa)
 */
 
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <chrono>
 #include <cstdint>
+#include <cstdio>
 #include <cerrno>
 #include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <vector>
 #include <strings.h>
 #include <openssl/evp.h>
 
+#include "coke/future.h"
 #include "coke/http/http_client.h"
+#include "coke/http/http_encoding.h"
+#include "coke/http/http_server.h"
 #include "coke/http/http_utils.h"
+#include "coke/net/upstream.h"
+#include "coke/sleep.h"
 
+#include "workflow/UpstreamManager.h"
 #include "workflow/WFTaskFactory.h"
 
 namespace coke {
 
+namespace {
+
+struct HostCounter {
+    std::atomic<std::size_t> max_connections{0};
+
+    std::atomic<uint64_t> active{0};
+    std::atomic<uint64_t> max_active{0};
+    std::atomic<uint64_t> total{0};
+    std::atomic<uint64_t> success{0};
+    std::atomic<uint64_t> wait_timeouts{0};
+    std::atomic<uint64_t> errors{0};
+
+    void start() {
+        uint64_t cur = active.fetch_add(1, std::memory_order_relaxed) + 1;
+        uint64_t old = max_active.load(std::memory_order_relaxed);
+
+        while (old < cur && !max_active.compare_exchange_weak(old, cur,
+                                std::memory_order_relaxed))
+            ;
+
+        total.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void finish(WFHttpTask *task) {
+        int state = task->get_state();
+
+        if (state == STATE_SUCCESS)
+            success.fetch_add(1, std::memory_order_relaxed);
+        else if (state == STATE_SYS_ERROR && task->get_error() == ETIMEDOUT &&
+                 task->get_timeout_reason() == CTOR_WAIT_TIMEOUT)
+            wait_timeouts.fetch_add(1, std::memory_order_relaxed);
+        else
+            errors.fetch_add(1, std::memory_order_relaxed);
+
+        active.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    void load(HttpHostStats &stats) const {
+        stats.max_connections = max_connections.load(std::memory_order_relaxed);
+        stats.active = active.load(std::memory_order_relaxed);
+        stats.max_active = max_active.load(std::memory_order_relaxed);
+        stats.total = total.load(std::memory_order_relaxed);
+        stats.success = success.load(std::memory_order_relaxed);
+        stats.wait_timeouts = wait_timeouts.load(std::memory_order_relaxed);
+        stats.errors = errors.load(std::memory_order_relaxed);
+    }
+};
+
+/**
+ * Counters are never removed, so the pointers can be saved in tasks.
+*/
+class HostRegistry {
+public:
+    static HostRegistry &get_instance() {
+        static HostRegistry registry;
+        return registry;
+    }
+
+    HostCounter *get_counter(std::string_view host) {
+        std::lock_guard<std::mutex> lg(mtx);
+        auto it = counters.find(host);
+
+        if (it == counters.end()) {
+            auto ptr = std::make_unique<HostCounter>();
+            it = counters.emplace(std::string(host), std::move(ptr)).first;
+        }
+
+        return it->second.get();
+    }
+
+    HostCounter *find_counter(std::string_view host) {
+        std::lock_guard<std::mutex> lg(mtx);
+        auto it = counters.find(host);
+        return it == counters.end() ? nullptr : it->second.get();
+    }
+
+    std::map<std::string, HttpHostStats> get_all() {
+        std::map<std::string, HttpHostStats> all;
+        std::lock_guard<std::mutex> lg(mtx);
+
+        for (const auto &[host, counter] : counters)
+            counter->load(all[host]);
+
+        return all;
+    }
+
+    void set_params(const std::string &host, const EndpointParams &ep);
+
+private:
+    std::mutex mtx;
+    std::map<std::string, std::unique_ptr<HostCounter>, std::less<>> counters;
+    std::map<std::string, EndpointParams> params;
+};
+
+bool same_params(const EndpointParams &l, const EndpointParams &r) {
+    return l.address_family == r.address_family &&
+           l.max_connections == r.max_connections &&
+           l.connect_timeout == r.connect_timeout &&
+           l.response_timeout == r.response_timeout &&
+           l.ssl_connect_timeout == r.ssl_connect_timeout &&
+           l.use_tls_sni == r.use_tls_sni;
+}
+
+/**
+ * Workflow only supports endpoint params per address through upstream, so
+ * create an upstream named by the host, with the host itself as the only
+ * server. The port in url is used because the server has no port.
+*/
+void HostRegistry::set_params(const std::string &host,
+                              const EndpointParams &ep) {
+    HostCounter *counter = get_counter(host);
+    std::lock_guard<std::mutex> lg(mtx);
+    auto it = params.find(host);
+
+    if (it != params.end()) {
+        if (same_params(it->second, ep))
+            return;
+
+        UpstreamManager::upstream_remove_server(host, host);
+    }
+    else
+        UpstreamManager::upstream_create_weighted_random(host, false);
+
+    AddressParams ap = ADDRESS_PARAMS_DEFAULT;
+    ap.endpoint_params.address_family = ep.address_family;
+    ap.endpoint_params.max_connections = ep.max_connections;
+    ap.endpoint_params.connect_timeout = ep.connect_timeout;
+    ap.endpoint_params.response_timeout = ep.response_timeout;
+    ap.endpoint_params.ssl_connect_timeout = ep.ssl_connect_timeout;
+    ap.endpoint_params.use_tls_sni = ep.use_tls_sni;
+
+    UpstreamManager::upstream_add_server(host, host, &ap);
+    params[host] = ep;
+    counter->max_connections.store(ep.max_connections,
+                                   std::memory_order_relaxed);
+}
+
+/**
+ * Get the host name in url, without userinfo and port.
+*/
+std::string_view get_url_host(std::string_view url) {
+    std::size_t pos = url.find("://");
+    if (pos != std::string_view::npos)
+        url.remove_prefix(pos + 3);
+
+    url = url.substr(0, url.find_first_of("/?#"));
+
+    pos = url.rfind('@');
+    if (pos != std::string_view::npos)
+        url.remove_prefix(pos + 1);
+
+    if (!url.empty() && url.front() == '[') {
+        pos = url.find(']');
+        return url.substr(1, pos == std::string_view::npos ? pos : pos - 1);
+    }
+
+    return url.substr(0, url.find(':'));
+}
+
+void http_stats_hook(WFHttpTask *task) {
+    static_cast<HostCounter *>(task->user_data)->finish(task);
+}
+
+struct HttpHookData {
+    HostCounter *counter;
+    void *server;
+};
+
+void http_upstream_hook(WFHttpTask *task) {
+    auto *data = static_cast<HttpHookData *>(task->user_data);
+
+    if (data->counter)
+        data->counter->finish(task);
+
+    detail::upstream_finish(data->server, task->get_state());
+    delete data;
+}
+
+/**
+ * If the host of `url` is an upstream group, select a replica by the path and
+ * query of `url`, and replace the host and port with the replica's address.
+*/
+bool select_upstream(const std::string &url, detail::UpstreamSelection &sel,
+                     std::string &upstream_url) {
+    std::size_t begin = url.find("://");
+    begin = (begin == std::string::npos) ? 0 : begin + 3;
+
+    std::size_t end = url.find_first_of("/?#", begin);
+    if (end == std::string::npos)
+        end = url.size();
+
+    // Keep the userinfo
+    std::size_t at = url.rfind('@', end);
+    if (at != std::string::npos && at >= begin)
+        begin = at + 1;
+
+    std::string_view key(url);
+    key = key.substr(end, key.find('#', end) - end);
+
+    if (!detail::upstream_select(get_url_host(url), key, sel))
+        return false;
+
+    upstream_url.reserve(url.size() + sel.address.size());
+    upstream_url.assign(url, 0, begin).append(sel.address)
+        .append(url, end, std::string::npos);
+    return true;
+}
+
+} // namespace
+
+bool get_http_host_stats(const std::string &host, HttpHostStats &stats) {
+    HostCounter *counter = HostRegistry::get_instance().find_counter(host);
+    if (!counter)
+        return false;
+
+    counter->load(stats);
+    return true;
+}
+
+std::map<std::string, HttpHostStats> get_all_http_host_stats() {
+    return HostRegistry::get_instance().get_all();
+}
+
+namespace detail {
+
+/**
+ * Shared by the hedged requests of a client, including the abandoned ones
+ * that are still running.
+*/
+struct HttpHedgeState {
+    static constexpr std::size_t MAX_SAMPLES = 256;
+    static constexpr std::size_t MIN_SAMPLES = 16;
+
+    HttpHedgeState(double ratio, int burst)
+        : ratio(ratio), burst(burst), tokens(burst)
+    { }
+
+    void deposit() {
+        std::lock_guard<std::mutex> lg(mtx);
+        tokens = std::min(tokens + ratio, burst);
+    }
+
+    bool take_token() {
+        std::lock_guard<std::mutex> lg(mtx);
+        if (tokens < 1.0)
+            return false;
+
+        tokens -= 1.0;
+        return true;
+    }
+
+    void add_latency(int64_t us) {
+        std::lock_guard<std::mutex> lg(mtx);
+        if (samples.size() < MAX_SAMPLES)
+            samples.push_back(us);
+        else
+            samples[next_sample] = us;
+
+        next_sample = (next_sample + 1) % MAX_SAMPLES;
+    }
+
+    /**
+     * Return the `p` percentile of the recent latencies in microseconds, or
+     * -1 if there are not enough samples.
+    */
+    int64_t percentile(double p) {
+        std::vector<int64_t> v;
+
+        {
+            std::lock_guard<std::mutex> lg(mtx);
+            if (samples.size() < MIN_SAMPLES)
+                return -1;
+            v = samples;
+        }
+
+        p = std::clamp(p, 0.0, 1.0);
+        std::size_t k = std::min(std::size_t(p * v.size()), v.size() - 1);
+        std::nth_element(v.begin(), v.begin() + k, v.end());
+        return v[k];
+    }
+
+    const double ratio;
+    const double burst;
+
+    std::mutex mtx;
+    double tokens;
+    std::vector<int64_t> samples;
+    std::size_t next_sample{0};
+};
+
+} // namespace detail
+
+HttpClient::HttpClient(const HttpClientParams &params)
+    : params(params),
+      hedge(std::make_shared<detail::HttpHedgeState>(
+          params.retry_budget_ratio, params.retry_budget_burst))
+{
+    HostRegistry &registry = HostRegistry::get_instance();
+
+    for (const auto &[host, ep] : params.host_params)
+        registry.set_params(host, ep);
+}
+
 static int encode_auth(const char *p, std::string& auth)
 {
     std::size_t len = strlen(p);
@@ -47,70 +365,334 @@ static int encode_auth(const char *p, std::string& auth)
 }
 
 static std::string_view get_http_host(coke::HttpRequest &req) {
-    constexpr int host_len = 4;
-
     for (const coke::HttpHeaderView &header : coke::HttpHeaderCursor(req)) {
-        if (header.name.length() != host_len)
-            continue;
-        if (strncasecmp(header.name.data(), "Host", host_len) == 0)
+        if (coke::http_name_equal(header.name, "Host"))
             return header.value;
     }
     return std::string_view();
 }
 
-HttpClient::AwaiterType
-HttpClient::request(const std::string &url, const std::string &method,
-                    const HttpHeader &headers, std::string body) {
-    ParsedURI uri;
-    HttpRequest req;
+/**
+ * Owns the request body, which is deleted together with the request.
+*/
+struct BodyAttachment : public protocol::ProtocolMessage::Attachment {
+    explicit BodyAttachment(std::string &&body) : body(std::move(body)) { }
+
+    std::string body;
+};
+
+static std::string get_request_uri(const ParsedURI &uri) {
     std::string request_uri("/");
 
-    if (URIParser::parse(url, uri) == 0) {
-        if (uri.path && uri.path[0])
-            request_uri.assign(uri.path);
+    if (uri.path && uri.path[0])
+        request_uri.assign(uri.path);
 
-        if (uri.query && uri.query[0])
-            request_uri.append("?").append(uri.query);
-    }
+    if (uri.query && uri.query[0])
+        request_uri.append("?").append(uri.query);
 
+    return request_uri;
+}
+
+static void fill_request(const std::string &request_uri,
+                         const std::string &method,
+                         const HttpClient::HttpHeader &headers,
+                         HttpRequest &req) {
     req.set_method(method);
     req.set_request_uri(request_uri);
-    req.append_output_body(body.data(), body.size());
 
     for (const auto &pair : headers)
         req.add_header_pair(pair.first, pair.second);
+}
+
+static void prepare_request(const std::string &url, const std::string &method,
+                            const HttpClient::HttpHeader &headers,
+                            HttpRequest &req) {
+    ParsedURI uri;
+    std::string request_uri("/");
+
+    if (URIParser::parse(url, uri) == 0)
+        request_uri = get_request_uri(uri);
+
+    fill_request(request_uri, method, headers, req);
+}
+
+static void set_owned_body(HttpRequest &req, std::string body) {
+    if (!body.empty()) {
+        // The request takes the ownership of the body, and sends it without
+        // copy. The attachment is moved along with the request.
+        auto *att = new BodyAttachment(std::move(body));
+        req.set_attachment(att);
+        req.append_output_body_nocopy(att->body.data(), att->body.size());
+    }
+}
+
+HttpClient::AwaiterType
+HttpClient::request(const std::string &url, const std::string &method,
+                    const HttpHeader &headers, std::string body) {
+    HttpRequest req;
+    prepare_request(url, method, headers, req);
+    set_owned_body(req, std::move(body));
 
     return create_task(url, &req);
 }
 
+HttpClient::AwaiterType
+HttpClient::request(const Endpoint &ep, const std::string &method,
+                    const HttpHeader &headers, std::string body) {
+    HttpRequest req;
+    fill_request(ep.request_uri, method, headers, req);
+    set_owned_body(req, std::move(body));
+
+    return create_task(ep, &req, params.retry_max);
+}
+
+HttpClient::AwaiterType
+HttpClient::request_nocopy(const std::string &url, const std::string &method,
+                           const HttpHeader &headers, std::string_view body) {
+    HttpRequest req;
+    prepare_request(url, method, headers, req);
+
+    if (!body.empty())
+        req.append_output_body_nocopy(body.data(), body.size());
+
+    return create_task(url, &req);
+}
+
+HttpClient::AwaiterType
+HttpClient::request_nocopy(const std::string &url, const std::string &method,
+                           const HttpHeader &headers,
+                           const std::vector<std::string_view> &body) {
+    HttpRequest req;
+    prepare_request(url, method, headers, req);
+
+    for (std::string_view buf : body)
+        if (!buf.empty())
+            req.append_output_body_nocopy(buf.data(), buf.size());
+
+    return create_task(url, &req);
+}
+
+static std::string_view get_header_value(const HttpMessage &msg,
+                                         std::string_view name) {
+    for (const coke::HttpHeaderView &header : coke::HttpHeaderCursor(msg)) {
+        if (coke::http_name_equal(header.name, name))
+            return header.value;
+    }
+    return std::string_view();
+}
+
+/**
+ * Parse the total length from `Content-Range: bytes first-last/total`, return
+ * false if it is absent or unknown.
+*/
+static bool parse_content_range(std::string_view value, std::size_t &total) {
+    std::size_t pos = value.rfind('/');
+    if (pos == std::string_view::npos || pos + 1 >= value.size())
+        return false;
+
+    std::size_t n = 0;
+    for (char c : value.substr(pos + 1)) {
+        if (c < '0' || c > '9')
+            return false;
+        n = n * 10 + (c - '0');
+    }
+
+    total = n;
+    return true;
+}
+
+AsyncGenerator<HttpResult>
+HttpClient::stream(std::string url, HttpHeader headers,
+                   std::size_t range_size) {
+    std::size_t offset = 0;
+    std::size_t total = std::size_t(-1);
+
+    if (range_size == 0)
+        range_size = HTTP_STREAM_RANGE_SIZE;
+
+    while (offset < total) {
+        HttpRequest req;
+        std::string range = "bytes=" + std::to_string(offset) + "-"
+                          + std::to_string(offset + range_size - 1);
+
+        prepare_request(url, "GET", headers, req);
+        req.add_header_pair("Range", range);
+
+        HttpResult res = co_await create_task(url, &req);
+
+        if (res.state != STATE_SUCCESS) {
+            co_yield std::move(res);
+            co_return;
+        }
+
+        const char *code = res.resp.get_status_code();
+        if (code && strcmp(code, "416") == 0 && offset > 0) {
+            // The length is unknown and the last piece ends exactly at the
+            // end of the object.
+            co_return;
+        }
+
+        if (!code || strcmp(code, "206") != 0) {
+            // The server ignores Range, the whole object is responded.
+            co_yield std::move(res);
+            co_return;
+        }
+
+        std::size_t len = 0;
+        for (std::string_view chunk : HttpChunkCursor(res.resp))
+            len += chunk.size();
+
+        std::string_view cr = get_header_value(res.resp, "Content-Range");
+        if (!parse_content_range(cr, total) && len < range_size)
+            total = offset + len;
+
+        co_yield std::move(res);
+
+        if (len == 0)
+            co_return;
+
+        offset += len;
+    }
+}
+
+static Task<HttpResult>
+hedge_attempt(HttpAwaiter awaiter, std::shared_ptr<std::string> body,
+              std::shared_ptr<detail::HttpHedgeState> hedge) {
+    auto start = std::chrono::steady_clock::now();
+    HttpResult res = co_await std::move(awaiter);
+    auto cost = std::chrono::steady_clock::now() - start;
+
+    if (res.state == STATE_SUCCESS) {
+        using std::chrono::microseconds;
+        hedge->add_latency(std::chrono::duration_cast<microseconds>(cost).count());
+    }
+
+    // The body is referenced by the request until here
+    body.reset();
+    co_return res;
+}
+
+Task<HttpResult>
+HttpClient::hedged_request(std::string url, std::string method,
+                           HttpHeader headers, std::string body) {
+    auto shared_body = std::make_shared<std::string>(std::move(body));
+    std::vector<Future<HttpResult>> futs;
+    std::vector<bool> checked;
+    std::size_t failed = 0;
+    int hedges = 0, retries = 0;
+    HttpResult last{STATE_UNDEFINED, 0, HttpResponse(), nullptr};
+
+    auto launch = [&]() {
+        HttpRequest req;
+        prepare_request(url, method, headers, req);
+
+        if (!shared_body->empty())
+            req.append_output_body_nocopy(shared_body->data(),
+                                          shared_body->size());
+
+        HttpAwaiter awaiter = create_task(url, &req, 0);
+        futs.emplace_back(create_future(
+            hedge_attempt(std::move(awaiter), shared_body, hedge)));
+        checked.push_back(false);
+    };
+
+    hedge->deposit();
+    launch();
+
+    while (true) {
+        int ret = TOP_SUCCESS;
+
+        if (hedges < params.hedge_max) {
+            int64_t us = hedge->percentile(params.hedge_percentile);
+            NanoSec delay = (us >= 0) ? NanoSec(us * 1000)
+                                      : NanoSec(params.hedge_delay * 1000000LL);
+
+            ret = co_await wait_futures_for(futs, failed + 1, delay);
+        }
+        else
+            co_await wait_futures(futs, failed + 1);
+
+        if (ret == TOP_TIMEOUT) {
+            // The pending requests are still running, send a backup request
+            // if the budget allows, or stop hedging.
+            if (hedge->take_token()) {
+                hedges++;
+                launch();
+            }
+            else
+                hedges = params.hedge_max;
+
+            continue;
+        }
+
+        for (std::size_t i = 0; i < futs.size(); i++) {
+            if (checked[i] || futs[i].get_state() == FUTURE_STATE_NOTSET)
+                continue;
+
+            checked[i] = true;
+            failed++;
+
+            if (futs[i].get_state() == FUTURE_STATE_READY) {
+                last = futs[i].get();
+                if (last.state == STATE_SUCCESS)
+                    co_return std::move(last);
+            }
+        }
+
+        // All the sent requests failed, retry if the budget allows
+        if (failed == futs.size()) {
+            if (retries >= params.retry_max || !hedge->take_token())
+                co_return std::move(last);
+
+            retries++;
+            launch();
+        }
+    }
+}
 
 HttpClient::AwaiterType
 HttpClient::create_task(const std::string &url, ReqType *req) noexcept {
-    WFHttpTask *task;
-    HttpRequest *treq;
-    bool https;
-    bool has_proxy = !params.proxy.empty();
-    const std::string &proxy = params.proxy;
+    return create_task(url, req, params.retry_max);
+}
 
-    https = (strncasecmp(url.c_str(), "https://", 8) == 0);
+/**
+ * Get the counter of the host in `url` if the statistics of it is collected.
+*/
+static HostCounter *get_host_counter(const HttpClientParams &params,
+                                     const std::string &url) {
+    if (!params.collect_host_stats && params.host_params.empty())
+        return nullptr;
 
-    // redirect disabled when http url with proxy
+    std::string_view host = get_url_host(url);
+    bool collect = params.collect_host_stats;
 
-    if (has_proxy && https)
-        task = WFTaskFactory::create_http_task(url, proxy, params.redirect_max, params.retry_max, nullptr);
-    else if (has_proxy)
-        task = WFTaskFactory::create_http_task(proxy, 0, params.retry_max, nullptr);
-    else
-        task = WFTaskFactory::create_http_task(url, params.redirect_max, params.retry_max, nullptr);
+    if (!collect)
+        collect = params.host_params.contains(std::string(host));
+
+    if (!collect)
+        return nullptr;
 
-    treq = task->get_req();
+    return HostRegistry::get_instance().get_counter(host);
+}
+
+/**
+ * Move `req` into `task` and fill in the missing parts, set the params and
+ * the hook of the task. `proxy_url` is the request uri of the http request
+ * sent through simple proxy, or nullptr.
+*/
+static HttpAwaiter init_http_task(const HttpClientParams &params,
+                                  WFHttpTask *task, HttpRequest *req,
+                                  const std::string *proxy_url,
+                                  const std::string &proxy_auth,
+                                  HostCounter *counter, void *server) {
+    HttpRequest *treq = task->get_req();
 
     if (req) {
         const char *uri = req->get_request_uri();
         const char *turi = treq->get_request_uri();
 
         // Use request_uri in url if not set in req
-        if ((!uri || !*uri) && turi && !has_proxy)
+        if ((!uri || !*uri) && turi && !proxy_url)
             req->set_request_uri(turi);
 
         std::string_view req_host, treq_host;
@@ -124,18 +706,11 @@ HttpClient::create_task(const std::string &url, ReqType *req) noexcept {
         *treq = std::move(*req);
     }
 
-    // Use simple proxy if not https
-    if (has_proxy && !https) {
-        ParsedURI proxy_uri;
-        if (URIParser::parse(proxy, proxy_uri) == 0) {
-            if (proxy_uri.userinfo  && proxy_uri.userinfo[0]) {
-                std::string proxy_auth;
-                if (encode_auth(proxy_uri.userinfo, proxy_auth) == 0)
-                    treq->add_header_pair("Proxy-Authorization", proxy_auth.data());
-            }
-        }
+    if (proxy_url) {
+        if (!proxy_auth.empty())
+            treq->add_header_pair("Proxy-Authorization", proxy_auth);
 
-        treq->set_request_uri(url);
+        treq->set_request_uri(*proxy_url);
     }
 
     if (!treq->get_http_version())
@@ -147,11 +722,132 @@ HttpClient::create_task(const std::string &url, ReqType *req) noexcept {
     if (!treq->get_method())
         treq->set_method("GET");
 
+    if (params.accept_encoding) {
+        std::string_view codings = http_accept_encoding();
+
+        if (!codings.empty() &&
+            get_header_value(*treq, "Accept-Encoding").empty())
+            treq->add_header_pair("Accept-Encoding", std::string(codings));
+    }
+
     task->set_send_timeout(params.send_timeout);
     task->set_receive_timeout(params.receive_timeout);
     task->set_keep_alive(params.keep_alive_timeout);
 
-    return AwaiterType(task);
+    if (counter)
+        counter->start();
+
+    if (server) {
+        task->user_data = new HttpHookData{counter, server};
+        return HttpAwaiter(task, http_upstream_hook);
+    }
+    else if (counter) {
+        task->user_data = counter;
+        return HttpAwaiter(task, http_stats_hook);
+    }
+
+    return HttpAwaiter(task);
+}
+
+HttpClient::AwaiterType
+HttpClient::create_task(const std::string &origin_url, ReqType *req,
+                        int retry_max) noexcept {
+    WFHttpTask *task;
+    bool https;
+    bool has_proxy = !params.proxy.empty();
+    const std::string &proxy = params.proxy;
+
+    // Send to one of the replicas if the host is an upstream group
+    detail::UpstreamSelection sel;
+    std::string upstream_url;
+
+    if (!has_proxy)
+        select_upstream(origin_url, sel, upstream_url);
+
+    const std::string &url = sel.server ? upstream_url : origin_url;
+
+    https = (strncasecmp(url.c_str(), "https://", 8) == 0);
+
+    // redirect disabled when http url with proxy
+
+    if (has_proxy && https)
+        task = WFTaskFactory::create_http_task(url, proxy, params.redirect_max, retry_max, nullptr);
+    else if (has_proxy)
+        task = WFTaskFactory::create_http_task(proxy, 0, retry_max, nullptr);
+    else
+        task = WFTaskFactory::create_http_task(url, params.redirect_max, retry_max, nullptr);
+
+    // Use simple proxy if not https
+    std::string proxy_auth;
+
+    if (has_proxy && !https) {
+        ParsedURI proxy_uri;
+        if (URIParser::parse(proxy, proxy_uri) == 0) {
+            if (proxy_uri.userinfo  && proxy_uri.userinfo[0])
+                encode_auth(proxy_uri.userinfo, proxy_auth);
+        }
+    }
+
+    // The connections are made to the proxy if there is one
+    HostCounter *counter;
+    counter = get_host_counter(params, has_proxy ? proxy : origin_url);
+
+    return init_http_task(params, task, req,
+                          (has_proxy && !https) ? &url : nullptr,
+                          proxy_auth, counter, sel.server);
+}
+
+HttpClient::Endpoint HttpClient::prepare(const std::string &url) const {
+    Endpoint ep;
+
+    ep.url = url;
+    ep.https = (strncasecmp(url.c_str(), "https://", 8) == 0);
+    ep.has_proxy = !params.proxy.empty();
+
+    if (URIParser::parse(url, ep.uri) == 0) {
+        ep.request_uri = get_request_uri(ep.uri);
+        ep.error = 0;
+    }
+    else
+        ep.error = (ep.uri.state == URI_STATE_ERROR) ? ep.uri.error : EINVAL;
+
+    if (ep.has_proxy) {
+        if (URIParser::parse(params.proxy, ep.proxy_uri) != 0) {
+            if (ep.error == 0)
+                ep.error = (ep.proxy_uri.state == URI_STATE_ERROR)
+                         ? ep.proxy_uri.error : EINVAL;
+        }
+        else if (!ep.https && ep.proxy_uri.userinfo &&
+                 ep.proxy_uri.userinfo[0])
+            encode_auth(ep.proxy_uri.userinfo, ep.proxy_auth);
+    }
+
+    ep.counter = get_host_counter(params, ep.has_proxy ? params.proxy : url);
+    return ep;
+}
+
+HttpClient::AwaiterType
+HttpClient::create_task(const Endpoint &ep, ReqType *req,
+                        int retry_max) noexcept {
+    WFHttpTask *task;
+    int redirect_max = params.redirect_max;
+
+    detail::UpstreamSelection sel;
+    std::string upstream_url;
+
+    if (ep.has_proxy && ep.https)
+        task = WFTaskFactory::create_http_task(ep.uri, ep.proxy_uri, redirect_max, retry_max, nullptr);
+    else if (ep.has_proxy)
+        task = WFTaskFactory::create_http_task(ep.proxy_uri, 0, retry_max, nullptr);
+    else if (select_upstream(ep.url, sel, upstream_url))
+        task = WFTaskFactory::create_http_task(upstream_url, redirect_max, retry_max, nullptr);
+    else
+        task = WFTaskFactory::create_http_task(ep.uri, redirect_max, retry_max, nullptr);
+
+    return init_http_task(params, task, req,
+                          (ep.has_proxy && !ep.https) ? &ep.url : nullptr,
+                          ep.proxy_auth, static_cast<HostCounter *>(ep.counter),
+                          sel.server);
 }
 
 bool HttpHeaderCursor::iterator::next() noexcept {
@@ -173,6 +869,139 @@ bool HttpHeaderCursor::iterator::next() noexcept {
     return true;
 }
 
+static inline uint64_t fold_ascii(uint64_t x) noexcept {
+    constexpr uint64_t ones = 0x0101010101010101ULL;
+
+    // Set the high bit of each byte in ['A', 'Z'], then turn it to 0x20
+    uint64_t low7 = x & (0x7F * ones);
+    uint64_t ge_a = low7 + (0x80 - 'A') * ones;
+    uint64_t gt_z = low7 + (0x80 - 'Z' - 1) * ones;
+    uint64_t upper = ge_a & ~gt_z & ~x & (0x80 * ones);
+
+    return x | (upper >> 2);
+}
+
+static inline unsigned char fold_ascii(unsigned char c) noexcept {
+    return (c >= 'A' && c <= 'Z') ? (c | 0x20) : c;
+}
+
+static uint64_t header_name_hash(std::string_view name) noexcept {
+    uint64_t h = 14695981039346656037ULL;
+
+    for (unsigned char c : name) {
+        h ^= fold_ascii(c);
+        h *= 1099511628211ULL;
+    }
+
+    return h;
+}
+
+bool http_name_equal(std::string_view a, std::string_view b) noexcept {
+    if (a.size() != b.size())
+        return false;
+
+    const char *p = a.data(), *q = b.data();
+    std::size_t n = a.size();
+    uint64_t x, y;
+
+    for (; n >= 8; n -= 8, p += 8, q += 8) {
+        std::memcpy(&x, p, 8);
+        std::memcpy(&y, q, 8);
+
+        if (x != y && fold_ascii(x) != fold_ascii(y))
+            return false;
+    }
+
+    for (std::size_t i = 0; i < n; i++) {
+        unsigned char c = p[i], d = q[i];
+        if (c != d && fold_ascii(c) != fold_ascii(d))
+            return false;
+    }
+
+    return true;
+}
+
+void HttpHeaderIndex::build_index() const {
+    constexpr uint32_t npos = UINT32_MAX;
+
+    for (const HttpHeaderView &header : HttpHeaderCursor(message))
+        headers.push_back(header);
+
+    std::size_t cap = 8;
+    while (cap < headers.size() * 2)
+        cap *= 2;
+
+    mask = cap - 1;
+    slots.assign(cap, npos);
+    hashes.assign(cap, 0);
+    next_same.assign(headers.size(), npos);
+
+    // The last header of each slot's name, used to append to the chain
+    std::vector<uint32_t> tails(cap, npos);
+
+    for (uint32_t i = 0; i < (uint32_t)headers.size(); i++) {
+        std::string_view name = headers[i].name;
+        uint64_t h = header_name_hash(name);
+        uint64_t pos = h & mask;
+
+        while (slots[pos] != npos) {
+            if (hashes[pos] == h &&
+                http_name_equal(headers[slots[pos]].name, name))
+                break;
+            pos = (pos + 1) & mask;
+        }
+
+        if (slots[pos] == npos) {
+            slots[pos] = i;
+            hashes[pos] = h;
+        }
+        else
+            next_same[tails[pos]] = i;
+
+        tails[pos] = i;
+    }
+
+    built = true;
+}
+
+uint32_t HttpHeaderIndex::find_slot(std::string_view name, uint64_t h) const {
+    uint64_t pos = h & mask;
+
+    while (slots[pos] != UINT32_MAX) {
+        if (hashes[pos] == h &&
+            http_name_equal(headers[slots[pos]].name, name))
+            return slots[pos];
+        pos = (pos + 1) & mask;
+    }
+
+    return UINT32_MAX;
+}
+
+bool
+HttpHeaderIndex::find(std::string_view name, std::string_view &value) const {
+    build();
+
+    uint32_t idx = find_slot(name, header_name_hash(name));
+    if (idx == UINT32_MAX)
+        return false;
+
+    value = headers[idx].value;
+    return true;
+}
+
+std::vector<std::string_view>
+HttpHeaderIndex::get_all(std::string_view name) const {
+    std::vector<std::string_view> values;
+
+    build();
+
+    uint32_t idx = find_slot(name, header_name_hash(name));
+    for (; idx != UINT32_MAX; idx = next_same[idx])
+        values.push_back(headers[idx].value);
+
+    return values;
+}
+
 bool HttpChunkCursor::iterator::next() noexcept {
     if (cur == end) {
         cur = end = nullptr;
@@ -209,4 +1038,157 @@ bool HttpChunkCursor::iterator::next() noexcept {
     return true;
 }
 
+Task<int> HttpResponseWriter::push(std::string_view data) {
+    using std::chrono::milliseconds;
+    constexpr milliseconds max_backoff(32);
+
+    auto *task = ctx.get_task();
+    auto deadline = std::chrono::steady_clock::now()
+                  + milliseconds(write_timeout);
+    milliseconds backoff(1);
+
+    while (!data.empty()) {
+        int ret = task->push(data.data(), data.size());
+
+        if (ret > 0) {
+            data.remove_prefix((std::size_t)ret);
+            backoff = milliseconds(1);
+            continue;
+        }
+
+        if (ret < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+            co_return -errno;
+
+        // The send buffer is full, wait for the peer to consume it. There is
+        // no writable notification for server task, so poll with backoff.
+        if (write_timeout >= 0 && std::chrono::steady_clock::now() >= deadline)
+            co_return -ETIMEDOUT;
+
+        co_await coke::sleep(backoff);
+        backoff = std::min(backoff * 2, max_backoff);
+    }
+
+    co_return 0;
+}
+
+Task<int> HttpResponseWriter::start(long long content_length) {
+    HttpResponse &resp = ctx.get_resp();
+    const char *version = resp.get_http_version();
+    const char *code = resp.get_status_code();
+    const char *phrase = resp.get_reason_phrase();
+    std::string head;
+
+    assert(!started);
+    started = true;
+    chunked = (content_length < 0);
+
+    head.append(version ? version : "HTTP/1.1").append(" ")
+        .append(code ? code : "200").append(" ")
+        .append(phrase ? phrase : "").append("\r\n");
+
+    for (const HttpHeaderView &header : HttpHeaderCursor(resp))
+        head.append(header.name).append(": ").append(header.value).append("\r\n");
+
+    if (chunked)
+        head.append("Transfer-Encoding: chunked\r\n");
+    else
+        head.append("Content-Length: ").append(std::to_string(content_length))
+            .append("\r\n");
+
+    head.append("\r\n");
+
+    error = co_await push(head);
+    co_return error;
+}
+
+Task<int> HttpResponseWriter::write_chunk(std::string_view data) {
+    char size_line[32];
+    int len;
+
+    assert(started);
+    if (error != 0)
+        co_return error;
+
+    if (data.empty())
+        co_return 0;
+
+    if (chunked) {
+        len = snprintf(size_line, sizeof(size_line), "%zx\r\n", data.size());
+        error = co_await push(std::string_view(size_line, len));
+    }
+
+    if (error == 0)
+        error = co_await push(data);
+
+    if (error == 0 && chunked)
+        error = co_await push("\r\n");
+
+    if (error == 0)
+        body_sent += data.size();
+
+    co_return error;
+}
+
+Task<int> HttpResponseWriter::write_file(const MappedFile &file,
+                                         std::size_t offset,
+                                         std::size_t len) {
+    constexpr std::size_t PIECE_SIZE = 1024 * 1024;
+    std::string_view data = file.view(offset, len);
+
+    assert(started);
+    if (error != 0)
+        co_return error;
+
+    if (data.size() != len)
+        co_return -EINVAL;
+
+    while (!data.empty()) {
+        std::string_view piece = data.substr(0, PIECE_SIZE);
+
+        // It is only a hint, the piece can be sent even if it fails
+        co_await file.prefetch(offset, piece.size());
+
+        int ret = co_await write_chunk(piece);
+        if (ret != 0)
+            co_return ret;
+
+        data.remove_prefix(piece.size());
+        offset += piece.size();
+    }
+
+    co_return 0;
+}
+
+Task<int> HttpResponseWriter::finish() {
+    NetworkReplyResult res;
+
+    if (!started) {
+        res = co_await ctx.reply();
+        co_return res.state == STATE_SUCCESS ? 0 : -res.error;
+    }
+
+    if (error == 0 && chunked)
+        error = co_await push("0\r\n\r\n");
+
+    res = co_await ctx.noreply();
+    co_return error;
+}
+
+Task<HttpReplyResult> reply_metrics(HttpServerContext &ctx,
+                                    const MetricsRegistry &registry) {
+    HttpResponse &resp = ctx.get_resp();
+    std::string body = registry.export_prometheus();
+
+    resp.set_status_code("200");
+    resp.set_header_pair("Content-Type",
+                         "text/plain; version=0.0.4; charset=utf-8");
+    resp.append_output_body(body.data(), body.size());
+
+    co_return co_await ctx.reply();
+}
+
+Task<> metrics_processor(HttpServerContext ctx) {
+    co_await reply_metrics(ctx, default_metrics_registry());
+}
+
 } // namespace coke
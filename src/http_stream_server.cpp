@@ -0,0 +1,438 @@
+/**
+ * Copyright 2024 Coke Project (https://github.com/kedixa/coke)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Authors: kedixa (https://github.com/kedixa)
+*/
+
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+
+#include "coke/http/http_stream_server.h"
+#include "coke/http/http_utils.h"
+
+namespace coke {
+
+namespace {
+
+// Max hex digits of a chunk size, which fits in uint64_t
+constexpr int MAX_CHUNK_DIGITS = 15;
+
+int hex_value(char c) {
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    else if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    else if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+
+    return -1;
+}
+
+bool parse_content_length(std::string_view value, uint64_t &length) {
+    const char *first = value.data();
+    const char *last = first + value.size();
+
+    auto res = std::from_chars(first, last, length);
+    return res.ec == std::errc() && res.ptr == last && first != last;
+}
+
+} // namespace
+
+namespace detail {
+
+void HttpBodyState::put(const char *data, std::size_t size, bool end) {
+    std::lock_guard<std::mutex> lg(mtx);
+
+    if (!detached && error == 0 && size > 0) {
+        if (buffer.size() + size > buffer_size) {
+            // Workflow can not stop reading the connection, the rest of the
+            // body is discarded and the reader knows it.
+            error = -ENOBUFS;
+            std::string().swap(buffer);
+        }
+        else
+            buffer.append(data, size);
+    }
+
+    if (end)
+        eof = true;
+
+    if (!detached)
+        cond.notify_one();
+}
+
+long long HttpBodyState::feed(const char *data, std::size_t size) {
+    if (chunked)
+        return feed_chunked(data, size);
+
+    std::size_t n = (std::size_t)std::min<uint64_t>(size, data_left);
+
+    data_left -= n;
+    if (data_left == 0)
+        parse_state = DONE;
+
+    put(data, n, data_left == 0);
+    return (long long)n;
+}
+
+long long HttpBodyState::feed_chunked(const char *data, std::size_t size) {
+    std::size_t pos = 0;
+
+    while (pos < size && parse_state != DONE) {
+        char c = data[pos];
+
+        switch (parse_state) {
+        case CHUNK_SIZE:
+            if (hex_value(c) >= 0) {
+                if (++chunk_digits > MAX_CHUNK_DIGITS)
+                    goto bad;
+
+                data_left = data_left * 16 + hex_value(c);
+            }
+            else if (chunk_digits == 0)
+                goto bad;
+            else if (c == ';' || c == ' ' || c == '\t')
+                parse_state = CHUNK_EXT;
+            else if (c == '\r')
+                parse_state = CHUNK_SIZE_LF;
+            else if (c == '\n')
+                parse_state = data_left ? CHUNK_DATA : TRAILER;
+            else
+                goto bad;
+
+            pos++;
+            break;
+
+        case CHUNK_EXT:
+            // The chunk extensions are ignored
+            if (c == '\r')
+                parse_state = CHUNK_SIZE_LF;
+            else if (c == '\n')
+                parse_state = data_left ? CHUNK_DATA : TRAILER;
+
+            pos++;
+            break;
+
+        case CHUNK_SIZE_LF:
+            if (c != '\n')
+                goto bad;
+
+            parse_state = data_left ? CHUNK_DATA : TRAILER;
+            pos++;
+            break;
+
+        case CHUNK_DATA: {
+            std::size_t n = (std::size_t)std::min<uint64_t>(size - pos,
+                                                            data_left);
+            put(data + pos, n, false);
+            data_left -= n;
+            pos += n;
+
+            if (data_left == 0)
+                parse_state = CHUNK_DATA_CR;
+
+            break;
+        }
+
+        case CHUNK_DATA_CR:
+            if (c == '\r')
+                parse_state = CHUNK_DATA_LF;
+            else if (c == '\n')
+                parse_state = CHUNK_SIZE;
+            else
+                goto bad;
+
+            chunk_digits = 0;
+            pos++;
+            break;
+
+        case CHUNK_DATA_LF:
+            if (c != '\n')
+                goto bad;
+
+            parse_state = CHUNK_SIZE;
+            pos++;
+            break;
+
+        case TRAILER:
+            // An empty line ends the trailers, the others are ignored
+            if (c == '\r')
+                parse_state = TRAILER_LF;
+            else if (c == '\n')
+                parse_state = DONE;
+            else
+                parse_state = TRAILER_LINE;
+
+            pos++;
+            break;
+
+        case TRAILER_LINE:
+            if (c == '\n')
+                parse_state = TRAILER;
+
+            pos++;
+            break;
+
+        case TRAILER_LF:
+            if (c != '\n')
+                goto bad;
+
+            parse_state = DONE;
+            pos++;
+            break;
+        }
+    }
+
+    if (parse_state == DONE)
+        put(nullptr, 0, true);
+
+    return (long long)pos;
+
+bad:
+    abort(-EBADMSG);
+    return -1;
+}
+
+void HttpBodyState::abort(int err) {
+    std::lock_guard<std::mutex> lg(mtx);
+
+    if (!eof && error == 0) {
+        error = err;
+        cond.notify_one();
+    }
+}
+
+void HttpBodyState::detach() {
+    std::lock_guard<std::mutex> lg(mtx);
+
+    detached = true;
+    std::string().swap(buffer);
+}
+
+Task<int> HttpBodyState::read_some(std::string &data, TimedWaitHelper helper) {
+    std::unique_lock<std::mutex> lk(mtx);
+    int ret;
+
+    while (buffer.empty() && error == 0 && !eof) {
+        if (helper.infinite())
+            ret = co_await cond.wait(lk);
+        else
+            ret = co_await cond.wait_until(lk, helper.deadline());
+
+        if (ret != TOP_SUCCESS && buffer.empty() && error == 0 && !eof)
+            co_return ret;
+    }
+
+    // Swap the buffers, so that the capacity of `data` is reused by the poller
+    data.clear();
+
+    if (!buffer.empty()) {
+        data.swap(buffer);
+        co_return TOP_SUCCESS;
+    }
+
+    co_return error ? error : TOP_CLOSED;
+}
+
+HttpBodySlot *StreamingHttpRequest::get_slot(bool create) {
+    using DataType = ConnectionData<HttpBodySlot>;
+
+    if (!conn)
+        return nullptr;
+
+    void *ctx = conn->get_context();
+
+    if (!ctx && create) {
+        DataType *data = new DataType();
+
+        ctx = conn->test_set_context(nullptr, data, delete_connection_data);
+        if (!ctx)
+            return &data->value;
+
+        delete data;
+    }
+
+    auto *base = static_cast<ConnectionDataBase *>(ctx);
+    DataType *data = dynamic_cast<DataType *>(base);
+    return data ? &data->value : nullptr;
+}
+
+int StreamingHttpRequest::append(const void *buf, size_t *size) {
+    const char *p = static_cast<const char *>(buf);
+    std::size_t consumed = 0;
+
+    // Feed the rest of the body of the previous request on the connection
+    if (!head_started) {
+        HttpBodySlot *slot = get_slot(false);
+
+        if (slot && slot->current) {
+            long long n = slot->current->feed(p, *size);
+
+            if (n < 0) {
+                errno = EBADMSG;
+                return -1;
+            }
+
+            if (!slot->current->finished()) {
+                feeding = slot->current;
+                return 0;
+            }
+
+            slot->current.reset();
+            feeding.reset();
+            consumed = (std::size_t)n;
+
+            if (consumed == *size)
+                return 0;
+        }
+
+        head_started = true;
+    }
+
+    std::size_t left = *size - consumed;
+    int ret = append_head(p + consumed, &left);
+
+    if (ret == 1)
+        *size = consumed + left;
+
+    return ret;
+}
+
+int StreamingHttpRequest::append_head(const char *p, size_t *size) {
+    std::size_t n = *size;
+    bool head_end = false;
+    int ret;
+
+    // The body is parsed into this request, if it can not be streamed
+    if (buffered)
+        return protocol::HttpRequest::append(p, size);
+
+    for (std::size_t i = 0; i < *size; i++) {
+        char expect = (head_matched % 2 == 0) ? '\r' : '\n';
+
+        if (p[i] == expect)
+            head_matched++;
+        else
+            head_matched = (p[i] == '\r') ? 1 : 0;
+
+        if (head_matched == 4) {
+            n = i + 1;
+            head_end = true;
+            break;
+        }
+    }
+
+    ret = protocol::HttpRequest::append(p, &n);
+    if (ret != 0 || !head_end) {
+        if (ret == 1)
+            *size = n;
+
+        return ret;
+    }
+
+    // The headers are completed, but the body is not
+    uint64_t length = 0;
+    bool chunked = is_chunked();
+
+    if (!chunked) {
+        HttpHeaderIndex index(*this);
+
+        if (!parse_content_length(index.get("Content-Length"), length)) {
+            errno = EBADMSG;
+            return -1;
+        }
+    }
+
+    std::size_t rest = *size - n;
+    HttpBodySlot *slot = get_slot(true);
+
+    if (!slot) {
+        // The connection data is used by others
+        buffered = true;
+        ret = protocol::HttpRequest::append(p + n, &rest);
+
+        if (ret == 1)
+            *size = n + rest;
+
+        return ret;
+    }
+
+    body = std::make_shared<HttpBodyState>(buffer_size, chunked, length);
+    slot->current = body;
+
+    long long k = body->feed(p + n, rest);
+    if (k < 0) {
+        errno = EBADMSG;
+        return -1;
+    }
+
+    if (body->finished())
+        slot->current.reset();
+
+    *size = n + (std::size_t)k;
+    return 1;
+}
+
+} // namespace detail
+
+Task<int> HttpBodyReader::read_impl(std::string &data,
+                                    detail::TimedWaitHelper helper) {
+    int ret;
+
+    if (!state) {
+        // The whole body is already parsed into the request
+        std::string_view body = http_body_view(req);
+
+        data.clear();
+        if (parsed_body_read || body.empty())
+            co_return TOP_CLOSED;
+
+        parsed_body_read = true;
+        data.assign(body);
+        body_read += data.size();
+        co_return TOP_SUCCESS;
+    }
+
+    ret = co_await state->read_some(data, helper);
+    if (ret == TOP_SUCCESS)
+        body_read += data.size();
+
+    co_return ret;
+}
+
+CommSession *HttpStreamServer::new_session(long long seq,
+                                           CommConnection *conn) {
+    CommSession *session = BaseType::new_session(seq, conn);
+
+    if (session) {
+        TaskType *task = static_cast<TaskType *>(session);
+        task->get_req()->set_connection(static_cast<WFConnection *>(conn),
+                                        body_buffer_size);
+    }
+
+    return session;
+}
+
+void HttpStreamServer::do_reject(TaskType *task) {
+    HttpResponse *resp = task->get_resp();
+
+    resp->set_http_version("HTTP/1.1");
+    resp->set_status_code("503");
+    resp->set_reason_phrase("Service Unavailable");
+    resp->set_header_pair("Retry-After", "1");
+}
+
+} // namespace coke
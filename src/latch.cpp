@@ -24,45 +24,30 @@
 namespace coke {
 
 void Latch::count_down(long n) {
-    const void *addr = nullptr;
+    const void *addr = get_addr();
+    long s = state.fetch_sub(n * COUNT_ONE, std::memory_order_acq_rel);
+    long count = s / COUNT_ONE;
 
-    {
-        std::lock_guard<std::mutex> lg(this->mtx);
-
-        if (this->expected > 0) {
-            this->expected -= n;
-
-            if (this->expected <= 0)
-                addr = get_addr();
-        }
-    }
-
-    if (addr)
+    // Only the one who counts it to zero wakes up the waiters, if any
+    if ((s & WAITING) && count > 0 && count <= n)
         cancel_sleep_by_addr(addr);
 
     // ATTENTION: *this maybe destroyed
 }
 
 LatchAwaiter Latch::create_awaiter(long n) {
-    LatchAwaiter a;
-    const void *addr = nullptr;
-
-    {
-        std::lock_guard<std::mutex> lg(this->mtx);
+    const void *addr = get_addr();
 
-        if (this->expected > 0) {
-            this->expected -= n;
+    // Sleep before counting down, *this maybe destroyed once it reaches zero
+    LatchAwaiter a = sleep(addr, coke::inf_dur);
+    long s = state.load(std::memory_order_relaxed);
 
-            if (this->expected <= 0) {
-                addr = get_addr();
-            }
-            else {
-                a = SleepAwaiter(get_addr(), coke::inf_dur, false);
-            }
-        }
-    }
+    while (!state.compare_exchange_weak(s, (s - n * COUNT_ONE) | WAITING,
+                                        std::memory_order_acq_rel,
+                                        std::memory_order_relaxed))
+        ;
 
-    if (addr)
+    if (s / COUNT_ONE <= n)
         cancel_sleep_by_addr(addr);
 
     // ATTENTION: *this maybe destroyed
@@ -70,11 +55,18 @@ LatchAwaiter Latch::create_awaiter(long n) {
 }
 
 LatchAwaiter Latch::wait_impl(detail::TimedWaitHelper helper) {
-    std::lock_guard<std::mutex> lg(mtx);
-    if (this->expected > 0)
-        return sleep(get_addr(), helper);
-    else
+    if (load_count() <= 0)
         return SleepAwaiter();
+
+    // See WaitGroup::wait, either the last count_down sees the bit, or the
+    // count is seen to be zero here
+    LatchAwaiter a = sleep(get_addr(), helper);
+    long s = state.fetch_or(WAITING, std::memory_order_acq_rel);
+
+    if (s / COUNT_ONE <= 0)
+        cancel_sleep_by_addr(get_addr());
+
+    return a;
 }
 
 } // namespace coke
@@ -0,0 +1,86 @@
+/**
+ * Copyright 2024 Coke Project (https://github.com/kedixa/coke)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Authors: kedixa (https://github.com/kedixa)
+*/
+
+#include <algorithm>
+#include <cmath>
+
+#include "coke/latency_histogram.h"
+
+namespace coke {
+
+uint64_t HistogramSnapshot::percentile(double p) const noexcept {
+    if (count == 0)
+        return 0;
+
+    p = std::clamp(p, 0.0, 1.0);
+    uint64_t rank = (uint64_t)std::ceil(p * double(count));
+    uint64_t seen = 0;
+
+    if (rank == 0)
+        rank = 1;
+
+    for (std::size_t i = 0; i < buckets.size(); i++) {
+        seen += buckets[i];
+        if (seen >= rank)
+            return std::min(LatencyHistogram::bucket_upper(i), max);
+    }
+
+    return max;
+}
+
+void HistogramSnapshot::merge(const HistogramSnapshot &other) {
+    if (buckets.size() < other.buckets.size())
+        buckets.resize(other.buckets.size(), 0);
+
+    for (std::size_t i = 0; i < other.buckets.size(); i++)
+        buckets[i] += other.buckets[i];
+
+    count += other.count;
+    sum += other.sum;
+    max = std::max(max, other.max);
+}
+
+HistogramSnapshot LatencyHistogram::snapshot() const {
+    HistogramSnapshot snap;
+    snap.buckets.assign(NUM_BUCKETS, 0);
+
+    for (const Shard &shard : shards) {
+        for (std::size_t i = 0; i < NUM_BUCKETS; i++)
+            snap.buckets[i] += shard.buckets[i].load(std::memory_order_relaxed);
+
+        snap.count += shard.count.load(std::memory_order_relaxed);
+        snap.sum += shard.sum.load(std::memory_order_relaxed);
+        snap.max = std::max(snap.max,
+                            shard.max.load(std::memory_order_relaxed));
+    }
+
+    return snap;
+}
+
+void LatencyHistogram::reset() noexcept {
+    for (Shard &shard : shards) {
+        for (std::size_t i = 0; i < NUM_BUCKETS; i++)
+            shard.buckets[i].store(0, std::memory_order_relaxed);
+
+        shard.count.store(0, std::memory_order_relaxed);
+        shard.sum.store(0, std::memory_order_relaxed);
+        shard.max.store(0, std::memory_order_relaxed);
+    }
+}
+
+} // namespace coke
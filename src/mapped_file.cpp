@@ -0,0 +1,142 @@
+/**
+ * Copyright 2024 Coke Project (https://github.com/kedixa/coke)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Authors: kedixa (https://github.com/kedixa)
+*/
+
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#include "coke/mapped_file.h"
+#include "coke/go.h"
+
+namespace coke {
+
+int MappedFile::open(const std::string &path) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return -errno;
+
+    int ret = map(fd);
+    ::close(fd);
+    return ret;
+}
+
+int MappedFile::map(int fd) {
+    struct stat st;
+
+    if (fstat(fd, &st) < 0)
+        return -errno;
+
+    // mmap with zero length fails, an empty file is mapped as empty
+    void *ptr = nullptr;
+    if (st.st_size > 0) {
+        ptr = mmap(nullptr, (std::size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (ptr == MAP_FAILED)
+            return -errno;
+    }
+
+    unmap();
+    addr = ptr;
+    length = (std::size_t)st.st_size;
+    page_size = (std::size_t)sysconf(_SC_PAGESIZE);
+    return 0;
+}
+
+void MappedFile::unmap() noexcept {
+    if (addr)
+        munmap(addr, length);
+
+    addr = nullptr;
+    length = 0;
+}
+
+bool MappedFile::page_range(std::size_t offset, std::size_t len,
+                            std::size_t &begin, std::size_t &end) const noexcept {
+    if (!addr || offset >= length || len == 0)
+        return false;
+
+    end = std::min(len, length - offset) + offset;
+    begin = offset / page_size * page_size;
+    return true;
+}
+
+int MappedFile::prefetch_pages(const char *addr, std::size_t begin,
+                               std::size_t end, std::size_t page_size) {
+    void *start = const_cast<char *>(addr + begin);
+    int ret = 0;
+
+    if (madvise(start, end - begin, MADV_WILLNEED) < 0)
+        ret = -errno;
+
+    // Touch each page, the page faults happen in the go thread
+    volatile const char *p = addr;
+    unsigned char sum = 0;
+    for (std::size_t off = begin; off < end; off += page_size)
+        sum += p[off];
+
+    (void)sum;
+    return ret;
+}
+
+Task<int> MappedFile::prefetch(std::size_t offset, std::size_t len) const {
+    std::size_t begin, end;
+
+    if (!page_range(offset, len, begin, end))
+        co_return 0;
+
+    if (is_resident(offset, len) == 1)
+        co_return 0;
+
+    co_return co_await go(prefetch_pages, data(), begin, end, page_size);
+}
+
+int MappedFile::is_resident(std::size_t offset, std::size_t len) const {
+    std::size_t begin, end;
+
+    if (!page_range(offset, len, begin, end))
+        return 1;
+
+    std::size_t pages = (end - begin + page_size - 1) / page_size;
+    std::vector<unsigned char> vec(pages);
+
+    if (mincore(const_cast<char *>(data() + begin), end - begin, vec.data()) < 0)
+        return -errno;
+
+    for (unsigned char v : vec) {
+        if ((v & 1) == 0)
+            return 0;
+    }
+
+    return 1;
+}
+
+int MappedFile::advise(std::size_t offset, std::size_t len, int advice) const {
+    std::size_t begin, end;
+
+    if (!page_range(offset, len, begin, end))
+        return 0;
+
+    if (madvise(const_cast<char *>(data() + begin), end - begin, advice) < 0)
+        return -errno;
+
+    return 0;
+}
+
+} // namespace coke
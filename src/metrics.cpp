@@ -0,0 +1,278 @@
+/**
+ * Copyright 2024 Coke Project (https://github.com/kedixa/coke)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Authors: kedixa (https://github.com/kedixa)
+*/
+
+#include <cmath>
+#include <cstdio>
+#include <stdexcept>
+
+#include "coke/metrics.h"
+
+namespace coke {
+
+namespace {
+
+void append_escaped(std::string &out, std::string_view s, bool quote) {
+    for (char c : s) {
+        if (c == '\\')
+            out.append("\\\\");
+        else if (c == '\n')
+            out.append("\\n");
+        else if (c == '"' && quote)
+            out.append("\\\"");
+        else
+            out.push_back(c);
+    }
+}
+
+std::string format_labels(const MetricLabels &labels) {
+    std::string s;
+
+    for (const auto &[key, value] : labels) {
+        if (!s.empty())
+            s.push_back(',');
+
+        s.append(key).append("=\"");
+        append_escaped(s, value, true);
+        s.push_back('"');
+    }
+
+    return s;
+}
+
+void append_double(std::string &out, double v) {
+    if (std::isnan(v))
+        out.append("NaN");
+    else if (std::isinf(v))
+        out.append(v > 0 ? "+Inf" : "-Inf");
+    else {
+        char buf[32];
+        int len = snprintf(buf, sizeof(buf), "%.17g", v);
+        out.append(buf, len);
+    }
+}
+
+void append_name(std::string &out, std::string_view name,
+                 std::string_view suffix, std::string_view labels,
+                 std::string_view extra = {}) {
+    out.append(name).append(suffix);
+
+    if (!labels.empty() || !extra.empty()) {
+        out.push_back('{');
+        out.append(labels);
+        if (!labels.empty() && !extra.empty())
+            out.push_back(',');
+        out.append(extra);
+        out.push_back('}');
+    }
+
+    out.push_back(' ');
+}
+
+const char *type_name(MetricType type) {
+    switch (type) {
+    case MetricType::COUNTER: return "counter";
+    case MetricType::GAUGE: return "gauge";
+    case MetricType::SUMMARY: return "summary";
+    }
+
+    return "untyped";
+}
+
+void append_summary(std::string &out, std::string_view name,
+                    std::string_view labels, const HistogramSnapshot &snap) {
+    static constexpr std::pair<double, const char *> quantiles[] = {
+        {0.5, "quantile=\"0.5\""},
+        {0.9, "quantile=\"0.9\""},
+        {0.99, "quantile=\"0.99\""},
+        {0.999, "quantile=\"0.999\""},
+    };
+
+    for (const auto &[p, label] : quantiles) {
+        append_name(out, name, "", labels, label);
+        out.append(std::to_string(snap.percentile(p))).push_back('\n');
+    }
+
+    append_name(out, name, "_sum", labels);
+    out.append(std::to_string(snap.sum)).push_back('\n');
+    append_name(out, name, "_count", labels);
+    out.append(std::to_string(snap.count)).push_back('\n');
+}
+
+} // namespace
+
+MetricsRegistry::Series &
+MetricsRegistry::get_series(std::string_view name, std::string_view help,
+                            MetricType type, const MetricLabels &labels) {
+    auto it = families.find(name);
+
+    if (it == families.end()) {
+        it = families.emplace(std::string(name), Family{}).first;
+        it->second.help.assign(help);
+        it->second.type = type;
+    }
+    else if (it->second.type != type) {
+        throw std::invalid_argument("coke::MetricsRegistry: metric "
+            + std::string(name) + " is registered with another type");
+    }
+
+    std::string label_str = format_labels(labels);
+
+    for (auto &s : it->second.series) {
+        if (s->labels == label_str)
+            return *s;
+    }
+
+    it->second.series.push_back(std::make_unique<Series>());
+    Series &s = *it->second.series.back();
+    s.labels = std::move(label_str);
+    return s;
+}
+
+MetricCounter &
+MetricsRegistry::counter(std::string_view name, std::string_view help,
+                         const MetricLabels &labels) {
+    std::lock_guard<std::mutex> lg(mtx);
+    Series &s = get_series(name, help, MetricType::COUNTER, labels);
+
+    if (!s.counter) {
+        s.value_func = nullptr;
+        s.counter = std::make_unique<MetricCounter>();
+    }
+
+    return *s.counter;
+}
+
+MetricGauge &
+MetricsRegistry::gauge(std::string_view name, std::string_view help,
+                       const MetricLabels &labels) {
+    std::lock_guard<std::mutex> lg(mtx);
+    Series &s = get_series(name, help, MetricType::GAUGE, labels);
+
+    if (!s.gauge) {
+        s.value_func = nullptr;
+        s.gauge = std::make_unique<MetricGauge>();
+    }
+
+    return *s.gauge;
+}
+
+LatencyHistogram &
+MetricsRegistry::histogram(std::string_view name, std::string_view help,
+                           const MetricLabels &labels) {
+    std::lock_guard<std::mutex> lg(mtx);
+    Series &s = get_series(name, help, MetricType::SUMMARY, labels);
+
+    if (!s.histogram) {
+        s.snapshot_func = nullptr;
+        s.histogram = std::make_unique<LatencyHistogram>();
+    }
+
+    return *s.histogram;
+}
+
+void MetricsRegistry::add_callback(std::string_view name,
+                                   std::string_view help, MetricType type,
+                                   const MetricLabels &labels,
+                                   ValueFunc func) {
+    if (type == MetricType::SUMMARY)
+        throw std::invalid_argument("coke::MetricsRegistry: summary callback "
+                                    "must return HistogramSnapshot");
+
+    std::lock_guard<std::mutex> lg(mtx);
+    Series &s = get_series(name, help, type, labels);
+    s.value_func = std::move(func);
+}
+
+void MetricsRegistry::add_callback(std::string_view name,
+                                   std::string_view help,
+                                   const MetricLabels &labels,
+                                   SnapshotFunc func) {
+    std::lock_guard<std::mutex> lg(mtx);
+    Series &s = get_series(name, help, MetricType::SUMMARY, labels);
+    s.snapshot_func = std::move(func);
+}
+
+bool MetricsRegistry::remove(std::string_view name,
+                             const MetricLabels &labels) {
+    std::lock_guard<std::mutex> lg(mtx);
+    auto it = families.find(name);
+
+    if (it == families.end())
+        return false;
+
+    std::string label_str = format_labels(labels);
+    auto &series = it->second.series;
+
+    for (auto sit = series.begin(); sit != series.end(); ++sit) {
+        if ((*sit)->labels == label_str) {
+            (*sit)->value_func = nullptr;
+            (*sit)->snapshot_func = nullptr;
+            removed.push_back(std::move(*sit));
+            series.erase(sit);
+
+            if (series.empty())
+                families.erase(it);
+
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void MetricsRegistry::export_prometheus(std::string &out) const {
+    std::lock_guard<std::mutex> lg(mtx);
+
+    for (const auto &[name, family] : families) {
+        out.append("# HELP ").append(name).push_back(' ');
+        append_escaped(out, family.help, false);
+        out.append("\n# TYPE ").append(name).push_back(' ');
+        out.append(type_name(family.type)).push_back('\n');
+
+        for (const auto &s : family.series) {
+            if (family.type == MetricType::SUMMARY) {
+                if (s->snapshot_func)
+                    append_summary(out, name, s->labels, s->snapshot_func());
+                else if (s->histogram)
+                    append_summary(out, name, s->labels,
+                                   s->histogram->snapshot());
+                continue;
+            }
+
+            append_name(out, name, "", s->labels);
+
+            if (s->value_func)
+                append_double(out, s->value_func());
+            else if (s->counter)
+                out.append(std::to_string(s->counter->value()));
+            else if (s->gauge)
+                out.append(std::to_string(s->gauge->value()));
+            else
+                out.push_back('0');
+
+            out.push_back('\n');
+        }
+    }
+}
+
+MetricsRegistry &default_metrics_registry() {
+    static MetricsRegistry registry;
+    return registry;
+}
+
+} // namespace coke
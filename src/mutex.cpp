@@ -15,147 +15,382 @@
  *
  * Authors: kedixa (https://github.com/kedixa)
 */
+#include <atomic>
 
+#include "coke/mutex.h"
 #include "coke/semaphore.h"
 #include "coke/shared_mutex.h"
+#include "coke/detail/spin_wait.h"
 
 namespace coke {
 
-Task<int> Semaphore::acquire_impl(detail::TimedWaitHelper helper) {
+static std::atomic<std::size_t> lock_spin_count{0};
+
+namespace detail {
+
+std::size_t get_lock_spin_count() noexcept {
+    return lock_spin_count.load(std::memory_order_relaxed);
+}
+
+} // namespace detail
+
+void set_lock_spin_count(int n) noexcept {
+    lock_spin_count.store(n > 0 ? (std::size_t)n : 0,
+                          std::memory_order_relaxed);
+}
+
+
+// Semaphore Implement
+
+struct Semaphore::Waiter {
+    Waiter *next;
+    CountType need;
+    bool granted;
+};
+
+void Semaphore::grant_waiters() {
+    while (head && head->need <= count) {
+        Waiter *w = head;
+
+        head = w->next;
+        if (head == nullptr)
+            tail = nullptr;
+
+        count -= w->need;
+        w->granted = true;
+
+        // The waiter resumes after `mtx` is released, `w` is not used later
+        cancel_sleep_by_addr(w, 1);
+    }
+}
+
+Task<int> Semaphore::acquire_impl(CountType n, detail::TimedWaitHelper helper) {
     std::unique_lock<std::mutex> lk(mtx);
-    bool insert_head = false;
-    int ret;
+    int ret = TOP_SUCCESS;
 
-    // Directly get one if it is enough,
-    if (waiting < count) {
-        --count;
+    // Directly get them if no one is waiting and the counts are enough,
+    if (n == 0 || (head == nullptr && count >= n)) {
+        count -= n;
         co_return TOP_SUCCESS;
     }
 
-    // otherwise reschedule to ensure relative fairness(but not absolutely).
-    while (true) {
-        if (helper.timeout())
-            co_return TOP_TIMEOUT;
+    // Spin a while if no one is parked, the count may be released soon
+    if (head == nullptr && detail::get_lock_spin_count() > 0) {
+        lk.unlock();
 
-        auto s = sleep(get_addr(), helper, insert_head);
-        ++waiting;
-        insert_head = true;
+        bool acquired = detail::spin_try_lock(mtx, [this, n] {
+            if (head != nullptr || count < n)
+                return false;
+
+            count -= n;
+            return true;
+        });
+
+        if (acquired)
+            co_return TOP_SUCCESS;
+
+        lk.lock();
+        if (head == nullptr && count >= n) {
+            count -= n;
+            co_return TOP_SUCCESS;
+        }
+    }
+
+    // otherwise wait in the queue, `release` hands the counts to the front
+    // of the queue directly, so that large requests are not starved.
+    Waiter w{nullptr, n, false};
+
+    if (tail)
+        tail->next = &w;
+    else
+        head = &w;
+    tail = &w;
+
+    while (!w.granted) {
+        if (ret == SLEEP_ABORTED || ret < 0)
+            break;
+
+        if (helper.timeout()) {
+            ret = TOP_TIMEOUT;
+            break;
+        }
+
+        auto s = sleep((const void *)&w, helper);
 
         lk.unlock();
         ret = co_await std::move(s);
         lk.lock();
-        --waiting;
+    }
 
-        if (count > 0)
-            break;
-        else if (ret == SLEEP_ABORTED || ret < 0)
-            co_return ret;
+    if (w.granted)
+        co_return TOP_SUCCESS;
+
+    // Leave the queue, those behind may be satisfied now
+    Waiter **pw = &head;
+    Waiter *prev = nullptr;
+
+    while (*pw != &w) {
+        prev = *pw;
+        pw = &prev->next;
     }
 
-    --count;
-    co_return TOP_SUCCESS;
+    *pw = w.next;
+    if (tail == &w)
+        tail = prev;
+
+    grant_waiters();
+    co_return ret;
 }
 
 
-// SharedMutex Implement
+// Mutex Implement
+
+Task<int> Mutex::lock_slow(detail::TimedWaitHelper helper) {
+    std::unique_lock<std::mutex> lk(mtx);
+    bool insert_head = false;
+    int ret = TOP_SUCCESS;
+    uint32_t s;
+
+    // Try again before waiting, the mutex may be unlocked just now
+    if (lock_fast())
+        co_return TOP_SUCCESS;
+
+    state.fetch_add(ONE_WAITER, std::memory_order_relaxed);
+
+    while (true) {
+        s = state.load(std::memory_order_relaxed);
+
+        while (!(s & LOCKED)) {
+            if (state.compare_exchange_weak(s, (s - ONE_WAITER) | LOCKED,
+                                            std::memory_order_acquire,
+                                            std::memory_order_relaxed))
+                co_return TOP_SUCCESS;
+        }
+
+        if (ret == SLEEP_ABORTED || ret < 0)
+            break;
+
+        if (helper.timeout()) {
+            ret = TOP_TIMEOUT;
+            break;
+        }
+
+        // `unlock` wakes up a waiter within `mtx`, after the sleep is created
+        auto slp = sleep(get_addr(), helper, insert_head);
+        insert_head = true;
+
+        lk.unlock();
+        ret = co_await std::move(slp);
+        lk.lock();
+    }
 
-void SharedMutex::unlock() {
+    state.fetch_sub(ONE_WAITER, std::memory_order_relaxed);
+    co_return ret;
+}
+
+void Mutex::wake_one() {
     std::lock_guard<std::mutex> lg(mtx);
+    cancel_sleep_by_addr(get_addr(), 1);
+}
 
-    if (state == State::Writing) {
-        state = State::Idle;
+struct Mutex::Waiter {
+    Waiter *next;
+    bool granted;
+};
 
-        if (write_waiting)
-            cancel_sleep_by_addr(wlock_addr(), 1);
-        else if (read_waiting)
-            cancel_sleep_by_addr(rlock_addr());
+Task<int> Mutex::lock_handoff(detail::TimedWaitHelper helper) {
+    std::unique_lock<std::mutex> lk(mtx);
+    int ret = TOP_SUCCESS;
+
+    // Try again before waiting, the mutex may be unlocked just now
+    if (lock_fast())
+        co_return TOP_SUCCESS;
+
+    // Once a waiter is counted, `unlock` never clears LOCKED but goes to
+    // unlock_handoff, which waits for `mtx` to see the queue.
+    uint32_t s = state.fetch_add(ONE_WAITER, std::memory_order_relaxed);
+    if (!(s & LOCKED)) {
+        s += ONE_WAITER;
+        while (!(s & LOCKED)) {
+            if (state.compare_exchange_weak(s, (s - ONE_WAITER) | LOCKED,
+                                            std::memory_order_acquire,
+                                            std::memory_order_relaxed))
+                co_return TOP_SUCCESS;
+        }
     }
-    else if (state == State::Reading) {
-        read_doing--;
 
-        if (read_doing == 0) {
-            state = State::Idle;
+    Waiter w{nullptr, false};
 
-            if (write_waiting)
-                cancel_sleep_by_addr(wlock_addr(), 1);
+    if (tail)
+        tail->next = &w;
+    else
+        head = &w;
+    tail = &w;
+
+    while (!w.granted) {
+        if (ret == SLEEP_ABORTED || ret < 0)
+            break;
+
+        if (helper.timeout()) {
+            ret = TOP_TIMEOUT;
+            break;
         }
+
+        auto slp = sleep((const void *)&w, helper);
+
+        lk.unlock();
+        ret = co_await std::move(slp);
+        lk.lock();
+    }
+
+    // The ownership may be handed over just before timeout
+    if (w.granted)
+        co_return TOP_SUCCESS;
+
+    Waiter **pw = &head;
+    Waiter *prev = nullptr;
+
+    while (*pw != &w) {
+        prev = *pw;
+        pw = &prev->next;
+    }
+
+    *pw = w.next;
+    if (tail == &w)
+        tail = prev;
+
+    state.fetch_sub(ONE_WAITER, std::memory_order_relaxed);
+    co_return ret;
+}
+
+void Mutex::unlock_handoff() {
+    std::lock_guard<std::mutex> lg(mtx);
+    Waiter *w = head;
+
+    if (w == nullptr) {
+        // No one is queued, release it as usual
+        state.fetch_sub(LOCKED, std::memory_order_release);
+        return;
     }
+
+    head = w->next;
+    if (head == nullptr)
+        tail = nullptr;
+
+    // The mutex stays locked and is owned by `w` now, which synchronizes with
+    // this unlock through `mtx`
+    state.fetch_sub(ONE_WAITER, std::memory_order_relaxed);
+    w->granted = true;
+    cancel_sleep_by_addr(w, 1);
+}
+
+
+// SharedMutex Implement
+
+void SharedMutex::wake_waiters() {
+    std::lock_guard<std::mutex> lg(mtx);
+
+    // The woken one retries and parks again if the mutex is locked by others
+    // just now, whose unlock will wake it up later.
+    if (write_waiting)
+        cancel_sleep_by_addr(wlock_addr(), 1);
+    else if (read_waiting)
+        cancel_sleep_by_addr(rlock_addr());
 }
 
 Task<int> SharedMutex::lock_impl(detail::TimedWaitHelper helper) {
     std::unique_lock<std::mutex> lk(mtx);
     bool insert_head = false;
-    int ret;
+    bool locked = false;
+    int ret = TOP_SUCCESS;
+    uint32_t s;
 
-    if (state == State::Idle && write_waiting == 0) {
-        state = State::Writing;
-        co_return TOP_SUCCESS;
-    }
+    // Readers and `unlock` see the bit after it is set, and then wait for
+    // or wake up this writer within `mtx`
+    if (write_waiting++ == 0)
+        state.fetch_or(WRITER_WAITING, std::memory_order_relaxed);
 
     while (true) {
-        if (helper.timeout()) {
-            if (write_waiting == 0 && read_waiting > 0)
-                cancel_sleep_by_addr(rlock_addr());
+        s = state.load(std::memory_order_relaxed);
+
+        while (!(s & (WRITING | READER_MASK))) {
+            if (state.compare_exchange_weak(s, s | WRITING,
+                                            std::memory_order_acquire,
+                                            std::memory_order_relaxed)) {
+                locked = true;
+                break;
+            }
+        }
+
+        if (locked || ret == SLEEP_ABORTED || ret < 0)
+            break;
 
-            co_return TOP_TIMEOUT;
+        if (helper.timeout()) {
+            ret = TOP_TIMEOUT;
+            break;
         }
 
-        auto s = sleep(wlock_addr(), helper, insert_head);
-        ++write_waiting;
+        auto slp = sleep(wlock_addr(), helper, insert_head);
         insert_head = true;
 
         lk.unlock();
-        ret = co_await std::move(s);
+        ret = co_await std::move(slp);
         lk.lock();
-        --write_waiting;
+    }
 
-        if (state == State::Idle)
-            break;
-        else if (ret == SLEEP_ABORTED || ret < 0) {
-            if (write_waiting == 0 && read_waiting > 0)
-                cancel_sleep_by_addr(rlock_addr());
+    if (--write_waiting == 0) {
+        state.fetch_and(~WRITER_WAITING, std::memory_order_relaxed);
 
-            co_return ret;
-        }
+        // The readers blocked by this writer can go on if it gives up
+        if (!locked && read_waiting > 0)
+            cancel_sleep_by_addr(rlock_addr());
     }
 
-    state = State::Writing;
-    co_return TOP_SUCCESS;
+    co_return locked ? TOP_SUCCESS : ret;
 }
 
 Task<int> SharedMutex::lock_shared_impl(detail::TimedWaitHelper helper) {
     std::unique_lock<std::mutex> lk(mtx);
     bool insert_head = false;
-    int ret;
+    bool locked = false;
+    int ret = TOP_SUCCESS;
+    uint32_t s;
 
-    if (can_lock_shared()) {
-        state = State::Reading;
-        read_doing++;
-        co_return TOP_SUCCESS;
-    }
+    if (read_waiting++ == 0)
+        state.fetch_or(READER_WAITING, std::memory_order_relaxed);
 
     while (true) {
-        if (helper.timeout())
-            co_return TOP_TIMEOUT;
+        s = state.load(std::memory_order_relaxed);
+
+        while (!(s & (WRITING | WRITER_WAITING))) {
+            if (state.compare_exchange_weak(s, s + 1,
+                                            std::memory_order_acquire,
+                                            std::memory_order_relaxed)) {
+                locked = true;
+                break;
+            }
+        }
+
+        if (locked || ret == SLEEP_ABORTED || ret < 0)
+            break;
 
-        auto s = sleep(rlock_addr(), helper, insert_head);
-        ++read_waiting;
+        if (helper.timeout()) {
+            ret = TOP_TIMEOUT;
+            break;
+        }
+
+        auto slp = sleep(rlock_addr(), helper, insert_head);
         insert_head = true;
 
         lk.unlock();
-        ret = co_await std::move(s);
+        ret = co_await std::move(slp);
         lk.lock();
-        --read_waiting;
-
-        if (can_lock_shared())
-            break;
-        else if (ret == SLEEP_ABORTED || ret < 0)
-            co_return ret;
     }
 
-    state = State::Reading;
-    read_doing++;
-    co_return TOP_SUCCESS;
+    if (--read_waiting == 0)
+        state.fetch_and(~READER_WAITING, std::memory_order_relaxed);
+
+    co_return locked ? TOP_SUCCESS : ret;
 }
 
 } // namespace coke
@@ -0,0 +1,156 @@
+/**
+ * Copyright 2024 Coke Project (https://github.com/kedixa/coke)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Authors: kedixa (https://github.com/kedixa)
+*/
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+
+#include "coke/mysql/mysql_connection_pool.h"
+
+namespace coke {
+
+static int64_t pool_now_us() noexcept {
+    using namespace std::chrono;
+    auto now = steady_clock::now().time_since_epoch();
+    return duration_cast<microseconds>(now).count();
+}
+
+MySQLConnectionPool::MySQLConnectionPool(const MySQLClientParams &client_params,
+                                         const MySQLPoolParams &params)
+    : client_params(client_params), params(params),
+      sem(std::max(params.max_connections, std::size_t(1)))
+{ }
+
+Task<int> MySQLConnectionPool::acquire_impl(detail::TimedWaitHelper helper,
+                                            MySQLPooledConnection &conn) {
+    std::unique_ptr<MySQLConnection> c;
+    int64_t start = pool_now_us();
+    int ret;
+
+    if (helper.infinite())
+        ret = co_await sem.acquire();
+    else
+        ret = co_await sem.try_acquire_for(helper.time_left());
+
+    if (ret != TOP_SUCCESS)
+        co_return ret;
+
+    wait_hist.record(static_cast<uint64_t>(pool_now_us() - start));
+
+    {
+        std::lock_guard<std::mutex> lg(mtx);
+        if (closed) {
+            sem.release();
+            co_return -ECANCELED;
+        }
+
+        // The most recently used one is the most likely to be alive
+        if (!idle.empty()) {
+            c = std::move(idle.back());
+            idle.pop_back();
+        }
+    }
+
+    // The new connection is established by its first request
+    if (!c)
+        c = std::make_unique<MySQLConnection>(client_params);
+
+    conn.release();
+    conn.pool = this;
+    conn.conn = std::move(c);
+    conn.broken = false;
+    co_return TOP_SUCCESS;
+}
+
+void MySQLConnectionPool::put_back(std::unique_ptr<MySQLConnection> conn,
+                                   bool broken) {
+    bool drop;
+
+    {
+        std::lock_guard<std::mutex> lg(mtx);
+        drop = broken || closed || idle.size() >= params.max_idle;
+    }
+
+    // Reset or disconnect in background, the slot of semaphore is released
+    // after that, so the number of connections never exceeds the limit.
+    pending.add(1);
+
+    if (drop || params.reset_query.empty()) {
+        if (drop)
+            coke::detach(disconnect(std::move(conn)));
+        else {
+            {
+                std::lock_guard<std::mutex> lg(mtx);
+                idle.push_back(std::move(conn));
+            }
+
+            sem.release();
+            pending.done();
+        }
+    }
+    else
+        coke::detach(reset_connection(std::move(conn)));
+}
+
+Task<> MySQLConnectionPool::reset_connection(
+    std::unique_ptr<MySQLConnection> conn)
+{
+    MySQLResult res = co_await conn->request(params.reset_query);
+    bool ok = (res.state == STATE_SUCCESS && !res.resp.is_error_packet());
+
+    if (ok) {
+        std::lock_guard<std::mutex> lg(mtx);
+        ok = !closed;
+        if (ok)
+            idle.push_back(std::move(conn));
+    }
+
+    if (!ok)
+        co_await conn->disconnect();
+
+    sem.release();
+    pending.done();
+}
+
+Task<> MySQLConnectionPool::disconnect(std::unique_ptr<MySQLConnection> conn) {
+    co_await conn->disconnect();
+
+    sem.release();
+    pending.done();
+}
+
+Task<> MySQLConnectionPool::close() {
+    std::vector<std::unique_ptr<MySQLConnection>> conns;
+
+    {
+        std::lock_guard<std::mutex> lg(mtx);
+        closed = true;
+    }
+
+    co_await pending.wait();
+
+    {
+        std::lock_guard<std::mutex> lg(mtx);
+        conns.swap(idle);
+    }
+
+    for (auto &conn : conns)
+        co_await conn->disconnect();
+}
+
+} // namespace coke
@@ -17,11 +17,18 @@
 */
 
 #include <atomic>
+#include <cctype>
+#include <cerrno>
+#include <charconv>
+#include <cmath>
 #include <mutex>
 #include <queue>
 
+#include "coke/global.h"
 #include "coke/mysql/mysql_client.h"
+#include "coke/mysql/mysql_statement.h"
 #include "coke/mysql/mysql_utils.h"
+#include "coke/net/upstream.h"
 
 #include "workflow/StringUtil.h"
 #include "workflow/WFTaskFactory.h"
@@ -56,38 +63,62 @@ MySQLClient::MySQLClient(const MySQLClientParams &p,
     else
         host = params.host;
 
-    url.append(host);
+    url_prefix = url;
 
     if (params.port != 0)
-        url.append(":").append(std::to_string(params.port));
+        host.append(":").append(std::to_string(params.port));
 
-    url.append("/").append(dbname);
+    url_suffix.assign("/").append(dbname);
 
-    std::size_t pos = url.size();
+    std::size_t pos = url_suffix.size();
     if (!params.character_set.empty())
-        url.append("&character_set=").append(params.character_set);
+        url_suffix.append("&character_set=").append(params.character_set);
     if (!params.character_set_results.empty())
-        url.append("&character_set_results=").append(params.character_set_results);
+        url_suffix.append("&character_set_results=").append(params.character_set_results);
 
     if (unique_conn)
-        url.append("&transaction=coke_mysql_transaction_id_")
-           .append(std::to_string(conn_id));
+        url_suffix.append("&transaction=coke_mysql_transaction_id_")
+                  .append(std::to_string(conn_id));
 
-    if (url.size() > pos)
-        url[pos] = '?';
+    if (url_suffix.size() > pos)
+        url_suffix[pos] = '?';
 
+    // All the requests of a connection go to the same replica
+    detail::UpstreamSelection sel;
+    if (unique_conn && detail::upstream_select(params.host, {}, sel)) {
+        host = sel.address;
+        detail::upstream_finish(sel.server, STATE_SUCCESS);
+    }
+
+    url.append(host).append(url_suffix);
     URIParser::parse(url, uri);
 }
 
+static void mysql_upstream_hook(WFMySQLTask *task) {
+    detail::upstream_finish(task->user_data, task->get_state());
+}
+
 MySQLClient::AwaiterType MySQLClient::request(const std::string &query) {
     WFMySQLTask *task;
+    detail::UpstreamSelection sel;
+
+    if (!unique_conn && detail::upstream_select(params.host, {}, sel)) {
+        std::string replica_url = url_prefix + sel.address + url_suffix;
+        task = WFTaskFactory::create_mysql_task(replica_url, params.retry_max,
+                                                nullptr);
+        task->user_data = sel.server;
+    }
+    else
+        task = WFTaskFactory::create_mysql_task(uri, params.retry_max, nullptr);
 
-    task = WFTaskFactory::create_mysql_task(uri, params.retry_max, nullptr);
     task->set_send_timeout(params.send_timeout);
     task->set_receive_timeout(params.receive_timeout);
     task->set_keep_alive(params.keep_alive_timeout);
     task->get_req()->set_query(query);
 
+    if (sel.server)
+        return AwaiterType(task, mysql_upstream_hook);
+
     return AwaiterType(task);
 }
 
@@ -125,6 +156,126 @@ private:
 };
 
 
+AsyncGenerator<MySQLResult>
+MySQLClient::stream(std::string query, std::size_t batch_rows) {
+    std::size_t offset = 0;
+    std::string batch_query;
+
+    if (batch_rows == 0)
+        batch_rows = MYSQL_STREAM_BATCH_ROWS;
+
+    while (!query.empty() && (query.back() == ';' || std::isspace((unsigned char)query.back())))
+        query.pop_back();
+
+    while (true) {
+        batch_query.assign(query).append(" LIMIT ");
+        batch_query.append(std::to_string(offset)).append(", ");
+        batch_query.append(std::to_string(batch_rows));
+
+        MySQLResult res = co_await request(batch_query);
+
+        if (res.state != STATE_SUCCESS) {
+            co_yield std::move(res);
+            co_return;
+        }
+
+        std::size_t rows = 0;
+        bool is_result_set = false;
+
+        for (MySQLResultSetView view : MySQLResultSetCursor(res.resp)) {
+            is_result_set = view.is_result_set();
+            rows = is_result_set ? (std::size_t)view.get_row_count() : 0;
+            break;
+        }
+
+        co_yield std::move(res);
+
+        if (!is_result_set || rows < batch_rows)
+            co_return;
+
+        offset += rows;
+    }
+}
+
+void MySQLBatch::add(std::string_view stmt) {
+    while (!stmt.empty() && (stmt.back() == ';' || std::isspace((unsigned char)stmt.back())))
+        stmt.remove_suffix(1);
+
+    buf.append(stmt);
+    ends.push_back(buf.size());
+}
+
+Task<MySQLBatchResult>
+MySQLClient::execute_batch(const MySQLBatch &batch, MySQLBatchParams p) {
+    MySQLBatchResult result;
+    std::vector<std::pair<std::size_t, std::size_t>> queries;
+    std::size_t n = batch.size();
+    std::size_t first = 0, len = 0;
+    std::string query;
+
+    if (p.max_statements == 0)
+        p.max_statements = 1;
+
+    for (std::size_t i = 0; i < n; i++) {
+        std::size_t stmt_len = batch.get_statement(i).size() + 1;
+
+        if (i > first && (i - first >= p.max_statements ||
+                          len + stmt_len > p.max_query_size))
+        {
+            queries.emplace_back(first, i);
+            first = i;
+            len = 0;
+        }
+
+        len += stmt_len;
+    }
+
+    if (first < n)
+        queries.emplace_back(first, n);
+
+    // Reserve to keep the responses in place, the views refer to them.
+    result.views.resize(n);
+    result.resps.reserve(queries.size());
+
+    for (auto [begin, end] : queries) {
+        query.clear();
+        for (std::size_t i = begin; i < end; i++) {
+            if (i != begin)
+                query.push_back(';');
+            query.append(batch.get_statement(i));
+        }
+
+        MySQLResult res = co_await request(query);
+        if (res.state != STATE_SUCCESS) {
+            result.state = res.state;
+            result.error = res.error;
+            break;
+        }
+
+        result.resps.push_back(std::move(res.resp));
+
+        std::size_t idx = begin;
+        bool failed = false;
+
+        for (MySQLResultSetView view : MySQLResultSetCursor(result.resps.back())) {
+            if (idx == end)
+                break;
+
+            result.views[idx++] = view;
+            if (view.is_error()) {
+                failed = true;
+                break;
+            }
+        }
+
+        result.executed = idx;
+        if (failed || idx != end)
+            break;
+    }
+
+    co_return result;
+}
+
 std::size_t MySQLConnection::acquire_conn_id() {
     __MySQLConnId *p = __MySQLConnId::get_instance();
     return p->acquire();
@@ -147,6 +298,193 @@ MySQLConnection::AwaiterType MySQLConnection::disconnect() {
     return AwaiterType(task);
 }
 
+
+void mysql_escape_string(std::string_view str, std::string &out) {
+    out.reserve(out.size() + str.size() + 8);
+
+    for (char c : str) {
+        switch (c) {
+        case '\0':     out.append("\\0"); break;
+        case '\n':     out.append("\\n"); break;
+        case '\r':     out.append("\\r"); break;
+        case '\\':     out.append("\\\\"); break;
+        case '\'':     out.append("\\'"); break;
+        case '"':      out.append("\\\""); break;
+        case '\032':   out.append("\\Z"); break;
+        default:       out.push_back(c); break;
+        }
+    }
+}
+
+int MySQLParam::append_to(std::string &out) const {
+    char buf[32];
+    std::to_chars_result r;
+
+    switch (type) {
+    case NULL_TYPE:
+        out.append("NULL");
+        return 0;
+
+    case INT_TYPE:
+        r = std::to_chars(buf, buf + sizeof(buf), i);
+        break;
+
+    case UINT_TYPE:
+        r = std::to_chars(buf, buf + sizeof(buf), u);
+        break;
+
+    case DOUBLE_TYPE:
+        if (!std::isfinite(d))
+            return -EINVAL;
+
+        r = std::to_chars(buf, buf + sizeof(buf), d);
+        break;
+
+    default:
+        out.push_back('\'');
+        mysql_escape_string(s, out);
+        out.push_back('\'');
+        return 0;
+    }
+
+    out.append(buf, r.ptr);
+    return 0;
+}
+
+MySQLStatement::MySQLStatement(std::string_view sql_view) : sql(sql_view) {
+    std::size_t n = sql.size();
+    std::size_t start = 0;
+    std::size_t i = 0;
+
+    pieces.clear();
+
+    while (i < n) {
+        char c = sql[i];
+
+        if (c == '\'' || c == '"' || c == '`') {
+            // Skip quoted string or identifier
+            for (++i; i < n && sql[i] != c; i++) {
+                if (c != '`' && sql[i] == '\\')
+                    ++i;
+            }
+            ++i;
+        }
+        else if (c == '#' || (c == '-' && i + 2 < n && sql[i + 1] == '-' &&
+                              std::isspace((unsigned char)sql[i + 2]))) {
+            while (i < n && sql[i] != '\n')
+                ++i;
+        }
+        else if (c == '/' && i + 1 < n && sql[i + 1] == '*') {
+            std::size_t end = sql.find("*/", i + 2);
+            i = (end == std::string::npos) ? n : end + 2;
+        }
+        else if (c == '?') {
+            pieces.emplace_back(start, i - start);
+            start = ++i;
+        }
+        else
+            ++i;
+    }
+
+    pieces.emplace_back(start, n - start);
+}
+
+int MySQLStatement::bind(std::string &query,
+                         std::span<const MySQLParam> params) const {
+    if (params.size() != param_count())
+        return -EINVAL;
+
+    query.clear();
+    query.reserve(sql.size() + params.size() * 8);
+    query.append(sql, pieces[0].first, pieces[0].second);
+
+    for (std::size_t i = 0; i < params.size(); i++) {
+        if (params[i].append_to(query) < 0)
+            return -EINVAL;
+
+        query.append(sql, pieces[i + 1].first, pieces[i + 1].second);
+    }
+
+    return 0;
+}
+
+static bool parse_digits(std::string_view &data, std::size_t min_len,
+                         std::size_t max_len, int &value) noexcept {
+    std::size_t n = 0;
+    value = 0;
+
+    while (n < data.size() && n < max_len && data[n] >= '0' && data[n] <= '9') {
+        value = value * 10 + (data[n] - '0');
+        n++;
+    }
+
+    data.remove_prefix(n);
+    return n >= min_len;
+}
+
+static bool parse_sep(std::string_view &data, char c) noexcept {
+    if (data.empty() || data.front() != c)
+        return false;
+
+    data.remove_prefix(1);
+    return true;
+}
+
+static bool parse_hms(std::string_view &data, std::size_t hour_len,
+                      int &hour, int &minute, int &second,
+                      int &microsecond) noexcept
+{
+    if (!parse_digits(data, 2, hour_len, hour) || !parse_sep(data, ':') ||
+        !parse_digits(data, 2, 2, minute) || !parse_sep(data, ':') ||
+        !parse_digits(data, 2, 2, second))
+        return false;
+
+    microsecond = 0;
+    if (parse_sep(data, '.')) {
+        std::size_t len = data.size();
+
+        if (!parse_digits(data, 1, 6, microsecond))
+            return false;
+
+        for (len -= data.size(); len < 6; len++)
+            microsecond *= 10;
+    }
+
+    return minute < 60 && second < 60;
+}
+
+std::errc mysql_parse_datetime(std::string_view data, MySQLDateTime &value) noexcept {
+    MySQLDateTime v;
+
+    if (!parse_digits(data, 4, 4, v.year) || !parse_sep(data, '-') ||
+        !parse_digits(data, 2, 2, v.month) || !parse_sep(data, '-') ||
+        !parse_digits(data, 2, 2, v.day))
+        return std::errc::invalid_argument;
+
+    if (parse_sep(data, ' ') &&
+        !parse_hms(data, 2, v.hour, v.minute, v.second, v.microsecond))
+        return std::errc::invalid_argument;
+
+    // Zero dates such as 0000-00-00 are allowed by MySQL
+    if (!data.empty() || v.month > 12 || v.day > 31 || v.hour > 23)
+        return std::errc::invalid_argument;
+
+    value = v;
+    return std::errc();
+}
+
+std::errc mysql_parse_time(std::string_view data, MySQLTime &value) noexcept {
+    MySQLTime v;
+
+    v.negative = parse_sep(data, '-');
+    if (!parse_hms(data, 3, v.hour, v.minute, v.second, v.microsecond) ||
+        !data.empty())
+        return std::errc::invalid_argument;
+
+    value = v;
+    return std::errc();
+}
+
 void MySQLFieldView::reset(const char *buf, mysql_field_t *field) {
     name        = std::string_view(buf + field->name_offset, field->name_length);
     org_name    = std::string_view(buf + field->org_name_offset, field->org_name_length);
@@ -171,9 +509,16 @@ bool MySQLResultSetView::get_fields(std::vector<MySQLFieldView> &fields) const {
     if (!is_result_set())
         return false;
 
-    int field_count = get_field_count();
     fields.clear();
-    fields.reserve(field_count);
+    fields.reserve(get_field_count());
+    return append_fields(fields);
+}
+
+bool MySQLResultSetView::append_fields(std::vector<MySQLFieldView> &fields) const {
+    if (!is_result_set())
+        return false;
+
+    int field_count = get_field_count();
 
     for (int i = 0; i < field_count; i++) {
         fields.emplace_back(buf, result_set->fields[i]);
@@ -216,6 +561,107 @@ bool MySQLResultSetView::next_row(std::vector<MySQLCellView> &cells) {
     return true;
 }
 
+static inline unsigned char ascii_lower(unsigned char c) noexcept {
+    return (c >= 'A' && c <= 'Z') ? (c | 0x20) : c;
+}
+
+static uint64_t field_hash(std::string_view name) noexcept {
+    uint64_t h = 14695981039346656037ULL;
+
+    for (unsigned char c : name) {
+        h ^= ascii_lower(c);
+        h *= 1099511628211ULL;
+    }
+
+    return h;
+}
+
+static bool field_equal(std::string_view a, std::string_view b) noexcept {
+    if (a.size() != b.size())
+        return false;
+
+    for (std::size_t i = 0; i < a.size(); i++) {
+        if (ascii_lower(a[i]) != ascii_lower(b[i]))
+            return false;
+    }
+
+    return true;
+}
+
+void MySQLResultTable::reset(const MySQLResponse &resp) {
+    clear();
+
+    for (MySQLResultSetView view : MySQLResultSetCursor(resp)) {
+        Entry e{view, fields.size(), 0, slots.size(), 0};
+
+        if (view.is_result_set()) {
+            std::size_t count = view.get_field_count();
+            std::size_t cap = 4;
+
+            view.append_fields(fields);
+            e.field_count = fields.size() - e.field_begin;
+
+            while (cap < count * 2)
+                cap <<= 1;
+
+            e.slot_count = cap;
+            slots.resize(e.slot_begin + cap, 0);
+
+            for (std::size_t i = 0; i < e.field_count; i++) {
+                const MySQLFieldView &f = fields[e.field_begin + i];
+                uint64_t hash = field_hash(f.get_name_view());
+                std::size_t pos = hash & (cap - 1);
+                bool dup = false;
+
+                hashes.push_back(hash);
+
+                while (slots[e.slot_begin + pos] != 0) {
+                    std::size_t j = slots[e.slot_begin + pos] - 1;
+                    const MySQLFieldView &g = fields[e.field_begin + j];
+
+                    if (hashes[e.field_begin + j] == hash &&
+                        field_equal(g.get_name_view(), f.get_name_view()))
+                    {
+                        dup = true;
+                        break;
+                    }
+
+                    pos = (pos + 1) & (cap - 1);
+                }
+
+                if (!dup)
+                    slots[e.slot_begin + pos] = static_cast<uint32_t>(i + 1);
+            }
+        }
+
+        sets.push_back(e);
+    }
+}
+
+int MySQLResultTable::find_field(std::size_t i,
+                                 std::string_view name) const noexcept {
+    const Entry &e = sets[i];
+
+    if (e.slot_count == 0)
+        return -1;
+
+    std::size_t cap = e.slot_count;
+    uint64_t hash = field_hash(name);
+    std::size_t pos = hash & (cap - 1);
+
+    while (slots[e.slot_begin + pos] != 0) {
+        std::size_t j = slots[e.slot_begin + pos] - 1;
+
+        if (hashes[e.field_begin + j] == hash &&
+            field_equal(fields[e.field_begin + j].get_name_view(), name))
+            return static_cast<int>(j);
+
+        pos = (pos + 1) & (cap - 1);
+    }
+
+    return -1;
+}
+
 void MySQLResultSetView::rewind() noexcept {
     if (is_result_set()) {
         const auto *p = reinterpret_cast<const unsigned char *>(buf);
@@ -19,6 +19,7 @@
 #include <chrono>
 #include <cmath>
 #include <cassert>
+#include <limits>
 
 #include "coke/qps_pool.h"
 
@@ -29,62 +30,64 @@ static int64_t __get_current_nano() noexcept {
     return std::chrono::duration_cast<std::chrono::nanoseconds>(now).count();
 }
 
-QpsPool::QpsPool(long query, long seconds) {
-    last_nano = 0;
-    last_sub = 0;
+// As if the last license was acquired long before the pool is created, so
+// the first get is immediate whatever the interval and count are.
+static constexpr int64_t INITIAL_LAST_SUB =
+    std::numeric_limits<int64_t>::min() / 2;
 
+QpsPool::QpsPool(long query, long seconds)
+    : base_nano(__get_current_nano()), interval_sub(0),
+      last_sub(INITIAL_LAST_SUB)
+{
     reset_qps(query, seconds);
 }
 
 void QpsPool::reset_qps(long query, long seconds) {
     assert(query >= 0 && seconds >= 1);
 
-    std::lock_guard<std::mutex> lg(mtx);
+    NanoType interval = 0;
 
-    if (query == 0) {
-        interval_nano = 0;
-        interval_sub = 0;
-    }
-    else {
+    if (query != 0) {
         double d = 1e9 * seconds / query;
-        double f = std::floor(d);
-        d -= f;
-
-        interval_nano = NanoType(f);
-        interval_sub = NanoType(d * SUB_MASK);
+        interval = NanoType(std::floor(d * (1 << SUB_SHIFT)));
     }
+
+    interval_sub.store(interval, std::memory_order_relaxed);
+}
+
+QpsPool::NanoType QpsPool::current_sub() const noexcept {
+    return (__get_current_nano() - base_nano) << SUB_SHIFT;
 }
 
 QpsPool::AwaiterType
 QpsPool::get_if(unsigned count, NanoSec nsec) {
-    std::lock_guard<std::mutex> lg(mtx);
-    NanoType current, next_nano, next_sub;
-
-    next_nano = last_nano + interval_nano * count;
-    next_sub = last_sub + interval_sub * count;
-
-    next_nano += next_sub / SUB_MASK;
-    next_sub %= SUB_MASK;
-
-    current = __get_current_nano();
-
-    auto nano = NanoSec(next_nano - current);
-    if (nano.count() > 0) {
-        if (nano < nsec) {
-            last_nano = next_nano;
-            last_sub = next_sub;
-            return AwaiterType(nano);
+    NanoType interval = interval_sub.load(std::memory_order_relaxed);
+    NanoType current = current_sub();
+    NanoType last = last_sub.load(std::memory_order_relaxed);
+    NanoType next;
+
+    while (true) {
+        next = last + interval * count;
+
+        auto nano = NanoSec((next - current) >> SUB_SHIFT);
+        if (nano.count() > 0) {
+            if (nano >= nsec) {
+                return AwaiterType(SleepAwaiter::ImmediateTag{},
+                                   SLEEP_CANCELED);
+            }
+
+            if (last_sub.compare_exchange_weak(last, next,
+                                               std::memory_order_relaxed))
+                return AwaiterType(nano);
         }
         else {
-            return AwaiterType(SleepAwaiter::ImmediateTag{}, SLEEP_CANCELED);
+            if (last_sub.compare_exchange_weak(last, current,
+                                               std::memory_order_relaxed)) {
+                // SLEEP_SUCCESS
+                return AwaiterType();
+            }
         }
     }
-    else {
-        last_nano = current;
-        last_sub = 0;
-        // SLEEP_SUCCESS
-        return AwaiterType();
-    }
 }
 
 } // namespace coke
@@ -16,35 +16,25 @@
  * Authors: kedixa (https://github.com/kedixa)
 */
 
-#include <mutex>
+#include <atomic>
 #include <chrono>
 
 #include "coke/detail/random.h"
 
 namespace coke::detail {
 
-class LockedRandomU64 {
-    static auto time_seed() {
-        auto now = std::chrono::system_clock::now().time_since_epoch();
-        return (std::mt19937_64::result_type)now.count();
-    }
-
-public:
-    LockedRandomU64() : mt64(time_seed()) { }
-
-    uint64_t operator()() {
-        std::lock_guard<std::mutex> lg(mtx);
-        return mt64();
-    }
-
-private:
-    std::mutex mtx;
-    std::mt19937_64 mt64;
-};
+static uint64_t time_seed() {
+    auto now = std::chrono::system_clock::now().time_since_epoch();
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(now)
+        .count();
+}
 
 uint64_t rand_seed() {
-    static LockedRandomU64 r;
-    return r();
+    static std::atomic<uint64_t> state{time_seed()};
+
+    uint64_t x = state.fetch_add(0x9E3779B97F4A7C15ULL,
+                                 std::memory_order_relaxed);
+    return splitmix64(x);
 }
 
 } // namespace coke::detail
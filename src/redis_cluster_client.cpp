@@ -0,0 +1,491 @@
+/**
+ * Copyright 2024 Coke Project (https://github.com/kedixa/coke)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Authors: kedixa (https://github.com/kedixa)
+*/
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdlib>
+#include <mutex>
+
+#include "coke/redis/redis_cluster_client.h"
+#include "coke/sleep.h"
+#include "coke/wait.h"
+
+namespace coke {
+
+static constexpr std::array<uint16_t, 256> make_crc16_table() {
+    std::array<uint16_t, 256> table{};
+
+    for (unsigned i = 0; i < 256; i++) {
+        uint16_t crc = static_cast<uint16_t>(i << 8);
+
+        for (int j = 0; j < 8; j++)
+            crc = (crc & 0x8000) ? uint16_t((crc << 1) ^ 0x1021)
+                                 : uint16_t(crc << 1);
+
+        table[i] = crc;
+    }
+
+    return table;
+}
+
+// CRC16-XMODEM, which is used by Redis Cluster
+static constexpr std::array<uint16_t, 256> crc16_table = make_crc16_table();
+
+static uint16_t crc16(std::string_view s) noexcept {
+    uint16_t crc = 0;
+
+    for (unsigned char c : s)
+        crc = uint16_t(crc << 8) ^ crc16_table[((crc >> 8) ^ c) & 0xFF];
+
+    return crc;
+}
+
+uint16_t redis_key_slot(std::string_view key) noexcept {
+    std::size_t start = key.find('{');
+
+    if (start != std::string_view::npos) {
+        std::size_t end = key.find('}', start + 1);
+
+        if (end != std::string_view::npos && end != start + 1)
+            key = key.substr(start + 1, end - start - 1);
+    }
+
+    return crc16(key) & (REDIS_CLUSTER_SLOTS - 1);
+}
+
+enum {
+    REDIRECT_NONE,
+    REDIRECT_MOVED,
+    REDIRECT_ASK,
+    REDIRECT_TRYAGAIN,
+};
+
+struct Redirect {
+    uint16_t slot{0};
+    std::string address;
+};
+
+static int parse_redirect(const RedisValue &value, Redirect &rd) {
+    if (!value.is_error())
+        return REDIRECT_NONE;
+
+    std::string_view err(*value.string_view());
+    int type;
+
+    if (err.starts_with("MOVED "))
+        type = REDIRECT_MOVED;
+    else if (err.starts_with("ASK "))
+        type = REDIRECT_ASK;
+    else if (err.starts_with("TRYAGAIN"))
+        return REDIRECT_TRYAGAIN;
+    else
+        return REDIRECT_NONE;
+
+    // MOVED <slot> <host>:<port>
+    std::size_t pos1 = err.find(' ');
+    std::size_t pos2 = err.find(' ', pos1 + 1);
+    if (pos2 == std::string_view::npos || pos2 + 1 >= err.size())
+        return REDIRECT_NONE;
+
+    unsigned long slot = 0;
+    for (std::size_t i = pos1 + 1; i < pos2; i++) {
+        if (err[i] < '0' || err[i] > '9')
+            return REDIRECT_NONE;
+        slot = slot * 10 + (err[i] - '0');
+    }
+
+    if (slot >= REDIS_CLUSTER_SLOTS)
+        return REDIRECT_NONE;
+
+    rd.slot = static_cast<uint16_t>(slot);
+    rd.address.assign(err.substr(pos2 + 1));
+    return type;
+}
+
+static bool is_redirect(const RedisValue &value) {
+    Redirect rd;
+    return parse_redirect(value, rd) != REDIRECT_NONE;
+}
+
+static void split_address(const std::string &address, std::string &host,
+                          int &port) {
+    std::size_t pos = address.rfind(':');
+
+    if (pos == std::string::npos || address.back() == ']') {
+        host = address;
+        port = 6379;
+    }
+    else {
+        host = address.substr(0, pos);
+        port = std::atoi(address.c_str() + pos + 1);
+    }
+}
+
+using SlotRange = std::pair<std::pair<uint16_t, uint16_t>, std::string>;
+
+/**
+ * Parse the reply of CLUSTER SLOTS, each entry is
+ * [start, end, [host, port, id, ...], replicas...].
+*/
+static bool parse_cluster_slots(const RedisValue &value,
+                                const std::string &from,
+                                std::vector<SlotRange> &ranges) {
+    if (!value.is_array())
+        return false;
+
+    for (std::size_t i = 0; i < value.arr_size(); i++) {
+        const RedisValue &ent = value.arr_at(i);
+        if (!ent.is_array() || ent.arr_size() < 3)
+            return false;
+
+        const RedisValue &start = ent.arr_at(0);
+        const RedisValue &end = ent.arr_at(1);
+        const RedisValue &master = ent.arr_at(2);
+
+        if (!start.is_int() || !end.is_int() || !master.is_array() ||
+            master.arr_size() < 2 || !master.arr_at(0).is_string() ||
+            !master.arr_at(1).is_int())
+            return false;
+
+        int64_t s = start.int_value(), e = end.int_value();
+        if (s < 0 || s > e || e >= REDIS_CLUSTER_SLOTS)
+            return false;
+
+        std::string host = master.arr_at(0).string_value();
+        std::string port = std::to_string(master.arr_at(1).int_value());
+
+        // An empty host means the same host as the node we asked
+        if (host.empty() || host == "?") {
+            int unused;
+            split_address(from, host, unused);
+        }
+        else if (host.find(':') != std::string::npos)
+            host = "[" + host + "]";
+
+        ranges.emplace_back(std::make_pair(uint16_t(s), uint16_t(e)),
+                            host + ":" + port);
+    }
+
+    return true;
+}
+
+RedisClusterClient::RedisClusterClient(const RedisClusterParams &params)
+    : params(params), slots(REDIS_CLUSTER_SLOTS, 0)
+{ }
+
+uint32_t RedisClusterClient::add_node_locked(const std::string &address) {
+    auto it = node_index.find(address);
+    if (it != node_index.end())
+        return it->second;
+
+    RedisClientParams p;
+    p.retry_max = params.retry_max;
+    p.send_timeout = params.send_timeout;
+    p.receive_timeout = params.receive_timeout;
+    p.keep_alive_timeout = params.keep_alive_timeout;
+    p.use_ssl = params.use_ssl;
+    p.username = params.username;
+    p.password = params.password;
+    split_address(address, p.host, p.port);
+
+    uint32_t idx = static_cast<uint32_t>(nodes.size());
+    nodes.emplace_back(std::make_unique<RedisClient>(p));
+    node_addrs.push_back(address);
+    node_index.emplace(address, idx);
+    return idx;
+}
+
+RedisClient *RedisClusterClient::get_node(const std::string &address) {
+    {
+        std::shared_lock<std::shared_mutex> lk(slot_mtx);
+        auto it = node_index.find(address);
+        if (it != node_index.end())
+            return nodes[it->second].get();
+    }
+
+    std::unique_lock<std::shared_mutex> lk(slot_mtx);
+    return nodes[add_node_locked(address)].get();
+}
+
+RedisClient *
+RedisClusterClient::find_slot_node(uint16_t slot, uint64_t *version) const {
+    std::shared_lock<std::shared_mutex> lk(slot_mtx);
+    uint32_t idx = slots[slot];
+
+    *version = slot_version;
+    return idx ? nodes[idx - 1].get() : nullptr;
+}
+
+void RedisClusterClient::update_slot(uint16_t slot,
+                                     const std::string &address) {
+    std::unique_lock<std::shared_mutex> lk(slot_mtx);
+    slots[slot] = add_node_locked(address) + 1;
+    ++slot_version;
+}
+
+std::string RedisClusterClient::get_slot_address(uint16_t slot) const {
+    std::shared_lock<std::shared_mutex> lk(slot_mtx);
+    uint32_t idx = (slot < REDIS_CLUSTER_SLOTS) ? slots[slot] : 0;
+
+    return idx ? node_addrs[idx - 1] : std::string();
+}
+
+Task<int> RedisClusterClient::refresh_slots() {
+    uint64_t version;
+
+    {
+        std::shared_lock<std::shared_mutex> lk(slot_mtx);
+        version = slot_version;
+    }
+
+    return refresh_slots(version);
+}
+
+Task<int> RedisClusterClient::refresh_slots(uint64_t version) {
+    UniqueLock<Mutex> lock(refresh_mtx);
+    std::vector<std::string> addrs;
+    int error = EHOSTUNREACH;
+
+    co_await lock.lock();
+
+    {
+        std::shared_lock<std::shared_mutex> lk(slot_mtx);
+
+        // The slot map has been changed while waiting for the lock
+        if (slot_version != version)
+            co_return 0;
+
+        addrs = node_addrs;
+    }
+
+    for (const std::string &seed : params.seeds) {
+        if (std::find(addrs.begin(), addrs.end(), seed) == addrs.end())
+            addrs.push_back(seed);
+    }
+
+    const std::string command("CLUSTER");
+    const std::vector<std::string> args{"SLOTS"};
+
+    for (const std::string &addr : addrs) {
+        RedisClient *cli = get_node(addr);
+        RedisResult res = co_await cli->request(command, args);
+        std::vector<SlotRange> ranges;
+        RedisValue value;
+
+        if (res.state != STATE_SUCCESS) {
+            if (res.state == STATE_SYS_ERROR)
+                error = res.error;
+            continue;
+        }
+
+        res.resp.get_result(value);
+        if (!parse_cluster_slots(value, addr, ranges)) {
+            error = EBADMSG;
+            continue;
+        }
+
+        std::unique_lock<std::shared_mutex> lk(slot_mtx);
+        std::fill(slots.begin(), slots.end(), 0);
+
+        for (const SlotRange &range : ranges) {
+            uint32_t idx = add_node_locked(range.second) + 1;
+
+            for (uint32_t s = range.first.first; s <= range.first.second; s++)
+                slots[s] = idx;
+        }
+
+        ++slot_version;
+        co_return 0;
+    }
+
+    co_return -error;
+}
+
+Task<RedisClusterResult>
+RedisClusterClient::request(const std::string &command,
+                            const std::vector<std::string> &params) {
+    int max_redirects = std::max(this->params.max_redirects, 0);
+    std::string_view key;
+    std::string ask_addr;
+    RedisClusterResult result;
+    uint64_t version = 0;
+    Redirect rd;
+
+    if (!params.empty())
+        key = params[0];
+
+    uint16_t slot = redis_key_slot(key);
+
+    for (int i = 0; i <= max_redirects; i++) {
+        RedisClient *cli;
+
+        if (!ask_addr.empty()) {
+            RedisPipeline pipe;
+            pipe.add("ASKING", {}).add(command, params);
+
+            cli = get_node(ask_addr);
+            ask_addr.clear();
+
+            RedisPipelineResult res = co_await cli->pipeline(std::move(pipe));
+            result.state = res.state;
+            result.error = res.error;
+
+            if (res.state == STATE_SUCCESS)
+                result.value = std::move(res.values.back());
+        }
+        else {
+            cli = find_slot_node(slot, &version);
+            if (!cli) {
+                int ret = co_await refresh_slots(version);
+
+                cli = find_slot_node(slot, &version);
+                if (!cli) {
+                    result.state = STATE_SYS_ERROR;
+                    result.error = (ret < 0) ? -ret : EHOSTUNREACH;
+                    co_return result;
+                }
+            }
+
+            RedisResult res = co_await cli->request(command, params);
+            result.state = res.state;
+            result.error = res.error;
+
+            if (res.state == STATE_SUCCESS)
+                res.resp.get_result(result.value);
+        }
+
+        if (result.state != STATE_SUCCESS)
+            break;
+
+        switch (parse_redirect(result.value, rd)) {
+        case REDIRECT_MOVED:
+            // The slot map is changed, refresh it for the other slots
+            co_await refresh_slots(version);
+            update_slot(rd.slot, rd.address);
+            break;
+
+        case REDIRECT_ASK:
+            ask_addr = std::move(rd.address);
+            break;
+
+        case REDIRECT_TRYAGAIN:
+            co_await sleep(std::chrono::milliseconds(10));
+            break;
+
+        default:
+            co_return result;
+        }
+    }
+
+    co_return result;
+}
+
+Task<std::vector<RedisClusterResult>>
+RedisClusterClient::pipeline(const std::vector<RedisCommand> &cmds) {
+    struct Group {
+        RedisClient *cli;
+        RedisPipeline pipe;
+        std::vector<std::size_t> index;
+    };
+
+    std::vector<RedisClusterResult> results(cmds.size());
+    std::vector<Group> groups;
+    std::map<RedisClient *, std::size_t> group_index;
+    std::vector<std::size_t> singles;
+    bool refreshed = false;
+    uint64_t version;
+
+    for (std::size_t i = 0; i < cmds.size(); i++) {
+        const RedisCommand &cmd = cmds[i];
+        std::string_view key;
+
+        if (!cmd.params.empty())
+            key = cmd.params[0];
+
+        uint16_t slot = redis_key_slot(key);
+        RedisClient *cli = find_slot_node(slot, &version);
+
+        if (!cli && !refreshed) {
+            co_await refresh_slots(version);
+            refreshed = true;
+            cli = find_slot_node(slot, &version);
+        }
+
+        // Let request report the error
+        if (!cli) {
+            singles.push_back(i);
+            continue;
+        }
+
+        auto [it, inserted] = group_index.try_emplace(cli, groups.size());
+        if (inserted)
+            groups.emplace_back().cli = cli;
+
+        Group &g = groups[it->second];
+        g.pipe.add(cmd.command, cmd.params);
+        g.index.push_back(i);
+    }
+
+    if (!groups.empty()) {
+        std::vector<Task<RedisPipelineResult>> tasks;
+        tasks.reserve(groups.size());
+
+        for (Group &g : groups)
+            tasks.emplace_back(g.cli->pipeline(std::move(g.pipe)));
+
+        std::vector<RedisPipelineResult> rets;
+        rets = co_await async_wait(std::move(tasks));
+
+        for (std::size_t i = 0; i < groups.size(); i++) {
+            const std::vector<std::size_t> &index = groups[i].index;
+            RedisPipelineResult &ret = rets[i];
+
+            for (std::size_t j = 0; j < index.size(); j++) {
+                RedisClusterResult &r = results[index[j]];
+                r.state = ret.state;
+                r.error = ret.error;
+
+                if (ret.state != STATE_SUCCESS)
+                    continue;
+
+                r.value = std::move(ret.values[j]);
+                if (is_redirect(r.value))
+                    singles.push_back(index[j]);
+            }
+        }
+    }
+
+    if (!singles.empty()) {
+        std::vector<Task<RedisClusterResult>> tasks;
+        tasks.reserve(singles.size());
+
+        for (std::size_t i : singles)
+            tasks.emplace_back(request(cmds[i].command, cmds[i].params));
+
+        std::vector<RedisClusterResult> rets;
+        rets = co_await async_wait(std::move(tasks));
+
+        for (std::size_t i = 0; i < singles.size(); i++)
+            results[singles[i]] = std::move(rets[i]);
+    }
+
+    co_return results;
+}
+
+} // namespace coke
@@ -16,20 +16,51 @@
  * Authors: kedixa (https://github.com/kedixa)
 */
 
+#include <algorithm>
 #include <string>
 #include <cctype>
+#include <cerrno>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <sys/uio.h>
 
 #include "coke/redis/redis_client.h"
+#include "coke/redis/redis_server.h"
 #include "coke/redis/redis_utils.h"
+#include "coke/net/upstream.h"
+#include "coke/future.h"
+#include "coke/sleep.h"
 
 #include "workflow/WFTaskFactory.h"
 #include "workflow/StringUtil.h"
 
 namespace coke {
 
-RedisClient::RedisClient(const RedisClientParams &p)
-    : params(p)
-{
+namespace detail {
+
+struct RedisBatch {
+    RedisPipeline pipe;
+    std::vector<Promise<RedisBatchResult>> promises;
+
+    // Protected by RedisBatcher::mtx. `full` is set when the batch is closed
+    // by the command that fills it, `sleeping` while the owner may still be
+    // waiting on the batch's address, which also means the batch is alive.
+    bool full{false};
+    bool sleeping{false};
+};
+
+struct RedisBatcher {
+    std::mutex mtx;
+
+    // The batch that is open for new commands, owned by its first caller.
+    RedisBatch *current{nullptr};
+};
+
+} // namespace detail
+
+void detail::make_redis_url(const RedisClientParams &params, std::string &url,
+                            std::string &prefix, std::string &suffix) {
     std::string username, password, host;
     username = StringUtil::url_encode_component(params.username);
     password = StringUtil::url_encode_component(params.password);
@@ -49,13 +80,20 @@ RedisClient::RedisClient(const RedisClientParams &p)
     else
         host = params.host;
 
+    prefix = url;
     url.append(host);
 
     if (params.port != 0)
         url.append(":").append(std::to_string(params.port));
 
-    url.append("/").append(std::to_string(params.db));
+    suffix.assign("/").append(std::to_string(params.db));
+    url.append(suffix);
+}
 
+RedisClient::RedisClient(const RedisClientParams &p)
+    : params(p), batcher(std::make_shared<detail::RedisBatcher>())
+{
+    detail::make_redis_url(params, url, url_prefix, url_suffix);
     URIParser::parse(url, uri);
 }
 
@@ -66,13 +104,36 @@ RedisClient::request(const std::string &command,
     RedisRequest req;
     req.set_request(command, params);
 
-    return create_task(&req);
+    // The first argument is the key of most commands
+    std::string_view key;
+    if (!params.empty())
+        key = params[0];
+
+    return create_task(&req, key);
 }
 
 RedisClient::AwaiterType RedisClient::create_task(ReqType *req) noexcept {
+    return create_task(req, std::string_view());
+}
+
+static void redis_upstream_hook(WFRedisTask *task) {
+    detail::upstream_finish(task->user_data, task->get_state());
+}
+
+RedisClient::AwaiterType
+RedisClient::create_task(ReqType *req, std::string_view key) noexcept {
     WFRedisTask *task;
+    detail::UpstreamSelection sel;
+
+    if (detail::upstream_select(params.host, key, sel)) {
+        std::string replica_url = url_prefix + sel.address + url_suffix;
+        task = WFTaskFactory::create_redis_task(replica_url, params.retry_max,
+                                                nullptr);
+        task->user_data = sel.server;
+    }
+    else
+        task = WFTaskFactory::create_redis_task(uri, params.retry_max, nullptr);
 
-    task = WFTaskFactory::create_redis_task(uri, params.retry_max, nullptr);
     if (req)
         *(task->get_req()) = std::move(*req);
 
@@ -80,10 +141,749 @@ RedisClient::AwaiterType RedisClient::create_task(ReqType *req) noexcept {
     task->set_receive_timeout(params.receive_timeout);
     task->set_keep_alive(params.keep_alive_timeout);
 
+    if (sel.server)
+        return AwaiterType(task, redis_upstream_hook);
+
     return AwaiterType(task);
 }
 
 
+// value view
+
+static int read_line(const char *p, const char *end, const char **eol) {
+    const char *q = static_cast<const char *>(std::memchr(p, '\n', end - p));
+
+    if (!q)
+        return 0;
+
+    if (q == p || q[-1] != '\r')
+        return -1;
+
+    *eol = q - 1;
+    return 1;
+}
+
+static bool parse_int(const char *b, const char *e, int64_t &value) {
+    bool neg = false;
+    uint64_t v = 0;
+
+    if (b < e && *b == '-') {
+        neg = true;
+        ++b;
+    }
+
+    if (b == e || e - b > 19)
+        return false;
+
+    for (; b < e; ++b) {
+        if (*b < '0' || *b > '9')
+            return false;
+        v = v * 10 + (*b - '0');
+    }
+
+    if (v > uint64_t(INT64_MAX) + (neg ? 1 : 0))
+        return false;
+
+    value = neg ? int64_t(0 - v) : int64_t(v);
+    return true;
+}
+
+struct RedisViewParser {
+    static constexpr int MAX_DEPTH = 512;
+
+    const char *end;
+
+    // When more data is needed, the min size of buffer that may make progress,
+    // nullptr if unknown.
+    const char *need{nullptr};
+    int depth{0};
+
+    int parse(const char *&p, RedisValueView &v);
+};
+
+int RedisViewParser::parse(const char *&p, RedisValueView &v) {
+    const char *eol;
+    int64_t n;
+    int ret;
+
+    if (p >= end)
+        return 0;
+
+    ret = read_line(p + 1, end, &eol);
+    if (ret <= 0)
+        return ret;
+
+    v.ptr = nullptr;
+    v.len = 0;
+    v.num = 0;
+
+    switch (*p) {
+    case '+':
+    case '-':
+        v.type = (*p == '+') ? REDIS_REPLY_TYPE_STATUS : REDIS_REPLY_TYPE_ERROR;
+        v.ptr = p + 1;
+        v.len = eol - (p + 1);
+        p = eol + 2;
+        return 1;
+
+    case ':':
+        if (!parse_int(p + 1, eol, v.num))
+            return -1;
+
+        v.type = REDIS_REPLY_TYPE_INTEGER;
+        p = eol + 2;
+        return 1;
+
+    case '$':
+        if (!parse_int(p + 1, eol, n) || n < -1)
+            return -1;
+
+        if (n == -1) {
+            v.type = REDIS_REPLY_TYPE_NIL;
+            p = eol + 2;
+            return 1;
+        }
+
+        p = eol + 2;
+        if (end - p < n + 2) {
+            need = p + n + 2;
+            return 0;
+        }
+
+        if (p[n] != '\r' || p[n + 1] != '\n')
+            return -1;
+
+        v.type = REDIS_REPLY_TYPE_STRING;
+        v.ptr = p;
+        v.len = n;
+        p += n + 2;
+        return 1;
+
+    case '*':
+        if (!parse_int(p + 1, eol, n) || n < -1 || depth >= MAX_DEPTH)
+            return -1;
+
+        if (n == -1) {
+            v.type = REDIS_REPLY_TYPE_NIL;
+            p = eol + 2;
+            return 1;
+        }
+
+        {
+            const char *q = eol + 2;
+            RedisValueView elem;
+
+            ++depth;
+            for (int64_t i = 0; i < n; i++) {
+                ret = parse(q, elem);
+                if (ret <= 0) {
+                    --depth;
+                    return ret;
+                }
+            }
+            --depth;
+
+            v.type = REDIS_REPLY_TYPE_ARRAY;
+            v.ptr = eol + 2;
+            v.len = q - v.ptr;
+            v.num = n;
+            p = q;
+        }
+        return 1;
+
+    default:
+        return -1;
+    }
+}
+
+int RedisValueView::parse(const char *buf, std::size_t size,
+                          RedisValueView &view, std::size_t *used) noexcept {
+    RedisViewParser parser{buf + size};
+    const char *p = buf;
+    int ret = parser.parse(p, view);
+
+    if (ret > 0)
+        *used = p - buf;
+
+    return ret;
+}
+
+RedisValueView RedisValueView::arr_at(std::size_t pos) const {
+    RedisViewParser parser{ptr + len};
+    RedisValueView elem;
+    const char *p = ptr;
+
+    for (std::size_t i = 0; i <= pos && i < arr_size(); i++) {
+        if (parser.parse(p, elem) <= 0)
+            return RedisValueView();
+    }
+
+    return pos < arr_size() ? elem : RedisValueView();
+}
+
+std::vector<RedisValueView> RedisValueView::arr_values() const {
+    RedisViewParser parser{ptr + len};
+    std::vector<RedisValueView> values(arr_size());
+    const char *p = ptr;
+
+    for (RedisValueView &elem : values)
+        parser.parse(p, elem);
+
+    return values;
+}
+
+RedisValue RedisValueView::to_value() const {
+    RedisValue value;
+
+    switch (type) {
+    case REDIS_REPLY_TYPE_STRING:
+        value.set_string(ptr, len);
+        break;
+    case REDIS_REPLY_TYPE_STATUS:
+        value.set_status(ptr, len);
+        break;
+    case REDIS_REPLY_TYPE_ERROR:
+        value.set_error(ptr, len);
+        break;
+    case REDIS_REPLY_TYPE_INTEGER:
+        value.set_int(num);
+        break;
+    case REDIS_REPLY_TYPE_ARRAY: {
+        std::vector<RedisValueView> elems = arr_values();
+
+        value.set_array(elems.size());
+        for (std::size_t i = 0; i < elems.size(); i++)
+            value[i] = elems[i].to_value();
+        break;
+    }
+    default:
+        value.set_nil();
+        break;
+    }
+
+    return value;
+}
+
+
+// pipeline
+
+static void append_bulk(std::string &buf, const void *data, std::size_t size) {
+    buf.append("$").append(std::to_string(size)).append("\r\n");
+    buf.append(static_cast<const char *>(data), size).append("\r\n");
+}
+
+static void append_command(std::string &buf, const std::string &command,
+                           const std::vector<std::string> &params) {
+    buf.append("*").append(std::to_string(params.size() + 1)).append("\r\n");
+    append_bulk(buf, command.data(), command.size());
+
+    for (const std::string &p : params)
+        append_bulk(buf, p.data(), p.size());
+}
+
+RedisPipeline &
+RedisPipeline::add(const std::string &command,
+                   const std::vector<std::string> &params) {
+    if (count == 0 && !params.empty())
+        key = params[0];
+
+    append_command(buf, command, params);
+    ++count;
+    return *this;
+}
+
+RedisPipeline &
+RedisPipeline::add_args(std::span<const std::string_view> args) {
+    if (count == 0 && args.size() > 1)
+        key = args[1];
+
+    buf.append("*").append(std::to_string(args.size())).append("\r\n");
+    for (std::string_view arg : args)
+        append_bulk(buf, arg.data(), arg.size());
+
+    ++count;
+    return *this;
+}
+
+RedisPipeline &
+RedisPipeline::add_args(std::span<const struct iovec> args) {
+    if (count == 0 && args.size() > 1)
+        key.assign(static_cast<const char *>(args[1].iov_base), args[1].iov_len);
+
+    buf.append("*").append(std::to_string(args.size())).append("\r\n");
+    for (const struct iovec &arg : args)
+        append_bulk(buf, arg.iov_base, arg.iov_len);
+
+    ++count;
+    return *this;
+}
+
+namespace detail {
+
+/**
+ * The request of a pipeline task, the AUTH and SELECT commands are kept in
+ * `prefix` so that the user's commands are not copied again.
+*/
+class RedisPipelineRequest : public protocol::ProtocolMessage {
+public:
+    std::string prefix;
+    std::string body;
+
+protected:
+    int encode(struct iovec vectors[], int max) override {
+        int n = 0;
+
+        if (!prefix.empty()) {
+            vectors[n].iov_base = prefix.data();
+            vectors[n].iov_len = prefix.size();
+            ++n;
+        }
+
+        if (n < max && !body.empty()) {
+            vectors[n].iov_base = body.data();
+            vectors[n].iov_len = body.size();
+            ++n;
+        }
+
+        return n;
+    }
+};
+
+/**
+ * The response of a pipeline task, replies are parsed one by one with the
+ * parser of RedisResponse until `expect` replies are received. In raw mode
+ * the replies are kept in `buffer` as is, and only scanned for their ends.
+*/
+class RedisPipelineResponse : public protocol::ProtocolMessage {
+    /**
+     * The parser of one reply, RedisResponse::append is protected and only
+     * called by the communicator, forward it for the pipeline.
+    */
+    class ReplyParser : public RedisResponse {
+    public:
+        int feed(const void *buf, size_t *size) {
+            return this->append(buf, size);
+        }
+    };
+
+public:
+    std::size_t expect{0};
+    bool raw{false};
+    std::vector<RedisValue> values;
+    std::vector<char> buffer;
+
+protected:
+    int append(const void *buf, size_t *size) override {
+        if (raw)
+            return append_raw(buf, size);
+
+        const char *p = static_cast<const char *>(buf);
+        size_t left = *size;
+        size_t n;
+        int ret;
+
+        while (left > 0 && values.size() < expect) {
+            n = left;
+            ret = cur.feed(p, &n);
+            if (ret < 0)
+                return -1;
+            else if (ret == 0)
+                return 0;
+
+            values.emplace_back();
+            cur.get_result(values.back());
+            cur = ReplyParser();
+
+            p += n;
+            left -= n;
+        }
+
+        if (values.size() < expect)
+            return 0;
+
+        *size -= left;
+        return 1;
+    }
+
+    int append_raw(const void *buf, size_t *size) {
+        const char *data = static_cast<const char *>(buf);
+        buffer.insert(buffer.end(), data, data + *size);
+
+        // A large bulk string arrives in many pieces, don't scan it again
+        // until it is complete.
+        if (buffer.size() < need)
+            return 0;
+
+        while (parsed_cnt < expect) {
+            RedisViewParser parser{buffer.data() + buffer.size()};
+            const char *p = buffer.data() + parsed_size;
+            RedisValueView view;
+            int ret = parser.parse(p, view);
+
+            if (ret < 0) {
+                errno = EBADMSG;
+                return -1;
+            }
+            else if (ret == 0) {
+                need = parser.need ? parser.need - buffer.data() : 0;
+                return 0;
+            }
+
+            parsed_size = p - buffer.data();
+            ++parsed_cnt;
+        }
+
+        // Drop the data after the last reply, if any
+        std::size_t extra = buffer.size() - parsed_size;
+        buffer.resize(parsed_size);
+        *size -= extra;
+        return 1;
+    }
+
+private:
+    ReplyParser cur;
+    std::size_t parsed_cnt{0};
+    std::size_t parsed_size{0};
+    std::size_t need{0};
+};
+
+struct RedisPipelineState {
+    int state{STATE_UNDEFINED};
+    int error{0};
+
+    // Number of replies of AUTH and SELECT in front of the results
+    std::size_t skip{0};
+    std::vector<RedisValue> values;
+    std::vector<char> buffer;
+};
+
+} // namespace detail
+
+using RedisPipelineTask = WFNetworkTask<detail::RedisPipelineRequest,
+                                        detail::RedisPipelineResponse>;
+
+Task<> RedisClient::send_pipeline(RedisPipeline &pipe, bool raw,
+                                  detail::RedisPipelineState &st) {
+    using Factory = WFNetworkTaskFactory<detail::RedisPipelineRequest,
+                                         detail::RedisPipelineResponse>;
+    using PipelineAwaiter = SimpleNetworkAwaiter<detail::RedisPipelineRequest,
+                                                 detail::RedisPipelineResponse>;
+
+    std::string prefix;
+
+    // The connections of pipeline tasks are not shared with WFRedisTask, so
+    // authenticate and select db in every pipeline.
+    if (!params.password.empty()) {
+        if (params.username.empty())
+            append_command(prefix, "AUTH", {params.password});
+        else
+            append_command(prefix, "AUTH", {params.username, params.password});
+        ++st.skip;
+    }
+
+    if (params.db != 0) {
+        append_command(prefix, "SELECT", {std::to_string(params.db)});
+        ++st.skip;
+    }
+
+    TransportType type = params.use_ssl ? TT_TCP_SSL : TT_TCP;
+
+    // The response is reset when Workflow retries, and the number of expected
+    // replies is lost, so retry here with a new task.
+    for (int i = 0; i <= params.retry_max; i++) {
+        RedisPipelineTask *task;
+        detail::UpstreamSelection sel;
+
+        if (detail::upstream_select(params.host, pipe.key, sel)) {
+            std::string replica_url = url_prefix + sel.address + url_suffix;
+            task = Factory::create_client_task(type, replica_url, 0, nullptr);
+            task->user_data = sel.server;
+        }
+        else
+            task = Factory::create_client_task(type, uri, 0, nullptr);
+
+        task->get_req()->prefix = prefix;
+        task->get_req()->body = (i == params.retry_max) ? std::move(pipe.buf)
+                                                        : pipe.buf;
+        task->get_resp()->expect = st.skip + pipe.size();
+        task->get_resp()->raw = raw;
+
+        task->set_send_timeout(params.send_timeout);
+        task->set_receive_timeout(params.receive_timeout);
+        task->set_keep_alive(params.keep_alive_timeout);
+
+        task = co_await PipelineAwaiter(task);
+        if (sel.server)
+            detail::upstream_finish(sel.server, task->get_state());
+
+        st.state = task->get_state();
+        st.error = task->get_error();
+
+        if (st.state == STATE_SUCCESS) {
+            st.values = std::move(task->get_resp()->values);
+            st.buffer = std::move(task->get_resp()->buffer);
+            break;
+        }
+    }
+}
+
+Task<RedisPipelineResult> RedisClient::pipeline(RedisPipeline pipe) {
+    RedisPipelineResult result;
+    detail::RedisPipelineState st;
+
+    if (pipe.empty()) {
+        result.state = STATE_SUCCESS;
+        co_return result;
+    }
+
+    co_await send_pipeline(pipe, false, st);
+    result.state = st.state;
+    result.error = st.error;
+
+    if (st.state == STATE_SUCCESS) {
+        for (std::size_t j = st.skip; j < st.values.size(); j++)
+            result.values.emplace_back(std::move(st.values[j]));
+    }
+
+    co_return result;
+}
+
+Task<RedisViewResult> RedisClient::pipeline_view(RedisPipeline pipe) {
+    RedisViewResult result;
+    detail::RedisPipelineState st;
+
+    if (pipe.empty()) {
+        result.state = STATE_SUCCESS;
+        co_return result;
+    }
+
+    co_await send_pipeline(pipe, true, st);
+    result.state = st.state;
+    result.error = st.error;
+
+    if (st.state == STATE_SUCCESS) {
+        const char *p = st.buffer.data();
+        const char *end = p + st.buffer.size();
+        RedisValueView view;
+
+        // The buffer is checked when received, the views point into it and
+        // stay valid after it is moved
+        for (std::size_t j = 0; j < st.skip + pipe.size(); j++) {
+            RedisViewParser parser{end};
+            parser.parse(p, view);
+
+            if (j >= st.skip)
+                result.values.push_back(view);
+        }
+
+        result.buffer = std::move(st.buffer);
+    }
+
+    co_return result;
+}
+
+Task<RedisViewResult>
+RedisClient::request_view(std::span<const std::string_view> args) {
+    RedisPipeline pipe;
+
+    pipe.add_args(args);
+    return pipeline_view(std::move(pipe));
+}
+
+Task<RedisBatchResult>
+RedisClient::batch_request(const std::string &command,
+                           const std::vector<std::string> &params) {
+    std::unique_ptr<detail::RedisBatch> owned;
+    detail::RedisBatch *batch;
+    Future<RedisBatchResult> fut;
+    std::size_t batch_max = std::max(this->params.batch_max, std::size_t(1));
+    bool full;
+
+    {
+        std::lock_guard<std::mutex> lg(batcher->mtx);
+        batch = batcher->current;
+        if (!batch) {
+            owned.reset(new detail::RedisBatch());
+            batch = owned.get();
+            batcher->current = batch;
+        }
+
+        batch->pipe.add(command, params);
+        fut = batch->promises.emplace_back().get_future();
+
+        full = (batch->pipe.size() >= batch_max);
+        if (full) {
+            batcher->current = nullptr;
+            batch->full = true;
+
+            // Wake up the owner to send the full batch at once. If the owner
+            // has not started to sleep, it sees `full` and does not sleep.
+            if (batch->sleeping)
+                cancel_sleep_by_addr(batch);
+        }
+    }
+
+    if (!owned) {
+        co_await fut.wait();
+        co_return fut.get();
+    }
+
+    if (!full) {
+        int window = this->params.batch_window_us;
+
+        if (window > 0) {
+            SleepAwaiter s;
+
+            {
+                // The timer is in the map once created, so the command that
+                // fills the batch after this can always cancel it.
+                std::lock_guard<std::mutex> lg(batcher->mtx);
+                if (!batch->full) {
+                    s = sleep(batch, std::chrono::microseconds(window));
+                    batch->sleeping = true;
+                }
+            }
+
+            co_await std::move(s);
+        }
+        else
+            co_await yield();
+
+        std::lock_guard<std::mutex> lg(batcher->mtx);
+        batch->sleeping = false;
+        if (batcher->current == batch)
+            batcher->current = nullptr;
+    }
+
+    std::vector<Promise<RedisBatchResult>> promises;
+    promises.swap(batch->promises);
+
+    RedisPipelineResult res = co_await pipeline(std::move(batch->pipe));
+    owned.reset();
+
+    for (std::size_t i = 0; i < promises.size(); i++) {
+        RedisBatchResult r;
+        r.state = res.state;
+        r.error = res.error;
+
+        if (i < res.values.size())
+            r.value = std::move(res.values[i]);
+
+        promises[i].set_value(std::move(r));
+    }
+
+    co_await fut.wait();
+    co_return fut.get();
+}
+
+
+// redis_server
+
+static inline unsigned char ascii_lower(unsigned char c) {
+    return (c >= 'A' && c <= 'Z') ? (c | 0x20) : c;
+}
+
+static uint64_t command_hash(std::string_view name) noexcept {
+    uint64_t h = 14695981039346656037ULL;
+
+    for (unsigned char c : name) {
+        h ^= ascii_lower(c);
+        h *= 1099511628211ULL;
+    }
+
+    return h;
+}
+
+static bool command_equal(std::string_view a, std::string_view b) noexcept {
+    if (a.size() != b.size())
+        return false;
+
+    for (std::size_t i = 0; i < a.size(); i++) {
+        if (ascii_lower(a[i]) != ascii_lower(b[i]))
+            return false;
+    }
+
+    return true;
+}
+
+void RedisCommandTable::add(std::string_view name,
+                            RedisCommandHandler handler) {
+    uint64_t hash = command_hash(name);
+
+    for (Entry &e : entries) {
+        if (e.hash == hash && command_equal(e.name, name)) {
+            e.handler = std::move(handler);
+            return;
+        }
+    }
+
+    entries.push_back(Entry{std::string(name), hash, std::move(handler)});
+    rebuild();
+}
+
+void RedisCommandTable::rebuild() {
+    std::size_t cap = 8;
+    while (cap < entries.size() * 2)
+        cap <<= 1;
+
+    slots.assign(cap, 0);
+
+    for (std::size_t i = 0; i < entries.size(); i++) {
+        std::size_t pos = entries[i].hash & (cap - 1);
+
+        while (slots[pos] != 0)
+            pos = (pos + 1) & (cap - 1);
+
+        slots[pos] = static_cast<uint32_t>(i + 1);
+    }
+}
+
+const RedisCommandHandler *
+RedisCommandTable::find(std::string_view name) const noexcept {
+    if (slots.empty())
+        return nullptr;
+
+    std::size_t cap = slots.size();
+    uint64_t hash = command_hash(name);
+    std::size_t pos = hash & (cap - 1);
+
+    while (slots[pos] != 0) {
+        const Entry &e = entries[slots[pos] - 1];
+
+        if (e.hash == hash && command_equal(e.name, name))
+            return &e.handler;
+
+        pos = (pos + 1) & (cap - 1);
+    }
+
+    return nullptr;
+}
+
+Task<> RedisServer::dispatch(RedisServerContext ctx) {
+    RedisRequest &req = ctx.get_req();
+    std::string command;
+    std::vector<std::string> params;
+    RedisValue value;
+
+    if (!req.get_command(command) || !req.get_params(params)) {
+        value.set_error("ERR bad request");
+        ctx.get_resp().set_result(value);
+        co_return;
+    }
+
+    const RedisCommandHandler *handler = commands.find(command);
+
+    if (handler)
+        co_await (*handler)(ctx, params);
+    else if (unknown_command)
+        co_await unknown_command(ctx, params);
+    else {
+        value.set_error("ERR unknown command '" + command + "'");
+        ctx.get_resp().set_result(value);
+    }
+}
+
+
 // redis_utils
 
 static std::string escape_string(const std::string &s, bool quote = true) {
@@ -0,0 +1,294 @@
+/**
+ * Copyright 2024 Coke Project (https://github.com/kedixa/coke)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Authors: kedixa (https://github.com/kedixa)
+*/
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <functional>
+
+#include "coke/redis/redis_subscriber.h"
+#include "coke/basic_awaiter.h"
+
+namespace coke {
+
+class RedisSubscribeAwaiter : public BasicAwaiter<int> {
+public:
+    using HookType = std::function<void (WFRedisSubscribeTask *)>;
+
+    RedisSubscribeAwaiter(WFRedisSubscribeTask *task, HookType hook) {
+        task->set_callback([info = this->get_info(), hook = std::move(hook)]
+                           (WFRedisSubscribeTask *task) {
+            hook(task);
+
+            auto *awaiter = info->get_awaiter<RedisSubscribeAwaiter>();
+            awaiter->emplace_result(task->get_state());
+            awaiter->done();
+        });
+
+        set_task(task);
+    }
+};
+
+static std::vector<std::string> to_vector(const std::set<std::string> &s) {
+    return std::vector<std::string>(s.begin(), s.end());
+}
+
+RedisSubscriber::RedisSubscriber(const RedisClientParams &client_params,
+                                 const RedisSubscriberParams &params)
+    : params(params), que(std::max(params.queue_size, std::size_t(1)))
+{
+    std::string url, prefix, suffix;
+
+    detail::make_redis_url(client_params, url, prefix, suffix);
+    if (subscriber.init(url) < 0)
+        init_error = errno ? errno : EINVAL;
+}
+
+int RedisSubscriber::prepare_locked(bool &start) {
+    if (init_error)
+        return -init_error;
+
+    if (closing)
+        return -ECANCELED;
+
+    start = !started;
+    started = true;
+    return 0;
+}
+
+void RedisSubscriber::start(bool start) {
+    // The coroutine runs until its first suspension, never detach it while
+    // holding the lock.
+    if (start)
+        coke::detach(run());
+}
+
+int RedisSubscriber::subscribe(const std::vector<std::string> &chans) {
+    std::unique_lock<std::mutex> lk(mtx);
+    bool need_start = false;
+    int ret = prepare_locked(need_start);
+
+    if (ret < 0)
+        return ret;
+
+    for (const std::string &c : chans) {
+        channels.insert(c);
+        removed_channels.erase(c);
+    }
+
+    if (current) {
+        if (current->subscribe(chans) < 0)
+            ret = -errno;
+    }
+    else
+        resubscribe = true;
+
+    lk.unlock();
+    start(need_start);
+    return ret;
+}
+
+int RedisSubscriber::psubscribe(const std::vector<std::string> &pats) {
+    std::unique_lock<std::mutex> lk(mtx);
+    bool need_start = false;
+    int ret = prepare_locked(need_start);
+
+    if (ret < 0)
+        return ret;
+
+    for (const std::string &p : pats) {
+        patterns.insert(p);
+        removed_patterns.erase(p);
+    }
+
+    if (current) {
+        if (current->psubscribe(pats) < 0)
+            ret = -errno;
+    }
+    else
+        resubscribe = true;
+
+    lk.unlock();
+    start(need_start);
+    return ret;
+}
+
+int RedisSubscriber::unsubscribe(const std::vector<std::string> &chans) {
+    std::lock_guard<std::mutex> lg(mtx);
+
+    for (const std::string &c : chans) {
+        if (channels.erase(c) && !current)
+            removed_channels.insert(c);
+    }
+
+    if (current && current->unsubscribe(chans) < 0)
+        return -errno;
+
+    return 0;
+}
+
+int RedisSubscriber::punsubscribe(const std::vector<std::string> &pats) {
+    std::lock_guard<std::mutex> lg(mtx);
+
+    for (const std::string &p : pats) {
+        if (patterns.erase(p) && !current)
+            removed_patterns.insert(p);
+    }
+
+    if (current && current->punsubscribe(pats) < 0)
+        return -errno;
+
+    return 0;
+}
+
+void RedisSubscriber::on_connect(WFRedisSubscribeTask *task, bool send_all) {
+    std::lock_guard<std::mutex> lg(mtx);
+
+    current = task;
+    if (closing) {
+        task->quit();
+        return;
+    }
+
+    // Subscribe again if the sets were changed before connected, or the task
+    // was created with only the channels.
+    if (send_all || resubscribe) {
+        if (!channels.empty())
+            task->subscribe(to_vector(channels));
+        if (!patterns.empty())
+            task->psubscribe(to_vector(patterns));
+    }
+
+    if (!removed_channels.empty())
+        task->unsubscribe(to_vector(removed_channels));
+    if (!removed_patterns.empty())
+        task->punsubscribe(to_vector(removed_patterns));
+
+    removed_channels.clear();
+    removed_patterns.clear();
+    resubscribe = false;
+}
+
+void RedisSubscriber::on_message(WFRedisSubscribeTask *task) {
+    RedisValue value;
+    RedisPushMessage msg;
+
+    task->get_task()->get_resp()->get_result(value);
+    if (!value.is_array() || value.arr_size() < 3 || !value[0].is_string())
+        return;
+
+    msg.type = value[0].string_value();
+
+    if (msg.type == "message") {
+        msg.channel = value[1].string_value();
+        msg.payload = value[2].string_value();
+    }
+    else if (msg.type == "pmessage" && value.arr_size() >= 4) {
+        msg.pattern = value[1].string_value();
+        msg.channel = value[2].string_value();
+        msg.payload = value[3].string_value();
+    }
+    else
+        return;
+
+    // This is called in the handler thread, never block it
+    if (!que.try_push(std::move(msg)))
+        dropped.fetch_add(1, std::memory_order_relaxed);
+}
+
+void RedisSubscriber::on_finish(WFRedisSubscribeTask *task) {
+    std::lock_guard<std::mutex> lg(mtx);
+
+    if (current == task)
+        current = nullptr;
+}
+
+Task<> RedisSubscriber::run() {
+    StopToken::FinishGuard guard(&token);
+    auto interval = std::chrono::milliseconds(params.reconnect_interval);
+
+    while (!token.stop_requested()) {
+        std::vector<std::string> chans, pats;
+
+        {
+            std::lock_guard<std::mutex> lg(mtx);
+            chans = to_vector(channels);
+            pats = to_vector(patterns);
+            removed_channels.clear();
+            removed_patterns.clear();
+            resubscribe = false;
+        }
+
+        if (chans.empty() && pats.empty()) {
+            co_await token.wait_stop_for(interval);
+            continue;
+        }
+
+        // The extract function is called in order, and this frame lives
+        // until the task is finished.
+        bool connected = false;
+        bool send_all = !chans.empty() && !pats.empty();
+
+        auto extract = [this, &connected, send_all] (WFRedisSubscribeTask *t) {
+            if (!connected) {
+                connected = true;
+                on_connect(t, send_all);
+            }
+
+            on_message(t);
+        };
+
+        WFRedisSubscribeTask *task;
+        if (!chans.empty())
+            task = subscriber.create_subscribe_task(chans, extract, nullptr);
+        else
+            task = subscriber.create_psubscribe_task(pats, extract, nullptr);
+
+        task->set_send_timeout(params.send_timeout);
+        task->set_keep_alive(params.keep_alive_timeout);
+
+        co_await RedisSubscribeAwaiter(task, [this] (WFRedisSubscribeTask *t) {
+            on_finish(t);
+        });
+
+        if (!token.stop_requested())
+            co_await token.wait_stop_for(interval);
+    }
+}
+
+Task<> RedisSubscriber::close() {
+    bool wait;
+
+    {
+        std::lock_guard<std::mutex> lg(mtx);
+        closing = true;
+        wait = started;
+
+        if (current)
+            current->quit();
+    }
+
+    token.request_stop();
+
+    if (wait)
+        co_await token.wait_finish();
+
+    que.close();
+}
+
+} // namespace coke
@@ -0,0 +1,151 @@
+/**
+ * Copyright 2024 Coke Project (https://github.com/kedixa/coke)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Authors: kedixa (https://github.com/kedixa)
+*/
+
+#include <algorithm>
+#include <cstring>
+
+#include "coke/net/rpc.h"
+
+#include "workflow/WFTaskFactory.h"
+
+namespace coke {
+
+namespace {
+
+void store32(char *p, uint32_t v) {
+    for (int i = 3; i >= 0; i--, v >>= 8)
+        p[i] = (char)(v & 0xFF);
+}
+
+void store64(char *p, uint64_t v) {
+    for (int i = 7; i >= 0; i--, v >>= 8)
+        p[i] = (char)(v & 0xFF);
+}
+
+uint32_t load32(const char *p) {
+    uint32_t v = 0;
+    for (int i = 0; i < 4; i++)
+        v = (v << 8) | (unsigned char)p[i];
+    return v;
+}
+
+uint64_t load64(const char *p) {
+    uint64_t v = 0;
+    for (int i = 0; i < 8; i++)
+        v = (v << 8) | (unsigned char)p[i];
+    return v;
+}
+
+} // namespace
+
+int RpcMessage::encode(struct iovec vectors[], int max) {
+    if (body.size() > UINT32_MAX) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+
+    store32(header, RPC_MAGIC);
+    store32(header + 4, code);
+    store64(header + 8, id);
+    store32(header + 16, (uint32_t)body.size());
+
+    vectors[0].iov_base = header;
+    vectors[0].iov_len = RPC_HEADER_SIZE;
+
+    if (body.empty() || max < 2)
+        return 1;
+
+    vectors[1].iov_base = body.data();
+    vectors[1].iov_len = body.size();
+    return 2;
+}
+
+int RpcMessage::append(const void *buf, size_t *size) {
+    const char *p = static_cast<const char *>(buf);
+    std::size_t left = *size;
+    std::size_t n;
+
+    if (header_received < RPC_HEADER_SIZE) {
+        n = std::min(left, RPC_HEADER_SIZE - header_received);
+        std::memcpy(header + header_received, p, n);
+        header_received += n;
+        p += n;
+        left -= n;
+
+        if (header_received < RPC_HEADER_SIZE)
+            return 0;
+
+        if (load32(header) != RPC_MAGIC) {
+            errno = EBADMSG;
+            return -1;
+        }
+
+        code = load32(header + 4);
+        id = load64(header + 8);
+        body_size = load32(header + 16);
+
+        if (RPC_HEADER_SIZE + body_size > this->size_limit) {
+            errno = EMSGSIZE;
+            return -1;
+        }
+
+        body.clear();
+        body.reserve(body_size);
+    }
+
+    n = std::min(left, body_size - body.size());
+    body.append(p, n);
+    left -= n;
+
+    if (body.size() < body_size)
+        return 0;
+
+    // Drop the data after the frame, if any
+    *size -= left;
+    return 1;
+}
+
+Task<RpcResult> RpcClient::call(RpcRequest req) {
+    using Factory = WFNetworkTaskFactory<RpcRequest, RpcResponse>;
+    using TaskType = WFNetworkTask<RpcRequest, RpcResponse>;
+
+    TransportType type = params.use_ssl ? TT_TCP_SSL : TT_TCP;
+    TaskType *task = Factory::create_client_task(type, params.host,
+                                                 params.port,
+                                                 params.retry_max, nullptr);
+    uint64_t id = get_unique_id();
+
+    req.set_id(id);
+    *task->get_req() = std::move(req);
+    task->get_resp()->set_size_limit(params.response_size_limit);
+
+    task->set_send_timeout(params.send_timeout);
+    task->set_receive_timeout(params.receive_timeout);
+    task->set_keep_alive(params.keep_alive_timeout);
+
+    RpcResult res = co_await RpcAwaiter(task);
+
+    if (res.state == STATE_SUCCESS && res.resp.get_id() != id) {
+        res.state = STATE_SYS_ERROR;
+        res.error = EBADMSG;
+    }
+
+    co_return res;
+}
+
+} // namespace coke
@@ -0,0 +1,105 @@
+/**
+ * Copyright 2024 Coke Project (https://github.com/kedixa/coke)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Authors: kedixa (https://github.com/kedixa)
+*/
+
+#include <new>
+
+#include "coke/series.h"
+#include "coke/detail/constant.h"
+#include "coke/detail/free_list.h"
+
+#include "workflow/Workflow.h"
+
+namespace coke::detail {
+
+class SeriesCache : public ThreadLocalCache<SeriesCache> {
+public:
+    void *alloc() noexcept {
+        void *ptr = list.pop();
+
+        if (ptr)
+            ++stats.hits;
+        else
+            ++stats.misses;
+
+        return ptr;
+    }
+
+    bool free(void *ptr) noexcept {
+        return list.push(ptr, SERIES_POOL_CACHE_COUNT);
+    }
+
+    SeriesPoolStats get_stats() const noexcept { return stats; }
+
+private:
+    FreeList list;
+    SeriesPoolStats stats;
+};
+
+/**
+ * SeriesWork deletes itself by `delete this` when finished, the class
+ * specific operator delete of the child class is used because the destructor
+ * is virtual, which returns the memory to the free list of current thread.
+*/
+class PooledSeriesWork final : public SeriesWork {
+public:
+    PooledSeriesWork(SubTask *first)
+        : SeriesWork(first, nullptr)
+    { }
+
+    static void *operator new(std::size_t size) {
+        SeriesCache *cache = SeriesCache::get();
+        void *ptr = nullptr;
+
+        if (cache && size == sizeof(PooledSeriesWork))
+            ptr = cache->alloc();
+
+        if (!ptr)
+            ptr = ::operator new(size);
+
+        return ptr;
+    }
+
+    static void operator delete(void *ptr, std::size_t size) noexcept {
+        SeriesCache *cache = SeriesCache::get();
+
+        if (!cache || size != sizeof(PooledSeriesWork) || !cache->free(ptr))
+            ::operator delete(ptr);
+    }
+
+protected:
+    virtual ~PooledSeriesWork() = default;
+};
+
+} // namespace coke::detail
+
+namespace coke {
+
+SeriesWork *pooled_series_creater(SubTask *first) {
+    return new detail::PooledSeriesWork(first);
+}
+
+SeriesPoolStats get_series_pool_stats() noexcept {
+    detail::SeriesCache *cache = detail::SeriesCache::get();
+
+    if (cache)
+        return cache->get_stats();
+
+    return SeriesPoolStats{};
+}
+
+} // namespace coke
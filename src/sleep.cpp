@@ -16,6 +16,11 @@
  * Authors: kedixa (https://github.com/kedixa)
 */
 
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
 #include "coke/detail/timer_task.h"
 #include "coke/sleep.h"
 
@@ -79,6 +84,13 @@ SleepBase &SleepBase::operator=(SleepBase &&that) noexcept {
     return *this;
 }
 
+SleepBase::~SleepBase() {
+    if (this->subtask && this->subtask == this->timer) {
+        ((TimerTask *)this->timer)->discard();
+        this->subtask = nullptr;
+    }
+}
+
 int SleepBase::await_resume() noexcept {
     if (this->timer)
         return ((TimerTask *)this->timer)->get_result();
@@ -89,8 +101,17 @@ int TimerTask::get_result() noexcept {
     return get_sleep_state(this->state, this->error);
 }
 
+static thread_local bool handler_thread_flag = false;
+
+bool in_handler_thread() noexcept {
+    return handler_thread_flag;
+}
+
 void YieldTask::handle(int state, int error) {
     if (state == WFT_STATE_SYS_ERROR && error == ECANCELED) {
+        // Canceled by the poller, so this is a handler thread
+        handler_thread_flag = true;
+
         state = WFT_STATE_SUCCESS;
         error = 0;
     }
@@ -98,9 +119,21 @@ void YieldTask::handle(int state, int error) {
     return this->TimerTask::handle(state, error);
 }
 
-TimerTask *create_timer(NanoSec nsec) {
+static std::atomic<NanoSec::rep> timer_slack{0};
+
+NanoSec get_timer_slack() noexcept {
+    return NanoSec(timer_slack.load(std::memory_order_relaxed));
+}
+
+void set_timer_slack(NanoSec slack) noexcept {
+    timer_slack.store(slack.count(), std::memory_order_relaxed);
+}
+
+TimerTask *create_timer(NanoSec nsec, bool coarse) {
     CommScheduler *s = WFGlobal::get_scheduler();
-    return new TimerTask(s, nsec);
+    TimerTask *task = new TimerTask(s, nsec);
+    task->set_coarse(coarse || use_timing_wheel(nsec));
+    return task;
 }
 
 TimerTask *create_yield_timer() {
@@ -111,7 +144,13 @@ TimerTask *create_yield_timer() {
 } // namespace coke::detail
 
 
-SleepAwaiter::SleepAwaiter(NanoSec nsec) {
+SleepAwaiter::SleepAwaiter(NanoSec nsec)
+    : SleepAwaiter(nsec, detail::get_timer_slack())
+{ }
+
+SleepAwaiter::SleepAwaiter(NanoSec nsec, NanoSec slack) {
+    nsec = detail::TimedWaitHelper::round_up(nsec, slack);
+
     auto *time_task = detail::create_timer(nsec);
     time_task->set_awaiter(this);
     this->timer = time_task;
@@ -122,6 +161,13 @@ SleepAwaiter::SleepAwaiter(double sec)
     : SleepAwaiter(to_nsec(sec))
 { }
 
+SleepAwaiter::SleepAwaiter(NanoSec nsec, CoarseTag) {
+    auto *time_task = detail::create_timer(nsec, true);
+    time_task->set_awaiter(this);
+    this->timer = time_task;
+    this->set_task(time_task);
+}
+
 SleepAwaiter::SleepAwaiter(uint64_t id, NanoSec nsec, bool insert_head) {
     auto *time_task = detail::create_timer(id, nsec, insert_head);
     time_task->set_awaiter(this);
@@ -171,6 +217,21 @@ SleepAwaiter::SleepAwaiter(YieldTag) {
 }
 
 
+SleepKey::SleepKey(const std::string &name) {
+    // Leaked on purpose, keys may be created during static destruction
+    static auto *keys = new std::unordered_map<std::string, uint64_t>();
+    static std::mutex mtx;
+
+    std::lock_guard<std::mutex> lg(mtx);
+    auto it = keys->find(name);
+
+    if (it == keys->end())
+        it = keys->emplace(name, get_unique_id()).first;
+
+    this->id = it->second;
+}
+
+
 WFSleepAwaiter::WFSleepAwaiter(const std::string &name, NanoSec nano) {
     auto cb = [info = this->get_info()](WFTimerTask *task) {
         auto *awaiter = info->get_awaiter<WFSleepAwaiter>();
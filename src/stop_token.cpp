@@ -17,34 +17,143 @@
 */
 
 #include "coke/stop_token.h"
+#include "coke/detail/spin_wait.h"
 
 namespace coke {
 
+uint32_t StopToken::lock_list() noexcept {
+    uint32_t s = state.load(std::memory_order_relaxed);
+
+    while (true) {
+        if (s & LOCK_BIT) {
+            detail::cpu_relax();
+            s = state.load(std::memory_order_relaxed);
+        }
+        else if (state.compare_exchange_weak(s, s | LOCK_BIT,
+                                             std::memory_order_acquire,
+                                             std::memory_order_relaxed))
+            return s;
+    }
+}
+
+bool StopToken::request_stop() {
+    uint32_t s = state.load(std::memory_order_relaxed);
+
+    // Set STOP_BIT together with LOCK_BIT, so that no callback is added after
+    // the list is taken over.
+    while (true) {
+        if (s & STOP_BIT)
+            return false;
+
+        if (s & LOCK_BIT) {
+            detail::cpu_relax();
+            s = state.load(std::memory_order_relaxed);
+        }
+        else if (state.compare_exchange_weak(s, s | STOP_BIT | LOCK_BIT,
+                                             std::memory_order_acq_rel,
+                                             std::memory_order_relaxed))
+            break;
+    }
+
+    running_tid = std::this_thread::get_id();
+
+    while (head) {
+        detail::StopCallbackNode *node = head;
+        bool removed = false;
+
+        head = node->next;
+        if (head)
+            head->prev = nullptr;
+
+        node->prev = node->next = nullptr;
+        node->removed = &removed;
+        running = node;
+        unlock_list();
+
+        node->run(node);
+
+        // The node may be destroyed by the callback itself.
+        if (!removed) {
+            node->removed = nullptr;
+            node->finished.store(true, std::memory_order_release);
+        }
+
+        lock_list();
+        running = nullptr;
+    }
+
+    unlock_list();
+
+    cancel_sleep_by_addr(get_stop_addr());
+    return true;
+}
+
+bool StopToken::add_callback(detail::StopCallbackNode *node) noexcept {
+    if (lock_list() & STOP_BIT) {
+        unlock_list();
+        return false;
+    }
+
+    node->next = head;
+    if (head)
+        head->prev = node;
+    head = node;
+
+    unlock_list();
+    return true;
+}
+
+void StopToken::remove_callback(detail::StopCallbackNode *node) noexcept {
+    lock_list();
+
+    if (node == head || node->prev) {
+        if (node->prev)
+            node->prev->next = node->next;
+        else
+            head = node->next;
+
+        if (node->next)
+            node->next->prev = node->prev;
+
+        unlock_list();
+        return;
+    }
+
+    bool self = (node == running && running_tid == std::this_thread::get_id());
+    if (self)
+        *node->removed = true;
+
+    unlock_list();
+
+    // The callback is running in another thread, or already finished.
+    if (!self) {
+        while (!node->finished.load(std::memory_order_acquire))
+            std::this_thread::yield();
+    }
+}
+
 Task<bool> StopToken::wait_finish_impl(detail::TimedWaitHelper helper) {
-    std::unique_lock<std::mutex> lk(mtx);
-    while (n != 0 && !helper.timeout()) {
+    while (!finished() && !helper.timeout()) {
+        // Either set_finished sees the sleep, or it's seen finished here.
         SleepAwaiter s = sleep(get_finish_addr(), helper);
+        if (finished())
+            cancel_sleep_by_addr(get_finish_addr());
 
-        lk.unlock();
         int ret = co_await std::move(s);
-        lk.lock();
-
         if (ret < 0 || ret == SLEEP_ABORTED)
             break;
     }
 
-    co_return n == 0;
+    co_return finished();
 }
 
 Task<bool> StopToken::wait_stop_impl(detail::TimedWaitHelper helper) {
-    std::unique_lock<std::mutex> lk(mtx);
     while (!stop_requested() && !helper.timeout()) {
         SleepAwaiter s = sleep(get_stop_addr(), helper);
+        if (stop_requested())
+            cancel_sleep_by_addr(get_stop_addr());
 
-        lk.unlock();
         int ret = co_await std::move(s);
-        lk.lock();
-
         if (ret < 0 || ret == SLEEP_ABORTED)
             break;
     }
@@ -0,0 +1,351 @@
+/**
+ * Copyright 2024 Coke Project (https://github.com/kedixa/coke)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Authors: kedixa (https://github.com/kedixa)
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+
+#include "coke/detail/timer_task.h"
+#include "workflow/WFGlobal.h"
+
+namespace coke::detail {
+
+static std::atomic<int> wheel_threshold_ms{-1};
+static std::atomic<int> wheel_tick_ms{10};
+
+void set_timer_wheel_config(int threshold_ms, int tick_ms) noexcept {
+    wheel_threshold_ms.store(threshold_ms, std::memory_order_relaxed);
+    wheel_tick_ms.store(tick_ms > 0 ? tick_ms : 1, std::memory_order_relaxed);
+}
+
+bool use_timing_wheel(NanoSec nsec) noexcept {
+    int threshold = wheel_threshold_ms.load(std::memory_order_relaxed);
+    return threshold >= 0 && nsec >= std::chrono::milliseconds(threshold);
+}
+
+/**
+ * TimingWheel is a hierarchical timing wheel for long and coarse-grained
+ * timers. Inserting and canceling a timer are O(1), and all the timers expire
+ * in the same tick are handed to the poller as a batch of zero duration
+ * timers, so the poller's heap only contains timers that are about to finish.
+ *
+ * The wheel is driven by a ticker on workflow's scheduler, which only runs
+ * when there are timers on the wheel.
+*/
+class TimingWheel {
+    static constexpr unsigned LEVEL_BITS = 6;
+    static constexpr unsigned LEVELS = 5;
+    static constexpr uint64_t SLOTS = uint64_t(1) << LEVEL_BITS;
+    static constexpr uint64_t SLOT_MASK = SLOTS - 1;
+    static constexpr uint64_t MAX_DELTA = (uint64_t(1) << (LEVEL_BITS * LEVELS)) - 1;
+
+    using Clock = std::chrono::steady_clock;
+
+    class Ticker : public SleepRequest {
+    public:
+        Ticker(CommScheduler *scheduler, TimingWheel *wheel, NanoSec nsec)
+            : SleepRequest(scheduler), wheel(wheel), nsec(nsec)
+        { }
+
+        int start() { return this->scheduler->sleep(this); }
+
+    protected:
+        virtual int duration(struct timespec *value) override {
+            constexpr int64_t N = 1'000'000'000;
+            value->tv_sec = (time_t)(nsec.count() / N);
+            value->tv_nsec = (long)(nsec.count() % N);
+            return 0;
+        }
+
+        virtual void handle(int state, int error) override {
+            TimingWheel *w = wheel;
+            delete this;
+            w->on_tick(state, error);
+        }
+
+        // Ticker is not in any series, done is never called
+        virtual SubTask *done() override { return nullptr; }
+
+    private:
+        TimingWheel *wheel;
+        NanoSec nsec;
+    };
+
+public:
+    static TimingWheel &get_instance() {
+        // Never destroyed, the ticker may still be running at exit
+        static TimingWheel *wheel = new TimingWheel();
+        return *wheel;
+    }
+
+    int add(TimerTask *task);
+    int cancel(TimerTask *task);
+
+private:
+    TimingWheel()
+        : start_time(Clock::now()),
+          tick(std::chrono::milliseconds(wheel_tick_ms.load()))
+    { }
+
+    uint64_t current_tick() const noexcept {
+        return (uint64_t)((Clock::now() - start_time) / tick);
+    }
+
+    void link(TimerTask *task);
+    void unlink(TimerTask *task) noexcept;
+    void on_tick(int state, int error);
+    int start_ticker();
+
+    static void fire(TimerTask *list);
+
+private:
+    std::mutex mtx;
+    Clock::time_point start_time;
+    NanoSec tick;
+
+    // The next tick to be processed
+    uint64_t base{0};
+    std::size_t count{0};
+    bool running{false};
+
+    TimerTask *slots[LEVELS][SLOTS] = {};
+};
+
+void TimingWheel::link(TimerTask *task) {
+    uint64_t expire = task->wheel_expire;
+    uint64_t delta = expire > base ? expire - base : 0;
+    unsigned level = 0;
+
+    if (delta > MAX_DELTA) {
+        // Put it on the last level, it will be reinserted when reached
+        delta = MAX_DELTA;
+        expire = base + MAX_DELTA;
+    }
+    else if (delta == 0)
+        expire = base;
+
+    while (level + 1 < LEVELS && delta >= (SLOTS << (LEVEL_BITS * level)))
+        ++level;
+
+    TimerTask **slot = &slots[level][(expire >> (LEVEL_BITS * level)) & SLOT_MASK];
+
+    task->wheel_prev = nullptr;
+    task->wheel_next = *slot;
+    if (*slot)
+        (*slot)->wheel_prev = task;
+
+    *slot = task;
+    task->wheel_slot = slot;
+}
+
+void TimingWheel::unlink(TimerTask *task) noexcept {
+    if (task->wheel_prev)
+        task->wheel_prev->wheel_next = task->wheel_next;
+    else
+        *task->wheel_slot = task->wheel_next;
+
+    if (task->wheel_next)
+        task->wheel_next->wheel_prev = task->wheel_prev;
+
+    task->wheel_prev = task->wheel_next = nullptr;
+    task->wheel_slot = nullptr;
+}
+
+int TimingWheel::add(TimerTask *task) {
+    bool need_start = false;
+
+    {
+        std::lock_guard<std::mutex> lg(mtx);
+        NanoSec elapsed = Clock::now() - start_time;
+        NanoSec nsec = std::max(task->nsec, NanoSec(0));
+
+        if (count == 0 && !running)
+            base = (uint64_t)(elapsed / tick);
+
+        // Round up, the timer never finishes earlier than expected
+        task->wheel_expire = (uint64_t)((elapsed + nsec + tick - NanoSec(1)) / tick);
+        link(task);
+        ++count;
+
+        if (!running)
+            running = need_start = true;
+    }
+
+    if (need_start && start_ticker() < 0) {
+        int err = errno;
+        std::lock_guard<std::mutex> lg(mtx);
+
+        unlink(task);
+        --count;
+        running = false;
+
+        errno = err;
+        return -1;
+    }
+
+    return 0;
+}
+
+int TimingWheel::cancel(TimerTask *task) {
+    {
+        std::lock_guard<std::mutex> lg(mtx);
+
+        // Already handed to the poller, it will finish soon
+        if (task->wheel_slot == nullptr)
+            return 0;
+
+        unlink(task);
+        --count;
+    }
+
+    fire(task);
+    return 0;
+}
+
+int TimingWheel::start_ticker() {
+    CommScheduler *s = WFGlobal::get_scheduler();
+    NanoSec wait = tick - (Clock::now() - start_time) % tick;
+    Ticker *ticker = new Ticker(s, this, wait);
+
+    int ret = ticker->start();
+    if (ret < 0)
+        delete ticker;
+
+    return ret;
+}
+
+void TimingWheel::on_tick(int state, int error) {
+    TimerTask *expired = nullptr;
+    bool restart = false;
+
+    if (state != SS_STATE_COMPLETE) {
+        // The scheduler is stopping, finish all the timers
+        std::unique_lock<std::mutex> lk(mtx);
+
+        for (auto &level : slots) {
+            for (TimerTask *&head : level) {
+                while (head) {
+                    TimerTask *task = head;
+                    unlink(task);
+                    task->wheel_next = expired;
+                    expired = task;
+                }
+            }
+        }
+
+        count = 0;
+        running = false;
+        lk.unlock();
+
+        while (expired) {
+            TimerTask *task = expired;
+            expired = task->wheel_next;
+            task->wheel_next = nullptr;
+            task->handle(state, error);
+        }
+
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lg(mtx);
+        uint64_t now = current_tick();
+
+        while (base <= now) {
+            uint64_t index = base & SLOT_MASK;
+
+            // Cascade timers from upper levels when lower level wraps
+            for (unsigned lv = 1; index == 0 && lv < LEVELS; lv++) {
+                uint64_t idx = (base >> (LEVEL_BITS * lv)) & SLOT_MASK;
+                TimerTask *task = slots[lv][idx];
+
+                slots[lv][idx] = nullptr;
+                while (task) {
+                    TimerTask *next = task->wheel_next;
+                    link(task);
+                    task = next;
+                }
+
+                if (idx != 0)
+                    break;
+            }
+
+            TimerTask *task = slots[0][index];
+            slots[0][index] = nullptr;
+
+            while (task) {
+                TimerTask *next = task->wheel_next;
+
+                if (task->wheel_expire > base)
+                    link(task);
+                else {
+                    task->wheel_prev = nullptr;
+                    task->wheel_slot = nullptr;
+                    task->wheel_next = expired;
+                    expired = task;
+                    --count;
+                }
+
+                task = next;
+            }
+
+            ++base;
+        }
+
+        running = restart = (count != 0);
+    }
+
+    // Expired timers are handed to the poller outside the lock
+    fire(expired);
+
+    if (restart && start_ticker() < 0)
+        on_tick(SS_STATE_ERROR, errno);
+}
+
+void TimingWheel::fire(TimerTask *list) {
+    while (list) {
+        TimerTask *task = list;
+        list = task->wheel_next;
+        task->wheel_next = nullptr;
+
+        // Reuse the poller with zero duration, so that the timer finishes in
+        // handler threads as usual. `task` may be destroyed after sleep.
+        task->nsec = NanoSec(0);
+        if (task->scheduler->sleep(task) < 0)
+            task->handle(SS_STATE_ERROR, errno);
+    }
+}
+
+int TimerTask::sleep_timer() {
+    if (coarse)
+        return TimingWheel::get_instance().add(this);
+
+    return this->scheduler->sleep(this);
+}
+
+int TimerTask::cancel_timer() {
+    if (coarse)
+        return TimingWheel::get_instance().cancel(this);
+
+    return this->cancel();
+}
+
+} // namespace coke::detail
@@ -0,0 +1,255 @@
+/**
+ * Copyright 2024 Coke Project (https://github.com/kedixa/coke)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Authors: kedixa (https://github.com/kedixa)
+*/
+
+#include <atomic>
+#include <chrono>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include <openssl/ssl.h>
+
+#include "coke/net/tls_session.h"
+
+#include "workflow/WFGlobal.h"
+
+namespace coke {
+
+namespace {
+
+using InfoCallback = void (*)(const SSL *, int, int);
+
+struct SessionEntry {
+    SSL_SESSION *session;
+    std::list<std::string>::iterator pos;
+};
+
+struct SessionCache {
+    std::mutex mtx;
+    std::unordered_map<std::string, SessionEntry> sessions;
+
+    // Least recently used at the front
+    std::list<std::string> lru;
+
+    TlsSessionParams params;
+    InfoCallback old_info_cb{nullptr};
+    int ex_index{-1};
+    bool enabled{false};
+
+    std::atomic<uint64_t> handshakes{0};
+    std::atomic<uint64_t> resumed{0};
+    LatencyHistogram latency;
+};
+
+SessionCache &get_session_cache() {
+    static SessionCache cache;
+    return cache;
+}
+
+int64_t steady_now_us() {
+    using namespace std::chrono;
+    auto now = steady_clock::now().time_since_epoch();
+    return duration_cast<microseconds>(now).count();
+}
+
+/**
+ * The key of a server is its address and the SNI name, the connected socket
+ * is already set to the SSL when the handshake starts.
+*/
+std::string session_key(const SSL *ssl) {
+    struct sockaddr_storage ss;
+    socklen_t len = sizeof(ss);
+    char buf[INET6_ADDRSTRLEN + 1];
+    unsigned short port;
+    std::string key;
+    int fd = SSL_get_fd(ssl);
+
+    if (fd < 0 || getpeername(fd, (struct sockaddr *)&ss, &len) != 0)
+        return key;
+
+    if (ss.ss_family == AF_INET) {
+        auto *sin = (struct sockaddr_in *)&ss;
+        inet_ntop(AF_INET, &sin->sin_addr, buf, sizeof(buf));
+        port = ntohs(sin->sin_port);
+    }
+    else if (ss.ss_family == AF_INET6) {
+        auto *sin6 = (struct sockaddr_in6 *)&ss;
+        inet_ntop(AF_INET6, &sin6->sin6_addr, buf, sizeof(buf));
+        port = ntohs(sin6->sin6_port);
+    }
+    else
+        return key;
+
+    key.append(buf).append(":").append(std::to_string(port));
+
+    const char *sni = SSL_get_servername(ssl, TLSEXT_NAMETYPE_host_name);
+    if (sni)
+        key.append("/").append(sni);
+
+    return key;
+}
+
+void drop_entry(SessionCache &c,
+                std::unordered_map<std::string, SessionEntry>::iterator it) {
+    SSL_SESSION_free(it->second.session);
+    c.lru.erase(it->second.pos);
+    c.sessions.erase(it);
+}
+
+// The cache takes the reference of `sess` if returns 1
+int new_session_cb(SSL *ssl, SSL_SESSION *sess) {
+    SessionCache &c = get_session_cache();
+    std::string key = session_key(ssl);
+
+    if (key.empty() || !SSL_SESSION_is_resumable(sess))
+        return 0;
+
+    std::lock_guard<std::mutex> lg(c.mtx);
+    auto it = c.sessions.find(key);
+
+    if (it != c.sessions.end()) {
+        SSL_SESSION_free(it->second.session);
+        it->second.session = sess;
+        c.lru.splice(c.lru.end(), c.lru, it->second.pos);
+        return 1;
+    }
+
+    if (c.params.max_sessions == 0)
+        return 0;
+
+    while (c.sessions.size() >= c.params.max_sessions)
+        drop_entry(c, c.sessions.find(c.lru.front()));
+
+    auto pos = c.lru.insert(c.lru.end(), key);
+    c.sessions.emplace(std::move(key), SessionEntry{sess, pos});
+    return 1;
+}
+
+void handshake_start(SessionCache &c, SSL *ssl) {
+    if (c.params.handshake_timing) {
+        void *start = (void *)(intptr_t)steady_now_us();
+        SSL_set_ex_data(ssl, c.ex_index, start);
+    }
+    else
+        SSL_set_ex_data(ssl, c.ex_index, (void *)(intptr_t)1);
+
+    // Renegotiation keeps its own session
+    if (SSL_get_session(ssl))
+        return;
+
+    std::string key = session_key(ssl);
+    if (key.empty())
+        return;
+
+    std::lock_guard<std::mutex> lg(c.mtx);
+    auto it = c.sessions.find(key);
+
+    if (it != c.sessions.end()) {
+        // SSL_set_session takes a reference of its own
+        SSL_set_session(ssl, it->second.session);
+        c.lru.splice(c.lru.end(), c.lru, it->second.pos);
+    }
+}
+
+void handshake_done(SessionCache &c, SSL *ssl) {
+    auto start = (intptr_t)SSL_get_ex_data(ssl, c.ex_index);
+
+    // HANDSHAKE_DONE is also reported for the TLS 1.3 session tickets after
+    // the handshake, count the first one only.
+    if (start == 0)
+        return;
+
+    SSL_set_ex_data(ssl, c.ex_index, nullptr);
+    c.handshakes.fetch_add(1, std::memory_order_relaxed);
+
+    if (SSL_session_reused(ssl))
+        c.resumed.fetch_add(1, std::memory_order_relaxed);
+
+    if (c.params.handshake_timing)
+        c.latency.record(uint64_t(steady_now_us() - start));
+}
+
+void info_cb(const SSL *cssl, int where, int ret) {
+    SessionCache &c = get_session_cache();
+    SSL *ssl = const_cast<SSL *>(cssl);
+
+    if (where & SSL_CB_HANDSHAKE_START)
+        handshake_start(c, ssl);
+    else if (where & SSL_CB_HANDSHAKE_DONE)
+        handshake_done(c, ssl);
+
+    if (c.old_info_cb)
+        c.old_info_cb(cssl, where, ret);
+}
+
+} // namespace
+
+int enable_tls_session_cache(const TlsSessionParams &params) {
+    SessionCache &c = get_session_cache();
+    SSL_CTX *ctx = WFGlobal::get_ssl_client_ctx();
+    std::lock_guard<std::mutex> lg(c.mtx);
+
+    if (c.enabled || !ctx)
+        return -1;
+
+    c.ex_index = SSL_get_ex_new_index(0, nullptr, nullptr, nullptr, nullptr);
+    if (c.ex_index < 0)
+        return -1;
+
+    c.params = params;
+    c.old_info_cb = SSL_CTX_get_info_callback(ctx);
+    c.enabled = true;
+
+    // The sessions are kept by this cache only, the internal cache of
+    // OpenSSL is for servers and not used by clients.
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT |
+                                        SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_sess_set_new_cb(ctx, new_session_cb);
+    SSL_CTX_set_info_callback(ctx, info_cb);
+    return 0;
+}
+
+void clear_tls_session_cache() {
+    SessionCache &c = get_session_cache();
+    std::lock_guard<std::mutex> lg(c.mtx);
+
+    for (auto &kv : c.sessions)
+        SSL_SESSION_free(kv.second.session);
+
+    c.sessions.clear();
+    c.lru.clear();
+}
+
+TlsHandshakeStats get_tls_handshake_stats() {
+    SessionCache &c = get_session_cache();
+    TlsHandshakeStats stats;
+
+    stats.handshakes = c.handshakes.load(std::memory_order_relaxed);
+    stats.resumed = c.resumed.load(std::memory_order_relaxed);
+    stats.latency = c.latency.snapshot();
+
+    std::lock_guard<std::mutex> lg(c.mtx);
+    stats.sessions = c.sessions.size();
+    return stats;
+}
+
+} // namespace coke
@@ -0,0 +1,194 @@
+/**
+ * Copyright 2024 Coke Project (https://github.com/kedixa/coke)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Authors: kedixa (https://github.com/kedixa)
+*/
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#if defined(__GNUC__) || defined(__clang__)
+#include <cxxabi.h>
+#endif
+
+#include "coke/trace.h"
+#include "coke/detail/constant.h"
+#include "coke/detail/exception_config.h"
+
+namespace coke::detail {
+
+static_assert((TRACE_BUFFER_SIZE & (TRACE_BUFFER_SIZE - 1)) == 0,
+              "TRACE_BUFFER_SIZE must be a power of 2");
+
+struct TraceEvent {
+    int64_t nsec;
+    const void *awaiter;
+    const char *name;
+    TracePhase phase;
+};
+
+/**
+ * Single producer ring buffer, only the owner thread writes to it, and the
+ * exporter reads the events before `pos`.
+*/
+struct TraceBuffer {
+    TraceBuffer(std::size_t tid) : tid(tid), pos(0) { }
+
+    std::size_t tid;
+    std::atomic<std::size_t> pos;
+    TraceEvent events[TRACE_BUFFER_SIZE];
+};
+
+class TraceRegistry {
+public:
+    TraceBuffer *new_buffer() {
+        std::lock_guard<std::mutex> lg(mtx);
+        buffers.emplace_back(std::make_unique<TraceBuffer>(buffers.size() + 1));
+        return buffers.back().get();
+    }
+
+    template<typename F>
+    void for_each(F &&f) {
+        std::lock_guard<std::mutex> lg(mtx);
+        for (auto &buf : buffers)
+            f(*buf);
+    }
+
+    static TraceRegistry &get() {
+        // Buffers are never released, threads may record events until exit
+        static TraceRegistry *reg = new TraceRegistry;
+        return *reg;
+    }
+
+private:
+    std::mutex mtx;
+    std::vector<std::unique_ptr<TraceBuffer>> buffers;
+};
+
+static int64_t trace_now() noexcept {
+    auto now = std::chrono::steady_clock::now().time_since_epoch();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(now).count();
+}
+
+void trace_record(TracePhase phase, const void *awaiter,
+                  const char *name) noexcept {
+    static thread_local TraceBuffer *buf = nullptr;
+
+    if (!buf) {
+        coke_try {
+            buf = TraceRegistry::get().new_buffer();
+        }
+        coke_catch (...) {
+            return;
+        }
+    }
+
+    std::size_t pos = buf->pos.load(std::memory_order_relaxed);
+    TraceEvent &e = buf->events[pos & (TRACE_BUFFER_SIZE - 1)];
+
+    e.nsec = trace_now();
+    e.awaiter = awaiter;
+    e.name = name;
+    e.phase = phase;
+
+    buf->pos.store(pos + 1, std::memory_order_release);
+}
+
+static std::string demangle(const char *name) {
+#if defined(__GNUC__) || defined(__clang__)
+    int status = 0;
+    char *p = abi::__cxa_demangle(name, nullptr, nullptr, &status);
+
+    if (p && status == 0) {
+        std::string s(p);
+        std::free(p);
+        return s;
+    }
+
+    std::free(p);
+#endif
+
+    return std::string(name);
+}
+
+static void write_json_string(std::ostream &os, const std::string &s) {
+    os << '"';
+    for (char c : s) {
+        if (c == '"' || c == '\\')
+            os << '\\';
+        os << c;
+    }
+    os << '"';
+}
+
+} // namespace coke::detail
+
+namespace coke {
+
+void trace_export_chrome(std::ostream &os) {
+    using detail::TraceBuffer;
+    using detail::TraceEvent;
+
+    // Type names are static strings, demangle each of them only once
+    std::map<const char *, std::string> names;
+    bool first = true;
+
+    os << "{\"traceEvents\":[";
+
+    detail::TraceRegistry::get().for_each([&](TraceBuffer &buf) {
+        std::size_t end = buf.pos.load(std::memory_order_acquire);
+        std::size_t start = 0;
+
+        if (end > detail::TRACE_BUFFER_SIZE)
+            start = end - detail::TRACE_BUFFER_SIZE;
+
+        for (std::size_t i = start; i < end; i++) {
+            const TraceEvent &e = buf.events[i & (detail::TRACE_BUFFER_SIZE - 1)];
+
+            if (!first)
+                os << ",";
+            first = false;
+
+            auto it = names.find(e.name);
+            if (it == names.end())
+                it = names.emplace(e.name, detail::demangle(e.name)).first;
+
+            os << "\n{\"name\":";
+            detail::write_json_string(os, it->second);
+            os << ",\"cat\":\"coke\",\"ph\":\"" << (char)e.phase << "\""
+               << ",\"id\":\"" << e.awaiter << "\""
+               << ",\"pid\":1,\"tid\":" << buf.tid
+               << ",\"ts\":" << (e.nsec / 1000) << "."
+               << (e.nsec % 1000 / 100) << "}";
+        }
+    });
+
+    os << "\n]}\n";
+}
+
+void trace_clear() {
+    detail::TraceRegistry::get().for_each([](detail::TraceBuffer &buf) {
+        buf.pos.store(0, std::memory_order_relaxed);
+    });
+}
+
+} // namespace coke
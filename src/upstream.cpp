@@ -0,0 +1,383 @@
+/**
+ * Copyright 2024 Coke Project (https://github.com/kedixa/coke)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Authors: kedixa (https://github.com/kedixa)
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+
+#include "coke/net/upstream.h"
+#include "coke/detail/random.h"
+#include "coke/global.h"
+
+namespace coke {
+
+namespace {
+
+constexpr unsigned int VIRTUAL_NODES = 64;
+
+int64_t steady_now_ms() {
+    using namespace std::chrono;
+    auto now = steady_clock::now().time_since_epoch();
+    return duration_cast<milliseconds>(now).count();
+}
+
+uint64_t hash_key(std::string_view key, uint64_t seed = 0) {
+    // FNV-1a, then mixed by the finalizer of splitmix64
+    uint64_t h = 14695981039346656037ULL ^ seed;
+
+    for (unsigned char c : key) {
+        h ^= c;
+        h *= 1099511628211ULL;
+    }
+
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111ebULL;
+    h ^= h >> 31;
+    return h;
+}
+
+struct UpstreamGroup;
+
+struct ServerState {
+    std::string address;
+    unsigned int weight;
+
+    // Used by round robin, protected by the group's mutex
+    long long current_weight{0};
+
+    UpstreamGroup *group;
+    std::atomic<uint64_t> inflight{0};
+    std::atomic<uint64_t> total{0};
+    std::atomic<uint64_t> failed{0};
+    std::atomic<unsigned int> continuous_fails{0};
+    std::atomic<int64_t> ejected_until{0};
+
+    bool ejected(int64_t now) const {
+        return ejected_until.load(std::memory_order_relaxed) > now;
+    }
+};
+
+struct UpstreamGroup {
+    ServerState *select(std::string_view key);
+    ServerState *select_random(const std::vector<ServerState *> &v);
+    ServerState *select_round_robin(const std::vector<ServerState *> &v);
+    ServerState *select_hash(std::string_view key, int64_t now, bool skip);
+    ServerState *select_least(const std::vector<ServerState *> &v);
+
+    void build_ring();
+
+    UpstreamParams params;
+
+    std::mutex mtx;
+    std::vector<ServerState *> servers;
+    std::vector<std::pair<uint64_t, ServerState *>> ring;
+
+    // The in-flight requests refer to the servers, so the removed ones are
+    // kept until the process exits.
+    std::vector<std::unique_ptr<ServerState>> owned;
+};
+
+ServerState *UpstreamGroup::select(std::string_view key) {
+    std::lock_guard<std::mutex> lg(mtx);
+    std::vector<ServerState *> healthy;
+    int64_t now = steady_now_ms();
+
+    if (servers.empty())
+        return nullptr;
+
+    healthy.reserve(servers.size());
+    for (ServerState *s : servers) {
+        if (!s->ejected(now))
+            healthy.push_back(s);
+    }
+
+    // All the replicas are ejected, select as if none is
+    bool panic = healthy.empty();
+    if (panic)
+        healthy = servers;
+
+    switch (params.policy) {
+    case UpstreamPolicy::ROUND_ROBIN:
+        return select_round_robin(healthy);
+    case UpstreamPolicy::CONSISTENT_HASH:
+        if (key.empty())
+            return select_round_robin(healthy);
+        return select_hash(key, now, !panic);
+    case UpstreamPolicy::LEAST_INFLIGHT:
+        return select_least(healthy);
+    default:
+        return select_random(healthy);
+    }
+}
+
+ServerState *
+UpstreamGroup::select_random(const std::vector<ServerState *> &v) {
+    uint64_t sum = 0;
+    for (ServerState *s : v)
+        sum += s->weight;
+
+    uint64_t r = rand_range(sum);
+    for (ServerState *s : v) {
+        if (r < s->weight)
+            return s;
+        r -= s->weight;
+    }
+
+    return v.back();
+}
+
+ServerState *
+UpstreamGroup::select_round_robin(const std::vector<ServerState *> &v) {
+    ServerState *best = nullptr;
+    long long total = 0;
+
+    for (ServerState *s : v) {
+        s->current_weight += s->weight;
+        total += s->weight;
+
+        if (!best || s->current_weight > best->current_weight)
+            best = s;
+    }
+
+    best->current_weight -= total;
+    return best;
+}
+
+ServerState *
+UpstreamGroup::select_hash(std::string_view key, int64_t now, bool skip) {
+    uint64_t h = hash_key(key);
+    auto it = std::lower_bound(ring.begin(), ring.end(),
+                               std::make_pair(h, (ServerState *)nullptr));
+
+    // Walk clockwise to the first healthy replica
+    for (std::size_t i = 0; i < ring.size(); i++, it++) {
+        if (it == ring.end())
+            it = ring.begin();
+
+        if (!skip || !it->second->ejected(now))
+            return it->second;
+    }
+
+    return ring.front().second;
+}
+
+ServerState *
+UpstreamGroup::select_least(const std::vector<ServerState *> &v) {
+    // Start from a random position, so that ties are broken randomly
+    std::size_t n = v.size();
+    std::size_t start = rand_range(n);
+    ServerState *best = nullptr;
+    uint64_t best_load = 0;
+
+    for (std::size_t i = 0; i < n; i++) {
+        ServerState *s = v[(start + i) % n];
+        uint64_t inflight = s->inflight.load(std::memory_order_relaxed);
+
+        // Compare inflight[s] / weight[s] < inflight[best] / weight[best]
+        if (!best || inflight * best->weight < best_load * s->weight) {
+            best = s;
+            best_load = inflight;
+        }
+    }
+
+    return best;
+}
+
+void UpstreamGroup::build_ring() {
+    ring.clear();
+
+    for (ServerState *s : servers) {
+        for (unsigned int i = 0; i < s->weight * VIRTUAL_NODES; i++)
+            ring.emplace_back(hash_key(s->address, i + 1), s);
+    }
+
+    std::sort(ring.begin(), ring.end());
+}
+
+class UpstreamRegistry {
+public:
+    static UpstreamRegistry &get_instance() {
+        static UpstreamRegistry registry;
+        return registry;
+    }
+
+    UpstreamGroup *find(std::string_view name) {
+        if (count.load(std::memory_order_acquire) == 0)
+            return nullptr;
+
+        std::lock_guard<std::mutex> lg(mtx);
+        auto it = groups.find(name);
+        return it == groups.end() ? nullptr : it->second.get();
+    }
+
+    int create(const std::string &name, const UpstreamParams &params) {
+        std::lock_guard<std::mutex> lg(mtx);
+        if (groups.contains(name))
+            return -1;
+
+        auto group = std::make_unique<UpstreamGroup>();
+        group->params = params;
+        groups.emplace(name, std::move(group));
+        count.fetch_add(1, std::memory_order_release);
+        return 0;
+    }
+
+    int remove(const std::string &name) {
+        std::lock_guard<std::mutex> lg(mtx);
+        auto it = groups.find(name);
+        if (it == groups.end())
+            return -1;
+
+        deleted.push_back(std::move(it->second));
+        groups.erase(it);
+        count.fetch_sub(1, std::memory_order_release);
+        return 0;
+    }
+
+private:
+    std::atomic<std::size_t> count{0};
+    std::mutex mtx;
+    std::map<std::string, std::unique_ptr<UpstreamGroup>, std::less<>> groups;
+
+    // See UpstreamGroup::owned
+    std::vector<std::unique_ptr<UpstreamGroup>> deleted;
+};
+
+} // namespace
+
+int upstream_create(const std::string &name, const UpstreamParams &params) {
+    return UpstreamRegistry::get_instance().create(name, params);
+}
+
+int upstream_delete(const std::string &name) {
+    return UpstreamRegistry::get_instance().remove(name);
+}
+
+int upstream_add_server(const std::string &name, const UpstreamServer &server) {
+    UpstreamGroup *group = UpstreamRegistry::get_instance().find(name);
+    if (!group || server.weight == 0)
+        return -1;
+
+    std::lock_guard<std::mutex> lg(group->mtx);
+    for (ServerState *s : group->servers) {
+        if (s->address == server.address)
+            return -1;
+    }
+
+    auto s = std::make_unique<ServerState>();
+    s->address = server.address;
+    s->weight = server.weight;
+    s->group = group;
+
+    group->servers.push_back(s.get());
+    group->owned.push_back(std::move(s));
+    group->build_ring();
+    return 0;
+}
+
+int upstream_remove_server(const std::string &name,
+                           const std::string &address) {
+    UpstreamGroup *group = UpstreamRegistry::get_instance().find(name);
+    if (!group)
+        return -1;
+
+    std::lock_guard<std::mutex> lg(group->mtx);
+    auto &servers = group->servers;
+    auto it = std::find_if(servers.begin(), servers.end(),
+        [&](ServerState *s) { return s->address == address; });
+
+    if (it == servers.end())
+        return -1;
+
+    servers.erase(it);
+    group->build_ring();
+    return 0;
+}
+
+bool get_upstream_stats(const std::string &name,
+                        std::vector<UpstreamServerStats> &stats) {
+    UpstreamGroup *group = UpstreamRegistry::get_instance().find(name);
+    if (!group)
+        return false;
+
+    std::lock_guard<std::mutex> lg(group->mtx);
+    int64_t now = steady_now_ms();
+
+    stats.clear();
+    for (ServerState *s : group->servers) {
+        UpstreamServerStats &st = stats.emplace_back();
+        st.address = s->address;
+        st.weight = s->weight;
+        st.ejected = s->ejected(now);
+        st.inflight = s->inflight.load(std::memory_order_relaxed);
+        st.total = s->total.load(std::memory_order_relaxed);
+        st.failed = s->failed.load(std::memory_order_relaxed);
+    }
+
+    return true;
+}
+
+namespace detail {
+
+bool upstream_select(std::string_view name, std::string_view key,
+                     UpstreamSelection &sel) {
+    UpstreamGroup *group = UpstreamRegistry::get_instance().find(name);
+    if (!group)
+        return false;
+
+    ServerState *s = group->select(key);
+    if (!s)
+        return false;
+
+    s->inflight.fetch_add(1, std::memory_order_relaxed);
+    s->total.fetch_add(1, std::memory_order_relaxed);
+
+    sel.address = s->address;
+    sel.server = s;
+    return true;
+}
+
+void upstream_finish(void *server, int state) noexcept {
+    ServerState *s = static_cast<ServerState *>(server);
+    const UpstreamParams &params = s->group->params;
+
+    s->inflight.fetch_sub(1, std::memory_order_relaxed);
+
+    if (state == STATE_SUCCESS) {
+        s->continuous_fails.store(0, std::memory_order_relaxed);
+        return;
+    }
+
+    s->failed.fetch_add(1, std::memory_order_relaxed);
+
+    unsigned int fails = s->continuous_fails.fetch_add(1) + 1;
+    if (params.max_fails != 0 && fails >= params.max_fails) {
+        s->continuous_fails.store(0, std::memory_order_relaxed);
+        s->ejected_until.store(steady_now_ms() + params.eject_timeout,
+                               std::memory_order_relaxed);
+    }
+}
+
+} // namespace detail
+
+} // namespace coke
@@ -0,0 +1,827 @@
+/**
+ * Copyright 2024 Coke Project (https://github.com/kedixa/coke)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Authors: kedixa (https://github.com/kedixa)
+*/
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <mutex>
+#include <vector>
+#include <openssl/evp.h>
+#include <openssl/sha.h>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "coke/http/http_utils.h"
+#include "coke/http/websocket.h"
+
+namespace coke {
+
+namespace {
+
+constexpr char WS_GUID[] = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+
+// Payloads not larger than it are copied after the header and pushed once
+constexpr std::size_t WS_INLINE_PAYLOAD = 512;
+
+// Size classes of the buffer pool are 4KB, 8KB, ... 1MB
+constexpr std::size_t WS_BUFFER_MIN_SHIFT = 12;
+constexpr std::size_t WS_BUFFER_CLASS_NUM = 9;
+constexpr std::size_t WS_BUFFER_MAX_SIZE =
+    std::size_t(1) << (WS_BUFFER_MIN_SHIFT + WS_BUFFER_CLASS_NUM - 1);
+
+// Each class caches at most this many bytes of idle buffers
+constexpr std::size_t WS_BUFFER_CACHE_BYTES = 4 * 1024 * 1024;
+
+struct BufferClass {
+    std::mutex mtx;
+    std::vector<char *> bufs;
+};
+
+class BufferPool {
+public:
+    BufferPool() {
+        for (std::size_t i = 0; i < WS_BUFFER_CLASS_NUM; i++)
+            classes[i].bufs.reserve(WS_BUFFER_CACHE_BYTES / class_size(i));
+    }
+
+    ~BufferPool() {
+        for (BufferClass &c : classes) {
+            for (char *buf : c.bufs)
+                delete[] buf;
+        }
+    }
+
+    char *alloc(std::size_t &cap) {
+        std::size_t idx = class_index(cap);
+
+        if (idx >= WS_BUFFER_CLASS_NUM) {
+            misses.fetch_add(1, std::memory_order_relaxed);
+            return new char[cap];
+        }
+
+        cap = class_size(idx);
+
+        BufferClass &c = classes[idx];
+        {
+            std::lock_guard<std::mutex> lg(c.mtx);
+            if (!c.bufs.empty()) {
+                char *buf = c.bufs.back();
+                c.bufs.pop_back();
+                hits.fetch_add(1, std::memory_order_relaxed);
+                return buf;
+            }
+        }
+
+        misses.fetch_add(1, std::memory_order_relaxed);
+        return new char[cap];
+    }
+
+    void free(char *buf, std::size_t cap) noexcept {
+        std::size_t idx = class_index(cap);
+
+        if (idx < WS_BUFFER_CLASS_NUM && class_size(idx) == cap) {
+            BufferClass &c = classes[idx];
+            std::lock_guard<std::mutex> lg(c.mtx);
+
+            if ((c.bufs.size() + 1) * cap <= WS_BUFFER_CACHE_BYTES) {
+                // Capacity is reserved in advance, push_back never throws
+                c.bufs.push_back(buf);
+                return;
+            }
+        }
+
+        delete[] buf;
+    }
+
+    WebSocketBufferStats get_stats() const noexcept {
+        WebSocketBufferStats stats;
+        stats.hits = hits.load(std::memory_order_relaxed);
+        stats.misses = misses.load(std::memory_order_relaxed);
+        return stats;
+    }
+
+private:
+    static std::size_t class_size(std::size_t idx) noexcept {
+        return std::size_t(1) << (WS_BUFFER_MIN_SHIFT + idx);
+    }
+
+    static std::size_t class_index(std::size_t size) noexcept {
+        if (size > WS_BUFFER_MAX_SIZE)
+            return WS_BUFFER_CLASS_NUM;
+
+        std::size_t idx = 0;
+        while (class_size(idx) < size)
+            idx++;
+
+        return idx;
+    }
+
+private:
+    std::array<BufferClass, WS_BUFFER_CLASS_NUM> classes;
+    std::atomic<std::size_t> hits{0};
+    std::atomic<std::size_t> misses{0};
+};
+
+BufferPool &get_buffer_pool() {
+    static BufferPool pool;
+    return pool;
+}
+
+uint64_t load_be(const char *p, std::size_t n) {
+    uint64_t v = 0;
+    for (std::size_t i = 0; i < n; i++)
+        v = (v << 8) | (unsigned char)p[i];
+    return v;
+}
+
+bool is_control(int opcode) {
+    return opcode >= WS_OPCODE_CLOSE;
+}
+
+/**
+ * @brief Whether the comma separated header value contains `token`, the
+ *        tokens are compared case-insensitively.
+*/
+bool has_token(std::string_view value, std::string_view token) {
+    while (!value.empty()) {
+        std::size_t pos = value.find(',');
+        std::string_view item = value.substr(0, pos);
+
+        while (!item.empty() && (item.front() == ' ' || item.front() == '\t'))
+            item.remove_prefix(1);
+        while (!item.empty() && (item.back() == ' ' || item.back() == '\t'))
+            item.remove_suffix(1);
+
+        if (http_name_equal(item, token))
+            return true;
+
+        if (pos == std::string_view::npos)
+            break;
+
+        value.remove_prefix(pos + 1);
+    }
+
+    return false;
+}
+
+/**
+ * @brief Check the upgrade request, see RFC 6455 section 4.2.1.
+ *
+ * @return 0 and the Sec-WebSocket-Key in `key` if it is valid, or the status
+ *         code to reply.
+*/
+int check_upgrade(const HttpRequest &req, std::string_view &key) {
+    HttpHeaderIndex index(req);
+    const char *method = req.get_method();
+
+    if (!method || strcmp(method, "GET") != 0)
+        return 400;
+
+    if (!has_token(index.get("Upgrade"), "websocket") ||
+        !has_token(index.get("Connection"), "Upgrade"))
+        return 400;
+
+    if (index.get("Sec-WebSocket-Version") != "13")
+        return 426;
+
+    key = index.get("Sec-WebSocket-Key");
+    return key.empty() ? 400 : 0;
+}
+
+} // namespace
+
+void websocket_mask(void *data, std::size_t len, uint32_t key,
+                    std::size_t offset) noexcept {
+    unsigned char *p = static_cast<unsigned char *>(data);
+    unsigned char k[4], rk[4];
+    uint32_t rkey;
+    uint64_t rkey8;
+    std::size_t i = 0;
+
+    // Rotate the key so that p[0] is masked by rk[0], then every 4 bytes
+    // share the same key bytes
+    std::memcpy(k, &key, 4);
+    for (std::size_t j = 0; j < 4; j++)
+        rk[j] = k[(offset + j) & 3];
+
+    std::memcpy(&rkey, rk, 4);
+
+#if defined(__AVX2__)
+    __m256i m32 = _mm256_set1_epi32((int)rkey);
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(p + i));
+        _mm256_storeu_si256((__m256i *)(p + i), _mm256_xor_si256(v, m32));
+    }
+#endif
+
+#if defined(__SSE2__)
+    __m128i m16 = _mm_set1_epi32((int)rkey);
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+        _mm_storeu_si128((__m128i *)(p + i), _mm_xor_si128(v, m16));
+    }
+#elif defined(__ARM_NEON)
+    uint8x16_t m16 = vreinterpretq_u8_u32(vdupq_n_u32(rkey));
+    for (; i + 16 <= len; i += 16)
+        vst1q_u8(p + i, veorq_u8(vld1q_u8(p + i), m16));
+#endif
+
+    rkey8 = ((uint64_t)rkey << 32) | rkey;
+    for (; i + 8 <= len; i += 8) {
+        uint64_t v;
+        std::memcpy(&v, p + i, 8);
+        v ^= rkey8;
+        std::memcpy(p + i, &v, 8);
+    }
+
+    for (; i < len; i++)
+        p[i] ^= rk[i & 3];
+}
+
+std::string websocket_accept_key(std::string_view key) {
+    unsigned char digest[SHA_DIGEST_LENGTH];
+    unsigned char out[32];
+    std::string str;
+
+    str.reserve(key.size() + sizeof(WS_GUID));
+    str.append(key).append(WS_GUID);
+
+    SHA1((const unsigned char *)str.data(), str.size(), digest);
+    int len = EVP_EncodeBlock(out, digest, SHA_DIGEST_LENGTH);
+
+    return std::string((const char *)out, (std::size_t)len);
+}
+
+std::size_t websocket_frame_header(char *buf, int opcode, bool fin,
+                                   uint64_t len,
+                                   const uint32_t *key) noexcept {
+    unsigned char *p = (unsigned char *)buf;
+    unsigned char mask_bit = key ? 0x80 : 0;
+    std::size_t n = 2;
+
+    p[0] = (unsigned char)((fin ? 0x80 : 0) | (opcode & 0x0F));
+
+    if (len < 126)
+        p[1] = (unsigned char)(mask_bit | len);
+    else if (len <= 0xFFFF) {
+        p[1] = mask_bit | 126;
+        p[2] = (unsigned char)(len >> 8);
+        p[3] = (unsigned char)len;
+        n = 4;
+    }
+    else {
+        p[1] = mask_bit | 127;
+        for (int i = 0; i < 8; i++)
+            p[2 + i] = (unsigned char)(len >> (56 - 8 * i));
+        n = 10;
+    }
+
+    if (key) {
+        std::memcpy(p + n, key, 4);
+        n += 4;
+    }
+
+    return n;
+}
+
+WebSocketBufferStats get_websocket_buffer_stats() noexcept {
+    return get_buffer_pool().get_stats();
+}
+
+namespace detail {
+
+char *websocket_buffer_alloc(std::size_t &cap) {
+    return get_buffer_pool().alloc(cap);
+}
+
+void websocket_buffer_free(char *buf, std::size_t cap) noexcept {
+    get_buffer_pool().free(buf, cap);
+}
+
+} // namespace detail
+
+uint16_t WebSocketMessage::get_close_code() const noexcept {
+    if (len < 2)
+        return WS_CLOSE_NO_STATUS;
+
+    return (uint16_t)load_be(buf, 2);
+}
+
+char *WebSocketMessage::prepare(std::size_t n) {
+    if (cap - len < n) {
+        std::size_t new_cap = std::max(len + n, cap * 2);
+        char *new_buf = detail::websocket_buffer_alloc(new_cap);
+
+        if (len > 0)
+            std::memcpy(new_buf, buf, len);
+
+        if (buf)
+            detail::websocket_buffer_free(buf, cap);
+
+        buf = new_buf;
+        cap = new_cap;
+    }
+
+    return buf + len;
+}
+
+void WebSocketMessage::append(const char *data, std::size_t n) {
+    if (n > 0) {
+        std::memcpy(prepare(n), data, n);
+        len += n;
+    }
+}
+
+int WebSocketParser::parse_header() {
+    const unsigned char *p = (const unsigned char *)header;
+    bool masked = (p[1] & 0x80) != 0;
+    std::size_t len7 = p[1] & 0x7F;
+
+    if (header_need == 2) {
+        header_need += (len7 == 126 ? 2 : (len7 == 127 ? 8 : 0));
+        header_need += masked ? 4 : 0;
+
+        if (header_need > 2)
+            return 0;
+    }
+
+    // Extensions are not negotiated, so the reserved bits must be zero
+    if (p[0] & 0x70)
+        return -EBADMSG;
+
+    frame_fin = (p[0] & 0x80) != 0;
+    frame_opcode = p[0] & 0x0F;
+    frame_masked = masked;
+
+    if (require_mask && !masked)
+        return -EBADMSG;
+
+    std::size_t pos = 2;
+    if (len7 == 126) {
+        payload_len = load_be(header + 2, 2);
+        pos = 4;
+    }
+    else if (len7 == 127) {
+        payload_len = load_be(header + 2, 8);
+        pos = 10;
+
+        if (payload_len >> 63)
+            return -EBADMSG;
+    }
+    else
+        payload_len = len7;
+
+    if (masked)
+        std::memcpy(&frame_key, header + pos, 4);
+
+    switch (frame_opcode) {
+    case WS_OPCODE_CONTINUATION:
+        if (!in_fragment)
+            return -EBADMSG;
+        break;
+
+    case WS_OPCODE_TEXT:
+    case WS_OPCODE_BINARY:
+        if (in_fragment)
+            return -EBADMSG;
+
+        data_msg.clear();
+        data_msg.set_opcode(frame_opcode);
+        break;
+
+    case WS_OPCODE_CLOSE:
+    case WS_OPCODE_PING:
+    case WS_OPCODE_PONG:
+        if (!frame_fin || payload_len > WS_MAX_CONTROL_SIZE ||
+            (frame_opcode == WS_OPCODE_CLOSE && payload_len == 1))
+            return -EBADMSG;
+
+        control_msg.clear();
+        control_msg.set_opcode(frame_opcode);
+        break;
+
+    default:
+        return -EBADMSG;
+    }
+
+    if (!is_control(frame_opcode)) {
+        if (payload_len > max_size - std::min(max_size, data_msg.size()))
+            return -EMSGSIZE;
+
+        // Make room for the whole frame once
+        if (payload_len > 0)
+            data_msg.prepare((std::size_t)payload_len);
+    }
+
+    payload_got = 0;
+    return 1;
+}
+
+int WebSocketParser::append(const void *buf, std::size_t *size) {
+    const char *p = static_cast<const char *>(buf);
+    std::size_t left = *size;
+    int ret;
+
+    completed = 0;
+
+    while (true) {
+        if (header_got < header_need) {
+            std::size_t n = std::min(left, header_need - header_got);
+            std::memcpy(header + header_got, p, n);
+            header_got += n;
+            p += n;
+            left -= n;
+
+            if (header_got < header_need)
+                return 0;
+
+            ret = parse_header();
+            if (ret < 0)
+                return ret;
+            else if (ret == 0)
+                continue;
+        }
+
+        WebSocketMessage &msg = is_control(frame_opcode) ? control_msg
+                                                         : data_msg;
+        uint64_t rest = payload_len - payload_got;
+        std::size_t n = (std::size_t)std::min<uint64_t>(left, rest);
+
+        if (n > 0) {
+            char *dst = msg.prepare(n);
+            std::memcpy(dst, p, n);
+
+            if (frame_masked)
+                websocket_mask(dst, n, frame_key, (std::size_t)payload_got);
+
+            msg.commit(n);
+            payload_got += n;
+            p += n;
+            left -= n;
+        }
+
+        if (payload_got < payload_len)
+            return 0;
+
+        // The frame is complete, prepare for the next header
+        header_got = 0;
+        header_need = 2;
+
+        if (is_control(frame_opcode)) {
+            completed = frame_opcode;
+            break;
+        }
+        else if (frame_fin) {
+            in_fragment = false;
+            completed = data_msg.get_opcode();
+            break;
+        }
+
+        in_fragment = true;
+        if (left == 0)
+            return 0;
+    }
+
+    *size -= left;
+    return 1;
+}
+
+void WebSocketParser::take(WebSocketMessage &msg) noexcept {
+    if (is_control(completed))
+        msg = std::move(control_msg);
+    else if (completed != 0)
+        msg = std::move(data_msg);
+
+    completed = 0;
+}
+
+namespace detail {
+
+void WebSocketState::fail(uint16_t code) noexcept {
+    stopped = true;
+    error_code.store(code, std::memory_order_release);
+    que.close();
+}
+
+int WebSocketState::append(const void *buf, std::size_t *size) {
+    const char *p = static_cast<const char *>(buf);
+    std::size_t left = *size;
+
+    while (left > 0 && !stopped) {
+        std::size_t n = left;
+        int ret = parser.append(p, &n);
+
+        if (ret < 0) {
+            fail(ret == -EMSGSIZE ? WS_CLOSE_TOO_BIG : WS_CLOSE_PROTOCOL_ERROR);
+            break;
+        }
+
+        p += n;
+        left -= n;
+
+        if (ret == 0)
+            break;
+
+        WebSocketMessage msg;
+        parser.take(msg);
+
+        bool is_close = (msg.get_opcode() == WS_OPCODE_CLOSE);
+        if (!que.try_push(std::move(msg))) {
+            fail(WS_CLOSE_POLICY_VIOLATION);
+            break;
+        }
+
+        // Nothing is accepted after the close frame
+        if (is_close) {
+            stopped = true;
+            que.close();
+        }
+    }
+
+    // The request never completes, the rest of the data is dropped
+    return 0;
+}
+
+void WebSocketState::shutdown() noexcept {
+    if (!que.closed())
+        que.close();
+}
+
+int WebSocketServerRequest::append(const void *buf, size_t *size) {
+    if (!checked) {
+        using DataType = ConnectionData<std::shared_ptr<WebSocketState>>;
+
+        checked = true;
+        if (conn) {
+            auto *base = static_cast<ConnectionDataBase *>(conn->get_context());
+            auto *data = dynamic_cast<DataType *>(base);
+
+            if (data)
+                state = data->value;
+        }
+    }
+
+    if (state)
+        return state->append(buf, size);
+
+    return protocol::HttpRequest::append(buf, size);
+}
+
+} // namespace detail
+
+Task<int> WebSocketConnection::push(std::string_view data) {
+    using std::chrono::milliseconds;
+    constexpr milliseconds max_backoff(32);
+
+    auto *task = ctx.get_task();
+    int timeout = params.send_timeout;
+    auto deadline = std::chrono::steady_clock::now() + milliseconds(timeout);
+    milliseconds backoff(1);
+
+    while (!data.empty()) {
+        int ret = task->push(data.data(), data.size());
+
+        if (ret > 0) {
+            data.remove_prefix((std::size_t)ret);
+            backoff = milliseconds(1);
+            continue;
+        }
+
+        if (ret < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+            co_return -errno;
+
+        // The send buffer is full, the peer is slower than us. There is no
+        // writable notification for server task, so poll with backoff.
+        if (timeout >= 0 && std::chrono::steady_clock::now() >= deadline)
+            co_return -ETIMEDOUT;
+
+        co_await coke::sleep(backoff);
+        backoff = std::min(backoff * 2, max_backoff);
+    }
+
+    co_return 0;
+}
+
+Task<int> WebSocketConnection::send_locked(int opcode, std::string_view data) {
+    char buf[WS_MAX_HEADER_SIZE + WS_INLINE_PAYLOAD];
+    std::size_t n;
+
+    if (error != 0)
+        co_return error;
+
+    if (close_sent)
+        co_return -EPIPE;
+
+    n = websocket_frame_header(buf, opcode, true, data.size());
+
+    if (data.size() <= WS_INLINE_PAYLOAD) {
+        if (!data.empty())
+            std::memcpy(buf + n, data.data(), data.size());
+
+        error = co_await push(std::string_view(buf, n + data.size()));
+    }
+    else {
+        error = co_await push(std::string_view(buf, n));
+
+        if (error == 0)
+            error = co_await push(data);
+    }
+
+    if (opcode == WS_OPCODE_CLOSE)
+        close_sent = true;
+
+    co_return error;
+}
+
+Task<int> WebSocketConnection::send(int opcode, std::string_view data) {
+    if (is_control(opcode) && data.size() > WS_MAX_CONTROL_SIZE)
+        co_return -EINVAL;
+
+    if (opcode == WS_OPCODE_CONTINUATION || (opcode > WS_OPCODE_BINARY &&
+                                             !is_control(opcode)))
+        co_return -EINVAL;
+
+    co_await send_mtx.lock();
+    int ret = co_await send_locked(opcode, data);
+    send_mtx.unlock();
+
+    co_return ret;
+}
+
+Task<int> WebSocketConnection::close(uint16_t code, std::string_view reason) {
+    char payload[WS_MAX_CONTROL_SIZE];
+
+    if (reason.size() > WS_MAX_CONTROL_SIZE - 2)
+        co_return -EINVAL;
+
+    payload[0] = (char)(code >> 8);
+    payload[1] = (char)(code & 0xFF);
+    std::memcpy(payload + 2, reason.data(), reason.size());
+
+    co_return co_await send(WS_OPCODE_CLOSE,
+                            std::string_view(payload, reason.size() + 2));
+}
+
+Task<int> WebSocketConnection::receive_impl(WebSocketMessage &msg,
+                                            detail::TimedWaitHelper helper) {
+    Queue<WebSocketMessage> &que = state->get_queue();
+    int ret;
+
+    while (true) {
+        if (close_code != 0)
+            co_return TOP_CLOSED;
+
+        if (helper.infinite())
+            ret = co_await que.pop(msg);
+        else
+            ret = co_await que.try_pop_until(helper.deadline(), msg);
+
+        if (ret == TOP_CLOSED) {
+            // The stream is broken or the connection is closed
+            uint16_t code = state->get_error_code();
+
+            if (code != 0 && !close_sent)
+                co_await close(code);
+
+            close_code = WS_CLOSE_ABNORMAL;
+            co_return TOP_CLOSED;
+        }
+        else if (ret != TOP_SUCCESS)
+            co_return ret;
+
+        if (msg.get_opcode() == WS_OPCODE_CLOSE) {
+            close_code = msg.get_close_code();
+
+            // Echo the status code, see RFC 6455 section 5.5.1
+            if (!close_sent) {
+                if (close_code == WS_CLOSE_NO_STATUS)
+                    co_await send(WS_OPCODE_CLOSE, {});
+                else
+                    co_await send(WS_OPCODE_CLOSE, msg.view().substr(0, 2));
+            }
+
+            co_return TOP_CLOSED;
+        }
+
+        if (msg.get_opcode() == WS_OPCODE_PING && params.auto_pong) {
+            co_await send(WS_OPCODE_PONG, msg.view());
+            continue;
+        }
+
+        co_return TOP_SUCCESS;
+    }
+}
+
+Task<int> WebSocketConnection::handshake(const std::string &accept) {
+    std::string head;
+
+    head.append("HTTP/1.1 101 Switching Protocols\r\n")
+        .append("Upgrade: websocket\r\n")
+        .append("Connection: Upgrade\r\n")
+        .append("Sec-WebSocket-Accept: ").append(accept).append("\r\n\r\n");
+
+    error = co_await push(head);
+    co_return error;
+}
+
+Task<> WebSocketConnection::finish() {
+    if (error == 0 && !close_sent)
+        co_await close(WS_CLOSE_NORMAL);
+
+    // Close the connection after the context finishes, the request parsing
+    // the frames is destroyed at that time and wakes up the receivers
+    ctx.get_task()->set_keep_alive(0);
+    co_await ctx.noreply();
+}
+
+CommSession *WebSocketServer::new_session(long long seq, CommConnection *conn) {
+    CommSession *session = BaseType::new_session(seq, conn);
+
+    if (session) {
+        TaskType *task = static_cast<TaskType *>(session);
+        task->get_req()->set_connection(static_cast<WFConnection *>(conn));
+    }
+
+    return session;
+}
+
+void WebSocketServer::do_reject(TaskType *task) {
+    HttpResponse *resp = task->get_resp();
+
+    resp->set_http_version("HTTP/1.1");
+    resp->set_status_code("503");
+    resp->set_reason_phrase("Service Unavailable");
+    resp->set_header_pair("Retry-After", "1");
+    resp->set_header_pair("Content-Length", "0");
+}
+
+Task<> WebSocketServer::handle(ServerContextType ctx) {
+    using DataType = detail::ConnectionData<
+        std::shared_ptr<detail::WebSocketState>
+    >;
+
+    HttpResponse &resp = ctx.get_resp();
+    std::string_view key;
+    int status = check_upgrade(ctx.get_req(), key);
+    void *old = nullptr;
+
+    auto state = std::make_shared<detail::WebSocketState>(ws_params);
+
+    if (status == 0) {
+        WFConnection *conn = ctx.get_task()->get_connection();
+        DataType *data = new DataType(state);
+
+        old = conn->test_set_context(nullptr, data,
+                                     detail::delete_connection_data);
+        if (old) {
+            delete data;
+            status = 500;
+        }
+    }
+
+    if (status != 0) {
+        resp.set_http_version("HTTP/1.1");
+        resp.set_status_code(std::to_string(status));
+        resp.set_reason_phrase(status == 426 ? "Upgrade Required"
+                                             : (status == 500
+                                                ? "Internal Server Error"
+                                                : "Bad Request"));
+        if (status == 426)
+            resp.set_header_pair("Sec-WebSocket-Version", "13");
+
+        resp.set_header_pair("Content-Length", "0");
+        co_await ctx.reply();
+        co_return;
+    }
+
+    std::string accept = websocket_accept_key(key);
+    WebSocketConnection ws(ctx, std::move(state), ws_params);
+
+    if (co_await ws.handshake(accept) == 0)
+        co_await ws_proc(ws);
+
+    co_await ws.finish();
+}
+
+} // namespace coke
@@ -0,0 +1,173 @@
+/**
+ * Copyright 2024 Coke Project (https://github.com/kedixa/coke)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Authors: kedixa (https://github.com/kedixa)
+*/
+
+#include <algorithm>
+#include <cerrno>
+
+#include "coke/http/websocket_client.h"
+#include "coke/basic_awaiter.h"
+
+namespace coke {
+
+class WebSocketTaskAwaiter : public BasicAwaiter<int> {
+public:
+    template<typename F>
+    explicit WebSocketTaskAwaiter(F &&create) {
+        auto cb = [info = this->get_info()] (WFWebSocketTask *task) {
+            auto *awaiter = info->get_awaiter<WebSocketTaskAwaiter>();
+            int ret = 0;
+
+            if (task->get_state() != STATE_SUCCESS)
+                ret = task->get_error() ? -task->get_error() : -EPIPE;
+
+            awaiter->emplace_result(ret);
+            awaiter->done();
+        };
+
+        task = std::forward<F>(create)(std::move(cb));
+        set_task(task);
+    }
+
+    WFWebSocketTask *get_task() const noexcept { return task; }
+
+private:
+    WFWebSocketTask *task;
+};
+
+WebSocketClient::WebSocketClient(const WebSocketClientParams &params)
+    : params(params),
+      que(std::max(params.receive_queue_size, std::size_t(1))),
+      client([this] (WFWebSocketTask *task) { on_frame(task); })
+{ }
+
+WebSocketClient::~WebSocketClient() {
+    if (inited)
+        client.deinit();
+}
+
+int WebSocketClient::connect(const std::string &url) {
+    WFWebSocketParams wf_params = WEBSOCKET_PARAMS_DEFAULT;
+
+    if (inited)
+        return -EALREADY;
+
+    // Workflow keeps the pointers, they live as long as this client
+    this->url = url;
+    wf_params.url = this->url.c_str();
+    wf_params.idle_timeout = params.idle_timeout;
+    wf_params.ping_interval = params.ping_interval;
+    wf_params.size_limit = params.max_message_size;
+    wf_params.random_masking_key = params.random_masking_key;
+
+    if (!params.sec_protocol.empty())
+        wf_params.sec_protocol = params.sec_protocol.c_str();
+
+    if (client.init(&wf_params) < 0)
+        return errno ? -errno : -EINVAL;
+
+    inited = true;
+    return 0;
+}
+
+Task<int> WebSocketClient::send(int opcode, std::string_view data) {
+    if (!inited)
+        co_return -ENOTCONN;
+
+    if (opcode >= WS_OPCODE_CLOSE && data.size() > WS_MAX_CONTROL_SIZE)
+        co_return -EINVAL;
+
+    co_await send_mtx.lock();
+
+    WebSocketTaskAwaiter awaiter([this] (websocket_callback_t cb) {
+        return client.create_websocket_task(std::move(cb));
+    });
+
+    protocol::WebSocketFrame *frame = awaiter.get_task()->get_msg();
+    if (opcode == WS_OPCODE_TEXT)
+        frame->set_text_data(data.data(), data.size(), true);
+    else
+        frame->set_binary_data(data.data(), data.size(), true);
+
+    // Setting the data also changes the opcode, set it at last
+    frame->set_opcode(opcode);
+
+    int ret = co_await std::move(awaiter);
+    send_mtx.unlock();
+
+    co_return ret;
+}
+
+Task<int> WebSocketClient::close() {
+    if (!inited)
+        co_return -ENOTCONN;
+
+    co_await send_mtx.lock();
+
+    int ret = co_await WebSocketTaskAwaiter([this] (websocket_callback_t cb) {
+        return client.create_close_task(std::move(cb));
+    });
+
+    send_mtx.unlock();
+    que.close();
+
+    co_return ret;
+}
+
+void WebSocketClient::on_frame(WFWebSocketTask *task) {
+    protocol::WebSocketFrame *frame = task->get_msg();
+    int opcode = frame->get_opcode();
+    const char *data = nullptr;
+    std::size_t size = 0;
+
+    if (opcode == WS_OPCODE_CLOSE) {
+        que.close();
+        return;
+    }
+
+    // Workflow replies the pings itself
+    if (opcode == WS_OPCODE_PING)
+        return;
+
+    frame->get_data(&data, &size);
+
+    if (opcode != WS_OPCODE_CONTINUATION) {
+        partial.clear();
+        partial.set_opcode(opcode);
+        partial_dropped = false;
+    }
+
+    if (!partial_dropped) {
+        if (size > params.max_message_size - std::min(params.max_message_size,
+                                                      partial.size()))
+            partial_dropped = true;
+        else
+            partial.append(data, size);
+    }
+
+    if (!frame->finished())
+        return;
+
+    // This is called in the handler thread, never block it
+    if (partial_dropped || !que.try_push(std::move(partial)))
+        dropped.fetch_add(1, std::memory_order_relaxed);
+
+    partial.clear();
+    partial_dropped = false;
+}
+
+} // namespace coke
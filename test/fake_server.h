@@ -0,0 +1,193 @@
+/**
+ * Copyright 2024 Coke Project (https://github.com/kedixa/coke)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Authors: kedixa (https://github.com/kedixa)
+*/
+
+#ifndef COKE_TEST_FAKE_SERVER_H
+#define COKE_TEST_FAKE_SERVER_H
+
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "coke/sleep.h"
+#include "coke/task.h"
+
+/**
+ * The loopback socket part of the fake servers in the tests. It accepts the
+ * connections in a thread, and serves each one in its own thread by `serve`,
+ * the derived classes implement only the protocol.
+ *
+ * The derived class must call `stop` in its destructor, before the members
+ * used by `serve` are destroyed.
+*/
+class FakeServer {
+public:
+    FakeServer() = default;
+    virtual ~FakeServer() { stop(); }
+
+    FakeServer(const FakeServer &) = delete;
+    FakeServer &operator= (const FakeServer &) = delete;
+
+    // Listen on a random port of localhost, return the port or -1
+    int start() {
+        sockaddr_in addr{};
+        socklen_t len = sizeof(addr);
+
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = 0;
+
+        listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (listen_fd < 0 || bind(listen_fd, (sockaddr *)&addr, len) != 0 ||
+            listen(listen_fd, 64) != 0 ||
+            getsockname(listen_fd, (sockaddr *)&addr, &len) != 0)
+            return -1;
+
+        acceptor = std::thread([this] { accept_loop(); });
+        return ntohs(addr.sin_port);
+    }
+
+    void stop() {
+        if (listen_fd < 0)
+            return;
+
+        shutdown(listen_fd, SHUT_RDWR);
+        acceptor.join();
+        close(listen_fd);
+        listen_fd = -1;
+
+        close_connections();
+
+        std::vector<std::thread> ths;
+        {
+            std::lock_guard<std::mutex> lg(mtx);
+            ths.swap(workers);
+        }
+
+        for (std::thread &th : ths)
+            th.join();
+    }
+
+    // Close all the connections, the clients see them broken
+    void close_connections() {
+        std::lock_guard<std::mutex> lg(mtx);
+        for (int fd : conns)
+            shutdown(fd, SHUT_RDWR);
+    }
+
+    // The number of connections accepted since started
+    std::size_t connections() {
+        std::lock_guard<std::mutex> lg(mtx);
+        return total_conns;
+    }
+
+    // The number of connections not closed yet
+    std::size_t active_connections() {
+        std::lock_guard<std::mutex> lg(mtx);
+        return conns.size();
+    }
+
+protected:
+    /**
+     * Serve the connection `fd` until it is closed by either side, it is
+     * called in a thread for each connection, and the fd is closed after it
+     * returns.
+    */
+    virtual void serve(int fd) = 0;
+
+    static bool recv_all(int fd, char *buf, std::size_t size) {
+        std::size_t pos = 0;
+        ssize_t n;
+
+        while (pos < size) {
+            n = recv(fd, buf + pos, size - pos, 0);
+            if (n <= 0)
+                return false;
+
+            pos += (std::size_t)n;
+        }
+
+        return true;
+    }
+
+    static void send_all(int fd, const std::string &data) {
+        std::size_t pos = 0;
+        ssize_t n;
+
+        while (pos < data.size()) {
+            n = send(fd, data.data() + pos, data.size() - pos, MSG_NOSIGNAL);
+            if (n <= 0)
+                return;
+
+            pos += (std::size_t)n;
+        }
+    }
+
+protected:
+    // Protects the connections, and the states of the derived classes
+    std::mutex mtx;
+
+private:
+    void accept_loop() {
+        int fd;
+
+        while ((fd = accept(listen_fd, nullptr, nullptr)) >= 0) {
+            std::lock_guard<std::mutex> lg(mtx);
+            conns.insert(fd);
+            ++total_conns;
+
+            workers.emplace_back([this, fd] {
+                serve(fd);
+
+                std::lock_guard<std::mutex> lg(mtx);
+                conns.erase(fd);
+                close(fd);
+            });
+        }
+    }
+
+private:
+    int listen_fd{-1};
+    std::thread acceptor;
+
+    std::set<int> conns;
+    std::vector<std::thread> workers;
+    std::size_t total_conns{0};
+};
+
+// Poll `pred` until it is true, give up after about two seconds
+inline coke::Task<bool> wait_until(std::function<bool ()> pred) {
+    for (int i = 0; i < 200; i++) {
+        if (pred())
+            co_return true;
+
+        co_await coke::sleep(std::chrono::milliseconds(10));
+    }
+
+    co_return pred();
+}
+
+#endif // COKE_TEST_FAKE_SERVER_H
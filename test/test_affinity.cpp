@@ -0,0 +1,164 @@
+/**
+ * Copyright 2024 Coke Project (https://github.com/kedixa/coke)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Authors: kedixa (https://github.com/kedixa)
+*/
+
+#include <cerrno>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <gtest/gtest.h>
+
+#include "coke/coke.h"
+
+// The first cpu the process may run on, all the pools are bound to it
+static int test_cpu = -1;
+static std::string test_cpus;
+static cpu_set_t main_set;
+
+static bool is_test_cpu_only(const cpu_set_t &set) {
+    return CPU_COUNT(&set) == 1 && CPU_ISSET(test_cpu, &set);
+}
+
+static bool current_is_test_cpu_only() {
+    cpu_set_t set;
+    if (pthread_getaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+        return false;
+
+    return is_test_cpu_only(set);
+}
+
+template<typename F>
+void run_in_thread(F &&f) {
+    std::thread th(std::forward<F>(f));
+    th.join();
+}
+
+TEST(AFFINITY, set_thread_affinity) {
+    run_in_thread([] {
+        const char *invalid[] = {
+            "", "abc", "3-1", "-1", "1-", ",", "100000", "0-100000",
+        };
+
+        for (const char *cpus : invalid) {
+            errno = 0;
+            EXPECT_EQ(coke::set_thread_affinity(cpus), -1) << cpus;
+            EXPECT_EQ(errno, EINVAL) << cpus;
+        }
+
+        errno = 0;
+        EXPECT_EQ(coke::set_thread_affinity(nullptr), -1);
+        EXPECT_EQ(errno, EINVAL);
+
+        EXPECT_EQ(coke::set_thread_affinity(test_cpus.c_str()), 0);
+        EXPECT_TRUE(current_is_test_cpu_only());
+    });
+
+    run_in_thread([] {
+        // A range, and the separators of a sysfs cpu list
+        std::string cpus = test_cpus + "-" + test_cpus + ",\n";
+        EXPECT_EQ(coke::set_thread_affinity(cpus.c_str()), 0);
+        EXPECT_TRUE(current_is_test_cpu_only());
+    });
+}
+
+TEST(AFFINITY, set_thread_numa_node) {
+    run_in_thread([] {
+        errno = 0;
+        EXPECT_EQ(coke::set_thread_numa_node(-1), -1);
+        EXPECT_EQ(errno, ENOENT);
+
+        errno = 0;
+        EXPECT_EQ(coke::set_thread_numa_node(1 << 20), -1);
+        EXPECT_EQ(errno, ENOENT);
+
+        if (access("/sys/devices/system/node/node0/cpulist", R_OK) != 0)
+            return;
+
+        // Node 0 may have no cpu that the process is allowed to use
+        if (coke::set_thread_numa_node(0) != 0) {
+            EXPECT_EQ(errno, EINVAL);
+        }
+    });
+}
+
+coke::Task<> check_pools() {
+    co_await coke::yield();
+    EXPECT_TRUE(current_is_test_cpu_only());
+
+    co_await coke::switch_go_thread();
+    EXPECT_TRUE(current_is_test_cpu_only());
+}
+
+TEST(AFFINITY, pool_binding) {
+    EXPECT_EQ(coke::get_affinity_failures(), 0);
+
+    // The handlers inherit the pollers' affinity, and the compute threads
+    // are bound explicitly
+    coke::sync_wait(check_pools());
+
+    // library_init restores the affinity of the calling thread
+    cpu_set_t set;
+    ASSERT_EQ(pthread_getaffinity_np(pthread_self(), sizeof(set), &set), 0);
+    EXPECT_TRUE(CPU_EQUAL(&set, &main_set));
+
+    // The pollers can not run a coroutine, check all the threads instead
+    DIR *dir = opendir("/proc/self/task");
+    ASSERT_NE(dir, nullptr);
+
+    int bound = 0;
+    while (struct dirent *ent = readdir(dir)) {
+        pid_t tid = (pid_t)std::atoi(ent->d_name);
+        if (tid <= 0 || tid == getpid())
+            continue;
+
+        if (sched_getaffinity(tid, sizeof(set), &set) == 0
+            && is_test_cpu_only(set))
+            ++bound;
+    }
+
+    closedir(dir);
+
+    // 2 pollers, 2 handlers and 2 compute threads
+    EXPECT_GE(bound, 6);
+}
+
+int main(int argc, char *argv[]) {
+    if (pthread_getaffinity_np(pthread_self(), sizeof(main_set), &main_set))
+        return 1;
+
+    for (int i = 0; i < CPU_SETSIZE && test_cpu < 0; i++) {
+        if (CPU_ISSET(i, &main_set))
+            test_cpu = i;
+    }
+
+    test_cpus = std::to_string(test_cpu);
+
+    coke::GlobalSettings s;
+    s.poller_threads = 2;
+    s.handler_threads = 2;
+    s.compute_threads = 2;
+    s.poller_cpus = test_cpus.c_str();
+    s.compute_cpus = test_cpus.c_str();
+    coke::library_init(s);
+
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
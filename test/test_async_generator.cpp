@@ -0,0 +1,118 @@
+/**
+ * Copyright 2024 Coke Project (https://github.com/kedixa/coke)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Authors: kedixa (https://github.com/kedixa)
+*/
+
+#include <string>
+#include <vector>
+#include <gtest/gtest.h>
+
+#include "coke/coke.h"
+
+coke::AsyncGenerator<int> sleep_range(int n) {
+    for (int i = 0; i < n; i++) {
+        co_await coke::sleep(0.001);
+        co_yield i;
+    }
+}
+
+coke::AsyncGenerator<std::string> to_string(coke::AsyncGenerator<int> gen) {
+    while (auto v = co_await gen.next())
+        co_yield std::to_string(*v);
+}
+
+coke::AsyncGenerator<int> throw_after(int n) {
+    for (int i = 0; i < n; i++)
+        co_yield i;
+
+    throw std::runtime_error("generator error");
+}
+
+coke::Task<> test_simple() {
+    auto gen = sleep_range(10);
+    std::vector<int> values;
+
+    while (auto v = co_await gen.next())
+        values.push_back(*v);
+
+    EXPECT_TRUE(gen.done());
+    EXPECT_EQ(values, std::vector<int>({0, 1, 2, 3, 4, 5, 6, 7, 8, 9}));
+
+    auto v = co_await gen.next();
+    EXPECT_FALSE(v.has_value());
+}
+
+coke::Task<> test_nested() {
+    auto gen = to_string(sleep_range(3));
+    std::string s;
+
+    while (auto v = co_await gen.next())
+        s.append(*v);
+
+    EXPECT_EQ(s, "012");
+}
+
+coke::Task<> test_exception() {
+    auto gen = throw_after(2);
+    int cnt = 0;
+    bool caught = false;
+
+    try {
+        while (auto v = co_await gen.next())
+            cnt++;
+    }
+    catch (const std::runtime_error &) {
+        caught = true;
+    }
+
+    EXPECT_EQ(cnt, 2);
+    EXPECT_TRUE(caught);
+    EXPECT_TRUE(gen.done());
+}
+
+coke::Task<> test_early_destroy() {
+    auto gen = sleep_range(100);
+    auto v = co_await gen.next();
+    EXPECT_EQ(v.value(), 0);
+}
+
+TEST(ASYNC_GENERATOR, simple) {
+    coke::sync_wait(test_simple());
+}
+
+TEST(ASYNC_GENERATOR, nested) {
+    coke::sync_wait(test_nested());
+}
+
+TEST(ASYNC_GENERATOR, exception) {
+    coke::sync_wait(test_exception());
+}
+
+TEST(ASYNC_GENERATOR, early_destroy) {
+    coke::sync_wait(test_early_destroy());
+}
+
+int main(int argc, char *argv[]) {
+    coke::GlobalSettings s;
+    s.poller_threads = 2;
+    s.handler_threads = 2;
+    s.compute_threads = 2;
+    coke::library_init(s);
+
+    testing::InitGoogleTest(&argc, argv);
+
+    return RUN_ALL_TESTS();
+}
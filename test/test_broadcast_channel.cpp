@@ -0,0 +1,153 @@
+/**
+ * Copyright 2024 Coke Project (https://github.com/kedixa/coke)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Authors: kedixa (https://github.com/kedixa)
+*/
+
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <gtest/gtest.h>
+
+#include "coke/broadcast_channel.h"
+#include "coke/global.h"
+#include "coke/sleep.h"
+#include "coke/wait.h"
+
+using Channel = coke::BroadcastChannel<int>;
+using ValuePtr = Channel::ValuePtr;
+
+coke::Task<> test_fan_out() {
+    constexpr int N = 1000;
+    constexpr int M = 4;
+    Channel ch(8, coke::BroadcastPolicy::BLOCK);
+    std::vector<Channel::Subscriber> subs;
+    std::atomic<int> total{0};
+
+    for (int i = 0; i < M; i++)
+        subs.emplace_back(ch.subscribe());
+    EXPECT_EQ(ch.subscriber_count(), (std::size_t)M);
+
+    auto publish = [&]() -> coke::Task<> {
+        for (int i = 0; i < N; i++)
+            EXPECT_EQ(co_await ch.publish(std::make_shared<int>(i)),
+                      coke::TOP_SUCCESS);
+        ch.close();
+    };
+
+    auto recv = [&](Channel::Subscriber &sub) -> coke::Task<> {
+        ValuePtr v;
+        int expect = 0;
+
+        while (co_await sub.recv(v) == coke::TOP_SUCCESS) {
+            // Every subscriber sees all the events in order
+            EXPECT_EQ(*v, expect);
+            ++expect;
+
+            if (expect % 7 == 0)
+                co_await coke::yield();
+        }
+
+        EXPECT_EQ(expect, N);
+        total.fetch_add(expect);
+    };
+
+    std::vector<coke::Task<>> tasks;
+    for (auto &sub : subs)
+        tasks.emplace_back(recv(sub));
+    tasks.emplace_back(publish());
+
+    co_await coke::async_wait(std::move(tasks));
+    EXPECT_EQ(total.load(), N * M);
+}
+
+TEST(BROADCAST, fan_out) {
+    coke::sync_wait(test_fan_out());
+}
+
+TEST(BROADCAST, drop) {
+    Channel ch(4, coke::BroadcastPolicy::DROP);
+    Channel::Subscriber sub = ch.subscribe();
+    ValuePtr v;
+
+    for (int i = 0; i < 10; i++)
+        EXPECT_TRUE(ch.try_publish(std::make_shared<int>(i)));
+
+    // The oldest six events are overwritten
+    EXPECT_EQ(sub.pending(), 4u);
+    EXPECT_EQ(sub.dropped(), 6u);
+
+    for (int i = 6; i < 10; i++) {
+        EXPECT_TRUE(sub.try_recv(v));
+        EXPECT_EQ(*v, i);
+    }
+
+    EXPECT_FALSE(sub.try_recv(v));
+}
+
+TEST(BROADCAST, block) {
+    Channel ch(4, coke::BroadcastPolicy::BLOCK);
+    Channel::Subscriber sub = ch.subscribe();
+    ValuePtr v;
+
+    for (int i = 0; i < 4; i++)
+        EXPECT_TRUE(ch.try_publish(std::make_shared<int>(i)));
+    EXPECT_FALSE(ch.try_publish(std::make_shared<int>(4)));
+
+    int ret = coke::sync_wait(
+        ch.try_publish_for(std::chrono::milliseconds(10),
+                           std::make_shared<int>(4))
+    );
+    EXPECT_EQ(ret, coke::TOP_TIMEOUT);
+
+    EXPECT_TRUE(sub.try_recv(v));
+    EXPECT_TRUE(ch.try_publish(std::make_shared<int>(4)));
+
+    // Leaving the channel makes room for the publisher
+    sub.unsubscribe();
+    EXPECT_TRUE(ch.try_publish(std::make_shared<int>(5)));
+    EXPECT_EQ(ch.subscriber_count(), 0u);
+}
+
+TEST(BROADCAST, disconnect) {
+    Channel ch(4, coke::BroadcastPolicy::DISCONNECT);
+    Channel::Subscriber slow = ch.subscribe();
+    Channel::Subscriber fast = ch.subscribe();
+    ValuePtr v;
+
+    for (int i = 0; i < 5; i++) {
+        EXPECT_TRUE(ch.try_publish(std::make_shared<int>(i)));
+        EXPECT_TRUE(fast.try_recv(v));
+    }
+
+    EXPECT_FALSE(slow.try_recv(v));
+    EXPECT_TRUE(slow.disconnected());
+    EXPECT_FALSE(fast.disconnected());
+
+    int ret = coke::sync_wait(slow.recv(v));
+    EXPECT_EQ(ret, coke::TOP_CLOSED);
+}
+
+int main(int argc, char *argv[]) {
+    coke::GlobalSettings s;
+    s.poller_threads = 2;
+    s.handler_threads = 2;
+    s.compute_threads = 2;
+    coke::library_init(s);
+
+    testing::InitGoogleTest(&argc, argv);
+
+    return RUN_ALL_TESTS();
+}
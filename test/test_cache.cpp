@@ -0,0 +1,189 @@
+/**
+ * Copyright 2024 Coke Project (https://github.com/kedixa/coke)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Authors: kedixa (https://github.com/kedixa)
+*/
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include <gtest/gtest.h>
+
+#include "coke/cache.h"
+#include "coke/coke.h"
+
+using IntCache = coke::Cache<int, std::string>;
+
+coke::CacheParams one_shard(std::size_t max_weight) {
+    coke::CacheParams params;
+    params.max_weight = max_weight;
+    params.shards = 1;
+    return params;
+}
+
+TEST(CACHE, put_get) {
+    IntCache cache(one_shard(16));
+
+    EXPECT_EQ(cache.get(1), nullptr);
+    EXPECT_TRUE(cache.put(1, "one"));
+    EXPECT_TRUE(cache.put(2, "two"));
+
+    auto p = cache.get(1);
+    ASSERT_NE(p, nullptr);
+    EXPECT_EQ(*p, "one");
+
+    EXPECT_TRUE(cache.put(1, "uno"));
+    EXPECT_EQ(*cache.get(1), "uno");
+    // The old value is still valid after it is replaced
+    EXPECT_EQ(*p, "one");
+
+    EXPECT_TRUE(cache.erase(2));
+    EXPECT_FALSE(cache.erase(2));
+    EXPECT_EQ(cache.size(), 1u);
+
+    coke::CacheStats st = cache.get_stats();
+    EXPECT_EQ(st.hits, 2u);
+    EXPECT_EQ(st.misses, 1u);
+
+    cache.clear();
+    EXPECT_EQ(cache.size(), 0u);
+}
+
+TEST(CACHE, lru) {
+    coke::CacheParams params = one_shard(3);
+    params.tinylfu = false;
+    IntCache cache(params);
+
+    for (int i = 0; i < 3; i++)
+        cache.put(i, std::to_string(i));
+
+    // 0 becomes the most recently used one, and 1 is evicted
+    EXPECT_NE(cache.get(0), nullptr);
+    EXPECT_TRUE(cache.put(3, "3"));
+
+    EXPECT_EQ(cache.get(1), nullptr);
+    EXPECT_NE(cache.get(0), nullptr);
+    EXPECT_NE(cache.get(2), nullptr);
+    EXPECT_NE(cache.get(3), nullptr);
+    EXPECT_EQ(cache.get_stats().evictions, 1u);
+}
+
+TEST(CACHE, tinylfu) {
+    IntCache cache(one_shard(4));
+
+    for (int i = 0; i < 4; i++) {
+        cache.put(i, std::to_string(i));
+        for (int j = 0; j < 4; j++)
+            cache.get(i);
+    }
+
+    // One-off keys do not flush the hot entries
+    for (int i = 100; i < 200; i++)
+        cache.put(i, std::to_string(i));
+
+    for (int i = 0; i < 4; i++)
+        EXPECT_NE(cache.get(i), nullptr);
+
+    EXPECT_GT(cache.get_stats().rejections, 0u);
+
+    // A key used often enough is admitted
+    for (int j = 0; j < 10; j++)
+        cache.get(1000);
+
+    EXPECT_TRUE(cache.put(1000, "hot"));
+    EXPECT_EQ(cache.size(), 4u);
+}
+
+TEST(CACHE, weigher) {
+    coke::CacheParams params = one_shard(10);
+    params.tinylfu = false;
+    coke::Cache<int, std::string> cache(params,
+        [](const int &, const std::string &v) { return v.size(); });
+
+    EXPECT_TRUE(cache.put(1, "aaaa"));
+    EXPECT_TRUE(cache.put(2, "bbbb"));
+    EXPECT_FALSE(cache.put(3, std::string(11, 'c')));
+    EXPECT_TRUE(cache.put(4, "dddd"));
+
+    coke::CacheStats st = cache.get_stats();
+    EXPECT_EQ(st.size, 2u);
+    EXPECT_EQ(st.weight, 8u);
+    EXPECT_EQ(cache.get(1), nullptr);
+}
+
+TEST(CACHE, ttl) {
+    coke::CacheParams params = one_shard(16);
+    params.ttl = std::chrono::milliseconds(20);
+    IntCache cache(params);
+
+    cache.put(1, "one");
+    cache.put(2, "two");
+    cache.put(3, "three", coke::NanoSec(0));
+    EXPECT_NE(cache.get(1), nullptr);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(40));
+
+    EXPECT_EQ(cache.get(1), nullptr);
+    EXPECT_EQ(cache.remove_expired(), 1u);
+    EXPECT_NE(cache.get(3), nullptr);
+    EXPECT_EQ(cache.get_stats().expirations, 2u);
+}
+
+coke::Task<> test_get_or_load() {
+    IntCache cache;
+    std::atomic<int> loads{0};
+
+    auto loader = [&]() -> coke::Task<std::string> {
+        loads.fetch_add(1);
+        co_await coke::sleep(std::chrono::milliseconds(20));
+        co_return std::string("loaded");
+    };
+
+    auto get = [&]() -> coke::Task<std::string> {
+        auto p = co_await cache.get_or_load(1, loader);
+        co_return p ? *p : std::string();
+    };
+
+    std::vector<coke::Task<std::string>> tasks;
+    for (int i = 0; i < 8; i++)
+        tasks.emplace_back(get());
+
+    auto rets = co_await coke::async_wait(std::move(tasks));
+    EXPECT_EQ(rets, std::vector<std::string>(8, "loaded"));
+    EXPECT_EQ(loads.load(), 1);
+
+    // Loaded value is cached
+    EXPECT_EQ(co_await get(), "loaded");
+    EXPECT_EQ(loads.load(), 1);
+    EXPECT_EQ(cache.size(), 1u);
+}
+
+TEST(CACHE, get_or_load) {
+    coke::sync_wait(test_get_or_load());
+}
+
+int main(int argc, char *argv[]) {
+    coke::GlobalSettings s;
+    s.poller_threads = 2;
+    s.handler_threads = 2;
+    s.compute_threads = 2;
+    coke::library_init(s);
+
+    testing::InitGoogleTest(&argc, argv);
+
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,140 @@
+/**
+ * Copyright 2024 Coke Project (https://github.com/kedixa/coke)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Authors: kedixa (https://github.com/kedixa)
+*/
+
+#include <chrono>
+#include <gtest/gtest.h>
+
+#include "coke/net/concurrency_limiter.h"
+#include "coke/sleep.h"
+#include "coke/wait.h"
+
+using coke::ConcurrencyLimiter;
+using std::chrono::milliseconds;
+
+TEST(CONCURRENCY_LIMITER, try_acquire) {
+    coke::ConcurrencyLimiterParams params;
+    params.initial_limit = 4;
+
+    ConcurrencyLimiter limiter(params);
+
+    for (int i = 0; i < 4; i++)
+        EXPECT_TRUE(limiter.try_acquire());
+
+    EXPECT_FALSE(limiter.try_acquire());
+
+    limiter.release(milliseconds(1), ConcurrencyLimiter::OUTCOME_IGNORED);
+    EXPECT_TRUE(limiter.try_acquire());
+
+    coke::ConcurrencyLimiterStats stats = limiter.get_stats();
+    EXPECT_EQ(stats.limit, 4u);
+    EXPECT_EQ(stats.inflight, 4u);
+    EXPECT_EQ(stats.accepted, 5u);
+    EXPECT_EQ(stats.rejected, 1u);
+}
+
+TEST(CONCURRENCY_LIMITER, aimd) {
+    coke::ConcurrencyLimiterParams params;
+    params.algorithm = coke::LimiterAlgorithm::AIMD;
+    params.initial_limit = 10;
+    params.aimd_timeout = 100;
+
+    ConcurrencyLimiter limiter(params);
+
+    // Grows only when the limit is nearly used
+    EXPECT_TRUE(limiter.try_acquire());
+    limiter.release(milliseconds(1), ConcurrencyLimiter::OUTCOME_SUCCESS);
+    EXPECT_EQ(limiter.get_limit(), 10u);
+
+    for (int i = 0; i < 10; i++)
+        EXPECT_TRUE(limiter.try_acquire());
+
+    limiter.release(milliseconds(1), ConcurrencyLimiter::OUTCOME_SUCCESS);
+    EXPECT_EQ(limiter.get_limit(), 11u);
+
+    // Slow requests are treated as dropped
+    limiter.release(milliseconds(200), ConcurrencyLimiter::OUTCOME_SUCCESS);
+    EXPECT_LT(limiter.get_limit(), 11u);
+
+    std::size_t limit = limiter.get_limit();
+    limiter.release(milliseconds(1), ConcurrencyLimiter::OUTCOME_DROPPED);
+    EXPECT_LT(limiter.get_limit(), limit);
+    EXPECT_EQ(limiter.get_stats().dropped, 1u);
+}
+
+TEST(CONCURRENCY_LIMITER, gradient) {
+    coke::ConcurrencyLimiterParams params;
+    params.initial_limit = 100;
+    params.min_limit = 5;
+
+    ConcurrencyLimiter limiter(params);
+    auto sample = [&](milliseconds rtt) {
+        EXPECT_TRUE(limiter.try_acquire());
+        limiter.release(rtt, ConcurrencyLimiter::OUTCOME_SUCCESS);
+    };
+
+    for (int i = 0; i < 100; i++)
+        sample(milliseconds(10));
+
+    // Not used up, the limit does not grow
+    EXPECT_EQ(limiter.get_limit(), 100u);
+
+    // The backend slows down, the limit shrinks but stays above min_limit
+    for (int i = 0; i < 100; i++)
+        sample(milliseconds(100));
+
+    EXPECT_LT(limiter.get_limit(), 50u);
+    EXPECT_GE(limiter.get_limit(), 5u);
+}
+
+coke::Task<> test_acquire_wait() {
+    coke::ConcurrencyLimiterParams params;
+    params.initial_limit = 1;
+    params.max_wait = 500;
+
+    ConcurrencyLimiter limiter(params);
+    EXPECT_TRUE(co_await limiter.acquire());
+
+    auto release = [&]() -> coke::Task<> {
+        co_await coke::sleep(milliseconds(20));
+        limiter.release(milliseconds(20), ConcurrencyLimiter::OUTCOME_IGNORED);
+    };
+
+    auto wait = [&]() -> coke::Task<> {
+        EXPECT_TRUE(co_await limiter.acquire());
+        limiter.release(milliseconds(1), ConcurrencyLimiter::OUTCOME_IGNORED);
+    };
+
+    co_await coke::async_wait(release(), wait());
+    EXPECT_EQ(limiter.get_stats().inflight, 0u);
+}
+
+TEST(CONCURRENCY_LIMITER, acquire_wait) {
+    coke::sync_wait(test_acquire_wait());
+}
+
+int main(int argc, char *argv[]) {
+    coke::GlobalSettings s;
+    s.poller_threads = 2;
+    s.handler_threads = 2;
+    s.compute_threads = 2;
+    coke::library_init(s);
+
+    testing::InitGoogleTest(&argc, argv);
+
+    return RUN_ALL_TESTS();
+}
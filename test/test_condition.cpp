@@ -16,6 +16,7 @@
  * Authors: kedixa (https://github.com/kedixa)
 */
 
+#include <atomic>
 #include <vector>
 #include <gtest/gtest.h>
 
@@ -96,6 +97,90 @@ coke::Task<> test_wait_for() {
     EXPECT_EQ(fut.get(), y);
 }
 
+coke::Task<> cv_wait_flag(coke::Latch &lt, std::atomic<int> &cnt, bool &flag) {
+    std::unique_lock<std::mutex> lk(mtx);
+    lt.count_down();
+
+    int ret = co_await cv.wait(lk, [&]() { return flag; });
+    EXPECT_EQ(ret, coke::TOP_SUCCESS);
+    cnt.fetch_add(1);
+}
+
+coke::Task<> test_notify_many() {
+    constexpr int N = 2000;
+    coke::Latch lt(N);
+    std::atomic<int> cnt{0};
+    bool flag = false;
+    std::vector<coke::Task<>> tasks;
+
+    for (int i = 0; i < N; i++)
+        tasks.emplace_back(cv_wait_flag(lt, cnt, flag));
+
+    auto fut = coke::create_future(coke::async_wait(std::move(tasks)));
+    co_await lt.wait();
+
+    {
+        std::lock_guard<std::mutex> lk(mtx);
+        flag = true;
+    }
+
+    cv.notify_all();
+    co_await fut.wait();
+    EXPECT_EQ(cnt.load(), N);
+}
+
+coke::KeyedCondition<int> kcv;
+
+coke::Task<> kcv_wait(coke::Latch &lt, std::atomic<int> &cnt, int key) {
+    std::unique_lock<std::mutex> lk(mtx);
+    lt.count_down();
+
+    int ret = co_await kcv.wait(lk, key);
+    EXPECT_EQ(ret, coke::TOP_SUCCESS);
+    cnt.fetch_add(1);
+}
+
+coke::Task<> test_keyed_notify() {
+    constexpr int K = 4, N = 4;
+    coke::Latch lt(K * N);
+    std::atomic<int> cnt[K];
+    std::vector<coke::Task<>> tasks;
+
+    for (int k = 0; k < K; k++) {
+        cnt[k] = 0;
+        for (int i = 0; i < N; i++)
+            tasks.emplace_back(kcv_wait(lt, cnt[k], k));
+    }
+
+    auto fut = coke::create_future(coke::async_wait(std::move(tasks)));
+    co_await lt.wait();
+
+    // All the waiters are sleeping after the lock is released by them
+    mtx.lock();
+    mtx.unlock();
+
+    kcv.notify_all(1);
+    kcv.notify_one(2);
+    kcv.notify_all(K);
+    co_await coke::sleep(Milli(50));
+
+    EXPECT_EQ(cnt[0].load(), 0);
+    EXPECT_EQ(cnt[1].load(), N);
+    EXPECT_EQ(cnt[2].load(), 1);
+    EXPECT_EQ(cnt[3].load(), 0);
+
+    kcv.notify_all();
+    co_await fut.wait();
+
+    for (int k = 0; k < K; k++)
+        EXPECT_EQ(cnt[k].load(), N);
+
+    // No one notifies key 0 now
+    std::unique_lock<std::mutex> lk(mtx);
+    int ret = co_await kcv.wait_for(lk, 0, Milli(10));
+    EXPECT_EQ(ret, coke::TOP_TIMEOUT);
+}
+
 TEST(CONDITION, wait) {
     coke::sync_wait(test_wait());
 }
@@ -104,6 +189,14 @@ TEST(CONDITION, wait_for) {
     coke::sync_wait(test_wait_for());
 }
 
+TEST(CONDITION, notify_many) {
+    coke::sync_wait(test_notify_many());
+}
+
+TEST(CONDITION, keyed_notify) {
+    coke::sync_wait(test_keyed_notify());
+}
+
 int main(int argc, char *argv[]) {
     coke::GlobalSettings s;
     s.poller_threads = 2;
@@ -17,14 +17,20 @@
 */
 
 #include <algorithm>
+#include <array>
+#include <atomic>
 #include <chrono>
 #include <mutex>
 #include <random>
+#include <sstream>
+#include <string>
 #include <vector>
 #include <gtest/gtest.h>
 
 #include "coke/coke.h"
 #include "coke/dag.h"
+#include "coke/dataflow_dag.h"
+#include "coke/static_dag.h"
 
 struct Context {
     std::vector<char> v;
@@ -33,6 +39,7 @@ struct Context {
 
 using DagGroup = coke::DagNodeGroup<Context>;
 using DagBuilder = coke::DagBuilder<Context>;
+using DagNodeGroup = coke::DagNodeGroup<void>;
 
 uint64_t rand64() {
     static std::mt19937_64 m(std::chrono::system_clock::now().time_since_epoch().count());
@@ -168,6 +175,413 @@ TEST(DAG, test1) { test_dag(create_dag1, validate_dag1); }
 TEST(DAG, test2) { test_dag(create_dag2, validate_dag2); }
 TEST(DAG, test3) { test_dag(create_dag3, validate_dag3); }
 
+TEST(DAG, dump) {
+    std::ostringstream oss;
+    auto dag = create_dag3();
+    dag->dump(oss);
+
+    std::string s = oss.str();
+    EXPECT_NE(s.find("N0 -> {N1, N2, N3};"), std::string::npos);
+    EXPECT_NE(s.find("N1 -> {N4};"), std::string::npos);
+    EXPECT_NE(s.find("N2 -> {N4} [style=dashed];"), std::string::npos);
+    EXPECT_NE(s.find("N3 -> {N4} [style=dashed];"), std::string::npos);
+    EXPECT_EQ(s.find("N4 ->"), std::string::npos);
+}
+
+TEST(DAG, run_many) {
+    auto dag = create_dag3();
+
+    for (int i = 0; i < 16; i++) {
+        Context ctx;
+        coke::sync_wait(dag->run(ctx));
+        ASSERT_EQ(ctx.v.size(), 4u);
+        validate_dag3(ctx);
+    }
+}
+
+coke::Task<> test_long_chain() {
+    constexpr int N = 10000;
+    std::atomic<int> cnt{0};
+    coke::DagBuilder<void> builder;
+    coke::DagNodeRef<void> node = builder.root();
+
+    // Nodes finish synchronously, and run one by one in the same coroutine
+    for (int i = 0; i < N; i++)
+        node = node.then([&]() -> coke::Task<> { cnt++; co_return; });
+
+    auto dag = builder.build();
+    EXPECT_TRUE(dag->valid());
+
+    for (int i = 1; i <= 4; i++) {
+        co_await dag->run();
+        EXPECT_EQ(cnt.load(), N * i);
+    }
+
+    // Concurrent runs take different contexts
+    co_await coke::async_wait(dag->run(), dag->run(), dag->run());
+    EXPECT_EQ(cnt.load(), N * 7);
+
+    dag->set_max_cached_contexts(0);
+    co_await dag->run();
+    EXPECT_EQ(cnt.load(), N * 8);
+}
+
+TEST(DAG, long_chain) {
+    coke::sync_wait(test_long_chain());
+}
+
+coke::Task<> test_node_hint() {
+    ExecQueue *queue = coke::detail::get_exec_queue("dag.compute");
+    std::atomic<int> compute_cnt{0}, io_cnt{0};
+    coke::DagBuilder<void> builder;
+
+    auto compute = [&]() -> coke::Task<> {
+        if (coke::detail::current_go_queue() == queue)
+            compute_cnt++;
+        co_return;
+    };
+
+    auto io = [&]() -> coke::Task<> {
+        if (coke::detail::in_handler_thread())
+            io_cnt++;
+        co_return;
+    };
+
+    /**
+     *      /-> A -> B -> C
+     * root --> D ----/
+     *
+     * A, B and D are compute nodes, C is io node.
+    */
+    auto root = builder.root();
+    auto a = builder.compute_node(compute, "A", "dag.compute");
+    auto b = builder.compute_node(compute, "B", "dag.compute");
+    auto c = builder.io_node(io, "C");
+    auto d = builder.node(compute, "D");
+    builder.set_compute(d, "dag.compute");
+
+    root > DagNodeGroup{a, d};
+    a > b > c;
+    d > c;
+
+    auto dag = builder.build();
+    EXPECT_TRUE(dag->valid());
+
+    for (int i = 1; i <= 4; i++) {
+        co_await dag->run();
+        EXPECT_EQ(compute_cnt.load(), 3 * i);
+        EXPECT_EQ(io_cnt.load(), i);
+    }
+}
+
+TEST(DAG, node_hint) {
+    coke::sync_wait(test_node_hint());
+}
+
+coke::Task<> test_profile() {
+    coke::DagBuilder<void> builder;
+    coke::DagProfileStats stats;
+    coke::DagRunProfile profile;
+
+    auto sleep_ms = [](int ms) {
+        return [ms]() -> coke::Task<> {
+            co_await coke::sleep(std::chrono::milliseconds(ms));
+        };
+    };
+
+    /**
+     *      /-> A(1ms) --\
+     * root --> B(30ms) --> D(1ms)
+    */
+    auto root = builder.root();
+    auto a = builder.node(sleep_ms(1), "A");
+    auto b = builder.node(sleep_ms(30), "B");
+    auto d = builder.node(sleep_ms(1), "D");
+
+    root > DagNodeGroup{a, b} > d;
+
+    auto dag = builder.build();
+
+    for (int i = 0; i < 3; i++) {
+        co_await dag->run(profile);
+        stats.add(profile);
+    }
+
+    EXPECT_EQ(profile.nodes.size(), 4u);
+    EXPECT_GE(profile.cost_ns, 30 * 1000000LL);
+    EXPECT_GE(profile.nodes[2].end_ns - profile.nodes[2].start_ns,
+              30 * 1000000LL);
+
+    std::vector<coke::dag_index_t> path{0, 2, 3};
+    EXPECT_EQ(coke::dag_critical_path(profile), path);
+
+    EXPECT_EQ(stats.run_count(), 3u);
+    EXPECT_GE(stats.percentile(2, 0.5), 25 * 1000000LL);
+    EXPECT_EQ(stats.critical_count(2), 3u);
+    EXPECT_EQ(stats.critical_count(1), 0u);
+
+    std::ostringstream oss;
+    dag->dump(oss, stats);
+    EXPECT_NE(oss.str().find("xlabel=\"p50"), std::string::npos);
+}
+
+TEST(DAG, profile) {
+    coke::sync_wait(test_profile());
+}
+
+std::vector<char> sorted_chars(std::vector<char> v) {
+    std::sort(v.begin(), v.end());
+    return v;
+}
+
+coke::Task<> test_plan() {
+    DagBuilder builder;
+
+    /**
+     * root -> A -> C --> E
+     *      \-> B -> D -/
+    */
+    auto root = builder.root();
+    auto a = builder.node(create_node_func('A'));
+    auto b = builder.node(create_node_func('B'));
+    auto c = builder.node(create_node_func('C'));
+    auto d = builder.node(create_node_func('D'));
+    auto e = builder.node(create_node_func('E'));
+
+    root > a > c > e;
+    root > b > d > e;
+
+    coke::dag_index_t cid = c.get_id(), did = d.get_id(), eid = e.get_id();
+    auto dag = builder.build();
+
+    std::vector<coke::dag_index_t> sinks1{cid}, sinks2{did, cid}, sinks3{eid};
+    std::vector<char> expect1{'A', 'C'}, expect2{'A', 'B', 'C', 'D'};
+
+    Context ctx1;
+    co_await dag->run(ctx1, sinks1);
+    EXPECT_EQ(sorted_chars(ctx1.v), expect1);
+
+    Context ctx2;
+    co_await dag->run(ctx2, sinks2);
+    EXPECT_EQ(sorted_chars(ctx2.v), expect2);
+
+    Context ctx3;
+    co_await dag->run(ctx3, sinks3);
+    EXPECT_EQ(ctx3.v.size(), 5u);
+
+    // Plans are cached by the set of sinks
+    auto plan = dag->get_plan(sinks1);
+    EXPECT_EQ(plan, dag->get_plan(std::vector<coke::dag_index_t>{cid, cid}));
+    EXPECT_EQ(plan->active_count(), 3u);
+    EXPECT_TRUE(plan->active(cid));
+    EXPECT_FALSE(plan->active(did));
+}
+
+coke::Task<> test_condition() {
+    DagBuilder builder;
+    bool enable_a = false;
+
+    /**
+     * root -> A -> B
+     *      |    \~~> W
+     *      \-> X ~~/
+     *           \-> Y
+     *
+     * A's condition is false, so B is skipped, W still runs by X.
+    */
+    auto root = builder.root();
+    auto a = builder.node(create_node_func('A'));
+    auto b = builder.node(create_node_func('B'));
+    auto w = builder.node(create_node_func('W'));
+    auto x = builder.node(create_node_func('X'));
+    auto y = builder.node(create_node_func('Y'));
+
+    root > DagGroup{a, x};
+    a > b;
+    DagGroup{a, x} >= w;
+    x > y;
+
+    builder.set_condition(a, [&](Context &) { return enable_a; });
+
+    auto dag = builder.build();
+
+    Context ctx1;
+    co_await dag->run(ctx1);
+    std::vector<char> expect1{'W', 'X', 'Y'};
+    EXPECT_EQ(sorted_chars(ctx1.v), expect1);
+
+    enable_a = true;
+    Context ctx2;
+    co_await dag->run(ctx2);
+    EXPECT_EQ(ctx2.v.size(), 5u);
+
+    // W is skipped because all its weak predecessors are skipped
+    enable_a = false;
+    DagBuilder builder2;
+    auto a2 = builder2.node(create_node_func('A'));
+    auto x2 = builder2.node(create_node_func('X'));
+    auto w2 = builder2.node(create_node_func('W'));
+    builder2.root() > DagGroup{a2, x2};
+    DagGroup{a2, x2} >= w2;
+    builder2.set_condition(a2, [&](Context &) { return enable_a; });
+    builder2.set_condition(x2, [](Context &) { return false; });
+
+    auto dag2 = builder2.build();
+    Context ctx3;
+    co_await dag2->run(ctx3);
+    EXPECT_TRUE(ctx3.v.empty());
+}
+
+TEST(DAG, plan) {
+    coke::sync_wait(test_plan());
+}
+
+TEST(DAG, condition) {
+    coke::sync_wait(test_condition());
+}
+
+constexpr std::array<coke::StaticDagEdge, 5> static_edges{{
+    {0, 1}, {0, 2}, {1, 3}, {2, 3}, {4, 3},
+}};
+
+// Out of range, self loop, duplicate edge and cycle are rejected at compile
+// time
+static_assert(coke::detail::static_dag_check<5>(static_edges));
+static_assert(!coke::detail::static_dag_check<3>(static_edges));
+static_assert(!coke::detail::static_dag_check<2>(
+    std::array<coke::StaticDagEdge, 1>{{{1, 1}}}));
+static_assert(!coke::detail::static_dag_check<2>(
+    std::array<coke::StaticDagEdge, 2>{{{0, 1}, {0, 1}}}));
+static_assert(!coke::detail::static_dag_check<3>(
+    std::array<coke::StaticDagEdge, 3>{{{0, 1}, {1, 2}, {2, 0}}}));
+
+coke::Task<> test_static_dag() {
+    auto dag = coke::make_static_dag<Context, static_edges>(
+        create_node_func('A'), create_node_func('B'), create_node_func('C'),
+        create_node_func('D'), create_node_func('E')
+    );
+
+    EXPECT_EQ(dag.node_count(), 5u);
+    EXPECT_EQ(dag.edge_count(), 5u);
+
+    for (int i = 0; i < 4; i++) {
+        Context ctx;
+        co_await dag.run(ctx);
+
+        EXPECT_EQ(ctx.v.size(), 5u);
+        expect_before(ctx.v, {'A'}, {'B', 'C'});
+        expect_before(ctx.v, {'B', 'C', 'E'}, {'D'});
+    }
+
+    // Concurrent runs have their own counters
+    Context ctx1, ctx2;
+    co_await coke::async_wait(dag.run(ctx1), dag.run(ctx2));
+    EXPECT_EQ(ctx1.v.size(), 5u);
+    EXPECT_EQ(ctx2.v.size(), 5u);
+}
+
+coke::Task<> test_static_dag_void() {
+    constexpr int N = 4;
+    static constexpr std::array<coke::StaticDagEdge, N - 1> edges{{
+        {0, 1}, {1, 2}, {2, 3},
+    }};
+
+    std::atomic<int> cnt{0};
+    std::vector<int> order;
+
+    auto node = [&](int i) {
+        return [&, i]() -> coke::Task<> {
+            order.push_back(i);
+            cnt++;
+            co_return;
+        };
+    };
+
+    auto dag = coke::make_static_dag<void, edges>(node(0), node(1), node(2),
+                                                  node(3));
+    co_await dag.run();
+
+    EXPECT_EQ(cnt.load(), N);
+    EXPECT_EQ(order, (std::vector<int>{0, 1, 2, 3}));
+}
+
+TEST(DAG, static_dag) {
+    coke::sync_wait(test_static_dag());
+}
+
+TEST(DAG, static_dag_void) {
+    coke::sync_wait(test_static_dag_void());
+}
+
+coke::Task<> test_dataflow_dag() {
+    auto length = [](const std::string &s) -> coke::Task<int> {
+        co_await coke::yield();
+        co_return (int)s.size();
+    };
+
+    auto twice = [](const int &x) -> coke::Task<int> {
+        co_await coke::sleep(std::chrono::milliseconds(rand64() % 10));
+        co_return x * 2;
+    };
+
+    auto to_str = [](const int &x) -> coke::Task<std::string> {
+        co_await coke::sleep(std::chrono::milliseconds(rand64() % 10));
+        co_return std::to_string(x);
+    };
+
+    auto concat = [](const int &x, const std::string &s)
+        -> coke::Task<std::string>
+    {
+        co_return s + ":" + std::to_string(x);
+    };
+
+    // 0 -> {1, 2}, {1, 2} -> 3
+    auto dag = coke::make_dataflow_dag<std::string>(
+        coke::dataflow_node(length),
+        coke::dataflow_node<0>(twice),
+        coke::dataflow_node<0>(to_str),
+        coke::dataflow_node<1, 2>(concat)
+    );
+
+    static_assert(std::is_same_v<decltype(dag)::result_type, std::string>);
+    EXPECT_EQ(dag.node_count(), 4u);
+
+    std::string in1 = "abc", in2 = "hello world";
+    EXPECT_EQ(co_await dag.run(in1), "3:6");
+
+    // Concurrent runs have their own slots
+    auto rets = co_await coke::async_wait(dag.run(in1), dag.run(in2));
+    EXPECT_EQ(rets[0], "3:6");
+    EXPECT_EQ(rets[1], "11:22");
+}
+
+coke::Task<> test_dataflow_dag_void() {
+    std::atomic<int> cnt{0};
+
+    auto dag = coke::make_dataflow_dag<void>(
+        coke::dataflow_node([]() -> coke::Task<int> { co_return 1; }),
+        coke::dataflow_node([]() -> coke::Task<int> { co_return 2; }),
+        coke::dataflow_node<0, 1>([&](const int &a, const int &b)
+            -> coke::Task<>
+        {
+            cnt += a + b;
+            co_return;
+        })
+    );
+
+    co_await dag.run();
+    co_await dag.run();
+    EXPECT_EQ(cnt.load(), 6);
+}
+
+TEST(DAG, dataflow_dag) {
+    coke::sync_wait(test_dataflow_dag());
+}
+
+TEST(DAG, dataflow_dag_void) {
+    coke::sync_wait(test_dataflow_dag_void());
+}
+
 int main(int argc, char *argv[]) {
     coke::GlobalSettings s;
     s.poller_threads = 2;
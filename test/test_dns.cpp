@@ -0,0 +1,117 @@
+/**
+ * Copyright 2024 Coke Project (https://github.com/kedixa/coke)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Authors: kedixa (https://github.com/kedixa)
+*/
+
+#include <chrono>
+#include <string>
+#include <vector>
+#include <gtest/gtest.h>
+
+#include "coke/net/dns.h"
+#include "coke/sleep.h"
+#include "coke/wait.h"
+
+coke::Task<> test_resolve() {
+    coke::DnsCacheStats before = coke::get_dns_cache_stats();
+
+    int ret = co_await coke::dns_resolve("localhost", 8000);
+    EXPECT_EQ(ret, 0);
+    EXPECT_EQ(coke::dns_cache_lookup("localhost", 8000), coke::DNS_CACHE_HIT);
+    EXPECT_EQ(coke::dns_cache_lookup("localhost", 8001), coke::DNS_CACHE_MISS);
+
+    coke::DnsCacheStats after = coke::get_dns_cache_stats();
+    EXPECT_EQ(after.resolves - before.resolves, 1u);
+    EXPECT_EQ(after.hits - before.hits, 1u);
+    EXPECT_EQ(after.misses - before.misses, 1u);
+}
+
+coke::Task<> test_resolve_fail() {
+    coke::DnsCacheStats before = coke::get_dns_cache_stats();
+
+    int ret = co_await coke::dns_resolve("coke-test.invalid", 80);
+    EXPECT_NE(ret, 0);
+
+    coke::DnsCacheStats after = coke::get_dns_cache_stats();
+    EXPECT_EQ(after.resolve_failures - before.resolve_failures, 1u);
+}
+
+coke::Task<> test_preresolve() {
+    std::vector<coke::DnsHost> hosts{
+        {"localhost", 8002},
+        {"localhost", 8003},
+        {"coke-test.invalid", 80},
+    };
+
+    std::size_t n = co_await coke::dns_preresolve(hosts, false);
+    EXPECT_EQ(n, 2u);
+    EXPECT_EQ(coke::dns_cache_lookup("localhost", 8002), coke::DNS_CACHE_HIT);
+    EXPECT_EQ(coke::dns_cache_lookup("localhost", 8003), coke::DNS_CACHE_HIT);
+}
+
+coke::Task<> test_prefetch() {
+    coke::DnsPrefetchParams params;
+    params.check_interval = 10;
+
+    EXPECT_EQ(coke::dns_prefetch_start(params), 0);
+    EXPECT_EQ(coke::dns_prefetch_start(params), -1);
+
+    coke::DnsCacheStats before = coke::get_dns_cache_stats();
+    coke::dns_prefetch_add("localhost", 8004);
+
+    // The new host is resolved at the next check
+    co_await coke::sleep(std::chrono::milliseconds(200));
+
+    coke::DnsCacheStats after = coke::get_dns_cache_stats();
+    EXPECT_GE(after.prefetches - before.prefetches, 1u);
+    EXPECT_GE(after.prefetch_hosts, 1u);
+    EXPECT_EQ(coke::dns_cache_lookup("localhost", 8004), coke::DNS_CACHE_HIT);
+
+    coke::dns_prefetch_remove("localhost", 8004);
+    co_await coke::dns_prefetch_stop();
+
+    // It can be started again after stopped
+    EXPECT_EQ(coke::dns_prefetch_start(params), 0);
+    co_await coke::dns_prefetch_stop();
+}
+
+TEST(DNS, resolve) {
+    coke::sync_wait(test_resolve());
+}
+
+TEST(DNS, resolve_fail) {
+    coke::sync_wait(test_resolve_fail());
+}
+
+TEST(DNS, preresolve) {
+    coke::sync_wait(test_preresolve());
+}
+
+TEST(DNS, prefetch) {
+    coke::sync_wait(test_prefetch());
+}
+
+int main(int argc, char *argv[]) {
+    coke::GlobalSettings s;
+    s.poller_threads = 2;
+    s.handler_threads = 2;
+    s.compute_threads = 2;
+    coke::library_init(s);
+
+    testing::InitGoogleTest(&argc, argv);
+
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,208 @@
+/**
+ * Copyright 2024 Coke Project (https://github.com/kedixa/coke)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Authors: kedixa (https://github.com/kedixa)
+*/
+
+#include <atomic>
+#include <condition_variable>
+#include <coroutine>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <gtest/gtest.h>
+
+#include "coke/coke.h"
+#include "coke/executor_adapter.h"
+
+/**
+ * A foreign executor with one thread, it is not managed by coke.
+*/
+class ThreadExecutor {
+public:
+    ThreadExecutor() : stop(false), th([this]() { run(); }) { }
+
+    ~ThreadExecutor() {
+        {
+            std::lock_guard<std::mutex> lg(mtx);
+            stop = true;
+        }
+
+        cv.notify_one();
+        th.join();
+    }
+
+    void execute(std::function<void()> job) {
+        {
+            std::lock_guard<std::mutex> lg(mtx);
+            jobs.push_back(std::move(job));
+        }
+
+        cv.notify_one();
+    }
+
+    std::thread::id get_id() const { return th.get_id(); }
+
+private:
+    void run() {
+        std::unique_lock<std::mutex> lk(mtx);
+
+        while (true) {
+            cv.wait(lk, [this]() { return stop || !jobs.empty(); });
+            if (jobs.empty())
+                break;
+
+            auto job = std::move(jobs.front());
+            jobs.pop_front();
+
+            lk.unlock();
+            job();
+            lk.lock();
+        }
+    }
+
+private:
+    std::mutex mtx;
+    std::condition_variable cv;
+    std::deque<std::function<void()>> jobs;
+    bool stop;
+    std::thread th;
+};
+
+/**
+ * A coroutine type of another framework, it starts eagerly and is detached.
+*/
+struct ForeignCoroutine {
+    struct promise_type {
+        ForeignCoroutine get_return_object() noexcept { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() noexcept { }
+        void unhandled_exception() { std::terminate(); }
+    };
+};
+
+coke::Task<int> sleep_and_return(int value) {
+    co_await coke::sleep(0.001);
+    co_return value;
+}
+
+coke::Task<> yield_task() {
+    co_await coke::yield();
+}
+
+coke::Task<> test_resume_on(ThreadExecutor &exec) {
+    co_await coke::resume_on(exec);
+    EXPECT_EQ(std::this_thread::get_id(), exec.get_id());
+
+    // Coke awaitables can be co awaited after switching
+    int ret = co_await sleep_and_return(1);
+    EXPECT_EQ(ret, 1);
+
+    co_await coke::resume_on(exec);
+    EXPECT_EQ(std::this_thread::get_id(), exec.get_id());
+}
+
+coke::Task<> test_from_callback(ThreadExecutor &exec) {
+    // Completed in the thread of the executor
+    int ret = co_await coke::from_callback<int>([&](auto resolve) {
+        exec.execute([resolve]() { resolve(2); });
+    });
+    EXPECT_EQ(ret, 2);
+    EXPECT_EQ(std::this_thread::get_id(), exec.get_id());
+
+    // Completed before the initiating function returns
+    std::string str = co_await coke::from_callback<std::string>(
+        [](auto resolve) { resolve(3, 's'); }
+    );
+    EXPECT_EQ(str, "sss");
+
+    co_await coke::from_callback([](coke::CallbackResolver<void> resolve) {
+        resolve();
+    });
+
+    // Move the awaiter before co await
+    auto awaiter = coke::from_callback<int>([](auto resolve) { resolve(4); });
+    auto awaiter2 = std::move(awaiter);
+    ret = co_await std::move(awaiter2);
+    EXPECT_EQ(ret, 4);
+}
+
+ForeignCoroutine foreign_await(ThreadExecutor &exec, std::promise<int> &p,
+                               std::thread::id &id) {
+    int ret = co_await coke::await_on(exec, sleep_and_return(5));
+    co_await coke::await_on(exec, yield_task());
+
+    id = std::this_thread::get_id();
+    p.set_value(ret);
+}
+
+TEST(EXECUTOR_ADAPTER, resume_on) {
+    ThreadExecutor exec;
+    coke::sync_wait(test_resume_on(exec));
+}
+
+TEST(EXECUTOR_ADAPTER, from_callback) {
+    ThreadExecutor exec;
+    coke::sync_wait(test_from_callback(exec));
+}
+
+TEST(EXECUTOR_ADAPTER, start_on) {
+    ThreadExecutor exec;
+    std::promise<int> p;
+    std::thread::id id;
+
+    exec.execute([&]() {
+        coke::start_on(exec, sleep_and_return(6), [&](int ret) {
+            id = std::this_thread::get_id();
+            p.set_value(ret);
+        });
+    });
+
+    EXPECT_EQ(p.get_future().get(), 6);
+    EXPECT_EQ(id, exec.get_id());
+
+    std::promise<void> q;
+    auto post = [&exec](coke::ExecutorJob job) { exec.execute(job); };
+    coke::start_on(post, yield_task(), [&]() {
+        q.set_value();
+    });
+    q.get_future().get();
+}
+
+TEST(EXECUTOR_ADAPTER, await_on) {
+    ThreadExecutor exec;
+    std::promise<int> p;
+    std::thread::id id;
+
+    foreign_await(exec, p, id);
+
+    EXPECT_EQ(p.get_future().get(), 5);
+    EXPECT_EQ(id, exec.get_id());
+}
+
+int main(int argc, char *argv[]) {
+    coke::GlobalSettings s;
+    s.poller_threads = 2;
+    s.handler_threads = 2;
+    s.compute_threads = 2;
+    coke::library_init(s);
+
+    testing::InitGoogleTest(&argc, argv);
+
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,144 @@
+/**
+ * Copyright 2024 Coke Project (https://github.com/kedixa/coke)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Authors: kedixa (https://github.com/kedixa)
+*/
+
+#include <string>
+#include <vector>
+#include <gtest/gtest.h>
+
+#include "coke/coke.h"
+#include "coke/expected.h"
+#include "coke/future.h"
+
+using IntResult = coke::Expected<int, std::string>;
+
+coke::Task<IntResult> parse(std::string s) {
+    co_await coke::yield();
+
+    if (s.empty() || s.find_first_not_of("0123456789") != std::string::npos)
+        co_return coke::Unexpected("bad number " + s);
+
+    co_return std::stoi(s);
+}
+
+coke::Task<IntResult> add(std::string a, std::string b) {
+    COKE_CO_TRY(x, co_await parse(a));
+    COKE_CO_TRY(y, co_await parse(b));
+
+    co_return *x + *y;
+}
+
+coke::Task<coke::Expected<void, int>> check(int v) {
+    co_await coke::yield();
+
+    if (v < 0)
+        co_return coke::Unexpected(v);
+
+    co_return coke::Expected<void, int>{};
+}
+
+TEST(EXPECTED, basic) {
+    coke::Expected<int, int> a(1);
+    coke::Expected<int, int> b = coke::Unexpected(2);
+
+    EXPECT_TRUE(a.has_value());
+    EXPECT_EQ(*a, 1);
+    EXPECT_FALSE(b);
+    EXPECT_EQ(b.error(), 2);
+    EXPECT_EQ(b.value_or(3), 3);
+
+    coke::Expected<std::string> s(std::string("abc"));
+    EXPECT_EQ(s->size(), 3u);
+
+    coke::Expected<void, std::string> v;
+    EXPECT_TRUE(v);
+    v = coke::Unexpected(std::string("err"));
+    EXPECT_EQ(v.error(), "err");
+}
+
+TEST(EXPECTED, co_try) {
+    IntResult r = coke::sync_wait(add("12", "30"));
+    ASSERT_TRUE(r);
+    EXPECT_EQ(*r, 42);
+
+    r = coke::sync_wait(add("12", "x"));
+    ASSERT_FALSE(r);
+    EXPECT_EQ(r.error(), "bad number x");
+}
+
+coke::Task<> test_async_wait_expected() {
+    std::vector<coke::Task<IntResult>> tasks;
+    tasks.emplace_back(parse("1"));
+    tasks.emplace_back(parse("2"));
+
+    coke::Expected<std::vector<int>, std::string> all;
+    all = co_await coke::async_wait_expected(std::move(tasks));
+    EXPECT_TRUE(all);
+    EXPECT_EQ(all.value_or(std::vector<int>{}), (std::vector<int>{1, 2}));
+
+    tasks.clear();
+    tasks.emplace_back(parse("1"));
+    tasks.emplace_back(parse("a"));
+    tasks.emplace_back(parse("b"));
+
+    all = co_await coke::async_wait_expected(std::move(tasks));
+    EXPECT_FALSE(all);
+    if (!all) {
+        EXPECT_EQ(all.error(), "bad number a");
+    }
+
+    std::vector<coke::Task<coke::Expected<void, int>>> checks;
+    checks.emplace_back(check(1));
+    checks.emplace_back(check(-5));
+
+    coke::Expected<void, int> ok;
+    ok = co_await coke::async_wait_expected(std::move(checks));
+    EXPECT_FALSE(ok);
+    if (!ok) {
+        EXPECT_EQ(ok.error(), -5);
+    }
+}
+
+TEST(EXPECTED, async_wait_expected) {
+    coke::sync_wait(test_async_wait_expected());
+}
+
+coke::Task<> test_future_expected() {
+    coke::Future<IntResult> fut = coke::create_future(parse("x"));
+
+    co_await fut.wait();
+    IntResult r = fut.get();
+
+    EXPECT_FALSE(r);
+    EXPECT_FALSE(fut.has_exception());
+}
+
+TEST(EXPECTED, future) {
+    coke::sync_wait(test_future_expected());
+}
+
+int main(int argc, char *argv[]) {
+    coke::GlobalSettings s;
+    s.poller_threads = 2;
+    s.handler_threads = 2;
+    s.compute_threads = 2;
+    coke::library_init(s);
+
+    testing::InitGoogleTest(&argc, argv);
+
+    return RUN_ALL_TESTS();
+}
@@ -16,9 +16,13 @@
  * Authors: kedixa (https://github.com/kedixa)
 */
 
+#include <algorithm>
+#include <cerrno>
 #include <cstdio>
 #include <cstdint>
 #include <cstring>
+#include <string>
+#include <vector>
 #include <gtest/gtest.h>
 
 #include "coke/coke.h"
@@ -59,8 +63,202 @@ TEST(FILEIO, read_write) {
     }
 }
 
+coke::Task<> read_write_fixed(int fd) {
+    struct iovec iov[2] = {{buf, BUF_SIZE}, {data, BUF_SIZE}};
+    int ret = coke::register_file_buffers(iov, 2);
+
+    if (coke::get_fio_backend() == coke::FIO_BACKEND_IO_URING) {
+        EXPECT_EQ(ret, 0);
+    }
+    else {
+        EXPECT_EQ(ret, -ENOTSUP);
+    }
+
+    for (size_t i = 0; i < BUF_SIZE; i++)
+        buf[i] = (i % 251);
+    memset(data, 0, BUF_SIZE);
+
+    coke::FileResult w = co_await coke::pwrite_fixed(fd, buf, BUF_SIZE, 0, 0);
+    coke::FileResult r = co_await coke::pread_fixed(fd, data, BUF_SIZE, 0, 1);
+    coke::FileResult s = co_await coke::fdatasync(fd);
+
+    EXPECT_EQ(w.state, coke::STATE_SUCCESS);
+    EXPECT_EQ(r.state, coke::STATE_SUCCESS);
+    EXPECT_EQ(s.state, coke::STATE_SUCCESS);
+
+    EXPECT_EQ(w.nbytes, (long)BUF_SIZE);
+    EXPECT_EQ(r.nbytes, (long)BUF_SIZE);
+    EXPECT_EQ(memcmp(buf, data, BUF_SIZE), 0);
+
+    if (ret == 0) {
+        EXPECT_EQ(coke::unregister_file_buffers(), 0);
+    }
+}
+
+TEST(FILEIO, read_write_fixed) {
+    std::FILE *file = tmpfile();
+
+    EXPECT_NE(file, nullptr);
+    if (file) {
+        coke::sync_wait(read_write_fixed(fileno(file)));
+
+        std::fclose(file);
+    }
+}
+
+coke::Task<> stream_read_write(int fd) {
+    constexpr std::size_t N = 100000;
+    std::string content;
+
+    for (std::size_t i = 0; i < N; i++)
+        content.push_back((char)('a' + i * 7 % 26));
+
+    coke::AsyncFileWriterParams wp;
+    wp.buffer_size = 4096;
+    wp.max_buffers = 3;
+    coke::AsyncFileWriter writer(fd, 0, wp);
+
+    // Write in uneven pieces to cross the buffer boundaries
+    for (std::size_t pos = 0, step = 1; pos < N; step = step * 3 % 10007) {
+        std::size_t n = std::min(step, N - pos);
+        EXPECT_EQ(co_await writer.write(content.data() + pos, n), 0);
+        pos += n;
+    }
+
+    EXPECT_EQ(writer.tell(), (off_t)N);
+    EXPECT_EQ(co_await writer.sync(), 0);
+    EXPECT_EQ(writer.buffered_size(), 0u);
+
+    coke::AsyncFileReaderParams rp;
+    rp.buffer_size = 4096;
+    rp.read_ahead = 2;
+    coke::AsyncFileReader reader(fd, 0, rp);
+    std::string result;
+    char buf[1000];
+
+    coke::FileResult res = co_await reader.read(buf, 10);
+    EXPECT_EQ(res.nbytes, 10);
+    result.append(buf, 10);
+
+    std::string_view chunk;
+    res = co_await reader.read_chunk(chunk);
+    EXPECT_EQ(res.state, coke::STATE_SUCCESS);
+    EXPECT_EQ(chunk.size(), 4096u - 10);
+    result.append(chunk);
+
+    while (true) {
+        res = co_await reader.read(buf, sizeof(buf));
+        EXPECT_EQ(res.state, coke::STATE_SUCCESS);
+        if (res.state != coke::STATE_SUCCESS || res.nbytes == 0)
+            break;
+
+        result.append(buf, res.nbytes);
+    }
+
+    EXPECT_EQ(reader.tell(), (off_t)N);
+    EXPECT_TRUE(result == content);
+}
+
+TEST(FILEIO, stream_read_write) {
+    std::FILE *file = tmpfile();
+
+    EXPECT_NE(file, nullptr);
+    if (file) {
+        coke::sync_wait(stream_read_write(fileno(file)));
+
+        std::fclose(file);
+    }
+}
+
+coke::Task<> append_record(coke::CommitLog &log, int i) {
+    std::string record = "record " + std::to_string(i) + "\n";
+    int ret = co_await log.append(record);
+    EXPECT_EQ(ret, 0);
+}
+
+coke::Task<> commit_log(int fd) {
+    constexpr int N = 200;
+    coke::CommitLogParams params;
+    params.max_batch_records = 16;
+    coke::CommitLog log(fd, 0, params);
+    std::vector<coke::Task<>> tasks;
+
+    for (int i = 0; i < N; i++)
+        tasks.emplace_back(append_record(log, i));
+
+    co_await coke::async_wait(std::move(tasks));
+    co_await log.close();
+
+    std::string closed_record("closed");
+    EXPECT_EQ(co_await log.append(closed_record), -EPIPE);
+    EXPECT_LT(log.get_batch_count(), (std::size_t)N);
+
+    std::string content((std::size_t)log.tell(), '\0');
+    coke::FileResult res = co_await coke::pread(fd, content.data(),
+                                                content.size(), 0);
+    EXPECT_EQ(res.nbytes, (long)content.size());
+
+    for (int i = 0; i < N; i++) {
+        std::string record = "record " + std::to_string(i) + "\n";
+        EXPECT_NE(content.find(record), std::string::npos);
+    }
+}
+
+TEST(FILEIO, commit_log) {
+    std::FILE *file = tmpfile();
+
+    EXPECT_NE(file, nullptr);
+    if (file) {
+        coke::sync_wait(commit_log(fileno(file)));
+
+        std::fclose(file);
+    }
+}
+
+coke::Task<> mapped_file(int fd) {
+    constexpr std::size_t N = 3 * 4096 + 100;
+    std::string content;
+
+    for (std::size_t i = 0; i < N; i++)
+        content.push_back((char)('A' + i % 26));
+
+    coke::FileResult res = co_await coke::pwrite(fd, content.data(), N, 0);
+    EXPECT_EQ(res.nbytes, (long)N);
+
+    coke::MappedFile file;
+    EXPECT_EQ(file.map(fd), 0);
+    EXPECT_EQ(file.size(), N);
+
+    EXPECT_EQ(co_await file.prefetch(4000, 5000), 0);
+    EXPECT_EQ(file.is_resident(4000, 5000), 1);
+    EXPECT_EQ(file.view(4000, 5000), std::string_view(content).substr(4000, 5000));
+    EXPECT_EQ(file.view(N - 10, 100).size(), 10u);
+    EXPECT_TRUE(file.view(N, 1).empty());
+
+    coke::MappedFile other(std::move(file));
+    EXPECT_FALSE(file.valid());
+    EXPECT_TRUE(other.valid());
+    EXPECT_EQ(other.view(0, N), content);
+}
+
+TEST(FILEIO, mapped_file) {
+    std::FILE *file = tmpfile();
+
+    EXPECT_NE(file, nullptr);
+    if (file) {
+        coke::sync_wait(mapped_file(fileno(file)));
+
+        std::fclose(file);
+    }
+
+    coke::MappedFile missing;
+    EXPECT_EQ(missing.open("/nonexistent/coke/file"), -ENOENT);
+}
+
 int main(int argc, char *argv[]) {
     coke::GlobalSettings s;
+    // Falls back to AIO if io_uring is not enabled or not supported
+    s.fio_backend = coke::FIO_BACKEND_IO_URING;
     s.poller_threads = 2;
     s.handler_threads = 2;
     s.compute_threads = 2;
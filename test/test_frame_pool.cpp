@@ -0,0 +1,113 @@
+/**
+ * Copyright 2024 Coke Project (https://github.com/kedixa/coke)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Authors: kedixa (https://github.com/kedixa)
+*/
+
+#include <atomic>
+#include <gtest/gtest.h>
+
+#include "coke/coke.h"
+
+coke::Task<int> add_one(int x) {
+    co_return x + 1;
+}
+
+coke::Task<> nested(int *out) {
+    *out = co_await add_one(co_await add_one(0));
+}
+
+coke::Task<> sleep_and_add(std::atomic<int> &cnt) {
+    co_await coke::sleep(0.01);
+    co_await coke::yield();
+    cnt.fetch_add(1);
+}
+
+coke::Task<> multi_thread() {
+    std::atomic<int> cnt{0};
+    std::vector<coke::Task<>> tasks;
+
+    for (int i = 0; i < 100; i++)
+        tasks.emplace_back(sleep_and_add(cnt));
+
+    co_await coke::async_wait(std::move(tasks));
+    EXPECT_EQ(cnt.load(), 100);
+}
+
+TEST(FRAME_POOL, reuse) {
+#ifdef COKE_NO_FRAME_POOL
+    GTEST_SKIP() << "Frame pool is disabled";
+#else
+    int value = 0;
+
+    // Warm up the free lists of this thread.
+    coke::detach(nested(&value));
+    EXPECT_EQ(value, 2);
+
+    coke::FramePoolStats before = coke::get_frame_pool_stats();
+
+    for (int i = 0; i < 100; i++) {
+        value = 0;
+        coke::detach(nested(&value));
+        EXPECT_EQ(value, 2);
+    }
+
+    coke::FramePoolStats after = coke::get_frame_pool_stats();
+    EXPECT_EQ(after.misses, before.misses);
+    EXPECT_EQ(after.hits - before.hits, 300u);
+#endif
+}
+
+TEST(FRAME_POOL, detach_on_new_series) {
+#ifdef COKE_NO_FRAME_POOL
+    GTEST_SKIP() << "Frame pool is disabled";
+#else
+    coke::SeriesCreater creater = coke::get_series_creater();
+    int value = 0;
+
+    // The series starts the coroutine synchronously, and the DetachTask is
+    // taken from the frame pool too.
+    coke::detach_on_new_series(nested(&value), creater);
+    EXPECT_EQ(value, 2);
+
+    coke::FramePoolStats before = coke::get_frame_pool_stats();
+
+    for (int i = 0; i < 100; i++) {
+        value = 0;
+        coke::detach_on_new_series(nested(&value), creater);
+        EXPECT_EQ(value, 2);
+    }
+
+    coke::FramePoolStats after = coke::get_frame_pool_stats();
+    EXPECT_EQ(after.misses, before.misses);
+    EXPECT_EQ(after.hits - before.hits, 400u);
+#endif
+}
+
+TEST(FRAME_POOL, multi_thread) {
+    coke::sync_wait(multi_thread());
+}
+
+int main(int argc, char *argv[]) {
+    coke::GlobalSettings s;
+    s.poller_threads = 2;
+    s.handler_threads = 2;
+    s.compute_threads = 2;
+    coke::library_init(s);
+
+    testing::InitGoogleTest(&argc, argv);
+
+    return RUN_ALL_TESTS();
+}
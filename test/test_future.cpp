@@ -16,8 +16,10 @@
  * Authors: kedixa (https://github.com/kedixa)
 */
 
+#include <atomic>
 #include <chrono>
 #include <string>
+#include <vector>
 #include <gtest/gtest.h>
 
 #include "coke/coke.h"
@@ -262,6 +264,149 @@ TEST(FUTURE, cancel) {
     EXPECT_EQ(fut.get(), 0);
 }
 
+coke::Task<> await_shared(coke::SharedFuture<std::string> fut,
+                          std::atomic<int> &cnt) {
+    int ret = co_await fut.wait();
+
+    if (ret == coke::FUTURE_STATE_READY && fut.get() == std::string(100, 'a'))
+        cnt.fetch_add(1);
+}
+
+coke::Task<> test_shared_future() {
+    constexpr int N = 64;
+    coke::SharedFuture<std::string> fut = coke::create_future(create_task());
+    std::vector<coke::Task<>> tasks;
+    std::atomic<int> cnt{0};
+
+    EXPECT_TRUE(fut.valid());
+
+    int ret = co_await fut.wait_for(milliseconds(10));
+    EXPECT_EQ(ret, coke::FUTURE_STATE_TIMEOUT);
+
+    for (int i = 0; i < N; i++)
+        tasks.emplace_back(await_shared(fut, cnt));
+
+    co_await coke::async_wait(std::move(tasks));
+    EXPECT_EQ(cnt.load(), N);
+
+    // Already ready, the value is not moved out
+    ret = co_await fut.wait();
+    EXPECT_EQ(ret, coke::FUTURE_STATE_READY);
+    EXPECT_EQ(fut.get().size(), 100u);
+
+    coke::SharedFuture<void> ex = coke::create_future(create_exception_task());
+    ret = co_await ex.wait();
+    EXPECT_EQ(ret, coke::FUTURE_STATE_EXCEPTION);
+    EXPECT_THROW(ex.get(), std::runtime_error);
+}
+
+TEST(FUTURE, shared_future) {
+    coke::sync_wait(test_shared_future());
+
+    coke::Future<int> f;
+    {
+        coke::Promise<int> p;
+        f = p.get_future();
+    }
+
+    coke::SharedFuture<int> sf = f.share();
+    EXPECT_FALSE(f.valid());
+    EXPECT_TRUE(sf.broken());
+    EXPECT_EQ(coke::sync_wait(sf.wait()), coke::FUTURE_STATE_BROKEN);
+}
+
+coke::Task<int> sleep_value(int ms) {
+    co_await coke::sleep(milliseconds(ms));
+    co_return ms;
+}
+
+coke::Task<> test_future_set() {
+    coke::FutureSet<int> set;
+    std::vector<int> order;
+    std::size_t idx;
+    int ret;
+
+    // Completion order is the reverse of adding order
+    for (int ms : {80, 40, 0})
+        set.add(coke::create_future(sleep_value(ms)));
+
+    EXPECT_EQ(set.size(), 3u);
+
+    while ((ret = co_await set.next(idx)) == coke::TOP_SUCCESS)
+        order.push_back(set[idx].get());
+
+    EXPECT_EQ(ret, coke::TOP_CLOSED);
+    EXPECT_EQ(order, (std::vector<int>{0, 40, 80}));
+
+    set.add(coke::create_future(sleep_value(200)));
+    ret = co_await set.next_for(idx, milliseconds(10));
+    EXPECT_EQ(ret, coke::TOP_TIMEOUT);
+
+    ret = co_await set.next(idx);
+    EXPECT_EQ(ret, coke::TOP_SUCCESS);
+    EXPECT_EQ(idx, 3u);
+    EXPECT_EQ(set.ready_count(), 0u);
+}
+
+TEST(FUTURE, future_set) {
+    coke::sync_wait(test_future_set());
+}
+
+coke::Task<> test_future_then() {
+    // Chain on a future that is not completed yet
+    coke::Future<std::string> f1 = coke::create_future(sleep_value(20))
+        .map([](int x) { return x * 2; })
+        .map([](int x) { return std::to_string(x); });
+
+    EXPECT_EQ(co_await f1.wait(), coke::FUTURE_STATE_READY);
+    EXPECT_EQ(f1.get(), "40");
+
+    // The exception is passed through map, and seen by then
+    coke::Future<int> f2 = coke::create_future(create_exception_task())
+        .map([]() { return 1; })
+        .then([](coke::Future<int> f) {
+            return f.has_exception() ? -1 : f.get();
+        });
+
+    EXPECT_EQ(co_await f2.wait(), coke::FUTURE_STATE_READY);
+    EXPECT_EQ(f2.get(), -1);
+
+    // The exception thrown by the continuation
+    coke::Future<void> f3 = coke::create_future(sleep_value(0))
+        .map([](int) -> void { throw std::runtime_error("map"); });
+
+    EXPECT_EQ(co_await f3.wait(), coke::FUTURE_STATE_EXCEPTION);
+    EXPECT_THROW(f3.get(), std::runtime_error);
+}
+
+TEST(FUTURE, then) {
+    coke::sync_wait(test_future_then());
+
+    // Already completed, the continuation is called immediately
+    coke::Promise<int> p1;
+    coke::Future<int> f1 = p1.get_future();
+    p1.set_value(3);
+
+    bool called = false;
+    coke::Future<void> f2 = f1.then([&called](coke::Future<int> f) {
+        called = (f.get() == 3);
+    });
+
+    EXPECT_FALSE(f1.valid());
+    EXPECT_TRUE(called);
+    EXPECT_TRUE(f2.ready());
+
+    // Broken is passed through map
+    coke::Future<int> f3;
+    {
+        coke::Promise<int> p2;
+        f3 = p2.get_future().map([](int x) { return x; });
+        EXPECT_EQ(f3.get_state(), coke::FUTURE_STATE_NOTSET);
+    }
+
+    EXPECT_TRUE(f3.broken());
+}
+
 int main(int argc, char *argv[]) {
     coke::GlobalSettings s;
     s.poller_threads = 2;
@@ -16,8 +16,19 @@
  * Authors: kedixa (https://github.com/kedixa)
 */
 
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <numeric>
+#include <string>
+#include <thread>
+#include <utility>
 #include <vector>
 #include <gtest/gtest.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 
 #include "coke/coke.h"
 
@@ -106,6 +117,275 @@ TEST(GO, more) {
     coke::sync_wait(test_more());
 }
 
+coke::Task<> test_exec_yield() {
+    int sum = 0;
+
+    for (int i = 0; i < 1000; i++) {
+        co_await coke::exec_yield();
+        sum += i;
+    }
+
+    EXPECT_EQ(sum, 999 * 1000 / 2);
+}
+
+TEST(GO, exec_yield) {
+    coke::sync_wait(test_exec_yield());
+}
+
+coke::Task<> test_go_batch() {
+    constexpr int N = 1000;
+    std::vector<std::function<int()>> funcs;
+
+    for (int i = 0; i < N; i++)
+        funcs.emplace_back([i]() { return i * i; });
+
+    std::vector<int> ret = co_await coke::go_batch("batch", std::move(funcs));
+    EXPECT_EQ(ret.size(), (std::size_t)N);
+    for (int i = 0; i < N; i++)
+        EXPECT_EQ(ret[i], i * i);
+
+    std::atomic<int> cnt{0};
+    auto inc = [&cnt]() { cnt.fetch_add(1, std::memory_order_relaxed); };
+    co_await coke::go_batch("batch", std::vector<decltype(inc)>(N, inc));
+    EXPECT_EQ(cnt.load(), N);
+
+    std::vector<std::function<bool()>> odd;
+    for (int i = 0; i < 10; i++)
+        odd.emplace_back([i]() { return i % 2 == 1; });
+
+    std::vector<bool> b = co_await coke::go_batch("batch", std::move(odd));
+    EXPECT_EQ(b, (std::vector<bool>{0, 1, 0, 1, 0, 1, 0, 1, 0, 1}));
+
+    std::vector<int(*)()> empty;
+    std::vector<int> r = co_await coke::go_batch("batch", std::move(empty));
+    EXPECT_TRUE(r.empty());
+}
+
+TEST(GO, go_batch) {
+    coke::sync_wait(test_go_batch());
+}
+
+coke::Task<> test_executor_pool() {
+    coke::ExecutorPool pool;
+    coke::ExecutorPoolParams params;
+    cpu_set_t cur;
+    int first_cpu = 0;
+
+    // Bind to the first cpu this process is allowed to use
+    CPU_ZERO(&cur);
+    sched_getaffinity(0, sizeof(cur), &cur);
+    while (first_cpu < CPU_SETSIZE && !CPU_ISSET(first_cpu, &cur))
+        first_cpu++;
+
+    params.threads = 2;
+    params.cpu_affinity = {first_cpu};
+    params.nice = 1;
+
+    int ret = pool.init(params);
+    EXPECT_EQ(ret, 0);
+    if (ret != 0)
+        co_return;
+
+    EXPECT_TRUE(pool.is_inited());
+    EXPECT_EQ(pool.get_threads(), 2u);
+    EXPECT_EQ(pool.get_exec_queue("q"), pool.get_exec_queue("q"));
+
+    auto get_cpus = [first_cpu]() {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        sched_getaffinity(0, sizeof(set), &set);
+        return std::make_pair(CPU_COUNT(&set), CPU_ISSET(first_cpu, &set) != 0);
+    };
+
+    auto cpus = co_await coke::go(pool, "q", get_cpus);
+    EXPECT_EQ(cpus.first, 1);
+    EXPECT_TRUE(cpus.second);
+
+    co_await coke::switch_go_thread(pool);
+    EXPECT_EQ(getpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid)), 1);
+
+    co_await coke::switch_go_thread();
+    pool.deinit();
+    EXPECT_FALSE(pool.is_inited());
+}
+
+TEST(GO, executor_pool) {
+    coke::sync_wait(test_executor_pool());
+}
+
+coke::Task<> test_go_queue_limit() {
+    const std::string name("test:limited");
+    std::atomic<int> inflight{0}, max_inflight{0};
+    coke::GoQueueStats stats;
+
+    EXPECT_FALSE(coke::get_go_queue_stats(name, stats));
+    coke::set_go_queue_params(name, coke::GoQueueParams{.max_concurrency = 1});
+
+    auto job = [&]() {
+        int cur = inflight.fetch_add(1) + 1;
+        int old = max_inflight.load();
+        while (old < cur && !max_inflight.compare_exchange_weak(old, cur))
+            ;
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        inflight.fetch_sub(1);
+    };
+
+    std::vector<coke::GoAwaiter<void>> jobs;
+    for (int i = 0; i < 4; i++)
+        jobs.emplace_back(coke::go(name, job));
+
+    co_await coke::async_wait(std::move(jobs));
+    EXPECT_EQ(max_inflight.load(), 1);
+
+    EXPECT_TRUE(coke::get_go_queue_stats(name, stats));
+    EXPECT_EQ(stats.submit_count, 4u);
+    EXPECT_EQ(stats.start_count, 4u);
+    EXPECT_EQ(stats.depth, 0u);
+    EXPECT_EQ(stats.running, 0u);
+    EXPECT_GE(stats.max_wait, std::chrono::milliseconds(5));
+    EXPECT_GE(stats.total_wait, stats.max_wait);
+
+    // Removing the limit
+    coke::set_go_queue_params(name, coke::GoQueueParams{});
+    co_await coke::go(name, job);
+}
+
+TEST(GO, go_queue_limit) {
+    coke::sync_wait(test_go_queue_limit());
+}
+
+coke::Task<> test_switch_handler() {
+    auto get_id = []() { return std::this_thread::get_id(); };
+
+    co_await coke::switch_go_thread();
+    std::thread::id compute_id = std::this_thread::get_id();
+
+    co_await coke::switch_handler_thread();
+    EXPECT_NE(std::this_thread::get_id(), compute_id);
+    EXPECT_TRUE(coke::detail::in_handler_thread());
+
+    // Already on a handler thread, no hop
+    std::thread::id handler_id = std::this_thread::get_id();
+    co_await coke::switch_handler_thread();
+    EXPECT_EQ(std::this_thread::get_id(), handler_id);
+
+    std::thread::id job_id = co_await coke::go_scoped("scoped", get_id);
+    EXPECT_NE(std::this_thread::get_id(), job_id);
+    EXPECT_TRUE(coke::detail::in_handler_thread());
+
+    co_await coke::go_scoped("scoped", simple);
+    EXPECT_TRUE(coke::detail::in_handler_thread());
+}
+
+TEST(GO, switch_handler_thread) {
+    coke::sync_wait(test_switch_handler());
+}
+
+coke::Task<> test_go_until() {
+    std::atomic<int> called{0};
+    auto job = [&]() { return called.fetch_add(1) + 1; };
+    auto past = coke::SteadyTimePoint::clock::now() - std::chrono::seconds(1);
+    auto future = coke::SteadyTimePoint::clock::now() + std::chrono::seconds(10);
+
+    coke::GoResult<int> r1 = co_await coke::go_until(past, "until", job);
+    EXPECT_EQ(r1.state, coke::TOP_TIMEOUT);
+    EXPECT_FALSE(r1.value.has_value());
+
+    coke::GoResult<int> r2 = co_await coke::go_until(future, "until", job);
+    EXPECT_EQ(r2.state, coke::TOP_SUCCESS);
+    EXPECT_EQ(r2.value.value_or(0), 1);
+
+    coke::StopToken token;
+    auto r3 = co_await coke::go_until(future, token, "until", simple);
+    EXPECT_EQ(r3.state, coke::TOP_SUCCESS);
+
+    token.request_stop();
+    coke::GoResult<int> r4 = co_await coke::go_until(future, token, "until", job);
+    EXPECT_EQ(r4.state, coke::TOP_STOPPED);
+    EXPECT_EQ(called.load(), 1);
+}
+
+TEST(GO, go_until) {
+    coke::sync_wait(test_go_until());
+}
+
+coke::Task<> test_for_index() {
+    constexpr std::size_t N = 10000;
+    std::vector<std::atomic<int>> cnt(N);
+
+    co_await coke::parallel_for(0, N, 64, [&](std::size_t i) {
+        cnt[i].fetch_add(1, std::memory_order_relaxed);
+    });
+
+    for (std::size_t i = 0; i < N; i++)
+        EXPECT_EQ(cnt[i].load(), 1);
+
+    // Empty and sub range
+    co_await coke::parallel_for(5, 5, 1, [&](std::size_t) { FAIL(); });
+    co_await coke::parallel_for(10, 20, 0, [&](std::size_t i) {
+        cnt[i].fetch_add(1, std::memory_order_relaxed);
+    });
+
+    EXPECT_EQ(cnt[9].load(), 1);
+    EXPECT_EQ(cnt[10].load(), 2);
+    EXPECT_EQ(cnt[19].load(), 2);
+    EXPECT_EQ(cnt[20].load(), 1);
+}
+
+coke::Task<> test_for_range() {
+    std::vector<int> v(5000);
+    std::iota(v.begin(), v.end(), 0);
+
+    co_await coke::parallel_for(v, 100, [](int &x) { x *= 2; });
+
+    for (int i = 0; i < (int)v.size(); i++)
+        EXPECT_EQ(v[i], i * 2);
+
+    // Grain larger than the range runs in one chunk
+    std::vector<int> w{1, 2, 3};
+    co_await coke::parallel_for(w, 100, [](int &x) { x += 1; });
+    EXPECT_EQ(w, (std::vector<int>{2, 3, 4}));
+}
+
+coke::Task<> test_reduce() {
+    std::vector<long> v(100000);
+    std::iota(v.begin(), v.end(), 1L);
+
+    long sum = co_await coke::parallel_reduce(v, 1000, 0L, std::plus<>{});
+    EXPECT_EQ(sum, 100000L * 100001L / 2);
+
+    long sq = co_await coke::parallel_reduce(v, 0, 0L, std::plus<>{},
+                                             [](long x) { return x % 7; });
+    EXPECT_EQ(sq, std::accumulate(v.begin(), v.end(), 0L,
+                                  [](long s, long x) { return s + x % 7; }));
+
+    // The partial results are combined in order
+    std::vector<std::string> s;
+    for (int i = 0; i < 1000; i++)
+        s.push_back(std::to_string(i % 10));
+
+    std::string cat = co_await coke::parallel_reduce(s, 10, std::string(">"),
+                                                     std::plus<>{});
+    EXPECT_EQ(cat, std::accumulate(s.begin(), s.end(), std::string(">")));
+
+    std::vector<long> empty;
+    long r = co_await coke::parallel_reduce(empty, 1, 42L, std::plus<>{});
+    EXPECT_EQ(r, 42L);
+}
+
+TEST(GO, parallel_for_index) {
+    coke::sync_wait(test_for_index());
+}
+
+TEST(GO, parallel_for_range) {
+    coke::sync_wait(test_for_range());
+}
+
+TEST(GO, parallel_reduce) {
+    coke::sync_wait(test_reduce());
+}
+
 int main(int argc, char *argv[]) {
     coke::GlobalSettings s;
     s.poller_threads = 2;
@@ -0,0 +1,233 @@
+/**
+ * Copyright 2024 Coke Project (https://github.com/kedixa/coke)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Authors: kedixa (https://github.com/kedixa)
+*/
+
+#include <cerrno>
+#include <string>
+#include <vector>
+#include <gtest/gtest.h>
+
+#include "coke/http/http_hpack.h"
+
+using HeaderList = std::vector<coke::HpackHeader>;
+
+std::string from_hex(const std::string &hex) {
+    std::string out;
+
+    for (std::size_t i = 0; i + 1 < hex.size(); i += 2)
+        out.push_back(char(std::stoi(hex.substr(i, 2), nullptr, 16)));
+
+    return out;
+}
+
+void expect_headers(const HeaderList &headers, const HeaderList &expect) {
+    ASSERT_EQ(headers.size(), expect.size());
+
+    for (std::size_t i = 0; i < headers.size(); i++) {
+        EXPECT_EQ(headers[i].name, expect[i].name);
+        EXPECT_EQ(headers[i].value, expect[i].value);
+    }
+}
+
+TEST(HPACK, huffman) {
+    std::string enc, dec;
+
+    // RFC 7541 C.4.1
+    coke::hpack_huffman_encode("www.example.com", enc);
+    EXPECT_EQ(enc, from_hex("f1e3c2e5f23a6ba0ab90f4ff"));
+    EXPECT_EQ(coke::hpack_huffman_length("www.example.com"), enc.size());
+
+    EXPECT_EQ(coke::hpack_huffman_decode(enc, dec), 0);
+    EXPECT_EQ(dec, "www.example.com");
+
+    // All the bytes
+    std::string all;
+    for (int i = 0; i < 256; i++)
+        all.push_back(char(i));
+
+    enc.clear();
+    dec.clear();
+    coke::hpack_huffman_encode(all, enc);
+    EXPECT_EQ(coke::hpack_huffman_decode(enc, dec), 0);
+    EXPECT_EQ(dec, all);
+
+    // The padding must be all ones and shorter than 8 bits
+    dec.clear();
+    EXPECT_EQ(coke::hpack_huffman_decode(from_hex("f1e3c2e5f23a6ba0ab90f4fe"),
+                                         dec), -EBADMSG);
+    dec.clear();
+    EXPECT_EQ(coke::hpack_huffman_decode(from_hex("1fff"), dec), -EBADMSG);
+
+    // EOS
+    dec.clear();
+    EXPECT_EQ(coke::hpack_huffman_decode(from_hex("ffffffff"), dec), -EBADMSG);
+}
+
+TEST(HPACK, request) {
+    // RFC 7541 C.4, requests with Huffman encoding
+    const char *blocks[] = {
+        "828684418cf1e3c2e5f23a6ba0ab90f4ff",
+        "828684be5886a8eb10649cbf",
+        "828785bf408825a849e95ba97d7f8925a849e95bb8e8b4bf",
+    };
+
+    std::vector<HeaderList> lists = {
+        {
+            {":method", "GET"}, {":scheme", "http"}, {":path", "/"},
+            {":authority", "www.example.com"},
+        },
+        {
+            {":method", "GET"}, {":scheme", "http"}, {":path", "/"},
+            {":authority", "www.example.com"}, {"cache-control", "no-cache"},
+        },
+        {
+            {":method", "GET"}, {":scheme", "https"}, {":path", "/index.html"},
+            {":authority", "www.example.com"}, {"custom-key", "custom-value"},
+        },
+    };
+
+    std::size_t sizes[] = {57, 110, 164};
+    coke::HpackEncoder encoder;
+    coke::HpackDecoder decoder;
+
+    for (std::size_t i = 0; i < 3; i++) {
+        std::string block;
+        HeaderList headers;
+
+        encoder.encode(lists[i], block);
+        EXPECT_EQ(block, from_hex(blocks[i]));
+        EXPECT_EQ(encoder.table_size(), sizes[i]);
+
+        EXPECT_EQ(decoder.decode(block, headers), 0);
+        expect_headers(headers, lists[i]);
+        EXPECT_EQ(decoder.table_size(), sizes[i]);
+    }
+}
+
+TEST(HPACK, response) {
+    // RFC 7541 C.5, responses without Huffman encoding and with eviction
+    const char *blocks[] = {
+        "4803333032580770726976617465611d4d6f6e2c203231204f63742032303133"
+        "2032303a31333a323120474d546e1768747470733a2f2f7777772e6578616d70"
+        "6c652e636f6d",
+        "4803333037c1c0bf",
+        "88c1611d4d6f6e2c203231204f637420323031332032303a31333a323220474d"
+        "54c05a04677a697077386f6f3d4153444a4b48514b425a584f5157454f504955"
+        "4158515745454f49553b206d61782d6167653d333630303b2076657273696f6e"
+        "3d31",
+    };
+
+    std::size_t sizes[] = {222, 222, 215};
+    coke::HpackEncoder encoder(256, false);
+    coke::HpackDecoder decoder(256);
+
+    for (std::size_t i = 0; i < 3; i++) {
+        std::string block = from_hex(blocks[i]);
+        std::string encoded;
+        HeaderList headers;
+
+        EXPECT_EQ(decoder.decode(block, headers), 0);
+        EXPECT_EQ(decoder.table_size(), sizes[i]);
+
+        encoder.encode(headers, encoded);
+        EXPECT_EQ(encoded, block);
+    }
+}
+
+TEST(HPACK, sensitive) {
+    coke::HpackEncoder encoder;
+    coke::HpackDecoder decoder;
+    HeaderList list{{"authorization", "secret", true}};
+    HeaderList headers;
+    std::string block;
+
+    encoder.encode(list, block);
+
+    // Never indexed with the name of static index 23
+    EXPECT_EQ(uint8_t(block[0]), 0x1f);
+    EXPECT_EQ(uint8_t(block[1]), 0x08);
+    EXPECT_EQ(encoder.table_size(), 0u);
+
+    EXPECT_EQ(decoder.decode(block, headers), 0);
+    ASSERT_EQ(headers.size(), 1u);
+    EXPECT_TRUE(headers[0].sensitive);
+    EXPECT_EQ(headers[0].value, "secret");
+    EXPECT_EQ(decoder.table_size(), 0u);
+}
+
+TEST(HPACK, table_size_update) {
+    coke::HpackEncoder encoder;
+    coke::HpackDecoder decoder;
+    HeaderList list{{"custom-key", "custom-value"}};
+    HeaderList headers;
+    std::string block;
+
+    encoder.encode(list, block);
+    EXPECT_EQ(decoder.decode(block, headers), 0);
+    EXPECT_EQ(decoder.table_size(), 54u);
+
+    // Shrink to 0 and grow to 100, both are sent in the next block
+    encoder.set_max_table_size(0);
+    encoder.set_max_table_size(100);
+
+    block.clear();
+    headers.clear();
+    encoder.encode(list, block);
+    EXPECT_EQ(uint8_t(block[0]), 0x20);
+    EXPECT_EQ(decoder.decode(block, headers), 0);
+    expect_headers(headers, list);
+    EXPECT_EQ(decoder.table_size(), 54u);
+
+    // Larger than our limit
+    coke::HpackDecoder small(64);
+    headers.clear();
+    EXPECT_EQ(small.decode(from_hex("3f61"), headers), -EBADMSG);
+
+    // Not at the beginning of the block
+    coke::HpackDecoder other;
+    EXPECT_EQ(other.decode(from_hex("8220"), headers), -EBADMSG);
+}
+
+TEST(HPACK, bad_block) {
+    HeaderList headers;
+
+    // Index out of range
+    coke::HpackDecoder d1;
+    EXPECT_EQ(d1.decode(from_hex("be"), headers), -EBADMSG);
+
+    // Index zero
+    coke::HpackDecoder d2;
+    EXPECT_EQ(d2.decode(from_hex("80"), headers), -EBADMSG);
+
+    // Integer too large
+    coke::HpackDecoder d3;
+    EXPECT_EQ(d3.decode(from_hex("ffffffffffff7f"), headers), -EBADMSG);
+
+    // Truncated string
+    coke::HpackDecoder d4;
+    EXPECT_EQ(d4.decode(from_hex("400561"), headers), -EBADMSG);
+
+    // Header list too large
+    coke::HpackDecoder d5(4096, 40);
+    EXPECT_EQ(d5.decode(from_hex("828684"), headers), -EBADMSG);
+}
+
+int main(int argc, char *argv[]) {
+    testing::InitGoogleTest(&argc, argv);
+
+    return RUN_ALL_TESTS();
+}
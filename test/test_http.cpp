@@ -16,12 +16,25 @@
  * Authors: kedixa (https://github.com/kedixa)
 */
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <cerrno>
+#include <cstdio>
+#include <fstream>
+#include <memory_resource>
+#include <string>
+#include <vector>
 #include <gtest/gtest.h>
 
 #include "coke/coke.h"
+#include "coke/http/http_cache.h"
 #include "coke/http/http_client.h"
+#include "coke/http/http_encoding.h"
 #include "coke/http/http_server.h"
+#include "coke/http/http_stream_server.h"
+#include "coke/http/http_utils.h"
+#include "coke/net/upstream.h"
 
 #include "workflow/WFTaskFactory.h"
 
@@ -57,6 +70,517 @@ coke::Task<> test_http_task() {
     EXPECT_STREQ(task->get_resp()->get_status_code(), "200");
 }
 
+coke::Task<> test_http_host_stats() {
+    constexpr int N = 8;
+    coke::HttpClientParams params;
+    coke::EndpointParams ep;
+    coke::HttpHostStats stats;
+
+    ep.max_connections = 2;
+    params.host_params.emplace("localhost", ep);
+
+    coke::HttpClient client(params);
+    std::string url = get_url();
+    std::vector<coke::HttpAwaiter> awaiters;
+
+    for (int i = 0; i < N; i++)
+        awaiters.emplace_back(client.request(url));
+
+    std::vector<coke::HttpResult> results;
+    results = co_await coke::async_wait(std::move(awaiters));
+
+    for (const auto &res : results)
+        EXPECT_EQ(res.state, coke::STATE_SUCCESS);
+
+    EXPECT_TRUE(coke::get_http_host_stats("localhost", stats));
+    EXPECT_EQ(stats.max_connections, 2u);
+    EXPECT_EQ(stats.active, 0u);
+    EXPECT_EQ(stats.total, (uint64_t)N);
+    EXPECT_EQ(stats.success, (uint64_t)N);
+    EXPECT_GE(stats.max_active, 1u);
+
+    EXPECT_FALSE(coke::get_http_host_stats("not.collected.host", stats));
+}
+
+coke::Task<> test_http_body() {
+    coke::HttpClient client;
+    std::string url = get_url();
+    url.replace(url.rfind('/'), std::string::npos, "/echo");
+
+    std::string body(1024 * 1024, 'x');
+    for (std::size_t i = 0; i < body.size(); i += 7)
+        body[i] = char('a' + i % 26);
+
+    std::string expect = body;
+    coke::HttpResult res;
+
+    res = co_await client.request(url, "POST", {}, std::move(body));
+    EXPECT_EQ(res.state, coke::STATE_SUCCESS);
+    EXPECT_EQ(coke::http_body_view(res.resp), expect);
+
+    res = co_await client.request_nocopy(url, "POST", {}, expect);
+    EXPECT_EQ(res.state, coke::STATE_SUCCESS);
+    EXPECT_EQ(coke::http_body_view(res.resp), expect);
+
+    std::string_view view(expect);
+    std::vector<std::string_view> chain{
+        view.substr(0, 100), view.substr(100, 5000), view.substr(5100)
+    };
+
+    res = co_await client.request_nocopy(url, "POST", {}, chain);
+    EXPECT_EQ(res.state, coke::STATE_SUCCESS);
+    EXPECT_EQ(coke::http_body_view(res.resp), expect);
+}
+
+coke::Task<> test_http_endpoint() {
+    coke::HttpClient client;
+    std::string url = get_url();
+    std::string echo_url = url;
+    echo_url.replace(url.rfind('/'), std::string::npos, "/echo");
+
+    coke::HttpClient::Endpoint ep = client.prepare(url);
+    coke::HttpClient::Endpoint echo = client.prepare(echo_url);
+    coke::HttpResult res;
+
+    EXPECT_TRUE(ep.valid());
+    EXPECT_EQ(ep.get_url(), url);
+
+    for (int i = 0; i < 3; i++) {
+        res = co_await client.request(ep);
+        EXPECT_EQ(res.state, coke::STATE_SUCCESS);
+        EXPECT_STREQ(res.resp.get_status_code(), "200");
+    }
+
+    res = co_await client.request(echo, "POST", {}, std::string("endpoint"));
+    EXPECT_EQ(res.state, coke::STATE_SUCCESS);
+    EXPECT_EQ(coke::http_body_view(res.resp), "endpoint");
+
+    coke::HttpClient::Endpoint none;
+    EXPECT_FALSE(none.valid());
+}
+
+coke::Task<> slow_processor(coke::HttpServerContext ctx) {
+    co_await coke::sleep(0.1);
+    ctx.get_resp().set_status_code("200");
+    co_await ctx.reply();
+}
+
+coke::Task<> test_http_admission(int port) {
+    constexpr int N = 4;
+    coke::HttpClient client;
+    std::string url = "http://localhost:" + std::to_string(port) + "/";
+    std::vector<coke::HttpAwaiter> awaiters;
+
+    for (int i = 0; i < N; i++)
+        awaiters.emplace_back(client.request(url));
+
+    std::vector<coke::HttpResult> results;
+    results = co_await coke::async_wait(std::move(awaiters));
+
+    int ok = 0, rejected = 0;
+    for (const auto &res : results) {
+        EXPECT_EQ(res.state, coke::STATE_SUCCESS);
+        std::string_view code = res.resp.get_status_code();
+
+        if (code == "200")
+            ok++;
+        else if (code == "503")
+            rejected++;
+    }
+
+    // One is running, one is queued, and the others are rejected at once
+    EXPECT_EQ(ok, 2);
+    EXPECT_EQ(rejected, 2);
+}
+
+coke::Task<> test_http_when_all() {
+    coke::HttpClient client;
+    std::string url = "http://127.0.0.1:" + std::to_string(http_port)
+                    + "/when_all";
+
+    for (int i = 0; i < 3; i++) {
+        coke::HttpResult res = co_await client.request(url);
+        EXPECT_EQ(res.state, coke::STATE_SUCCESS);
+        EXPECT_STREQ(res.resp.get_status_code(), "200");
+        EXPECT_EQ(coke::http_body_view(res.resp), "012");
+    }
+}
+
+coke::Task<> test_http_connection_data() {
+    coke::HttpClient client;
+    std::string url = "http://127.0.0.1:" + std::to_string(http_port)
+                    + "/connection";
+
+    // Requests one by one reuse the keep-alive connection, use an address
+    // different from the other tests so that it is a new connection.
+    for (int i = 1; i <= 3; i++) {
+        coke::HttpResult res = co_await client.request(url);
+        EXPECT_EQ(res.state, coke::STATE_SUCCESS);
+        EXPECT_EQ(coke::http_body_view(res.resp), std::to_string(i));
+    }
+}
+
+coke::Task<> test_http_arena() {
+    coke::HttpClient client;
+    std::string url = "http://127.0.0.1:" + std::to_string(http_port)
+                    + "/arena";
+
+    coke::HttpResult res = co_await client.request(url);
+    EXPECT_EQ(res.state, coke::STATE_SUCCESS);
+    EXPECT_EQ(coke::http_body_view(res.resp), "012");
+}
+
+std::string get_range_body() {
+    std::string body(100 * 1000 + 7, 'x');
+    for (std::size_t i = 0; i < body.size(); i += 3)
+        body[i] = char('a' + i % 26);
+    return body;
+}
+
+coke::Task<> test_http_stream() {
+    coke::HttpClient client;
+    std::string url = get_url();
+    std::string hello_url = url;
+    url.replace(url.rfind('/'), std::string::npos, "/range");
+
+    std::string body;
+    std::size_t pieces = 0;
+    auto gen = client.stream(url, {}, 30000);
+
+    while (auto res = co_await gen.next()) {
+        EXPECT_EQ(res->state, coke::STATE_SUCCESS);
+        EXPECT_STREQ(res->resp.get_status_code(), "206");
+        body.append(coke::http_body_view(res->resp));
+        pieces++;
+    }
+
+    EXPECT_EQ(pieces, 4u);
+    EXPECT_EQ(body, get_range_body());
+
+    // The server ignores Range, all the body is yielded at once
+    pieces = 0;
+    gen = client.stream(hello_url, {}, 4);
+
+    while (auto res = co_await gen.next()) {
+        EXPECT_EQ(res->state, coke::STATE_SUCCESS);
+        EXPECT_STREQ(res->resp.get_status_code(), "200");
+        EXPECT_EQ(coke::http_body_view(res->resp), "<html>Hello World</html>");
+        pieces++;
+    }
+
+    EXPECT_EQ(pieces, 1u);
+}
+
+std::string get_stream_piece(int i) {
+    return std::string(10000 + i * 1000, char('a' + i));
+}
+
+coke::Task<> test_http_writer() {
+    constexpr int N = 5;
+    coke::HttpClient client;
+    std::string url = get_url();
+    std::string expect;
+
+    for (int i = 0; i < N; i++)
+        expect.append(get_stream_piece(i));
+
+    std::vector<std::string> uris{"/stream", "/stream_length"};
+
+    for (const std::string &uri : uris) {
+        std::string stream_url = url;
+        stream_url.replace(url.rfind('/'), std::string::npos, uri);
+
+        coke::HttpResult res = co_await client.request(stream_url);
+        EXPECT_EQ(res.state, coke::STATE_SUCCESS);
+        EXPECT_STREQ(res.resp.get_status_code(), "200");
+
+        std::string body;
+        for (std::string_view chunk : coke::HttpChunkCursor(res.resp))
+            body.append(chunk);
+
+        EXPECT_EQ(body, expect);
+    }
+}
+
+const std::string file_path = "test_http_file.tmp";
+
+coke::Task<> test_http_write_file() {
+    coke::HttpClient client;
+    std::string url = get_url();
+    std::vector<std::string> uris{"/file", "/file_length"};
+
+    for (const std::string &uri : uris) {
+        std::string file_url = url;
+        file_url.replace(url.rfind('/'), std::string::npos, uri);
+
+        coke::HttpResult res = co_await client.request(file_url);
+        EXPECT_EQ(res.state, coke::STATE_SUCCESS);
+        EXPECT_STREQ(res.resp.get_status_code(), "200");
+
+        std::string body;
+        for (std::string_view chunk : coke::HttpChunkCursor(res.resp))
+            body.append(chunk);
+
+        EXPECT_EQ(body, get_range_body());
+    }
+}
+
+std::atomic<int> hedge_count{0};
+std::atomic<int> fail_count{0};
+
+coke::Task<> test_http_hedge() {
+    coke::HttpClientParams params;
+    params.hedge_max = 1;
+    params.hedge_delay = 20;
+
+    coke::HttpClient client(params);
+    std::string url = get_url();
+    url.replace(url.rfind('/'), std::string::npos, "/hedge");
+
+    // The first request is slow, and the backup one returns first
+    auto start = std::chrono::steady_clock::now();
+    coke::HttpResult res = co_await client.hedged_request(url);
+    auto cost = std::chrono::steady_clock::now() - start;
+
+    EXPECT_EQ(res.state, coke::STATE_SUCCESS);
+    EXPECT_EQ(coke::http_body_view(res.resp), "2");
+    EXPECT_LT(cost, std::chrono::milliseconds(250));
+    EXPECT_EQ(hedge_count.load(), 2);
+
+    // Wait for the abandoned request
+    co_await coke::sleep(0.4);
+}
+
+coke::Task<> test_http_retry_budget() {
+    coke::HttpClientParams params;
+    params.retry_max = 5;
+    params.hedge_max = 0;
+    params.retry_budget_ratio = 0.0;
+    params.retry_budget_burst = 2;
+
+    coke::HttpClient client(params);
+    std::string url = get_url();
+    url.replace(url.rfind('/'), std::string::npos, "/fail");
+
+    coke::HttpResult res = co_await client.hedged_request(url);
+    EXPECT_NE(res.state, coke::STATE_SUCCESS);
+    EXPECT_EQ(fail_count.load(), 3);
+
+    // The budget is exhausted, no more retry
+    res = co_await client.hedged_request(url);
+    EXPECT_NE(res.state, coke::STATE_SUCCESS);
+    EXPECT_EQ(fail_count.load(), 4);
+}
+
+coke::Task<> test_http_upstream() {
+    constexpr int N = 4;
+    const std::string group = "coke.test.upstream";
+    std::string port = std::to_string(http_port);
+
+    coke::UpstreamParams params;
+    params.policy = coke::UpstreamPolicy::ROUND_ROBIN;
+    EXPECT_EQ(coke::upstream_create(group, params), 0);
+
+    coke::UpstreamServer server;
+    server.address = "localhost:" + port;
+    coke::upstream_add_server(group, server);
+    server.address = "127.0.0.1:" + port;
+    coke::upstream_add_server(group, server);
+
+    coke::HttpClient client;
+    std::string url = "http://" + group + "/hello";
+
+    for (int i = 0; i < N; i++) {
+        coke::HttpResult res = co_await client.request(url);
+        EXPECT_EQ(res.state, coke::STATE_SUCCESS);
+        EXPECT_EQ(coke::http_body_view(res.resp), "<html>Hello World</html>");
+    }
+
+    std::vector<coke::UpstreamServerStats> stats;
+    EXPECT_TRUE(coke::get_upstream_stats(group, stats));
+    EXPECT_EQ(stats.size(), 2u);
+
+    for (const auto &st : stats) {
+        EXPECT_EQ(st.total, (uint64_t)N / 2);
+        EXPECT_EQ(st.failed, 0u);
+        EXPECT_EQ(st.inflight, 0u);
+    }
+
+    EXPECT_EQ(coke::upstream_delete(group), 0);
+}
+
+std::atomic<int> cache_count{0};
+
+coke::Task<> test_http_cache() {
+    coke::HttpClient client;
+    coke::HttpCache cache;
+    coke::HttpCacheResult res1, res2;
+    std::string url = get_url();
+    std::string fresh_url = url, etag_url = url, slow_url = url;
+
+    fresh_url.replace(url.rfind('/'), std::string::npos, "/cache_fresh");
+    etag_url.replace(url.rfind('/'), std::string::npos, "/cache_etag");
+    slow_url.replace(url.rfind('/'), std::string::npos, "/cache_slow");
+
+    // Fresh for max-age, the second one is served from cache
+    res1 = co_await cache.get(client, fresh_url);
+    res2 = co_await cache.get(client, fresh_url);
+    EXPECT_EQ(res1->state, coke::STATE_SUCCESS);
+    EXPECT_EQ(res1->body, "fresh");
+    EXPECT_EQ(res1, res2);
+    EXPECT_EQ(cache_count.load(), 1);
+
+    // Always revalidated by ETag
+    res1 = co_await cache.get(client, etag_url);
+    res2 = co_await cache.get(client, etag_url);
+    EXPECT_EQ(res1->body, "etag");
+    EXPECT_EQ(res1, res2);
+    EXPECT_EQ(cache_count.load(), 3);
+
+    coke::HttpCacheStats stats = cache.get_stats();
+    EXPECT_EQ(stats.hits, 1u);
+    EXPECT_EQ(stats.revalidated, 1u);
+    EXPECT_EQ(stats.entries, 2u);
+
+    // Concurrent misses share one request
+    std::vector<coke::Task<coke::HttpCacheResult>> tasks;
+    for (int i = 0; i < 4; i++)
+        tasks.emplace_back(cache.get(client, slow_url));
+
+    auto results = co_await coke::async_wait(std::move(tasks));
+    for (const auto &res : results) {
+        EXPECT_EQ(res->state, coke::STATE_SUCCESS);
+        EXPECT_EQ(res->body, "slow");
+    }
+
+    EXPECT_EQ(cache_count.load(), 4);
+
+    stats = cache.get_stats();
+    EXPECT_EQ(stats.misses, 7u);
+    EXPECT_EQ(stats.loads, 4u);
+
+    EXPECT_TRUE(cache.remove(fresh_url));
+    EXPECT_FALSE(cache.remove(fresh_url));
+}
+
+std::string get_encoding_body() {
+    std::string body;
+
+    for (int i = 0; i < 4096; i++)
+        body.append(std::to_string(i % 97)).append(" ");
+
+    return body;
+}
+
+coke::Task<> test_http_metrics() {
+    coke::HttpClient client;
+    std::string url = get_url();
+    url.replace(url.rfind('/'), std::string::npos, "/metrics");
+
+    coke::MetricsRegistry &reg = coke::default_metrics_registry();
+    reg.counter("test_http_metrics_total", "Requests of /metrics").add(2);
+
+    coke::HttpResult res = co_await client.request(url);
+    EXPECT_EQ(res.state, coke::STATE_SUCCESS);
+
+    std::string_view body = coke::http_body_view(res.resp);
+    EXPECT_NE(body.find("# TYPE test_http_metrics_total counter\n"),
+              std::string_view::npos);
+    EXPECT_NE(body.find("test_http_metrics_total 3\n"), std::string_view::npos);
+}
+
+coke::Task<> test_http_encoding() {
+    coke::HttpClientParams params;
+    params.accept_encoding = true;
+
+    coke::HttpClient client(params);
+    std::string url = get_url();
+    url.replace(url.rfind('/'), std::string::npos, "/encoding");
+
+    coke::HttpResult res = co_await client.request(url);
+    EXPECT_EQ(res.state, coke::STATE_SUCCESS);
+
+    // Identity if coke is built without content encoding support
+    std::string body;
+    int ret = co_await coke::http_decode_body_go(res.resp, body);
+    EXPECT_EQ(ret, 0);
+    EXPECT_EQ(body, get_encoding_body());
+
+    if (coke::http_encoding_supported(coke::HttpCoding::GZIP)) {
+        EXPECT_LT(coke::http_body_view(res.resp).size(), body.size());
+    }
+}
+
+TEST(HTTP, http_coding) {
+    std::string body = get_encoding_body();
+    std::vector<coke::HttpCoding> codings{
+        coke::HttpCoding::IDENTITY,
+        coke::HttpCoding::GZIP,
+        coke::HttpCoding::DEFLATE,
+    };
+
+    for (coke::HttpCoding coding : codings) {
+        if (!coke::http_encoding_supported(coding)) {
+            std::string out;
+            EXPECT_EQ(coke::http_compress(coding, body, out), -ENOTSUP);
+            continue;
+        }
+
+        std::string encoded, decoded;
+        EXPECT_EQ(coke::http_compress(coding, body, encoded), 0);
+        EXPECT_EQ(coke::http_decompress(coding, encoded, decoded), 0);
+        EXPECT_EQ(decoded, body);
+
+        // Feed the decompressor piece by piece
+        coke::HttpDecompressor d;
+        std::string_view view(encoded);
+        decoded.clear();
+
+        EXPECT_EQ(d.init(coding), 0);
+        for (std::size_t pos = 0; pos < view.size(); pos += 100)
+            EXPECT_EQ(d.update(view.substr(pos, 100), decoded), 0);
+        EXPECT_EQ(d.finish(), 0);
+        EXPECT_EQ(decoded, body);
+
+        if (coding != coke::HttpCoding::IDENTITY) {
+            std::string truncated = encoded.substr(0, encoded.size() / 2);
+            decoded.clear();
+            EXPECT_EQ(coke::http_decompress(coding, truncated, decoded),
+                      -EBADMSG);
+        }
+    }
+
+    coke::HttpCoding coding;
+    EXPECT_TRUE(coke::http_parse_coding("GZIP", coding));
+    EXPECT_EQ(coding, coke::HttpCoding::GZIP);
+    EXPECT_FALSE(coke::http_parse_coding("br", coding));
+}
+
+TEST(HTTP, http_header_index) {
+    coke::HttpRequest req;
+    req.set_method("GET");
+    req.set_request_uri("/");
+    req.set_http_version("HTTP/1.1");
+    req.add_header_pair("Host", "localhost");
+    req.add_header_pair("Accept-Encoding", "gzip");
+    req.add_header_pair("x-forwarded-for", "10.0.0.1");
+    req.add_header_pair("X-Forwarded-For", "10.0.0.2");
+
+    coke::HttpHeaderIndex index(req);
+    std::vector<std::string_view> expect{"10.0.0.1", "10.0.0.2"};
+
+    EXPECT_EQ(index.size(), 4u);
+    EXPECT_EQ(index.get("host"), "localhost");
+    EXPECT_EQ(index.get("ACCEPT-ENCODING"), "gzip");
+    EXPECT_EQ(index.get_all("X-Forwarded-For"), expect);
+    EXPECT_FALSE(index.contains("Accept"));
+    EXPECT_TRUE(index.get_all("Cookie").empty());
+
+    EXPECT_TRUE(coke::http_name_equal("Content-Encoding", "content-ENCODING"));
+    EXPECT_FALSE(coke::http_name_equal("Content-Encoding", "Content-Encodinf"));
+    EXPECT_FALSE(coke::http_name_equal("a@", "A`"));
+}
+
 TEST(HTTP, http_client) {
     coke::sync_wait(test_http_client());
 }
@@ -65,14 +589,426 @@ TEST(HTTP, http_task) {
     coke::sync_wait(test_http_task());
 }
 
+TEST(HTTP, http_body) {
+    coke::sync_wait(test_http_body());
+}
+
+TEST(HTTP, http_endpoint) {
+    coke::sync_wait(test_http_endpoint());
+}
+
+TEST(HTTP, http_admission) {
+    coke::HttpServer server(slow_processor);
+    coke::AdmissionParams params;
+    int port = -1;
+
+    params.max_inflight = 1;
+    params.max_queue = 1;
+    server.set_admission_params(params);
+    server.enable_latency_stats();
+
+    for (int i = 8010; i < 8020; i++) {
+        if (server.start(i) == 0) {
+            port = i;
+            break;
+        }
+    }
+
+    ASSERT_NE(port, -1);
+    coke::sync_wait(test_http_admission(port));
+    server.stop();
+
+    coke::AdmissionStats stats = server.get_admission_stats();
+    EXPECT_EQ(stats.admitted, 1u);
+    EXPECT_EQ(stats.admitted_after_queue, 1u);
+    EXPECT_EQ(stats.rejected, 2u);
+    EXPECT_EQ(stats.inflight, 0u);
+
+    // The rejected requests do not run the processor
+    coke::ServerLatencyStats latency = server.get_latency_stats();
+    EXPECT_EQ(latency.handler.count, 2u);
+    EXPECT_EQ(latency.reply.count, 2u);
+    EXPECT_EQ(latency.queue.count, 2u);
+    EXPECT_GE(latency.handler.percentile(0.5), 100u * 1000);
+    EXPECT_GE(latency.queue.max, 50u * 1000);
+}
+
+coke::Task<> test_http_reuse_port(int port) {
+    std::string url = "http://127.0.0.1:" + std::to_string(port) + "/";
+    std::vector<coke::HttpAwaiter> awaiters;
+
+    // The slow requests at the same time come from different connections
+    coke::HttpClientParams params;
+    params.keep_alive_timeout = 0;
+    coke::HttpClient client(params);
+
+    for (int i = 0; i < 16; i++)
+        awaiters.emplace_back(client.request(url));
+
+    std::vector<coke::HttpResult> results;
+    results = co_await coke::async_wait(std::move(awaiters));
+
+    for (const coke::HttpResult &res : results)
+        EXPECT_EQ(res.state, coke::STATE_SUCCESS);
+}
+
+TEST(HTTP, http_reuse_port) {
+    coke::HttpServer server(slow_processor);
+    int port = -1;
+
+    server.enable_latency_stats();
+
+    for (int i = 8020; i < 8030; i++) {
+        if (server.start_reuse_port(3, AF_INET, "127.0.0.1", i) == 0) {
+            port = i;
+            break;
+        }
+    }
+
+    ASSERT_NE(port, -1);
+    coke::sync_wait(test_http_reuse_port(port));
+    server.stop();
+
+    EXPECT_EQ(server.get_conn_count(), 0u);
+    EXPECT_EQ(server.get_latency_stats().handler.count, 16u);
+}
+
+coke::Task<> stream_processor(coke::HttpStreamServerContext ctx) {
+    coke::HttpBodyReader reader(ctx);
+    std::string data;
+    uint64_t sum = 0;
+    int ret;
+
+    while ((ret = co_await reader.read_some(data)) == coke::TOP_SUCCESS) {
+        for (char c : data)
+            sum = sum * 31 + (unsigned char)c;
+
+        // A slow reader, the body is buffered meanwhile
+        co_await coke::yield();
+    }
+
+    coke::HttpResponse &resp = ctx.get_resp();
+    resp.set_status_code(ret == coke::TOP_CLOSED ? "200" : "500");
+    resp.append_output_body(std::to_string(reader.get_body_read()) + " " +
+                            std::to_string(sum));
+
+    co_await ctx.reply();
+}
+
+coke::Task<> test_http_stream_server(int port) {
+    std::string url = "http://127.0.0.1:" + std::to_string(port) + "/upload";
+    coke::HttpClient client;
+    coke::HttpResult res;
+
+    // Requests on the same connection, the next one follows a streamed body
+    for (std::size_t size : {0, 10, 4 * 1024 * 1024, 100}) {
+        std::string body(size, '\0');
+        uint64_t sum = 0;
+
+        for (std::size_t i = 0; i < size; i++) {
+            body[i] = char('a' + i % 23);
+            sum = sum * 31 + (unsigned char)body[i];
+        }
+
+        res = co_await client.request(url, "POST", {}, std::move(body));
+        EXPECT_EQ(res.state, coke::STATE_SUCCESS);
+        EXPECT_STREQ(res.resp.get_status_code(), "200");
+        EXPECT_EQ(coke::http_body_view(res.resp),
+                  std::to_string(size) + " " + std::to_string(sum));
+    }
+}
+
+TEST(HTTP, http_stream_server) {
+    coke::HttpStreamServerParams params;
+    params.body_buffer_size = 64 * 1024 * 1024;
+
+    coke::HttpStreamServer server(params, stream_processor);
+    int port = -1;
+
+    for (int i = 8030; i < 8040; i++) {
+        if (server.start(AF_INET, "127.0.0.1", i) == 0) {
+            port = i;
+            break;
+        }
+    }
+
+    ASSERT_NE(port, -1);
+    coke::sync_wait(test_http_stream_server(port));
+    server.stop();
+}
+
+TEST(HTTP, http_when_all) {
+    coke::sync_wait(test_http_when_all());
+}
+
+TEST(HTTP, http_connection_data) {
+    coke::sync_wait(test_http_connection_data());
+}
+
+TEST(HTTP, http_arena) {
+    coke::sync_wait(test_http_arena());
+}
+
+TEST(HTTP, http_host_stats) {
+    coke::sync_wait(test_http_host_stats());
+}
+
+TEST(HTTP, http_stream) {
+    coke::sync_wait(test_http_stream());
+}
+
+TEST(HTTP, http_writer) {
+    coke::sync_wait(test_http_writer());
+}
+
+TEST(HTTP, http_write_file) {
+    coke::sync_wait(test_http_write_file());
+}
+
+TEST(HTTP, http_upstream) {
+    coke::sync_wait(test_http_upstream());
+}
+
+TEST(HTTP, http_cache) {
+    coke::sync_wait(test_http_cache());
+}
+
+TEST(HTTP, http_encoding) {
+    coke::sync_wait(test_http_encoding());
+}
+
+TEST(HTTP, http_metrics) {
+    coke::sync_wait(test_http_metrics());
+}
+
+TEST(HTTP, http_hedge) {
+    coke::sync_wait(test_http_hedge());
+}
+
+TEST(HTTP, http_retry_budget) {
+    coke::sync_wait(test_http_retry_budget());
+}
+
+coke::Task<> stream_processor(coke::HttpServerContext &ctx, bool chunked) {
+    constexpr int N = 5;
+    coke::HttpResponseWriter writer(ctx);
+    long long length = coke::HttpResponseWriter::CHUNKED;
+    int ret;
+
+    if (!chunked) {
+        length = 0;
+        for (int i = 0; i < N; i++)
+            length += (long long)get_stream_piece(i).size();
+    }
+
+    ret = co_await writer.start(length);
+    EXPECT_EQ(ret, 0);
+
+    for (int i = 0; i < N && ret == 0; i++) {
+        std::string piece = get_stream_piece(i);
+        ret = co_await writer.write_chunk(piece);
+        EXPECT_EQ(ret, 0);
+    }
+
+    ret = co_await writer.finish();
+    EXPECT_EQ(ret, 0);
+}
+
+coke::Task<> file_processor(coke::HttpServerContext &ctx, bool chunked) {
+    coke::HttpResponseWriter writer(ctx);
+    coke::MappedFile file;
+    int ret;
+
+    ret = file.open(file_path);
+    EXPECT_EQ(ret, 0);
+
+    std::size_t size = file.size();
+    std::size_t half = size / 2;
+
+    ret = co_await writer.start(chunked ? coke::HttpResponseWriter::CHUNKED
+                                        : (long long)size);
+    EXPECT_EQ(ret, 0);
+
+    // Out of the file, nothing is sent
+    ret = co_await writer.write_file(file, half, size);
+    EXPECT_EQ(ret, -EINVAL);
+
+    ret = co_await writer.write_file(file, 0, half);
+    EXPECT_EQ(ret, 0);
+
+    ret = co_await writer.write_file(file, half, size - half);
+    EXPECT_EQ(ret, 0);
+
+    ret = co_await writer.finish();
+    EXPECT_EQ(ret, 0);
+}
+
+void reply_range(coke::HttpRequest &req, coke::HttpResponse &resp) {
+    static const std::string body = get_range_body();
+    std::string_view range;
+
+    for (const coke::HttpHeaderView &header : coke::HttpHeaderCursor(req)) {
+        if (header.name == "Range")
+            range = header.value;
+    }
+
+    // Only `bytes=first-last` is supported
+    std::size_t first = 0, last = body.size() - 1;
+    if (range.starts_with("bytes=")) {
+        std::string r(range.substr(6));
+        std::size_t pos = r.find('-');
+
+        first = std::stoul(r.substr(0, pos));
+        last = std::min(std::stoul(r.substr(pos + 1)), last);
+    }
+
+    if (first >= body.size()) {
+        resp.set_status_code("416");
+        return;
+    }
+
+    std::string cr = "bytes " + std::to_string(first) + "-"
+                   + std::to_string(last) + "/" + std::to_string(body.size());
+
+    resp.set_status_code("206");
+    resp.set_header_pair("Content-Range", cr);
+    resp.append_output_body_nocopy(body.data() + first, last - first + 1);
+}
+
+coke::Task<std::string> when_all_piece(int i) {
+    co_await coke::sleep(0.01 * i);
+    co_return std::to_string(i);
+}
+
+coke::Task<> when_all_processor(coke::HttpServerContext &ctx) {
+    std::vector<coke::Task<std::string>> tasks;
+    for (int i = 0; i < 3; i++)
+        tasks.emplace_back(when_all_piece(i));
+
+    // The server's series must be kept until the join, and the handler goes
+    // on with it, so the reply is not sent before the body is filled
+    std::vector<std::string> pieces = co_await coke::when_all(std::move(tasks));
+    co_await coke::sleep(0.01);
+
+    for (const std::string &piece : pieces)
+        ctx.get_resp().append_output_body(piece);
+
+    co_await ctx.reply();
+}
+
 coke::Task<> http_processor(coke::HttpServerContext ctx) {
+    coke::HttpRequest &req = ctx.get_req();
     coke::HttpResponse &resp = ctx.get_resp();
 
     resp.set_status_code("200");
     resp.set_http_version("HTTP/1.1");
     resp.set_header_pair("Server", "Coke HTTP Test Server");
 
-    resp.append_output_body_nocopy("<html>Hello World</html>");
+    std::string_view uri(req.get_request_uri());
+    if (uri == "/stream" || uri == "/stream_length") {
+        co_await stream_processor(ctx, uri == "/stream");
+        co_return;
+    }
+
+    if (uri == "/file" || uri == "/file_length") {
+        co_await file_processor(ctx, uri == "/file");
+        co_return;
+    }
+
+    if (uri == "/hedge") {
+        int n = ++hedge_count;
+        if (n == 1)
+            co_await coke::sleep(0.3);
+
+        resp.append_output_body(std::to_string(n));
+        co_await ctx.reply();
+        co_return;
+    }
+
+    if (uri.starts_with("/cache_")) {
+        ++cache_count;
+
+        if (uri == "/cache_etag") {
+            resp.set_header_pair("Cache-Control", "no-cache");
+            resp.set_header_pair("ETag", "\"v1\"");
+
+            for (const coke::HttpHeaderView &h : coke::HttpHeaderCursor(req)) {
+                if (h.name == "If-None-Match" && h.value == "\"v1\"")
+                    resp.set_status_code("304");
+            }
+        }
+        else
+            resp.set_header_pair("Cache-Control", "max-age=60");
+
+        if (uri == "/cache_slow")
+            co_await coke::sleep(0.1);
+
+        if (std::string_view(resp.get_status_code()) != "304")
+            resp.append_output_body(std::string(uri.substr(7)));
+
+        co_await ctx.reply();
+        co_return;
+    }
+
+    if (uri == "/encoding") {
+        static const std::string body = get_encoding_body();
+
+        int ret = co_await coke::http_set_encoded_body_go(req, resp, body);
+        EXPECT_EQ(ret, 0);
+
+        co_await ctx.reply();
+        co_return;
+    }
+
+    if (uri == "/when_all") {
+        co_await when_all_processor(ctx);
+        co_return;
+    }
+
+    if (uri == "/connection") {
+        int *count = ctx.get_connection_data<int>(0);
+        resp.append_output_body(std::to_string(++*count));
+
+        co_await ctx.reply();
+        co_return;
+    }
+
+    if (uri == "/arena") {
+        std::pmr::vector<std::pmr::string> parts(ctx.get_arena_allocator());
+
+        for (int i = 0; i < 3; i++)
+            parts.emplace_back(std::to_string(i));
+
+        for (const std::pmr::string &part : parts)
+            resp.append_output_body(part.data(), part.size());
+
+        EXPECT_TRUE(ctx.has_arena());
+        co_await ctx.reply();
+        co_return;
+    }
+
+    if (uri == "/metrics") {
+        coke::MetricsRegistry &reg = coke::default_metrics_registry();
+        reg.counter("test_http_metrics_total", "Requests of /metrics").add();
+
+        co_await coke::reply_metrics(ctx, reg);
+        co_return;
+    }
+
+    if (uri == "/fail") {
+        ++fail_count;
+        co_await ctx.noreply();
+        co_return;
+    }
+
+    if (std::string_view(req.get_request_uri()) == "/echo") {
+        std::string_view body = coke::http_body_view(req);
+        resp.append_output_body(body.data(), body.size());
+    }
+    else if (std::string_view(req.get_request_uri()) == "/range")
+        reply_range(req, resp);
+    else
+        resp.append_output_body_nocopy("<html>Hello World</html>");
 
     co_await ctx.reply();
 }
@@ -86,6 +1022,11 @@ int main(int argc, char *argv[]) {
 
     testing::InitGoogleTest(&argc, argv);
 
+    {
+        std::ofstream ofs(file_path, std::ios::binary | std::ios::trunc);
+        ofs << get_range_body();
+    }
+
     coke::HttpServer server(http_processor);
 
     for (int i = 8000; i < 8010; i++) {
@@ -102,6 +1043,7 @@ int main(int argc, char *argv[]) {
 
     int ret = RUN_ALL_TESTS();
     server.stop();
+    std::remove(file_path.c_str());
 
     return ret;
 }
@@ -17,6 +17,7 @@
 */
 
 #include <string>
+#include <vector>
 #include <gtest/gtest.h>
 
 #include "coke/coke.h"
@@ -81,6 +82,32 @@ TEST(LATCH, ret_value) {
     coke::sync_wait(ret_value());
 }
 
+coke::Task<> arrive_and_wait() {
+    constexpr int N = 64;
+    coke::Latch lt(N + 1);
+    std::vector<coke::Task<>> tasks;
+
+    auto func = [&]() -> coke::Task<> {
+        co_await coke::yield();
+        lt.count_down();
+    };
+
+    for (int i = 0; i < N; i++)
+        tasks.emplace_back(func());
+
+    EXPECT_FALSE(lt.try_wait());
+    co_await coke::async_wait(std::move(tasks));
+    EXPECT_FALSE(lt.try_wait());
+
+    int ret = co_await lt.arrive_and_wait();
+    EXPECT_EQ(ret, coke::LATCH_SUCCESS);
+    EXPECT_TRUE(lt.try_wait());
+}
+
+TEST(LATCH, arrive_and_wait) {
+    coke::sync_wait(arrive_and_wait());
+}
+
 int main(int argc, char *argv[]) {
     coke::GlobalSettings s;
     s.poller_threads = 2;
@@ -0,0 +1,96 @@
+/**
+ * Copyright 2024 Coke Project (https://github.com/kedixa/coke)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Authors: kedixa (https://github.com/kedixa)
+*/
+
+#include <thread>
+#include <vector>
+#include <gtest/gtest.h>
+
+#include "coke/latency_histogram.h"
+
+using coke::LatencyHistogram;
+
+TEST(LATENCY_HISTOGRAM, bucket) {
+    for (uint64_t v = 0; v < (1 << 16); v++) {
+        std::size_t idx = LatencyHistogram::bucket_index(v);
+
+        ASSERT_LT(idx, LatencyHistogram::NUM_BUCKETS);
+        ASSERT_GE(LatencyHistogram::bucket_upper(idx), v);
+        if (idx > 0) {
+            ASSERT_LT(LatencyHistogram::bucket_upper(idx - 1), v);
+        }
+    }
+
+    std::size_t last = LatencyHistogram::NUM_BUCKETS - 1;
+    EXPECT_EQ(LatencyHistogram::bucket_index(UINT64_MAX), last);
+}
+
+TEST(LATENCY_HISTOGRAM, percentile) {
+    LatencyHistogram hist;
+
+    for (uint64_t i = 1; i <= 1000; i++)
+        hist.record(i);
+
+    coke::HistogramSnapshot snap = hist.snapshot();
+    EXPECT_EQ(snap.count, 1000u);
+    EXPECT_EQ(snap.max, 1000u);
+    EXPECT_DOUBLE_EQ(snap.mean(), 500.5);
+
+    // The relative error is below 1/16
+    EXPECT_GE(snap.percentile(0.5), 500u);
+    EXPECT_LE(snap.percentile(0.5), 500u + 500u / 16);
+    EXPECT_GE(snap.percentile(0.99), 990u);
+    EXPECT_EQ(snap.percentile(1.0), 1000u);
+
+    hist.reset();
+    EXPECT_EQ(hist.snapshot().count, 0u);
+    EXPECT_EQ(hist.snapshot().percentile(0.5), 0u);
+}
+
+TEST(LATENCY_HISTOGRAM, merge) {
+    constexpr int N = 4;
+    constexpr int M = 10000;
+    LatencyHistogram hist;
+    std::vector<std::thread> threads;
+
+    for (int i = 0; i < N; i++) {
+        threads.emplace_back([&hist, i]() {
+            for (int j = 0; j < M; j++)
+                hist.record(uint64_t(i * M + j));
+        });
+    }
+
+    for (auto &th : threads)
+        th.join();
+
+    coke::HistogramSnapshot snap = hist.snapshot();
+    EXPECT_EQ(snap.count, uint64_t(N * M));
+    EXPECT_EQ(snap.max, uint64_t(N * M - 1));
+
+    coke::HistogramSnapshot merged;
+    merged.merge(snap);
+    merged.merge(snap);
+    EXPECT_EQ(merged.count, 2 * snap.count);
+    EXPECT_EQ(merged.sum, 2 * snap.sum);
+    EXPECT_EQ(merged.percentile(0.5), snap.percentile(0.5));
+}
+
+int main(int argc, char *argv[]) {
+    testing::InitGoogleTest(&argc, argv);
+
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,128 @@
+/**
+ * Copyright 2024 Coke Project (https://github.com/kedixa/coke)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Authors: kedixa (https://github.com/kedixa)
+*/
+
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <gtest/gtest.h>
+
+#include "coke/metrics.h"
+
+TEST(METRICS, counter) {
+    coke::MetricCounter c;
+    std::vector<std::thread> ths;
+
+    for (int i = 0; i < 4; i++) {
+        ths.emplace_back([&c]() {
+            for (int j = 0; j < 10000; j++)
+                c.add();
+        });
+    }
+
+    for (auto &th : ths)
+        th.join();
+
+    EXPECT_EQ(c.value(), 40000u);
+}
+
+TEST(METRICS, same_series) {
+    coke::MetricsRegistry reg;
+
+    coke::MetricCounter &a = reg.counter("req_total", "Requests",
+                                         {{"method", "GET"}});
+    coke::MetricCounter &b = reg.counter("req_total", "Requests",
+                                         {{"method", "GET"}});
+    coke::MetricCounter &c = reg.counter("req_total", "Requests",
+                                         {{"method", "POST"}});
+
+    EXPECT_EQ(&a, &b);
+    EXPECT_NE(&a, &c);
+    EXPECT_THROW(reg.gauge("req_total", "Requests"), std::invalid_argument);
+}
+
+TEST(METRICS, export_prometheus) {
+    coke::MetricsRegistry reg;
+
+    reg.counter("req_total", "Requests", {{"method", "GET"}}).add(3);
+    reg.counter("req_total", "Requests", {{"method", "POST"}}).add(1);
+    reg.gauge("inflight", "Running\nrequests").set(-2);
+    reg.add_callback("ratio", "Ratio", coke::MetricType::GAUGE,
+                     {{"path", "a\"b"}}, []() { return 0.5; });
+
+    std::string out = reg.export_prometheus();
+    std::string expect =
+        "# HELP inflight Running\\nrequests\n"
+        "# TYPE inflight gauge\n"
+        "inflight -2\n"
+        "# HELP ratio Ratio\n"
+        "# TYPE ratio gauge\n"
+        "ratio{path=\"a\\\"b\"} 0.5\n"
+        "# HELP req_total Requests\n"
+        "# TYPE req_total counter\n"
+        "req_total{method=\"GET\"} 3\n"
+        "req_total{method=\"POST\"} 1\n";
+
+    EXPECT_EQ(out, expect);
+}
+
+TEST(METRICS, summary) {
+    coke::MetricsRegistry reg;
+    coke::LatencyHistogram &h = reg.histogram("lat_us", "Latency",
+                                              {{"op", "get"}});
+
+    for (uint64_t i = 1; i <= 10; i++)
+        h.record(i);
+
+    std::string out = reg.export_prometheus();
+
+    EXPECT_NE(out.find("# TYPE lat_us summary\n"), std::string::npos);
+    EXPECT_NE(out.find("lat_us{op=\"get\",quantile=\"0.5\"} 5\n"),
+              std::string::npos);
+    EXPECT_NE(out.find("lat_us{op=\"get\",quantile=\"0.999\"} 10\n"),
+              std::string::npos);
+    EXPECT_NE(out.find("lat_us_sum{op=\"get\"} 55\n"), std::string::npos);
+    EXPECT_NE(out.find("lat_us_count{op=\"get\"} 10\n"), std::string::npos);
+}
+
+TEST(METRICS, remove) {
+    coke::MetricsRegistry reg;
+    int called = 0;
+
+    coke::MetricGauge &g = reg.gauge("g", "Gauge");
+    reg.add_callback("cb", "Callback", coke::MetricType::COUNTER, {},
+                     [&called]() { return double(++called); });
+
+    EXPECT_NE(reg.export_prometheus().find("cb 1\n"), std::string::npos);
+
+    EXPECT_TRUE(reg.remove("cb"));
+    EXPECT_FALSE(reg.remove("cb"));
+    EXPECT_TRUE(reg.remove("g"));
+
+    // The removed metric is still valid
+    g.add(2);
+    EXPECT_EQ(g.value(), 2);
+
+    EXPECT_EQ(reg.export_prometheus(), std::string());
+    EXPECT_EQ(called, 1);
+}
+
+int main(int argc, char *argv[]) {
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
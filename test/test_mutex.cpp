@@ -35,6 +35,8 @@ enum {
 };
 
 struct ParamPack {
+    explicit ParamPack(bool handoff) : mtx(handoff) { }
+
     coke::Mutex mtx;
     std::atomic<int> count;
     std::atomic<int> total;
@@ -79,8 +81,8 @@ coke::Task<> do_test_mutex(ParamPack *p) {
     }
 }
 
-void test_mutex(int test_method) {
-    ParamPack p;
+void test_mutex(int test_method, bool handoff = false) {
+    ParamPack p(handoff);
     p.count = 0;
     p.total = 0;
     p.test_method = test_method;
@@ -139,6 +141,82 @@ coke::Task<> test_unique_lock() {
     }
 }
 
+coke::Task<> test_lock_until() {
+    auto deadline = std::chrono::steady_clock::now() + ms10;
+    coke::Mutex mtx;
+
+    EXPECT_EQ(co_await mtx.try_lock_until(deadline), coke::TOP_SUCCESS);
+    EXPECT_EQ(co_await mtx.try_lock_until(deadline), coke::TOP_TIMEOUT);
+    EXPECT_GE(std::chrono::steady_clock::now(), deadline);
+    mtx.unlock();
+
+    coke::UniqueLock<coke::Mutex> lock(mtx);
+    EXPECT_EQ(co_await lock.try_lock_until(deadline), coke::TOP_SUCCESS);
+    EXPECT_TRUE(lock.owns_lock());
+}
+
+TEST(MUTEX, lock_awaiter) {
+    coke::Mutex mtx;
+
+    EXPECT_EQ(coke::sync_wait(mtx.lock()), coke::TOP_SUCCESS);
+    EXPECT_FALSE(mtx.try_lock());
+    EXPECT_EQ(coke::sync_wait(mtx.try_lock_for(ms10)), coke::TOP_TIMEOUT);
+
+    mtx.unlock();
+    EXPECT_TRUE(mtx.try_lock());
+    mtx.unlock();
+}
+
+coke::Task<> keyed_worker(coke::KeyedMutex<int> &km, std::atomic<int> *in,
+                          int *total, int key) {
+    for (int i = 0; i < 32; i++) {
+        EXPECT_EQ(co_await km.lock(key), coke::TOP_SUCCESS);
+        EXPECT_EQ(in[key].fetch_add(1, relaxed), 0);
+
+        co_await coke::sleep(us1);
+        total[key]++;
+
+        in[key].fetch_sub(1, relaxed);
+        km.unlock(key);
+    }
+}
+
+coke::Task<> test_keyed_mutex() {
+    constexpr int K = 4;
+    coke::KeyedMutex<int> km;
+    std::atomic<int> in[K];
+    int total[K] = {0};
+    std::vector<coke::Task<>> tasks;
+
+    for (int k = 0; k < K; k++) {
+        in[k] = 0;
+        for (int i = 0; i < 8; i++)
+            tasks.emplace_back(keyed_worker(km, in, total, k));
+    }
+
+    co_await coke::async_wait(std::move(tasks));
+
+    for (int k = 0; k < K; k++)
+        EXPECT_EQ(total[k], 8 * 32);
+
+    // The state of each key is freed after the last one releases it
+    EXPECT_EQ(km.size(), 0u);
+
+    EXPECT_TRUE(km.try_lock(1));
+    EXPECT_FALSE(km.try_lock(1));
+    EXPECT_TRUE(km.try_lock(2));
+    EXPECT_EQ(co_await km.try_lock_for(1, ms10), coke::TOP_TIMEOUT);
+    EXPECT_EQ(km.size(), 2u);
+
+    km.unlock(1);
+    km.unlock(2);
+    EXPECT_EQ(km.size(), 0u);
+}
+
+TEST(MUTEX, keyed_mutex) {
+    coke::sync_wait(test_keyed_mutex());
+}
+
 TEST(MUTEX, try_lock) {
     test_mutex(TEST_TRY_LOCK);
 }
@@ -151,6 +229,61 @@ TEST(MUTEX, lock_for) {
     test_mutex(TEST_LOCK_FOR);
 }
 
+TEST(MUTEX, spin_lock) {
+    coke::set_lock_spin_count(100);
+    test_mutex(TEST_LOCK);
+    test_mutex(TEST_LOCK_FOR);
+    coke::set_lock_spin_count(0);
+}
+
+coke::Task<> test_handoff() {
+    coke::Mutex mtx(true);
+    std::vector<int> order;
+
+    auto waiter = [&](int i) -> coke::Task<> {
+        EXPECT_EQ(co_await mtx.lock(), coke::TOP_SUCCESS);
+        order.push_back(i);
+        co_await coke::sleep(std::chrono::milliseconds(1));
+        mtx.unlock();
+    };
+
+    EXPECT_TRUE(mtx.is_handoff());
+    EXPECT_TRUE(mtx.try_lock());
+
+    // Timeout waiters leave the queue without the ownership
+    EXPECT_EQ(co_await mtx.try_lock_for(ms10), coke::TOP_TIMEOUT);
+
+    std::vector<coke::Task<>> tasks;
+    for (int i = 0; i < 4; i++)
+        tasks.emplace_back(waiter(i));
+
+    auto run = coke::async_wait(std::move(tasks));
+    auto unlock = [&]() -> coke::Task<> {
+        co_await coke::sleep(ms10);
+
+        // Ownership is passed to the waiters in order, no one can barge in
+        mtx.unlock();
+        EXPECT_FALSE(mtx.try_lock());
+    };
+
+    co_await coke::async_wait(std::move(run), unlock());
+    EXPECT_EQ(order, (std::vector<int>{0, 1, 2, 3}));
+
+    EXPECT_TRUE(mtx.try_lock());
+    mtx.unlock();
+}
+
+TEST(MUTEX, handoff) {
+    test_mutex(TEST_TRY_LOCK, true);
+    test_mutex(TEST_LOCK, true);
+    test_mutex(TEST_LOCK_FOR, true);
+    coke::sync_wait(test_handoff());
+}
+
+TEST(MUTEX, lock_until) {
+    coke::sync_wait(test_lock_until());
+}
+
 TEST(MUTEX, unique_lock) {
     coke::sync_wait(test_unique_lock());
 }
@@ -0,0 +1,698 @@
+/**
+ * Copyright 2024 Coke Project (https://github.com/kedixa/coke)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Authors: kedixa (https://github.com/kedixa)
+*/
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <utility>
+#include <vector>
+#include <gtest/gtest.h>
+
+#include "coke/coke.h"
+#include "coke/mysql/mysql_client.h"
+#include "coke/mysql/mysql_connection_pool.h"
+#include "coke/mysql/mysql_statement.h"
+#include "coke/mysql/mysql_utils.h"
+#include "fake_server.h"
+
+TEST(MYSQL, escape_string) {
+    std::string out;
+    coke::mysql_escape_string(std::string_view("a'b\"c\\d\n\r\0\032", 11), out);
+    EXPECT_EQ(out, "a\\'b\\\"c\\\\d\\n\\r\\0\\Z");
+}
+
+TEST(MYSQL, statement_bind) {
+    coke::MySQLStatement stmt("SELECT * FROM t WHERE id = ? AND name = ? "
+                              "AND note != '?' AND `a?b` = ? -- ?\n"
+                              "AND x = ? /* ? */");
+    std::string query;
+
+    EXPECT_EQ(stmt.param_count(), 4u);
+    EXPECT_EQ(stmt.bind(query, {42, "it's", nullptr, 1.5}), 0);
+    EXPECT_EQ(query, "SELECT * FROM t WHERE id = 42 AND name = 'it\\'s' "
+                     "AND note != '?' AND `a?b` = NULL -- ?\n"
+                     "AND x = 1.5 /* ? */");
+
+    EXPECT_EQ(stmt.bind(query, {1, 2, 3}), -EINVAL);
+    EXPECT_EQ(stmt.bind(query, {1, 2, 3, NAN}), -EINVAL);
+
+    coke::MySQLStatement no_param("SELECT 'a\\'?'");
+    EXPECT_EQ(no_param.param_count(), 0u);
+    EXPECT_EQ(no_param.bind(query, {}), 0);
+    EXPECT_EQ(query, no_param.get_sql());
+
+    coke::MySQLStatement unsigned_param("SELECT ?, ?");
+    EXPECT_EQ(unsigned_param.bind(query, {18446744073709551615ULL, -7LL}), 0);
+    EXPECT_EQ(query, "SELECT 18446744073709551615, -7");
+}
+
+TEST(MYSQL, cell_decode) {
+    coke::MySQLCellView i(MYSQL_TYPE_LONGLONG, "-42");
+    coke::MySQLCellView d(MYSQL_TYPE_NEWDECIMAL, "3.25");
+    coke::MySQLCellView s(MYSQL_TYPE_VAR_STRING, "abc");
+    coke::MySQLCellView null;
+
+    EXPECT_EQ(i.as<int64_t>(), -42);
+    EXPECT_EQ(i.as<uint64_t>(7), 7u);
+    EXPECT_EQ(i.as<bool>(), true);
+    EXPECT_EQ(d.as<double>(), 3.25);
+    EXPECT_EQ(s.as<std::string_view>(), "abc");
+    EXPECT_EQ(s.as<int>(-1), -1);
+    EXPECT_EQ(null.as<std::optional<int>>(5), std::nullopt);
+    EXPECT_EQ(i.as<std::optional<int>>(), -42);
+
+    int x;
+    EXPECT_EQ(null.decode(x), std::errc::invalid_argument);
+    EXPECT_EQ(coke::MySQLCellView(MYSQL_TYPE_TINY, "300").decode(x), std::errc());
+    EXPECT_EQ(x, 300);
+
+    int8_t y;
+    EXPECT_EQ(coke::MySQLCellView(MYSQL_TYPE_TINY, "300").decode(y),
+              std::errc::result_out_of_range);
+}
+
+TEST(MYSQL, cell_decode_datetime) {
+    coke::MySQLDateTime dt;
+    coke::MySQLTime t;
+
+    coke::MySQLCellView c1(MYSQL_TYPE_DATETIME, "2024-02-29 23:59:58.125");
+    EXPECT_EQ(c1.decode(dt), std::errc());
+    EXPECT_EQ(dt, (coke::MySQLDateTime{2024, 2, 29, 23, 59, 58, 125000}));
+
+    coke::MySQLCellView c2(MYSQL_TYPE_DATE, "2024-01-02");
+    EXPECT_EQ(c2.decode(dt), std::errc());
+    EXPECT_EQ(dt, (coke::MySQLDateTime{2024, 1, 2, 0, 0, 0, 0}));
+
+    coke::MySQLCellView c3(MYSQL_TYPE_TIME, "-838:59:59");
+    EXPECT_EQ(c3.decode(t), std::errc());
+    EXPECT_EQ(t, (coke::MySQLTime{true, 838, 59, 59, 0}));
+
+    coke::MySQLCellView c4(MYSQL_TYPE_DATETIME, "2024-13-01 00:00:00");
+    EXPECT_EQ(c4.decode(dt), std::errc::invalid_argument);
+
+    coke::MySQLCellView c5(MYSQL_TYPE_DATETIME, "2024-01-01 00:00:00x");
+    EXPECT_EQ(c5.decode(dt), std::errc::invalid_argument);
+    EXPECT_EQ(c3.decode(dt), std::errc::invalid_argument);
+}
+
+TEST(MYSQL, bind_row) {
+    std::vector<coke::MySQLCellView> cells{
+        {MYSQL_TYPE_LONG, "1"},
+        {MYSQL_TYPE_VAR_STRING, "name"},
+        {},
+        {MYSQL_TYPE_DOUBLE, "0.5"},
+    };
+
+    std::tuple<int, std::string_view, std::optional<int>, double> row;
+    EXPECT_EQ(coke::mysql_bind_row(cells, row), std::errc());
+    EXPECT_EQ(std::get<0>(row), 1);
+    EXPECT_EQ(std::get<1>(row), "name");
+    EXPECT_EQ(std::get<2>(row), std::nullopt);
+    EXPECT_EQ(std::get<3>(row), 0.5);
+
+    struct Item {
+        long id;
+        std::string name;
+        std::optional<int> count;
+        float score;
+    } item;
+
+    auto ec = coke::mysql_bind_row(cells,
+        std::tie(item.id, item.name, item.count, item.score));
+    EXPECT_EQ(ec, std::errc());
+    EXPECT_EQ(item.id, 1);
+    EXPECT_EQ(item.name, "name");
+    EXPECT_EQ(item.count, std::nullopt);
+    EXPECT_EQ(item.score, 0.5f);
+
+    std::tuple<int, int, int, double> bad_row;
+    EXPECT_EQ(coke::mysql_bind_row(cells, bad_row), std::errc::invalid_argument);
+
+    std::tuple<int, std::string> short_row;
+    EXPECT_EQ(coke::mysql_bind_row(cells, short_row), std::errc::invalid_argument);
+}
+
+TEST(MYSQL, batch) {
+    coke::MySQLBatch batch;
+    EXPECT_TRUE(batch.empty());
+
+    batch.add("INSERT INTO t VALUES (1);");
+    batch.add("UPDATE t SET a = 2 ;\n");
+    batch.add("DELETE FROM t");
+
+    EXPECT_EQ(batch.size(), 3u);
+    EXPECT_EQ(batch.get_statement(0), "INSERT INTO t VALUES (1)");
+    EXPECT_EQ(batch.get_statement(1), "UPDATE t SET a = 2");
+    EXPECT_EQ(batch.get_statement(2), "DELETE FROM t");
+
+    batch.clear();
+    EXPECT_TRUE(batch.empty());
+}
+
+/**
+ * Build the packets of a text protocol response as if they are sent by the
+ * server, the sequence id starts from 1 after the request.
+*/
+class PacketBuilder {
+public:
+    PacketBuilder() = default;
+    explicit PacketBuilder(int seqid) : seqid(seqid) { }
+
+    static std::string lenenc(std::string_view s) {
+        return std::string(1, (char)s.size()).append(s);
+    }
+
+    static std::string column(std::string_view name, int type) {
+        std::string p;
+
+        p.append(lenenc("def")).append(lenenc("db"))
+         .append(lenenc("t")).append(lenenc("t"))
+         .append(lenenc(name)).append(lenenc(name));
+        // length of the fixed fields, charset, column length
+        p.append("\x0c\x21\x00\x0b\x00\x00\x00", 7);
+        // type, flags, decimals and filler
+        p.push_back((char)type);
+        p.append("\x00\x00\x00\x00\x00", 5);
+        return p;
+    }
+
+    static std::string eof(int status) {
+        std::string p("\xfe\x00\x00", 3);
+        p.push_back((char)(status & 0xFF));
+        p.push_back((char)(status >> 8));
+        return p;
+    }
+
+    static std::string ok(int affected, int status) {
+        std::string p(1, '\x00');
+        p.push_back((char)affected);
+        p.push_back('\x00');
+        p.push_back((char)(status & 0xFF));
+        p.push_back((char)(status >> 8));
+        p.append("\x00\x00", 2);
+        return p;
+    }
+
+    static std::string err(int code, std::string_view msg) {
+        std::string p("\xff", 1);
+        p.push_back((char)(code & 0xFF));
+        p.push_back((char)(code >> 8));
+        p.append("#42000").append(msg);
+        return p;
+    }
+
+    PacketBuilder &packet(const std::string &payload) {
+        std::size_t n = payload.size();
+
+        data.push_back((char)(n & 0xFF));
+        data.push_back((char)((n >> 8) & 0xFF));
+        data.push_back((char)((n >> 16) & 0xFF));
+        data.push_back((char)(seqid++));
+        data.append(payload);
+        return *this;
+    }
+
+    // The header, column definitions, rows and the EOF of one result set,
+    // std::nullopt is a NULL cell
+    using Column = std::pair<std::string, int>;
+    using Row = std::vector<std::optional<std::string>>;
+
+    PacketBuilder &result_set(const std::vector<Column> &cols,
+                              const std::vector<Row> &rows, int status) {
+        packet(std::string(1, (char)cols.size()));
+        for (const auto &[name, type] : cols)
+            packet(column(name, type));
+        packet(eof(status));
+
+        for (const Row &row : rows) {
+            std::string p;
+            for (const auto &cell : row)
+                p.append(cell ? lenenc(*cell) : std::string(1, '\xfb'));
+            packet(p);
+        }
+
+        return packet(eof(status));
+    }
+
+    const std::string &get_data() const { return data; }
+
+private:
+    std::string data;
+    int seqid{1};
+};
+
+// Feed the packets to a response as the client task does
+class PacketResponse : public coke::MySQLResponse {
+public:
+    int feed(const std::string &data) {
+        std::size_t size = data.size();
+        return this->append(data.data(), &size);
+    }
+};
+
+constexpr int STATUS_AUTOCOMMIT = 0x0002;
+constexpr int STATUS_MORE_RESULTS = 0x0008;
+
+TEST(MYSQL, result_table) {
+    constexpr int more = STATUS_AUTOCOMMIT | STATUS_MORE_RESULTS;
+    PacketBuilder builder;
+
+    builder.result_set({{"id", MYSQL_TYPE_LONGLONG},
+                        {"Name", MYSQL_TYPE_VAR_STRING},
+                        {"note", MYSQL_TYPE_VAR_STRING}},
+                       {{"1", "a", std::nullopt}, {"2", "b", "x"}}, more);
+    // Duplicate names, the first one is found
+    builder.result_set({{"cnt", MYSQL_TYPE_LONGLONG},
+                        {"CNT", MYSQL_TYPE_LONGLONG}},
+                       {{"3", std::nullopt}}, more);
+    builder.packet(PacketBuilder::ok(0, STATUS_AUTOCOMMIT));
+
+    PacketResponse resp;
+    EXPECT_EQ(resp.feed(builder.get_data()), 1);
+
+    coke::MySQLResultTable table(resp);
+    std::vector<coke::MySQLCellView> cells;
+    ASSERT_EQ(table.size(), 3u);
+
+    // Column access by index and by name
+    auto fields = table.get_fields(0);
+    EXPECT_EQ(fields.size(), 3u);
+    EXPECT_EQ(fields[1].get_name_view(), "Name");
+    EXPECT_EQ(fields[2].get_data_type(), MYSQL_TYPE_VAR_STRING);
+    EXPECT_EQ(table.find_field(0, "id"), 0);
+    EXPECT_EQ(table.find_field(0, "name"), 1);
+    EXPECT_EQ(table.find_field(0, "NOTE"), 2);
+    EXPECT_EQ(table.find_field(0, "missing"), -1);
+
+    // Row access and NULL handling
+    coke::MySQLResultSetView view = table.get_result_set(0);
+    int col = table.find_field(0, "note");
+    EXPECT_TRUE(view.is_result_set());
+    EXPECT_EQ(view.get_row_count(), 2);
+
+    EXPECT_TRUE(view.next_row(cells));
+    EXPECT_EQ(cells.size(), 3u);
+    EXPECT_EQ(cells[0].as<int>(), 1);
+    EXPECT_EQ(cells[1].as<std::string_view>(), "a");
+    EXPECT_TRUE(cells[col].is_null());
+    EXPECT_EQ(cells[col].as<std::optional<std::string_view>>(), std::nullopt);
+
+    EXPECT_TRUE(view.next_row(cells));
+    EXPECT_EQ(cells[0].as<int>(), 2);
+    EXPECT_FALSE(cells[col].is_null());
+    EXPECT_EQ(cells[col].as<std::string_view>(), "x");
+    EXPECT_FALSE(view.next_row(cells));
+
+    // Every view from the table starts at the first row
+    view = table.get_result_set(0);
+    EXPECT_TRUE(view.next_row(cells));
+    EXPECT_EQ(cells[0].as<int>(), 1);
+
+    // The following result sets
+    EXPECT_EQ(table.get_fields(1).size(), 2u);
+    EXPECT_EQ(table.find_field(1, "Cnt"), 0);
+    EXPECT_EQ(table.find_field(1, "id"), -1);
+
+    view = table.get_result_set(1);
+    EXPECT_TRUE(view.next_row(cells));
+    EXPECT_EQ(cells[0].as<int>(), 3);
+    EXPECT_TRUE(cells[1].is_null());
+    EXPECT_FALSE(view.next_row(cells));
+
+    EXPECT_TRUE(table.get_result_set(2).is_ok());
+    EXPECT_TRUE(table.get_fields(2).empty());
+    EXPECT_EQ(table.find_field(2, "id"), -1);
+
+    // Reset with another response
+    PacketBuilder ok_builder;
+    PacketResponse ok_resp;
+
+    ok_builder.packet(PacketBuilder::ok(5, STATUS_AUTOCOMMIT));
+    EXPECT_EQ(ok_resp.feed(ok_builder.get_data()), 1);
+
+    table.reset(ok_resp);
+    EXPECT_EQ(table.size(), 1u);
+    EXPECT_TRUE(table.get_result_set(0).is_ok());
+    EXPECT_EQ(table.get_result_set(0).get_affected_rows(), 5u);
+
+    table.clear();
+    EXPECT_TRUE(table.empty());
+}
+
+/**
+ * A minimal mysql server for the tests, it accepts any user and replies OK to
+ * every query, except that the queries starting with FAIL get an error, and
+ * `SELECT id FROM nums ORDER BY id LIMIT offset, count` returns the numbers
+ * in [offset, offset + count) that are less than NUMS_ROWS.
+*/
+class FakeMySQLServer : public FakeServer {
+public:
+    static constexpr std::size_t NUMS_ROWS = 10;
+
+    FakeMySQLServer() = default;
+    ~FakeMySQLServer() { stop(); }
+
+    // The number of times `query` is received
+    std::size_t count_query(const std::string &query) {
+        std::lock_guard<std::mutex> lg(mtx);
+        auto n = std::count(queries.begin(), queries.end(), query);
+        return static_cast<std::size_t>(n);
+    }
+
+    std::vector<std::string> get_queries() {
+        std::lock_guard<std::mutex> lg(mtx);
+        return queries;
+    }
+
+    void clear_queries() {
+        std::lock_guard<std::mutex> lg(mtx);
+        queries.clear();
+    }
+
+private:
+    static bool recv_packet(int fd, std::string &payload) {
+        unsigned char header[4];
+        std::size_t len;
+
+        if (!recv_all(fd, (char *)header, 4))
+            return false;
+
+        len = header[0] | (header[1] << 8) | (header[2] << 16);
+        payload.resize(len);
+        return recv_all(fd, payload.data(), len);
+    }
+
+    static std::string greeting() {
+        // PROTOCOL_41, TRANSACTIONS, SECURE_CONNECTION, MULTI_STATEMENTS,
+        // MULTI_RESULTS, PLUGIN_AUTH, and the flags of old clients
+        constexpr uint32_t caps = 0x000BA20F;
+        std::string p("\x0a" "5.7.40-fake", 12);
+
+        p.push_back('\0');
+        p.append("\x01\x00\x00\x00", 4);
+        p.append("abcdefgh", 8).push_back('\0');
+        p.push_back((char)(caps & 0xFF));
+        p.push_back((char)((caps >> 8) & 0xFF));
+        p.append("\x21\x02\x00", 3);
+        p.push_back((char)((caps >> 16) & 0xFF));
+        p.push_back((char)(caps >> 24));
+        p.push_back((char)21);
+        p.append(10, '\0');
+        p.append("ijklmnopqrst", 12).push_back('\0');
+        p.append("mysql_native_password").push_back('\0');
+        return p;
+    }
+
+    void serve(int fd) override {
+        std::string payload;
+
+        // Accept any user and password
+        send_all(fd, PacketBuilder(0).packet(greeting()).get_data());
+        if (recv_packet(fd, payload)) {
+            PacketBuilder builder(2);
+            builder.packet(PacketBuilder::ok(0, STATUS_AUTOCOMMIT));
+            send_all(fd, builder.get_data());
+        }
+
+        while (recv_packet(fd, payload) && !payload.empty()) {
+            // COM_QUIT
+            if (payload[0] == 0x01)
+                break;
+
+            std::string query;
+            if (payload[0] == 0x03) {
+                query = payload.substr(1);
+
+                std::lock_guard<std::mutex> lg(mtx);
+                queries.push_back(query);
+            }
+
+            PacketBuilder builder;
+            handle(query, builder);
+            send_all(fd, builder.get_data());
+        }
+    }
+
+    void handle(const std::string &query, PacketBuilder &builder) {
+        std::string_view nums("SELECT id FROM nums ORDER BY id LIMIT ");
+        std::size_t offset, count;
+
+        if (query.starts_with("FAIL"))
+            builder.packet(PacketBuilder::err(1064, "syntax error"));
+        else if (query.starts_with(nums) &&
+                 std::sscanf(query.c_str() + nums.size(), "%zu, %zu",
+                             &offset, &count) == 2) {
+            std::vector<PacketBuilder::Row> rows;
+
+            for (std::size_t i = offset;
+                 i < NUMS_ROWS && i < offset + count; i++)
+                rows.push_back({std::to_string(i)});
+
+            builder.result_set({{"id", MYSQL_TYPE_LONGLONG}}, rows,
+                               STATUS_AUTOCOMMIT);
+        }
+        else
+            builder.packet(PacketBuilder::ok(0, STATUS_AUTOCOMMIT));
+    }
+
+private:
+    std::vector<std::string> queries;
+};
+
+FakeMySQLServer fake_server;
+int fake_port = -1;
+
+coke::MySQLClientParams fake_params() {
+    coke::MySQLClientParams params;
+    params.host = "127.0.0.1";
+    params.port = fake_port;
+    params.username = "root";
+    params.password = "password";
+    return params;
+}
+
+coke::Task<int> run_query(coke::MySQLClient &cli, std::string query) {
+    coke::MySQLResult res = co_await cli.request(query);
+
+    if (res.state != coke::STATE_SUCCESS)
+        co_return -1;
+
+    co_return res.resp.is_error_packet() ? 1 : 0;
+}
+
+coke::Task<> test_pool_reuse() {
+    coke::MySQLPoolParams params;
+    params.max_connections = 2;
+    coke::MySQLConnectionPool pool(fake_params(), params);
+    coke::MySQLPooledConnection c1, c2, c3;
+    int ret;
+    bool ok;
+
+    fake_server.clear_queries();
+
+    ret = co_await pool.acquire(c1);
+    EXPECT_EQ(ret, coke::TOP_SUCCESS);
+    ret = co_await pool.acquire(c2);
+    EXPECT_EQ(ret, coke::TOP_SUCCESS);
+    EXPECT_TRUE(c1.valid() && c2.valid());
+
+    // The pool is exhausted
+    ret = co_await pool.try_acquire_for(std::chrono::milliseconds(20), c3);
+    EXPECT_EQ(ret, coke::TOP_TIMEOUT);
+    EXPECT_FALSE(c3.valid());
+
+    // The connection is established by the first request
+    std::size_t conns = fake_server.connections();
+    ret = co_await run_query(*c1, "BEGIN");
+    EXPECT_EQ(ret, 0);
+    EXPECT_EQ(fake_server.connections(), conns + 1);
+
+    // A released connection is reset, then handed out again while a waiter
+    // is still blocked by max_connections
+    coke::MySQLConnection *p = c1.get();
+    c1.release();
+    EXPECT_FALSE(c1.valid());
+
+    ret = co_await pool.acquire(c3);
+    EXPECT_EQ(ret, coke::TOP_SUCCESS);
+    EXPECT_EQ(c3.get(), p);
+    EXPECT_EQ(fake_server.count_query("ROLLBACK"), 1u);
+
+    // Reused without a new handshake
+    ret = co_await run_query(*c3, "COMMIT");
+    EXPECT_EQ(ret, 0);
+    EXPECT_EQ(fake_server.connections(), conns + 1);
+
+    // A broken connection is disconnected instead of being reset
+    ret = co_await run_query(*c2, "SELECT 1");
+    EXPECT_EQ(ret, 0);
+    c2.set_broken();
+    c2.release();
+
+    ok = co_await wait_until([] {
+        return fake_server.active_connections() == 1;
+    });
+    EXPECT_TRUE(ok);
+    EXPECT_EQ(pool.idle_count(), 0u);
+    EXPECT_EQ(fake_server.count_query("ROLLBACK"), 1u);
+
+    c3.release();
+    ok = co_await wait_until([&pool] { return pool.idle_count() == 1; });
+    EXPECT_TRUE(ok);
+
+    coke::HistogramSnapshot stats = pool.get_wait_stats();
+    EXPECT_EQ(stats.count, 3u);
+
+    co_await pool.close();
+    EXPECT_EQ(pool.idle_count(), 0u);
+
+    ret = co_await pool.acquire(c1);
+    EXPECT_EQ(ret, -ECANCELED);
+
+    ok = co_await wait_until([] {
+        return fake_server.active_connections() == 0;
+    });
+    EXPECT_TRUE(ok);
+}
+
+coke::Task<> test_pool_reset_failed() {
+    coke::MySQLPoolParams params;
+    params.reset_query = "FAIL RESET";
+    coke::MySQLConnectionPool pool(fake_params(), params);
+    coke::MySQLPooledConnection conn;
+    int ret;
+    bool ok;
+
+    ret = co_await pool.acquire(conn);
+    EXPECT_EQ(ret, coke::TOP_SUCCESS);
+    ret = co_await run_query(*conn, "FAIL QUERY");
+    EXPECT_EQ(ret, 1);
+
+    // The session state is unknown if the reset fails, never reuse it
+    conn.release();
+    ok = co_await wait_until([] {
+        return fake_server.count_query("FAIL RESET") == 1 &&
+               fake_server.active_connections() == 0;
+    });
+    EXPECT_TRUE(ok);
+    EXPECT_EQ(pool.idle_count(), 0u);
+
+    co_await pool.close();
+}
+
+TEST(MYSQL, connection_pool) {
+    coke::sync_wait(test_pool_reuse());
+    coke::sync_wait(test_pool_reset_failed());
+}
+
+// Stream the nums table, return the row count of each batch, or -1 for the
+// batches that are not result sets
+coke::Task<std::vector<int>>
+stream_nums(std::string query, std::size_t batch_rows,
+            std::vector<std::size_t> &ids) {
+    coke::MySQLClient cli(fake_params());
+    auto gen = cli.stream(std::move(query), batch_rows);
+    std::vector<int> batches;
+    std::vector<coke::MySQLCellView> cells;
+
+    while (auto res = co_await gen.next()) {
+        EXPECT_EQ(res->state, coke::STATE_SUCCESS);
+        coke::MySQLResultSetCursor cursor(res->resp);
+        int rows = -1;
+
+        for (coke::MySQLResultSetView view : cursor) {
+            if (view.is_result_set()) {
+                rows = view.get_row_count();
+                while (view.next_row(cells))
+                    ids.push_back(cells[0].as<std::size_t>());
+            }
+
+            break;
+        }
+
+        batches.push_back(rows);
+    }
+
+    co_return batches;
+}
+
+coke::Task<> test_stream() {
+    const std::string query = "SELECT id FROM nums ORDER BY id";
+    std::vector<std::size_t> ids, all_ids;
+    std::vector<int> batches;
+
+    for (std::size_t i = 0; i < FakeMySQLServer::NUMS_ROWS; i++)
+        all_ids.push_back(i);
+
+    // The last batch is short, the trailing semicolon is removed
+    fake_server.clear_queries();
+    batches = co_await stream_nums(query + " ;", 4, ids);
+    EXPECT_EQ(batches, std::vector<int>({4, 4, 2}));
+    EXPECT_EQ(ids, all_ids);
+    EXPECT_EQ(fake_server.get_queries(), std::vector<std::string>({
+        query + " LIMIT 0, 4",
+        query + " LIMIT 4, 4",
+        query + " LIMIT 8, 4",
+    }));
+
+    // An empty batch finishes it
+    ids.clear();
+    batches = co_await stream_nums(query, 5, ids);
+    EXPECT_EQ(batches, std::vector<int>({5, 5, 0}));
+    EXPECT_EQ(ids, all_ids);
+
+    // One batch holds all the rows
+    ids.clear();
+    batches = co_await stream_nums(query, 100, ids);
+    EXPECT_EQ(batches, std::vector<int>({10}));
+    EXPECT_EQ(ids, all_ids);
+
+    // An error packet is yielded, then the generator finishes
+    ids.clear();
+    fake_server.clear_queries();
+    batches = co_await stream_nums("FAIL SELECT", 4, ids);
+    EXPECT_EQ(batches, std::vector<int>({-1}));
+    EXPECT_TRUE(ids.empty());
+    EXPECT_EQ(fake_server.count_query("FAIL SELECT LIMIT 0, 4"), 1u);
+}
+
+TEST(MYSQL, stream) {
+    coke::sync_wait(test_stream());
+}
+
+int main(int argc, char *argv[]) {
+    coke::library_init(coke::GlobalSettings());
+
+    fake_port = fake_server.start();
+    if (fake_port < 0)
+        return 1;
+
+    testing::InitGoogleTest(&argc, argv);
+    int ret = RUN_ALL_TESTS();
+
+    fake_server.stop();
+    return ret;
+}
@@ -0,0 +1,195 @@
+/**
+ * Copyright 2024 Coke Project (https://github.com/kedixa/coke)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Authors: kedixa (https://github.com/kedixa)
+*/
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <gtest/gtest.h>
+
+#include "coke/coke.h"
+#include "coke/object_pool.h"
+
+struct Buffer {
+    Buffer() { live.fetch_add(1); }
+    ~Buffer() { live.fetch_sub(1); }
+
+    std::string data;
+
+    static std::atomic<int> live;
+};
+
+std::atomic<int> Buffer::live{0};
+
+using BufferPool = coke::ObjectPool<Buffer>;
+
+coke::ObjectPoolParams make_params(std::size_t max_objects) {
+    coke::ObjectPoolParams params;
+    params.max_objects = max_objects;
+    params.local_caches = 4;
+    params.local_cache_size = 2;
+    return params;
+}
+
+TEST(OBJECT_POOL, reuse) {
+    BufferPool pool(make_params(4));
+    Buffer *first;
+
+    {
+        BufferPool::Handle h = pool.try_acquire();
+        ASSERT_TRUE(h);
+        first = h.get();
+        h->data = "hello";
+    }
+
+    EXPECT_EQ(pool.created(), 1u);
+    EXPECT_EQ(pool.idle(), 1u);
+
+    BufferPool::Handle h = pool.try_acquire();
+    ASSERT_TRUE(h);
+    EXPECT_EQ(h.get(), first);
+    EXPECT_EQ(h->data, "hello");
+    EXPECT_EQ(pool.created(), 1u);
+}
+
+TEST(OBJECT_POOL, limit) {
+    BufferPool pool(make_params(3));
+    std::vector<BufferPool::Handle> handles;
+
+    for (int i = 0; i < 3; i++) {
+        handles.push_back(pool.try_acquire());
+        EXPECT_TRUE(handles.back());
+    }
+
+    EXPECT_FALSE(pool.try_acquire());
+    EXPECT_EQ(pool.created(), 3u);
+
+    // Discarded object is destroyed, and a new one can be created
+    handles[0].discard();
+    EXPECT_FALSE(handles[0]);
+    EXPECT_EQ(pool.created(), 2u);
+    EXPECT_TRUE(pool.try_acquire());
+
+    handles.clear();
+    EXPECT_EQ(pool.idle(), 3u);
+}
+
+TEST(OBJECT_POOL, factory) {
+    int cnt = 0;
+    auto factory = [&cnt]() {
+        auto p = std::make_unique<Buffer>();
+        p->data = std::to_string(++cnt);
+        return p;
+    };
+
+    {
+        BufferPool pool(make_params(0), factory);
+        auto h1 = pool.try_acquire();
+        auto h2 = pool.try_acquire();
+
+        EXPECT_EQ(h1->data, "1");
+        EXPECT_EQ(h2->data, "2");
+    }
+
+    EXPECT_EQ(Buffer::live.load(), 0);
+}
+
+coke::Task<> acquire_timeout() {
+    BufferPool pool(make_params(1));
+    auto h1 = co_await pool.acquire();
+    EXPECT_TRUE(h1);
+
+    auto h2 = co_await pool.acquire_for(std::chrono::milliseconds(10));
+    EXPECT_FALSE(h2);
+
+    auto deadline = std::chrono::steady_clock::now() +
+                    std::chrono::milliseconds(10);
+    auto h3 = co_await pool.acquire_until(deadline);
+    EXPECT_FALSE(h3);
+}
+
+TEST(OBJECT_POOL, acquire_timeout) {
+    coke::sync_wait(acquire_timeout());
+}
+
+coke::Task<> release_later(BufferPool::Handle h) {
+    co_await coke::sleep(std::chrono::milliseconds(10));
+    h.reset();
+}
+
+coke::Task<> acquire_wait() {
+    BufferPool pool(make_params(1));
+    auto h1 = co_await pool.acquire();
+    Buffer *p = h1.get();
+
+    auto waiter = [&]() -> coke::Task<> {
+        auto h2 = co_await pool.acquire_for(std::chrono::seconds(5));
+        EXPECT_EQ(h2.get(), p);
+    };
+
+    co_await coke::async_wait(release_later(std::move(h1)), waiter());
+}
+
+TEST(OBJECT_POOL, acquire_wait) {
+    coke::sync_wait(acquire_wait());
+}
+
+coke::Task<> worker(BufferPool &pool, int n, std::atomic<int> &cnt) {
+    for (int i = 0; i < n; i++) {
+        auto h = co_await pool.acquire();
+
+        if (h) {
+            cnt.fetch_add(1);
+
+            if (i % 3 == 0)
+                co_await coke::yield();
+        }
+    }
+}
+
+coke::Task<> multi_thread() {
+    constexpr int N = 16, M = 200;
+    BufferPool pool(make_params(4));
+    std::atomic<int> cnt{0};
+    std::vector<coke::Task<>> tasks;
+
+    for (int i = 0; i < N; i++)
+        tasks.emplace_back(worker(pool, M, cnt));
+
+    co_await coke::async_wait(std::move(tasks));
+
+    EXPECT_EQ(cnt.load(), N * M);
+    EXPECT_LE(pool.created(), 4u);
+    EXPECT_EQ(pool.idle(), pool.created());
+}
+
+TEST(OBJECT_POOL, multi_thread) {
+    coke::sync_wait(multi_thread());
+}
+
+int main(int argc, char *argv[]) {
+    coke::GlobalSettings s;
+    s.poller_threads = 2;
+    s.handler_threads = 2;
+    s.compute_threads = 2;
+    coke::library_init(s);
+
+    testing::InitGoogleTest(&argc, argv);
+
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,133 @@
+/**
+ * Copyright 2024 Coke Project (https://github.com/kedixa/coke)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Authors: kedixa (https://github.com/kedixa)
+*/
+
+#include <chrono>
+#include <string>
+#include <gtest/gtest.h>
+
+#include "coke/qps_pool.h"
+#include "coke/wait.h"
+
+using std::chrono::steady_clock;
+using std::chrono::milliseconds;
+
+coke::Task<> test_qps_pool() {
+    // The first license of a new pool is acquired without sleeping, even if
+    // the interval is long
+    coke::QpsPool slow_pool(1, 60);
+    int ret = co_await slow_pool.get_if(1, coke::NanoSec(0));
+    EXPECT_EQ(ret, coke::SLEEP_SUCCESS);
+
+    ret = co_await slow_pool.get_if(1, coke::NanoSec(0));
+    EXPECT_EQ(ret, coke::SLEEP_CANCELED);
+
+    coke::QpsPool pool(100);
+    auto start = steady_clock::now();
+
+    for (int i = 0; i < 10; i++)
+        co_await pool.get();
+
+    // The first one is acquired immediately, then nine intervals of 10ms
+    auto elapsed = steady_clock::now() - start;
+    EXPECT_GE(elapsed, milliseconds(80));
+    EXPECT_LT(elapsed, milliseconds(95));
+
+    co_await pool.get();
+    ret = co_await pool.get_if(1, coke::NanoSec(0));
+    EXPECT_EQ(ret, coke::SLEEP_CANCELED);
+
+    ret = co_await pool.get_if(1, milliseconds(50));
+    EXPECT_EQ(ret, coke::SLEEP_SUCCESS);
+}
+
+coke::Task<> test_keyed_burst() {
+    coke::KeyedQpsPoolParams params;
+    params.query = 10;
+    params.burst = 5;
+
+    coke::KeyedQpsPool<std::string> pool(params);
+    std::string key1("tenant1"), key2("tenant2");
+    int ret;
+
+    for (int i = 0; i < 5; i++) {
+        ret = co_await pool.get_if(key1, 1, coke::NanoSec(0));
+        EXPECT_EQ(ret, coke::SLEEP_SUCCESS);
+    }
+
+    ret = co_await pool.get_if(key1, 1, coke::NanoSec(0));
+    EXPECT_EQ(ret, coke::SLEEP_CANCELED);
+
+    // Keys are limited independently
+    ret = co_await pool.get_if(key2, 5, coke::NanoSec(0));
+    EXPECT_EQ(ret, coke::SLEEP_SUCCESS);
+
+    auto start = steady_clock::now();
+    ret = co_await pool.get(key1);
+    EXPECT_EQ(ret, coke::SLEEP_SUCCESS);
+    EXPECT_GE(steady_clock::now() - start, milliseconds(80));
+
+    EXPECT_EQ(pool.size(), 2u);
+}
+
+coke::Task<> test_keyed_evict() {
+    coke::KeyedQpsPoolParams params;
+    params.query = 1000;
+    params.shards = 1;
+    params.max_keys = 16;
+
+    coke::KeyedQpsPool<int> pool(params);
+
+    for (int i = 0; i < 16; i++)
+        co_await pool.get(i);
+
+    co_await coke::sleep(milliseconds(5));
+
+    // The idle keys are evicted when the shard is full
+    for (int i = 16; i < 100; i++)
+        co_await pool.get(i);
+
+    EXPECT_LE(pool.size(), 84u);
+
+    co_await coke::sleep(milliseconds(10));
+    pool.evict_idle();
+    EXPECT_EQ(pool.size(), 0u);
+}
+
+TEST(QPS_POOL, qps_pool) {
+    coke::sync_wait(test_qps_pool());
+}
+
+TEST(QPS_POOL, keyed_burst) {
+    coke::sync_wait(test_keyed_burst());
+}
+
+TEST(QPS_POOL, keyed_evict) {
+    coke::sync_wait(test_keyed_evict());
+}
+
+int main(int argc, char *argv[]) {
+    coke::GlobalSettings s;
+    s.poller_threads = 2;
+    s.handler_threads = 2;
+    s.compute_threads = 2;
+    coke::library_init(s);
+
+    testing::InitGoogleTest(&argc, argv);
+
+    return RUN_ALL_TESTS();
+}
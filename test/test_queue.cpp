@@ -16,6 +16,9 @@
  * Authors: kedixa (https://github.com/kedixa)
 */
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <vector>
 #include <string>
 #include <random>
@@ -26,10 +29,19 @@
 #include <gtest/gtest.h>
 
 #include "coke/global.h"
+#include "coke/dary_heap.h"
 #include "coke/wait.h"
+#include "coke/delay_queue.h"
 #include "coke/deque.h"
 #include "coke/queue.h"
+#include "coke/ring_buffer.h"
+#include "coke/ring_queue.h"
+#include "coke/select.h"
+#include "coke/sharded_queue.h"
+#include "coke/spsc_queue.h"
 #include "coke/future.h"
+#include "coke/sleep.h"
+#include "coke/stop_token.h"
 
 constexpr int LOOP_HINT = 10;
 
@@ -309,6 +321,7 @@ void test_order(std::vector<int> in, std::vector<int> out) {
     }
 }
 
+template<typename D>
 coke::Task<> test_deque_order() {
     std::chrono::seconds sec(1);
     std::vector<int> out;
@@ -317,7 +330,7 @@ coke::Task<> test_deque_order() {
     for (int i = 3; i < 19; i++)
         expected_out.push_back(i);
 
-    coke::Deque<int> que(100);
+    D que(100);
 
     que.try_emplace_front(10);
     que.try_push_front(9);
@@ -346,6 +359,392 @@ coke::Task<> test_deque_order() {
     EXPECT_EQ(out, expected_out);
 }
 
+coke::Task<> test_queue_until() {
+    auto deadline = std::chrono::steady_clock::now() +
+                    std::chrono::milliseconds(20);
+    coke::Queue<int> que(1);
+    int val = 0;
+
+    EXPECT_EQ(co_await que.try_push_until(deadline, 1), coke::TOP_SUCCESS);
+    EXPECT_EQ(co_await que.try_push_until(deadline, 2), coke::TOP_TIMEOUT);
+    EXPECT_GE(std::chrono::steady_clock::now(), deadline);
+
+    // The deadline has passed, but the queue is ready
+    EXPECT_EQ(co_await que.try_pop_until(deadline, val), coke::TOP_SUCCESS);
+    EXPECT_EQ(val, 1);
+    EXPECT_EQ(co_await que.try_pop_until(deadline, val), coke::TOP_TIMEOUT);
+}
+
+coke::Task<> test_queue_stop() {
+    constexpr int N = 4;
+    coke::Queue<int> que(1);
+    coke::StopToken token;
+    std::vector<int> rets(N, -1);
+
+    auto pop = [&](int i) -> coke::Task<> {
+        int val;
+        rets[i] = co_await que.pop(val, token);
+    };
+
+    auto push = [&](int i) -> coke::Task<> {
+        rets[i] = co_await que.push(i, token);
+    };
+
+    auto stop = [&]() -> coke::Task<> {
+        co_await coke::sleep(std::chrono::milliseconds(20));
+        token.request_stop();
+    };
+
+    // All the poppers wait on the empty queue until stop is requested
+    std::vector<coke::Task<>> tasks;
+    for (int i = 0; i < N; i++)
+        tasks.emplace_back(pop(i));
+    tasks.emplace_back(stop());
+
+    co_await coke::async_wait(std::move(tasks));
+    EXPECT_EQ(rets, std::vector<int>(N, coke::TOP_STOPPED));
+
+    // The element is still popped after stop, but no more waits
+    int val = -1;
+    EXPECT_TRUE(que.try_push(1));
+    EXPECT_EQ(co_await que.pop(val, token), coke::TOP_SUCCESS);
+    EXPECT_EQ(val, 1);
+
+    EXPECT_TRUE(que.try_push(2));
+    co_await push(0);
+    EXPECT_EQ(rets[0], coke::TOP_STOPPED);
+}
+
+coke::Task<> test_select() {
+    constexpr int N = 1000;
+    coke::Queue<int> q1(8);
+    coke::Deque<int> q2(8);
+    coke::StopToken token;
+    int a = -1, b = -1;
+
+    // Ready cases are chosen in order
+    EXPECT_TRUE(q1.try_push(1));
+    EXPECT_TRUE(q2.try_push_back(2));
+    auto ret = co_await coke::select(coke::pop_case(q1, a),
+                                     coke::pop_front_case(q2, b));
+    EXPECT_EQ(ret.state, coke::TOP_SUCCESS);
+    EXPECT_EQ(ret.index, 0u);
+    EXPECT_EQ(a, 1);
+
+    ret = co_await coke::select(coke::pop_case(q1, a),
+                                coke::pop_front_case(q2, b));
+    EXPECT_EQ(ret.index, 1u);
+    EXPECT_EQ(b, 2);
+
+    ret = co_await coke::try_select_for(std::chrono::milliseconds(10),
+                                        coke::pop_case(q1, a),
+                                        coke::pop_back_case(q2, b));
+    EXPECT_EQ(ret.state, coke::TOP_TIMEOUT);
+    EXPECT_EQ(ret.index, coke::SELECT_NPOS);
+
+    // One waiter wakes up for whichever queue is pushed
+    auto push = [&]() -> coke::Task<> {
+        for (int i = 0; i < N; i++) {
+            if (i % 2 == 0)
+                co_await q1.push(i);
+            else
+                co_await q2.push_back(i);
+
+            if (i % 16 == 0)
+                co_await coke::yield();
+        }
+    };
+
+    auto consume = [&]() -> coke::Task<> {
+        long sum = 0;
+        for (int i = 0; i < N; i++) {
+            auto r = co_await coke::select(coke::pop_case(q1, a),
+                                           coke::pop_front_case(q2, b));
+            EXPECT_EQ(r.state, coke::TOP_SUCCESS);
+            sum += (r.index == 0) ? a : b;
+        }
+
+        EXPECT_EQ(sum, (long)N * (N - 1) / 2);
+    };
+
+    co_await coke::async_wait(push(), consume());
+
+    auto stop = [&]() -> coke::Task<> {
+        co_await coke::sleep(std::chrono::milliseconds(10));
+        token.request_stop();
+    };
+
+    auto wait_stop = [&]() -> coke::Task<> {
+        auto r = co_await coke::select(token, coke::pop_case(q1, a));
+        EXPECT_EQ(r.state, coke::TOP_STOPPED);
+    };
+
+    co_await coke::async_wait(stop(), wait_stop());
+
+    // A closed and empty queue is chosen with TOP_CLOSED
+    q2.close();
+    ret = co_await coke::select(coke::pop_case(q1, a),
+                                coke::pop_front_case(q2, b));
+    EXPECT_EQ(ret.state, coke::TOP_CLOSED);
+    EXPECT_EQ(ret.index, 1u);
+}
+
+coke::Task<> test_delay_queue() {
+    using namespace std::chrono_literals;
+    coke::DelayQueue<int> que;
+    auto start = std::chrono::steady_clock::now();
+    std::vector<int> order;
+    int val;
+
+    EXPECT_TRUE(que.push_after(60ms, 3));
+    EXPECT_TRUE(que.push_after(40ms, 2));
+    EXPECT_FALSE(que.try_pop(val));
+    EXPECT_EQ(co_await que.try_pop_for(5ms, val), coke::TOP_TIMEOUT);
+
+    // The sleeping pop is woken up early for the sooner element
+    auto push_sooner = [&]() -> coke::Task<> {
+        co_await coke::sleep(10ms);
+        EXPECT_TRUE(que.push_after(10ms, 1));
+    };
+
+    auto pop_all = [&]() -> coke::Task<> {
+        for (int i = 0; i < 3; i++) {
+            EXPECT_EQ(co_await que.pop(val), coke::TOP_SUCCESS);
+            order.push_back(val);
+
+            if (i == 0) {
+                EXPECT_LT(std::chrono::steady_clock::now() - start, 40ms);
+            }
+        }
+    };
+
+    co_await coke::async_wait(push_sooner(), pop_all());
+    EXPECT_EQ(order, std::vector<int>({1, 2, 3}));
+    EXPECT_GE(std::chrono::steady_clock::now() - start, 60ms);
+
+    // Many poppers share the due elements
+    constexpr int N = 16;
+    std::atomic<int> sum{0};
+    auto pop_one = [&]() -> coke::Task<> {
+        int v;
+        if (co_await que.pop(v) == coke::TOP_SUCCESS)
+            sum += v;
+    };
+
+    std::vector<coke::Task<>> tasks;
+    for (int i = 0; i < N; i++) {
+        EXPECT_TRUE(que.push_after(std::chrono::milliseconds(i % 4), i));
+        tasks.emplace_back(pop_one());
+    }
+
+    co_await coke::async_wait(std::move(tasks));
+    EXPECT_EQ(sum.load(), N * (N - 1) / 2);
+
+    que.close();
+    EXPECT_FALSE(que.push_after(0ms, 0));
+    EXPECT_EQ(co_await que.pop(val), coke::TOP_CLOSED);
+}
+
+coke::Task<> test_queue_stats() {
+    using namespace std::chrono_literals;
+    coke::Queue<int> que(2);
+    coke::Deque<int> deq(2);
+    int val;
+
+    EXPECT_TRUE(que.try_push(1));
+    EXPECT_TRUE(que.try_push(2));
+    EXPECT_EQ(co_await que.try_push_for(5ms, 3), coke::TOP_TIMEOUT);
+
+    auto pop_later = [&]() -> coke::Task<> {
+        co_await coke::sleep(10ms);
+        EXPECT_TRUE(que.try_pop(val));
+    };
+
+    auto push = [&]() -> coke::Task<> {
+        EXPECT_EQ(co_await que.push(3), coke::TOP_SUCCESS);
+    };
+
+    co_await coke::async_wait(pop_later(), push());
+
+    coke::QueueStats st = que.get_stats();
+    EXPECT_EQ(st.high_water, 2u);
+    EXPECT_EQ(st.push_count, 3u);
+    EXPECT_EQ(st.pop_count, 1u);
+    EXPECT_EQ(st.blocked_push_count, 2u);
+    EXPECT_EQ(st.blocked_pop_count, 0u);
+    EXPECT_GE(st.blocked_push_time, 10ms);
+
+    que.reset_stats();
+    st = que.get_stats();
+    EXPECT_EQ(st.high_water, 2u);
+    EXPECT_EQ(st.push_count, 0u);
+    EXPECT_EQ(st.blocked_push_count, 0u);
+
+    EXPECT_EQ(co_await deq.try_pop_front_for(5ms, val), coke::TOP_TIMEOUT);
+    EXPECT_TRUE(deq.force_push_back(1));
+    EXPECT_TRUE(deq.force_push_back(2));
+    EXPECT_TRUE(deq.force_push_front(3));
+    EXPECT_TRUE(deq.try_pop_back(val));
+
+    st = deq.get_stats();
+    EXPECT_EQ(st.high_water, 3u);
+    EXPECT_EQ(st.push_count, 3u);
+    EXPECT_EQ(st.pop_count, 1u);
+    EXPECT_EQ(st.blocked_pop_count, 1u);
+    EXPECT_GE(st.blocked_pop_time, 5ms);
+}
+
+coke::Task<> test_spsc() {
+    constexpr int N = 10000;
+    coke::SpscQueue<int> que(4);
+    bool in_order = true;
+    int count = 0;
+
+    auto producer = [&]() -> coke::Task<> {
+        co_await coke::yield();
+
+        for (int i = 0; i < N; i++) {
+            if (i % 3 == 0 && que.try_push(i))
+                continue;
+
+            EXPECT_EQ(co_await que.push(i), coke::TOP_SUCCESS);
+        }
+
+        que.close();
+    };
+
+    auto consumer = [&]() -> coke::Task<> {
+        int val;
+
+        while (co_await que.pop(val) == coke::TOP_SUCCESS) {
+            if (val != count)
+                in_order = false;
+            ++count;
+        }
+    };
+
+    co_await coke::async_wait(producer(), consumer());
+    EXPECT_TRUE(in_order);
+    EXPECT_EQ(count, N);
+
+    int val;
+    que.reopen();
+    EXPECT_EQ(co_await que.try_pop_for(std::chrono::milliseconds(10), val),
+              coke::TOP_TIMEOUT);
+
+    for (int i = 0; i < 4; i++)
+        EXPECT_TRUE(que.try_push(i));
+    EXPECT_TRUE(que.full());
+    EXPECT_EQ(co_await que.try_push_for(std::chrono::milliseconds(10), 4),
+              coke::TOP_TIMEOUT);
+}
+
+coke::Task<> test_batch_wait() {
+    constexpr int N = 1000;
+    coke::Queue<int> que(8);
+    std::vector<int> in, out;
+
+    for (int i = 0; i < N; i++)
+        in.push_back(i);
+
+    auto producer = [&]() -> coke::Task<> {
+        std::size_t pushed = 0;
+        int ret = co_await que.push_range(in.begin(), in.end(), &pushed);
+
+        EXPECT_EQ(ret, coke::TOP_SUCCESS);
+        EXPECT_EQ(pushed, (std::size_t)N);
+        que.close();
+    };
+
+    auto consumer = [&]() -> coke::Task<> {
+        std::size_t popped;
+        int ret;
+
+        do {
+            ret = co_await que.pop_n(std::back_inserter(out), 5, &popped);
+            EXPECT_LE(popped, 5u);
+        } while (ret == coke::TOP_SUCCESS);
+
+        EXPECT_EQ(ret, coke::TOP_CLOSED);
+    };
+
+    co_await coke::async_wait(consumer(), producer());
+    EXPECT_EQ(in, out);
+
+    // Timeout with part of the range pushed
+    std::size_t pushed = 0;
+    que.reopen();
+    int ret = co_await que.try_push_range_for(std::chrono::milliseconds(10),
+                                              in.begin(), in.end(), &pushed);
+    EXPECT_EQ(ret, coke::TOP_TIMEOUT);
+    EXPECT_EQ(pushed, 8u);
+
+    out.clear();
+    ret = co_await que.try_pop_n_for(std::chrono::milliseconds(10),
+                                     std::back_inserter(out), 100);
+    EXPECT_EQ(ret, coke::TOP_SUCCESS);
+    EXPECT_EQ(out.size(), 8u);
+}
+
+coke::Task<> test_sharded_queue() {
+    constexpr int N = 1000;
+    coke::ShardedQueue<int> que(16, 4);
+    std::vector<int> cnt(N, 0);
+
+    EXPECT_EQ(que.shard_count(), 4u);
+    EXPECT_EQ(que.max_size(), 16u);
+
+    auto producer = [&](int start) -> coke::Task<> {
+        co_await coke::yield();
+
+        for (int i = start; i < N; i += 4)
+            EXPECT_EQ(co_await que.push(i), coke::TOP_SUCCESS);
+    };
+
+    auto consumer = [&]() -> coke::Task<> {
+        int val;
+
+        while (co_await que.pop(val) == coke::TOP_SUCCESS)
+            ++cnt[val];
+    };
+
+    auto produce_all = [&]() -> coke::Task<> {
+        co_await coke::async_wait(producer(0), producer(1),
+                                  producer(2), producer(3));
+        que.close();
+    };
+
+    co_await coke::async_wait(produce_all(), consumer(), consumer());
+    EXPECT_EQ(cnt, std::vector<int>(N, 1));
+    EXPECT_TRUE(que.empty());
+
+    // Closed and empty
+    int val;
+    EXPECT_FALSE(que.try_push(1));
+    EXPECT_EQ(co_await que.pop(val), coke::TOP_CLOSED);
+
+    // Pushes go to the other shards when the local one is full, and pops
+    // steal from them
+    que.reopen();
+    for (int i = 0; i < 16; i++)
+        EXPECT_TRUE(que.try_push(i));
+    EXPECT_TRUE(que.full());
+    EXPECT_EQ(co_await que.try_push_for(std::chrono::milliseconds(10), 16),
+              coke::TOP_TIMEOUT);
+
+    std::vector<int> out;
+    while (que.try_pop(val))
+        out.push_back(val);
+
+    std::sort(out.begin(), out.end());
+    EXPECT_EQ(out.size(), 16u);
+    for (int i = 0; i < (int)out.size(); i++)
+        EXPECT_EQ(out[i], i);
+
+    EXPECT_EQ(co_await que.try_pop_for(std::chrono::milliseconds(10), val),
+              coke::TOP_TIMEOUT);
+}
+
 /// Tests.
 
 TEST(QUEUE, queue_single) {
@@ -363,6 +762,21 @@ TEST(QUEUE, priority_queue_single) {
     coke::sync_wait(test_single<PriorityQueue>(20, 200, (uint64_t)15));
 }
 
+TEST(QUEUE, ring_queue_single) {
+    using RingQueue = coke::RingQueue<std::string>;
+    coke::sync_wait(test_single<RingQueue>(20, 200, (uint64_t)15));
+}
+
+TEST(QUEUE, sharded_queue_single) {
+    using ShardedQueue = coke::ShardedQueue<std::string>;
+    coke::sync_wait(test_single<ShardedQueue>(20, 200, (uint64_t)15));
+    coke::sync_wait(test_sharded_queue());
+}
+
+TEST(QUEUE, spsc_queue) {
+    coke::sync_wait(test_spsc());
+}
+
 TEST(QUEUE, queue_batch) {
     using Queue = coke::Queue<std::string>;
     coke::sync_wait(test_batch<Queue>(10, 100, 10, (uint64_t)95));
@@ -378,6 +792,36 @@ TEST(QUEUE, priority_queue_batch) {
     coke::sync_wait(test_batch<PriorityQueue>(10, 100, 10, (uint64_t)95));
 }
 
+TEST(QUEUE, dary_priority_queue_batch) {
+    using Vector = coke::DaryHeapVector<std::string, 8>;
+    using PriorityQueue = coke::PriorityQueue<std::string, Vector>;
+    coke::sync_wait(test_batch<PriorityQueue>(10, 100, 10, (uint64_t)95));
+}
+
+TEST(QUEUE, batch_wait) {
+    coke::sync_wait(test_batch_wait());
+}
+
+TEST(QUEUE, queue_until) {
+    coke::sync_wait(test_queue_until());
+}
+
+TEST(QUEUE, queue_stop) {
+    coke::sync_wait(test_queue_stop());
+}
+
+TEST(QUEUE, select) {
+    coke::sync_wait(test_select());
+}
+
+TEST(QUEUE, delay_queue) {
+    coke::sync_wait(test_delay_queue());
+}
+
+TEST(QUEUE, queue_stats) {
+    coke::sync_wait(test_queue_stats());
+}
+
 TEST(QUEUE, queue_order) {
     test_order<coke::Queue<int>>({1, 4, 7, 2, 5, 8}, {1, 4, 7, 2, 5, 8});
 }
@@ -391,6 +835,85 @@ TEST(QUEUE, priority_queue_order) {
                                          {8, 7, 5, 4, 2, 1});
 }
 
+TEST(QUEUE, dary_priority_queue_order) {
+    using Vector = coke::DaryHeapVector<int, 4>;
+    test_order<coke::PriorityQueue<int, Vector>>({1, 4, 7, 2, 5, 8},
+                                                 {8, 7, 5, 4, 2, 1});
+}
+
+template<std::size_t D>
+void test_dary_heap() {
+    std::mt19937 mt(D);
+    std::vector<int> v(1000);
+
+    for (int &x : v)
+        x = (int)(mt() % 300);
+
+    auto check = [](coke::DaryHeap<int, D> &heap, std::vector<int> expect) {
+        std::sort(expect.begin(), expect.end(), std::greater<int>{});
+        ASSERT_EQ(heap.size(), expect.size());
+
+        for (int x : expect) {
+            EXPECT_EQ(heap.top(), x);
+            heap.pop();
+        }
+        EXPECT_TRUE(heap.empty());
+    };
+
+    // Bulk build
+    coke::DaryHeap<int, D> h1(v.begin(), v.end());
+    check(h1, v);
+
+    // Push one by one
+    coke::DaryHeap<int, D> h2;
+    for (int x : v)
+        h2.push(x);
+    check(h2, v);
+
+    // Push a few by range, then many by range to rebuild the heap
+    coke::DaryHeap<int, D> h3;
+    auto it = h3.push_range(v.begin(), v.end(), 10);
+    EXPECT_EQ(it, v.begin() + 10);
+    it = h3.push_range(it, v.begin() + 20);
+    it = h3.push_range(it, v.end());
+    EXPECT_EQ(it, v.end());
+    check(h3, v);
+}
+
+TEST(QUEUE, dary_heap) {
+    test_dary_heap<2>();
+    test_dary_heap<4>();
+    test_dary_heap<8>();
+}
+
+TEST(QUEUE, dary_priority_queue_range) {
+    using Vector = coke::DaryHeapVector<int, 4>;
+    coke::PriorityQueue<int, Vector> que(8);
+    std::vector<int> v{3, 9, 1, 7, 5, 8, 2, 6, 4, 0};
+
+    // Only the first 8 elements fit
+    auto it = que.try_push_range(v.begin(), v.end());
+    EXPECT_EQ(it, v.begin() + 8);
+    EXPECT_TRUE(que.full());
+
+    std::vector<int> out(8);
+    EXPECT_EQ(que.try_pop_range(out.begin(), out.end()), out.end());
+    EXPECT_EQ(out, (std::vector<int>{9, 8, 7, 6, 5, 3, 2, 1}));
+}
+
+TEST(QUEUE, ring_queue_order) {
+    test_order<coke::RingQueue<int>>({1, 4, 7, 2, 5, 8}, {1, 4, 7, 2, 5, 8});
+
+    // The max size is rounded up to a power of 2
+    coke::RingQueue<int> que(5);
+    EXPECT_EQ(que.max_size(), 8u);
+
+    for (int i = 0; i < 8; i++)
+        EXPECT_TRUE(que.try_push(i));
+    EXPECT_FALSE(que.try_push(8));
+    EXPECT_TRUE(que.full());
+}
+
 TEST(QUEUE, queue_force) {
     coke::Queue<std::string> que(1);
     bool b;
@@ -423,7 +946,68 @@ TEST(QUEUE, queue_force) {
 }
 
 TEST(QUEUE, deque_order) {
-    coke::sync_wait(test_deque_order());
+    coke::sync_wait(test_deque_order<coke::Deque<int>>());
+
+    using RingBuffer = coke::RingBuffer<int>;
+    using RingDeque = coke::Deque<int, std::allocator<int>, RingBuffer>;
+    coke::sync_wait(test_deque_order<RingDeque>());
+}
+
+TEST(QUEUE, ring_buffer) {
+    coke::RingBuffer<std::string> buf;
+    std::string s(40, 'x');
+
+    // Wrap around without reallocation
+    for (int i = 0; i < 100; i++) {
+        buf.push_back(std::to_string(i));
+        if (buf.size() > 5)
+            buf.pop_front();
+    }
+
+    EXPECT_EQ(buf.capacity(), 8u);
+    EXPECT_EQ(buf.front(), "95");
+    EXPECT_EQ(buf.back(), "99");
+
+    // Grow from both ends, even with an element of itself
+    for (int i = 0; i < 10; i++) {
+        buf.push_front(buf.back());
+        buf.emplace_back(s);
+    }
+
+    EXPECT_EQ(buf.size(), 25u);
+    EXPECT_EQ(buf.capacity(), 32u);
+    EXPECT_EQ(buf[0], s);
+    EXPECT_EQ(buf[9], "99");
+    EXPECT_EQ(buf[10], "95");
+    EXPECT_EQ(buf[24], s);
+
+    coke::RingBuffer<std::string> copy(buf);
+    EXPECT_EQ(copy.size(), buf.size());
+    EXPECT_EQ(copy[14], buf[14]);
+
+    while (buf.size() > 3)
+        buf.pop_back();
+    buf.shrink_to_fit();
+    EXPECT_EQ(buf.capacity(), 8u);
+    EXPECT_EQ(buf.back(), s);
+
+    buf.clear();
+    buf.shrink_to_fit();
+    EXPECT_EQ(buf.capacity(), 0u);
+
+    // Halve the capacity when at most a quarter is used
+    coke::RingBuffer<int, std::allocator<int>, true> shrink;
+    for (int i = 0; i < 64; i++)
+        shrink.push_back(i);
+    while (shrink.size() > 8)
+        shrink.pop_front();
+    EXPECT_EQ(shrink.capacity(), 16u);
+    EXPECT_EQ(shrink.front(), 56);
+
+    test_order<coke::Queue<int, coke::RingBuffer<int>>>({1, 4, 7, 2, 5, 8},
+                                                        {1, 4, 7, 2, 5, 8});
+    test_order<coke::Stack<int, coke::RingBuffer<int>>>({1, 4, 7, 2, 5, 8},
+                                                        {8, 5, 2, 7, 4, 1});
 }
 
 TEST(QUEUE, deque_force) {
@@ -475,6 +1059,8 @@ TEST(QUEUE, allocator) {
     auto *res = std::pmr::get_default_resource();
     coke::Queue<int, std::pmr::deque<int>> q(10, res);
     coke::PriorityQueue<std::string, std::pmr::vector<std::string>> p(20, res);
+    coke::PriorityQueue<int, coke::DaryHeapVector<int, 4,
+        std::pmr::polymorphic_allocator<int>>> dp(20, res);
     coke::Stack<long, std::pmr::deque<long>> s(30, res);
     coke::Deque<short, std::pmr::polymorphic_allocator<short>> d(40, res);
 }
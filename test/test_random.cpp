@@ -0,0 +1,125 @@
+/**
+ * Copyright 2024 Coke Project (https://github.com/kedixa/coke)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Authors: kedixa (https://github.com/kedixa)
+*/
+
+#include <cstdint>
+#include <set>
+#include <vector>
+#include <gtest/gtest.h>
+
+#include "coke/detail/random.h"
+
+using coke::detail::Xoshiro256;
+using coke::detail::rand_range;
+
+// Returns the given values in order, to drive rand_range deterministically
+struct SequenceGen {
+    uint64_t operator()() { return values[calls++ % values.size()]; }
+
+    std::vector<uint64_t> values;
+    std::size_t calls{0};
+};
+
+TEST(RANDOM, bounds) {
+    Xoshiro256 gen(42);
+
+    for (int i = 0; i < 1000; i++) {
+        EXPECT_EQ(rand_range(gen, 0), 0u);
+        EXPECT_EQ(rand_range(gen, 1), 0u);
+        EXPECT_LT(rand_range(gen, UINT64_MAX), UINT64_MAX);
+    }
+
+    // The largest value of the generator maps to n - 1
+    SequenceGen max_gen{{UINT64_MAX}};
+    EXPECT_EQ(rand_range(max_gen, UINT64_MAX), UINT64_MAX - 1);
+    EXPECT_EQ(rand_range(max_gen, 10), 9u);
+    EXPECT_EQ(rand_range(max_gen, 1), 0u);
+
+    // A power of two takes the high bits
+    SequenceGen pow2_gen{{0x0123456789ABCDEFULL, 0xFEDCBA9876543210ULL}};
+    EXPECT_EQ(rand_range(pow2_gen, 8), 0x0123456789ABCDEFULL >> 61);
+    EXPECT_EQ(rand_range(pow2_gen, 8), 0xFEDCBA9876543210ULL >> 61);
+    EXPECT_EQ(pow2_gen.calls, 2u);
+}
+
+TEST(RANDOM, reject_biased) {
+    // For n = 10, (2^64 - 10) % 10 = 6, the products whose low 64 bits are
+    // less than 6 are rejected, zero is one of them
+    SequenceGen gen10{{0, UINT64_MAX}};
+    EXPECT_EQ(rand_range(gen10, 10), 9u);
+    EXPECT_EQ(gen10.calls, 2u);
+
+    // For n = 3, the threshold is 1
+    SequenceGen gen3{{0, 0, 1ULL << 63}};
+    EXPECT_EQ(rand_range(gen3, 3), 1u);
+    EXPECT_EQ(gen3.calls, 3u);
+}
+
+TEST(RANDOM, coverage) {
+    constexpr int N = 30000;
+    Xoshiro256 gen(2024);
+
+    // Every value of a non power of two range appears, evenly
+    std::vector<int> counts(3, 0);
+    for (int i = 0; i < N; i++)
+        counts[rand_range(gen, 3)]++;
+
+    for (int c : counts) {
+        EXPECT_GT(c, N / 3 - 1000);
+        EXPECT_LT(c, N / 3 + 1000);
+    }
+
+    std::set<uint64_t> seen;
+    for (int i = 0; i < N; i++) {
+        uint64_t x = rand_range(gen, 1000);
+        EXPECT_LT(x, 1000u);
+        seen.insert(x);
+    }
+
+    EXPECT_EQ(seen.size(), 1000u);
+}
+
+TEST(RANDOM, deterministic_seed) {
+    Xoshiro256 a(7), b(7), c(8);
+    bool differ = false;
+
+    for (int i = 0; i < 100; i++) {
+        uint64_t x = a(), y = b(), z = c();
+        EXPECT_EQ(x, y);
+        differ = differ || (x != z);
+    }
+
+    EXPECT_TRUE(differ);
+
+    for (int i = 0; i < 100; i++)
+        EXPECT_EQ(rand_range(a, 12345), rand_range(b, 12345));
+}
+
+TEST(RANDOM, thread_local_generator) {
+    EXPECT_NE(coke::detail::rand_seed(), coke::detail::rand_seed());
+
+    for (int i = 0; i < 1000; i++) {
+        EXPECT_EQ(coke::rand_range(1), 0u);
+        EXPECT_LT(coke::rand_range(7), 7u);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    testing::InitGoogleTest(&argc, argv);
+
+    return RUN_ALL_TESTS();
+}
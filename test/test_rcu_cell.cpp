@@ -0,0 +1,110 @@
+/**
+ * Copyright 2024 Coke Project (https://github.com/kedixa/coke)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Authors: kedixa (https://github.com/kedixa)
+*/
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <vector>
+#include <gtest/gtest.h>
+
+#include "coke/coke.h"
+
+constexpr auto us10 = std::chrono::microseconds(10);
+
+std::atomic<int> live_values{0};
+
+struct Value {
+    Value(int v) : value(v), alive(true) { live_values.fetch_add(1); }
+
+    ~Value() {
+        alive = false;
+        live_values.fetch_sub(1);
+    }
+
+    int value;
+    volatile bool alive;
+};
+
+TEST(RCU_CELL, read_update) {
+    {
+        coke::RcuCell<Value> cell;
+        EXPECT_FALSE(cell.read());
+
+        EXPECT_EQ(coke::sync_wait(cell.emplace(1)), coke::TOP_SUCCESS);
+        EXPECT_EQ(cell.read()->value, 1);
+
+        int ret = coke::sync_wait(cell.update(std::make_unique<Value>(2)));
+        EXPECT_EQ(ret, coke::TOP_SUCCESS);
+        EXPECT_EQ(live_values.load(), 1);
+        EXPECT_EQ(cell.read()->value, 2);
+
+        EXPECT_EQ(coke::sync_wait(cell.synchronize()), coke::TOP_SUCCESS);
+    }
+
+    EXPECT_EQ(live_values.load(), 0);
+}
+
+coke::Task<> reader(coke::RcuCell<Value> &cell, std::atomic<bool> &stop) {
+    while (!stop.load(std::memory_order_relaxed)) {
+        auto guard = cell.read();
+        int v = guard->value;
+
+        // The snapshot is kept alive even if an update happens meanwhile
+        co_await coke::sleep(us10);
+        EXPECT_TRUE(guard->alive);
+        EXPECT_EQ(guard->value, v);
+    }
+}
+
+coke::Task<> updater(coke::RcuCell<Value> &cell, std::atomic<bool> &stop) {
+    for (int i = 0; i < 200; i++) {
+        int ret = co_await cell.emplace(i);
+        EXPECT_EQ(ret, coke::TOP_SUCCESS);
+    }
+
+    stop = true;
+}
+
+TEST(RCU_CELL, concurrent) {
+    {
+        coke::RcuCell<Value> cell(std::make_unique<Value>(-1));
+        std::atomic<bool> stop{false};
+        std::vector<coke::Task<>> tasks;
+
+        for (int i = 0; i < 16; i++)
+            tasks.emplace_back(reader(cell, stop));
+
+        tasks.emplace_back(updater(cell, stop));
+        tasks.emplace_back(updater(cell, stop));
+
+        coke::sync_wait(std::move(tasks));
+        EXPECT_EQ(live_values.load(), 1);
+    }
+
+    EXPECT_EQ(live_values.load(), 0);
+}
+
+int main(int argc, char *argv[]) {
+    coke::GlobalSettings s;
+    s.poller_threads = 4;
+    s.handler_threads = 8;
+    coke::library_init(s);
+
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,521 @@
+/**
+ * Copyright 2024 Coke Project (https://github.com/kedixa/coke)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Authors: kedixa (https://github.com/kedixa)
+*/
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <gtest/gtest.h>
+
+#include "coke/coke.h"
+#include "coke/redis/redis_client.h"
+#include "coke/redis/redis_cluster_client.h"
+#include "coke/redis/redis_server.h"
+#include "coke/redis/redis_subscriber.h"
+#include "fake_server.h"
+
+/**
+ * A minimal redis server for the tests, it supports pipelined commands, and
+ * PING, ECHO, SET, GET, SUBSCRIBE, UNSUBSCRIBE and PUBLISH.
+*/
+class FakeRedisServer : public FakeServer {
+public:
+    FakeRedisServer() = default;
+    ~FakeRedisServer() { stop(); }
+
+    // The most commands received by one read
+    std::size_t max_pipelined() {
+        std::lock_guard<std::mutex> lg(mtx);
+        return max_cmds;
+    }
+
+    // The number of connections subscribed to `channel`
+    std::size_t subscribers(const std::string &channel) {
+        std::lock_guard<std::mutex> lg(mtx);
+        auto it = subs.find(channel);
+        return it == subs.end() ? 0 : it->second.size();
+    }
+
+private:
+    void serve(int fd) override {
+        std::string buf;
+        char tmp[4096];
+        ssize_t n;
+
+        while ((n = recv(fd, tmp, sizeof(tmp), 0)) > 0) {
+            buf.append(tmp, (std::size_t)n);
+
+            coke::RedisValueView view;
+            std::size_t used, pos = 0, cmds = 0;
+            std::string out;
+
+            while (coke::RedisValueView::parse(buf.data() + pos,
+                                               buf.size() - pos,
+                                               view, &used) == 1) {
+                std::vector<std::string> args;
+                for (const coke::RedisValueView &v : view.arr_values())
+                    args.push_back(v.as_string());
+
+                pos += used;
+                ++cmds;
+
+                std::lock_guard<std::mutex> lg(mtx);
+                handle(fd, args, out);
+            }
+
+            buf.erase(0, pos);
+
+            std::lock_guard<std::mutex> lg(mtx);
+            max_cmds = std::max(max_cmds, cmds);
+            send_all(fd, out);
+        }
+
+        std::lock_guard<std::mutex> lg(mtx);
+        for (auto &[channel, fds] : subs)
+            fds.erase(fd);
+    }
+
+    static std::string bulk(const std::string &s) {
+        return "$" + std::to_string(s.size()) + "\r\n" + s + "\r\n";
+    }
+
+    std::size_t subscribed(int fd) {
+        std::size_t n = 0;
+        for (auto &[channel, fds] : subs)
+            n += fds.count(fd);
+
+        return n;
+    }
+
+    // Called with the lock held
+    void handle(int fd, std::vector<std::string> &args, std::string &out) {
+        std::string cmd = args.empty() ? "" : args[0];
+        std::transform(cmd.begin(), cmd.end(), cmd.begin(), ::toupper);
+
+        if (cmd == "PING")
+            out.append("+PONG\r\n");
+        else if (cmd == "ECHO" && args.size() == 2)
+            out.append(bulk(args[1]));
+        else if (cmd == "SET" && args.size() == 3) {
+            kv[args[1]] = args[2];
+            out.append("+OK\r\n");
+        }
+        else if (cmd == "GET" && args.size() == 2) {
+            auto it = kv.find(args[1]);
+            out.append(it == kv.end() ? "$-1\r\n" : bulk(it->second));
+        }
+        else if ((cmd == "SUBSCRIBE" || cmd == "UNSUBSCRIBE") &&
+                 args.size() > 1) {
+            bool sub = (cmd == "SUBSCRIBE");
+
+            for (std::size_t i = 1; i < args.size(); i++) {
+                if (sub)
+                    subs[args[i]].insert(fd);
+                else
+                    subs[args[i]].erase(fd);
+
+                out.append("*3\r\n")
+                   .append(bulk(sub ? "subscribe" : "unsubscribe"))
+                   .append(bulk(args[i]))
+                   .append(":" + std::to_string(subscribed(fd)) + "\r\n");
+            }
+        }
+        else if (cmd == "PUBLISH" && args.size() == 3) {
+            std::string msg = "*3\r\n" + bulk("message") + bulk(args[1])
+                            + bulk(args[2]);
+            std::set<int> &fds = subs[args[1]];
+
+            for (int sub_fd : fds)
+                send_all(sub_fd, msg);
+
+            out.append(":" + std::to_string(fds.size()) + "\r\n");
+        }
+        else
+            out.append("-ERR unknown command\r\n");
+    }
+
+private:
+    std::map<std::string, std::string> kv;
+    std::map<std::string, std::set<int>> subs;
+    std::size_t max_cmds{0};
+};
+
+FakeRedisServer fake_server;
+int fake_port = -1;
+
+coke::RedisClientParams fake_params() {
+    coke::RedisClientParams params;
+    params.host = "127.0.0.1";
+    params.port = fake_port;
+    return params;
+}
+
+TEST(REDIS, key_slot) {
+    EXPECT_EQ(coke::redis_key_slot("123456789"), 12739);
+    EXPECT_EQ(coke::redis_key_slot("foo"), 12182);
+    EXPECT_EQ(coke::redis_key_slot("bar"), 5061);
+    EXPECT_EQ(coke::redis_key_slot(""), 0);
+
+    // Only the first non-empty hash tag is used
+    EXPECT_EQ(coke::redis_key_slot("{user1000}.following"),
+              coke::redis_key_slot("{user1000}.followers"));
+    EXPECT_EQ(coke::redis_key_slot("foo{bar}{zap}"),
+              coke::redis_key_slot("bar"));
+    EXPECT_EQ(coke::redis_key_slot("foo{{bar}}zap"),
+              coke::redis_key_slot("{bar"));
+    EXPECT_NE(coke::redis_key_slot("foo{}{bar}"),
+              coke::redis_key_slot("bar"));
+}
+
+TEST(REDIS, pipeline_encode) {
+    coke::RedisPipeline pipe;
+    EXPECT_TRUE(pipe.empty());
+
+    pipe.add("SET", {"key", "value"}).add("PING", {});
+    EXPECT_EQ(pipe.size(), 2u);
+    EXPECT_EQ(pipe.get_buffer(),
+              "*3\r\n$3\r\nSET\r\n$3\r\nkey\r\n$5\r\nvalue\r\n"
+              "*1\r\n$4\r\nPING\r\n");
+
+    pipe.clear();
+    EXPECT_TRUE(pipe.empty());
+    EXPECT_TRUE(pipe.get_buffer().empty());
+}
+
+TEST(REDIS, pipeline_add_args) {
+    coke::RedisPipeline pipe;
+    std::string_view args[] = {"MGET", "k1", "k2"};
+
+    pipe.add_args(args);
+    EXPECT_EQ(pipe.size(), 1u);
+    EXPECT_EQ(pipe.get_buffer(),
+              "*3\r\n$4\r\nMGET\r\n$2\r\nk1\r\n$2\r\nk2\r\n");
+}
+
+TEST(REDIS, value_view) {
+    std::string buf("*4\r\n$5\r\nhello\r\n:-42\r\n$-1\r\n"
+                    "*2\r\n+OK\r\n-ERR bad\r\n");
+    coke::RedisValueView view;
+    std::size_t used = 0;
+
+    EXPECT_EQ(coke::RedisValueView::parse(buf.data(), buf.size(), view, &used), 1);
+    EXPECT_EQ(used, buf.size());
+    EXPECT_TRUE(view.is_array());
+    EXPECT_EQ(view.arr_size(), 4u);
+
+    std::vector<coke::RedisValueView> values = view.arr_values();
+    EXPECT_EQ(values.size(), 4u);
+    EXPECT_TRUE(values[0].is_string());
+    EXPECT_EQ(values[0].as_string_view(), "hello");
+    EXPECT_TRUE(values[1].is_int());
+    EXPECT_EQ(values[1].int_value(), -42);
+    EXPECT_TRUE(values[2].is_nil());
+
+    coke::RedisValueView sub = view.arr_at(3);
+    EXPECT_TRUE(sub.is_array());
+    EXPECT_TRUE(sub.arr_at(0).is_ok());
+    EXPECT_TRUE(sub.arr_at(1).is_error());
+    EXPECT_EQ(sub.arr_at(1).as_string_view(), "ERR bad");
+    EXPECT_TRUE(view.arr_at(4).is_nil());
+
+    // Incomplete at any position
+    for (std::size_t i = 0; i < buf.size(); i++) {
+        EXPECT_EQ(coke::RedisValueView::parse(buf.data(), i, view, &used), 0);
+    }
+
+    std::string bad("$3\r\nabcd\r\n");
+    EXPECT_EQ(coke::RedisValueView::parse(bad.data(), bad.size(), view, &used), -1);
+}
+
+TEST(REDIS, command_table) {
+    coke::RedisCommandTable table;
+    int called = 0;
+
+    auto make_handler = [&called](int id) {
+        return [&called, id](coke::RedisServerContext &,
+                             std::vector<std::string> &) -> coke::Task<> {
+            called = id;
+            co_return;
+        };
+    };
+
+    EXPECT_EQ(table.find("get"), nullptr);
+
+    table.add("GET", make_handler(1));
+    table.add("set", make_handler(2));
+    for (int i = 0; i < 32; i++)
+        table.add("cmd" + std::to_string(i), make_handler(100 + i));
+
+    EXPECT_EQ(table.size(), 34u);
+    EXPECT_NE(table.find("get"), nullptr);
+    EXPECT_EQ(table.find("GeT"), table.find("GET"));
+    EXPECT_NE(table.find("SET"), nullptr);
+    EXPECT_NE(table.find("CMD31"), nullptr);
+    EXPECT_EQ(table.find("del"), nullptr);
+    EXPECT_EQ(table.find("ge"), nullptr);
+
+    // Replace the handler of an existing command
+    table.add("Get", make_handler(3));
+    EXPECT_EQ(table.size(), 34u);
+}
+
+coke::Task<> test_pipeline() {
+    coke::RedisClient cli(fake_params());
+    std::string large(256 * 1024, 'x');
+
+    coke::RedisPipeline pipe;
+    pipe.add("SET", {"pipe_key", "pipe_value"})
+        .add("GET", {"pipe_key"})
+        .add("GET", {"pipe_missing"})
+        .add("PING", {})
+        .add("NO_SUCH_COMMAND", {})
+        .add("ECHO", {large});
+
+    // The large reply arrives in many pieces and is parsed incrementally
+    coke::RedisPipelineResult res = co_await cli.pipeline(pipe);
+    EXPECT_EQ(res.state, coke::STATE_SUCCESS);
+    EXPECT_EQ(res.values.size(), 6u);
+
+    if (res.values.size() == 6u) {
+        EXPECT_TRUE(res.values[0].is_ok());
+        EXPECT_EQ(res.values[1].string_value(), "pipe_value");
+        EXPECT_TRUE(res.values[2].is_nil());
+        EXPECT_EQ(res.values[3].string_value(), "PONG");
+        EXPECT_TRUE(res.values[4].is_error());
+        EXPECT_EQ(res.values[5].string_value(), large);
+    }
+
+    coke::RedisViewResult view = co_await cli.pipeline_view(std::move(pipe));
+    EXPECT_EQ(view.state, coke::STATE_SUCCESS);
+    EXPECT_EQ(view.values.size(), 6u);
+
+    if (view.values.size() == 6u) {
+        EXPECT_TRUE(view.values[0].is_ok());
+        EXPECT_EQ(view.values[1].as_string_view(), "pipe_value");
+        EXPECT_TRUE(view.values[2].is_nil());
+        EXPECT_TRUE(view.values[4].is_error());
+        EXPECT_EQ(view.values[5].as_string_view().size(), large.size());
+    }
+
+    // The commands of a pipeline are sent together, the small ones arrive in
+    // the first read
+    EXPECT_GE(fake_server.max_pipelined(), 5u);
+}
+
+TEST(REDIS, pipeline) {
+    coke::sync_wait(test_pipeline());
+}
+
+coke::Task<coke::RedisBatchResult>
+batch_echo(coke::RedisClient &cli, int i) {
+    std::vector<std::string> args{std::to_string(i)};
+    co_return co_await cli.batch_request("ECHO", args);
+}
+
+coke::Task<> test_batch_full(std::size_t batch_max) {
+    using namespace std::chrono;
+
+    coke::RedisClientParams params = fake_params();
+    params.batch_max = batch_max;
+    // A full batch must be sent at once, long before the window expires
+    params.batch_window_us = 2'000'000;
+    coke::RedisClient cli(params);
+
+    for (int round = 0; round < 20; round++) {
+        std::vector<coke::Task<coke::RedisBatchResult>> tasks;
+        for (std::size_t i = 0; i < batch_max; i++)
+            tasks.emplace_back(batch_echo(cli, (int)i));
+
+        auto start = steady_clock::now();
+        auto results = co_await coke::async_wait(std::move(tasks));
+        auto cost = steady_clock::now() - start;
+
+        EXPECT_LT(cost, milliseconds(500));
+        for (std::size_t i = 0; i < results.size(); i++) {
+            EXPECT_EQ(results[i].state, coke::STATE_SUCCESS);
+            EXPECT_EQ(results[i].value.string_value(), std::to_string(i));
+        }
+    }
+}
+
+coke::Task<> test_batch_window() {
+    using namespace std::chrono;
+
+    coke::RedisClientParams params = fake_params();
+    params.batch_window_us = 50'000;
+    coke::RedisClient cli(params);
+
+    // A batch that is not full is sent when the window expires
+    auto start = steady_clock::now();
+    coke::RedisBatchResult res = co_await batch_echo(cli, 7);
+    EXPECT_GE(steady_clock::now() - start, milliseconds(40));
+    EXPECT_EQ(res.state, coke::STATE_SUCCESS);
+    EXPECT_EQ(res.value.string_value(), "7");
+
+    // Commands that overflow a batch go to the next one
+    params.batch_max = 3;
+    params.batch_window_us = 0;
+    coke::RedisClient cli2(params);
+
+    std::vector<coke::Task<coke::RedisBatchResult>> tasks;
+    for (int i = 0; i < 10; i++)
+        tasks.emplace_back(batch_echo(cli2, i));
+
+    auto results = co_await coke::async_wait(std::move(tasks));
+    for (int i = 0; i < 10; i++) {
+        EXPECT_EQ(results[i].state, coke::STATE_SUCCESS);
+        EXPECT_EQ(results[i].value.string_value(), std::to_string(i));
+    }
+}
+
+TEST(REDIS, batch_request) {
+    coke::sync_wait(test_batch_full(1));
+    coke::sync_wait(test_batch_full(4));
+    coke::sync_wait(test_batch_full(16));
+    EXPECT_GE(fake_server.max_pipelined(), 2u);
+
+    coke::sync_wait(test_batch_window());
+}
+
+coke::Task<bool> receive_for(coke::RedisSubscriber &sub,
+                             coke::RedisPushMessage &msg) {
+    co_return co_await wait_until([&] { return sub.try_receive(msg); });
+}
+
+coke::Task<long long>
+publish(coke::RedisClient &cli, std::string channel, std::string payload) {
+    std::vector<std::string> args{std::move(channel), std::move(payload)};
+    coke::RedisResult res = co_await cli.request("PUBLISH", args);
+    coke::RedisValue value;
+
+    if (res.state != coke::STATE_SUCCESS)
+        co_return -1;
+
+    res.resp.get_result(value);
+    co_return value.is_int() ? value.int_value() : -1;
+}
+
+coke::Task<> test_subscriber() {
+    coke::RedisClientParams params = fake_params();
+    // The publisher's connection is also closed when reconnect is tested
+    params.retry_max = 1;
+    coke::RedisClient cli(params);
+
+    coke::RedisSubscriberParams sub_params;
+    sub_params.reconnect_interval = 100;
+    coke::RedisSubscriber sub(fake_params(), sub_params);
+    coke::RedisPushMessage msg;
+    long long n;
+    bool ok;
+
+    // Subscribe
+    EXPECT_EQ(sub.subscribe({"sub_ch1", "sub_ch2"}), 0);
+    ok = co_await wait_until([] {
+        return fake_server.subscribers("sub_ch1") == 1 &&
+               fake_server.subscribers("sub_ch2") == 1;
+    });
+    EXPECT_TRUE(ok);
+    EXPECT_FALSE(sub.try_receive(msg));
+
+    // Message delivery
+    n = co_await publish(cli, "sub_ch1", "hello");
+    EXPECT_EQ(n, 1);
+    n = co_await publish(cli, "sub_ch2", "world");
+    EXPECT_EQ(n, 1);
+
+    ok = co_await receive_for(sub, msg);
+    EXPECT_TRUE(ok);
+    EXPECT_EQ(msg.type, "message");
+    EXPECT_EQ(msg.channel, "sub_ch1");
+    EXPECT_EQ(msg.payload, "hello");
+
+    ok = co_await receive_for(sub, msg);
+    EXPECT_TRUE(ok);
+    EXPECT_EQ(msg.channel, "sub_ch2");
+    EXPECT_EQ(msg.payload, "world");
+
+    // Unsubscribe, the messages on the other channel still arrive
+    EXPECT_EQ(sub.unsubscribe({"sub_ch1"}), 0);
+    ok = co_await wait_until([] {
+        return fake_server.subscribers("sub_ch1") == 0;
+    });
+    EXPECT_TRUE(ok);
+
+    n = co_await publish(cli, "sub_ch1", "dropped");
+    EXPECT_EQ(n, 0);
+    n = co_await publish(cli, "sub_ch2", "still");
+    EXPECT_EQ(n, 1);
+
+    ok = co_await receive_for(sub, msg);
+    EXPECT_TRUE(ok);
+    EXPECT_EQ(msg.channel, "sub_ch2");
+    EXPECT_EQ(msg.payload, "still");
+    EXPECT_FALSE(sub.try_receive(msg));
+
+    // Reconnect, only the channels still subscribed are subscribed again
+    std::size_t conns = fake_server.connections();
+    fake_server.close_connections();
+    ok = co_await wait_until([conns] {
+        return fake_server.connections() > conns &&
+               fake_server.subscribers("sub_ch2") == 1;
+    });
+    EXPECT_TRUE(ok);
+    EXPECT_EQ(fake_server.subscribers("sub_ch1"), 0u);
+
+    n = co_await publish(cli, "sub_ch2", "again");
+    EXPECT_EQ(n, 1);
+    ok = co_await receive_for(sub, msg);
+    EXPECT_TRUE(ok);
+    EXPECT_EQ(msg.channel, "sub_ch2");
+    EXPECT_EQ(msg.payload, "again");
+
+    // Close, no more subscriptions are accepted
+    co_await sub.close();
+    int ret = co_await sub.receive(msg);
+    EXPECT_EQ(ret, coke::TOP_CLOSED);
+    EXPECT_EQ(sub.subscribe({"sub_ch3"}), -ECANCELED);
+    EXPECT_EQ(sub.get_dropped(), 0u);
+
+    ok = co_await wait_until([] {
+        return fake_server.subscribers("sub_ch2") == 0;
+    });
+    EXPECT_TRUE(ok);
+}
+
+TEST(REDIS, subscriber) {
+    coke::sync_wait(test_subscriber());
+}
+
+int main(int argc, char *argv[]) {
+    coke::library_init(coke::GlobalSettings());
+
+    fake_port = fake_server.start();
+    if (fake_port < 0)
+        return 1;
+
+    testing::InitGoogleTest(&argc, argv);
+    int ret = RUN_ALL_TESTS();
+
+    fake_server.stop();
+    return ret;
+}
@@ -0,0 +1,180 @@
+/**
+ * Copyright 2024 Coke Project (https://github.com/kedixa/coke)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Authors: kedixa (https://github.com/kedixa)
+*/
+
+#include <cstdio>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <gtest/gtest.h>
+
+#include "coke/coke.h"
+#include "coke/net/rpc.h"
+
+constexpr uint32_t METHOD_ECHO = 1;
+constexpr uint32_t METHOD_ADD = 2;
+constexpr uint32_t STATUS_NO_METHOD = 100;
+
+struct AddRequest {
+    int32_t a;
+    int32_t b;
+};
+
+template<>
+struct coke::RpcCodec<AddRequest> {
+    static bool encode(const AddRequest &v, std::string &body) {
+        body = std::to_string(v.a) + " " + std::to_string(v.b);
+        return true;
+    }
+
+    static bool decode(std::string_view body, AddRequest &v) {
+        std::string s(body);
+        return std::sscanf(s.c_str(), "%d %d", &v.a, &v.b) == 2;
+    }
+};
+
+template<>
+struct coke::RpcCodec<int> {
+    static bool encode(const int &v, std::string &body) {
+        body = std::to_string(v);
+        return true;
+    }
+
+    static bool decode(std::string_view body, int &v) {
+        std::string s(body);
+        return std::sscanf(s.c_str(), "%d", &v) == 1;
+    }
+};
+
+int rpc_port = -1;
+
+coke::RpcClient make_client() {
+    coke::RpcClientParams params;
+    params.host = "127.0.0.1";
+    params.port = (unsigned short)rpc_port;
+    return coke::RpcClient(params);
+}
+
+coke::Task<> rpc_processor(coke::RpcServerContext ctx) {
+    coke::RpcRequest &req = ctx.get_req();
+    coke::RpcResponse &resp = ctx.get_resp();
+
+    if (req.get_method() == METHOD_ECHO) {
+        // Longer bodies are replied later
+        co_await coke::sleep(std::chrono::milliseconds(req.get_body().size()));
+        resp.set_body(req.get_body());
+    }
+    else if (req.get_method() == METHOD_ADD) {
+        AddRequest add;
+        if (coke::rpc_decode(req, add))
+            coke::rpc_encode(add.a + add.b, resp);
+        else
+            resp.set_status(STATUS_NO_METHOD);
+    }
+    else
+        resp.set_status(STATUS_NO_METHOD);
+
+    co_await ctx.reply();
+}
+
+coke::Task<> test_echo() {
+    coke::RpcClient client = make_client();
+    coke::RpcResult res = co_await client.call(METHOD_ECHO, "hello");
+
+    EXPECT_EQ(res.state, coke::STATE_SUCCESS);
+    EXPECT_EQ(res.resp.get_status(), coke::RPC_STATUS_OK);
+    EXPECT_EQ(res.resp.get_body(), "hello");
+
+    res = co_await client.call(METHOD_ECHO, std::string());
+    EXPECT_EQ(res.state, coke::STATE_SUCCESS);
+    EXPECT_TRUE(res.resp.get_body().empty());
+
+    res = co_await client.call(12345, "x");
+    EXPECT_EQ(res.state, coke::STATE_SUCCESS);
+    EXPECT_EQ(res.resp.get_status(), STATUS_NO_METHOD);
+}
+
+coke::Task<> test_typed() {
+    coke::RpcClient client = make_client();
+    int sum = 0;
+
+    coke::RpcResult res = co_await client.call(METHOD_ADD, AddRequest{3, 4}, sum);
+    EXPECT_EQ(res.state, coke::STATE_SUCCESS);
+    EXPECT_EQ(sum, 7);
+
+    // The echoed body is not a number
+    std::string bad("abc");
+    res = co_await client.call(METHOD_ECHO, bad, sum);
+    EXPECT_EQ(res.state, coke::STATE_SYS_ERROR);
+    EXPECT_EQ(res.error, EBADMSG);
+}
+
+coke::Task<> test_concurrent() {
+    constexpr int N = 16;
+    coke::RpcClient client = make_client();
+    std::vector<coke::Task<coke::RpcResult>> tasks;
+
+    for (int i = 0; i < N; i++)
+        tasks.emplace_back(client.call(METHOD_ECHO, std::string(N - i, 'a')));
+
+    std::vector<coke::RpcResult> rets = co_await coke::async_wait(std::move(tasks));
+    for (int i = 0; i < N; i++) {
+        EXPECT_EQ(rets[i].state, coke::STATE_SUCCESS);
+        EXPECT_EQ(rets[i].resp.get_body(), std::string(N - i, 'a'));
+    }
+}
+
+TEST(RPC, echo) {
+    coke::sync_wait(test_echo());
+}
+
+TEST(RPC, typed) {
+    coke::sync_wait(test_typed());
+}
+
+TEST(RPC, concurrent) {
+    coke::sync_wait(test_concurrent());
+}
+
+int main(int argc, char *argv[]) {
+    coke::GlobalSettings s;
+    s.poller_threads = 2;
+    s.handler_threads = 2;
+    s.compute_threads = 2;
+    coke::library_init(s);
+
+    testing::InitGoogleTest(&argc, argv);
+
+    coke::RpcServer server(rpc_processor);
+
+    for (int i = 8100; i < 8110; i++) {
+        if (server.start(i) == 0) {
+            rpc_port = i;
+            break;
+        }
+    }
+
+    if (rpc_port == -1) {
+        EXPECT_NE(rpc_port, -1) << "Server start failed " << errno;
+        return -1;
+    }
+
+    int ret = RUN_ALL_TESTS();
+    server.stop();
+
+    return ret;
+}
@@ -101,6 +101,35 @@ void test_semaphore(int sem_max, int test_method) {
     EXPECT_EQ(p.total.load(), (MAX_TASKS * p.loop_max));
 }
 
+coke::Task<> acquire_large(coke::Semaphore &sem, coke::Latch &lt) {
+    EXPECT_EQ(co_await sem.acquire(4), coke::TOP_SUCCESS);
+    lt.count_down();
+}
+
+coke::Task<> test_batch_acquire() {
+    coke::Semaphore sem(4);
+    coke::Latch lt(1);
+
+    EXPECT_EQ(co_await sem.acquire(3), coke::TOP_SUCCESS);
+    EXPECT_FALSE(sem.try_acquire(2));
+    EXPECT_EQ(co_await sem.try_acquire_for(ms10, 2), coke::TOP_TIMEOUT);
+
+    // The small requests cannot overtake the large one in the queue
+    acquire_large(sem, lt).detach();
+    co_await coke::sleep(ms10);
+    EXPECT_FALSE(sem.try_acquire(1));
+    EXPECT_EQ(co_await sem.try_acquire_for(ms10, 1), coke::TOP_TIMEOUT);
+
+    sem.release(3);
+    co_await lt.wait();
+    EXPECT_FALSE(sem.try_acquire(1));
+
+    sem.release(4);
+    EXPECT_TRUE(sem.try_acquire(4));
+    EXPECT_TRUE(sem.try_acquire(0));
+    sem.release(4);
+}
+
 TEST(SEMAPHORE, sem_try_acquire) {
     test_semaphore(1, TEST_TRY_ACQUIRE);
     test_semaphore(16, TEST_TRY_ACQUIRE);
@@ -116,6 +145,17 @@ TEST(SEMAPHORE, sem_acquire_for) {
     test_semaphore(16, TEST_ACQUIRE_FOR);
 }
 
+TEST(SEMAPHORE, sem_spin_acquire) {
+    coke::set_lock_spin_count(100);
+    test_semaphore(1, TEST_ACQUIRE);
+    test_semaphore(16, TEST_ACQUIRE_FOR);
+    coke::set_lock_spin_count(0);
+}
+
+TEST(SEMAPHORE, batch_acquire) {
+    coke::sync_wait(test_batch_acquire());
+}
+
 int main(int argc, char *argv[]) {
     coke::GlobalSettings s;
     s.poller_threads = 4;
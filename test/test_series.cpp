@@ -88,6 +88,31 @@ TEST(SERIES, default) {
     lt.wait();
 }
 
+coke::Task<> pooled_series(coke::SyncLatch &lt) {
+    SeriesWork *s1 = co_await coke::current_series();
+    co_await coke::sleep(0.01);
+
+    SeriesWork *s2 = co_await coke::current_series();
+    EXPECT_EQ(s1, s2);
+
+    lt.count_down();
+}
+
+TEST(SERIES, pooled) {
+    constexpr std::size_t N = 8;
+    coke::SeriesPoolStats before = coke::get_series_pool_stats();
+
+    for (std::size_t i = 0; i < N; i++) {
+        coke::SyncLatch lt(1);
+        coke::detach_on_new_series(pooled_series(lt),
+                                   coke::pooled_series_creater);
+        lt.wait();
+    }
+
+    coke::SeriesPoolStats after = coke::get_series_pool_stats();
+    EXPECT_EQ(after.hits + after.misses, before.hits + before.misses + N);
+}
+
 int main(int argc, char *argv[]) {
     coke::GlobalSettings s;
     s.poller_threads = 2;
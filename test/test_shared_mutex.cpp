@@ -167,6 +167,28 @@ coke::Task<> test_shared_lock() {
     }
 }
 
+TEST(SHARED_MUTEX, lock_awaiter) {
+    coke::SharedMutex mtx;
+
+    EXPECT_EQ(coke::sync_wait(mtx.lock_shared()), coke::TOP_SUCCESS);
+    EXPECT_EQ(coke::sync_wait(mtx.lock_shared()), coke::TOP_SUCCESS);
+    EXPECT_FALSE(mtx.try_lock());
+    EXPECT_FALSE(mtx.try_upgrade());
+    EXPECT_EQ(coke::sync_wait(mtx.try_lock_for(ms10)), coke::TOP_TIMEOUT);
+
+    mtx.unlock_shared();
+    EXPECT_TRUE(mtx.try_upgrade());
+    EXPECT_FALSE(mtx.try_lock_shared());
+    EXPECT_EQ(coke::sync_wait(mtx.try_lock_shared_for(ms10)),
+              coke::TOP_TIMEOUT);
+
+    mtx.unlock();
+    EXPECT_EQ(coke::sync_wait(mtx.lock()), coke::TOP_SUCCESS);
+    mtx.unlock();
+    EXPECT_TRUE(mtx.try_lock_shared());
+    mtx.unlock_shared();
+}
+
 TEST(SHARED_MUTEX, try_lock) {
     test_mutex(TEST_TRY_LOCK);
 }
@@ -191,6 +213,13 @@ TEST(SHARED_MUTEX, lock_shared_for) {
     test_mutex(TEST_TRY_LOCK_SHARED_FOR);
 }
 
+TEST(SHARED_MUTEX, spin_lock) {
+    coke::set_lock_spin_count(100);
+    test_mutex(TEST_LOCK);
+    test_mutex(TEST_LOCK_SHARED);
+    coke::set_lock_spin_count(0);
+}
+
 TEST(MUTEX, shared_lock) {
     coke::sync_wait(test_shared_lock());
 }
@@ -0,0 +1,137 @@
+/**
+ * Copyright 2024 Coke Project (https://github.com/kedixa/coke)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Authors: kedixa (https://github.com/kedixa)
+*/
+
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <gtest/gtest.h>
+
+#include "coke/coke.h"
+#include "coke/single_flight.h"
+
+using SingleFlight = coke::SingleFlight<int, std::string>;
+
+constexpr auto ms10 = std::chrono::milliseconds(10);
+constexpr auto ms50 = std::chrono::milliseconds(50);
+
+coke::Task<std::string> loader(std::atomic<int> &cnt, int key) {
+    cnt.fetch_add(1);
+    co_await coke::sleep(ms10);
+    co_return std::to_string(key);
+}
+
+coke::Task<> get_value(SingleFlight &sf, std::atomic<int> &cnt, int key) {
+    auto ptr = co_await sf.call(key, [&cnt, key]() {
+        return loader(cnt, key);
+    });
+
+    EXPECT_TRUE(ptr);
+    if (ptr) {
+        EXPECT_EQ(*ptr, std::to_string(key));
+    }
+}
+
+coke::Task<> test_share() {
+    constexpr int N = 16;
+    SingleFlight sf;
+    std::atomic<int> cnt{0};
+    std::vector<coke::Task<>> tasks;
+
+    for (int i = 0; i < N; i++)
+        tasks.emplace_back(get_value(sf, cnt, i % 2));
+
+    co_await coke::async_wait(std::move(tasks));
+    EXPECT_EQ(cnt.load(), 2);
+    EXPECT_EQ(sf.size(), 0u);
+
+    // Without ttl, the next call loads again
+    co_await get_value(sf, cnt, 0);
+    EXPECT_EQ(cnt.load(), 3);
+}
+
+coke::Task<> test_ttl() {
+    SingleFlight sf(ms50);
+    std::atomic<int> cnt{0};
+
+    co_await get_value(sf, cnt, 1);
+    co_await get_value(sf, cnt, 1);
+    EXPECT_EQ(cnt.load(), 1);
+    EXPECT_EQ(sf.size(), 1u);
+
+    co_await coke::sleep(ms50);
+    co_await get_value(sf, cnt, 1);
+    EXPECT_EQ(cnt.load(), 2);
+
+    EXPECT_TRUE(sf.forget(1));
+    co_await get_value(sf, cnt, 1);
+    EXPECT_EQ(cnt.load(), 3);
+}
+
+coke::Task<> throw_value(SingleFlight &sf, std::atomic<int> &cnt) {
+    bool caught = false;
+
+    try {
+        co_await sf.call(0, [&cnt]() -> coke::Task<std::string> {
+            cnt.fetch_add(1);
+            co_await coke::sleep(ms10);
+            throw std::runtime_error("load failed");
+        });
+    }
+    catch (const std::runtime_error &) {
+        caught = true;
+    }
+
+    EXPECT_TRUE(caught);
+}
+
+coke::Task<> test_exception() {
+    SingleFlight sf(ms50);
+    std::atomic<int> cnt{0};
+
+    co_await coke::async_wait(throw_value(sf, cnt), throw_value(sf, cnt));
+    EXPECT_EQ(cnt.load(), 1);
+
+    // The exception is not kept
+    EXPECT_EQ(sf.size(), 0u);
+}
+
+TEST(SINGLE_FLIGHT, share) {
+    coke::sync_wait(test_share());
+}
+
+TEST(SINGLE_FLIGHT, ttl) {
+    coke::sync_wait(test_ttl());
+}
+
+TEST(SINGLE_FLIGHT, exception) {
+    coke::sync_wait(test_exception());
+}
+
+int main(int argc, char *argv[]) {
+    coke::GlobalSettings s;
+    s.poller_threads = 2;
+    s.handler_threads = 2;
+    s.compute_threads = 2;
+    coke::library_init(s);
+
+    testing::InitGoogleTest(&argc, argv);
+
+    return RUN_ALL_TESTS();
+}
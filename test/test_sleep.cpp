@@ -16,7 +16,10 @@
  * Authors: kedixa (https://github.com/kedixa)
 */
 
+#include <atomic>
 #include <chrono>
+#include <thread>
+#include <vector>
 #include <gtest/gtest.h>
 
 #include "coke/coke.h"
@@ -68,11 +71,265 @@ TEST(SLEEP, sleep2) {
     coke::sync_wait(success_sleep());
 }
 
+coke::Task<> slack_sleep(int ms, int slack) {
+    long start = current_msec();
+    auto nsec = std::chrono::milliseconds(ms);
+    int ret = co_await coke::sleep(nsec, std::chrono::milliseconds(slack));
+    long cost = current_msec() - start;
+
+    EXPECT_EQ(ret, coke::SLEEP_SUCCESS);
+    EXPECT_GE(cost, ms);
+    EXPECT_LE(cost, ms + slack + 10);
+}
+
+coke::Task<> do_sleep_until() {
+    auto deadline = std::chrono::steady_clock::now() +
+                    std::chrono::milliseconds(20);
+
+    int ret = co_await coke::sleep_until(deadline);
+    EXPECT_EQ(ret, coke::SLEEP_SUCCESS);
+    EXPECT_GE(std::chrono::steady_clock::now(), deadline);
+
+    // A passed deadline returns without waiting
+    ret = co_await coke::sleep_until(deadline);
+    EXPECT_EQ(ret, coke::SLEEP_SUCCESS);
+}
+
+TEST(SLEEP, sleep_until) {
+    coke::sync_wait(do_sleep_until());
+}
+
+TEST(SLEEP, slack) {
+    coke::sync_wait(
+        slack_sleep(10, 50),
+        slack_sleep(30, 50),
+        slack_sleep(60, 100)
+    );
+}
+
+TEST(SLEEP, round_up) {
+    using Helper = coke::detail::TimedWaitHelper;
+    auto slack = std::chrono::milliseconds(100);
+    auto now = Helper::now();
+    auto t = Helper::round_up(now, slack);
+
+    EXPECT_GE(t, now);
+    EXPECT_LT(t - now, slack);
+    EXPECT_EQ(t.time_since_epoch().count() % coke::NanoSec(slack).count(), 0);
+    EXPECT_EQ(Helper::round_up(t, slack), t);
+    EXPECT_EQ(Helper::round_up(now, coke::NanoSec(0)), now);
+}
+
+coke::Task<> coarse_sleep(int ms) {
+    long start = current_msec();
+    int ret = co_await coke::sleep_coarse(std::chrono::milliseconds(ms));
+    long cost = current_msec() - start;
+
+    EXPECT_EQ(ret, coke::SLEEP_SUCCESS);
+    EXPECT_GE(cost, ms);
+    EXPECT_NEAR(cost, ms, 30);
+}
+
+coke::Task<> coarse_cancel() {
+    int x;
+
+    // Uses the timing wheel because of GlobalSettings::timer_wheel_threshold
+    auto awaiter = coke::sleep(&x, std::chrono::seconds(100));
+    coke::cancel_sleep_by_addr(&x);
+    int ret = co_await std::move(awaiter);
+    EXPECT_EQ(ret, coke::SLEEP_CANCELED);
+}
+
+TEST(SLEEP, timing_wheel) {
+    coke::sync_wait(
+        coarse_sleep(20),
+        coarse_sleep(100),
+        coarse_sleep(300)
+    );
+    coke::sync_wait(coarse_cancel());
+}
+
+class ReadyAwaiter : public coke::BasicAwaiter<int> {
+public:
+    ReadyAwaiter(int x) { this->emplace_result(x); }
+};
+
+coke::Task<> ready_awaiters() {
+    constexpr int N = 100000;
+    long sum = 0;
+
+    for (int i = 0; i < N; i++) {
+        int ret = co_await coke::SleepAwaiter();
+        EXPECT_EQ(ret, coke::SLEEP_SUCCESS);
+
+        sum += co_await ReadyAwaiter(1);
+    }
+
+    EXPECT_EQ(sum, N);
+}
+
+TEST(SLEEP, ready_awaiter) {
+    coke::sync_wait(ready_awaiters());
+}
+
+coke::Task<> sleep_by_key() {
+    coke::SleepKey key("test_sleep_key");
+    auto awaiter = coke::sleep(key, coke::inf_dur);
+
+    EXPECT_EQ(coke::cancel_sleep(coke::SleepKey("test_sleep_key")), 1u);
+    EXPECT_EQ(co_await std::move(awaiter), coke::SLEEP_CANCELED);
+}
+
+TEST(SLEEP, sleep_key) {
+    coke::SleepKey a("a"), b("b"), c("a"), d;
+
+    EXPECT_TRUE(a.valid());
+    EXPECT_FALSE(d.valid());
+    EXPECT_EQ(a, c);
+    EXPECT_NE(a, b);
+
+    coke::sync_wait(sleep_by_key());
+}
+
+coke::Task<> sleep_by_addr(int *addr) {
+    co_await coke::sleep(addr, std::chrono::milliseconds(1));
+}
+
+TEST(SLEEP, timer_map_stats) {
+    int x;
+    auto before = coke::get_sleep_map_stats_by_addr();
+    coke::sync_wait(sleep_by_addr(&x), sleep_by_addr(&x));
+    auto after = coke::get_sleep_map_stats_by_addr();
+
+    uint64_t cnt_before = 0, cnt_after = 0;
+    for (const auto &st : before)
+        cnt_before += st.lock_count;
+    for (const auto &st : after) {
+        cnt_after += st.lock_count;
+        EXPECT_LE(st.contended_count, st.lock_count);
+    }
+
+    EXPECT_EQ(after.size(), 8u);
+    EXPECT_EQ(coke::get_sleep_map_stats_by_id().size(), 8u);
+    EXPECT_GE(cnt_after, cnt_before + 2);
+}
+
+TEST(SLEEP, timer_map_counts) {
+    auto sum = [](const std::vector<coke::TimerMapStats> &v) {
+        coke::TimerMapStats t;
+        for (const auto &st : v) {
+            t.live_timers += st.live_timers;
+            t.add_count += st.add_count;
+            t.cancel_count += st.cancel_count;
+            t.expire_count += st.expire_count;
+        }
+        return t;
+    };
+
+    uint64_t id = coke::get_unique_id();
+    auto before = sum(coke::get_sleep_map_stats_by_id());
+
+    auto a = coke::sleep(id, coke::inf_dur);
+    auto b = coke::sleep(id, std::chrono::milliseconds(1));
+    EXPECT_EQ(sum(coke::get_sleep_map_stats_by_id()).live_timers,
+              before.live_timers + 2);
+
+    coke::cancel_sleep_by_id(id, 1);
+    coke::sync_wait(std::move(a), std::move(b));
+    auto after = sum(coke::get_sleep_map_stats_by_id());
+
+    EXPECT_EQ(after.live_timers, before.live_timers);
+    EXPECT_EQ(after.add_count, before.add_count + 2);
+    EXPECT_EQ(after.cancel_count, before.cancel_count + 1);
+    EXPECT_EQ(after.expire_count, before.expire_count + 1);
+}
+
+TEST(SLEEP, cancel_unawaited) {
+    constexpr int N = 1000;
+    auto live = []() {
+        uint64_t n = 0;
+        for (const auto &st : coke::get_sleep_map_stats_by_id())
+            n += st.live_timers;
+        return n;
+    };
+
+    uint64_t id = coke::get_unique_id();
+    uint64_t before = live();
+
+    // Cancel the timers while the awaiters are destroyed without co await
+    for (int round = 0; round < 10; round++) {
+        std::vector<coke::SleepAwaiter> awaiters;
+        std::atomic<bool> cleared{false};
+
+        awaiters.reserve(N);
+        for (int i = 0; i < N; i++) {
+            if (i % 2)
+                awaiters.emplace_back(coke::sleep(id, std::chrono::seconds(10)));
+            else
+                awaiters.emplace_back(coke::sleep(id, coke::inf_dur));
+        }
+
+        std::thread th([&] {
+            awaiters.clear();
+            cleared.store(true);
+        });
+
+        while (!cleared.load())
+            coke::cancel_sleep_by_id(id, 8);
+
+        th.join();
+        EXPECT_EQ(coke::cancel_sleep_by_id(id), 0u);
+    }
+
+    EXPECT_EQ(live(), before);
+}
+
+coke::Task<> test_coarse_clock() {
+    using namespace std::chrono;
+
+    EXPECT_TRUE(coke::start_coarse_clock(milliseconds(1)));
+    EXPECT_FALSE(coke::start_coarse_clock(milliseconds(1)));
+    EXPECT_TRUE(coke::coarse_clock_running());
+
+    auto t1 = coke::CoarseSteadyClock::now();
+    auto real = steady_clock::now();
+    EXPECT_LE(t1, real);
+    EXPECT_LT(real - t1, milliseconds(100));
+
+    auto w = coke::CoarseSystemClock::now();
+    EXPECT_LT(abs(system_clock::now() - w), seconds(1));
+
+    co_await coke::sleep(milliseconds(20));
+    auto t2 = coke::CoarseSteadyClock::now();
+    EXPECT_GT(t2, t1);
+
+    // Timed waits still finish with the coarse clock
+    coke::set_timed_wait_coarse_clock(true);
+    int ret = co_await coke::sleep_until(steady_clock::now() + milliseconds(10));
+    EXPECT_EQ(ret, coke::SLEEP_SUCCESS);
+    coke::set_timed_wait_coarse_clock(false);
+
+    co_await coke::stop_coarse_clock();
+    EXPECT_FALSE(coke::coarse_clock_running());
+
+    // Fall back to the std clock
+    t1 = coke::CoarseSteadyClock::now();
+    t2 = coke::CoarseSteadyClock::now();
+    EXPECT_LE(t1, t2);
+}
+
+TEST(SLEEP, coarse_clock) {
+    coke::sync_wait(test_coarse_clock());
+}
+
 int main(int argc, char *argv[]) {
     coke::GlobalSettings s;
     s.poller_threads = 2;
     s.handler_threads = 2;
     s.compute_threads = 2;
+    s.timer_map_shards = 5;
+    s.timer_wheel_threshold = 10000;
+    s.timer_lock_timing = true;
     coke::library_init(s);
 
     testing::InitGoogleTest(&argc, argv);
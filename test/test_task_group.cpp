@@ -0,0 +1,121 @@
+/**
+ * Copyright 2024 Coke Project (https://github.com/kedixa/coke)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Authors: kedixa (https://github.com/kedixa)
+*/
+
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+#include <gtest/gtest.h>
+
+#include "coke/coke.h"
+
+coke::Task<> sleep_add(std::atomic<int> &cnt) {
+    co_await coke::sleep(0.01);
+    cnt.fetch_add(1);
+}
+
+coke::Task<> wait_stop(coke::TaskGroup &group, std::atomic<int> &cnt) {
+    coke::StopToken &token = group.get_stop_token();
+    bool stop = co_await token.wait_stop_for(std::chrono::seconds(10));
+
+    if (stop)
+        cnt.fetch_add(1);
+}
+
+coke::Task<> throw_error() {
+    co_await coke::yield();
+    throw std::runtime_error("child error");
+}
+
+coke::Task<> test_join() {
+    coke::TaskGroup group;
+    std::atomic<int> cnt{0};
+
+    for (int i = 0; i < 10; i++)
+        group.spawn(sleep_add(cnt));
+
+    co_await group.join();
+    EXPECT_EQ(cnt.load(), 10);
+
+    // The group can be reused after join
+    group.spawn(sleep_add(cnt));
+    co_await group.join();
+    EXPECT_EQ(cnt.load(), 11);
+
+    // Join an empty group returns immediately
+    co_await group.join();
+}
+
+coke::Task<> test_stop() {
+    coke::TaskGroup group;
+    std::atomic<int> cnt{0};
+
+    for (int i = 0; i < 5; i++)
+        group.spawn(wait_stop(group, cnt));
+
+    co_await coke::sleep(0.01);
+    group.request_stop();
+    EXPECT_TRUE(group.stop_requested());
+
+    co_await group.join();
+    EXPECT_EQ(cnt.load(), 5);
+}
+
+coke::Task<> test_exception() {
+    coke::TaskGroup group;
+    std::atomic<int> cnt{0};
+    bool caught = false;
+
+    for (int i = 0; i < 3; i++)
+        group.spawn(wait_stop(group, cnt));
+
+    group.spawn(throw_error());
+
+    try {
+        co_await group.join();
+    }
+    catch (const std::runtime_error &) {
+        caught = true;
+    }
+
+    EXPECT_TRUE(caught);
+    EXPECT_EQ(cnt.load(), 3);
+}
+
+TEST(TASK_GROUP, join) {
+    coke::sync_wait(test_join());
+}
+
+TEST(TASK_GROUP, stop) {
+    coke::sync_wait(test_stop());
+}
+
+TEST(TASK_GROUP, exception) {
+    coke::sync_wait(test_exception());
+}
+
+int main(int argc, char *argv[]) {
+    coke::GlobalSettings s;
+    s.poller_threads = 2;
+    s.handler_threads = 2;
+    s.compute_threads = 2;
+    coke::library_init(s);
+
+    testing::InitGoogleTest(&argc, argv);
+
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,52 @@
+/**
+ * Copyright 2024 Coke Project (https://github.com/kedixa/coke)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Authors: kedixa (https://github.com/kedixa)
+*/
+
+#include <gtest/gtest.h>
+
+#include "coke/global.h"
+#include "coke/net/tls_session.h"
+
+TEST(TLS_SESSION, enable) {
+    coke::TlsSessionParams params;
+    params.max_sessions = 4;
+    params.handshake_timing = true;
+
+    EXPECT_EQ(coke::enable_tls_session_cache(params), 0);
+    EXPECT_EQ(coke::enable_tls_session_cache(params), -1);
+
+    coke::TlsHandshakeStats stats = coke::get_tls_handshake_stats();
+    EXPECT_EQ(stats.handshakes, 0u);
+    EXPECT_EQ(stats.resumed, 0u);
+    EXPECT_EQ(stats.sessions, 0u);
+    EXPECT_EQ(stats.latency.count, 0u);
+
+    coke::clear_tls_session_cache();
+    EXPECT_EQ(coke::get_tls_handshake_stats().sessions, 0u);
+}
+
+int main(int argc, char *argv[]) {
+    coke::GlobalSettings s;
+    s.poller_threads = 2;
+    s.handler_threads = 2;
+    s.compute_threads = 2;
+    coke::library_init(s);
+
+    testing::InitGoogleTest(&argc, argv);
+
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,68 @@
+/**
+ * Copyright 2024 Coke Project (https://github.com/kedixa/coke)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Authors: kedixa (https://github.com/kedixa)
+*/
+
+#include <sstream>
+#include <string>
+#include <gtest/gtest.h>
+
+#include "coke/coke.h"
+#include "coke/trace.h"
+
+coke::Task<> sleep_twice() {
+    co_await coke::sleep(0.01);
+    co_await coke::yield();
+}
+
+TEST(TRACE, export_chrome) {
+#ifndef COKE_ENABLE_TRACE
+    GTEST_SKIP() << "Tracing is disabled";
+#endif
+
+    coke::trace_clear();
+    coke::sync_wait(sleep_twice());
+
+    std::ostringstream oss;
+    coke::trace_export_chrome(oss);
+    std::string s = oss.str();
+
+    EXPECT_EQ(s.rfind("{\"traceEvents\":[", 0), 0u);
+    EXPECT_NE(s.find("coke::SleepAwaiter"), std::string::npos);
+    EXPECT_NE(s.find("\"ph\":\"b\""), std::string::npos);
+    EXPECT_NE(s.find("\"ph\":\"e\""), std::string::npos);
+}
+
+TEST(TRACE, clear) {
+    coke::sync_wait(sleep_twice());
+    coke::trace_clear();
+
+    std::ostringstream oss;
+    coke::trace_export_chrome(oss);
+    EXPECT_EQ(oss.str().find("SleepAwaiter"), std::string::npos);
+}
+
+int main(int argc, char *argv[]) {
+    coke::GlobalSettings s;
+    s.poller_threads = 2;
+    s.handler_threads = 2;
+    s.compute_threads = 2;
+    coke::library_init(s);
+
+    testing::InitGoogleTest(&argc, argv);
+
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,194 @@
+/**
+ * Copyright 2024 Coke Project (https://github.com/kedixa/coke)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Authors: kedixa (https://github.com/kedixa)
+*/
+
+#include <map>
+#include <string>
+#include <vector>
+#include <gtest/gtest.h>
+
+#include "coke/global.h"
+#include "coke/net/upstream.h"
+
+using Selection = coke::detail::UpstreamSelection;
+
+void create_group(const std::string &name, coke::UpstreamPolicy policy,
+                  const std::vector<unsigned> &weights) {
+    coke::UpstreamParams params;
+    params.policy = policy;
+    params.max_fails = 2;
+    params.eject_timeout = 60 * 1000;
+
+    EXPECT_EQ(coke::upstream_create(name, params), 0);
+    EXPECT_EQ(coke::upstream_create(name, params), -1);
+
+    for (std::size_t i = 0; i < weights.size(); i++) {
+        coke::UpstreamServer server;
+        server.address = "10.0.0." + std::to_string(i) + ":80";
+        server.weight = weights[i];
+        EXPECT_EQ(coke::upstream_add_server(name, server), 0);
+    }
+}
+
+std::map<std::string, int> select_n(const std::string &name, int n) {
+    std::map<std::string, int> cnt;
+    Selection sel;
+
+    for (int i = 0; i < n; i++) {
+        EXPECT_TRUE(coke::detail::upstream_select(name, "", sel));
+        cnt[sel.address]++;
+        coke::detail::upstream_finish(sel.server, coke::STATE_SUCCESS);
+    }
+
+    return cnt;
+}
+
+TEST(UPSTREAM, not_group) {
+    Selection sel;
+    EXPECT_FALSE(coke::detail::upstream_select("not.a.group", "", sel));
+    EXPECT_EQ(coke::upstream_delete("not.a.group"), -1);
+}
+
+TEST(UPSTREAM, round_robin) {
+    create_group("rr", coke::UpstreamPolicy::ROUND_ROBIN, {1, 2, 3});
+
+    auto cnt = select_n("rr", 600);
+    EXPECT_EQ(cnt["10.0.0.0:80"], 100);
+    EXPECT_EQ(cnt["10.0.0.1:80"], 200);
+    EXPECT_EQ(cnt["10.0.0.2:80"], 300);
+
+    std::vector<coke::UpstreamServerStats> stats;
+    EXPECT_TRUE(coke::get_upstream_stats("rr", stats));
+    EXPECT_EQ(stats.size(), 3u);
+    EXPECT_EQ(stats[2].total, 300u);
+    EXPECT_EQ(stats[2].inflight, 0u);
+
+    EXPECT_EQ(coke::upstream_delete("rr"), 0);
+}
+
+TEST(UPSTREAM, weighted_random) {
+    create_group("wr", coke::UpstreamPolicy::WEIGHTED_RANDOM, {1, 1});
+
+    // Zero weight and duplicated address are rejected
+    coke::UpstreamServer server;
+    server.address = "10.0.0.2:80";
+    server.weight = 0;
+    EXPECT_EQ(coke::upstream_add_server("wr", server), -1);
+
+    server.address = "10.0.0.1:80";
+    server.weight = 1;
+    EXPECT_EQ(coke::upstream_add_server("wr", server), -1);
+
+    auto cnt = select_n("wr", 1000);
+    EXPECT_EQ(cnt.size(), 2u);
+    EXPECT_GE(cnt["10.0.0.0:80"], 300);
+    EXPECT_GE(cnt["10.0.0.1:80"], 300);
+
+    EXPECT_EQ(coke::upstream_delete("wr"), 0);
+}
+
+TEST(UPSTREAM, consistent_hash) {
+    create_group("ch", coke::UpstreamPolicy::CONSISTENT_HASH, {1, 1, 1, 1});
+
+    std::map<std::string, std::string> first;
+    Selection sel;
+    int moved = 0;
+
+    for (int i = 0; i < 1000; i++) {
+        std::string key = "key" + std::to_string(i);
+        EXPECT_TRUE(coke::detail::upstream_select("ch", key, sel));
+        first[key] = sel.address;
+        coke::detail::upstream_finish(sel.server, coke::STATE_SUCCESS);
+    }
+
+    // Only the keys of the removed server move
+    EXPECT_EQ(coke::upstream_remove_server("ch", "10.0.0.3:80"), 0);
+
+    for (const auto &[key, addr] : first) {
+        EXPECT_TRUE(coke::detail::upstream_select("ch", key, sel));
+        EXPECT_NE(sel.address, "10.0.0.3:80");
+        if (sel.address != addr) {
+            EXPECT_EQ(addr, "10.0.0.3:80");
+            moved++;
+        }
+        coke::detail::upstream_finish(sel.server, coke::STATE_SUCCESS);
+    }
+
+    EXPECT_GT(moved, 0);
+    EXPECT_LT(moved, 500);
+
+    EXPECT_EQ(coke::upstream_delete("ch"), 0);
+}
+
+TEST(UPSTREAM, least_inflight) {
+    create_group("li", coke::UpstreamPolicy::LEAST_INFLIGHT, {1, 1});
+
+    std::vector<Selection> sels(10);
+    std::map<std::string, int> cnt;
+
+    for (Selection &sel : sels) {
+        EXPECT_TRUE(coke::detail::upstream_select("li", "", sel));
+        cnt[sel.address]++;
+    }
+
+    EXPECT_EQ(cnt["10.0.0.0:80"], 5);
+    EXPECT_EQ(cnt["10.0.0.1:80"], 5);
+
+    for (Selection &sel : sels)
+        coke::detail::upstream_finish(sel.server, coke::STATE_SUCCESS);
+
+    EXPECT_EQ(coke::upstream_delete("li"), 0);
+}
+
+TEST(UPSTREAM, eject) {
+    create_group("ej", coke::UpstreamPolicy::ROUND_ROBIN, {1, 1});
+
+    Selection sel;
+    std::string bad;
+
+    // Fail the same server continuously until it is ejected
+    for (int i = 0; i < 2; i++) {
+        do {
+            EXPECT_TRUE(coke::detail::upstream_select("ej", "", sel));
+            if (bad.empty())
+                bad = sel.address;
+            if (sel.address != bad)
+                coke::detail::upstream_finish(sel.server, coke::STATE_SUCCESS);
+        } while (sel.address != bad);
+
+        coke::detail::upstream_finish(sel.server, coke::STATE_SYS_ERROR);
+    }
+
+    auto cnt = select_n("ej", 10);
+    EXPECT_EQ(cnt.size(), 1u);
+    EXPECT_EQ(cnt.count(bad), 0u);
+
+    std::vector<coke::UpstreamServerStats> stats;
+    EXPECT_TRUE(coke::get_upstream_stats("ej", stats));
+    for (const auto &st : stats) {
+        EXPECT_EQ(st.ejected, st.address == bad);
+        EXPECT_EQ(st.failed, st.address == bad ? 2u : 0u);
+    }
+
+    EXPECT_EQ(coke::upstream_delete("ej"), 0);
+}
+
+int main(int argc, char *argv[]) {
+    testing::InitGoogleTest(&argc, argv);
+
+    return RUN_ALL_TESTS();
+}
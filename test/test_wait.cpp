@@ -16,6 +16,8 @@
  * Authors: kedixa (https://github.com/kedixa)
 */
 
+#include <atomic>
+#include <chrono>
 #include <functional>
 #include <string>
 #include <vector>
@@ -191,6 +193,349 @@ TEST(WAIT, async_vector_bool) {
     coke::sync_wait(async_test_bool());
 }
 
+std::atomic<int> move_count{0};
+
+struct MoveCounter {
+    MoveCounter() = default;
+    MoveCounter(int v) : value(v) { }
+    MoveCounter(MoveCounter &&that) : value(that.value) { move_count++; }
+
+    MoveCounter &operator= (MoveCounter &&that) {
+        value = that.value;
+        move_count++;
+        return *this;
+    }
+
+    int value{0};
+};
+
+coke::Task<MoveCounter> make_counter(int v) {
+    MoveCounter c(v);
+    co_await coke::yield();
+    co_return c;
+}
+
+TEST(WAIT, result_slot) {
+    constexpr int N = 16;
+    std::vector<coke::Task<MoveCounter>> tasks;
+
+    for (int i = 0; i < N; i++)
+        tasks.emplace_back(make_counter(i));
+
+    move_count = 0;
+    std::vector<MoveCounter> ret = coke::sync_wait(std::move(tasks));
+
+    // Each result is moved into the vector directly from co_return
+    EXPECT_EQ(move_count.load(), N);
+    for (int i = 0; i < N; i++)
+        EXPECT_EQ(ret[i].value, i);
+
+    move_count = 0;
+    MoveCounter one = coke::sync_wait(make_counter(N));
+    EXPECT_EQ(one.value, N);
+    EXPECT_LE(move_count.load(), 2);
+}
+
+struct InflightCounter {
+    void enter() {
+        int cur = inflight.fetch_add(1) + 1;
+        int old = max_inflight.load();
+
+        while (old < cur && !max_inflight.compare_exchange_weak(old, cur))
+            ;
+    }
+
+    void leave() { inflight.fetch_sub(1); }
+
+    std::atomic<int> inflight{0};
+    std::atomic<int> max_inflight{0};
+};
+
+coke::Task<int> counted_sleep(InflightCounter &c, int value) {
+    c.enter();
+    co_await coke::sleep(0.005);
+    c.leave();
+    co_return value;
+}
+
+coke::Task<> test_async_wait_n() {
+    constexpr int N = 32;
+    InflightCounter c;
+    std::vector<coke::Task<int>> tasks;
+    std::vector<int> expect;
+
+    for (int i = 0; i < N; i++) {
+        tasks.emplace_back(counted_sleep(c, i));
+        expect.push_back(i);
+    }
+
+    auto ret = co_await coke::async_wait_n(std::move(tasks), 4);
+    EXPECT_EQ(ret, expect);
+    EXPECT_LE(c.max_inflight.load(), 4);
+    EXPECT_EQ(c.inflight.load(), 0);
+}
+
+coke::Task<> test_async_for_each() {
+    InflightCounter c;
+    std::vector<int> values(32, 1);
+    std::atomic<int> sum{0};
+
+    auto func = [&](int v) -> coke::Task<> {
+        sum.fetch_add(co_await counted_sleep(c, v));
+    };
+
+    co_await coke::async_for_each(values, func, 3);
+    EXPECT_EQ(sum.load(), 32);
+    EXPECT_LE(c.max_inflight.load(), 3);
+}
+
+TEST(WAIT, async_wait_n) {
+    coke::sync_wait(test_async_wait_n());
+}
+
+TEST(WAIT, async_for_each) {
+    coke::sync_wait(test_async_for_each());
+}
+
+coke::Task<int> sleep_then_return(int ms, int value) {
+    co_await coke::sleep(std::chrono::milliseconds(ms));
+    co_return value;
+}
+
+coke::Task<> sleep_until_stop(coke::StopToken &token, std::atomic<int> &cnt) {
+    coke::StopToken::FinishGuard guard(&token);
+    bool stop = co_await token.wait_stop_for(std::chrono::seconds(10));
+
+    if (stop)
+        cnt.fetch_add(1);
+}
+
+coke::Task<> test_when_any() {
+    auto ret = co_await coke::when_any(
+        sleep_then_return(200, 1),
+        sleep_then_return(10, 2),
+        sleep_then_return(300, 3)
+    );
+
+    EXPECT_EQ(ret.index, 1u);
+    EXPECT_EQ(ret.value, 2);
+
+    // Let the remaining tasks finish before the test ends
+    co_await coke::sleep(0.35);
+}
+
+coke::Task<> test_when_any_stop() {
+    constexpr int N = 4;
+    coke::StopToken token(N + 1);
+    std::atomic<int> cnt{0};
+    std::vector<coke::Task<>> tasks;
+
+    tasks.emplace_back([](coke::StopToken &token) -> coke::Task<> {
+        coke::StopToken::FinishGuard guard(&token);
+        co_await coke::sleep(0.01);
+    }(token));
+
+    for (int i = 0; i < N; i++)
+        tasks.emplace_back(sleep_until_stop(token, cnt));
+
+    auto ret = co_await coke::when_any(std::move(tasks), &token);
+    EXPECT_EQ(ret.index, 0u);
+
+    bool finished = co_await token.wait_finish();
+    EXPECT_TRUE(finished);
+    EXPECT_EQ(cnt.load(), N);
+}
+
+coke::Task<> test_when_any_stop_variadic() {
+    coke::StopToken token(3);
+    std::atomic<int> cnt{0};
+
+    auto first = [](coke::StopToken &token) -> coke::Task<> {
+        coke::StopToken::FinishGuard guard(&token);
+        co_await coke::sleep(0.01);
+    };
+
+    auto ret = co_await coke::when_any(&token, first(token),
+                                       sleep_until_stop(token, cnt),
+                                       sleep_until_stop(token, cnt));
+    EXPECT_EQ(ret.index, 0u);
+
+    bool finished = co_await token.wait_finish();
+    EXPECT_TRUE(finished);
+    EXPECT_EQ(cnt.load(), 2);
+}
+
+coke::Task<> test_stop_callback() {
+    coke::StopToken token;
+    std::atomic<int> cnt{0};
+
+    {
+        coke::StopCallback cb1(token, [&]() noexcept { cnt.fetch_add(1); });
+        coke::StopCallback cb2(token, [&]() noexcept { cnt.fetch_add(2); });
+
+        // Removed before stop, never invoked
+        { coke::StopCallback cb3(token, [&]() noexcept { cnt.fetch_add(4); }); }
+
+        auto stop = [&]() -> coke::Task<> {
+            co_await coke::sleep(0.01);
+            EXPECT_TRUE(token.request_stop());
+            EXPECT_FALSE(token.request_stop());
+        };
+
+        auto wait = [&]() -> coke::Task<> {
+            EXPECT_TRUE(co_await token.wait_stop());
+        };
+
+        co_await coke::async_wait(stop(), wait(), wait());
+        EXPECT_EQ(cnt.load(), 3);
+    }
+
+    // Invoked at once if stop is already requested
+    coke::StopCallback cb4(token, [&]() noexcept { cnt.fetch_add(8); });
+    EXPECT_EQ(cnt.load(), 11);
+}
+
+TEST(WAIT, when_any) {
+    coke::sync_wait(test_when_any());
+}
+
+TEST(WAIT, when_any_stop) {
+    coke::sync_wait(test_when_any_stop());
+}
+
+TEST(WAIT, when_any_stop_variadic) {
+    coke::sync_wait(test_when_any_stop_variadic());
+}
+
+TEST(WAIT, stop_callback) {
+    coke::sync_wait(test_stop_callback());
+}
+
+coke::Task<int> return_value(int value) {
+    co_return value;
+}
+
+coke::Task<> test_when_all() {
+    constexpr int N = 64;
+    std::vector<coke::Task<int>> tasks;
+    std::vector<int> expect;
+
+    // Half of them finish synchronously, and the others on other threads
+    for (int i = 0; i < N; i++) {
+        if (i % 2)
+            tasks.emplace_back(sleep_then_return(1, i));
+        else
+            tasks.emplace_back(return_value(i));
+        expect.push_back(i);
+    }
+
+    auto ret = co_await coke::when_all(std::move(tasks));
+    EXPECT_EQ(ret, expect);
+
+    // The caller goes on with other awaitables after resumed
+    co_await coke::yield();
+
+    auto ret2 = co_await coke::when_all(return_value(1), return_value(2));
+    EXPECT_EQ(ret2, (std::vector<int>{1, 2}));
+
+    std::atomic<int> cnt{0};
+    auto inc = [&]() -> coke::Task<> {
+        co_await coke::sleep(0.001);
+        cnt.fetch_add(1);
+    };
+
+    co_await coke::when_all(inc(), inc(), inc());
+    EXPECT_EQ(cnt.load(), 3);
+
+    co_await coke::when_all(std::vector<coke::Task<>>{});
+}
+
+TEST(WAIT, when_all) {
+    coke::sync_wait(test_when_all());
+}
+
+coke::Task<> test_when_all_series() {
+    // Start a series before when_all, the caller must go on with it
+    co_await coke::sleep(0.001);
+    SeriesWork *series = co_await coke::current_series();
+
+    std::vector<coke::Task<int>> tasks;
+    for (int i = 0; i < 8; i++)
+        tasks.emplace_back(sleep_then_return(1, i));
+
+    auto ret = co_await coke::when_all(std::move(tasks));
+    EXPECT_EQ(ret.size(), 8u);
+
+    co_await coke::sleep(0.001);
+    SeriesWork *after = co_await coke::current_series();
+    EXPECT_EQ(series, after);
+
+    // Children finished synchronously do not suspend the caller
+    co_await coke::when_all(return_value(1), return_value(2));
+    co_await coke::sleep(0.001);
+    after = co_await coke::current_series();
+    EXPECT_EQ(series, after);
+}
+
+TEST(WAIT, when_all_series) {
+    coke::sync_wait(test_when_all_series());
+}
+
+struct RequestCtx {
+    int id;
+};
+
+coke::Task<int> local_id() {
+    co_await coke::yield();
+    RequestCtx *ctx = co_await coke::current_local_context<RequestCtx>();
+    co_return ctx ? ctx->id : -1;
+}
+
+coke::Task<int> nested_local_id() {
+    co_return co_await local_id();
+}
+
+coke::Task<> test_local_context() {
+    // The tasks of when_any may still be running after it returns
+    static RequestCtx ctx1{1}, ctx2{2};
+
+    EXPECT_EQ(co_await coke::current_local_context(), nullptr);
+    EXPECT_EQ(co_await local_id(), -1);
+
+    RequestCtx *prev = co_await coke::set_local_context(&ctx1);
+    EXPECT_EQ(prev, nullptr);
+    EXPECT_EQ(co_await nested_local_id(), 1);
+
+    // Explicitly set context is not overridden by the awaiting coroutine
+    coke::Task<int> task = nested_local_id();
+    task.set_local_context(&ctx2);
+    EXPECT_EQ(co_await std::move(task), 2);
+
+    // Propagated to the tasks started by async_wait and when_any
+    auto rets = co_await coke::async_wait(local_id(), nested_local_id());
+    EXPECT_EQ(rets, std::vector<int>(2, 1));
+
+    auto any = co_await coke::when_any(local_id(), local_id());
+    EXPECT_EQ(any.value, 1);
+
+    std::vector<coke::Task<int>> tasks;
+    for (int i = 0; i < 4; i++)
+        tasks.emplace_back(local_id());
+    rets = co_await coke::async_wait_n(std::move(tasks), 2);
+    EXPECT_EQ(rets, std::vector<int>(4, 1));
+
+    prev = co_await coke::set_local_context(&ctx2);
+    EXPECT_EQ(prev, &ctx1);
+    EXPECT_EQ(co_await local_id(), 2);
+
+    co_await coke::set_local_context(nullptr);
+    EXPECT_EQ(co_await local_id(), -1);
+}
+
+TEST(WAIT, local_context) {
+    coke::sync_wait(test_local_context());
+}
+
 int main(int argc, char *argv[]) {
     coke::GlobalSettings s;
     s.poller_threads = 2;
@@ -0,0 +1,281 @@
+/**
+ * Copyright 2024 Coke Project (https://github.com/kedixa/coke)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Authors: kedixa (https://github.com/kedixa)
+*/
+
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <gtest/gtest.h>
+
+#include "coke/coke.h"
+#include "coke/http/websocket.h"
+#include "coke/http/websocket_client.h"
+
+int ws_port = -1;
+
+std::string make_payload(std::size_t n) {
+    std::string s(n, '\0');
+
+    for (std::size_t i = 0; i < n; i++)
+        s[i] = (char)(i * 31 + 7);
+
+    return s;
+}
+
+/**
+ * @brief Make a masked frame, as sent by a client.
+*/
+std::string make_frame(int opcode, bool fin, std::string_view payload,
+                       uint32_t key = 0x12345678) {
+    char header[coke::WS_MAX_HEADER_SIZE];
+    std::size_t n;
+    std::string frame;
+
+    n = coke::websocket_frame_header(header, opcode, fin, payload.size(), &key);
+    frame.assign(header, n).append(payload);
+    coke::websocket_mask(frame.data() + n, payload.size(), key);
+
+    return frame;
+}
+
+/**
+ * @brief Feed `data` to the parser by `step` bytes each time, and collect
+ *        the messages.
+*/
+int parse_all(coke::WebSocketParser &parser, std::string_view data,
+              std::size_t step, std::vector<coke::WebSocketMessage> &msgs) {
+    while (!data.empty()) {
+        std::size_t size = std::min(step, data.size());
+        int ret = parser.append(data.data(), &size);
+
+        if (ret < 0)
+            return ret;
+
+        data.remove_prefix(size);
+
+        if (ret == 1) {
+            coke::WebSocketMessage msg;
+            parser.take(msg);
+            msgs.push_back(std::move(msg));
+        }
+    }
+
+    return 0;
+}
+
+coke::Task<> ws_echo(coke::WebSocketConnection &ws) {
+    coke::WebSocketMessage msg;
+
+    while (co_await ws.receive(msg) == coke::TOP_SUCCESS) {
+        if (msg.is_text())
+            co_await ws.send_text(msg.view());
+        else if (msg.is_binary())
+            co_await ws.send_binary(msg.view());
+    }
+}
+
+coke::Task<> test_echo(std::size_t size) {
+    coke::WebSocketClient client;
+    coke::WebSocketMessage msg;
+    std::string url = "ws://localhost:" + std::to_string(ws_port) + "/echo";
+    std::string text = make_payload(size);
+    int ret;
+
+    EXPECT_EQ(client.connect(url), 0);
+
+    ret = co_await client.send_binary(text);
+    EXPECT_EQ(ret, 0);
+
+    ret = co_await client.send_text("hello");
+    EXPECT_EQ(ret, 0);
+
+    ret = co_await client.try_receive_for(std::chrono::seconds(5), msg);
+    EXPECT_EQ(ret, coke::TOP_SUCCESS);
+    EXPECT_TRUE(msg.is_binary());
+    EXPECT_EQ(msg.view(), text);
+
+    ret = co_await client.try_receive_for(std::chrono::seconds(5), msg);
+    EXPECT_EQ(ret, coke::TOP_SUCCESS);
+    EXPECT_TRUE(msg.is_text());
+    EXPECT_EQ(msg.view(), "hello");
+
+    co_await client.close();
+}
+
+TEST(WEBSOCKET, mask) {
+    uint32_t key = 0xA1B2C3D4;
+    unsigned char k[4];
+
+    std::memcpy(k, &key, 4);
+
+    for (std::size_t len = 0; len < 200; len++) {
+        for (std::size_t offset = 0; offset < 4; offset++) {
+            std::string data = make_payload(len);
+            std::string expect = data;
+
+            for (std::size_t i = 0; i < len; i++)
+                expect[i] ^= k[(offset + i) & 3];
+
+            coke::websocket_mask(data.data(), len, key, offset);
+            EXPECT_EQ(data, expect) << len << " " << offset;
+        }
+    }
+}
+
+TEST(WEBSOCKET, accept_key) {
+    // The example of RFC 6455 section 1.3
+    EXPECT_EQ(coke::websocket_accept_key("dGhlIHNhbXBsZSBub25jZQ=="),
+              "s3pPLMBiTxaQ9kYGzzo+xOo=");
+}
+
+TEST(WEBSOCKET, frame_header) {
+    char buf[coke::WS_MAX_HEADER_SIZE];
+
+    EXPECT_EQ(coke::websocket_frame_header(buf, coke::WS_OPCODE_TEXT, true, 5),
+              2u);
+    EXPECT_EQ((unsigned char)buf[0], 0x81);
+    EXPECT_EQ((unsigned char)buf[1], 5);
+
+    EXPECT_EQ(coke::websocket_frame_header(buf, 2, false, 300), 4u);
+    EXPECT_EQ((unsigned char)buf[0], 0x02);
+    EXPECT_EQ((unsigned char)buf[1], 126);
+
+    uint32_t key = 1;
+    EXPECT_EQ(coke::websocket_frame_header(buf, 2, true, 70000, &key), 14u);
+    EXPECT_EQ((unsigned char)buf[1], 0x80 | 127);
+}
+
+TEST(WEBSOCKET, parser) {
+    std::string big = make_payload(100000);
+    std::string data;
+
+    data.append(make_frame(coke::WS_OPCODE_TEXT, true, "hello"));
+    data.append(make_frame(coke::WS_OPCODE_BINARY, false, "frag1-"));
+    data.append(make_frame(coke::WS_OPCODE_PING, true, "ping"));
+    data.append(make_frame(coke::WS_OPCODE_CONTINUATION, false, "frag2-"));
+    data.append(make_frame(coke::WS_OPCODE_CONTINUATION, true, big));
+    data.append(make_frame(coke::WS_OPCODE_CLOSE, true, "\x03\xe8" "bye"));
+
+    for (std::size_t step : {std::size_t(1), std::size_t(7), data.size()}) {
+        coke::WebSocketParser parser(1024 * 1024, true);
+        std::vector<coke::WebSocketMessage> msgs;
+
+        EXPECT_EQ(parse_all(parser, data, step, msgs), 0);
+        ASSERT_EQ(msgs.size(), 4u);
+
+        EXPECT_TRUE(msgs[0].is_text());
+        EXPECT_EQ(msgs[0].view(), "hello");
+
+        EXPECT_EQ(msgs[1].get_opcode(), coke::WS_OPCODE_PING);
+        EXPECT_EQ(msgs[1].view(), "ping");
+
+        EXPECT_TRUE(msgs[2].is_binary());
+        EXPECT_EQ(msgs[2].view(), "frag1-frag2-" + big);
+
+        EXPECT_EQ(msgs[3].get_opcode(), coke::WS_OPCODE_CLOSE);
+        EXPECT_EQ(msgs[3].get_close_code(), coke::WS_CLOSE_NORMAL);
+        EXPECT_EQ(msgs[3].get_close_reason(), "bye");
+    }
+}
+
+TEST(WEBSOCKET, parser_error) {
+    auto parse = [](std::string_view data, std::size_t max_size) {
+        coke::WebSocketParser parser(max_size, true);
+        std::vector<coke::WebSocketMessage> msgs;
+        return parse_all(parser, data, data.size(), msgs);
+    };
+
+    char header[coke::WS_MAX_HEADER_SIZE];
+    std::size_t n;
+
+    // Unmasked frame from client
+    n = coke::websocket_frame_header(header, coke::WS_OPCODE_TEXT, true, 0);
+    EXPECT_EQ(parse(std::string_view(header, n), 1024), -EBADMSG);
+
+    // Continuation without a fragmented message
+    EXPECT_EQ(parse(make_frame(coke::WS_OPCODE_CONTINUATION, true, "x"), 1024),
+              -EBADMSG);
+
+    // Fragmented control frame
+    EXPECT_EQ(parse(make_frame(coke::WS_OPCODE_PING, false, "x"), 1024),
+              -EBADMSG);
+
+    // Unknown opcode
+    EXPECT_EQ(parse(make_frame(3, true, "x"), 1024), -EBADMSG);
+
+    // Too large, the fragments are counted together
+    std::string data = make_frame(coke::WS_OPCODE_TEXT, false, "12345678");
+    data.append(make_frame(coke::WS_OPCODE_CONTINUATION, true, "12345678"));
+    EXPECT_EQ(parse(data, 8), -EMSGSIZE);
+    EXPECT_EQ(parse(data, 16), 0);
+}
+
+TEST(WEBSOCKET, buffer_pool) {
+    {
+        coke::WebSocketMessage msg;
+        msg.append("hello", 5);
+    }
+
+    coke::WebSocketBufferStats before = coke::get_websocket_buffer_stats();
+
+    for (int i = 0; i < 10; i++) {
+        coke::WebSocketMessage msg;
+        msg.append("hello", 5);
+        EXPECT_EQ(msg.view(), "hello");
+    }
+
+    coke::WebSocketBufferStats after = coke::get_websocket_buffer_stats();
+    EXPECT_EQ(after.hits - before.hits, 10u);
+    EXPECT_EQ(after.misses, before.misses);
+}
+
+TEST(WEBSOCKET, echo) {
+    coke::sync_wait(test_echo(10), test_echo(100 * 1000));
+}
+
+int main(int argc, char *argv[]) {
+    coke::GlobalSettings s;
+    s.poller_threads = 2;
+    s.handler_threads = 4;
+    s.compute_threads = 2;
+    coke::library_init(s);
+
+    testing::InitGoogleTest(&argc, argv);
+
+    coke::HttpServerParams params;
+    params.receive_timeout = -1;
+
+    coke::WebSocketServer server(params, coke::WebSocketParams(), ws_echo);
+
+    for (int i = 8100; i < 8110; i++) {
+        if (server.start(i) == 0) {
+            ws_port = i;
+            break;
+        }
+    }
+
+    if (ws_port == -1) {
+        EXPECT_NE(ws_port, -1) << "Server start failed " << errno;
+        return -1;
+    }
+
+    int ret = RUN_ALL_TESTS();
+    server.stop();
+
+    return ret;
+}
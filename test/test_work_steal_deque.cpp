@@ -0,0 +1,96 @@
+/**
+ * Copyright 2024 Coke Project (https://github.com/kedixa/coke)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Authors: kedixa (https://github.com/kedixa)
+*/
+
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <gtest/gtest.h>
+
+#include "coke/work_steal_deque.h"
+
+TEST(WORK_STEAL_DEQUE, order) {
+    coke::WorkStealDeque<int> dq(2);
+
+    for (int i = 0; i < 10; i++)
+        dq.push(i);
+    EXPECT_EQ(dq.size(), 10u);
+
+    // The owner pops the last pushed, the thieves steal the first pushed
+    EXPECT_EQ(dq.pop(), 9);
+    EXPECT_EQ(dq.steal(), 0);
+    EXPECT_EQ(dq.pop(), 8);
+    EXPECT_EQ(dq.steal(), 1);
+
+    while (dq.pop())
+        ;
+
+    EXPECT_TRUE(dq.empty());
+    EXPECT_FALSE(dq.pop().has_value());
+    EXPECT_FALSE(dq.steal().has_value());
+}
+
+TEST(WORK_STEAL_DEQUE, concurrent_steal) {
+    constexpr int N = 100000;
+    constexpr int THIEVES = 4;
+
+    coke::WorkStealDeque<int> dq;
+    std::vector<std::atomic<int>> taken(N);
+    std::atomic<bool> done{false};
+    std::vector<std::thread> thieves;
+
+    for (int i = 0; i < THIEVES; i++) {
+        thieves.emplace_back([&]() {
+            while (!done.load() || !dq.empty()) {
+                auto x = dq.steal();
+                if (x)
+                    taken[*x].fetch_add(1);
+            }
+        });
+    }
+
+    for (int i = 0; i < N; i++) {
+        dq.push(i);
+
+        if (i % 3 == 0) {
+            auto x = dq.pop();
+            if (x)
+                taken[*x].fetch_add(1);
+        }
+    }
+
+    while (auto x = dq.pop())
+        taken[*x].fetch_add(1);
+
+    done.store(true);
+    for (auto &t : thieves)
+        t.join();
+
+    int bad = 0;
+    for (int i = 0; i < N; i++) {
+        if (taken[i].load() != 1)
+            ++bad;
+    }
+
+    EXPECT_EQ(bad, 0);
+}
+
+int main(int argc, char *argv[]) {
+    testing::InitGoogleTest(&argc, argv);
+
+    return RUN_ALL_TESTS();
+}